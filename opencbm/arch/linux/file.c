@@ -9,8 +9,16 @@
 
 #include "arch.h"
 
+#include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
+struct arch_filemap_s
+{
+    void  *data;
+    size_t size;
+};
+
 
 /*! \brief Obtain the size of a given file
 
@@ -44,3 +52,68 @@ int arch_filesize(const char *Filename, off_t *Filesize)
 
     return ret;
 }
+
+/*! \brief Map the beginning of a file into memory
+
+ \param Map
+   Pointer to a location which will hold the mapping on success.
+   It must be given to arch_file_unmap() later.
+
+ \param Fd
+   The descriptor of the open file. The file must be at least
+   Size bytes long, and it must stay open while it is mapped.
+
+ \param Size
+   The number of bytes to map, starting at offset 0.
+
+ \param Writable
+   If not 0, the mapping is writable, and everything written into
+   it ends up in the file. The file must be opened for writing then.
+
+ \param Data
+   Pointer to a location which will hold the address of the
+   mapped bytes on success.
+
+ \return
+   0 on success, everything else denotes an error. In this case,
+   the caller has to use the usual file functions instead.
+*/
+
+int arch_file_map(ARCH_FILEMAP **Map, int Fd, size_t Size, int Writable, unsigned char **Data)
+{
+    ARCH_FILEMAP *map;
+
+    if (Size == 0)
+        return 1;
+
+    map = malloc(sizeof(*map));
+    if (map == NULL)
+        return 1;
+
+    map->size = Size;
+    map->data = mmap(NULL, Size, PROT_READ | (Writable ? PROT_WRITE : 0),
+                     MAP_SHARED, Fd, 0);
+    if (map->data == MAP_FAILED)
+    {
+        free(map);
+        return 1;
+    }
+
+    *Map = map;
+    *Data = map->data;
+    return 0;
+}
+
+/*! \brief Remove a file mapping
+
+ All changes are written back to the file.
+
+ \param Map
+   The mapping, as returned by arch_file_map().
+*/
+
+void arch_file_unmap(ARCH_FILEMAP *Map)
+{
+    munmap(Map->data, Map->size);
+    free(Map);
+}
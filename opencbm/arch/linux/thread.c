@@ -0,0 +1,216 @@
+/*
+ *      This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file arch/linux/thread.c \n
+** \n
+** \brief Threads, counting semaphores, a global lock and a clock
+**
+** The semaphores are built on a mutex and a condition variable,
+** as unnamed POSIX semaphores are not available on all supported
+** platforms (e.g., Mac OS X).
+**
+****************************************************************/
+
+#include "arch.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct arch_thread_s
+{
+    pthread_t        thread;
+    ARCH_THREAD_FUNC func;
+    void            *context;
+};
+
+struct arch_semaphore_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    unsigned int    count;
+};
+
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *
+thread_start(void *Arg)
+{
+    ARCH_THREAD *thread = Arg;
+
+    thread->func(thread->context);
+    return NULL;
+}
+
+/*! \brief Start a new thread
+
+ \param Thread
+   Pointer to a location which will hold the thread handle on
+   success. It must be given to arch_thread_join() later.
+
+ \param Func
+   The function to execute in the new thread.
+
+ \param Context
+   Parameter given to Func.
+
+ \return
+   0 on success, everything else denotes an error.
+*/
+int
+arch_thread_create(ARCH_THREAD **Thread, ARCH_THREAD_FUNC Func, void *Context)
+{
+    ARCH_THREAD *thread;
+
+    thread = malloc(sizeof(*thread));
+    if (thread == NULL)
+        return 1;
+
+    thread->func = Func;
+    thread->context = Context;
+
+    if (pthread_create(&thread->thread, NULL, thread_start, thread) != 0)
+    {
+        free(thread);
+        return 1;
+    }
+
+    *Thread = thread;
+    return 0;
+}
+
+/*! \brief Wait for a thread to end, and free its handle
+
+ \param Thread
+   The thread handle, as returned from arch_thread_create().
+*/
+void
+arch_thread_join(ARCH_THREAD *Thread)
+{
+    pthread_join(Thread->thread, NULL);
+    free(Thread);
+}
+
+/*! \brief Create a counting semaphore
+
+ \param Semaphore
+   Pointer to a location which will hold the semaphore on success.
+
+ \param InitialCount
+   The initial count of the semaphore.
+
+ \return
+   0 on success, everything else denotes an error.
+*/
+int
+arch_semaphore_create(ARCH_SEMAPHORE **Semaphore, unsigned int InitialCount)
+{
+    ARCH_SEMAPHORE *sem;
+
+    sem = malloc(sizeof(*sem));
+    if (sem == NULL)
+        return 1;
+
+    if (pthread_mutex_init(&sem->mutex, NULL) != 0)
+    {
+        free(sem);
+        return 1;
+    }
+    if (pthread_cond_init(&sem->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&sem->mutex);
+        free(sem);
+        return 1;
+    }
+    sem->count = InitialCount;
+
+    *Semaphore = sem;
+    return 0;
+}
+
+/*! \brief Decrement a semaphore, waiting until its count is not zero
+
+ \param Semaphore
+   The semaphore to wait for.
+*/
+void
+arch_semaphore_wait(ARCH_SEMAPHORE *Semaphore)
+{
+    pthread_mutex_lock(&Semaphore->mutex);
+    while (Semaphore->count == 0)
+        pthread_cond_wait(&Semaphore->cond, &Semaphore->mutex);
+    Semaphore->count--;
+    pthread_mutex_unlock(&Semaphore->mutex);
+}
+
+/*! \brief Increment a semaphore, waking up one waiter
+
+ \param Semaphore
+   The semaphore to post.
+*/
+void
+arch_semaphore_post(ARCH_SEMAPHORE *Semaphore)
+{
+    pthread_mutex_lock(&Semaphore->mutex);
+    Semaphore->count++;
+    pthread_cond_signal(&Semaphore->cond);
+    pthread_mutex_unlock(&Semaphore->mutex);
+}
+
+/*! \brief Free a semaphore
+
+ \param Semaphore
+   The semaphore to free. Nobody may wait for it anymore.
+*/
+void
+arch_semaphore_destroy(ARCH_SEMAPHORE *Semaphore)
+{
+    pthread_cond_destroy(&Semaphore->cond);
+    pthread_mutex_destroy(&Semaphore->mutex);
+    free(Semaphore);
+}
+
+/*! \brief Acquire the process-wide lock
+
+ This lock needs no initialisation, so it can be used to protect
+ short critical sections in static data, without having to set up
+ anything first. It must not be taken recursively.
+*/
+void
+arch_global_lock(void)
+{
+    pthread_mutex_lock(&global_lock);
+}
+
+/*! \brief Release the process-wide lock
+*/
+void
+arch_global_unlock(void)
+{
+    pthread_mutex_unlock(&global_lock);
+}
+
+/*! \brief Read a clock which counts microseconds
+
+ The clock is not related to the time of day, and it wraps around.
+ It is only meant to measure how long something takes, by
+ subtracting two readings.
+
+ \return
+   The current reading of the clock, in microseconds.
+*/
+unsigned long
+arch_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long) ts.tv_sec * 1000000ul + (unsigned long) (ts.tv_nsec / 1000);
+}
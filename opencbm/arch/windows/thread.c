@@ -0,0 +1,202 @@
+/*
+ *      This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file arch/windows/thread.c \n
+** \n
+** \brief Threads, counting semaphores, a global lock and a clock
+**
+****************************************************************/
+
+#include "arch.h"
+
+#include <windows.h>
+#include <stdlib.h>
+
+struct arch_thread_s
+{
+    HANDLE           thread;
+    ARCH_THREAD_FUNC func;
+    void            *context;
+};
+
+struct arch_semaphore_s
+{
+    HANDLE semaphore;
+};
+
+static volatile LONG global_lock = 0;
+
+static DWORD WINAPI
+thread_start(LPVOID Arg)
+{
+    ARCH_THREAD *thread = Arg;
+
+    thread->func(thread->context);
+    return 0;
+}
+
+/*! \brief Start a new thread
+
+ \param Thread
+   Pointer to a location which will hold the thread handle on
+   success. It must be given to arch_thread_join() later.
+
+ \param Func
+   The function to execute in the new thread.
+
+ \param Context
+   Parameter given to Func.
+
+ \return
+   0 on success, everything else denotes an error.
+*/
+int
+arch_thread_create(ARCH_THREAD **Thread, ARCH_THREAD_FUNC Func, void *Context)
+{
+    ARCH_THREAD *thread;
+    DWORD threadId;
+
+    thread = malloc(sizeof(*thread));
+    if (thread == NULL)
+        return 1;
+
+    thread->func = Func;
+    thread->context = Context;
+
+    thread->thread = CreateThread(NULL, 0, thread_start, thread, 0, &threadId);
+    if (thread->thread == NULL)
+    {
+        free(thread);
+        return 1;
+    }
+
+    *Thread = thread;
+    return 0;
+}
+
+/*! \brief Wait for a thread to end, and free its handle
+
+ \param Thread
+   The thread handle, as returned from arch_thread_create().
+*/
+void
+arch_thread_join(ARCH_THREAD *Thread)
+{
+    WaitForSingleObject(Thread->thread, INFINITE);
+    CloseHandle(Thread->thread);
+    free(Thread);
+}
+
+/*! \brief Create a counting semaphore
+
+ \param Semaphore
+   Pointer to a location which will hold the semaphore on success.
+
+ \param InitialCount
+   The initial count of the semaphore.
+
+ \return
+   0 on success, everything else denotes an error.
+*/
+int
+arch_semaphore_create(ARCH_SEMAPHORE **Semaphore, unsigned int InitialCount)
+{
+    ARCH_SEMAPHORE *sem;
+
+    sem = malloc(sizeof(*sem));
+    if (sem == NULL)
+        return 1;
+
+    sem->semaphore = CreateSemaphore(NULL, InitialCount, MAXLONG, NULL);
+    if (sem->semaphore == NULL)
+    {
+        free(sem);
+        return 1;
+    }
+
+    *Semaphore = sem;
+    return 0;
+}
+
+/*! \brief Decrement a semaphore, waiting until its count is not zero
+
+ \param Semaphore
+   The semaphore to wait for.
+*/
+void
+arch_semaphore_wait(ARCH_SEMAPHORE *Semaphore)
+{
+    WaitForSingleObject(Semaphore->semaphore, INFINITE);
+}
+
+/*! \brief Increment a semaphore, waking up one waiter
+
+ \param Semaphore
+   The semaphore to post.
+*/
+void
+arch_semaphore_post(ARCH_SEMAPHORE *Semaphore)
+{
+    ReleaseSemaphore(Semaphore->semaphore, 1, NULL);
+}
+
+/*! \brief Free a semaphore
+
+ \param Semaphore
+   The semaphore to free. Nobody may wait for it anymore.
+*/
+void
+arch_semaphore_destroy(ARCH_SEMAPHORE *Semaphore)
+{
+    CloseHandle(Semaphore->semaphore);
+    free(Semaphore);
+}
+
+/*! \brief Acquire the process-wide lock
+
+ This lock needs no initialisation, so it can be used to protect
+ short critical sections in static data, without having to set up
+ anything first. It must not be taken recursively.
+*/
+void
+arch_global_lock(void)
+{
+    while (InterlockedCompareExchange(&global_lock, 1, 0) != 0)
+        Sleep(0);
+}
+
+/*! \brief Release the process-wide lock
+*/
+void
+arch_global_unlock(void)
+{
+    InterlockedExchange(&global_lock, 0);
+}
+
+/*! \brief Read a clock which counts microseconds
+
+ The clock is not related to the time of day, and it wraps around.
+ It is only meant to measure how long something takes, by
+ subtracting two readings.
+
+ \return
+   The current reading of the clock, in microseconds.
+*/
+unsigned long
+arch_time_us(void)
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (!QueryPerformanceFrequency(&frequency) || !QueryPerformanceCounter(&counter))
+        return GetTickCount() * 1000ul;
+
+    return (unsigned long) (counter.QuadPart / frequency.QuadPart * 1000000
+        + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+}
@@ -0,0 +1,118 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+*/
+
+#include "cbmbench.h"
+#include "d64copy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define D64_TRACKS  35
+
+static const char * const modes[] =
+{
+    "original", "serial1", "serial2", "parallel", NULL
+};
+
+
+static int status_cb(d64copy_status status)
+{
+    return 0;
+}
+
+
+static int sectors(int track)
+{
+    return d64copy_sector_count(0, track);
+}
+
+
+/* an empty disk, so the libraries which look at the BAM find a usable one */
+static void format(unsigned char *image)
+{
+    unsigned char *bam = image;
+    int i, tr;
+
+    for(tr = 1; tr < 18; tr++)
+    {
+        bam += sectors(tr) * 256;
+    }
+
+    memset(bam, 0, 2 * 256);
+    bam[0] = 18;
+    bam[1] = 1;
+    bam[2] = 'A';
+    for(tr = 1; tr <= D64_TRACKS; tr++)
+    {
+        unsigned char *e = &bam[4 * tr];
+        unsigned int map = (1u << sectors(tr)) - 1;
+
+        if(tr == 18)
+        {
+            map &= ~3u;
+        }
+        e[0] = 0;
+        for(i = 0; i < sectors(tr); i++)
+        {
+            e[0] += (map >> i) & 1;
+        }
+        e[1] = map & 0xff;
+        e[2] = (map >> 8) & 0xff;
+        e[3] = (map >> 16) & 0xff;
+    }
+    memset(&bam[0x90], 0xa0, 0x1b);
+    memcpy(&bam[0x90], "CBMBENCH", 8);
+    memcpy(&bam[0xa2], "CB 2A", 5);
+    bam[256 + 1] = 0xff;
+}
+
+
+static int copy(CBM_FILE fd, const bench_params *params)
+{
+    d64copy_settings *settings;
+    int rv;
+
+    settings = d64copy_get_default_settings();
+    if(settings == NULL)
+    {
+        return -1;
+    }
+
+    settings->transfer_mode = d64copy_get_transfer_mode_index(params->mode);
+    settings->warp          = params->warp;
+    settings->end_track     = params->end_track;
+    settings->drive_type    = cbm_dt_cbm1541;
+    if(params->interleave > 0)
+    {
+        settings->interleave = params->interleave;
+    }
+
+    if(settings->transfer_mode < 0)
+    {
+        rv = -1;
+    }
+    else if(params->write)
+    {
+        rv = d64copy_write_image(fd, settings, params->image, params->drive,
+                                 bench_message, status_cb);
+    }
+    else
+    {
+        rv = d64copy_read_image(fd, settings, params->drive, params->image,
+                                bench_message, status_cb);
+    }
+
+    free(settings);
+    return rv;
+}
+
+
+const bench_lib bench_d64copy =
+{
+    "d64copy", modes, 1, "d64", D64_TRACKS, sectors, format, copy
+};
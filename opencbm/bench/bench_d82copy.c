@@ -0,0 +1,77 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+*/
+
+#include "cbmbench.h"
+#include "d82copy.h"
+
+#include <stdlib.h>
+
+static const char * const modes[] =
+{
+    "original", NULL
+};
+
+
+static int status_cb(d82copy_status status)
+{
+    return 0;
+}
+
+
+static int sectors(int track)
+{
+    return d82copy_sector_count(1, track);
+}
+
+
+static int copy(CBM_FILE fd, const bench_params *params)
+{
+    d82copy_settings *settings;
+    int rv;
+
+    settings = d82copy_get_default_settings();
+    if(settings == NULL)
+    {
+        return -1;
+    }
+
+    settings->transfer_mode = d82copy_get_transfer_mode_index(params->mode);
+    settings->warp          = params->warp;
+    settings->end_track     = params->end_track;
+    settings->drive_type    = cbm_dt_cbm8250;
+    settings->two_sided     = 1;
+    if(params->interleave > 0)
+    {
+        settings->interleave = params->interleave;
+    }
+
+    if(settings->transfer_mode < 0)
+    {
+        rv = -1;
+    }
+    else if(params->write)
+    {
+        rv = d82copy_write_image(fd, settings, params->image, params->drive,
+                                 bench_message, status_cb);
+    }
+    else
+    {
+        rv = d82copy_read_image(fd, settings, params->drive, params->image,
+                                bench_message, status_cb);
+    }
+
+    free(settings);
+    return rv;
+}
+
+
+/* a .d82 image on the 8250, which has no fast transfer mode */
+const bench_lib bench_d82copy =
+{
+    "d82copy", modes, 0, "d82", D82_TRACKS, sectors, NULL, copy
+};
@@ -0,0 +1,77 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+*/
+
+#include "cbmbench.h"
+#include "imgcopy.h"
+
+#include <stdlib.h>
+
+/* the burst transfer (serial-3) is not emulated by the vdrive plugin */
+static const char * const modes[] =
+{
+    "original", "serial1", "serial2", NULL
+};
+
+
+static int status_cb(imgcopy_status status)
+{
+    return 0;
+}
+
+
+static int sectors(int track)
+{
+    return D81_MAX_SECTORS;
+}
+
+
+static int copy(CBM_FILE fd, const bench_params *params)
+{
+    imgcopy_settings *settings;
+    int rv;
+
+    settings = imgcopy_get_default_settings();
+    if(settings == NULL)
+    {
+        return -1;
+    }
+
+    settings->transfer_mode = imgcopy_get_transfer_mode_index(params->mode);
+    settings->warp          = params->warp;
+    settings->end_track     = params->end_track;
+    settings->drive_type    = cbm_dt_cbm1581;
+    if(params->interleave > 0)
+    {
+        settings->interleave = params->interleave;
+    }
+
+    if(settings->transfer_mode < 0)
+    {
+        rv = -1;
+    }
+    else if(params->write)
+    {
+        rv = imgcopy_write_image(fd, settings, params->image, params->drive,
+                                 bench_message, status_cb);
+    }
+    else
+    {
+        rv = imgcopy_read_image(fd, settings, params->drive, params->image,
+                                bench_message, status_cb);
+    }
+
+    free(settings);
+    return rv;
+}
+
+
+/* a .d81 image on the 1581 */
+const bench_lib bench_imgcopy =
+{
+    "imgcopy", modes, 0, "d81", D81_TRACKS, sectors, NULL, copy
+};
@@ -0,0 +1,476 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*
+ * cbmbench: measure the disk copy libraries without a drive
+ *
+ * Every copy runs against the vdrive plugin, which emulates the drive
+ * the image is made for (a 1541 for libd64copy, a 1581 for libimgcopy
+ * and a 8250 for libd82copy) and the adapter it is connected to with a
+ * latency model. The time it
+ * reports is emulated, so the results do not depend on the machine,
+ * and a regression shows up as a changed number in the output.
+ *
+ * The libraries give the drive time with arch_usleep() in some places,
+ * 20 ms a block in the serial and parallel modes without warp. These
+ * sleeps are counted in the emulated time instead, see usleep() below.
+ */
+
+#include "opencbm.h"
+#include "opencbm-plugin.h"
+#include "cbmbench.h"
+
+#include "arch.h"
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef VDRIVE_PLUGIN
+# define VDRIVE_PLUGIN "libopencbm-vdrive.so"
+#endif
+
+/* the largest image, a .d82 */
+#define IMAGE_SIZE  (4166 * 256)
+
+/*
+ * libcbmcopy is missing: it copies files, but the DOS of the vdrive
+ * plugin only opens buffers ("#") and answers any file name with
+ * 62, FILE NOT FOUND. Nor does the plugin know the turbo programs of
+ * libcbmcopy.
+ */
+static const bench_lib *libs[] =
+{
+    &bench_d64copy, &bench_imgcopy, &bench_d82copy, NULL
+};
+
+/* setable via command line */
+static const char *plugin = VDRIVE_PLUGIN;
+static const char *model = NULL;
+static const char *only_lib = NULL;
+static const char *only_mode = NULL;
+static const char *interleaves = "0,1,5,10";
+static int end_track = 0;
+static int verbose = 0;
+static int keep = 0;
+
+/* other globals */
+static char tmpdir[] = "/tmp/cbmbench.XXXXXX";
+static unsigned char reference[IMAGE_SIZE];
+
+/* the drive of the current copy, for usleep() */
+static CBM_FILE sleep_fd;
+static opencbm_plugin_vdrive_sleep_t *vdrive_sleep;
+
+
+/*
+ * This takes the place of usleep() of the C library for the copy
+ * libraries linked in: a sleep lets the emulated time pass, but not the
+ * real one. Otherwise, a run of all modes of libimgcopy alone would
+ * sleep for more than a quarter of an hour.
+ */
+int usleep(useconds_t usec)
+{
+    if(vdrive_sleep != NULL)
+    {
+        vdrive_sleep(sleep_fd, usec);
+    }
+    return 0;
+}
+
+
+static void help()
+{
+    printf(
+"Usage: cbmbench [OPTION]...\n"
+"Measure the transfer modes of the disk copy libraries with a virtual drive\n"
+"\n"
+"Options:\n"
+"  -h, --help                display this help and exit\n"
+"  -V, --version             display version information and exit\n"
+"  -p, --plugin=FILE         the vdrive plugin (default: " VDRIVE_PLUGIN ")\n"
+"  -o, --model=OPTIONS       latency model of the vdrive plugin, for example\n"
+"                            usb=1000,s1=150 (times in microseconds), or\n"
+"                            latency=0 for the time of the host only\n"
+"  -l, --lib=NAME            only measure this library (d64copy, imgcopy,\n"
+"                            d82copy)\n"
+"  -t, --transfer=MODE       only measure this transfer mode (original,\n"
+"                            serial1, serial2, parallel)\n"
+"  -i, --interleave=LIST     interleaves to measure, 0 is the default of the\n"
+"                            library (default: 0,1,5,10)\n"
+"  -e, --end-track=TRACK     copy the tracks up to this one (default: all\n"
+"                            tracks of the image)\n"
+"  -k, --keep                keep the temporary directory\n"
+"  -v, --verbose             show the messages of the libraries\n"
+"\n"
+"The results are written as tab separated values, one line for each\n"
+"library, transfer mode, direction, warp and interleave. The time is\n"
+"emulated, the host CPU time is the real one.\n"
+"\n");
+}
+
+static void hint(char *s)
+{
+    fprintf(stderr, "Try `%s' -h for more information.\n", s);
+}
+
+
+void bench_message(int severity, const char *format, ...)
+{
+    va_list args;
+
+    if(severity == 0 || verbose)
+    {
+        va_start(args, format);
+        fprintf(stderr, "  ");
+        vfprintf(stderr, format, args);
+        fprintf(stderr, "\n");
+        va_end(args);
+    }
+}
+
+
+static int blocks(const bench_lib *lib, int tracks)
+{
+    int tr, n = 0;
+
+    for(tr = 1; tr <= tracks; tr++)
+    {
+        n += lib->sectors(tr);
+    }
+    return n;
+}
+
+
+static char *path(const char *name)
+{
+    static char buf[3][256];
+    static int next;
+    char *p = buf[next++ % 3];
+
+    snprintf(p, sizeof(buf[0]), "%s/%s", tmpdir, name);
+    return p;
+}
+
+/* the image called name, of the type the library works on */
+static char *image_path(const bench_lib *lib, const char *name)
+{
+    char file[64];
+
+    snprintf(file, sizeof(file), "%s.%s", name, lib->image_type);
+    return path(file);
+}
+
+static int write_file(const char *name, const unsigned char *data, size_t size)
+{
+    FILE *f = fopen(name, "wb");
+    int rv = -1;
+
+    if(f != NULL)
+    {
+        rv = fwrite(data, 1, size, f) == size ? 0 : -1;
+        rv |= fclose(f);
+    }
+    if(rv)
+    {
+        arch_error(0, arch_get_errno(), "%s", name);
+    }
+    return rv;
+}
+
+/* 0 if the file starts with the first blocks of the reference image */
+static int compare_file(const char *name, size_t size)
+{
+    static unsigned char data[IMAGE_SIZE];
+    FILE *f = fopen(name, "rb");
+    size_t n = 0;
+
+    if(f != NULL)
+    {
+        n = fread(data, 1, size, f);
+        fclose(f);
+    }
+    return n == size && memcmp(data, reference, size) == 0 ? 0 : -1;
+}
+
+
+/*
+ * The reference image is the same in every run: a LCG fills the
+ * blocks, and the library may write a valid directory track.
+ */
+static int make_reference(const bench_lib *lib)
+{
+    static const unsigned char empty[IMAGE_SIZE];
+    unsigned int seed = 0x1541;
+    size_t size = blocks(lib, lib->tracks) * 256;
+    size_t i;
+
+    for(i = 0; i < size; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        reference[i] = (unsigned char) (seed >> 16);
+    }
+    if(lib->format)
+    {
+        lib->format(reference);
+    }
+
+    return write_file(image_path(lib, "reference"), reference, size)
+        || write_file(image_path(lib, "empty"), empty, size);
+}
+
+static int setup(void)
+{
+    FILE *f;
+
+    if(mkdtemp(tmpdir) == NULL)
+    {
+        arch_error(0, arch_get_errno(), "%s", tmpdir);
+        return -1;
+    }
+
+    /* a configuration of our own, and no drive cache of the user */
+    if(mkdir(path("etc"), 0700) != 0
+       || (f = fopen(path("etc/opencbm.conf"), "w")) == NULL)
+    {
+        arch_error(0, arch_get_errno(), "%s", path("etc/opencbm.conf"));
+        return -1;
+    }
+    fprintf(f, "[plugins]\ndefault=vdrive\n\n[vdrive]\nlocation=%s\n", plugin);
+    fclose(f);
+
+    setenv("OPENCBM_HOME", tmpdir, 1);
+    setenv("HOME", tmpdir, 1);
+
+    return 0;
+}
+
+static void cleanup(void)
+{
+    static const char *files[] =
+    {
+        "etc/opencbm.conf", ".opencbm.cache", NULL
+    };
+    static const char *images[] =
+    {
+        "reference", "empty", "drive", "host", NULL
+    };
+    const bench_lib **lib;
+    int i;
+
+    if(keep)
+    {
+        fprintf(stderr, "files kept in %s\n", tmpdir);
+        return;
+    }
+    for(i = 0; files[i]; i++)
+    {
+        unlink(path(files[i]));
+    }
+    for(lib = libs; *lib; lib++)
+    {
+        for(i = 0; images[i]; i++)
+        {
+            unlink(image_path(*lib, images[i]));
+        }
+    }
+    rmdir(path("etc"));
+    rmdir(tmpdir);
+}
+
+
+static int copy_file(const char *from, const char *to, size_t size)
+{
+    static unsigned char data[IMAGE_SIZE];
+    FILE *f = fopen(from, "rb");
+    size_t n = 0;
+
+    if(f != NULL)
+    {
+        n = fread(data, 1, size, f);
+        fclose(f);
+    }
+    return n == size ? write_file(to, data, n) : -1;
+}
+
+static void run(const bench_lib *lib, const char *mode, int write, int warp, int interleave)
+{
+    opencbm_plugin_vdrive_get_stats_t *get_stats;
+    opencbm_plugin_vdrive_stats_t stats;
+    bench_params params;
+    char image[256];
+    char adapter[512];
+    CBM_FILE fd;
+    clock_t cpu;
+    int tracks = end_track && end_track < lib->tracks ? end_track : lib->tracks;
+    int n = blocks(lib, tracks);
+    int ok;
+
+    params.mode       = mode;
+    params.warp       = warp;
+    params.interleave = interleave;
+    params.end_track  = tracks;
+    params.write      = write;
+    params.image      = image;
+    params.drive      = 8;
+
+    /* the drive gets an empty disk to write on, or the reference to read */
+    strcpy(image, image_path(lib, write ? "reference" : "host"));
+    unlink(image_path(lib, "host"));
+    if(copy_file(image_path(lib, write ? "empty" : "reference"),
+                 image_path(lib, "drive"), blocks(lib, lib->tracks) * 256))
+    {
+        return;
+    }
+
+    snprintf(adapter, sizeof(adapter), "vdrive:%s%s%s",
+             image_path(lib, "drive"), model ? "," : "", model ? model : "");
+    if(cbm_driver_open_ex(&fd, adapter) != 0)
+    {
+        fprintf(stderr, "cannot open %s\n", adapter);
+        exit(1);
+    }
+    get_stats = cbm_get_plugin_function_address("opencbm_plugin_vdrive_get_stats");
+    vdrive_sleep = cbm_get_plugin_function_address("opencbm_plugin_vdrive_sleep");
+    if(get_stats == NULL || vdrive_sleep == NULL)
+    {
+        fprintf(stderr, "%s is not the vdrive plugin\n", plugin);
+        exit(1);
+    }
+    sleep_fd = fd;
+
+    cpu = clock();
+    ok = lib->copy(fd, &params) == n;
+    cpu = clock() - cpu;
+    get_stats(fd, &stats);
+
+    /* the image is written back when the driver is closed */
+    vdrive_sleep = NULL;
+    cbm_driver_close(fd);
+
+    ok = ok && compare_file(image_path(lib, write ? "drive" : "host"), n * 256) == 0;
+
+    printf("%s\t%s\t%s\t%d\t%d\t%d\t%.3f\t%.1f\t%.2f\t%.2f\t%.1f\t%s\n",
+           lib->name, mode, write ? "write" : "read", warp, interleave, n,
+           stats.VirtualTime / 1e9,
+           stats.VirtualTime ? n / (stats.VirtualTime / 1e9) : 0.0,
+           (double) stats.Transactions / n,
+           (double) stats.LineOperations / n,
+           (double) cpu * 1e6 / CLOCKS_PER_SEC / n,
+           ok ? "ok" : "FAILED");
+    fflush(stdout);
+}
+
+
+int ARCH_MAINDECL main(int argc, char *argv[])
+{
+    const bench_lib **lib;
+    const char * const *mode;
+    const char *p;
+    int option, write, warp, interleave;
+
+    struct option longopts[] =
+    {
+        { "help"       , no_argument      , NULL, 'h' },
+        { "version"    , no_argument      , NULL, 'V' },
+        { "plugin"     , required_argument, NULL, 'p' },
+        { "model"      , required_argument, NULL, 'o' },
+        { "lib"        , required_argument, NULL, 'l' },
+        { "transfer"   , required_argument, NULL, 't' },
+        { "interleave" , required_argument, NULL, 'i' },
+        { "end-track"  , required_argument, NULL, 'e' },
+        { "keep"       , no_argument      , NULL, 'k' },
+        { "verbose"    , no_argument      , NULL, 'v' },
+        { NULL         , 0                , NULL, 0   }
+    };
+
+    const char shortopts[] ="hVp:o:l:t:i:e:kv";
+
+    while((option = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1)
+    {
+        switch(option)
+        {
+            case 'h': help();
+                      return 0;
+            case 'V': printf("cbmbench %s\n", OPENCBM_VERSION);
+                      return 0;
+            case 'p': plugin = optarg;
+                      break;
+            case 'o': model = optarg;
+                      break;
+            case 'l': only_lib = optarg;
+                      break;
+            case 't': only_mode = optarg;
+                      break;
+            case 'i': interleaves = optarg;
+                      break;
+            case 'e': end_track = atoi(optarg);
+                      if(end_track < 1)
+                      {
+                          fprintf(stderr, "invalid end track: %s\n", optarg);
+                          return 1;
+                      }
+                      break;
+            case 'k': keep = 1;
+                      break;
+            case 'v': verbose = 1;
+                      break;
+            default : hint(argv[0]);
+                      return 1;
+        }
+    }
+
+    if(setup())
+    {
+        cleanup();
+        return 1;
+    }
+
+    printf("lib\tmode\tdirection\twarp\tinterleave\tblocks\tseconds"
+           "\tblocks_per_s\ttransactions_per_block\tline_ops_per_block"
+           "\tcpu_us_per_block\tresult\n");
+
+    for(lib = libs; *lib; lib++)
+    {
+        if(only_lib && strcmp(only_lib, (*lib)->name))
+        {
+            continue;
+        }
+        if(make_reference(*lib))
+        {
+            cleanup();
+            return 1;
+        }
+        for(mode = (*lib)->modes; *mode; mode++)
+        {
+            if(only_mode && strcmp(only_mode, *mode))
+            {
+                continue;
+            }
+            for(write = 1; write >= 0; write--)
+            {
+                for(warp = 0; warp <= ((*lib)->warp && strcmp(*mode, "original")); warp++)
+                {
+                    for(p = interleaves; *p; p += strcspn(p, ","), p += *p == ',')
+                    {
+                        interleave = atoi(p);
+                        run(*lib, *mode, write, warp, interleave);
+                    }
+                }
+            }
+        }
+    }
+
+    cleanup();
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+*/
+
+#ifndef CBMBENCH_H
+#define CBMBENCH_H
+
+#include "opencbm.h"
+
+/* one copy between the disk image and the virtual drive */
+typedef struct
+{
+    const char *mode;       /* the transfer mode, as given to -t */
+    int warp;
+    int interleave;         /* 0: the default of the library */
+    int end_track;
+    int write;              /* 1: image to drive, 0: drive to image */
+    const char *image;
+    unsigned char drive;
+} bench_params;
+
+/* a copy library under test; copy() returns the number of blocks copied */
+typedef struct
+{
+    const char *name;
+    const char * const *modes;  /* the transfer modes the vdrive plugin runs */
+    int warp;               /* warp is supported by all fast transfer modes */
+    const char *image_type; /* the extension of the images, selects the drive */
+    int tracks;
+    int (*sectors)(int track);
+    /* writes a valid directory track into the image, may be NULL */
+    void (*format)(unsigned char *image);
+    int (*copy)(CBM_FILE fd, const bench_params *params);
+} bench_lib;
+
+extern const bench_lib bench_d64copy;
+extern const bench_lib bench_imgcopy;
+extern const bench_lib bench_d82copy;
+
+extern void bench_message(int severity, const char *format, ...);
+
+#endif
@@ -187,6 +187,10 @@ int ARCH_MAINDECL main(int argc, char **argv)
     int i;
     int write;
     cbmcopy_settings *settings;
+    cbmcopy_session *session;
+    char **cbmnames;
+    int *order;
+    int n;
     char auto_name[17];
     char auto_type = '\0';
     char output_type = '\0';
@@ -435,6 +439,33 @@ int ARCH_MAINDECL main(int argc, char **argv)
         return 1;
     }
 
+    /* the PETSCII names of the files to read, and the order to read them */
+    cbmnames = calloc(num_files, sizeof(*cbmnames));
+    order = calloc(num_files, sizeof(*order));
+    if(cbmnames == NULL || order == NULL)
+    {
+        my_message_cb(sev_fatal, "Out of memory");
+        return 1;
+    }
+    optind++;
+
+    for(n = 0; n < num_files; n++)
+    {
+        order[n] = n;
+        if(!write)
+        {
+            cbmnames[n] = malloc(17);
+            if(cbmnames[n] == NULL)
+            {
+                my_message_cb(sev_fatal, "Out of memory");
+                return 1;
+            }
+            strncpy(cbmnames[n], argv[optind + n], 16);
+            cbmnames[n][16] = '\0';
+            cbm_ascii2petscii(cbmnames[n]);
+        }
+    }
+
     rv = cbm_driver_open_ex( &fd, adapter );
     cbmlibmisc_strfree(adapter);
 
@@ -453,9 +484,29 @@ int ARCH_MAINDECL main(int argc, char **argv)
 
         arch_set_ctrlbreak_handler(reset);
 
-        while(++optind < argc)
+        /*
+         * Keep the drive prepared over all files. When reading more
+         * than one file, read the directory once, and read the files
+         * in the order they are found on the disk.
+         */
+        session = cbmcopy_session_open(fd, settings, drive,
+                                       !write && num_files > 1,
+                                       my_message_cb);
+        if(session == NULL)
+        {
+            cbm_driver_close( fd );
+            return 1;
+        }
+
+        if(!write)
         {
-            fname = argv[optind];
+            cbmcopy_session_order(session, (const char * const *) cbmnames,
+                                  num_files, order);
+        }
+
+        for(n = 0; n < num_files; n++)
+        {
+            fname = argv[optind + order[n]];
             if(write)
             {
                 rd = readers[0];
@@ -515,11 +566,10 @@ int ARCH_MAINDECL main(int argc, char **argv)
                                                filedata[1], filedata[0] );
 
                             }
-                            if(cbmcopy_write_file(fd, settings, drive,
-                                                  buf, strlen(buf),
-                                                  filedata, filesize,
-                                                  my_message_cb,
-                                                  my_status_cb) == 0)
+                            if(cbmcopy_session_write(session,
+                                                     buf, strlen(buf),
+                                                     filedata, filesize,
+                                                     my_status_cb) == 0)
                             {
                                 printf("\n");
                                 rv = cbm_device_status( fd, drive,
@@ -552,9 +602,7 @@ int ARCH_MAINDECL main(int argc, char **argv)
             }
             else
             {
-                strncpy(buf, fname, 16);
-                buf[16] = '\0';
-                cbm_ascii2petscii(buf);
+                strcpy(buf, cbmnames[order[n]]);
 
                 if(output_name)
                 {
@@ -590,6 +638,7 @@ int ARCH_MAINDECL main(int argc, char **argv)
                 else
                 {
                     /* should not happen... */
+                    cbmcopy_session_close( session );
                     cbm_driver_close( fd );
                     my_message_cb(sev_fatal, "Out of memory");
                     exit(1);
@@ -597,9 +646,9 @@ int ARCH_MAINDECL main(int argc, char **argv)
 
                 my_message_cb( sev_info, "reading %s -> %s", buf, fs_name );
 
-                if(cbmcopy_read_file(fd, settings, drive, buf, strlen(buf),
-                                     &filedata, &filesize,
-                                     my_message_cb, my_status_cb) == 0)
+                if(cbmcopy_session_read(session, buf, strlen(buf),
+                                        &filedata, &filesize,
+                                        my_status_cb) == 0)
                 {
                     rv = cbm_device_status( fd, drive, buf, sizeof(buf) );
                     my_message_cb( rv ? sev_warning : sev_info, "%s", buf );
@@ -649,6 +698,7 @@ int ARCH_MAINDECL main(int argc, char **argv)
                 }
             }
         }
+        cbmcopy_session_close( session );
         cbm_driver_close( fd );
 
         if(rv)
@@ -657,5 +707,12 @@ int ARCH_MAINDECL main(int argc, char **argv)
         }
     }
 
+    for(n = 0; n < num_files; n++)
+    {
+        free(cbmnames[n]);
+    }
+    free(cbmnames);
+    free(order);
+
     return rv;
 }
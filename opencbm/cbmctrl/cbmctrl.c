@@ -28,6 +28,24 @@ enum {
     PA_RAW
 } PETSCII_RAW;
 
+//! the most lines of a batch which are queued before they are executed
+#define PIPELINE_MAX_LINES 32
+
+//! the most bus operations one queued line records
+#define PIPELINE_MAX_LINE_OPS 4
+
+//! the bus operations of a batch which are executed together, see --pipeline
+typedef struct {
+    CBM_BATCH *batch;                         //!< the queued bus operations
+    int expected[PIPELINE_MAX_LINES * PIPELINE_MAX_LINE_OPS]; //!< the result of each operation if it succeeds
+    unsigned int ops;                         //!< the number of queued operations
+    unsigned int lines;                       //!< the number of queued lines
+    unsigned long lineno[PIPELINE_MAX_LINES]; //!< the line number of each queued line
+    const char *name[PIPELINE_MAX_LINES];     //!< the action of each queued line
+    int error[PIPELINE_MAX_LINES];            //!< the line could not be queued completely
+    unsigned int first_op[PIPELINE_MAX_LINES + 1]; //!< the first operation of each queued line
+} PIPELINE;
+
 //! struct to remember the general options to the program
 typedef struct {
     int argc;    //!< a (modifieable) copy of the number of arguments, as given to main()
@@ -38,6 +56,9 @@ typedef struct {
     int version; //!< option: print version information
     char *adapter; //!< option: an explicit adapter was specified
     PETSCII_RAW petsciiraw; //!< option: The user requested PETSCII or RAW, or nothing 
+    char *batch;   //!< option: read the actions from this file ("-" for stdin), or NULL
+    int pipeline;  //!< option: queue the bus actions of a batch
+    PIPELINE *queue; //!< while executing a pipelined batch: where the bus actions are queued, else NULL
 } OPTIONS;
 
 typedef int (*mainfunc)(CBM_FILE fd, OPTIONS * const options);
@@ -129,6 +150,14 @@ static int get_argument_file_for_write(OPTIONS * const options, FILE **f)
 
         *f = fopen(filename, "wb");
     }
+    else if (options->batch)
+    {
+        /* in a batch, stdout is needed for the following actions, too */
+
+        *f = stdout;
+        fflush(stdout);
+        arch_setbinmode(arch_fileno(stdout));
+    }
     else
     {
         /* no filename was given, open stdout in binary mode */
@@ -152,6 +181,14 @@ static int get_argument_file_for_write(OPTIONS * const options, FILE **f)
     return 0;
 }
 
+static void close_argument_file_for_write(FILE *f)
+{
+    if (f == stdout)
+        fflush(f);
+    else
+        fclose(f);
+}
+
 static int get_argument_file_for_read(OPTIONS * const options, FILE **f, char **fn)
 {
     char *filename = NULL;
@@ -169,6 +206,12 @@ static int get_argument_file_for_read(OPTIONS * const options, FILE **f, char **
     if (check_if_parameters_ok(options))
         return 1;
 
+    if(filename == NULL && options->batch && strcmp(options->batch, "-") == 0)
+    {
+        fprintf(stderr, "stdin is used for the batch, give a file name!\n");
+        return 1;
+    }
+
     if(filename == NULL)
     {
         filename = "(stdin)";
@@ -201,15 +244,17 @@ static int get_argument_file_for_read(OPTIONS * const options, FILE **f, char **
     return 0;
 }
 
+//! process_individual_option() has not been called for the current action yet
+static int individual_option_firstcall = 1;
+
 static int
 process_individual_option(OPTIONS * const options, const char short_options[], struct option long_options[])
 {
-    static int firstcall = 1;
     int option;
 
-    if (firstcall)
+    if (individual_option_firstcall)
     {
-        firstcall = 0;
+        individual_option_firstcall = 0;
 
         optind = 0;
 
@@ -430,6 +475,23 @@ get_extended_argument_string(int extended,
     return 0;
 }
 
+/*
+ * Remember a bus operation queued for a pipelined batch
+ */
+static int queue_op(OPTIONS * const options, int op, int expected)
+{
+    PIPELINE *queue = options->queue;
+
+    if (op < 0 || queue->ops >= sizeof(queue->expected) / sizeof(queue->expected[0]))
+    {
+        fprintf(stderr, "Could not queue the action, aborting...\n");
+        return 1;
+    }
+
+    queue->expected[queue->ops++] = expected;
+    return 0;
+}
+
 /*
  * Simple wrapper for lock
  */
@@ -492,6 +554,9 @@ static int do_listen(CBM_FILE fd, OPTIONS * const options)
     if (rv || check_if_parameters_ok(options))
         return 1;
 
+    if (options->queue)
+        return queue_op(options, cbm_batch_listen(options->queue->batch, unit, secondary), 0);
+
     return cbm_listen(fd, unit, secondary);
 }
 
@@ -512,6 +577,9 @@ static int do_talk(CBM_FILE fd, OPTIONS * const options)
     if (rv || check_if_parameters_ok(options))
         return 1;
 
+    if (options->queue)
+        return queue_op(options, cbm_batch_talk(options->queue->batch, unit, secondary), 0);
+
     return cbm_talk(fd, unit, secondary);
 }
 
@@ -524,7 +592,9 @@ static int do_unlisten(CBM_FILE fd, OPTIONS * const options)
     
     rv = rv || check_if_parameters_ok(options);
 
-    if (rv == 0)
+    if (rv == 0 && options->queue)
+        rv = queue_op(options, cbm_batch_unlisten(options->queue->batch), 0);
+    else if (rv == 0)
         rv = cbm_unlisten(fd);
 
     return rv;
@@ -539,7 +609,9 @@ static int do_untalk(CBM_FILE fd, OPTIONS * const options)
     
     rv = rv || check_if_parameters_ok(options);
 
-    if (rv == 0)
+    if (rv == 0 && options->queue)
+        rv = queue_op(options, cbm_batch_untalk(options->queue->batch), 0);
+    else if (rv == 0)
         rv = cbm_untalk(fd);
 
     return rv;
@@ -652,7 +724,7 @@ static int do_read(CBM_FILE fd, OPTIONS * const options)
 
     if(size < 0) rv=1; /* error condition from cbm_raw_read */
 
-    fclose(f);
+    close_argument_file_for_write(f);
     return rv;
 }
 
@@ -769,8 +841,14 @@ static int do_put(CBM_FILE fd, OPTIONS * const options)
     }
 
     /* write that to the IEC bus */
-    rv = cbm_raw_write(fd, commandline, commandlinelen);
-    if(rv < 0 || commandlinelen != (unsigned int) rv)
+    if (options->queue)
+    {
+        rv = queue_op(options,
+            cbm_batch_raw_write(options->queue->batch, commandline, commandlinelen),
+            commandlinelen);
+    }
+    else if ((rv = cbm_raw_write(fd, commandline, commandlinelen)) < 0
+        || commandlinelen != (unsigned int) rv)
     {
         rv = 1;
     }
@@ -854,8 +932,17 @@ static int do_command(CBM_FILE fd, OPTIONS * const options)
     if (rv)
         return 1;
 
-    rv = cbm_listen(fd, unit, 15);
-    if(rv == 0)
+    if (options->queue)
+    {
+        CBM_BATCH *batch = options->queue->batch;
+
+        rv = queue_op(options, cbm_batch_listen(batch, unit, 15), 0);
+        if (rv == 0 && commandlinelen > 0)
+            rv = queue_op(options, cbm_batch_raw_write(batch, commandline, commandlinelen), commandlinelen);
+        rv = rv || queue_op(options, cbm_batch_raw_write(batch, "\r", 1), 1);
+        rv = rv || queue_op(options, cbm_batch_unlisten(batch), 0);
+    }
+    else if((rv = cbm_listen(fd, unit, 15)) == 0)
     {
         if (commandlinelen > 0)
             cbm_raw_write(fd, commandline, commandlinelen);
@@ -877,60 +964,184 @@ static int do_command(CBM_FILE fd, OPTIONS * const options)
     return rv;
 }
 
+/*
+ * output one line of a directory listing, as the drive sends it
+ */
+static void dir_output_line(OPTIONS * const options, unsigned int number,
+                            const unsigned char *text, size_t len)
+{
+    size_t i;
+
+    printf("%u ", number);
+
+    for (i = 0; i < len; i++)
+    {
+        if (options->petsciiraw == PA_PETSCII)
+            putchar(cbm_petscii2ascii_c(text[i]));
+        else
+            putchar(text[i]);
+    }
+
+    putchar('\n');
+}
+
+/*
+ * display directory, as read by cbm_read_directory()
+ */
+static int dir_fast(CBM_FILE fd, OPTIONS * const options,
+                    unsigned char unit, unsigned char drive)
+{
+    static const char *types[] = { "DEL", "SEQ", "PRG", "USR", "REL", "CBM", "DIR", "???" };
+
+    CBM_DIRECTORY *directory;
+    unsigned char line[40];
+    unsigned int i;
+    int len;
+
+    if (cbm_read_directory(fd, unit, drive, &directory) != 0)
+        return 1;
+
+    len = sprintf((char *) line, "\022\"%-16s\" %s", directory->name, directory->id);
+    dir_output_line(options, 0, line, len);
+
+    for (i = 0; i < directory->count; i++)
+    {
+        CBM_DIRECTORY_ENTRY *entry = &directory->entries[i];
+        unsigned int blocks = entry->blocks;
+        int spaces = (blocks < 10) ? 3 : (blocks < 100) ? 2 : (blocks < 1000) ? 1 : 0;
+
+        // align the names as the drive does it
+
+        len = sprintf((char *) line, "%*s\"%s\"%*s%c%s%c",
+            spaces, "", entry->name, 16 - (int) strlen((char *) entry->name), "",
+            (entry->type & 0x80) ? ' ' : '*',
+            types[entry->type & 7],
+            (entry->type & 0x40) ? '<' : ' ');
+
+        dir_output_line(options, blocks, line, len);
+    }
+
+    dir_output_line(options, directory->blocks_free, (const unsigned char *) "BLOCKS FREE.", 12);
+
+    cbm_directory_free(directory);
+    return 0;
+}
+
 /*
  * display directory
  */
 static int do_dir(CBM_FILE fd, OPTIONS * const options)
 {
-    char c, buf[40];
+    char buf[40];
     unsigned char command[] = { '$', '0' };
+    unsigned char *listing = NULL;
+    unsigned int size = 0;
     int rv;
+    int c;
     unsigned char unit;
+    unsigned char drive = 0;
+    int fast = 0;
+    static const char short_options[] = "+f";
+    static struct option long_options[] =
+    {
+        {"fast", no_argument, NULL, 'f'},
+        {NULL,   no_argument, NULL, 0  }
+    };
 
-    rv = skip_options(options);
-    
-    rv = rv || get_argument_char(options, &unit);
+    // first of all, process the options given
+
+    while ((c = process_individual_option(options, short_options, long_options)) != EOF)
+    {
+        switch (c)
+        {
+        case 'f':
+            fast = 1;
+            break;
+
+        default:
+            return 1;
+        }
+    }
+
+    rv = get_argument_char(options, &unit);
     /* default is drive '0' */
     if (options->argc > 0)
     {
-        rv = rv || get_argument_char(options, command+1);
+        rv = rv || get_argument_char(options, &drive);
     }
 
     if (rv || check_if_parameters_ok(options))
         return 1;
 
+    command[1] = '0' + drive;
+
+    if (fast)
+    {
+        if (dir_fast(fd, options, unit, drive) == 0)
+        {
+            cbm_device_status(fd, unit, buf, sizeof(buf));
+            printf("%s", cbm_petscii2ascii(buf));
+            return 0;
+        }
+
+        // not a known disk format; let the drive generate the listing
+    }
+
     rv = cbm_open(fd, unit, 0, command, sizeof(command));
     if(rv == 0)
     {
         if(cbm_device_status(fd, unit, buf, sizeof(buf)) == 0)
         {
+            unsigned int pos;
+
+            // get the whole listing, in as few transfers as possible
+
             cbm_talk(fd, unit, 0);
-            if(cbm_raw_read(fd, buf, 2) == 2)
+            for (;;)
             {
-                while(cbm_raw_read(fd, buf, 2) == 2)
-                {
-                    if(cbm_raw_read(fd, buf, 2) == 2)
-                    {
-                        printf("%u ", (unsigned char)buf[0] | (unsigned char)buf[1] << 8 );
-                        while((cbm_raw_read(fd, &c, 1) == 1) && c)
-                        {
-                            if (options->petsciiraw == PA_PETSCII)
-                                putchar(cbm_petscii2ascii_c(c));
-                            else
-                                putchar(c);
-                        }
-                        putchar('\n');
-                    }
-                }
-                cbm_untalk(fd);
-                cbm_device_status(fd, unit, buf, sizeof(buf));
-                printf("%s", cbm_petscii2ascii(buf));
+                unsigned char *p = realloc(listing, size + 256);
+                int n;
+
+                if (p == NULL)
+                    break;
+
+                listing = p;
+                n = cbm_raw_read(fd, listing + size, 256);
+                if (n <= 0)
+                    break;
+
+                size += n;
+                if (n < 256)
+                    break;
             }
-            else
+            cbm_untalk(fd);
+
+            // skip the load address, and output the lines, each with
+            // the link to the next one, the line number and the text
+
+            for (pos = 2; pos + 4 <= size; )
             {
-                cbm_untalk(fd);
+                unsigned int number = listing[pos + 2] | listing[pos + 3] << 8;
+                unsigned int len;
+
+                if (listing[pos] == 0 && listing[pos + 1] == 0)
+                    break;
+
+                pos += 4;
+                for (len = 0; pos + len < size && listing[pos + len]; len++)
+                    ;
+
+                dir_output_line(options, number, listing + pos, len);
+                pos += len + 1;
             }
 
+            free(listing);
+
+            if (size > 2)
+            {
+                cbm_device_status(fd, unit, buf, sizeof(buf));
+                printf("%s", cbm_petscii2ascii(buf));
+            }
         }
         else
         {
@@ -1045,7 +1256,7 @@ static int do_download(CBM_FILE fd, OPTIONS * const options)
         count -= c;
     }
 
-    fclose(f);
+    close_argument_file_for_write(f);
     return rv;
 }
 
@@ -1169,6 +1380,7 @@ static int do_upload(CBM_FILE fd, OPTIONS * const options)
 static int do_detect(CBM_FILE fd, OPTIONS * const options)
 {
     unsigned int num_devices;
+    unsigned long devices;
     unsigned char device;
     const char *type_str;
 
@@ -1180,10 +1392,17 @@ static int do_detect(CBM_FILE fd, OPTIONS * const options)
 
     num_devices = 0;
 
+    /* only the devices which answered are identified */
+    cbm_bus_scan( fd, &devices );
+
     for( device = 8; device < 16; device++ )
     {
         enum cbm_device_type_e device_type;
-        if( cbm_identify( fd, device, &device_type, &type_str ) == 0 )
+
+        if( !(devices & (1ul << device)) )
+            continue;
+
+        if( cbm_bus_identify( fd, device, &device_type, &type_str ) == 0 )
         {
             enum cbm_cable_type_e cable_type;
             const char *cable_str = "(cannot determine cable type)";
@@ -1241,7 +1460,7 @@ static int do_change(CBM_FILE fd, OPTIONS * const options)
 
         enum cbm_device_type_e device_type;
 
-        if (cbm_identify(fd, unit, &device_type, NULL) == 0)
+        if (cbm_bus_identify(fd, unit, &device_type, NULL) == 0)
         {
             if (device_type == cbm_dt_cbm1581)
             {
@@ -1316,6 +1535,7 @@ struct prog
     char    *arglist;
     char    *shorthelp_text;
     char    *help_text;
+    int      queueable; // the action only records bus operations, see --pipeline
 };
 
 static struct prog prog_table[] =
@@ -1336,24 +1556,24 @@ static struct prog prog_table[] =
         "Output a listen command on the IEC bus.\n"
         "<device> is the device number,\n"
         "<secadr> the secondary address to use for this.\n\n"
-        "This has to be undone later with an unlisten command." },
+        "This has to be undone later with an unlisten command.", 1 },
 
     {1, "talk"    , PA_UNSPEC,  do_talk    , "<device> <secadr>",
         "perform a talk on the IEC bus",
         "Output a talk command on the IEC bus.\n"
         "<device> is the device number,\n"
         "<secadr> the secondary address to use for this.\n\n"
-        "This has to be undone later with an untalk command." },
+        "This has to be undone later with an untalk command.", 1 },
 
     {1, "unlisten", PA_UNSPEC,  do_unlisten, "",
         "perform an unlisten on the IEC bus",
         "Undo one or more previous listen commands.\n"
-        "This affects all drives." },
+        "This affects all drives.", 1 },
 
     {1, "untalk"  , PA_UNSPEC,  do_untalk  , "",
         "perform an untalk on the IEC bus",
         "Undo one or more previous talk commands.\n"
-        "This affects all drives." },
+        "This affects all drives.", 1 },
 
     {1, "open"    , PA_RAW,     do_open    , "[-e|--extended] <device> <secadr> <filename> [<file1>...<fileN>]",
         "perform an open on the IEC bus",
@@ -1415,7 +1635,7 @@ static struct prog prog_table[] =
         "  and-so-on. A '%' is given by giving its hex ASCII: '%25' => '%'.\n\n"
         "NOTES:\n"
         "- If using both --pestscii and --extended option, the bytes given via the\n"
-        "  '%' meta-character or as <data1> .. <dataN> are *not* converted to petscii." },
+        "  '%' meta-character or as <data1> .. <dataN> are *not* converted to petscii.", 1 },
 
     {1, "status"  , PA_PETSCII, do_status  , "<device>",
         "give the status of the specified drive",
@@ -1449,19 +1669,23 @@ static struct prog prog_table[] =
         "- If used with the global --petscii option, this action is equivalent\n"
         "  to the deprecated command-line 'cbmctrl pcommand'.\n"
         "- If using both --petscii and --extended option, the bytes given via the\n"
-        "  '%' meta-character or as <cmd1> .. <cmdN> are *not* converted to petscii." },
+        "  '%' meta-character or as <cmd1> .. <cmdN> are *not* converted to petscii.", 1 },
 
     {1, "pcommand", PA_PETSCII, do_command , "[-e|--extended] <device> <cmdstr>",
         "deprecated; use 'cbmctrl --petscii command' instead!",
         "This command is deprecated; use 'cbmctrl -p command' instead!\n\n"
         "NOTE: You have to give the commands in lower-case letters.\n"
-        "      Upper case will NOT work!\n" },
+        "      Upper case will NOT work!\n", 1 },
 
-    {1, "dir"     , PA_PETSCII, do_dir     , "<device> [<drive>]",
+    {1, "dir"     , PA_PETSCII, do_dir     , "[-f|--fast] <device> [<drive>]",
         "output the directory of the disk in the specified drive",
         "This command gets the directory of a disk in the drive.\n\n"
         "<device> is the device number of the drive (bus ID).\n" 
-        "<drive> is the drive number of a dual drive (LUN), default is 0." },
+        "<drive> is the drive number of a dual drive (LUN), default is 0.\n\n"
+        "If the option -f or --fast is given, the directory blocks are read\n"
+        "and the listing is made of them, instead of letting the drive generate\n"
+        "it. This needs less round trips with USB adapters. If the disk format is\n"
+        "not known, the listing of the drive is used anyway." },
 
     {1, "download", PA_RAW,     do_download, "<device> <adr> <count> [<file>]",
         "download memory contents from the floppy drive",
@@ -1578,6 +1802,18 @@ static int do_help(CBM_FILE fd, OPTIONS * const options)
             "                  and 'command'\n"
             "   -r, --raw:     Do not convert data between CBM and PC format.\n"
             "                  Default with 'open' and 'command'.\n"
+            "   -b, --batch[=<file>]:\n"
+            "                  Read actions from <file>, or from stdin if no <file> or\n"
+            "                  '-' is given, one per line, and execute all of them with\n"
+            "                  one opened driver. After each action, a line\n"
+            "                  '= <line> ok <action>' or '= <line> error <action>'\n"
+            "                  is output. Empty lines and lines starting with '#' are\n"
+            "                  ignored, arguments with spaces can be quoted with \"\".\n"
+            "                  A line can start with -p or -r to override the default.\n"
+            "   --pipeline:    With --batch, do not execute listen, talk, unlisten,\n"
+            "                  untalk, put and command at once, but collect them and\n"
+            "                  send them to the adapter together, before the next other\n"
+            "                  action, a line 'sync', or the end of the batch.\n"
             "   --             Delimiter between action_opt and action_args; if any of the\n"
             "                  arguments in action_args starts with a '-', make sure to set\n"
             "                  the '--' so the argument is not treated as an option,\n"
@@ -1654,10 +1890,12 @@ process_cmdline_common_options(int argc, char **argv, OPTIONS *options)
     int option_index;
     int option;
 
-    static const char short_options[] = "+fhVpr@:";
+    static const char short_options[] = "+fhVprb::@:";
     static struct option long_options[] =
     {
         { "adapter" , required_argument, NULL, '@' },
+        { "batch"   , optional_argument, NULL, 'b' },
+        { "pipeline", no_argument,       NULL, 'P' },
         { "forget"  , no_argument,       NULL, 'f' },
         { "help"    , no_argument,       NULL, 'h' },
         { "version" , no_argument,       NULL, 'V' },
@@ -1729,6 +1967,17 @@ process_cmdline_common_options(int argc, char **argv, OPTIONS *options)
         case 'r':
             options->error |= set_option_petsciiraw(&options->petsciiraw, PA_RAW, 0);
             break;
+
+        case 'b':
+            if (options->batch != NULL)
+                options->error = 1;
+            else
+                options->batch = cbmlibmisc_strdup(optarg ? optarg : "-");
+            break;
+
+        case 'P':
+            set_option(&options->pipeline, 1, 0, "--pipeline");
+            break;
         };
     }
 
@@ -1743,6 +1992,7 @@ static void
 free_options(OPTIONS * const options)
 {
     cbmlibmisc_strfree(options->adapter);
+    cbmlibmisc_strfree(options->batch);
 }
 
 static int
@@ -1768,6 +2018,288 @@ process_version_help(OPTIONS * const options)
     return processed;
 }
 
+/*
+ * Output the result of one line of a batch
+ */
+static void
+batch_result(unsigned long lineno, const char *name, int failed)
+{
+    printf("= %lu %s %s\n", lineno, failed ? "error" : "ok", name);
+    fflush(stdout);
+}
+
+/*
+ * Execute the queued lines of a pipelined batch, and output their results
+ */
+static int
+batch_flush(CBM_FILE fd, PIPELINE *queue)
+{
+    unsigned int line;
+    int failed = 0;
+
+    if (queue == NULL || queue->lines == 0)
+        return 0;
+
+    queue->first_op[queue->lines] = queue->ops;
+
+    cbm_batch_submit(fd, queue->batch);
+
+    for (line = 0; line < queue->lines; line++)
+    {
+        unsigned int op;
+        int error = queue->error[line];
+
+        for (op = queue->first_op[line]; op < queue->first_op[line + 1]; op++)
+        {
+            if (cbm_batch_result(queue->batch, op) != queue->expected[op])
+                error = 1;
+        }
+
+        batch_result(queue->lineno[line], queue->name[line], error);
+        failed += error;
+    }
+
+    cbm_batch_clear(queue->batch);
+    queue->ops = 0;
+    queue->lines = 0;
+
+    return failed;
+}
+
+/*
+ * Split a line of a batch into arguments, in place
+ *
+ * Arguments are separated by white space, and can be quoted with
+ * "", where \" and \\ stand for " and \. Returns the number of
+ * arguments, or -1 if there are too many or a quote is not closed.
+ */
+static int
+batch_split_line(char *line, char *argv[], int max_args)
+{
+    int argc = 0;
+    char *p = line;
+
+    for (;;)
+    {
+        char *arg;
+
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+
+        if (*p == 0)
+            break;
+
+        if (argc == max_args)
+            return -1;
+
+        arg = argv[argc++] = p;
+
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        {
+            if (*p == '"')
+            {
+                for (++p; *p != '"'; p++)
+                {
+                    if (*p == 0)
+                        return -1;
+
+                    if (*p == '\\' && (p[1] == '"' || p[1] == '\\'))
+                        p++;
+
+                    *arg++ = *p;
+                }
+                p++;
+            }
+            else
+            {
+                *arg++ = *p++;
+            }
+        }
+
+        if (*p)
+            p++;
+
+        *arg = 0;
+    }
+
+    return argc;
+}
+
+/*
+ * Execute the actions of a batch, one per line
+ */
+static int
+process_batch(CBM_FILE fd, OPTIONS * const options)
+{
+    char line[1024];
+    char *argv[64];
+    unsigned long lineno = 0;
+    PIPELINE *queue = NULL;
+    FILE *f = stdin;
+    int failed = 0;
+
+    if (options->argc > 0)
+    {
+        fprintf(stderr, "Extra parameter with --batch, aborting...\n");
+        return 1;
+    }
+
+    if (strcmp(options->batch, "-") != 0)
+    {
+        f = fopen(options->batch, "r");
+        if (f == NULL)
+        {
+            arch_error(0, arch_get_errno(), "could not open %s", options->batch);
+            return 1;
+        }
+    }
+
+    if (options->pipeline)
+    {
+        queue = calloc(1, sizeof(*queue));
+        if (queue)
+            queue->batch = cbm_batch_create();
+
+        if (queue == NULL || queue->batch == NULL)
+        {
+            fprintf(stderr, "Not enough memory for the pipeline, aborting...\n");
+            free(queue);
+            if (f != stdin)
+                fclose(f);
+            return 1;
+        }
+    }
+
+    while (fgets(line, sizeof(line), f))
+    {
+        OPTIONS line_options = *options;
+        struct prog *pprog;
+        int argc;
+        int rv;
+
+        lineno++;
+
+        if (strchr(line, '\n') == NULL && !feof(f))
+        {
+            int c;
+
+            // skip the rest of the line, it is too long anyway
+            while ((c = fgetc(f)) != EOF && c != '\n')
+                ;
+
+            fprintf(stderr, "line %lu is too long.\n", lineno);
+            failed += batch_flush(fd, queue) + 1;
+            batch_result(lineno, "-", 1);
+            continue;
+        }
+
+        argc = batch_split_line(line, argv, sizeof(argv) / sizeof(argv[0]));
+
+        if (argc == 0 || (argc > 0 && argv[0][0] == '#'))
+            continue;
+
+        if (argc < 0)
+        {
+            fprintf(stderr, "line %lu: too many arguments, or a quote is not closed.\n", lineno);
+            failed += batch_flush(fd, queue) + 1;
+            batch_result(lineno, "-", 1);
+            continue;
+        }
+
+        line_options.argc = argc;
+        line_options.argv = argv;
+        line_options.queue = NULL;
+
+        // a line can override the default PETSCII or RAW conversion
+        while (line_options.argc > 0)
+        {
+            if (strcmp(line_options.argv[0], "-p") == 0 || strcmp(line_options.argv[0], "--petscii") == 0)
+                line_options.petsciiraw = PA_PETSCII;
+            else if (strcmp(line_options.argv[0], "-r") == 0 || strcmp(line_options.argv[0], "--raw") == 0)
+                line_options.petsciiraw = PA_RAW;
+            else
+                break;
+
+            line_options.argc--;
+            line_options.argv++;
+        }
+
+        if (line_options.argc == 1 && strcmp(line_options.argv[0], "sync") == 0)
+        {
+            failed += batch_flush(fd, queue);
+            batch_result(lineno, "sync", 0);
+            continue;
+        }
+
+        pprog = process_cmdline_find_command(&line_options);
+
+        if (pprog == NULL)
+        {
+            fprintf(stderr, "line %lu: invalid command.\n", lineno);
+            failed += batch_flush(fd, queue);
+            batch_result(lineno, (line_options.argc > 0) ? line_options.argv[0] : "-", 1);
+            failed++;
+            continue;
+        }
+
+        // if neither PETSCII or RAW was specified, use default for that command
+        if (line_options.petsciiraw == PA_UNSPEC)
+            line_options.petsciiraw = pprog->petsciiraw;
+
+        individual_option_firstcall = 1;
+
+        if (queue && pprog->queueable)
+        {
+            if (queue->lines == PIPELINE_MAX_LINES
+                || queue->ops + PIPELINE_MAX_LINE_OPS > sizeof(queue->expected) / sizeof(queue->expected[0]))
+            {
+                failed += batch_flush(fd, queue);
+            }
+
+            line_options.queue = queue;
+            queue->lineno[queue->lines] = lineno;
+            queue->name[queue->lines] = pprog->name;
+            queue->first_op[queue->lines] = queue->ops;
+            queue->error[queue->lines] = pprog->prog(fd, &line_options) != 0;
+            queue->lines++;
+            continue;
+        }
+
+        failed += batch_flush(fd, queue);
+
+        arch_set_errno(0);
+
+        rv = pprog->prog(fd, &line_options) != 0;
+        if (rv && arch_get_errno())
+        {
+            arch_error(0, arch_get_errno(), "%s", pprog->name);
+        }
+
+        fflush(stdout);
+        batch_result(lineno, pprog->name, rv);
+        failed += rv;
+    }
+
+    if (ferror(f))
+    {
+        arch_error(0, arch_get_errno(), "could not read %s", options->batch);
+        failed++;
+    }
+
+    failed += batch_flush(fd, queue);
+
+    if (queue)
+    {
+        cbm_batch_free(queue->batch);
+        free(queue);
+    }
+
+    if (f != stdin)
+        fclose(f);
+
+    return failed > 0;
+}
+
 int ARCH_MAINDECL main(int argc, char *argv[])
 {
     struct prog *pprog;
@@ -1788,6 +2320,36 @@ int ARCH_MAINDECL main(int argc, char *argv[])
         if (process_version_help(&options))
             break;
 
+        if (options.pipeline && options.batch == NULL)
+        {
+            fprintf(stderr, "--pipeline can only be used with --batch, aborting...\n");
+            rv = 2;
+            break;
+        }
+
+        if (options.batch)
+        {
+            rv = cbm_driver_open_ex(&fd, options.adapter);
+
+            if (rv != 0)
+            {
+                if (arch_get_errno())
+                {
+                    arch_error(0, arch_get_errno(), "%s", cbm_get_driver_name_ex(options.adapter));
+                }
+                else
+                {
+                    fprintf(stderr, "An error occurred opening OpenCBM, aborting...\n");
+                }
+                break;
+            }
+
+            rv = process_batch(fd, &options);
+
+            cbm_driver_close(fd);
+            break;
+        }
+
         pprog = process_cmdline_find_command(&options);
 
         if (pprog == NULL)
@@ -28,6 +28,33 @@ static int no_progress = 0;
 /* other globals */
 static CBM_FILE fd_cbm;
 
+/*
+ * batch mode: every adapter is driven by its own worker thread, which
+ * copies the disks listed for this adapter one after the other
+ */
+#define MAX_BATCH_ADAPTERS 32
+
+struct batch_job
+{
+    struct batch_job *next;
+    char *src_arg;
+    char *dst_arg;
+    int rv;
+};
+
+struct batch_worker
+{
+    char *adapter;              /* NULL: the default adapter */
+    CBM_FILE fd;
+    ARCH_THREAD *thread;
+    const d64copy_settings *settings;
+    struct batch_job *jobs;
+    struct batch_job **last_job;
+};
+
+static struct batch_worker batch_workers[MAX_BATCH_ADAPTERS];
+static volatile int batch_worker_count;
+
 
 static int is_cbm(char *name)
 {
@@ -111,6 +138,25 @@ static void help()
 "  -2, --two-sided           two-sided disk transfer (.d71): Requires 1571.\n"
 "                            Warp mode is not available for .d71 images.\n"
 "\n"
+"  -I, --incremental         when reading a disk into an existing image, only\n"
+"                            transfer the blocks changed since the last run.\n"
+"                            The drive compares checksums of its blocks with\n"
+"                            the index in TARGET.idx; the previous contents of\n"
+"                            changed blocks are appended to TARGET.gen.\n"
+"\n"
+"  -g, --generation=GEN      instead of copying a disk, write generation GEN of\n"
+"                            the incrementally read image SOURCE to TARGET.\n"
+"\n"
+"  -j, --batch=FILE          copy all disks listed in FILE instead of SOURCE\n"
+"                            and TARGET. Every line of FILE has the form\n"
+"                              ADAPTER SOURCE TARGET\n"
+"                            where ADAPTER is given as for `-@', or `-' for\n"
+"                            the default one. All adapters are used at the\n"
+"                            same time, the disks of one adapter are copied\n"
+"                            one after the other. The adapters have to use\n"
+"                            the same plugin. Empty lines and lines\n"
+"                            starting with `#' are ignored.\n"
+"\n"
 );
 }
 
@@ -133,11 +179,14 @@ static void my_message_cb(int severity, const char *format, ...)
 
     if(verbosity >= severity)
     {
+        /* do not mix up the messages of the batch workers */
+        arch_global_lock();
         fprintf(stderr, "[%s] ", severities[severity]);
         va_start(args, format);
         vfprintf(stderr, format, args);
         va_end(args);
         fprintf(stderr, "\n");
+        arch_global_unlock();
     }
 }
 
@@ -192,6 +241,13 @@ static int my_status_cb(d64copy_status status)
 }
 
 
+/* the per-sector progress display cannot be shared by the batch workers */
+static int batch_status_cb(d64copy_status status)
+{
+    return 0;
+}
+
+
 static void ARCH_SIGNALDECL reset(int dummy)
 {
     CBM_FILE fd_cbm_local;
@@ -214,6 +270,255 @@ static void ARCH_SIGNALDECL reset(int dummy)
     exit(1);
 }
 
+static void ARCH_SIGNALDECL batch_reset(int dummy)
+{
+    int i;
+
+    fprintf(stderr, "\nSIGINT caught X-(  Resetting IEC buses...\n");
+    d64copy_cleanup();
+    for(i = 0; i < batch_worker_count; i++)
+    {
+        cbm_reset(batch_workers[i].fd);
+    }
+    exit(1);
+}
+
+static struct batch_worker *batch_get_worker(const char *adapter)
+{
+    struct batch_worker *worker;
+    int i;
+
+    for(i = 0; i < batch_worker_count; i++)
+    {
+        worker = &batch_workers[i];
+        if((adapter == NULL && worker->adapter == NULL) ||
+           (adapter && worker->adapter && strcmp(adapter, worker->adapter) == 0))
+        {
+            return worker;
+        }
+    }
+
+    if(batch_worker_count >= MAX_BATCH_ADAPTERS)
+    {
+        my_message_cb(sev_fatal, "too many adapters, at most %d are supported",
+                      MAX_BATCH_ADAPTERS);
+        return NULL;
+    }
+
+    worker = &batch_workers[batch_worker_count];
+    memset(worker, 0, sizeof(*worker));
+    worker->adapter = adapter ? cbmlibmisc_strdup(adapter) : NULL;
+    worker->last_job = &worker->jobs;
+    batch_worker_count++;
+    return worker;
+}
+
+static int batch_read(const char *filename, const char *default_adapter)
+{
+    FILE *f;
+    char line[1024];
+    char adapter[256];
+    char src_arg[512];
+    char dst_arg[512];
+    const char *name;
+    char *p;
+    int line_no = 0;
+    int rv = 0;
+    struct batch_worker *worker;
+    struct batch_job *job;
+
+    f = fopen(filename, "r");
+    if(f == NULL)
+    {
+        my_message_cb(sev_fatal, "could not open batch file %s", filename);
+        return 1;
+    }
+
+    while(rv == 0 && fgets(line, sizeof(line), f))
+    {
+        line_no++;
+
+        for(p = line; *p == ' ' || *p == '\t'; p++)
+            ;
+        if(*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+        {
+            continue;
+        }
+
+        if(sscanf(p, "%255s %511s %511s", adapter, src_arg, dst_arg) != 3)
+        {
+            my_message_cb(sev_fatal, "%s:%d: expected ADAPTER SOURCE TARGET",
+                          filename, line_no);
+            rv = 1;
+            break;
+        }
+
+        if(is_cbm(src_arg) == is_cbm(dst_arg))
+        {
+            my_message_cb(sev_fatal, "%s:%d: either source or target must be a CBM drive",
+                          filename, line_no);
+            rv = 1;
+            break;
+        }
+
+        /* "-", "xum1541" and "xum1541:" can all be the same adapter */
+        name = cbm_get_adapter_name(strcmp(adapter, "-") == 0 ? default_adapter : adapter);
+        if(name == NULL)
+        {
+            name = strcmp(adapter, "-") == 0 ? default_adapter : adapter;
+        }
+        worker = batch_get_worker(name);
+        job = calloc(1, sizeof(*job));
+        if(worker == NULL || job == NULL)
+        {
+            free(job);
+            rv = 1;
+            break;
+        }
+        job->src_arg = cbmlibmisc_strdup(src_arg);
+        job->dst_arg = cbmlibmisc_strdup(dst_arg);
+
+        *worker->last_job = job;
+        worker->last_job = &job->next;
+    }
+
+    fclose(f);
+
+    if(rv == 0 && batch_worker_count == 0)
+    {
+        my_message_cb(sev_fatal, "%s: no disks to copy", filename);
+        rv = 1;
+    }
+    return rv;
+}
+
+static void batch_worker_run(void *Context)
+{
+    struct batch_worker *worker = Context;
+    struct batch_job *job;
+    d64copy_settings settings;
+    int src_is_cbm;
+    int drive;
+
+    for(job = worker->jobs; job; job = job->next)
+    {
+        /* every copy changes its settings, so give each one a fresh copy */
+        settings = *worker->settings;
+
+        src_is_cbm = is_cbm(job->src_arg);
+        drive = atoi(src_is_cbm ? job->src_arg : job->dst_arg);
+
+        settings.transfer_mode =
+            d64copy_check_auto_transfer_mode(worker->fd,
+                settings.transfer_mode, drive);
+
+        if(src_is_cbm)
+        {
+            job->rv = d64copy_read_image(worker->fd, &settings, drive,
+                    job->dst_arg, my_message_cb, batch_status_cb);
+        }
+        else
+        {
+            job->rv = d64copy_write_image(worker->fd, &settings,
+                    job->src_arg, drive, my_message_cb, batch_status_cb);
+        }
+
+        if(!no_progress && job->rv >= 0)
+        {
+            arch_global_lock();
+            printf("%s -> %s: %d blocks copied.\n",
+                   job->src_arg, job->dst_arg, job->rv);
+            fflush(stdout);
+            arch_global_unlock();
+        }
+    }
+}
+
+static int batch_run(const char *filename, const char *default_adapter,
+                     const d64copy_settings *settings)
+{
+    struct batch_worker *worker;
+    struct batch_job *job;
+    int opened = 0;
+    int started = 0;
+    int rv;
+    int i;
+
+    rv = batch_read(filename, default_adapter);
+
+    /* opening and closing the drivers is done from this thread only */
+    for(i = 0; rv == 0 && i < batch_worker_count; i++)
+    {
+        worker = &batch_workers[i];
+        worker->settings = settings;
+        if(cbm_driver_open_ex(&worker->fd, worker->adapter) != 0)
+        {
+            arch_error(0, arch_get_errno(), "%s",
+                       cbm_get_driver_name_ex(worker->adapter));
+            rv = 1;
+            break;
+        }
+        opened++;
+    }
+
+    if(rv == 0)
+    {
+        arch_set_ctrlbreak_handler(batch_reset);
+
+        for(i = 0; i < batch_worker_count; i++)
+        {
+            worker = &batch_workers[i];
+            if(arch_thread_create(&worker->thread, batch_worker_run, worker) != 0)
+            {
+                my_message_cb(sev_warning,
+                              "could not start a worker thread, copying sequentially");
+                worker->thread = NULL;
+                batch_worker_run(worker);
+            }
+            else
+            {
+                started++;
+            }
+        }
+        for(i = 0; i < batch_worker_count; i++)
+        {
+            worker = &batch_workers[i];
+            if(worker->thread)
+            {
+                arch_thread_join(worker->thread);
+                worker->thread = NULL;
+            }
+        }
+        my_message_cb(sev_debug, "%d adapters, %d worker threads",
+                      batch_worker_count, started);
+    }
+
+    for(i = 0; i < opened; i++)
+    {
+        cbm_driver_close(batch_workers[i].fd);
+    }
+
+    for(i = 0; i < batch_worker_count; i++)
+    {
+        worker = &batch_workers[i];
+        while((job = worker->jobs) != NULL)
+        {
+            if(job->rv < 0)
+            {
+                rv = 1;
+            }
+            worker->jobs = job->next;
+            cbmlibmisc_strfree(job->src_arg);
+            cbmlibmisc_strfree(job->dst_arg);
+            free(job);
+        }
+        cbmlibmisc_strfree(worker->adapter);
+    }
+    batch_worker_count = 0;
+
+    return rv;
+}
+
 int ARCH_MAINDECL main(int argc, char *argv[])
 {
     d64copy_settings *settings = d64copy_get_default_settings();
@@ -222,6 +527,8 @@ int ARCH_MAINDECL main(int argc, char *argv[])
     char *src_arg;
     char *dst_arg;
     char *adapter = NULL;
+    char *batch_file = NULL;
+    int generation = -1;
 
     int  option;
     int  rv = 1;
@@ -250,10 +557,13 @@ int ARCH_MAINDECL main(int argc, char *argv[])
         { "retry-count", required_argument, NULL, 'r' },
         { "two-sided"  , no_argument      , NULL, '2' },
         { "error-map"  , required_argument, NULL, 'E' },
+        { "batch"      , required_argument, NULL, 'j' },
+        { "incremental", no_argument      , NULL, 'I' },
+        { "generation" , required_argument, NULL, 'g' },
         { NULL         , 0                , NULL, 0   }
     };
 
-    const char shortopts[] ="hVwqbBt:i:s:e:d:r:2vnE:@:";
+    const char shortopts[] ="hVwqbBt:i:s:e:d:r:2vnE:@:j:Ig:";
 
     while((option = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1)
     {
@@ -333,6 +643,12 @@ int ARCH_MAINDECL main(int argc, char *argv[])
                           exit(1);
                       }
                       break;
+            case 'j': batch_file = optarg;
+                      break;
+            case 'I': settings->incremental = 1;
+                      break;
+            case 'g': generation = atoi(optarg);
+                      break;
             case 0:   break; // needed for --no-warp
             default : hint(argv[0]);
                       return 1;
@@ -358,6 +674,22 @@ int ARCH_MAINDECL main(int argc, char *argv[])
 
     my_message_cb(3, "transfer mode is %d", settings->transfer_mode );
 
+    if(batch_file)
+    {
+        if(optind != argc)
+        {
+            fprintf(stderr, "Usage: %s [OPTION]... --batch=FILE\n", argv[0]);
+            hint(argv[0]);
+            return 1;
+        }
+
+        rv = batch_run(batch_file, adapter, settings);
+
+        cbmlibmisc_strfree(adapter);
+        free(settings);
+        return rv;
+    }
+
     if(optind + 2 != argc)
     {
         fprintf(stderr, "Usage: %s [OPTION]... [SOURCE] [TARGET]\n", argv[0]);
@@ -368,6 +700,15 @@ int ARCH_MAINDECL main(int argc, char *argv[])
     src_arg = argv[optind];
     dst_arg = argv[optind+1];
 
+    if(generation >= 0)
+    {
+        rv = d64copy_rebuild_generation(src_arg, generation, dst_arg,
+                                        my_message_cb) == 0 ? 0 : 1;
+        cbmlibmisc_strfree(adapter);
+        free(settings);
+        return rv;
+    }
+
     src_is_cbm = is_cbm(src_arg);
     dst_is_cbm = is_cbm(dst_arg);
 
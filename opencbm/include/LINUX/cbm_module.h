@@ -47,7 +47,19 @@
 #define CBMCTRL_PARBURST_WRITE_TRACK _IO(CBMCTRL_BASE, 20)
 #define CBMCTRL_PARBURST_READ_TRACK_VAR    _IO(CBMCTRL_BASE, 21)
 
-/* all values needed by PARBURST_READ_TRACK and PARBURST_WRITE_TRACK */
+/* block transfers with the fast protocols, run in the driver */
+#define CBMCTRL_S1_READ_N       _IO(CBMCTRL_BASE, 22)
+#define CBMCTRL_S1_WRITE_N      _IO(CBMCTRL_BASE, 23)
+#define CBMCTRL_S2_READ_N       _IO(CBMCTRL_BASE, 24)
+#define CBMCTRL_S2_WRITE_N      _IO(CBMCTRL_BASE, 25)
+#define CBMCTRL_PP_DC_READ_N    _IO(CBMCTRL_BASE, 26)
+#define CBMCTRL_PP_DC_WRITE_N   _IO(CBMCTRL_BASE, 27)
+#define CBMCTRL_PP_CC_READ_N    _IO(CBMCTRL_BASE, 28)
+#define CBMCTRL_PP_CC_WRITE_N   _IO(CBMCTRL_BASE, 29)
+
+/* all values needed by PARBURST_READ_TRACK and PARBURST_WRITE_TRACK,
+ * and by the block transfers; these return the number of bytes
+ * transferred */
 typedef struct PARBURST_RW_VALUE {
 	unsigned char *buffer;
 	int length;
@@ -111,6 +111,12 @@ typedef bool BOOL;
 
 int arch_filesize(const char *Filename, off_t *Filesize);
 
+/* mapping (a part of) a file into memory (arch/.../file.c) */
+typedef struct arch_filemap_s ARCH_FILEMAP;
+
+extern int  arch_file_map(ARCH_FILEMAP **Map, int Fd, size_t Size, int Writable, unsigned char **Data);
+extern void arch_file_unmap(ARCH_FILEMAP *Map);
+
 #define arch_strdup(_x) ARCH_CBM_LINUX_WIN(strdup(_x), _strdup(_x))
 
 #define arch_fileno(_x) ARCH_CBM_LINUX_WIN(fileno(_x), _fileno(_x))
@@ -129,4 +135,24 @@ int arch_filesize(const char *Filename, off_t *Filesize);
 typedef void (ARCH_SIGNALDECL *ARCH_CTRLBREAK_HANDLER)(int dummy);
 extern void arch_set_ctrlbreak_handler(ARCH_CTRLBREAK_HANDLER Handler);
 
+/* threads and counting semaphores (arch/.../thread.c) */
+
+typedef struct arch_thread_s    ARCH_THREAD;
+typedef struct arch_semaphore_s ARCH_SEMAPHORE;
+
+typedef void (*ARCH_THREAD_FUNC)(void *Context);
+
+extern int  arch_thread_create(ARCH_THREAD **Thread, ARCH_THREAD_FUNC Func, void *Context);
+extern void arch_thread_join(ARCH_THREAD *Thread);
+
+extern int  arch_semaphore_create(ARCH_SEMAPHORE **Semaphore, unsigned int InitialCount);
+extern void arch_semaphore_wait(ARCH_SEMAPHORE *Semaphore);
+extern void arch_semaphore_post(ARCH_SEMAPHORE *Semaphore);
+extern void arch_semaphore_destroy(ARCH_SEMAPHORE *Semaphore);
+
+extern void arch_global_lock(void);
+extern void arch_global_unlock(void);
+
+extern unsigned long arch_time_us(void);
+
 #endif /* #ifndef CBM_ARCH_H */
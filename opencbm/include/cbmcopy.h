@@ -97,6 +97,52 @@ extern int cbmcopy_read_file_ts(CBM_FILE cbm_fd,
                                 cbmcopy_message_cb msg_cb,
                                 cbmcopy_status_cb status_cb);
 
+/*
+ * A session transfers many files to or from one drive. The drive
+ * type is determined only once, and the turbo routines stay in the
+ * drive between the files; they are only checked, not uploaded again.
+ *
+ * If read_directory is set, the directory is read when the session is
+ * opened. Files found in it are read by their first track and sector,
+ * without letting the drive search for them, and cbmcopy_session_order()
+ * can sort a list of files by their position on the disk.
+ *
+ * cbmcopy_session_open() returns NULL if there is not enough memory.
+ */
+typedef struct cbmcopy_session_s cbmcopy_session;
+
+extern cbmcopy_session *cbmcopy_session_open(CBM_FILE cbm_fd,
+                                             cbmcopy_settings *settings,
+                                             int drive,
+                                             int read_directory,
+                                             cbmcopy_message_cb msg_cb);
+
+extern int cbmcopy_session_read(cbmcopy_session *session,
+                                const char *cbmname,
+                                int cbmname_size,
+                                unsigned char **filedata,
+                                size_t *filedata_size,
+                                cbmcopy_status_cb status_cb);
+
+extern int cbmcopy_session_write(cbmcopy_session *session,
+                                 const char *cbmname,
+                                 int cbmname_size,
+                                 const unsigned char *filedata,
+                                 int filedata_size,
+                                 cbmcopy_status_cb status_cb);
+
+/*
+ * fill order[0..count-1] with the indices of the PETSCII file names
+ * cbmnames[], sorted by the first track of the files to keep the
+ * head movements short; files not in the directory go last.
+ */
+extern void cbmcopy_session_order(const cbmcopy_session *session,
+                                  const char * const *cbmnames,
+                                  int count,
+                                  int *order);
+
+extern void cbmcopy_session_close(cbmcopy_session *session);
+
 #ifdef __cplusplus
 }
 #endif
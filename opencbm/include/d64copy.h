@@ -57,6 +57,7 @@ typedef struct
     enum cbm_device_type_e drive_type;
     d64copy_bam_mode bam_mode;
     d64copy_error_mode error_mode;
+    int incremental;    /* only transfer blocks changed since the last run */
 } d64copy_settings;
 
 typedef struct
@@ -135,6 +136,15 @@ extern int d64copy_write_image(CBM_FILE cbm_fd,
                                d64copy_message_cb msg_cb,
                                d64copy_status_cb status_cb);
 
+/*
+ * write the given generation of an image that was read incrementally
+ * to target, using the generation log of the image
+ */
+extern int d64copy_rebuild_generation(const char *image,
+                                      int generation,
+                                      const char *target,
+                                      d64copy_message_cb msg_cb);
+
 extern void d64copy_cleanup(void);
 
 #ifdef __cplusplus
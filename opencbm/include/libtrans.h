@@ -48,6 +48,16 @@ libopencbmtransfer_write_mem(CBM_FILE HandleDevice, unsigned char DeviceAddress,
 int
 libopencbmtransfer_remove(CBM_FILE HandleDevice, unsigned char DeviceAddress);
 
+int
+libopencbmtransfer_upload(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                          opencbm_transfer_t TransferType, unsigned int DriveMemAddress,
+                          const unsigned char *Program, unsigned int Length);
+
+int
+libopencbmtransfer_download(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                            opencbm_transfer_t TransferType, unsigned int DriveMemAddress,
+                            unsigned char *Buffer, unsigned int Length);
+
 #ifdef LIBOCT_STATE_DEBUG
 extern void libopencbmtransfer_printStateDebugCounters(FILE *channel);
 #endif
@@ -336,6 +336,7 @@ typedef int CBMAPIDECL opencbm_plugin_tap_wait_for_play_sense_t(CBM_FILE HandleD
 typedef int CBMAPIDECL opencbm_plugin_tap_motor_on_t(CBM_FILE HandleDevice, int *Status);
 typedef int CBMAPIDECL opencbm_plugin_tap_motor_off_t(CBM_FILE HandleDevice, int *Status);
 typedef int CBMAPIDECL opencbm_plugin_tap_start_capture_t(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int Buffer_Length, int *Status, int *BytesRead);
+typedef int CBMAPIDECL opencbm_plugin_tap_start_capture_stream_t(CBM_FILE HandleDevice, CBM_TAP_STREAM_GET GetBuffer, CBM_TAP_STREAM_PUT PutBuffer, void *Context, int *Status, int *BytesRead);
 typedef int CBMAPIDECL opencbm_plugin_tap_start_write_t(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int Length, int *Status, int *BytesWritten);
 typedef int CBMAPIDECL opencbm_plugin_tap_get_ver_t(CBM_FILE HandleDevice, int *Status);
 typedef int CBMAPIDECL opencbm_plugin_tap_download_config_t(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int Buffer_Length, int *Status, int *BytesRead);
@@ -512,6 +513,259 @@ typedef int CBMAPIDECL opencbm_plugin_pp_cc_read_n_t (CBM_FILE HandleDevice,
 */
 typedef int CBMAPIDECL opencbm_plugin_pp_cc_write_n_t(CBM_FILE HandleDevice, const unsigned char *data, unsigned int size);
 
+/*! Specifies the protocol for the queued transfer functions */
+enum opencbm_plugin_protocol_e
+{
+    opencbm_proto_s1 = 1, /*!< serial-1 */
+    opencbm_proto_s2,     /*!< serial-2 */
+    opencbm_proto_pp_dc,  /*!< parallel, d64copy flavour */
+    opencbm_proto_pp_cc,  /*!< parallel, cbmcopy flavour */
+    opencbm_proto_nib     /*!< burst nibbler */
+};
+
+/*! \brief queue a read of a block of data from the OpenCBM backend
+
+ The read is started, but the function does not wait for it to finish.
+ This way, the backend can keep several requests in flight.
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the OpenCBM backend
+
+ \param Protocol
+    The protocol to use, one of enum opencbm_plugin_protocol_e
+
+ \param data
+    Pointer to a buffer which will contain the data read from the OpenCBM backend.
+    It must stay valid until opencbm_plugin_queue_flush() returned.
+
+ \param size
+    The number of bytes to read from the OpenCBM backend
+
+ \param BytesRead
+    Will contain the number of bytes actually read after the next
+    opencbm_plugin_queue_flush().
+
+ \return
+    0 if the read was queued, < 0 on error.
+*/
+typedef int CBMAPIDECL opencbm_plugin_queue_read_n_t (CBM_FILE HandleDevice, int Protocol,       unsigned char *data, unsigned int size, int *BytesRead);
+
+/*! \brief queue a write of a block of data to the OpenCBM backend
+
+ The write is started, but the function does not wait for it to finish.
+ This way, the backend can keep several requests in flight.
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the OpenCBM backend
+
+ \param Protocol
+    The protocol to use, one of enum opencbm_plugin_protocol_e
+
+ \param data
+    Pointer to buffer which contains the data to be written to the OpenCBM backend.
+    It must stay valid until opencbm_plugin_queue_flush() returned.
+
+ \param size
+    The length of the data buffer to be written to the OpenCBM backend
+
+ \param BytesWritten
+    Will contain the number of bytes actually written after the next
+    opencbm_plugin_queue_flush().
+
+ \return
+    0 if the write was queued, < 0 on error.
+*/
+typedef int CBMAPIDECL opencbm_plugin_queue_write_n_t(CBM_FILE HandleDevice, int Protocol, const unsigned char *data, unsigned int size, int *BytesWritten);
+
+/*! \brief wait for all queued transfers to finish
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the OpenCBM backend
+
+ \return
+    0 if all queued transfers succeeded, -1 if any of them failed.
+*/
+typedef int CBMAPIDECL opencbm_plugin_queue_flush_t(CBM_FILE HandleDevice);
+
+/*! \brief read a number of equally sized blocks from the OpenCBM backend
+
+ All blocks are transferred as one stream, without a request of the
+ host in between.
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the OpenCBM backend
+
+ \param Protocol
+    The protocol to use, one of enum opencbm_plugin_protocol_e, except
+    opencbm_proto_nib
+
+ \param data
+    Pointer to a buffer which will contain the blocks read from the OpenCBM backend
+
+ \param blocks
+    The number of blocks to read
+
+ \param blocksize
+    The size of each block, 1 to 256 bytes
+
+ \return
+    The number of blocks read completely, < 0 on a fatal error.
+*/
+typedef int CBMAPIDECL opencbm_plugin_stream_read_t (CBM_FILE HandleDevice, int Protocol,       unsigned char *data, unsigned int blocks, unsigned int blocksize);
+
+/*! \brief write a number of equally sized blocks to the OpenCBM backend
+
+ All blocks are transferred as one stream, without a request of the
+ host in between.
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the OpenCBM backend
+
+ \param Protocol
+    The protocol to use, one of enum opencbm_plugin_protocol_e, except
+    opencbm_proto_nib
+
+ \param data
+    Pointer to buffer which contains the blocks to be written to the OpenCBM backend
+
+ \param blocks
+    The number of blocks to write
+
+ \param blocksize
+    The size of each block, 1 to 256 bytes
+
+ \return
+    The number of blocks written completely, < 0 on a fatal error.
+*/
+typedef int CBMAPIDECL opencbm_plugin_stream_write_t(CBM_FILE HandleDevice, int Protocol, const unsigned char *data, unsigned int blocks, unsigned int blocksize);
+
+/*! \brief read the sectors of a track from a drive running the d64copy warp read
+
+ The track map is sent to the drive, and all sectors it sends back are
+ collected without a request of the host in between. Every sector
+ starts with its number and the job status, and if that is 0, it is
+ followed by 326 bytes of GCR data. The drive stops after a failed sector.
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the OpenCBM backend
+
+ \param Protocol
+    The protocol to use: opencbm_proto_s1, opencbm_proto_s2 or opencbm_proto_pp_dc
+
+ \param map
+    The track number, the sector count and the track map, exactly as
+    they are sent to the drive
+
+ \param mapsize
+    The size of map in bytes
+
+ \param sectors
+    The number of sectors the drive will send, at most 21
+
+ \param data
+    Pointer to a buffer for sectors * 326 bytes, which gets the GCR data
+    of the sectors read without error, back to back
+
+ \param results
+    Pointer to a buffer for sectors * 2 bytes, which gets the sector
+    number and the job status of every sector the drive sent
+
+ \return
+    The number of sectors in results, < 0 on a fatal error.
+*/
+typedef int CBMAPIDECL opencbm_plugin_warp_read_track_t(CBM_FILE HandleDevice, int Protocol, const unsigned char *map, unsigned int mapsize, unsigned int sectors, unsigned char *data, unsigned char *results);
+
+/*! Specifies the kind of an operation for opencbm_plugin_batch_submit() */
+enum opencbm_plugin_batch_op_e
+{
+    opencbm_batch_listen = 1, /*!< cbm_listen() */
+    opencbm_batch_talk,       /*!< cbm_talk() */
+    opencbm_batch_unlisten,   /*!< cbm_unlisten() */
+    opencbm_batch_untalk,     /*!< cbm_untalk() */
+    opencbm_batch_raw_write,  /*!< cbm_raw_write() */
+    opencbm_batch_raw_read    /*!< cbm_raw_read() */
+};
+
+/*! One operation of a batch given to opencbm_plugin_batch_submit() */
+typedef struct opencbm_plugin_batch_op_s
+{
+    int            Type;             /*!< one of enum opencbm_plugin_batch_op_e */
+    unsigned char  DeviceAddress;    /*!< listen, talk: the primary address */
+    unsigned char  SecondaryAddress; /*!< listen, talk: the secondary address */
+    void          *Buffer;           /*!< raw_write, raw_read: the data */
+    size_t         Count;            /*!< raw_write, raw_read: the number of bytes */
+    int            Result;           /*!< the result, as returned by the corresponding single function */
+} opencbm_plugin_batch_op_t;
+
+/*! \brief execute a batch of IEC operations
+
+ The operations are executed in order, with the same effect on the bus as
+ calling the corresponding single functions one after the other. The
+ backend is free to send them to the hardware without waiting for each
+ single result, though.
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the OpenCBM backend
+
+ \param Ops
+    Pointer to the operations. The Result member of each one is set
+    when the function returns.
+
+ \param Count
+    The number of operations in Ops
+
+ \return
+    0 if the batch was executed, < 0 on a fatal error. In the latter case,
+    the Result of the operations which could not be executed is -1.
+*/
+typedef int CBMAPIDECL opencbm_plugin_batch_submit_t(CBM_FILE HandleDevice, opencbm_plugin_batch_op_t *Ops, unsigned int Count);
+
+/*! The counters of the vdrive plugin, see opencbm_plugin_vdrive_get_stats() */
+typedef struct opencbm_plugin_vdrive_stats_s
+{
+    unsigned long long VirtualTime;   /*!< emulated time since the driver was opened, in ns */
+    unsigned long      Transactions;  /*!< round trips between the host and the adapter */
+    unsigned long      LineOperations;/*!< single IEC line or parallel port accesses */
+    unsigned long      BusBytes;      /*!< bytes transferred over the bus, in either direction */
+    unsigned long      SectorsRead;   /*!< sectors read from the disk */
+    unsigned long      SectorsWritten;/*!< sectors written to the disk */
+    unsigned long      Commands;      /*!< commands executed on the command channel */
+} opencbm_plugin_vdrive_stats_t;
+
+/*! \brief get the counters of the vdrive plugin
+
+ The vdrive plugin emulates a drive and the adapter it is connected
+ to, and counts what the host did on the way. The time is not measured,
+ but derived from a latency model, so it is the same on every run.
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the OpenCBM backend
+
+ \param Stats
+    Will contain the counters since the driver was opened.
+
+ \return
+    0 on success, -1 on error.
+*/
+typedef int CBMAPIDECL opencbm_plugin_vdrive_get_stats_t(CBM_FILE HandleDevice, opencbm_plugin_vdrive_stats_t *Stats);
+
+/*! \brief let the emulated time of the vdrive plugin pass
+
+ This is what a sleep of the host is for the emulated drive: the drive
+ goes on with its work, and the time is counted, but it does not pass
+ in reality.
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the OpenCBM backend
+
+ \param Microseconds
+    The time to pass.
+
+ \return
+    0 on success, -1 on error.
+*/
+typedef int CBMAPIDECL opencbm_plugin_vdrive_sleep_t(CBM_FILE HandleDevice, unsigned long Microseconds);
+
 
 /*! \brief @@@@@ \todo document
 
@@ -593,6 +847,7 @@ struct opencbm_plugin_s {
     opencbm_plugin_tap_motor_on_t               * opencbm_plugin_tap_motor_on;            /*!< pointer to a opencbm_plugin_tap_motor_on_t() function */
     opencbm_plugin_tap_motor_off_t              * opencbm_plugin_tap_motor_off;           /*!< pointer to a opencbm_plugin_tap_motor_off_t() function */
     opencbm_plugin_tap_start_capture_t          * opencbm_plugin_tap_start_capture;       /*!< pointer to a opencbm_plugin_tap_start_capture_t() function */
+    opencbm_plugin_tap_start_capture_stream_t   * opencbm_plugin_tap_start_capture_stream; /*!< pointer to a opencbm_plugin_tap_start_capture_stream_t() function */
     opencbm_plugin_tap_start_write_t            * opencbm_plugin_tap_start_write;         /*!< pointer to a opencbm_plugin_tap_start_write_t() function */
     opencbm_plugin_tap_get_ver_t                * opencbm_plugin_tap_get_ver;             /*!< pointer to a opencbm_plugin_tap_get_ver_t() function */
     opencbm_plugin_tap_download_config_t        * opencbm_plugin_tap_download_config;     /*!< pointer to a opencbm_plugin_tap_download_config_t() function */
@@ -146,6 +146,7 @@ EXTERN void CBMAPIDECL cbm_unlock(CBM_FILE f);
 /*! \todo FIXME: port isn't used yet */
 EXTERN const char * CBMAPIDECL cbm_get_driver_name(int port);
 EXTERN const char * CBMAPIDECL cbm_get_driver_name_ex(char * adapter);
+EXTERN const char * CBMAPIDECL cbm_get_adapter_name(const char * adapter);
 
 EXTERN int CBMAPIDECL cbm_listen(CBM_FILE f, unsigned char dev, unsigned char secadr);
 EXTERN int CBMAPIDECL cbm_talk(CBM_FILE f, unsigned char dev, unsigned char secadr);
@@ -175,6 +176,9 @@ EXTERN void CBMAPIDECL cbm_iec_setrelease(CBM_FILE f, int set, int release);
 EXTERN int CBMAPIDECL cbm_iec_wait(CBM_FILE f, int line, int state);
 
 EXTERN int CBMAPIDECL cbm_upload(CBM_FILE f, unsigned char dev, int adr, const void *prog, size_t size);
+EXTERN int CBMAPIDECL cbm_upload_cached(CBM_FILE f, unsigned char dev, int adr, const void *prog, size_t size);
+EXTERN int CBMAPIDECL cbm_drive_code_resident(CBM_FILE f, unsigned char dev, int adr, const void *prog, size_t size);
+EXTERN void CBMAPIDECL cbm_drive_code_uploaded(CBM_FILE f, unsigned char dev, int adr, const void *prog, size_t size);
 EXTERN int CBMAPIDECL cbm_download(CBM_FILE f, unsigned char dev, int adr, void *dbuf, size_t size);
 
 EXTERN int CBMAPIDECL cbm_device_status(CBM_FILE f, unsigned char dev, void *buf, size_t bufsize);
@@ -189,6 +193,61 @@ EXTERN int CBMAPIDECL cbm_identify_xp1541(CBM_FILE HandleDevice,
                                           enum cbm_device_type_e *CbmDeviceType,
                                           enum cbm_cable_type_e *CableType);
 
+/* scanning the bus for devices */
+
+#define CBM_BUS_FIRST_DEVICE  4 /*!< the lowest device address cbm_bus_scan() probes */
+#define CBM_BUS_LAST_DEVICE  30 /*!< the highest device address cbm_bus_scan() probes */
+
+EXTERN int CBMAPIDECL cbm_bus_scan(CBM_FILE f, unsigned long *devices);
+EXTERN int CBMAPIDECL cbm_bus_identify(CBM_FILE f, unsigned char drv,
+                                       enum cbm_device_type_e *t,
+                                       const char **type_str);
+
+/* batches of IEC operations, executed as one unit */
+
+/*! A batch of IEC operations, see cbm_batch_create() */
+typedef struct cbm_batch_s CBM_BATCH;
+
+EXTERN CBM_BATCH * CBMAPIDECL cbm_batch_create(void);
+EXTERN void CBMAPIDECL cbm_batch_free(CBM_BATCH *batch);
+EXTERN void CBMAPIDECL cbm_batch_clear(CBM_BATCH *batch);
+
+EXTERN int CBMAPIDECL cbm_batch_listen(CBM_BATCH *batch, unsigned char dev, unsigned char secadr);
+EXTERN int CBMAPIDECL cbm_batch_talk(CBM_BATCH *batch, unsigned char dev, unsigned char secadr);
+EXTERN int CBMAPIDECL cbm_batch_unlisten(CBM_BATCH *batch);
+EXTERN int CBMAPIDECL cbm_batch_untalk(CBM_BATCH *batch);
+EXTERN int CBMAPIDECL cbm_batch_raw_write(CBM_BATCH *batch, const void *buf, size_t size);
+EXTERN int CBMAPIDECL cbm_batch_raw_read(CBM_BATCH *batch, void *buf, size_t size);
+
+EXTERN int CBMAPIDECL cbm_batch_submit(CBM_FILE f, CBM_BATCH *batch);
+EXTERN int CBMAPIDECL cbm_batch_result(CBM_BATCH *batch, int op);
+
+/* reading the directory of a disk */
+
+/*! A file in the directory of a disk, see cbm_read_directory() */
+typedef struct cbm_directory_entry_s
+{
+    unsigned char name[17];     /*!< the file name in PETSCII, without the filling shifted spaces */
+    unsigned char type;         /*!< the file type byte: bits 0-2 are the type (2 = PRG), bit 6 is set if locked, bit 7 if closed */
+    unsigned int blocks;        /*!< the size of the file in blocks, as stored in the directory */
+    unsigned char track;        /*!< the track of the first block of the file */
+    unsigned char sector;       /*!< the sector of the first block of the file */
+} CBM_DIRECTORY_ENTRY;
+
+/*! The directory of a disk, as returned by cbm_read_directory() */
+typedef struct cbm_directory_s
+{
+    unsigned char name[17];     /*!< the disk name in PETSCII, without the filling shifted spaces */
+    unsigned char id[6];        /*!< the disk ID, a space and the DOS type, in PETSCII ("ID 2A") */
+    unsigned int blocks_free;   /*!< the number of free blocks, as the DOS shows it */
+    unsigned int count;         /*!< the number of files */
+    unsigned int allocated;     /*!< internal: the number of files there is room for in entries */
+    CBM_DIRECTORY_ENTRY *entries; /*!< the files, in the order of the directory */
+} CBM_DIRECTORY;
+
+EXTERN int CBMAPIDECL cbm_read_directory(CBM_FILE f, unsigned char dev, unsigned char drive, CBM_DIRECTORY **directory);
+EXTERN void CBMAPIDECL cbm_directory_free(CBM_DIRECTORY *directory);
+
 
 EXTERN char CBMAPIDECL cbm_petscii2ascii_c(char character);
 EXTERN char CBMAPIDECL cbm_ascii2petscii_c(char character);
@@ -199,6 +258,11 @@ EXTERN int CBMAPIDECL gcr_5_to_4_decode(const unsigned char *source, unsigned ch
                                         size_t sourceLength,         size_t destLength);
 EXTERN int CBMAPIDECL gcr_4_to_5_encode(const unsigned char *source, unsigned char *dest,
                                         size_t sourceLength,         size_t destLength);
+EXTERN int CBMAPIDECL gcr_decode_buffer(const unsigned char *source, unsigned char *dest,
+                                        size_t sourceLength,         size_t destLength);
+EXTERN int CBMAPIDECL gcr_encode_buffer(const unsigned char *source, unsigned char *dest,
+                                        size_t sourceLength,         size_t destLength);
+EXTERN const char * CBMAPIDECL gcr_select_codec(const char *name);
 
 
 #if DBG
@@ -233,12 +297,18 @@ EXTERN int CBMAPIDECL cbm_srq_burst_write_track(CBM_FILE f, unsigned char *buffe
 
 /* functions specifically for CBM 153x tape drive */
 
+/*! Gets the next empty buffer for cbm_tap_start_capture_stream(), or NULL to abort */
+typedef unsigned char * (*CBM_TAP_STREAM_GET)(void *Context, unsigned int *Length);
+/*! Hands a buffer filled with Length bytes of capture data back to the caller */
+typedef void (*CBM_TAP_STREAM_PUT)(void *Context, unsigned char *Buffer, unsigned int Length);
+
 EXTERN int CBMAPIDECL cbm_tap_prepare_capture(CBM_FILE f, int *Status);
 EXTERN int CBMAPIDECL cbm_tap_prepare_write(CBM_FILE f, int *Status);
 EXTERN int CBMAPIDECL cbm_tap_get_sense(CBM_FILE f, int *Status);
 EXTERN int CBMAPIDECL cbm_tap_wait_for_stop_sense(CBM_FILE f, int *Status);
 EXTERN int CBMAPIDECL cbm_tap_wait_for_play_sense(CBM_FILE f, int *Status);
 EXTERN int CBMAPIDECL cbm_tap_start_capture(CBM_FILE f, unsigned char *Buffer, unsigned int Buffer_Length, int *Status, int *BytesRead);
+EXTERN int CBMAPIDECL cbm_tap_start_capture_stream(CBM_FILE f, CBM_TAP_STREAM_GET GetBuffer, CBM_TAP_STREAM_PUT PutBuffer, void *Context, int *Status, int *BytesRead);
 EXTERN int CBMAPIDECL cbm_tap_start_write(CBM_FILE f, unsigned char *Buffer, unsigned int Length, int *Status, int *BytesWritten);
 EXTERN int CBMAPIDECL cbm_tap_motor_on(CBM_FILE f, int *Status);
 EXTERN int CBMAPIDECL cbm_tap_motor_off(CBM_FILE f, int *Status);
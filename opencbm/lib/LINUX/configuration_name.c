@@ -55,3 +55,25 @@ configuration_get_default_filename(void)
     }
     return cbmlibmisc_strdup(OPENCBM_DEFAULT_CONFIGURATION_FILE_NAME);
 }
+
+/*! \brief The name of the drive cache file, relative to the home directory */
+#define OPENCBM_DRIVE_CACHE_FILEPATH "/.opencbm.cache"
+
+/*! \brief Get the filename for the drive cache
+
+ Get the name of the file which remembers the drives and the
+ programs uploaded into them between two runs.
+
+ \return 
+   Returns a newly allocated memory area with the file name,
+   or NULL if there is no home directory.
+*/
+const char *
+configuration_get_drive_cache_filename(void)
+{
+    char* home = getenv("HOME");
+    if (home == NULL || home[0] == 0) {
+      return NULL;
+    }
+    return cbmlibmisc_strcat(home, OPENCBM_DRIVE_CACHE_FILEPATH);
+}
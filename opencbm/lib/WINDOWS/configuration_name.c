@@ -227,3 +227,29 @@ configuration_get_default_filename_for_install(unsigned int DefaultLocation)
 }
 
 
+
+/*! \brief The filename of the drive cache file */
+#define FILENAME_DRIVECACHE "opencbm.cache"
+
+/*! \brief Get the filename for the drive cache
+
+ Get the name of the file which remembers the drives and the
+ programs uploaded into them between two runs.
+
+ \return 
+   Returns a newly allocated memory area with the file name,
+   or NULL if there is no user profile directory.
+*/
+const char *
+configuration_get_drive_cache_filename(void)
+{
+    char * buffer = NULL;
+    char * userdir = get_userdir();
+
+    if (userdir != NULL) {
+        buffer = cbmlibmisc_strcat(userdir, "/" FILENAME_DRIVECACHE);
+        free(userdir);
+    }
+
+    return buffer;
+}
@@ -76,6 +76,7 @@ EXTERN opencbm_plugin_tap_wait_for_play_sense_t    opencbm_plugin_tap_wait_for_p
 EXTERN opencbm_plugin_tap_motor_on_t               opencbm_plugin_tap_motor_on;
 EXTERN opencbm_plugin_tap_motor_off_t              opencbm_plugin_tap_motor_off;
 EXTERN opencbm_plugin_tap_start_capture_t          opencbm_plugin_tap_start_capture;
+EXTERN opencbm_plugin_tap_start_capture_stream_t   opencbm_plugin_tap_start_capture_stream;
 EXTERN opencbm_plugin_tap_start_write_t            opencbm_plugin_tap_start_write;
 EXTERN opencbm_plugin_tap_get_ver_t                opencbm_plugin_tap_get_ver;
 EXTERN opencbm_plugin_tap_download_config_t        opencbm_plugin_tap_download_config;
@@ -91,6 +92,17 @@ EXTERN opencbm_plugin_pp_dc_write_n_t              opencbm_plugin_pp_dc_write_n;
 EXTERN opencbm_plugin_pp_cc_read_n_t               opencbm_plugin_pp_cc_read_n;
 EXTERN opencbm_plugin_pp_cc_write_n_t              opencbm_plugin_pp_cc_write_n;
 
+EXTERN opencbm_plugin_queue_read_n_t               opencbm_plugin_queue_read_n;
+EXTERN opencbm_plugin_queue_write_n_t              opencbm_plugin_queue_write_n;
+EXTERN opencbm_plugin_queue_flush_t                opencbm_plugin_queue_flush;
+
+EXTERN opencbm_plugin_stream_read_t                opencbm_plugin_stream_read;
+EXTERN opencbm_plugin_stream_write_t               opencbm_plugin_stream_write;
+
+EXTERN opencbm_plugin_warp_read_track_t            opencbm_plugin_warp_read_track;
+
+EXTERN opencbm_plugin_batch_submit_t               opencbm_plugin_batch_submit;
+
 EXTERN opencbm_plugin_iec_dbg_read_t               opencbm_plugin_iec_dbg_read;
 EXTERN opencbm_plugin_iec_dbg_write_t              opencbm_plugin_iec_dbg_write;
 
@@ -0,0 +1,529 @@
+/*
+ *      This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file lib/batch.c \n
+** \n
+** \brief Shared library / DLL for accessing the driver:
+**        batches of IEC operations
+**
+** A batch records a sequence of LISTEN, TALK, UNLISTEN, UNTALK and
+** raw read and write operations, and executes them with one call.
+** If the plugin supports it, it gets the whole batch at once, and can
+** send the operations to the hardware without waiting for each single
+** result. Otherwise, the operations are executed one by one.
+**
+****************************************************************/
+
+/*! Mark: We are in user-space (for debug.h) */
+#define DBG_USERMODE
+
+/*! The name of the executable */
+#define DBG_PROGNAME "OPENCBM.DLL"
+
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//! mark: We are building the DLL */
+#define DLL
+#include "opencbm.h"
+#include "archlib.h"
+
+/*! The number of operations a new batch has room for */
+#define BATCH_INITIAL_OPS 16
+
+/*! A batch of IEC operations */
+struct cbm_batch_s
+{
+    opencbm_plugin_batch_op_t *ops; /*!< the recorded operations */
+    unsigned int count;             /*!< the number of recorded operations */
+    unsigned int allocated;         /*!< the number of operations ops has room for */
+};
+
+
+/*-------------------------------------------------------------------*/
+/*--------- HELPER FUNCTIONS ----------------------------------------*/
+
+/*! \internal \brief Append an operation to a batch
+
+ \param Batch
+   The batch to append to.
+
+ \param Type
+   The type of the operation, one of enum opencbm_plugin_batch_op_e.
+
+ \return
+   The new operation, or NULL if there is not enough memory.
+*/
+
+static opencbm_plugin_batch_op_t *
+batch_append(CBM_BATCH *Batch, int Type)
+{
+    opencbm_plugin_batch_op_t *op;
+
+    DBG_ASSERT(Batch != NULL);
+
+    if (Batch->count == Batch->allocated)
+    {
+        unsigned int allocated = Batch->allocated ? 2 * Batch->allocated : BATCH_INITIAL_OPS;
+
+        op = realloc(Batch->ops, allocated * sizeof(*op));
+        if (op == NULL)
+            return NULL;
+
+        Batch->ops = op;
+        Batch->allocated = allocated;
+    }
+
+    op = &Batch->ops[Batch->count++];
+    memset(op, 0, sizeof(*op));
+    op->Type = Type;
+    op->Result = -1;
+
+    return op;
+}
+
+/*! \internal \brief Check if an executed operation succeeded
+
+ \param Op
+   The operation to check.
+
+ \return
+   Nonzero if the operation succeeded, 0 if not.
+*/
+
+static int
+batch_op_succeeded(const opencbm_plugin_batch_op_t *Op)
+{
+    switch (Op->Type)
+    {
+    case opencbm_batch_raw_write:
+        return Op->Result == (int) Op->Count;
+
+    case opencbm_batch_raw_read:
+        return Op->Result >= 0;
+
+    default:
+        return Op->Result == 0;
+    }
+}
+
+/*! \internal \brief Execute the operations of a batch one by one
+
+ This is used if the plugin cannot execute a batch by itself.
+ After the first operation which fails, the remaining ones are
+ not executed anymore.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Batch
+   The batch to execute.
+*/
+
+static void
+batch_execute_single(CBM_FILE HandleDevice, CBM_BATCH *Batch)
+{
+    unsigned int i;
+
+    for (i = 0; i < Batch->count; i++)
+    {
+        opencbm_plugin_batch_op_t *op = &Batch->ops[i];
+
+        switch (op->Type)
+        {
+        case opencbm_batch_listen:
+            op->Result = cbm_listen(HandleDevice, op->DeviceAddress, op->SecondaryAddress);
+            break;
+
+        case opencbm_batch_talk:
+            op->Result = cbm_talk(HandleDevice, op->DeviceAddress, op->SecondaryAddress);
+            break;
+
+        case opencbm_batch_unlisten:
+            op->Result = cbm_unlisten(HandleDevice);
+            break;
+
+        case opencbm_batch_untalk:
+            op->Result = cbm_untalk(HandleDevice);
+            break;
+
+        case opencbm_batch_raw_write:
+            op->Result = cbm_raw_write(HandleDevice, op->Buffer, op->Count);
+            break;
+
+        case opencbm_batch_raw_read:
+            op->Result = cbm_raw_read(HandleDevice, op->Buffer, op->Count);
+            break;
+
+        default:
+            DBG_ERROR((DBG_PREFIX "unknown batch operation %d", op->Type));
+            op->Result = -1;
+            break;
+        }
+
+        if (!batch_op_succeeded(op))
+            break;
+    }
+}
+
+
+/*-------------------------------------------------------------------*/
+/*--------- BATCH FUNCTIONS -----------------------------------------*/
+
+/*! \brief Create an empty batch of IEC operations
+
+ \return
+   The new batch, or NULL if there is not enough memory.
+   It must be freed with cbm_batch_free().
+*/
+
+CBM_BATCH * CBMAPIDECL
+cbm_batch_create(void)
+{
+    CBM_BATCH *batch;
+
+    FUNC_ENTER();
+
+    batch = calloc(1, sizeof(*batch));
+
+    FUNC_LEAVE_PTR(batch, CBM_BATCH*);
+}
+
+/*! \brief Free a batch of IEC operations
+
+ \param Batch
+   The batch, as returned by cbm_batch_create(). NULL is allowed.
+*/
+
+void CBMAPIDECL
+cbm_batch_free(CBM_BATCH *Batch)
+{
+    FUNC_ENTER();
+
+    if (Batch)
+    {
+        cbm_batch_clear(Batch);
+        free(Batch->ops);
+        free(Batch);
+    }
+
+    FUNC_LEAVE();
+}
+
+/*! \brief Remove all operations from a batch
+
+ After this, the batch can be used to record new operations.
+
+ \param Batch
+   The batch, as returned by cbm_batch_create().
+*/
+
+void CBMAPIDECL
+cbm_batch_clear(CBM_BATCH *Batch)
+{
+    unsigned int i;
+
+    FUNC_ENTER();
+
+    DBG_ASSERT(Batch != NULL);
+
+    for (i = 0; i < Batch->count; i++)
+    {
+        // the data of the writes was copied by cbm_batch_raw_write()
+        if (Batch->ops[i].Type == opencbm_batch_raw_write)
+            free(Batch->ops[i].Buffer);
+    }
+    Batch->count = 0;
+
+    FUNC_LEAVE();
+}
+
+/*! \brief Record a LISTEN in a batch
+
+ \param Batch
+   The batch, as returned by cbm_batch_create().
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param SecondaryAddress
+   The secondary address for the device on the IEC serial bus.
+
+ \return
+   The index of the operation, for cbm_batch_result(),
+   or -1 if there is not enough memory.
+*/
+
+int CBMAPIDECL
+cbm_batch_listen(CBM_BATCH *Batch, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    opencbm_plugin_batch_op_t *op;
+
+    FUNC_ENTER();
+
+    op = batch_append(Batch, opencbm_batch_listen);
+    if (op == NULL)
+        FUNC_LEAVE_INT(-1);
+
+    op->DeviceAddress = DeviceAddress;
+    op->SecondaryAddress = SecondaryAddress;
+
+    FUNC_LEAVE_INT(Batch->count - 1);
+}
+
+/*! \brief Record a TALK in a batch
+
+ \param Batch
+   The batch, as returned by cbm_batch_create().
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param SecondaryAddress
+   The secondary address for the device on the IEC serial bus.
+
+ \return
+   The index of the operation, for cbm_batch_result(),
+   or -1 if there is not enough memory.
+*/
+
+int CBMAPIDECL
+cbm_batch_talk(CBM_BATCH *Batch, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    opencbm_plugin_batch_op_t *op;
+
+    FUNC_ENTER();
+
+    op = batch_append(Batch, opencbm_batch_talk);
+    if (op == NULL)
+        FUNC_LEAVE_INT(-1);
+
+    op->DeviceAddress = DeviceAddress;
+    op->SecondaryAddress = SecondaryAddress;
+
+    FUNC_LEAVE_INT(Batch->count - 1);
+}
+
+/*! \brief Record an UNLISTEN in a batch
+
+ \param Batch
+   The batch, as returned by cbm_batch_create().
+
+ \return
+   The index of the operation, for cbm_batch_result(),
+   or -1 if there is not enough memory.
+*/
+
+int CBMAPIDECL
+cbm_batch_unlisten(CBM_BATCH *Batch)
+{
+    FUNC_ENTER();
+
+    if (batch_append(Batch, opencbm_batch_unlisten) == NULL)
+        FUNC_LEAVE_INT(-1);
+
+    FUNC_LEAVE_INT(Batch->count - 1);
+}
+
+/*! \brief Record an UNTALK in a batch
+
+ \param Batch
+   The batch, as returned by cbm_batch_create().
+
+ \return
+   The index of the operation, for cbm_batch_result(),
+   or -1 if there is not enough memory.
+*/
+
+int CBMAPIDECL
+cbm_batch_untalk(CBM_BATCH *Batch)
+{
+    FUNC_ENTER();
+
+    if (batch_append(Batch, opencbm_batch_untalk) == NULL)
+        FUNC_LEAVE_INT(-1);
+
+    FUNC_LEAVE_INT(Batch->count - 1);
+}
+
+/*! \brief Record a write of raw data in a batch
+
+ The data is copied, so the buffer can be reused as soon as this
+ function returns. As with cbm_raw_write(), the last byte is sent
+ with EOI; thus, consecutive writes are not merged.
+
+ \param Batch
+   The batch, as returned by cbm_batch_create().
+
+ \param Buffer
+   Pointer to the bytes to be written.
+
+ \param Count
+   Number of bytes to be written.
+
+ \return
+   The index of the operation, for cbm_batch_result(),
+   or -1 if there is not enough memory.
+*/
+
+int CBMAPIDECL
+cbm_batch_raw_write(CBM_BATCH *Batch, const void *Buffer, size_t Count)
+{
+    opencbm_plugin_batch_op_t *op;
+    void *data;
+
+    FUNC_ENTER();
+
+    data = malloc(Count ? Count : 1);
+    if (data == NULL)
+        FUNC_LEAVE_INT(-1);
+
+    op = batch_append(Batch, opencbm_batch_raw_write);
+    if (op == NULL)
+    {
+        free(data);
+        FUNC_LEAVE_INT(-1);
+    }
+
+    memcpy(data, Buffer, Count);
+    op->Buffer = data;
+    op->Count = Count;
+
+    FUNC_LEAVE_INT(Batch->count - 1);
+}
+
+/*! \brief Record a read of raw data in a batch
+
+ \param Batch
+   The batch, as returned by cbm_batch_create().
+
+ \param Buffer
+   Pointer to a buffer which will hold the bytes read. It must
+   stay valid until cbm_batch_submit() returned.
+
+ \param Count
+   Number of bytes to be read at most.
+
+ \return
+   The index of the operation, for cbm_batch_result(),
+   or -1 if there is not enough memory.
+*/
+
+int CBMAPIDECL
+cbm_batch_raw_read(CBM_BATCH *Batch, void *Buffer, size_t Count)
+{
+    opencbm_plugin_batch_op_t *op;
+
+    FUNC_ENTER();
+
+    op = batch_append(Batch, opencbm_batch_raw_read);
+    if (op == NULL)
+        FUNC_LEAVE_INT(-1);
+
+    op->Buffer = Buffer;
+    op->Count = Count;
+
+    FUNC_LEAVE_INT(Batch->count - 1);
+}
+
+/*! \brief Execute a batch of IEC operations
+
+ The recorded operations are executed in order. If the plugin
+ can execute batches, it gets all of them at once; otherwise,
+ they are executed one by one, stopping at the first failure.
+ The batch itself is not changed; it can be submitted again.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Batch
+   The batch, as returned by cbm_batch_create().
+
+ \return
+   0 if all operations succeeded, -1 if not. In the latter case,
+   cbm_batch_result() tells which ones failed. Operations after a
+   failed one might or might not have been executed.
+
+ If cbm_driver_open() did not succeed, it is illegal to
+ call this function.
+*/
+
+int CBMAPIDECL
+cbm_batch_submit(CBM_FILE HandleDevice, CBM_BATCH *Batch)
+{
+    opencbm_plugin_batch_submit_t *plugin_batch_submit;
+    unsigned int i;
+    int ret = 0;
+
+    FUNC_ENTER();
+
+    DBG_ASSERT(Batch != NULL);
+
+    for (i = 0; i < Batch->count; i++)
+        Batch->ops[i].Result = -1;
+
+    if (Batch->count == 0)
+        FUNC_LEAVE_INT(0);
+
+    plugin_batch_submit = cbm_get_plugin_function_address("opencbm_plugin_batch_submit");
+
+    if (plugin_batch_submit)
+    {
+        // a fatal error is reported through the Result of the operations
+        plugin_batch_submit(HandleDevice, Batch->ops, Batch->count);
+    }
+    else
+    {
+        batch_execute_single(HandleDevice, Batch);
+    }
+
+    for (i = 0; i < Batch->count; i++)
+    {
+        if (!batch_op_succeeded(&Batch->ops[i]))
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    FUNC_LEAVE_INT(ret);
+}
+
+/*! \brief Get the result of an operation of a submitted batch
+
+ \param Batch
+   The batch, as given to cbm_batch_submit().
+
+ \param Op
+   The index of the operation, as returned when recording it.
+
+ \return
+   The result of the operation, as the corresponding single function
+   (cbm_listen(), cbm_raw_write(), ...) would have returned it.
+   -1 if the operation was not executed, or Op is invalid.
+*/
+
+int CBMAPIDECL
+cbm_batch_result(CBM_BATCH *Batch, int Op)
+{
+    int ret = -1;
+
+    FUNC_ENTER();
+
+    DBG_ASSERT(Batch != NULL);
+
+    if (Op >= 0 && (unsigned int) Op < Batch->count)
+        ret = Batch->ops[Op].Result;
+
+    FUNC_LEAVE_INT(ret);
+}
@@ -26,6 +26,7 @@
 
 #include "debug.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -44,6 +45,8 @@
 
 #include "arch.h"
 
+#include "internal.h"
+
 /*! \brief @@@@@ \todo document
 
  \param Handle
@@ -116,6 +119,9 @@ int plugin_set_inactive(const char PluginName[])
 struct plugin_information_s {
     SHARED_OBJECT_HANDLE Library; /*!< \brief @@@@@ \todo document */
     opencbm_plugin_t     Plugin;  /*!< \brief @@@@@ \todo document */
+    unsigned int         OpenCount; /*!< \brief number of handles currently opened with this plugin */
+    char               * Name;    /*!< \brief the name of the plugin, as given in the configuration file */
+    unsigned int         LazyBound; /*!< \brief the lazy groups of entry points which have been read, one bit for each enum plugin_group_e */
 };
 
 /*! \brief @@@@@ \todo document */
@@ -175,12 +181,6 @@ static struct plugin_read_pointer plugin_pointer_to_read_optional[] =
 	PLUGIN_POINTER_DEF(opencbm_plugin_unlock),
 	PLUGIN_POINTER_DEF(opencbm_plugin_iec_set),
 	PLUGIN_POINTER_DEF(opencbm_plugin_iec_release),
-	PLUGIN_POINTER_DEF(opencbm_plugin_parallel_burst_read),
-	PLUGIN_POINTER_DEF(opencbm_plugin_parallel_burst_write),
-	PLUGIN_POINTER_DEF(opencbm_plugin_parallel_burst_read_track),
-	PLUGIN_POINTER_DEF(opencbm_plugin_parallel_burst_write_track),
-	PLUGIN_POINTER_DEF(opencbm_plugin_pp_read),
-	PLUGIN_POINTER_DEF(opencbm_plugin_pp_write),
     PLUGIN_POINTER_END()
 };
 
@@ -219,6 +219,7 @@ static struct plugin_read_pointer plugin_pointer_to_read_tape[] =
 	PLUGIN_POINTER_DEF(opencbm_plugin_tap_motor_on),
 	PLUGIN_POINTER_DEF(opencbm_plugin_tap_motor_off),
 	PLUGIN_POINTER_DEF(opencbm_plugin_tap_start_capture),
+	PLUGIN_POINTER_DEF(opencbm_plugin_tap_start_capture_stream),
 	PLUGIN_POINTER_DEF(opencbm_plugin_tap_start_write),
 	PLUGIN_POINTER_DEF(opencbm_plugin_tap_get_ver),
 	PLUGIN_POINTER_DEF(opencbm_plugin_tap_download_config),
@@ -234,18 +235,32 @@ struct plugin_read_pointer_group
     enum {
         PRP_MANDATORY,
         PRP_OPTIONAL,
-        PRP_OPTIONAL_ALL_OR_NOTHING
+        PRP_OPTIONAL_ALL_OR_NOTHING,
+        PRP_LAZY_ALL_OR_NOTHING     /* read on first use, cf. plugin_bind_lazy() */
     } type;
 };
 
+/*! \brief the groups of entry points, as indices into read_pointer_group[] */
+enum plugin_group_e {
+    PLUGIN_GROUP_MANDATORY,
+    PLUGIN_GROUP_OPTIONAL,
+    PLUGIN_GROUP_PARALLEL_BURST,
+    PLUGIN_GROUP_PP_READWRITE,
+    PLUGIN_GROUP_SRQ_BURST,
+    PLUGIN_GROUP_TAPE
+};
+
+/* Most tools only use the IEC functions. Thus, the entry points of the
+ * other transfer methods are only read when they are used first.
+ */
 static struct plugin_read_pointer_group read_pointer_group[] =
 {
     { plugin_pointer_to_read_mandatory, PRP_MANDATORY },
     { plugin_pointer_to_read_optional, PRP_OPTIONAL },
-    { plugin_pointer_to_read_parallel_burst, PRP_OPTIONAL_ALL_OR_NOTHING },
-    { plugin_pointer_to_read_pp_readwrite, PRP_OPTIONAL_ALL_OR_NOTHING },
-    { plugin_pointer_to_read_srq_burst, PRP_OPTIONAL_ALL_OR_NOTHING },
-    { plugin_pointer_to_read_tape, PRP_OPTIONAL_ALL_OR_NOTHING },
+    { plugin_pointer_to_read_parallel_burst, PRP_LAZY_ALL_OR_NOTHING },
+    { plugin_pointer_to_read_pp_readwrite, PRP_LAZY_ALL_OR_NOTHING },
+    { plugin_pointer_to_read_srq_burst, PRP_LAZY_ALL_OR_NOTHING },
+    { plugin_pointer_to_read_tape, PRP_LAZY_ALL_OR_NOTHING },
     { NULL, PRP_OPTIONAL }
 };
 
@@ -320,6 +335,11 @@ read_plugin_pointer_groups(
     int error = 0;
 
     while (pointer_to_read_group->read_pointer) {
+        if (pointer_to_read_group->type == PRP_LAZY_ALL_OR_NOTHING) {
+            ++pointer_to_read_group;
+            continue;
+        }
+
         read_plugin_pointer(Plugin_information, pointer_to_read_group->read_pointer);
 
         switch (pointer_to_read_group->type) {
@@ -332,6 +352,8 @@ read_plugin_pointer_groups(
         case PRP_OPTIONAL_ALL_OR_NOTHING:
             error = error || check_plugin_pointer_all_or_nothing(Plugin_information, pointer_to_read_group->read_pointer);
             break;
+        case PRP_LAZY_ALL_OR_NOTHING:
+            break;
         };
 
         ++pointer_to_read_group;
@@ -340,8 +362,150 @@ read_plugin_pointer_groups(
     return error;
 }
 
+/*! \brief Read a lazy group of entry points of the plugin
+
+ The entry points of the groups of type PRP_LAZY_ALL_OR_NOTHING are
+ not read when the plugin is loaded, but when a function which needs
+ them is called the first time.
+
+ \param Group
+   The group of entry points which is needed.
+*/
+static void
+plugin_bind_lazy(enum plugin_group_e Group)
+{
+    unsigned int mask = 1u << Group;
+
+    if (Plugin_information.LazyBound & mask) {
+        return;
+    }
+
+    arch_global_lock();
+
+    if ( ! (Plugin_information.LazyBound & mask) && Plugin_information.Library) {
+        struct plugin_read_pointer * read_pointer = read_pointer_group[Group].read_pointer;
+
+        read_plugin_pointer(&Plugin_information, read_pointer);
+
+        if (check_plugin_pointer_all_or_nothing(&Plugin_information, read_pointer)) {
+            DBG_WARN((DBG_PREFIX "The entry points of group %u of the plugin do not validate correctly.",
+                (unsigned int) Group));
+        }
+
+        Plugin_information.LazyBound |= mask;
+    }
+
+    arch_global_unlock();
+}
+
+/*! \brief the phases of cbm_driver_open_ex(), as reported with OPENCBM_TRACE_STARTUP */
+enum startup_phase_e {
+    STARTUP_CONFIGURATION,
+    STARTUP_PLUGIN_LOAD,
+    STARTUP_PLUGIN_BIND,
+    STARTUP_PLUGIN_INIT,
+    STARTUP_DRIVER_OPEN,
+    STARTUP_DRIVE_CACHE,
+    STARTUP_PHASES
+};
+
+/*! \brief the names of enum startup_phase_e */
+static const char * const startup_phase_name[STARTUP_PHASES] =
+{
+    "configuration",
+    "plugin load",
+    "plugin bind",
+    "plugin init",
+    "driver open",
+    "drive cache"
+};
+
+/*! \brief the time spent in each phase of cbm_driver_open_ex() */
+struct startup_trace_s {
+    unsigned long last;                   /*!< the clock at the end of the last phase */
+    unsigned long time[STARTUP_PHASES];   /*!< the time spent in each phase, in us */
+};
+
+/*! \brief Start measuring the phases of cbm_driver_open_ex()
+
+ \param Trace
+   The measurements to start.
+
+ \return
+   Trace if the environment variable OPENCBM_TRACE_STARTUP is set to
+   something else than 0, NULL otherwise.
+*/
+static struct startup_trace_s *
+startup_trace_start(struct startup_trace_s *Trace)
+{
+    const char *trace = getenv("OPENCBM_TRACE_STARTUP");
+
+    if (trace == NULL || trace[0] == 0 || strcmp(trace, "0") == 0) {
+        return NULL;
+    }
+
+    memset(Trace, 0, sizeof(*Trace));
+    Trace->last = arch_time_us();
+
+    return Trace;
+}
+
+/*! \brief Mark the end of a phase of cbm_driver_open_ex()
+
+ \param Trace
+   The measurements, as returned by startup_trace_start().
+   If it is NULL, nothing is measured.
+
+ \param Phase
+   The phase which has just ended.
+*/
+static void
+startup_trace_phase(struct startup_trace_s *Trace, enum startup_phase_e Phase)
+{
+    if (Trace) {
+        unsigned long now = arch_time_us();
+
+        Trace->time[Phase] += now - Trace->last;
+        Trace->last = now;
+    }
+}
+
+/*! \brief Report the time spent in cbm_driver_open_ex()
+
+ \param Trace
+   The measurements, as returned by startup_trace_start().
+   If it is NULL, nothing is reported.
+
+ \param Error
+   The result of cbm_driver_open_ex().
+*/
+static void
+startup_trace_report(struct startup_trace_s *Trace, int Error)
+{
+    unsigned long total = 0;
+    int phase;
+
+    if (Trace == NULL) {
+        return;
+    }
+
+    for (phase = 0; phase < STARTUP_PHASES; phase++) {
+        total += Trace->time[phase];
+    }
+
+    fprintf(stderr, "opencbm: driver open with plugin '%s' %s after %lu us\n",
+        Plugin_information.Name ? Plugin_information.Name : "(none)",
+        Error ? "failed" : "succeeded", total);
+
+    for (phase = 0; phase < STARTUP_PHASES; phase++) {
+        fprintf(stderr, "opencbm:   %-14s %8lu us\n",
+            startup_phase_name[phase], Trace->time[phase]);
+    }
+}
+
 static int
-initialize_plugin_pointer(plugin_information_t *Plugin_information, const char * const Adapter)
+initialize_plugin_pointer(plugin_information_t *Plugin_information, const char * const Adapter,
+                          struct startup_trace_s *Trace)
 {
     int error = 1;
 
@@ -387,6 +551,7 @@ initialize_plugin_pointer(plugin_information_t *Plugin_information, const char *
             //
 
             if ( ! plugin_is_active(handle_configuration, plugin_name) ) {
+                opencbm_configuration_close(handle_configuration);
                 error = 1;
                 break;
             }
@@ -418,10 +583,15 @@ initialize_plugin_pointer(plugin_information_t *Plugin_information, const char *
         }
         DBG_PRINT((DBG_PREFIX "Using plugin at '%s'", plugin_location ? plugin_location : "(none)"));
 
+        startup_trace_phase(Trace, STARTUP_CONFIGURATION);
+
         memset(&Plugin_information->Plugin, 0, sizeof(Plugin_information->Plugin));
+        Plugin_information->LazyBound = 0;
 
         Plugin_information->Library = plugin_load(plugin_location);
 
+        startup_trace_phase(Trace, STARTUP_PLUGIN_LOAD);
+
         DBG_PRINT((DBG_PREFIX "plugin_load() returned %p", Plugin_information->Library));
 
         if (!Plugin_information->Library) {
@@ -430,6 +600,9 @@ initialize_plugin_pointer(plugin_information_t *Plugin_information, const char *
         }
 
         error = read_plugin_pointer_groups(Plugin_information, read_pointer_group);
+
+        startup_trace_phase(Trace, STARTUP_PLUGIN_BIND);
+
         if (error) {
             DBG_ERROR((DBG_PREFIX "The entry points of plugin %s do not validate correctly.\n",
                                   plugin_location));
@@ -448,6 +621,11 @@ initialize_plugin_pointer(plugin_information_t *Plugin_information, const char *
             }
         }
 
+        startup_trace_phase(Trace, STARTUP_PLUGIN_INIT);
+
+        Plugin_information->Name = plugin_name;
+        plugin_name = NULL;
+
     } while (0);
 
     cbmlibmisc_strfree(plugin_name);
@@ -469,21 +647,89 @@ uninitialize_plugin(void)
         plugin_unload(Plugin_information.Library);
 
         Plugin_information.Library = NULL;
+        Plugin_information.LazyBound = 0;
     }
+
+    cbmlibmisc_strfree(Plugin_information.Name);
+    Plugin_information.Name = NULL;
+}
+
+/*! \internal \brief Get the name of the plugin of an adapter
+
+ \param Adapter
+   The name of the adapter, without the port, or NULL for the
+   default adapter.
+
+ \return
+   The name of the plugin, that is, Adapter itself or the default plugin
+   from the configuration file. NULL if the configuration file cannot
+   be read. It has to be freed with cbmlibmisc_strfree().
+*/
+static char *
+plugin_get_name(const char * const Adapter)
+{
+    const char * configurationFilename;
+    opencbm_configuration_handle handle_configuration;
+    char * plugin_name = NULL;
+
+    if (Adapter != NULL)
+        return cbmlibmisc_strdup(Adapter);
+
+    configurationFilename = configuration_get_default_filename();
+
+    if (configurationFilename != NULL) {
+        handle_configuration = opencbm_configuration_open(configurationFilename);
+
+        if (handle_configuration) {
+            if (opencbm_configuration_get_data(handle_configuration,
+                    "plugins", "default", &plugin_name)) {
+                cbmlibmisc_strfree(plugin_name);
+                plugin_name = NULL;
+            }
+            opencbm_configuration_close(handle_configuration);
+        }
+    }
+
+    cbmlibmisc_strfree(configurationFilename);
+
+    return plugin_name;
 }
 
 static int
-initialize_plugin(const char * const Adapter)
+initialize_plugin(const char * const Adapter, struct startup_trace_s *Trace)
 {
     /* if library is already opened and initialized correctly then 
        this function returns OK */
     int error = 0;
 
+    /* only one plugin can be loaded at a time. Another one replaces
+       it if no handle is open, else, it cannot be used. */
+    if (Plugin_information.Library != NULL)
+    {
+        char * plugin_name = plugin_get_name(Adapter);
+
+        if (plugin_name == NULL || strcmp(plugin_name, Plugin_information.Name) != 0)
+        {
+            if (Plugin_information.OpenCount > 0)
+            {
+                DBG_ERROR((DBG_PREFIX "Plugin %s is in use, cannot use plugin %s at the same time.\n",
+                    Plugin_information.Name, plugin_name ? plugin_name : "(none)"));
+                error = 1;
+            }
+            else
+            {
+                uninitialize_plugin();
+            }
+        }
+
+        cbmlibmisc_strfree(plugin_name);
+    }
+
     /* init pointers if library was not yet opened */
-    if (Plugin_information.Library == NULL)
+    if (error == 0 && Plugin_information.Library == NULL)
     {
         /* if pointer init failed then close library and make Library NULL */
-        error = initialize_plugin_pointer(&Plugin_information, Adapter);
+        error = initialize_plugin_pointer(&Plugin_information, Adapter, Trace);
         if(error != 0)
         {
             uninitialize_plugin();
@@ -608,7 +854,7 @@ cbm_get_driver_name_ex(char * Adapter)
             Adapter, adapter_stripped, port));
     }
 
-    error = initialize_plugin(adapter_stripped);
+    error = initialize_plugin(adapter_stripped, NULL);
 
     if (error == 0) {
         ret = Plugin_information.Plugin.opencbm_plugin_get_driver_name(port);
@@ -660,6 +906,57 @@ cbm_get_driver_name(int PortNumber)
     FUNC_LEAVE_STRING(cbm_get_driver_name_ex(number));
 }
 
+/*! \brief Get the complete name of an adapter
+
+ Two adapter specifications name the same adapter if this function
+ returns the same name for both.
+
+ \param Adapter
+   The name of the adapter, as given to cbm_driver_open_ex().
+   NULL means the default adapter.
+
+ \return
+   The name of the plugin, with a colon and the port if one is given.
+   The default plugin is filled in from the configuration file, and an
+   empty port is removed. NULL if the configuration file cannot be read.
+   The string is valid until the next call of this function.
+*/
+
+const char * CBMAPIDECL
+cbm_get_adapter_name(const char * Adapter)
+{
+    static char * buffer = NULL;
+    char * adapter_stripped = NULL;
+    char * plugin_name;
+    char * port = NULL;
+
+    FUNC_ENTER();
+
+    cbmlibmisc_strfree(buffer);
+    buffer = NULL;
+
+    if (Adapter != NULL)
+        adapter_stripped = cbm_split_adapter_in_name_and_port((char *) Adapter, &port);
+
+    plugin_name = plugin_get_name(adapter_stripped);
+
+    if (plugin_name != NULL && port != NULL) {
+        char * name_colon = cbmlibmisc_strcat(plugin_name, ":");
+
+        buffer = cbmlibmisc_strcat(name_colon, port);
+        cbmlibmisc_strfree(name_colon);
+    }
+    else if (plugin_name != NULL) {
+        buffer = cbmlibmisc_strdup(plugin_name);
+    }
+
+    cbmlibmisc_strfree(plugin_name);
+    cbmlibmisc_strfree(adapter_stripped);
+    cbmlibmisc_strfree(port);
+
+    FUNC_LEAVE_STRING(buffer);
+}
+
 /*! \brief Opens the driver, extended version
 
  This function Opens the driver.
@@ -677,6 +974,13 @@ cbm_get_driver_name(int PortNumber)
 
  \remark
  cbm_driver_open_ex() should be balanced with cbm_driver_close().
+
+ \remark
+ More than one adapter (port) of the same plugin can be open at the
+ same time, and the handles can be used from different threads
+ concurrently, if the plugin supports this. An adapter of another plugin
+ cannot be opened while a handle is open. cbm_driver_open_ex() and cbm_driver_close() themselves
+ are not thread-safe, though; call them from one thread only.
 */
 
 int CBMAPIDECL 
@@ -685,11 +989,15 @@ cbm_driver_open_ex(CBM_FILE *HandleDevice, char * Adapter)
     int error;
     char * port = NULL;
     char * adapter_stripped = NULL;
+    struct startup_trace_s trace_buffer;
+    struct startup_trace_s *trace;
 
     FUNC_ENTER();
 
     DBG_PRINT((DBG_PREFIX "cbm_driver_open_ex() called"));
 
+    trace = startup_trace_start(&trace_buffer);
+
     if (Adapter != NULL)
     {
         adapter_stripped = cbm_split_adapter_in_name_and_port(Adapter, &port);
@@ -698,14 +1006,22 @@ cbm_driver_open_ex(CBM_FILE *HandleDevice, char * Adapter)
             Adapter, adapter_stripped, port));
     }
 
-    error = initialize_plugin(adapter_stripped);
+    error = initialize_plugin(adapter_stripped, trace);
 
     cbmlibmisc_strfree(adapter_stripped);
 
     if (error == 0) {
         error = Plugin_information.Plugin.opencbm_plugin_driver_open(HandleDevice, port);
+        startup_trace_phase(trace, STARTUP_DRIVER_OPEN);
+        if (error == 0) {
+            Plugin_information.OpenCount++;
+            cbm_drive_cache_open(*HandleDevice, Plugin_information.Name, port);
+            startup_trace_phase(trace, STARTUP_DRIVE_CACHE);
+        }
     }
 
+    startup_trace_report(trace, error);
+
     cbmlibmisc_strfree(port);
 
     FUNC_LEAVE_INT(error);
@@ -769,9 +1085,18 @@ cbm_driver_close(CBM_FILE HandleDevice)
 {
     FUNC_ENTER();
 
+    cbm_bus_forget(HandleDevice);
+    cbm_drive_cache_close(HandleDevice);
+
     Plugin_information.Plugin.opencbm_plugin_driver_close(HandleDevice);
 
-    uninitialize_plugin();
+    /* only unload the plugin if this was the last handle open */
+    if (Plugin_information.OpenCount > 0) {
+        Plugin_information.OpenCount--;
+    }
+    if (Plugin_information.OpenCount == 0) {
+        uninitialize_plugin();
+    }
 
     FUNC_LEAVE();
 }
@@ -1247,6 +1572,8 @@ cbm_pp_read(CBM_FILE HandleDevice)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_PP_READWRITE);
+
     if (Plugin_information.Plugin.opencbm_plugin_pp_read)
         ret = Plugin_information.Plugin.opencbm_plugin_pp_read(HandleDevice);
 
@@ -1283,6 +1610,8 @@ cbm_pp_write(CBM_FILE HandleDevice, unsigned char Byte)
 {
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_PP_READWRITE);
+
     if (Plugin_information.Plugin.opencbm_plugin_pp_write)
         Plugin_information.Plugin.opencbm_plugin_pp_write(HandleDevice, Byte);
 
@@ -1602,6 +1931,7 @@ cbm_exec_command(CBM_FILE HandleDevice, unsigned char DeviceAddress,
     int rv;
 
     FUNC_ENTER();
+    cbm_drive_cache_executed(HandleDevice, DeviceAddress);
     rv = cbm_listen(HandleDevice, DeviceAddress, 15);
     if(rv == 0) {
         if(Size == 0) {
@@ -1638,6 +1968,8 @@ cbm_parallel_burst_read(CBM_FILE HandleDevice)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_PARALLEL_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_parallel_burst_read)
         ret = Plugin_information.Plugin.opencbm_plugin_parallel_burst_read(HandleDevice);
 
@@ -1666,6 +1998,8 @@ cbm_parallel_burst_write(CBM_FILE HandleDevice, unsigned char Value)
 {
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_PARALLEL_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_parallel_burst_write)
         Plugin_information.Plugin.opencbm_plugin_parallel_burst_write(HandleDevice, Value);
 
@@ -1681,6 +2015,8 @@ cbm_parallel_burst_read_n(CBM_FILE HandleDevice, unsigned char *Buffer,
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_PARALLEL_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_parallel_burst_read_n) {
         rv = Plugin_information.Plugin.opencbm_plugin_parallel_burst_read_n(
             HandleDevice, Buffer, Length);
@@ -1704,6 +2040,8 @@ cbm_parallel_burst_write_n(CBM_FILE HandleDevice, unsigned char *Buffer,
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_PARALLEL_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_parallel_burst_write_n) {
         rv = Plugin_information.Plugin.opencbm_plugin_parallel_burst_write_n(
             HandleDevice, Buffer, Length);
@@ -1749,6 +2087,8 @@ cbm_parallel_burst_read_track(CBM_FILE HandleDevice, unsigned char *Buffer, unsi
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_PARALLEL_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_parallel_burst_read_track)
         ret = Plugin_information.Plugin.opencbm_plugin_parallel_burst_read_track(HandleDevice, Buffer, Length);
 
@@ -1783,6 +2123,8 @@ cbm_parallel_burst_read_track_var(CBM_FILE HandleDevice, unsigned char *Buffer,
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_PARALLEL_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_parallel_burst_read_track)
         ret = Plugin_information.Plugin.opencbm_plugin_parallel_burst_read_track_var(HandleDevice, Buffer, Length);
 
@@ -1820,6 +2162,8 @@ cbm_parallel_burst_write_track(CBM_FILE HandleDevice, unsigned char *Buffer, uns
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_PARALLEL_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_parallel_burst_write_track)
         ret = Plugin_information.Plugin.opencbm_plugin_parallel_burst_write_track(HandleDevice, Buffer, Length);
 
@@ -1850,6 +2194,8 @@ cbm_srq_burst_read(CBM_FILE HandleDevice)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_SRQ_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_srq_burst_read)
         ret = Plugin_information.Plugin.opencbm_plugin_srq_burst_read(HandleDevice);
 
@@ -1878,6 +2224,8 @@ cbm_srq_burst_write(CBM_FILE HandleDevice, unsigned char Value)
 {
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_SRQ_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_srq_burst_write)
         Plugin_information.Plugin.opencbm_plugin_srq_burst_write(HandleDevice, Value);
 
@@ -1893,6 +2241,8 @@ cbm_srq_burst_read_n(CBM_FILE HandleDevice, unsigned char *Buffer,
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_SRQ_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_srq_burst_read_n) {
         rv = Plugin_information.Plugin.opencbm_plugin_srq_burst_read_n(
             HandleDevice, Buffer, Length);
@@ -1916,6 +2266,8 @@ cbm_srq_burst_write_n(CBM_FILE HandleDevice, unsigned char *Buffer,
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_SRQ_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_srq_burst_write_n) {
         rv = Plugin_information.Plugin.opencbm_plugin_srq_burst_write_n(
             HandleDevice, Buffer, Length);
@@ -1961,6 +2313,8 @@ cbm_srq_burst_read_track(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_SRQ_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_srq_burst_read_track)
         ret = Plugin_information.Plugin.opencbm_plugin_srq_burst_read_track(HandleDevice, Buffer, Length);
 
@@ -1998,6 +2352,8 @@ cbm_srq_burst_write_track(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_SRQ_BURST);
+
     if (Plugin_information.Plugin.opencbm_plugin_srq_burst_write_track)
         ret = Plugin_information.Plugin.opencbm_plugin_srq_burst_write_track(HandleDevice, Buffer, Length);
 
@@ -2028,6 +2384,8 @@ cbm_tap_prepare_capture(CBM_FILE HandleDevice, int *Status)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_prepare_capture)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_prepare_capture(HandleDevice, Status);
 
@@ -2058,6 +2416,8 @@ cbm_tap_prepare_write(CBM_FILE HandleDevice, int *Status)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_prepare_write)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_prepare_write(HandleDevice, Status);
 
@@ -2088,6 +2448,8 @@ cbm_tap_get_sense(CBM_FILE HandleDevice, int *Status)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_get_sense)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_get_sense(HandleDevice, Status);
 
@@ -2118,6 +2480,8 @@ cbm_tap_wait_for_stop_sense(CBM_FILE HandleDevice, int *Status)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_wait_for_stop_sense)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_wait_for_stop_sense(HandleDevice, Status);
 
@@ -2148,6 +2512,8 @@ cbm_tap_wait_for_play_sense(CBM_FILE HandleDevice, int *Status)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_wait_for_play_sense)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_wait_for_play_sense(HandleDevice, Status);
 
@@ -2178,6 +2544,8 @@ cbm_tap_motor_on(CBM_FILE HandleDevice, int *Status)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_motor_on)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_motor_on(HandleDevice, Status);
 
@@ -2208,6 +2576,8 @@ cbm_tap_motor_off(CBM_FILE HandleDevice, int *Status)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_motor_off)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_motor_off(HandleDevice, Status);
 
@@ -2250,12 +2620,66 @@ cbm_tap_start_capture(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_start_capture)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_start_capture(HandleDevice, Buffer, Buffer_Length, Status, BytesRead);
 
     FUNC_LEAVE_INT(ret);
 }
 
+/*! \brief TAPE: Start capture, streaming the data to the caller
+
+ This function is a helper function for tape:
+ It starts the actual tape capture, like cbm_tap_start_capture().
+ Instead of filling one buffer which must be large enough for the
+ whole tape, the data is handed to the caller in chunks while the
+ capture is still running, so its length is not limited.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param GetBuffer
+   Called whenever a new buffer is needed. It returns the buffer and
+   sets its length. If it returns NULL, the capture is aborted.
+
+ \param PutBuffer
+   Called with every buffer returned by GetBuffer, after it has been
+   filled. The last one might not be full.
+
+ \param Context
+   Given to GetBuffer and PutBuffer.
+
+ \param Status
+   The return status.
+
+ \param BytesRead
+   The number of bytes read in total.
+
+ \return
+   != 0 on success.
+
+ If cbm_driver_open() did not succeed, it is illegal to 
+ call this function.
+
+ Note that a plugin is not required to implement this function.
+*/
+
+int CBMAPIDECL
+cbm_tap_start_capture_stream(CBM_FILE HandleDevice, CBM_TAP_STREAM_GET GetBuffer, CBM_TAP_STREAM_PUT PutBuffer, void *Context, int *Status, int *BytesRead)
+{
+    int ret = -1;
+
+    FUNC_ENTER();
+
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
+    if (Plugin_information.Plugin.opencbm_plugin_tap_start_capture_stream)
+        ret = Plugin_information.Plugin.opencbm_plugin_tap_start_capture_stream(HandleDevice, GetBuffer, PutBuffer, Context, Status, BytesRead);
+
+    FUNC_LEAVE_INT(ret);
+}
+
 /*! \brief TAPE: Start write
 
  This function is a helper function for tape:
@@ -2292,6 +2716,8 @@ cbm_tap_start_write(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int L
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_start_write)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_start_write(HandleDevice, Buffer, Length, Status, BytesWritten);
 
@@ -2323,6 +2749,8 @@ cbm_tap_get_ver(CBM_FILE HandleDevice, int *Status)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_get_ver)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_get_ver(HandleDevice, Status);
 
@@ -2337,6 +2765,8 @@ cbm_tap_break(CBM_FILE HandleDevice)
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_break)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_break(HandleDevice);
 
@@ -2380,6 +2810,8 @@ cbm_tap_download_config(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned i
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_download_config)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_download_config(HandleDevice, Buffer, Buffer_Length, Status, BytesRead);
 
@@ -2422,6 +2854,8 @@ cbm_tap_upload_config(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int
 
     FUNC_ENTER();
 
+    plugin_bind_lazy(PLUGIN_GROUP_TAPE);
+
     if (Plugin_information.Plugin.opencbm_plugin_tap_upload_config)
         ret = Plugin_information.Plugin.opencbm_plugin_tap_upload_config(HandleDevice, Buffer, Length, Status, BytesWritten);
 
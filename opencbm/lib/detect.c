@@ -28,11 +28,15 @@
 #include "debug.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 //! mark: We are building the DLL */
 #define DLL
 #include "opencbm.h"
 #include "archlib.h"
+#include "internal.h"
+
+#include "arch.h"
 
 
 /*! \brief Identify the connected floppy drive.
@@ -205,3 +209,388 @@ cbm_identify(CBM_FILE HandleDevice, unsigned char DeviceAddress,
 
     FUNC_LEAVE_INT(rv);
 }
+
+
+/*-------------------------------------------------------------------*/
+/*--------- BUS SCAN ------------------------------------------------*/
+
+/*! The secondary address used for probing a device: the command channel */
+#define BUS_PROBE_SECADR 15
+
+/*! The length of a device string kept in the cache */
+#define BUS_DEVICE_STRING_LEN 32
+
+/*! \internal \brief What is known about the devices behind one handle */
+struct bus_cache_s
+{
+    struct bus_cache_s *next;   /*!< the cache of the next handle */
+    CBM_FILE HandleDevice;      /*!< the handle this cache belongs to */
+    unsigned long scanned;      /*!< bitmap of devices whose presence is known */
+    unsigned long present;      /*!< bitmap of devices which are present */
+    unsigned long identified;   /*!< bitmap of devices with a cached cbm_identify() result */
+
+    /*! the device type of each identified device */
+    enum cbm_device_type_e type[CBM_BUS_LAST_DEVICE + 1];
+
+    /*! the device string of each identified device */
+    char string[CBM_BUS_LAST_DEVICE + 1][BUS_DEVICE_STRING_LEN];
+};
+
+/*! The caches of all handles; protected by arch_global_lock() */
+static struct bus_cache_s *bus_cache = NULL;
+
+/*! \internal \brief Find the cache of a handle
+
+ The caller must hold arch_global_lock().
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Create
+   If nonzero, an empty cache is created if the handle has none yet.
+
+ \return
+   The cache, or NULL if there is none (or not enough memory).
+*/
+
+static struct bus_cache_s *
+bus_cache_get(CBM_FILE HandleDevice, int Create)
+{
+    struct bus_cache_s *cache;
+
+    for (cache = bus_cache; cache != NULL; cache = cache->next)
+    {
+        if (cache->HandleDevice == HandleDevice)
+            return cache;
+    }
+
+    if (Create)
+    {
+        cache = calloc(1, sizeof(*cache));
+        if (cache != NULL)
+        {
+            cache->HandleDevice = HandleDevice;
+            cache->next = bus_cache;
+            bus_cache = cache;
+        }
+    }
+
+    return cache;
+}
+
+/*! \internal \brief Forget everything known about the devices behind a handle
+
+ This is called by cbm_driver_close(), as a new handle might get
+ the same value later.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+*/
+
+void
+cbm_bus_forget(CBM_FILE HandleDevice)
+{
+    struct bus_cache_s **pcache;
+
+    arch_global_lock();
+
+    for (pcache = &bus_cache; *pcache != NULL; pcache = &(*pcache)->next)
+    {
+        if ((*pcache)->HandleDevice == HandleDevice)
+        {
+            struct bus_cache_s *cache = *pcache;
+
+            *pcache = cache->next;
+            free(cache);
+            break;
+        }
+    }
+
+    arch_global_unlock();
+}
+
+/*! The memory read which probes a device: one byte of the footprint cbm_identify() uses */
+static const unsigned char bus_probe_command[] = { 'M', '-', 'R', 0x40, 0xff, 0x01 };
+
+/*! \internal \brief Probe all devices with one batch
+
+ A memory read of one byte is sent to the command channel of every
+ device, and the answer is read back. Only the LISTEN and TALK
+ themselves are not enough: they are sent under ATN, and every
+ device on the bus acknowledges those bytes, regardless of the
+ address. Only the addressed device takes the command and talks
+ after the turnaround. The plugin executes all of the operations,
+ even if some of them fail.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Present
+   Pointer to the bitmap of the devices which answered.
+
+ \return
+   0 on success, -1 if the batch could not be created.
+*/
+
+static int
+bus_probe_batch(CBM_FILE HandleDevice, unsigned long *Present)
+{
+    CBM_BATCH *batch;
+    int read[CBM_BUS_LAST_DEVICE + 1];
+    unsigned char answer[CBM_BUS_LAST_DEVICE + 1][2];
+    unsigned char device;
+    int ret = 0;
+
+    batch = cbm_batch_create();
+    if (batch == NULL)
+        return -1;
+
+    for (device = CBM_BUS_FIRST_DEVICE; device <= CBM_BUS_LAST_DEVICE; device++)
+    {
+        // the byte is followed by a CR, which is read, too
+        if (cbm_batch_listen(batch, device, BUS_PROBE_SECADR) < 0
+            || cbm_batch_raw_write(batch, bus_probe_command, sizeof(bus_probe_command)) < 0
+            || cbm_batch_unlisten(batch) < 0
+            || cbm_batch_talk(batch, device, BUS_PROBE_SECADR) < 0
+            || (read[device] = cbm_batch_raw_read(batch, answer[device], sizeof(answer[device]))) < 0
+            || cbm_batch_untalk(batch) < 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret == 0)
+    {
+        // the single results tell which devices are there
+        cbm_batch_submit(HandleDevice, batch);
+
+        for (device = CBM_BUS_FIRST_DEVICE; device <= CBM_BUS_LAST_DEVICE; device++)
+        {
+            if (cbm_batch_result(batch, read[device]) > 0)
+                *Present |= 1ul << device;
+        }
+    }
+
+    cbm_batch_free(batch);
+
+    return ret;
+}
+
+/*! \internal \brief Probe one device
+
+ The same as bus_probe_batch(), for one device, without a batch.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \return
+   1 if the device answered, 0 if not.
+*/
+
+static int
+bus_probe_single(CBM_FILE HandleDevice, unsigned char DeviceAddress)
+{
+    unsigned char answer[2];
+    int rv = 0;
+
+    if (cbm_exec_command(HandleDevice, DeviceAddress, bus_probe_command, sizeof(bus_probe_command)) == 0
+        && cbm_talk(HandleDevice, DeviceAddress, BUS_PROBE_SECADR) == 0)
+    {
+        rv = cbm_raw_read(HandleDevice, answer, sizeof(answer)) > 0;
+        cbm_untalk(HandleDevice);
+    }
+
+    return rv;
+}
+
+/*! \brief Scan the IEC bus for devices
+
+ This function finds out which devices are present on the bus. Instead
+ of identifying every possible device with cbm_identify(), only one
+ byte of memory is read from each of them, which only a device with
+ this address answers. If the plugin can execute batches of operations,
+ all devices are probed with a single batch.
+
+ The result is kept for the handle. cbm_bus_identify() uses it to
+ avoid accessing devices which are not there.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceBitmap
+   Pointer to a bitmap which will have bit n set if device n is
+   present. Devices CBM_BUS_FIRST_DEVICE to CBM_BUS_LAST_DEVICE
+   are probed. May be NULL.
+
+ \return
+   The number of devices found.
+
+ If cbm_driver_open() did not succeed, it is illegal to
+ call this function.
+*/
+
+int CBMAPIDECL
+cbm_bus_scan(CBM_FILE HandleDevice, unsigned long *DeviceBitmap)
+{
+    struct bus_cache_s *cache;
+    unsigned long present = 0;
+    unsigned char device;
+    int count = 0;
+
+    FUNC_ENTER();
+
+    if (cbm_get_plugin_function_address("opencbm_plugin_batch_submit") == NULL
+        || bus_probe_batch(HandleDevice, &present) != 0)
+    {
+        // a generic batch would stop at the first missing device
+        present = 0;
+        for (device = CBM_BUS_FIRST_DEVICE; device <= CBM_BUS_LAST_DEVICE; device++)
+        {
+            if (bus_probe_single(HandleDevice, device))
+                present |= 1ul << device;
+        }
+    }
+
+    arch_global_lock();
+
+    cache = bus_cache_get(HandleDevice, 1);
+    if (cache != NULL)
+    {
+        // devices which went away (or came) must be identified again
+        cache->identified &= ~(cache->present ^ present);
+        cache->identified &= present;
+        cache->present = present;
+        cache->scanned = ((1ul << (CBM_BUS_LAST_DEVICE + 1)) - 1) & ~((1ul << CBM_BUS_FIRST_DEVICE) - 1);
+    }
+
+    arch_global_unlock();
+
+    for (device = CBM_BUS_FIRST_DEVICE; device <= CBM_BUS_LAST_DEVICE; device++)
+    {
+        if (present & (1ul << device))
+            count++;
+    }
+
+    DBG_PRINT((DBG_PREFIX "bus scan: %d device(s), bitmap 0x%08lx", count, present));
+
+    if (DeviceBitmap)
+        *DeviceBitmap = present;
+
+    FUNC_LEAVE_INT(count);
+}
+
+/*! \brief Identify a device, using the results of a bus scan
+
+ This function behaves like cbm_identify(), but it remembers the
+ result for the handle, so the device is only accessed once. If
+ cbm_bus_scan() found that the device is not present, it is not
+ accessed at all. If the drive still holds a program uploaded with
+ cbm_upload_cached() in an earlier run, the type remembered then is
+ used.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param CbmDeviceType
+   Pointer to an enum which will hold the type of the device.
+
+ \param CbmDeviceString
+   Pointer to a pointer which will point on a string which
+   tells the name of the device. It stays valid until the
+   handle is closed.
+
+ \return
+   0 if the drive could be contacted. It does not mean that
+   the device could be identified.
+
+ If cbm_driver_open() did not succeed, it is illegal to
+ call this function.
+*/
+
+int CBMAPIDECL
+cbm_bus_identify(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                 enum cbm_device_type_e *CbmDeviceType,
+                 const char **CbmDeviceString)
+{
+    struct bus_cache_s *cache;
+    enum cbm_device_type_e deviceType = cbm_dt_unknown;
+    const char *deviceString = NULL;
+    unsigned long mask;
+    int rv = -1;
+
+    FUNC_ENTER();
+
+    if (DeviceAddress < CBM_BUS_FIRST_DEVICE || DeviceAddress > CBM_BUS_LAST_DEVICE)
+        FUNC_LEAVE_INT(cbm_identify(HandleDevice, DeviceAddress, CbmDeviceType, CbmDeviceString));
+
+    mask = 1ul << DeviceAddress;
+
+    arch_global_lock();
+
+    cache = bus_cache_get(HandleDevice, 0);
+    if (cache != NULL)
+    {
+        if ((cache->scanned & mask) && !(cache->present & mask))
+        {
+            // the bus scan did not find it
+            arch_global_unlock();
+            FUNC_LEAVE_INT(-1);
+        }
+
+        if (cache->identified & mask)
+        {
+            deviceType = cache->type[DeviceAddress];
+            deviceString = cache->string[DeviceAddress];
+            rv = 0;
+        }
+    }
+
+    arch_global_unlock();
+
+    if (rv != 0)
+    {
+        // a drive which still holds our code has not been reset since the last run
+        rv = cbm_drive_cache_identify(HandleDevice, DeviceAddress, &deviceType, &deviceString);
+
+        if (rv != 0)
+        {
+            rv = cbm_identify(HandleDevice, DeviceAddress, &deviceType, &deviceString);
+
+            if (rv == 0)
+                cbm_drive_cache_set_type(HandleDevice, DeviceAddress, deviceType, deviceString);
+        }
+
+        if (rv == 0)
+        {
+            arch_global_lock();
+
+            cache = bus_cache_get(HandleDevice, 1);
+            if (cache != NULL)
+            {
+                cache->identified |= mask;
+                cache->type[DeviceAddress] = deviceType;
+                strncpy(cache->string[DeviceAddress], deviceString, BUS_DEVICE_STRING_LEN - 1);
+                cache->string[DeviceAddress][BUS_DEVICE_STRING_LEN - 1] = 0;
+                deviceString = cache->string[DeviceAddress];
+            }
+
+            arch_global_unlock();
+        }
+    }
+
+    if (CbmDeviceType)
+        *CbmDeviceType = deviceType;
+
+    if (CbmDeviceString)
+        *CbmDeviceString = deviceString;
+
+    FUNC_LEAVE_INT(rv);
+}
@@ -0,0 +1,563 @@
+/*
+ *      This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file lib/directory.c \n
+** \n
+** \brief Shared library / DLL for accessing the driver:
+**        reading the directory of a disk
+**
+** The directory is not read as the BASIC listing the DOS generates
+** for "$", but as the raw blocks of the directory track. Each block
+** is read into a buffer of the drive with U1, and transferred with
+** its status in one batch (see lib/batch.c), that is, with one round
+** trip to the adapter per block instead of one per byte or two.
+**
+** The header, the BAM and the directory entries are parsed
+** afterwards; thus, the caller gets the start track and sector of
+** each file, too, which the listing does not show.
+**
+****************************************************************/
+
+/*! Mark: We are in user-space (for debug.h) */
+#define DBG_USERMODE
+
+/*! The name of the executable */
+#define DBG_PROGNAME "OPENCBM.DLL"
+
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! mark: We are building the DLL */
+#define DLL
+#include "opencbm.h"
+#include "archlib.h"
+#include "internal.h"
+
+/*! The channel the buffer for reading the blocks is opened on */
+#define DIRECTORY_CHANNEL       14
+
+/*! The size of a block */
+#define DIRECTORY_BLOCK_SIZE    0x100
+
+/*! The size of a directory entry */
+#define DIRECTORY_ENTRY_SIZE    0x20
+
+/*! The number of entries a new directory has room for */
+#define DIRECTORY_INITIAL_ENTRIES 144
+
+/*! The file type byte of a scratched file */
+#define DIRECTORY_TYPE_SCRATCHED 0x00
+
+/*! The filler of names in the directory, a shifted space */
+#define DIRECTORY_FILLER        0xA0
+
+/*! How the BAM of a disk format is stored */
+enum directory_bam_e
+{
+    bam_1541,       /*!< in the header block; a second side (1571) in the header block, too */
+    bam_1581,       /*!< in the blocks following the header, each for 40 tracks */
+    bam_8050        /*!< in a chain of blocks on the track before the directory track */
+};
+
+/*! Where the header and the directory of a disk format are */
+struct directory_format_s
+{
+    unsigned char dir_track;        /*!< the directory track; it is not counted as free */
+    unsigned char header_sector;    /*!< the sector of the header on the directory track */
+    unsigned char name_offset;      /*!< the offset of the disk name in the header */
+    unsigned char id_offset;        /*!< the offset of the disk ID in the header; the DOS type follows 3 bytes later */
+    enum directory_bam_e bam;       /*!< how the BAM is stored */
+};
+
+/*! 1541, 1570, 1571, 2031, 4031, 2040, 3040 and 4040 */
+static const struct directory_format_s directory_format_1541 = { 18, 0, 0x90, 0xA2, bam_1541 };
+
+/*! 1581 */
+static const struct directory_format_s directory_format_1581 = { 40, 0, 0x04, 0x16, bam_1581 };
+
+/*! 8050, 8250 and SFD-1001 */
+static const struct directory_format_s directory_format_8050 = { 39, 0, 0x06, 0x18, bam_8050 };
+
+
+/*-------------------------------------------------------------------*/
+/*--------- HELPER FUNCTIONS ----------------------------------------*/
+
+/*! \internal \brief Get the disk format of a drive
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \return
+   The format. Drives which cannot be identified are assumed
+   to be 1541 compatible.
+*/
+
+static const struct directory_format_s *
+directory_format(CBM_FILE HandleDevice, unsigned char DeviceAddress)
+{
+    enum cbm_device_type_e deviceType;
+
+    if (cbm_bus_identify(HandleDevice, DeviceAddress, &deviceType, NULL) != 0)
+        return &directory_format_1541;
+
+    switch (deviceType)
+    {
+    case cbm_dt_cbm1581:
+        return &directory_format_1581;
+
+    case cbm_dt_cbm8050:
+    case cbm_dt_cbm8250:
+    case cbm_dt_sfd1001:
+        return &directory_format_8050;
+
+    default:
+        return &directory_format_1541;
+    }
+}
+
+/*! \internal \brief Read a block of the disk
+
+ The block is read into the buffer of DIRECTORY_CHANNEL with U1.
+ The command, the status and the contents of the buffer are
+ transferred in one batch.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Batch
+   A batch to record the operations in.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param DriveNumber
+   The drive of a dual drive, 0 for all others.
+
+ \param Track
+   The track of the block.
+
+ \param Sector
+   The sector of the block.
+
+ \param Block
+   Pointer to a buffer of DIRECTORY_BLOCK_SIZE bytes which
+   receives the block.
+
+ \return
+   0 on success, -1 on error.
+*/
+
+static int
+directory_read_block(CBM_FILE HandleDevice, CBM_BATCH *Batch,
+                     unsigned char DeviceAddress, unsigned char DriveNumber,
+                     unsigned int Track, unsigned int Sector, unsigned char *Block)
+{
+    char command[32];
+    char status[40];
+    int statusOp;
+    int blockOp;
+    int statusLength;
+
+    FUNC_ENTER();
+
+    sprintf(command, "U1:%u %u %u %u", DIRECTORY_CHANNEL, DriveNumber, Track, Sector);
+
+    cbm_batch_clear(Batch);
+
+    cbm_batch_listen(Batch, DeviceAddress, 15);
+    cbm_batch_raw_write(Batch, command, strlen(command));
+    cbm_batch_unlisten(Batch);
+
+    cbm_batch_talk(Batch, DeviceAddress, 15);
+    statusOp = cbm_batch_raw_read(Batch, status, sizeof(status) - 1);
+    cbm_batch_untalk(Batch);
+
+    cbm_batch_talk(Batch, DeviceAddress, DIRECTORY_CHANNEL);
+    blockOp = cbm_batch_raw_read(Batch, Block, DIRECTORY_BLOCK_SIZE);
+    cbm_batch_untalk(Batch);
+
+    if (blockOp < 0 || cbm_batch_submit(HandleDevice, Batch) != 0)
+    {
+        DBG_ERROR((DBG_PREFIX "could not transfer block %u/%u", Track, Sector));
+        FUNC_LEAVE_INT(-1);
+    }
+
+    statusLength = cbm_batch_result(Batch, statusOp);
+    status[statusLength > 0 ? statusLength : 0] = 0;
+
+    // all status codes below 20 are no errors
+
+    if (statusLength < 2 || status[0] < '0' || status[0] > '1' || status[1] < '0' || status[1] > '9')
+    {
+        DBG_ERROR((DBG_PREFIX "reading block %u/%u: %s", Track, Sector, status));
+        FUNC_LEAVE_INT(-1);
+    }
+
+    if (cbm_batch_result(Batch, blockOp) != DIRECTORY_BLOCK_SIZE)
+    {
+        DBG_ERROR((DBG_PREFIX "block %u/%u is too short", Track, Sector));
+        FUNC_LEAVE_INT(-1);
+    }
+
+    FUNC_LEAVE_INT(0);
+}
+
+/*! \internal \brief Copy a name from the directory
+
+ \param Name
+   Pointer to a buffer of Length + 1 bytes which receives the name.
+
+ \param Source
+   The name, filled up with shifted spaces.
+
+ \param Length
+   The length of the name in the directory.
+*/
+
+static void
+directory_copy_name(unsigned char *Name, const unsigned char *Source, unsigned int Length)
+{
+    memcpy(Name, Source, Length);
+
+    while (Length > 0 && Name[Length - 1] == DIRECTORY_FILLER)
+        Length--;
+
+    Name[Length] = 0;
+}
+
+/*! \internal \brief Count the free blocks of a disk
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Batch
+   A batch to record the operations in.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param DriveNumber
+   The drive of a dual drive, 0 for all others.
+
+ \param Format
+   The format of the disk.
+
+ \param Header
+   The header block, which has been read already.
+
+ \return
+   The number of free blocks, as the DOS shows it, or -1 on error.
+*/
+
+static int
+directory_blocks_free(CBM_FILE HandleDevice, CBM_BATCH *Batch,
+                      unsigned char DeviceAddress, unsigned char DriveNumber,
+                      const struct directory_format_s *Format,
+                      const unsigned char *Header)
+{
+    unsigned char block[DIRECTORY_BLOCK_SIZE];
+    unsigned int track;
+    unsigned int sector;
+    unsigned int count;
+    int blocksFree = 0;
+
+    FUNC_ENTER();
+
+    switch (Format->bam)
+    {
+    case bam_1541:
+        for (track = 1; track <= 35; track++)
+        {
+            if (track != Format->dir_track)
+                blocksFree += Header[4 * track];
+        }
+
+        // the second side of a 1571 disk; its BAM is on track 53
+
+        if (Header[3] & 0x80)
+        {
+            for (track = 36; track <= 70; track++)
+            {
+                if (track != Format->dir_track + 35)
+                    blocksFree += Header[0xDD + track - 36];
+            }
+        }
+        break;
+
+    case bam_1581:
+        for (sector = Format->header_sector + 1; sector <= Format->header_sector + 2; sector++)
+        {
+            if (directory_read_block(HandleDevice, Batch, DeviceAddress, DriveNumber,
+                    Format->dir_track, sector, block) != 0)
+            {
+                FUNC_LEAVE_INT(-1);
+            }
+
+            for (count = 0; count < 40; count++)
+            {
+                track = 40 * (sector - Format->header_sector - 1) + count + 1;
+
+                if (track != Format->dir_track)
+                    blocksFree += block[0x10 + 6 * count];
+            }
+        }
+        break;
+
+    case bam_8050:
+        // the header points to the first block of the BAM, each BAM
+        // block to the next one, and the last one to the directory
+
+        track = Header[0];
+        sector = Header[1];
+
+        for (count = 0; track == Format->dir_track - 1u && count < 4; count++)
+        {
+            if (directory_read_block(HandleDevice, Batch, DeviceAddress, DriveNumber,
+                    track, sector, block) != 0)
+            {
+                FUNC_LEAVE_INT(-1);
+            }
+
+            // bytes 4 and 5: the first track, and the one after the last
+            // one, described by this block
+
+            for (track = block[4]; track < block[5] && 6 + 5 * (track - block[4]) < DIRECTORY_BLOCK_SIZE; track++)
+            {
+                if (track != Format->dir_track)
+                    blocksFree += block[6 + 5 * (track - block[4])];
+            }
+
+            track = block[0];
+            sector = block[1];
+        }
+        break;
+    }
+
+    FUNC_LEAVE_INT(blocksFree);
+}
+
+/*! \internal \brief Append the entries of a directory block
+
+ \param Directory
+   The directory to append to.
+
+ \param Block
+   The directory block.
+
+ \return
+   0 on success, -1 if there is not enough memory.
+*/
+
+static int
+directory_append_block(CBM_DIRECTORY *Directory, const unsigned char *Block)
+{
+    unsigned int offset;
+
+    for (offset = 0; offset < DIRECTORY_BLOCK_SIZE; offset += DIRECTORY_ENTRY_SIZE)
+    {
+        const unsigned char *entry = Block + offset;
+        CBM_DIRECTORY_ENTRY *newEntry;
+
+        if (entry[2] == DIRECTORY_TYPE_SCRATCHED)
+            continue;
+
+        if (Directory->count == Directory->allocated)
+        {
+            unsigned int allocated = Directory->allocated
+                ? 2 * Directory->allocated : DIRECTORY_INITIAL_ENTRIES;
+
+            newEntry = realloc(Directory->entries, allocated * sizeof(*newEntry));
+            if (newEntry == NULL)
+                return -1;
+
+            Directory->entries = newEntry;
+            Directory->allocated = allocated;
+        }
+
+        newEntry = &Directory->entries[Directory->count++];
+
+        newEntry->type = entry[2];
+        newEntry->track = entry[3];
+        newEntry->sector = entry[4];
+        directory_copy_name(newEntry->name, entry + 5, 16);
+        newEntry->blocks = entry[0x1E] | (entry[0x1F] << 8);
+    }
+
+    return 0;
+}
+
+
+/*-------------------------------------------------------------------*/
+/*--------- DIRECTORY FUNCTIONS -------------------------------------*/
+
+/*! \brief Read the directory of a disk
+
+ The header, the BAM and the directory blocks are read from the
+ disk with block read commands, and parsed. The directory track
+ is determined by the type of the drive: track 18 on 1541 and
+ compatible drives, track 40 on a 1581, and track 39 on 8050, 8250
+ and SFD-1001 drives.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param DriveNumber
+   The drive of a dual drive, 0 for all others.
+
+ \param Directory
+   Pointer to a variable which receives the directory. It must be
+   freed with cbm_directory_free().
+
+ \return
+   0 on success, -1 on error. In this case, the status of the
+   drive might tell more.
+
+ The channel 14 of the drive is used while the directory is read.
+
+ If cbm_driver_open() did not succeed, it is illegal to
+ call this function.
+*/
+
+int CBMAPIDECL
+cbm_read_directory(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                   unsigned char DriveNumber, CBM_DIRECTORY **Directory)
+{
+    const struct directory_format_s *format;
+    unsigned char block[DIRECTORY_BLOCK_SIZE];
+    unsigned char visited[DIRECTORY_BLOCK_SIZE];
+    CBM_DIRECTORY *directory = NULL;
+    CBM_BATCH *batch = NULL;
+    unsigned int sector;
+    int blocksFree;
+    int opened = 0;
+    int error = -1;
+
+    FUNC_ENTER();
+
+    DBG_ASSERT(Directory != NULL);
+
+    *Directory = NULL;
+
+    do {
+        format = directory_format(HandleDevice, DeviceAddress);
+
+        directory = calloc(1, sizeof(*directory));
+        batch = cbm_batch_create();
+
+        if (directory == NULL || batch == NULL)
+            break;
+
+        // the buffer for the blocks might overwrite code in the drive
+
+        cbm_drive_cache_executed(HandleDevice, DeviceAddress);
+
+        if (cbm_open(HandleDevice, DeviceAddress, DIRECTORY_CHANNEL, "#", 1) != 0)
+            break;
+
+        opened = 1;
+
+        // the header: the disk name, the ID and the DOS type
+
+        if (directory_read_block(HandleDevice, batch, DeviceAddress, DriveNumber,
+                format->dir_track, format->header_sector, block) != 0)
+        {
+            break;
+        }
+
+        directory_copy_name(directory->name, block + format->name_offset, 16);
+
+        memcpy(directory->id, block + format->id_offset, 5);
+        directory->id[2] = ' ';
+        directory->id[5] = 0;
+
+        blocksFree = directory_blocks_free(HandleDevice, batch, DeviceAddress,
+            DriveNumber, format, block);
+
+        if (blocksFree < 0)
+            break;
+
+        directory->blocks_free = blocksFree;
+
+        // the directory blocks; the header points to the first one,
+        // but on a 8050, it points to the BAM, and the directory
+        // follows the header. A block which links to one that has
+        // been read already ends the directory, as it is corrupt.
+
+        if (format->bam == bam_8050)
+            sector = format->header_sector + 1;
+        else
+            sector = block[1];
+
+        memset(visited, 0, sizeof(visited));
+
+        error = 0;
+
+        while (!visited[sector])
+        {
+            visited[sector] = 1;
+
+            if (directory_read_block(HandleDevice, batch, DeviceAddress, DriveNumber,
+                    format->dir_track, sector, block) != 0
+                || directory_append_block(directory, block) != 0)
+            {
+                error = -1;
+                break;
+            }
+
+            if (block[0] != format->dir_track)
+                break;
+
+            sector = block[1];
+        }
+
+    } while (0);
+
+    if (opened)
+        cbm_close(HandleDevice, DeviceAddress, DIRECTORY_CHANNEL);
+
+    cbm_batch_free(batch);
+
+    if (error == 0)
+        *Directory = directory;
+    else
+        cbm_directory_free(directory);
+
+    FUNC_LEAVE_INT(error);
+}
+
+/*! \brief Free a directory
+
+ \param Directory
+   The directory, as returned by cbm_read_directory().
+   NULL is allowed, too.
+*/
+
+void CBMAPIDECL
+cbm_directory_free(CBM_DIRECTORY *Directory)
+{
+    FUNC_ENTER();
+
+    if (Directory != NULL)
+    {
+        free(Directory->entries);
+        free(Directory);
+    }
+
+    FUNC_LEAVE();
+}
@@ -0,0 +1,940 @@
+/*
+ *      This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file lib/drvcache.c \n
+** \n
+** \brief Shared library / DLL for accessing the driver:
+**        Cache of drive types and of the code resident in the drives
+**
+** For every adapter and device, the type of the drive and the
+** programs uploaded with cbm_upload_cached() are remembered, together
+** with a checksum of each program. This information is kept in a file
+** between two runs.
+**
+** A program is only uploaded again if a short checksum routine
+** executed in the drive shows that it is not resident anymore. If one
+** of the programs is found to be resident, the drive has not been
+** reset in the mean time, thus, its type does not need to be
+** identified again.
+**
+** The checksum routine uses the drive memory from $0300 on, thus,
+** programs there are never taken from the cache.
+**
+****************************************************************/
+
+/*! Mark: We are in user-space (for debug.h) */
+#define DBG_USERMODE
+
+/*! The name of the executable */
+#define DBG_PROGNAME "OPENCBM.DLL"
+
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! mark: We are building the DLL */
+#define DLL
+#include "opencbm.h"
+#include "archlib.h"
+#include "internal.h"
+
+#include "arch.h"
+#include "configuration.h"
+#include "libmisc.h"
+
+/*! The checksum routine, see drvcache.a65 */
+static const unsigned char check_prog[] = {
+#include "drvcache.inc"
+};
+
+/* addresses in the drive, see drvcache.a65 */
+#define CHECK_PARAM     0x0300  /*!< start address and length of the region */
+#define CHECK_RESULT    0x0304  /*!< the checksum of the region */
+#define CHECK_START     0x0308  /*!< the start of the routine */
+#define CHECK_PARAMSIZE (CHECK_START - CHECK_PARAM) /*!< size of parameters and result */
+
+/*! The number of programs remembered for every drive */
+#define DRIVE_CACHE_REGIONS 8
+
+/*! The length of a device string kept in the cache */
+#define DRIVE_CACHE_STRING_LEN 32
+
+/*! \internal \brief A program which has been uploaded into the drive */
+struct drive_cache_region_s
+{
+    int address;             /*!< the address of the program in the drive */
+    size_t size;             /*!< the size of the program */
+    unsigned long checksum;  /*!< the checksum of the program */
+    int verified;            /*!< the program has just been found resident */
+};
+
+/*! \internal \brief What is known about one drive */
+struct drive_cache_device_s
+{
+    int type_known;          /*!< the type of the drive is known */
+    int type_verified;       /*!< the type is known to be valid for this run */
+    int changed;             /*!< the entry has to be written to the file */
+    int checking;            /*!< the checksum routine is running */
+
+    enum cbm_device_type_e type;          /*!< the type of the drive */
+    char string[DRIVE_CACHE_STRING_LEN];  /*!< the name of the drive type */
+
+    unsigned int region_count; /*!< the number of valid entries in region[] */
+
+    /*! the programs uploaded into the drive */
+    struct drive_cache_region_s region[DRIVE_CACHE_REGIONS];
+};
+
+/*! \internal \brief The cache of one handle */
+struct drive_cache_s
+{
+    struct drive_cache_s *next;   /*!< the cache of the next handle */
+    CBM_FILE HandleDevice;        /*!< the handle this cache belongs to */
+    char *adapter;                /*!< the name of the adapter, including the port */
+
+    /*! the drives behind this handle */
+    struct drive_cache_device_s device[CBM_BUS_LAST_DEVICE + 1];
+};
+
+/*! The caches of all handles. The list is protected by arch_global_lock();
+ * the contents of an entry are only used by the user of the handle. */
+static struct drive_cache_s *drive_cache = NULL;
+
+/*! \internal \brief Calculate the checksum of a program
+
+ This is the same checksum the drive calculates with drvcache.a65.
+
+ \param Program
+   Pointer to the program.
+
+ \param Size
+   The size of the program, in bytes.
+
+ \return
+   The 16 bit sum of the bytes in the low word, and the 16 bit sum of
+   all of these sums in the high word.
+*/
+
+static unsigned long
+drive_code_checksum(const unsigned char *Program, size_t Size)
+{
+    unsigned int s1 = 0;
+    unsigned int s2 = 0;
+
+    while (Size--)
+    {
+        s1 = (s1 + *Program++) & 0xffff;
+        s2 = (s2 + s1) & 0xffff;
+    }
+
+    return ((unsigned long) s2 << 16) | s1;
+}
+
+/*! \internal \brief Find the information about a drive
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \return
+   The information about the drive, or NULL if there is no cache
+   for it.
+*/
+
+static struct drive_cache_device_s *
+drive_cache_device(CBM_FILE HandleDevice, unsigned char DeviceAddress)
+{
+    struct drive_cache_s *cache;
+
+    if (DeviceAddress < CBM_BUS_FIRST_DEVICE || DeviceAddress > CBM_BUS_LAST_DEVICE)
+        return NULL;
+
+    arch_global_lock();
+
+    for (cache = drive_cache; cache != NULL; cache = cache->next)
+    {
+        if (cache->HandleDevice == HandleDevice)
+            break;
+    }
+
+    arch_global_unlock();
+
+    return cache ? &cache->device[DeviceAddress] : NULL;
+}
+
+/*! \internal \brief Forget the programs in a memory area of a drive
+
+ \param Device
+   The information about the drive.
+
+ \param DriveMemAddress
+   The start of the memory area.
+
+ \param Size
+   The size of the memory area.
+*/
+
+static void
+drive_cache_remove(struct drive_cache_device_s *Device, int DriveMemAddress, size_t Size)
+{
+    unsigned int i = 0;
+
+    while (i < Device->region_count)
+    {
+        struct drive_cache_region_s *region = &Device->region[i];
+
+        if (region->address < DriveMemAddress + (int) Size
+            && DriveMemAddress < region->address + (int) region->size)
+        {
+            *region = Device->region[--Device->region_count];
+            Device->changed = 1;
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+/*! \internal \brief Check if a program is resident in the drive
+
+ The checksum routine is uploaded into the drive and executed there,
+ and its result is compared with the checksum of the program. If the
+ program is not resident, it is forgotten.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param Device
+   The information about the drive.
+
+ \param Region
+   The program to check.
+
+ \return
+   0 if the program is resident, 1 if not, -1 if it cannot be
+   checked on this drive.
+*/
+
+static int
+drive_cache_check(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                  struct drive_cache_device_s *Device,
+                  const struct drive_cache_region_s *Region)
+{
+    unsigned char buffer[CHECK_PARAMSIZE + sizeof(check_prog)];
+    unsigned char command[] = { 'M', '-', 'E', CHECK_START % 256, CHECK_START / 256 };
+    unsigned char result[4];
+    struct drive_cache_region_s region = *Region;
+    unsigned long checksum;
+
+    if (!Device->type_known)
+        return -1;
+
+    switch (Device->type)
+    {
+    case cbm_dt_cbm1541:
+    case cbm_dt_cbm1570:
+    case cbm_dt_cbm1571:
+    case cbm_dt_cbm1581:
+        break;
+
+    default:
+        return -1;
+    }
+
+    // the checksum routine must not overwrite the program itself
+
+    if (region.address < CHECK_PARAM + (int) sizeof(buffer)
+        && CHECK_PARAM < region.address + (int) region.size)
+    {
+        return -1;
+    }
+
+    memset(buffer, 0, CHECK_PARAMSIZE);
+    buffer[0] = (unsigned char) (region.address % 256);
+    buffer[1] = (unsigned char) (region.address / 256);
+    buffer[2] = (unsigned char) (region.size % 256);
+    buffer[3] = (unsigned char) (region.size / 256);
+    memcpy(&buffer[CHECK_PARAMSIZE], check_prog, sizeof(check_prog));
+
+    // this drops all programs which overlap with the checksum routine
+
+    Device->checking = 1;
+
+    if (cbm_upload(HandleDevice, DeviceAddress, CHECK_PARAM, buffer, sizeof(buffer)) != (int) sizeof(buffer)
+        || cbm_exec_command(HandleDevice, DeviceAddress, command, sizeof(command)) != 0
+        || cbm_download(HandleDevice, DeviceAddress, CHECK_RESULT, result, sizeof(result)) != (int) sizeof(result))
+    {
+        Device->checking = 0;
+        DBG_WARN((DBG_PREFIX "could not check the drive code at $%04x", region.address));
+        return -1;
+    }
+
+    Device->checking = 0;
+
+    checksum = result[0] | (result[1] << 8)
+        | ((unsigned long) result[2] << 16) | ((unsigned long) result[3] << 24);
+
+    DBG_PRINT((DBG_PREFIX "drive code at $%04x: checksum %08lx, expected %08lx",
+        region.address, checksum, region.checksum));
+
+    if (checksum != region.checksum)
+    {
+        drive_cache_remove(Device, region.address, region.size);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*! \internal \brief Get the name of the file section of a drive
+
+ \param Cache
+   The cache of the handle.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \return
+   A newly allocated string with the name of the section.
+   It has to be freed with cbmlibmisc_strfree().
+*/
+
+static char *
+drive_cache_section(const struct drive_cache_s *Cache, unsigned char DeviceAddress)
+{
+    char device[8];
+
+    sprintf(device, "/%u", DeviceAddress);
+
+    return cbmlibmisc_strcat(Cache->adapter, device);
+}
+
+/*! \internal \brief Read the information about the drives from the file
+
+ \param Cache
+   The cache of the handle.
+*/
+
+static void
+drive_cache_load(struct drive_cache_s *Cache)
+{
+    opencbm_configuration_handle configuration;
+    const char *filename;
+    unsigned char device;
+
+    filename = configuration_get_drive_cache_filename();
+    if (filename == NULL)
+        return;
+
+    configuration = opencbm_configuration_open(filename);
+    cbmlibmisc_strfree(filename);
+
+    if (configuration == NULL)
+        return;
+
+    for (device = CBM_BUS_FIRST_DEVICE; device <= CBM_BUS_LAST_DEVICE; device++)
+    {
+        struct drive_cache_device_s *dev = &Cache->device[device];
+        char *section = drive_cache_section(Cache, device);
+        char *type = NULL;
+        char *name = NULL;
+        char *code = NULL;
+
+        if (section
+            && opencbm_configuration_get_data(configuration, section, "type", &type) == 0
+            && opencbm_configuration_get_data(configuration, section, "name", &name) == 0
+            && type[0] != 0)
+        {
+            const char *p;
+
+            dev->type_known = 1;
+            dev->type = (enum cbm_device_type_e) strtol(type, NULL, 10);
+            strncpy(dev->string, name, DRIVE_CACHE_STRING_LEN - 1);
+
+            // code=<address>:<size>:<checksum> <address>:<size>:<checksum> ...
+
+            opencbm_configuration_get_data(configuration, section, "code", &code);
+
+            for (p = code; p && dev->region_count < DRIVE_CACHE_REGIONS; )
+            {
+                struct drive_cache_region_s *region = &dev->region[dev->region_count];
+                unsigned int address, size;
+                unsigned long checksum;
+                int length;
+
+                if (sscanf(p, " %x:%x:%lx%n", &address, &size, &checksum, &length) != 3)
+                    break;
+
+                if (size > 0)
+                {
+                    region->address = address;
+                    region->size = size;
+                    region->checksum = checksum;
+                    dev->region_count++;
+                }
+                p += length;
+            }
+        }
+
+        cbmlibmisc_strfree(type);
+        cbmlibmisc_strfree(name);
+        cbmlibmisc_strfree(code);
+        cbmlibmisc_strfree(section);
+    }
+
+    opencbm_configuration_close(configuration);
+}
+
+/*! \internal \brief Write the changed information about the drives into the file
+
+ \param Cache
+   The cache of the handle.
+*/
+
+static void
+drive_cache_save(struct drive_cache_s *Cache)
+{
+    opencbm_configuration_handle configuration = NULL;
+    const char *filename = NULL;
+    unsigned char device;
+
+    for (device = CBM_BUS_FIRST_DEVICE; device <= CBM_BUS_LAST_DEVICE; device++)
+    {
+        struct drive_cache_device_s *dev = &Cache->device[device];
+        char type[12];
+        char code[DRIVE_CACHE_REGIONS * 24 + 1];
+        char *section;
+        unsigned int i;
+
+        if (!dev->changed)
+            continue;
+
+        if (configuration == NULL)
+        {
+            filename = configuration_get_drive_cache_filename();
+            if (filename == NULL)
+                break;
+
+            configuration = opencbm_configuration_create(filename);
+            if (configuration == NULL)
+                break;
+        }
+
+        code[0] = 0;
+        type[0] = 0;
+
+        if (dev->type_known)
+        {
+            sprintf(type, "%d", (int) dev->type);
+
+            for (i = 0; i < dev->region_count; i++)
+            {
+                sprintf(code + strlen(code), "%s%04x:%04x:%08lx", i ? " " : "",
+                    dev->region[i].address, (unsigned int) dev->region[i].size,
+                    dev->region[i].checksum);
+            }
+        }
+
+        section = drive_cache_section(Cache, device);
+        if (section)
+        {
+            opencbm_configuration_set_data(configuration, section, "type", type);
+            opencbm_configuration_set_data(configuration, section, "name", dev->type_known ? dev->string : "");
+            opencbm_configuration_set_data(configuration, section, "code", code);
+            cbmlibmisc_strfree(section);
+        }
+    }
+
+    if (configuration)
+    {
+        if (opencbm_configuration_close(configuration))
+        {
+            DBG_WARN((DBG_PREFIX "could not write the drive cache '%s'", filename));
+        }
+    }
+
+    cbmlibmisc_strfree(filename);
+}
+
+/*! \internal \brief Start caching the drives behind a handle
+
+ This is called by cbm_driver_open_ex() after a handle has been opened.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Adapter
+   The name of the plugin which is used.
+
+ \param Port
+   The port of the plugin which is used, or NULL for the default port.
+*/
+
+void
+cbm_drive_cache_open(CBM_FILE HandleDevice, const char *Adapter, const char *Port)
+{
+    struct drive_cache_s *cache;
+
+    if (Adapter == NULL)
+        return;
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL)
+        return;
+
+    cache->HandleDevice = HandleDevice;
+
+    if (Port && Port[0])
+    {
+        char *adapter = cbmlibmisc_strcat(Adapter, ":");
+
+        cache->adapter = cbmlibmisc_strcat(adapter, Port);
+        cbmlibmisc_strfree(adapter);
+    }
+    else
+    {
+        cache->adapter = cbmlibmisc_strdup(Adapter);
+    }
+
+    if (cache->adapter == NULL)
+    {
+        free(cache);
+        return;
+    }
+
+    drive_cache_load(cache);
+
+    arch_global_lock();
+    cache->next = drive_cache;
+    drive_cache = cache;
+    arch_global_unlock();
+}
+
+/*! \internal \brief Stop caching the drives behind a handle
+
+ The changed information is written into the file. This is called
+ by cbm_driver_close().
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+*/
+
+void
+cbm_drive_cache_close(CBM_FILE HandleDevice)
+{
+    struct drive_cache_s **pcache;
+    struct drive_cache_s *cache = NULL;
+
+    arch_global_lock();
+
+    for (pcache = &drive_cache; *pcache != NULL; pcache = &(*pcache)->next)
+    {
+        if ((*pcache)->HandleDevice == HandleDevice)
+        {
+            cache = *pcache;
+            *pcache = cache->next;
+            break;
+        }
+    }
+
+    arch_global_unlock();
+
+    if (cache)
+    {
+        drive_cache_save(cache);
+        cbmlibmisc_strfree(cache->adapter);
+        free(cache);
+    }
+}
+
+/*! \internal \brief Get the type of a drive from the cache
+
+ The type is only taken from the cache if one of the programs uploaded
+ into the drive is still resident, that is, the drive has not been
+ reset or exchanged.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param CbmDeviceType
+   Pointer to an enum which will hold the type of the device.
+
+ \param CbmDeviceString
+   Pointer to a pointer which will point on a string which
+   tells the name of the device.
+
+ \return
+   0 if the type has been found in the cache, 1 otherwise.
+*/
+
+int
+cbm_drive_cache_identify(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                         enum cbm_device_type_e *CbmDeviceType,
+                         const char **CbmDeviceString)
+{
+    struct drive_cache_device_s *dev;
+    unsigned int i;
+
+    dev = drive_cache_device(HandleDevice, DeviceAddress);
+    if (dev == NULL || !dev->type_known)
+        return 1;
+
+    for (i = 0; !dev->type_verified && i < dev->region_count; )
+    {
+        struct drive_cache_region_s region = dev->region[i];
+
+        switch (drive_cache_check(HandleDevice, DeviceAddress, dev, &region))
+        {
+        case 0:
+            // the check itself might have dropped some entries
+            for (i = 0; i < dev->region_count; i++)
+            {
+                if (dev->region[i].address == region.address)
+                    dev->region[i].verified = 1;
+            }
+            dev->type_verified = 1;
+            break;
+
+        case 1:
+            // the program has been removed, check the one which took its place
+            break;
+
+        default:
+            i++;
+            break;
+        }
+    }
+
+    if (!dev->type_verified)
+        return 1;
+
+    DBG_PRINT((DBG_PREFIX "drive %u: %s, taken from the cache", DeviceAddress, dev->string));
+
+    if (CbmDeviceType)
+        *CbmDeviceType = dev->type;
+
+    if (CbmDeviceString)
+        *CbmDeviceString = dev->string;
+
+    return 0;
+}
+
+/*! \internal \brief Remember the type of a drive
+
+ This is called after a drive has been identified with cbm_identify().
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param CbmDeviceType
+   The type of the device.
+
+ \param CbmDeviceString
+   The name of the device type.
+*/
+
+void
+cbm_drive_cache_set_type(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                         enum cbm_device_type_e CbmDeviceType,
+                         const char *CbmDeviceString)
+{
+    struct drive_cache_device_s *dev;
+
+    dev = drive_cache_device(HandleDevice, DeviceAddress);
+    if (dev == NULL)
+        return;
+
+    if (CbmDeviceType == cbm_dt_unknown || CbmDeviceString == NULL)
+    {
+        // the footprint of an unknown drive is not worth remembering
+
+        if (dev->type_known)
+            dev->changed = 1;
+
+        dev->type_known = 0;
+        dev->type_verified = 0;
+        dev->region_count = 0;
+        return;
+    }
+
+    if (!dev->type_known || dev->type != CbmDeviceType
+        || strncmp(dev->string, CbmDeviceString, DRIVE_CACHE_STRING_LEN - 1) != 0)
+    {
+        // another drive: what we knew about the old one is worthless
+        dev->region_count = 0;
+        dev->changed = 1;
+    }
+
+    dev->type_known = 1;
+    dev->type_verified = 1;
+    dev->type = CbmDeviceType;
+    strncpy(dev->string, CbmDeviceString, DRIVE_CACHE_STRING_LEN - 1);
+    dev->string[DRIVE_CACHE_STRING_LEN - 1] = 0;
+}
+
+/*! \internal \brief Note that memory of a drive has been written to
+
+ This is called by cbm_upload(), so programs which have been
+ overwritten are forgotten.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param DriveMemAddress
+   The start of the memory area which has been written.
+
+ \param Size
+   The size of the memory area which has been written.
+*/
+
+void
+cbm_drive_cache_written(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                        int DriveMemAddress, size_t Size)
+{
+    struct drive_cache_device_s *dev;
+
+    dev = drive_cache_device(HandleDevice, DeviceAddress);
+    if (dev != NULL)
+        drive_cache_remove(dev, DriveMemAddress, Size);
+}
+
+/*! \internal \brief Note that code has been executed in a drive
+
+ This is called by cbm_exec_command(). The executed code might
+ have changed the drive memory, thus, the programs found to be
+ resident have to be checked again before they are used.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+*/
+
+void
+cbm_drive_cache_executed(CBM_FILE HandleDevice, unsigned char DeviceAddress)
+{
+    struct drive_cache_device_s *dev;
+    unsigned int i;
+
+    dev = drive_cache_device(HandleDevice, DeviceAddress);
+    if (dev == NULL || dev->checking)
+        return;
+
+    for (i = 0; i < dev->region_count; i++)
+        dev->region[i].verified = 0;
+}
+
+/*! \brief Check if a program is resident in a floppy's drive memory
+
+ This function finds out if a program which has been uploaded before
+ with cbm_upload_cached(), or noted with cbm_drive_code_uploaded(),
+ is still resident in the drive, even if this happened in an earlier
+ run.
+
+ For this, the drive must have been identified with cbm_bus_identify()
+ before. A short checksum routine is executed in the drive, which
+ overwrites the drive memory from $0300 to $034e; programs in this
+ area are never found to be resident.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param DriveMemAddress
+   The address in the drive's memory where the program is
+   expected.
+
+ \param Program
+   Pointer to a byte buffer which holds the program in the
+   caller's address space.
+
+ \param Size
+   The size of the program, in bytes.
+
+ \return
+   1 if the program is resident, 0 if it has to be uploaded.
+
+ If cbm_driver_open() did not succeed, it is illegal to
+ call this function.
+*/
+
+int CBMAPIDECL
+cbm_drive_code_resident(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                        int DriveMemAddress, const void *Program, size_t Size)
+{
+    struct drive_cache_device_s *dev;
+    unsigned long checksum;
+    unsigned int i;
+
+    FUNC_ENTER();
+
+    dev = drive_cache_device(HandleDevice, DeviceAddress);
+
+    if (dev == NULL || Size == 0 || !dev->type_verified)
+        FUNC_LEAVE_INT(0);
+
+    checksum = drive_code_checksum(Program, Size);
+
+    for (i = 0; i < dev->region_count; i++)
+    {
+        struct drive_cache_region_s region = dev->region[i];
+
+        if (region.address != DriveMemAddress || region.size != Size || region.checksum != checksum)
+            continue;
+
+        // a program found by cbm_drive_cache_identify() need not be checked again
+
+        if (region.verified || drive_cache_check(HandleDevice, DeviceAddress, dev, &region) == 0)
+        {
+            for (i = 0; i < dev->region_count; i++)
+            {
+                if (dev->region[i].address == DriveMemAddress)
+                    dev->region[i].verified = 0;
+            }
+
+            DBG_PRINT((DBG_PREFIX "drive code at $%04x is resident", DriveMemAddress));
+            FUNC_LEAVE_INT(1);
+        }
+        break;
+    }
+
+    FUNC_LEAVE_INT(0);
+}
+
+/*! \brief Remember a program which has been uploaded into a floppy's drive memory
+
+ cbm_upload_cached() calls this after a successful upload. Whoever
+ writes programs into the drive memory by other means can call this
+ to let cbm_drive_code_resident() find them later.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param DriveMemAddress
+   The address in the drive's memory where the program has been
+   stored.
+
+ \param Program
+   Pointer to a byte buffer which holds the program in the
+   caller's address space.
+
+ \param Size
+   The size of the program, in bytes.
+
+ If cbm_driver_open() did not succeed, it is illegal to
+ call this function.
+*/
+
+void CBMAPIDECL
+cbm_drive_code_uploaded(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                        int DriveMemAddress, const void *Program, size_t Size)
+{
+    struct drive_cache_device_s *dev;
+    struct drive_cache_region_s *region;
+
+    FUNC_ENTER();
+
+    dev = drive_cache_device(HandleDevice, DeviceAddress);
+
+    if (dev != NULL && Size > 0)
+    {
+        drive_cache_remove(dev, DriveMemAddress, Size);
+
+        if (dev->region_count == DRIVE_CACHE_REGIONS)
+            dev->region_count--;
+
+        region = &dev->region[dev->region_count++];
+        region->address = DriveMemAddress;
+        region->size = Size;
+        region->checksum = drive_code_checksum(Program, Size);
+        region->verified = 0;
+        dev->changed = 1;
+    }
+
+    FUNC_LEAVE();
+}
+
+/*! \brief Upload a program into a floppy's drive memory, if it is not there yet
+
+ This function behaves like cbm_upload(), but it remembers the
+ programs uploaded into each drive, even between two runs. If the
+ program is still resident in the drive, as found by
+ cbm_drive_code_resident(), it is not uploaded again.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param DriveMemAddress
+   The address in the drive's memory where the program is to be
+   stored.
+
+ \param Program
+   Pointer to a byte buffer which holds the program in the
+   caller's address space.
+
+ \param Size
+   The size of the program to be stored, in bytes.
+
+ \return
+   Returns the number of bytes written into program memory,
+   or found to be there already. If it does not equal Size,
+   than an error occurred.
+   Specifically, -1 is returned on transfer errors.
+
+ If cbm_driver_open() did not succeed, it is illegal to
+ call this function.
+*/
+
+int CBMAPIDECL
+cbm_upload_cached(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                  int DriveMemAddress, const void *Program, size_t Size)
+{
+    int rv;
+
+    FUNC_ENTER();
+
+    if (cbm_drive_code_resident(HandleDevice, DeviceAddress, DriveMemAddress, Program, Size))
+        FUNC_LEAVE_INT((int) Size);
+
+    rv = cbm_upload(HandleDevice, DeviceAddress, DriveMemAddress, Program, Size);
+
+    if (rv == (int) Size)
+        cbm_drive_code_uploaded(HandleDevice, DeviceAddress, DriveMemAddress, Program, Size);
+
+    FUNC_LEAVE_INT(rv);
+}
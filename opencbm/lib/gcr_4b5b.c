@@ -30,6 +30,8 @@
 #include "opencbm.h"
 
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 /*! \brief Decode GCR data
 
@@ -265,3 +267,644 @@ gcr_4_to_5_encode(const unsigned char *source, unsigned char *dest,
     FUNC_LEAVE_INT(rv);
     return rv;
 }
+
+/*
+ * Whole buffer GCR conversion
+ *
+ * Decoding looks up every 10 bit GCR code in one table, giving the
+ * plain byte and whether one of its nybble codes was illegal. Encoding
+ * looks up the 10 bit GCR code of every plain byte. Thus, 5 GCR bytes
+ * are converted with 4 table accesses, without any loop per nybble.
+ *
+ * The nybble-wise gcr_5_to_4_decode() and gcr_4_to_5_encode() above are
+ * kept as the reference implementation. Which one is used is selected
+ * at runtime, see gcr_select_codec().
+ */
+
+/*! Decode table: bits 0-7 are the plain byte, bit 8 is set if at least
+    one of the two 5 bit codes is illegal. Illegal codes decode as for
+    gcr_5_to_4_decode(). */
+static const unsigned short gcr_decode_10[1024] =
+{
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x18f, 0x18f, 0x18f, 0x18f, 0x18f, 0x18f, 0x18f, 0x18f,
+    0x18f, 0x088, 0x080, 0x081, 0x18f, 0x08c, 0x084, 0x085,
+    0x18f, 0x18f, 0x082, 0x083, 0x18f, 0x08f, 0x086, 0x087,
+    0x18f, 0x089, 0x08a, 0x08b, 0x18f, 0x08d, 0x08e, 0x18f,
+    0x10f, 0x10f, 0x10f, 0x10f, 0x10f, 0x10f, 0x10f, 0x10f,
+    0x10f, 0x008, 0x000, 0x001, 0x10f, 0x00c, 0x004, 0x005,
+    0x10f, 0x10f, 0x002, 0x003, 0x10f, 0x00f, 0x006, 0x007,
+    0x10f, 0x009, 0x00a, 0x00b, 0x10f, 0x00d, 0x00e, 0x10f,
+    0x11f, 0x11f, 0x11f, 0x11f, 0x11f, 0x11f, 0x11f, 0x11f,
+    0x11f, 0x018, 0x010, 0x011, 0x11f, 0x01c, 0x014, 0x015,
+    0x11f, 0x11f, 0x012, 0x013, 0x11f, 0x01f, 0x016, 0x017,
+    0x11f, 0x019, 0x01a, 0x01b, 0x11f, 0x01d, 0x01e, 0x11f,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1cf, 0x1cf, 0x1cf, 0x1cf, 0x1cf, 0x1cf, 0x1cf, 0x1cf,
+    0x1cf, 0x0c8, 0x0c0, 0x0c1, 0x1cf, 0x0cc, 0x0c4, 0x0c5,
+    0x1cf, 0x1cf, 0x0c2, 0x0c3, 0x1cf, 0x0cf, 0x0c6, 0x0c7,
+    0x1cf, 0x0c9, 0x0ca, 0x0cb, 0x1cf, 0x0cd, 0x0ce, 0x1cf,
+    0x14f, 0x14f, 0x14f, 0x14f, 0x14f, 0x14f, 0x14f, 0x14f,
+    0x14f, 0x048, 0x040, 0x041, 0x14f, 0x04c, 0x044, 0x045,
+    0x14f, 0x14f, 0x042, 0x043, 0x14f, 0x04f, 0x046, 0x047,
+    0x14f, 0x049, 0x04a, 0x04b, 0x14f, 0x04d, 0x04e, 0x14f,
+    0x15f, 0x15f, 0x15f, 0x15f, 0x15f, 0x15f, 0x15f, 0x15f,
+    0x15f, 0x058, 0x050, 0x051, 0x15f, 0x05c, 0x054, 0x055,
+    0x15f, 0x15f, 0x052, 0x053, 0x15f, 0x05f, 0x056, 0x057,
+    0x15f, 0x059, 0x05a, 0x05b, 0x15f, 0x05d, 0x05e, 0x15f,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x12f, 0x12f, 0x12f, 0x12f, 0x12f, 0x12f, 0x12f, 0x12f,
+    0x12f, 0x028, 0x020, 0x021, 0x12f, 0x02c, 0x024, 0x025,
+    0x12f, 0x12f, 0x022, 0x023, 0x12f, 0x02f, 0x026, 0x027,
+    0x12f, 0x029, 0x02a, 0x02b, 0x12f, 0x02d, 0x02e, 0x12f,
+    0x13f, 0x13f, 0x13f, 0x13f, 0x13f, 0x13f, 0x13f, 0x13f,
+    0x13f, 0x038, 0x030, 0x031, 0x13f, 0x03c, 0x034, 0x035,
+    0x13f, 0x13f, 0x032, 0x033, 0x13f, 0x03f, 0x036, 0x037,
+    0x13f, 0x039, 0x03a, 0x03b, 0x13f, 0x03d, 0x03e, 0x13f,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x0f8, 0x0f0, 0x0f1, 0x1ff, 0x0fc, 0x0f4, 0x0f5,
+    0x1ff, 0x1ff, 0x0f2, 0x0f3, 0x1ff, 0x0ff, 0x0f6, 0x0f7,
+    0x1ff, 0x0f9, 0x0fa, 0x0fb, 0x1ff, 0x0fd, 0x0fe, 0x1ff,
+    0x16f, 0x16f, 0x16f, 0x16f, 0x16f, 0x16f, 0x16f, 0x16f,
+    0x16f, 0x068, 0x060, 0x061, 0x16f, 0x06c, 0x064, 0x065,
+    0x16f, 0x16f, 0x062, 0x063, 0x16f, 0x06f, 0x066, 0x067,
+    0x16f, 0x069, 0x06a, 0x06b, 0x16f, 0x06d, 0x06e, 0x16f,
+    0x17f, 0x17f, 0x17f, 0x17f, 0x17f, 0x17f, 0x17f, 0x17f,
+    0x17f, 0x078, 0x070, 0x071, 0x17f, 0x07c, 0x074, 0x075,
+    0x17f, 0x17f, 0x072, 0x073, 0x17f, 0x07f, 0x076, 0x077,
+    0x17f, 0x079, 0x07a, 0x07b, 0x17f, 0x07d, 0x07e, 0x17f,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x19f, 0x19f, 0x19f, 0x19f, 0x19f, 0x19f, 0x19f, 0x19f,
+    0x19f, 0x098, 0x090, 0x091, 0x19f, 0x09c, 0x094, 0x095,
+    0x19f, 0x19f, 0x092, 0x093, 0x19f, 0x09f, 0x096, 0x097,
+    0x19f, 0x099, 0x09a, 0x09b, 0x19f, 0x09d, 0x09e, 0x19f,
+    0x1af, 0x1af, 0x1af, 0x1af, 0x1af, 0x1af, 0x1af, 0x1af,
+    0x1af, 0x0a8, 0x0a0, 0x0a1, 0x1af, 0x0ac, 0x0a4, 0x0a5,
+    0x1af, 0x1af, 0x0a2, 0x0a3, 0x1af, 0x0af, 0x0a6, 0x0a7,
+    0x1af, 0x0a9, 0x0aa, 0x0ab, 0x1af, 0x0ad, 0x0ae, 0x1af,
+    0x1bf, 0x1bf, 0x1bf, 0x1bf, 0x1bf, 0x1bf, 0x1bf, 0x1bf,
+    0x1bf, 0x0b8, 0x0b0, 0x0b1, 0x1bf, 0x0bc, 0x0b4, 0x0b5,
+    0x1bf, 0x1bf, 0x0b2, 0x0b3, 0x1bf, 0x0bf, 0x0b6, 0x0b7,
+    0x1bf, 0x0b9, 0x0ba, 0x0bb, 0x1bf, 0x0bd, 0x0be, 0x1bf,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff,
+    0x1df, 0x1df, 0x1df, 0x1df, 0x1df, 0x1df, 0x1df, 0x1df,
+    0x1df, 0x0d8, 0x0d0, 0x0d1, 0x1df, 0x0dc, 0x0d4, 0x0d5,
+    0x1df, 0x1df, 0x0d2, 0x0d3, 0x1df, 0x0df, 0x0d6, 0x0d7,
+    0x1df, 0x0d9, 0x0da, 0x0db, 0x1df, 0x0dd, 0x0de, 0x1df,
+    0x1ef, 0x1ef, 0x1ef, 0x1ef, 0x1ef, 0x1ef, 0x1ef, 0x1ef,
+    0x1ef, 0x0e8, 0x0e0, 0x0e1, 0x1ef, 0x0ec, 0x0e4, 0x0e5,
+    0x1ef, 0x1ef, 0x0e2, 0x0e3, 0x1ef, 0x0ef, 0x0e6, 0x0e7,
+    0x1ef, 0x0e9, 0x0ea, 0x0eb, 0x1ef, 0x0ed, 0x0ee, 0x1ef,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1f8, 0x1f0, 0x1f1, 0x1ff, 0x1fc, 0x1f4, 0x1f5,
+    0x1ff, 0x1ff, 0x1f2, 0x1f3, 0x1ff, 0x1ff, 0x1f6, 0x1f7,
+    0x1ff, 0x1f9, 0x1fa, 0x1fb, 0x1ff, 0x1fd, 0x1fe, 0x1ff
+};
+
+/*! Encode table: the 10 bit GCR code of every byte */
+static const unsigned short gcr_encode_10[256] =
+{
+    0x14a, 0x14b, 0x152, 0x153, 0x14e, 0x14f, 0x156, 0x157,
+    0x149, 0x159, 0x15a, 0x15b, 0x14d, 0x15d, 0x15e, 0x155,
+    0x16a, 0x16b, 0x172, 0x173, 0x16e, 0x16f, 0x176, 0x177,
+    0x169, 0x179, 0x17a, 0x17b, 0x16d, 0x17d, 0x17e, 0x175,
+    0x24a, 0x24b, 0x252, 0x253, 0x24e, 0x24f, 0x256, 0x257,
+    0x249, 0x259, 0x25a, 0x25b, 0x24d, 0x25d, 0x25e, 0x255,
+    0x26a, 0x26b, 0x272, 0x273, 0x26e, 0x26f, 0x276, 0x277,
+    0x269, 0x279, 0x27a, 0x27b, 0x26d, 0x27d, 0x27e, 0x275,
+    0x1ca, 0x1cb, 0x1d2, 0x1d3, 0x1ce, 0x1cf, 0x1d6, 0x1d7,
+    0x1c9, 0x1d9, 0x1da, 0x1db, 0x1cd, 0x1dd, 0x1de, 0x1d5,
+    0x1ea, 0x1eb, 0x1f2, 0x1f3, 0x1ee, 0x1ef, 0x1f6, 0x1f7,
+    0x1e9, 0x1f9, 0x1fa, 0x1fb, 0x1ed, 0x1fd, 0x1fe, 0x1f5,
+    0x2ca, 0x2cb, 0x2d2, 0x2d3, 0x2ce, 0x2cf, 0x2d6, 0x2d7,
+    0x2c9, 0x2d9, 0x2da, 0x2db, 0x2cd, 0x2dd, 0x2de, 0x2d5,
+    0x2ea, 0x2eb, 0x2f2, 0x2f3, 0x2ee, 0x2ef, 0x2f6, 0x2f7,
+    0x2e9, 0x2f9, 0x2fa, 0x2fb, 0x2ed, 0x2fd, 0x2fe, 0x2f5,
+    0x12a, 0x12b, 0x132, 0x133, 0x12e, 0x12f, 0x136, 0x137,
+    0x129, 0x139, 0x13a, 0x13b, 0x12d, 0x13d, 0x13e, 0x135,
+    0x32a, 0x32b, 0x332, 0x333, 0x32e, 0x32f, 0x336, 0x337,
+    0x329, 0x339, 0x33a, 0x33b, 0x32d, 0x33d, 0x33e, 0x335,
+    0x34a, 0x34b, 0x352, 0x353, 0x34e, 0x34f, 0x356, 0x357,
+    0x349, 0x359, 0x35a, 0x35b, 0x34d, 0x35d, 0x35e, 0x355,
+    0x36a, 0x36b, 0x372, 0x373, 0x36e, 0x36f, 0x376, 0x377,
+    0x369, 0x379, 0x37a, 0x37b, 0x36d, 0x37d, 0x37e, 0x375,
+    0x1aa, 0x1ab, 0x1b2, 0x1b3, 0x1ae, 0x1af, 0x1b6, 0x1b7,
+    0x1a9, 0x1b9, 0x1ba, 0x1bb, 0x1ad, 0x1bd, 0x1be, 0x1b5,
+    0x3aa, 0x3ab, 0x3b2, 0x3b3, 0x3ae, 0x3af, 0x3b6, 0x3b7,
+    0x3a9, 0x3b9, 0x3ba, 0x3bb, 0x3ad, 0x3bd, 0x3be, 0x3b5,
+    0x3ca, 0x3cb, 0x3d2, 0x3d3, 0x3ce, 0x3cf, 0x3d6, 0x3d7,
+    0x3c9, 0x3d9, 0x3da, 0x3db, 0x3cd, 0x3dd, 0x3de, 0x3d5,
+    0x2aa, 0x2ab, 0x2b2, 0x2b3, 0x2ae, 0x2af, 0x2b6, 0x2b7,
+    0x2a9, 0x2b9, 0x2ba, 0x2bb, 0x2ad, 0x2bd, 0x2be, 0x2b5
+};
+
+/*! decode "groups" groups of 5 GCR bytes, count illegal bytes */
+typedef int gcr_decode_groups_t(const unsigned char *source, unsigned char *dest, size_t groups);
+
+/*! encode "groups" groups of 4 plain bytes */
+typedef void gcr_encode_groups_t(const unsigned char *source, unsigned char *dest, size_t groups);
+
+/*! count the bytes marked as illegal in a gcr_5_to_4_decode() result */
+static int
+gcr_count_illegal(int rv)
+{
+    int count = 0;
+
+    for (rv >>= 2; rv > 0; rv >>= 2)
+    {
+        if (rv & 3)
+            count++;
+    }
+    return count;
+}
+
+static int
+gcr_decode_groups_table(const unsigned char *source, unsigned char *dest, size_t groups)
+{
+    unsigned int code, illegal = 0;
+
+    for (; groups > 0; groups--, source += 5, dest += 4)
+    {
+        code = gcr_decode_10[(source[0] << 2) | (source[1] >> 6)];
+        illegal += code >> 8;
+        dest[0] = (unsigned char) code;
+
+        code = gcr_decode_10[((source[1] & 0x3f) << 4) | (source[2] >> 4)];
+        illegal += code >> 8;
+        dest[1] = (unsigned char) code;
+
+        code = gcr_decode_10[((source[2] & 0x0f) << 6) | (source[3] >> 2)];
+        illegal += code >> 8;
+        dest[2] = (unsigned char) code;
+
+        code = gcr_decode_10[((source[3] & 0x03) << 8) | source[4]];
+        illegal += code >> 8;
+        dest[3] = (unsigned char) code;
+    }
+    return illegal;
+}
+
+static void
+gcr_encode_groups_table(const unsigned char *source, unsigned char *dest, size_t groups)
+{
+    unsigned int c0, c1, c2, c3;
+
+    for (; groups > 0; groups--, source += 4, dest += 5)
+    {
+        c0 = gcr_encode_10[source[0]];
+        c1 = gcr_encode_10[source[1]];
+        c2 = gcr_encode_10[source[2]];
+        c3 = gcr_encode_10[source[3]];
+
+        dest[0] = (unsigned char) (c0 >> 2);
+        dest[1] = (unsigned char) ((c0 << 6) | (c1 >> 4));
+        dest[2] = (unsigned char) ((c1 << 4) | (c2 >> 6));
+        dest[3] = (unsigned char) ((c2 << 2) | (c3 >> 8));
+        dest[4] = (unsigned char) c3;
+    }
+}
+
+static int
+gcr_decode_groups_reference(const unsigned char *source, unsigned char *dest, size_t groups)
+{
+    int illegal = 0;
+
+    for (; groups > 0; groups--, source += 5, dest += 4)
+    {
+        illegal += gcr_count_illegal(gcr_5_to_4_decode(source, dest, 5, 4));
+    }
+    return illegal;
+}
+
+static void
+gcr_encode_groups_reference(const unsigned char *source, unsigned char *dest, size_t groups)
+{
+    for (; groups > 0; groups--, source += 4, dest += 5)
+    {
+        gcr_4_to_5_encode(source, dest, 4, 5);
+    }
+}
+
+/*! The available GCR codecs, the first one is the default */
+static const struct gcr_codec_s
+{
+    const char          *name;
+    gcr_decode_groups_t *decode;
+    gcr_encode_groups_t *encode;
+} gcr_codecs[] =
+{
+    { "table",     gcr_decode_groups_table,     gcr_encode_groups_table     },
+    { "reference", gcr_decode_groups_reference, gcr_encode_groups_reference }
+};
+
+static const struct gcr_codec_s *gcr_codec = NULL;
+
+static const struct gcr_codec_s *
+gcr_find_codec(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(gcr_codecs) / sizeof(gcr_codecs[0]); i++)
+    {
+        if (strcmp(gcr_codecs[i].name, name) == 0)
+            return &gcr_codecs[i];
+    }
+    return NULL;
+}
+
+static const struct gcr_codec_s *
+gcr_get_codec(void)
+{
+    const struct gcr_codec_s *codec = gcr_codec;
+
+    if (codec == NULL)
+    {
+        char *val = getenv("OPENCBM_GCR_CODEC");
+
+        if (val != NULL)
+            codec = gcr_find_codec(val);
+        if (codec == NULL)
+            codec = &gcr_codecs[0];
+        gcr_codec = codec;
+    }
+    return codec;
+}
+
+/*! \brief Select the GCR codec
+
+ This function selects the implementation used by gcr_decode_buffer()
+ and gcr_encode_buffer(). If it is not called, the codec given in the
+ environment variable OPENCBM_GCR_CODEC is used, or the default one.
+
+ \param name
+   The name of the codec: "table" (the default), or "reference" for
+   the nybble-wise gcr_5_to_4_decode() and gcr_4_to_5_encode(). If
+   NULL, the name of the codec in use is returned only.
+
+ \return
+   The name of the codec in use, or NULL if there is no codec with
+   the given name. In this case, the codec is not changed.
+*/
+
+const char * CBMAPIDECL
+gcr_select_codec(const char *name)
+{
+    const struct gcr_codec_s *codec;
+    const char *rv;
+
+    FUNC_ENTER();
+
+    if (name == NULL)
+    {
+        codec = gcr_get_codec();
+    }
+    else
+    {
+        codec = gcr_find_codec(name);
+        if (codec != NULL)
+            gcr_codec = codec;
+    }
+    rv = codec ? codec->name : NULL;
+
+    FUNC_LEAVE_STRING(rv);
+    return rv;
+}
+
+/*! \brief Decode a buffer of GCR data
+
+ This function decodes a buffer of GCR bytes, e.g. a whole
+ sector or a whole track, into plain bytes. Every 5 GCR bytes
+ give 4 plain bytes.
+
+ \param source
+   The pointer to the source buffer of read-only GCR bytes
+
+ \param dest
+   The pointer to the destination buffer of plain bytes
+
+ \param sourceLength
+   The size of the source buffer.
+
+ \param destLength
+   The size of the destination buffer.
+
+ \return
+   -1 means failure due to invalid buffer pointers, otherwise,
+   the number of decoded bytes which contained an illegal GCR
+   nybble code. Thus, 0 means success.
+
+ Remarks:
+
+ As with gcr_5_to_4_decode(), the conversion stops as soon as
+ either the source or the destination buffer is exhausted; a
+ trailing incomplete group is decoded partially. The buffers
+ must not overlap.
+*/
+
+int CBMAPIDECL
+gcr_decode_buffer(const unsigned char *source, unsigned char *dest,
+                  size_t sourceLength,         size_t destLength)
+{
+    size_t groups;
+    int rv;
+
+    FUNC_ENTER();
+
+    DBG_ASSERT( (source != NULL ) && (dest != NULL) );
+
+    if( (source == NULL) || (dest == NULL) )
+    {
+        rv = -1;
+    }
+    else
+    {
+        groups = sourceLength / 5;
+        if (groups > destLength / 4)
+            groups = destLength / 4;
+
+        rv = gcr_get_codec()->decode(source, dest, groups);
+
+        sourceLength -= groups * 5;
+        destLength   -= groups * 4;
+        if ((sourceLength > 0) && (destLength > 0))
+        {
+            int tail = gcr_5_to_4_decode(source + groups * 5, dest + groups * 4,
+                                         sourceLength, destLength);
+            if (tail > 0)
+                rv += gcr_count_illegal(tail);
+        }
+    }
+
+    FUNC_LEAVE_INT(rv);
+    return rv;
+}
+
+/*! \brief Encode a buffer into GCR data
+
+ This function encodes a buffer of plain bytes, e.g. a whole
+ sector or a whole track, into GCR bytes. Every 4 plain bytes
+ give 5 GCR bytes.
+
+ \param source
+   The pointer to the source buffer of read-only plain bytes
+
+ \param dest
+   The pointer to the destination buffer of GCR bytes
+
+ \param sourceLength
+   The size of the source buffer.
+
+ \param destLength
+   The size of the destination buffer.
+
+ \return
+   0 means success, -1 means failure due to invalid buffer pointers.
+
+ Remarks:
+
+ As with gcr_4_to_5_encode(), the conversion stops as soon as
+ either the source or the destination buffer is exhausted; a
+ trailing incomplete group is encoded partially. The buffers
+ must not overlap.
+*/
+
+int CBMAPIDECL
+gcr_encode_buffer(const unsigned char *source, unsigned char *dest,
+                  size_t sourceLength,         size_t destLength)
+{
+    size_t groups;
+    int rv;
+
+    FUNC_ENTER();
+
+    DBG_ASSERT( (source != NULL ) && (dest != NULL) );
+
+    if( (source == NULL) || (dest == NULL) )
+    {
+        rv = -1;
+    }
+    else
+    {
+        groups = sourceLength / 4;
+        if (groups > destLength / 5)
+            groups = destLength / 5;
+
+        gcr_get_codec()->encode(source, dest, groups);
+
+        sourceLength -= groups * 4;
+        destLength   -= groups * 5;
+        if ((sourceLength > 0) && (destLength > 0))
+        {
+            gcr_4_to_5_encode(source + groups * 4, dest + groups * 5,
+                              sourceLength, destLength);
+        }
+        rv = 0;
+    }
+
+    FUNC_LEAVE_INT(rv);
+    return rv;
+}
+
+/* #define OPENCBM_STANDALONE_TEST 1 */
+
+#ifdef OPENCBM_STANDALONE_TEST
+
+/*
+ * Randomized equivalence test of gcr_decode_buffer() and
+ * gcr_encode_buffer() against gcr_5_to_4_decode() and
+ * gcr_4_to_5_encode(), for every codec.
+ *
+ * Build with e.g.
+ *   cc -DOPENCBM_STANDALONE_TEST -Iinclude -Iinclude/LINUX lib/gcr_4b5b.c
+ * and run it with an optional seed and an optional number of rounds.
+ */
+
+#include <stdio.h>
+
+/*! the largest buffer tested: a whole track of GCR data, and some */
+#define GCR_TEST_MAX 8192
+
+static unsigned long gcr_test_seed;
+
+static unsigned int
+gcr_test_random(void)
+{
+    gcr_test_seed = gcr_test_seed * 1103515245ul + 12345ul;
+    return (unsigned int) (gcr_test_seed >> 16) & 0x7fff;
+}
+
+/*! decode like gcr_decode_buffer(), one group after the other */
+static int
+gcr_test_decode(const unsigned char *source, unsigned char *dest,
+                size_t sourceLength, size_t destLength)
+{
+    int illegal = 0;
+    int rv;
+
+    while ((sourceLength > 0) && (destLength > 0))
+    {
+        rv = gcr_5_to_4_decode(source, dest, sourceLength, destLength);
+        if (rv > 0)
+            illegal += gcr_count_illegal(rv);
+
+        if ((sourceLength < 5) || (destLength < 4))
+            break;
+        source += 5; sourceLength -= 5;
+        dest   += 4; destLength   -= 4;
+    }
+    return illegal;
+}
+
+/*! encode like gcr_encode_buffer(), one group after the other */
+static void
+gcr_test_encode(const unsigned char *source, unsigned char *dest,
+                size_t sourceLength, size_t destLength)
+{
+    while ((sourceLength > 0) && (destLength > 0))
+    {
+        gcr_4_to_5_encode(source, dest, sourceLength, destLength);
+
+        if ((sourceLength < 4) || (destLength < 5))
+            break;
+        source += 4; sourceLength -= 4;
+        dest   += 5; destLength   -= 5;
+    }
+}
+
+static int
+gcr_test_round(const char *codec, unsigned int round)
+{
+    static unsigned char source[GCR_TEST_MAX];
+    static unsigned char expected[GCR_TEST_MAX];
+    static unsigned char result[GCR_TEST_MAX];
+    size_t sourceLength, destLength, i;
+    int rv_expected, rv_result;
+
+    sourceLength = gcr_test_random() % GCR_TEST_MAX;
+    destLength   = gcr_test_random() % GCR_TEST_MAX;
+
+    /* every other round, use valid GCR only, else random bytes */
+    for (i = 0; i < sourceLength; i++)
+        source[i] = (unsigned char) gcr_test_random();
+    if (round & 1)
+    {
+        gcr_test_encode(source, expected, sourceLength / 5 * 4, sourceLength);
+        memcpy(source, expected, sourceLength / 5 * 5);
+    }
+
+    memset(expected, 0x55, sizeof(expected));
+    memset(result, 0x55, sizeof(result));
+    rv_expected = gcr_test_decode(source, expected, sourceLength, destLength);
+    rv_result = gcr_decode_buffer(source, result, sourceLength, destLength);
+    if ((rv_expected != rv_result) || memcmp(expected, result, sizeof(result)) != 0)
+    {
+        fprintf(stderr, "%s: round %u: decode of %u to %u bytes differs (%d, %d)\n",
+                codec, round, (unsigned int) sourceLength,
+                (unsigned int) destLength, rv_expected, rv_result);
+        return 1;
+    }
+
+    memset(expected, 0x55, sizeof(expected));
+    memset(result, 0x55, sizeof(result));
+    gcr_test_encode(source, expected, sourceLength, destLength);
+    rv_result = gcr_encode_buffer(source, result, sourceLength, destLength);
+    if ((rv_result != 0) || memcmp(expected, result, sizeof(result)) != 0)
+    {
+        fprintf(stderr, "%s: round %u: encode of %u to %u bytes differs\n",
+                codec, round, (unsigned int) sourceLength,
+                (unsigned int) destLength);
+        return 1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const char *codecs[] = { "table", "reference" };
+    unsigned long seed = 1541;
+    unsigned int rounds = 1000;
+    unsigned int c, round, failed = 0;
+
+    if (argc > 1)
+        seed = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        rounds = (unsigned int) strtoul(argv[2], NULL, 0);
+
+    for (c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++)
+    {
+        if (gcr_select_codec(codecs[c]) == NULL)
+        {
+            fprintf(stderr, "%s: codec not found\n", codecs[c]);
+            failed++;
+            continue;
+        }
+
+        gcr_test_seed = seed;
+        for (round = 0; round < rounds; round++)
+            failed += gcr_test_round(codecs[c], round);
+
+        fprintf(stderr, "%s: %u rounds with seed %lu done.\n",
+                codecs[c], rounds, seed);
+    }
+
+    fprintf(stderr, failed ? "FAILED: %u rounds.\n" : "success.\n", failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif /* #ifdef OPENCBM_STANDALONE_TEST */
@@ -0,0 +1,39 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*! **************************************************************
+** \file lib/internal.h \n
+** \n
+** \brief Shared library / DLL for accessing the driver:
+**        functions shared between the files of the library,
+**        which are not exported
+**
+****************************************************************/
+
+#ifndef LIB_INTERNAL_H
+#define LIB_INTERNAL_H
+
+#include "opencbm.h"
+
+/* detect.c */
+extern void cbm_bus_forget(CBM_FILE HandleDevice);
+
+/* drvcache.c */
+extern void cbm_drive_cache_open(CBM_FILE HandleDevice, const char *Adapter, const char *Port);
+extern void cbm_drive_cache_close(CBM_FILE HandleDevice);
+extern int  cbm_drive_cache_identify(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                                     enum cbm_device_type_e *CbmDeviceType,
+                                     const char **CbmDeviceString);
+extern void cbm_drive_cache_set_type(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                                     enum cbm_device_type_e CbmDeviceType,
+                                     const char *CbmDeviceString);
+extern void cbm_drive_cache_written(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                                    int DriveMemAddress, size_t Size);
+extern void cbm_drive_cache_executed(CBM_FILE HandleDevice, unsigned char DeviceAddress);
+
+#endif // #ifndef LIB_INTERNAL_H
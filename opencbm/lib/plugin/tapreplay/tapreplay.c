@@ -0,0 +1,752 @@
+/*
+ *  tapreplay plugin: a file backed stand-in for the ZoomTape hardware
+ *
+ *      This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file lib/plugin/tapreplay/tapreplay.c \n
+** \n
+** \brief Plugin replaying a recorded CAP file as tape capture data
+**
+** The tape functions behave like a xum1541 with a 1530/1531 attached
+** whose tape is already on <PLAY>: a capture returns the signals of
+** the CAP file given as port ("tapreplay:recorded.cap", or the
+** environment variable OPENCBM_TAPREPLAY_FILE), converted back into
+** the firmware format. Data written to tape is accepted and dropped.
+**
+** This allows measuring and regression testing the tape tools
+** without hardware. There is no IEC bus; all IEC functions fail.
+**
+****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! mark: We are building the DLL */
+#define OPENCBM_PLUGIN
+#include "archlib.h"
+
+#include "tape.h"
+
+/*! The environment variable giving the CAP file if there is no port */
+#define TAPREPLAY_FILE_ENV "OPENCBM_TAPREPLAY_FILE"
+
+/*! Size of the CAP header, and offset of the data start offset in it */
+#define CAP_HEADER_SIZE       0xA0
+#define CAP_HEADER_START_OFS  0x80
+
+/*! Number of CAP signals read from the file at once */
+#define TAPREPLAY_SIGNALS     0x4000
+
+/*! Largest delta the firmware can report (39 bit) */
+#define TAPREPLAY_MAX_DELTA   0x7fffffffffULL
+
+/*! The state of an opened tapreplay "device" */
+typedef struct tapreplay_handle
+{
+    char *filename;              /*!< the CAP file to replay */
+    volatile int abort;          /*!< set by cbm_tap_break() */
+    unsigned char config;        /*!< the last uploaded tape configuration */
+
+    FILE *fd;                    /*!< the CAP file while capturing */
+    unsigned int scale;          /*!< factor from CAP precision to 16 MHz */
+    unsigned char signals[TAPREPLAY_SIGNALS * 5]; /*!< CAP signals read ahead */
+    size_t signals_pos;          /*!< next byte to be used in signals */
+    size_t signals_len;          /*!< valid bytes in signals */
+    unsigned char pending[5];    /*!< converted signal that did not fit */
+    int pending_pos;             /*!< next byte to be returned from pending */
+    int pending_len;             /*!< valid bytes in pending */
+} tapreplay_handle;
+
+
+/*! \internal \brief Open the CAP file and check its header
+
+ \return
+   0 on success, -1 on error (already reported).
+*/
+
+static int
+tapreplay_capture_open(tapreplay_handle *h)
+{
+    unsigned char header[CAP_HEADER_SIZE];
+    unsigned long start_ofs;
+
+    h->fd = fopen(h->filename, "rb");
+    if (h->fd == NULL)
+    {
+        fprintf(stderr, "tapreplay: cannot open '%s'.\n", h->filename);
+        return -1;
+    }
+
+    if (fread(header, sizeof(header), 1, h->fd) != 1
+        || strcmp((char *) &header[0x00], "TAPEIMAGE") != 0
+        || strcmp((char *) &header[0x60], "Relative") != 0
+        || strcmp((char *) &header[0x70], "40bit") != 0)
+    {
+        fprintf(stderr, "tapreplay: '%s' is no supported CAP file.\n", h->filename);
+        fclose(h->fd);
+        h->fd = NULL;
+        return -1;
+    }
+
+    // the firmware counts in 16 MHz, the CAP file might have 1 MHz
+    h->scale = strcmp((char *) &header[0x20], "1us") == 0 ? 16 : 1;
+
+    start_ofs = ((unsigned long) header[CAP_HEADER_START_OFS] << 24)
+              | ((unsigned long) header[CAP_HEADER_START_OFS + 1] << 16)
+              | ((unsigned long) header[CAP_HEADER_START_OFS + 2] << 8)
+              | header[CAP_HEADER_START_OFS + 3];
+
+    if (fseek(h->fd, (long) start_ofs, SEEK_SET) != 0)
+    {
+        fprintf(stderr, "tapreplay: cannot seek to the data of '%s'.\n", h->filename);
+        fclose(h->fd);
+        h->fd = NULL;
+        return -1;
+    }
+
+    h->signals_pos = h->signals_len = 0;
+    h->pending_pos = h->pending_len = 0;
+    h->abort = 0;
+
+    return 0;
+}
+
+/*! \internal \brief Close the CAP file after capturing */
+
+static void
+tapreplay_capture_close(tapreplay_handle *h)
+{
+    if (h->fd != NULL)
+    {
+        fclose(h->fd);
+        h->fd = NULL;
+    }
+}
+
+/*! \internal \brief Convert the next CAP signal into firmware format
+
+ The firmware sends a delta below 0x8000 as 2 bytes, every other as
+ 5 bytes with the highest bit set, both big endian.
+
+ \return
+   1 if a signal was converted into h->pending, 0 at the end of the
+   file, -1 on a read error.
+*/
+
+static int
+tapreplay_next_signal(tapreplay_handle *h)
+{
+    unsigned long long delta;
+    unsigned char *p;
+    size_t numread;
+
+    if (h->signals_len - h->signals_pos < 5)
+    {
+        memmove(h->signals, &h->signals[h->signals_pos], h->signals_len - h->signals_pos);
+        h->signals_len -= h->signals_pos;
+        h->signals_pos = 0;
+
+        numread = fread(&h->signals[h->signals_len], 1, sizeof(h->signals) - h->signals_len, h->fd);
+        if (numread == 0 && ferror(h->fd))
+        {
+            fprintf(stderr, "tapreplay: error reading '%s'.\n", h->filename);
+            return -1;
+        }
+        h->signals_len += numread;
+
+        if (h->signals_len < 5)
+            return 0;
+    }
+
+    p = &h->signals[h->signals_pos];
+    h->signals_pos += 5;
+
+    delta = ((unsigned long long) p[0] << 32) | ((unsigned long long) p[1] << 24)
+          | ((unsigned long long) p[2] << 16) | ((unsigned long long) p[3] << 8) | p[4];
+
+    delta *= h->scale;
+    if (delta > TAPREPLAY_MAX_DELTA)
+        delta = TAPREPLAY_MAX_DELTA;
+
+    h->pending_pos = 0;
+
+    if (delta < 0x8000)
+    {
+        h->pending[0] = (unsigned char) (delta >> 8);
+        h->pending[1] = (unsigned char) delta;
+        h->pending_len = 2;
+    }
+    else
+    {
+        h->pending[0] = (unsigned char) (delta >> 32) | 0x80;
+        h->pending[1] = (unsigned char) (delta >> 24);
+        h->pending[2] = (unsigned char) (delta >> 16);
+        h->pending[3] = (unsigned char) (delta >> 8);
+        h->pending[4] = (unsigned char) delta;
+        h->pending_len = 5;
+    }
+
+    return 1;
+}
+
+/*! \internal \brief Fill a buffer with capture data
+
+ \return
+   The number of bytes written into Buffer, -1 on a read error.
+   Less than Length bytes means that the end of the file is reached.
+*/
+
+static int
+tapreplay_fill(tapreplay_handle *h, unsigned char *Buffer, unsigned int Length)
+{
+    unsigned int filled = 0;
+    int n;
+
+    while (filled < Length)
+    {
+        if (h->pending_pos == h->pending_len)
+        {
+            n = tapreplay_next_signal(h);
+            if (n < 0)
+                return -1;
+            if (n == 0)
+                break;
+        }
+
+        n = h->pending_len - h->pending_pos;
+        if ((unsigned int) n > Length - filled)
+            n = Length - filled;
+
+        memcpy(&Buffer[filled], &h->pending[h->pending_pos], n);
+        h->pending_pos += n;
+        filled += n;
+    }
+
+    return filled;
+}
+
+/*! \internal \brief Return the status of a finished capture */
+
+static int
+tapreplay_capture_status(tapreplay_handle *h)
+{
+    return h->abort ? Tape_Status_ERROR_External_Break : Tape_Status_OK_Capture_Finished;
+}
+
+
+/*-------------------------------------------------------------------*/
+/*--------- OPENCBM ARCH FUNCTIONS ----------------------------------*/
+
+/*! \brief Get the name of the driver
+
+ \param Port
+   The CAP file to replay. If NULL, the file is taken from the
+   environment variable OPENCBM_TAPREPLAY_FILE.
+
+ \return
+   Returns a pointer to a null-terminated string containing the
+   driver name.
+*/
+
+const char * CBMAPIDECL
+opencbm_plugin_get_driver_name(const char * const Port)
+{
+    static char name[256];
+    const char *file = Port ? Port : getenv(TAPREPLAY_FILE_ENV);
+
+    snprintf(name, sizeof(name), "tapreplay (%s)", file ? file : "no file");
+
+    return name;
+}
+
+/*! \brief Opens the driver
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the driver.
+
+ \param Port
+   The CAP file to replay. If NULL, the file is taken from the
+   environment variable OPENCBM_TAPREPLAY_FILE.
+
+ \return
+   ==0: This function completed successfully
+   !=0: otherwise
+*/
+
+int CBMAPIDECL
+opencbm_plugin_driver_open(CBM_FILE *HandleDevice, const char * const Port)
+{
+    const char *file = Port ? Port : getenv(TAPREPLAY_FILE_ENV);
+    tapreplay_handle *h;
+    FILE *fd;
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "tapreplay: no CAP file given, use tapreplay:FILE or " TAPREPLAY_FILE_ENV ".\n");
+        return 1;
+    }
+
+    fd = fopen(file, "rb");
+    if (fd == NULL)
+    {
+        fprintf(stderr, "tapreplay: cannot open '%s'.\n", file);
+        return 1;
+    }
+    fclose(fd);
+
+    h = calloc(1, sizeof(*h));
+    if (h == NULL)
+        return 1;
+
+    h->filename = strdup(file);
+    if (h->filename == NULL)
+    {
+        free(h);
+        return 1;
+    }
+
+    *HandleDevice = (CBM_FILE) h;
+    return 0;
+}
+
+/*! \brief Closes the driver
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+*/
+
+void CBMAPIDECL
+opencbm_plugin_driver_close(CBM_FILE HandleDevice)
+{
+    tapreplay_handle *h = (tapreplay_handle *) HandleDevice;
+
+    tapreplay_capture_close(h);
+    free(h->filename);
+    free(h);
+}
+
+/*
+ * There is no IEC bus behind this plugin. The IEC functions are
+ * mandatory, so they are here, but they fail.
+ */
+
+/*! \brief Write data to the IEC serial bus; fails, there is no IEC bus */
+
+int CBMAPIDECL
+opencbm_plugin_raw_write(CBM_FILE HandleDevice, const void *Buffer, size_t Count)
+{
+    return -1;
+}
+
+/*! \brief Read data from the IEC serial bus; fails, there is no IEC bus */
+
+int CBMAPIDECL
+opencbm_plugin_raw_read(CBM_FILE HandleDevice, void *Buffer, size_t Count)
+{
+    return -1;
+}
+
+/*! \brief Send a LISTEN; fails, there is no IEC bus */
+
+int CBMAPIDECL
+opencbm_plugin_listen(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    return -1;
+}
+
+/*! \brief Send a TALK; fails, there is no IEC bus */
+
+int CBMAPIDECL
+opencbm_plugin_talk(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    return -1;
+}
+
+/*! \brief Open a file on the IEC bus; fails, there is no IEC bus */
+
+int CBMAPIDECL
+opencbm_plugin_open(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    return -1;
+}
+
+/*! \brief Close a file on the IEC bus; fails, there is no IEC bus */
+
+int CBMAPIDECL
+opencbm_plugin_close(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    return -1;
+}
+
+/*! \brief Send an UNLISTEN; fails, there is no IEC bus */
+
+int CBMAPIDECL
+opencbm_plugin_unlisten(CBM_FILE HandleDevice)
+{
+    return -1;
+}
+
+/*! \brief Send an UNTALK; fails, there is no IEC bus */
+
+int CBMAPIDECL
+opencbm_plugin_untalk(CBM_FILE HandleDevice)
+{
+    return -1;
+}
+
+/*! \brief Get EOI flag; there is never an EOI */
+
+int CBMAPIDECL
+opencbm_plugin_get_eoi(CBM_FILE HandleDevice)
+{
+    return 0;
+}
+
+/*! \brief Reset the EOI flag; nothing to do */
+
+int CBMAPIDECL
+opencbm_plugin_clear_eoi(CBM_FILE HandleDevice)
+{
+    return 0;
+}
+
+/*! \brief RESET all devices; fails, there is no IEC bus */
+
+int CBMAPIDECL
+opencbm_plugin_reset(CBM_FILE HandleDevice)
+{
+    return -1;
+}
+
+/*! \brief Read status of all bus lines; all lines are released */
+
+int CBMAPIDECL
+opencbm_plugin_iec_poll(CBM_FILE HandleDevice)
+{
+    return 0;
+}
+
+/*! \brief Activate and deactivate lines; nothing to do */
+
+void CBMAPIDECL
+opencbm_plugin_iec_setrelease(CBM_FILE HandleDevice, int Set, int Release)
+{
+}
+
+/*! \brief Wait for a line to have a specific state; the lines never change */
+
+int CBMAPIDECL
+opencbm_plugin_iec_wait(CBM_FILE HandleDevice, int Line, int State)
+{
+    return 0;
+}
+
+
+/*-------------------------------------------------------------------*/
+/*--------- TAPE FUNCTIONS ------------------------------------------*/
+
+/*! \brief TAPE: Prepare capture
+
+ \return
+   != 0 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_prepare_capture(CBM_FILE HandleDevice, int *Status)
+{
+    *Status = Tape_Status_OK_Device_Configured_for_Read;
+    return 1;
+}
+
+/*! \brief TAPE: Prepare write
+
+ \return
+   != 0 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_prepare_write(CBM_FILE HandleDevice, int *Status)
+{
+    *Status = Tape_Status_OK_Device_Configured_for_Write;
+    return 1;
+}
+
+/*! \brief TAPE: Get tape sense
+
+ The replayed tape always starts out stopped, so the tools do not ask
+ the user to press <STOP> first.
+
+ \return
+   != 0 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_get_sense(CBM_FILE HandleDevice, int *Status)
+{
+    *Status = Tape_Status_OK_Sense_On_Stop;
+    return 1;
+}
+
+/*! \brief TAPE: Wait for <STOP> sense; returns at once
+
+ \return
+   != 0 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_wait_for_stop_sense(CBM_FILE HandleDevice, int *Status)
+{
+    *Status = Tape_Status_OK_Sense_On_Stop;
+    return 1;
+}
+
+/*! \brief TAPE: Wait for <PLAY> sense; returns at once
+
+ \return
+   != 0 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_wait_for_play_sense(CBM_FILE HandleDevice, int *Status)
+{
+    *Status = Tape_Status_OK_Sense_On_Play;
+    return 1;
+}
+
+/*! \brief TAPE: Motor on
+
+ \return
+   != 0 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_motor_on(CBM_FILE HandleDevice, int *Status)
+{
+    *Status = Tape_Status_OK_Motor_On;
+    return 1;
+}
+
+/*! \brief TAPE: Motor off
+
+ \return
+   != 0 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_motor_off(CBM_FILE HandleDevice, int *Status)
+{
+    *Status = Tape_Status_OK_Motor_Off;
+    return 1;
+}
+
+/*! \brief TAPE: Start capture
+
+ Replays the whole CAP file into Buffer. As with the hardware,
+ BytesRead equal to Buffer_Length means the buffer was too small.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Buffer
+   Pointer to a buffer which will hold the capture data.
+
+ \param Buffer_Length
+   The length of the Buffer.
+
+ \param Status
+   The return status.
+
+ \param BytesRead
+   The number of bytes read.
+
+ \return
+   1 on success, -1 on error.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_start_capture(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int Buffer_Length, int *Status, int *BytesRead)
+{
+    tapreplay_handle *h = (tapreplay_handle *) HandleDevice;
+
+    *BytesRead = 0;
+
+    if (tapreplay_capture_open(h) != 0)
+        return -1;
+
+    *BytesRead = tapreplay_fill(h, Buffer, Buffer_Length);
+
+    tapreplay_capture_close(h);
+
+    if (*BytesRead < 0)
+    {
+        *BytesRead = 0;
+        return -1;
+    }
+
+    *Status = tapreplay_capture_status(h);
+    return 1;
+}
+
+/*! \brief TAPE: Start capture, streaming the data to the caller
+
+ Replays the CAP file in chunks, as fast as the caller consumes them.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param GetBuffer
+   Called whenever a new buffer is needed.
+
+ \param PutBuffer
+   Called with every buffer after it has been filled.
+
+ \param Context
+   Given to GetBuffer and PutBuffer.
+
+ \param Status
+   The return status.
+
+ \param BytesRead
+   The number of bytes read.
+
+ \return
+   1 on success, -1 on error.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_start_capture_stream(CBM_FILE HandleDevice, CBM_TAP_STREAM_GET GetBuffer, CBM_TAP_STREAM_PUT PutBuffer, void *Context, int *Status, int *BytesRead)
+{
+    tapreplay_handle *h = (tapreplay_handle *) HandleDevice;
+    unsigned char *buffer;
+    unsigned int length;
+    int filled;
+
+    *BytesRead = 0;
+
+    if (tapreplay_capture_open(h) != 0)
+        return -1;
+
+    do
+    {
+        buffer = GetBuffer(Context, &length);
+        if (buffer == NULL)
+        {
+            tapreplay_capture_close(h);
+            return -1;
+        }
+
+        filled = tapreplay_fill(h, buffer, length);
+        if (filled < 0)
+        {
+            PutBuffer(Context, buffer, 0);
+            tapreplay_capture_close(h);
+            return -1;
+        }
+
+        *BytesRead += filled;
+        PutBuffer(Context, buffer, filled);
+
+    } while ((unsigned int) filled == length && !h->abort);
+
+    tapreplay_capture_close(h);
+
+    *Status = tapreplay_capture_status(h);
+    return 1;
+}
+
+/*! \brief TAPE: Start write
+
+ The data is accepted and dropped.
+
+ \return
+   1 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_start_write(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int Length, int *Status, int *BytesWritten)
+{
+    tapreplay_handle *h = (tapreplay_handle *) HandleDevice;
+
+    *BytesWritten = Length;
+    *Status = h->abort ? Tape_Status_ERROR_External_Break : Tape_Status_OK_Write_Finished;
+    return 1;
+}
+
+/*! \brief TAPE: Return tape firmware version
+
+ \return
+   != 0 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_get_ver(CBM_FILE HandleDevice, int *Status)
+{
+    *Status = TapeFirmwareVersion;
+    return 1;
+}
+
+/*! \brief TAPE: Abort a running capture or write
+
+ \return
+   1 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_break(CBM_FILE HandleDevice)
+{
+    ((tapreplay_handle *) HandleDevice)->abort = 1;
+    return 1;
+}
+
+/*! \brief TAPE: Download configuration
+
+ Returns the configuration uploaded before.
+
+ \return
+   1 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_download_config(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int Buffer_Length, int *Status, int *BytesRead)
+{
+    tapreplay_handle *h = (tapreplay_handle *) HandleDevice;
+
+    *BytesRead = 0;
+    if (Buffer_Length > 0)
+    {
+        Buffer[0] = h->config;
+        *BytesRead = 1;
+    }
+    *Status = Tape_Status_OK_Config_Downloaded;
+    return 1;
+}
+
+/*! \brief TAPE: Upload configuration
+
+ Remembers the configuration for a later download.
+
+ \return
+   1 on success.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_tap_upload_config(CBM_FILE HandleDevice, unsigned char *Buffer, unsigned int Length, int *Status, int *BytesWritten)
+{
+    tapreplay_handle *h = (tapreplay_handle *) HandleDevice;
+
+    *BytesWritten = 0;
+    if (Length > 0)
+    {
+        h->config = Buffer[0];
+        *BytesWritten = 1;
+    }
+    *Status = Tape_Status_OK_Config_Uploaded;
+    return 1;
+}
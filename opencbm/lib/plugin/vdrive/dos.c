@@ -0,0 +1,910 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file lib/plugin/vdrive/dos.c \n
+** \n
+** \brief Virtual drive plugin: disk image and DOS
+**
+** The DOS knows what the drive tools need to talk to a 1541, 1571,
+** 1581, 8050 or 8250: the command channel with M-R, M-W, M-E, U1 to
+** U9, UJ, B-P and I, the status channel, and "#" channels for direct
+** access to the buffers. Files on the disk are not supported.
+**
+** The disk is a .d64, .d71, .d81, .d80 or .d82 image, which is kept
+** in memory and written back when the driver is closed. Its error
+** information, if any, is honoured. The drive is the one the image
+** is made for, unless another one is asked for: a 1571 takes .d64
+** images as well, and a 8250 takes .d80 images.
+**
+****************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vdrive.h"
+
+/*! The zones of the 1541 and the 1571, up to track 42 */
+static const vdrive_zone zones_1541[] = {
+    { 17, 21 }, { 24, 19 }, { 30, 18 }, { 42, 17 }
+};
+
+/*! The single zone of the 1581 */
+static const vdrive_zone zones_1581[] = {
+    { 80, 40 }
+};
+
+/*! The zones of the 8050 and the 8250 */
+static const vdrive_zone zones_8050[] = {
+    { 39, 29 }, { 53, 27 }, { 64, 25 }, { 77, 23 }
+};
+
+/*! The image formats; they all have a different size */
+static const vdrive_format formats[] = {
+    { "d64",  35,  683, 35, zones_1541, 1541 },
+    { "d64",  40,  768, 40, zones_1541, 1541 },
+    { "d64",  42,  802, 42, zones_1541, 1541 },
+    { "d71",  70, 1366, 35, zones_1541, 1571 },
+    { "d81",  80, 3200, 80, zones_1581, 1581 },
+    { "d80",  77, 2083, 77, zones_8050, 8050 },
+    { "d82", 154, 4166, 77, zones_8050, 8250 }
+};
+
+/*! The drives which can be emulated */
+static const vdrive_drive drives[] = {
+    { 1541, "CBM DOS V2.6 1541",          { 0xaa, 0xaa }, 0x0800, 0x1801, 18, 1, 0, zones_1541 },
+    { 1571, "CBM DOS V3.0 1571",          { 0xac, 0x02 }, 0x0800, 0x4001, 18, 2, 0, zones_1541 },
+    { 1581, "COPYRIGHT CBM DOS V10 1581", { 0xba, 0x01 }, 0x2000, 0,      40, 1, 1, zones_1581 },
+    { 8050, "CBM DOS V2.5 8050",          { 0xe9, 0xf2 }, 0x1000, 0,      39, 1, 0, zones_8050 },
+    { 8250, "CBM DOS V2.7 8250",          { 0x11, 0xc6 }, 0x1000, 0,      39, 2, 0, zones_8050 }
+};
+
+/*! The number of revolutions the track cache of the 1581 needs to read a track */
+#define VDRIVE_CACHE_REVOLUTIONS 2
+
+/*! \internal \brief The cylinder of a track
+
+ \return
+   The track on the first side of the disk.
+*/
+
+int
+vdrive_cylinder(vdrive *vd, int track)
+{
+    return track > vd->format->side_tracks ? track - vd->format->side_tracks : track;
+}
+
+/*! \internal \brief The number of sectors of a track
+
+ \return
+   The number of sectors, or -1 if the image does not have the track.
+*/
+
+int
+vdrive_sector_count(vdrive *vd, int track)
+{
+    const vdrive_zone *zone = vd->format->zones;
+
+    if (track < 1 || track > vd->tracks)
+        return -1;
+
+    track = vdrive_cylinder(vd, track);
+    while (track > zone->last_track)
+        zone++;
+    return zone->sectors;
+}
+
+/*! \internal \brief The number of a block in the image
+
+ \return
+   The block number, or -1 if the image does not have the block.
+*/
+
+static int
+vdrive_block(vdrive *vd, int track, int sector)
+{
+    int block = 0;
+    int t;
+
+    if (sector < 0 || sector >= vdrive_sector_count(vd, track))
+        return -1;
+
+    for (t = 1; t < track; t++)
+        block += vdrive_sector_count(vd, t);
+
+    return block + sector;
+}
+
+/*! \internal \brief Load the disk image
+
+ \return
+   0 on success, -1 on error (already reported).
+*/
+
+int
+vdrive_image_open(vdrive *vd, const char *filename)
+{
+    FILE *f;
+    long size;
+    unsigned int i;
+
+    f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "vdrive: cannot open '%s'.\n", filename);
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        if (size == formats[i].blocks * 256L || size == formats[i].blocks * 257L)
+        {
+            vd->format = &formats[i];
+            break;
+        }
+    }
+
+    if (vd->format == NULL)
+    {
+        fprintf(stderr, "vdrive: '%s' is no .d64, .d71, .d81, .d80 or .d82 image.\n", filename);
+        fclose(f);
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(drives) / sizeof(drives[0]); i++)
+    {
+        if (drives[i].model == (vd->model.drive ? vd->model.drive : vd->format->drive))
+            vd->drive = &drives[i];
+    }
+
+    if (vd->drive == NULL
+        || vd->drive->zones != vd->format->zones
+        || (vd->format->tracks > vd->format->side_tracks && vd->drive->sides < 2))
+    {
+        fprintf(stderr, "vdrive: a %d cannot take the .%s image '%s'.\n",
+            vd->model.drive, vd->format->name, filename);
+        fclose(f);
+        return -1;
+    }
+
+    vd->tracks = vd->format->tracks;
+    vd->blocks = vd->format->blocks;
+
+    // only the 1541 and the 1571 have the parallel cable
+    if (vd->drive->pp_port == 0)
+        vd->model.parallel = 0;
+
+    vd->image = malloc(vd->blocks * 256);
+    if (size > vd->blocks * 256L)
+        vd->errors = malloc(vd->blocks);
+
+    if (vd->image == NULL
+        || fread(vd->image, 256, vd->blocks, f) != (size_t) vd->blocks
+        || (vd->errors && fread(vd->errors, 1, vd->blocks, f) != (size_t) vd->blocks))
+    {
+        fprintf(stderr, "vdrive: cannot read '%s'.\n", filename);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    // some tools write 0 instead of 1 for "no error"
+    for (i = 0; vd->errors && i < (unsigned int) vd->blocks; i++)
+    {
+        if (vd->errors[i] == 0)
+            vd->errors[i] = 1;
+    }
+
+    // a disk which cannot be written back is write protected
+    f = fopen(filename, "r+b");
+    if (f == NULL)
+        vd->write_protect = 1;
+    else
+        fclose(f);
+
+    vd->filename = strdup(filename);
+    vd->head = vd->drive->dir_track;
+    return vd->filename ? 0 : -1;
+}
+
+/*! \internal \brief Write the disk image back if it was changed, and free it */
+
+void
+vdrive_image_close(vdrive *vd)
+{
+    FILE *f;
+
+    if (vd->dirty)
+    {
+        f = fopen(vd->filename, "wb");
+        if (f == NULL
+            || fwrite(vd->image, 256, vd->blocks, f) != (size_t) vd->blocks
+            || (vd->errors && fwrite(vd->errors, 1, vd->blocks, f) != (size_t) vd->blocks))
+        {
+            fprintf(stderr, "vdrive: cannot write back '%s'.\n", vd->filename);
+        }
+        if (f != NULL)
+            fclose(f);
+    }
+
+    free(vd->image);
+    free(vd->errors);
+    free(vd->filename);
+}
+
+/*! \internal \brief Move the head
+
+ \param when
+   The time the head starts moving.
+
+ \param track
+   The track to move to.
+
+ \return
+   The time the head is on the track.
+*/
+
+vdrive_time
+vdrive_seek(vdrive *vd, vdrive_time when, int track)
+{
+    int cylinder = vdrive_cylinder(vd, track);
+    int distance = cylinder > vd->head ? cylinder - vd->head : vd->head - cylinder;
+
+    vd->head = cylinder;
+    return when + distance * vd->model.step;
+}
+
+/*! \internal \brief Wait for a sector to come by
+
+ The sectors are evenly spread over the track, and sector 0 of
+ every track starts at the same angle. A drive with a track cache
+ reads the whole track first, and has the sectors at once after that.
+
+ \param when
+   The time the drive starts waiting.
+
+ \return
+   The time the sector starts passing the head.
+*/
+
+vdrive_time
+vdrive_sector_start(vdrive *vd, vdrive_time when, int track, int sector)
+{
+    vdrive_time revolution = vd->model.revolution;
+    vdrive_time phase, start;
+
+    if (vd->drive->track_cache)
+    {
+        if (vd->cached_track == track)
+            return when;
+        vd->cached_track = track;
+        return when + VDRIVE_CACHE_REVOLUTIONS * revolution;
+    }
+
+    // the zero latency model
+    if (revolution == 0)
+        return when;
+
+    phase = when % revolution;
+    start = revolution * sector / vdrive_sector_count(vd, track);
+
+    if (start >= phase)
+        return when + start - phase;
+    return when + revolution - phase + start;
+}
+
+/*! \internal \brief Get the error of a sector, without reading it
+
+ \return
+   The job code: 1 if the sector is fine, the error otherwise.
+*/
+
+int
+vdrive_sector_error(vdrive *vd, int track, int sector)
+{
+    int block = vdrive_block(vd, track, sector);
+
+    if (block < 0)
+        return 2;
+    return vd->errors ? vd->errors[block] : 1;
+}
+
+/*! \internal \brief Get the contents of a sector
+
+ \return
+   The job code: 1 if the sector could be read, the error otherwise.
+*/
+
+int
+vdrive_read_sector(vdrive *vd, int track, int sector, unsigned char *data)
+{
+    int block = vdrive_block(vd, track, sector);
+
+    if (block < 0)
+        return 2;
+
+    vd->stats.SectorsRead++;
+    memcpy(data, vd->image + block * 256, 256);
+    return vd->errors ? vd->errors[block] : 1;
+}
+
+/*! \internal \brief Change the contents of a sector
+
+ \param jobcode
+   The job code a later read of the sector returns; 1 if the data
+   was written correctly.
+
+ \return
+   The job code of the write: 1 on success, 8 if the disk is write
+   protected.
+*/
+
+int
+vdrive_write_sector(vdrive *vd, int track, int sector, const unsigned char *data, int jobcode)
+{
+    int block = vdrive_block(vd, track, sector);
+
+    if (block < 0)
+        return 2;
+    if (vd->write_protect)
+        return 8;
+
+    vd->stats.SectorsWritten++;
+    memcpy(vd->image + block * 256, data, 256);
+
+    if (jobcode != 1 && vd->errors == NULL)
+    {
+        vd->errors = malloc(vd->blocks);
+        if (vd->errors)
+            memset(vd->errors, 1, vd->blocks);
+    }
+    if (vd->errors)
+        vd->errors[block] = (unsigned char) jobcode;
+
+    vd->dirty = 1;
+    return 1;
+}
+
+/*-------------------------------------------------------------------*/
+/*--------- DOS -----------------------------------------------------*/
+
+/*! The bytes of the 1541 ROM the drive tools look at, besides the footprint */
+static const struct {
+    unsigned int address;
+    unsigned char value;
+} rom_bytes_1541[] = {
+    { 0xfed7, 0x24 }, // the first track with 17 sectors is > 35
+    { 0xfffe, 0x67 }, // IRQ vector
+    { 0xffff, 0xfe }
+};
+
+/*! \internal \brief Read a byte of the drive memory */
+
+unsigned char
+vdrive_peek(vdrive *vd, unsigned int address)
+{
+    unsigned int i;
+
+    address &= 0xffff;
+
+    if (address < vd->drive->ram_size)
+        return vd->ram[address];
+
+    if (vd->drive->pp_port != 0 && address == vd->drive->pp_port)
+        return vd->pp_drive_output ? vd->pp_drive : vd->pp_host;
+    if (vd->drive->pp_port != 0 && address == vd->drive->pp_port + 2)
+        return vd->pp_drive_output ? 0xff : 0x00;
+
+    if (address == 0xff40 || address == 0xff41)
+        return vd->drive->footprint[address - 0xff40];
+
+    for (i = 0; vd->drive->model == 1541 && i < sizeof(rom_bytes_1541) / sizeof(rom_bytes_1541[0]); i++)
+    {
+        if (rom_bytes_1541[i].address == address)
+            return rom_bytes_1541[i].value;
+    }
+    return 0;
+}
+
+/*! \internal \brief Write a byte of the drive memory */
+
+void
+vdrive_poke(vdrive *vd, unsigned int address, unsigned char value)
+{
+    address &= 0xffff;
+
+    if (address < vd->drive->ram_size)
+        vd->ram[address] = value;
+    else if (address == vd->drive->pp_port && vd->model.parallel)
+        vd->pp_drive = value;
+    else if (address == vd->drive->pp_port + 2 && vd->model.parallel)
+        vd->pp_drive_output = value != 0;
+}
+
+/*! \internal \brief Set the status the command channel reports */
+
+static void
+vdrive_status(vdrive *vd, int code, int track, int sector)
+{
+    const char *text;
+
+    switch (code)
+    {
+    case  0: text = " OK"; break;
+    case 20: case 21: case 22: case 23: case 24: case 27:
+             text = "READ ERROR"; break;
+    case 25: text = "WRITE ERROR"; break;
+    case 26: text = "WRITE PROTECT ON"; break;
+    case 29: text = "DISK ID MISMATCH"; break;
+    case 30: case 31: case 32: case 33: case 34:
+             text = "SYNTAX ERROR"; break;
+    case 62: text = "FILE NOT FOUND"; break;
+    case 66: text = "ILLEGAL TRACK OR SECTOR"; break;
+    case 70: text = "NO CHANNEL"; break;
+    case 73: text = vd->drive->dos; break;
+    case 74: text = "DRIVE NOT READY"; break;
+    default: text = "UNKNOWN ERROR"; break;
+    }
+
+    vd->reply_len = sprintf((char *) vd->reply, "%02d,%s,%02d,%02d\r", code, text, track, sector);
+    vd->reply_pos = 0;
+}
+
+/*! \internal \brief Set the status after a job
+
+ \param jobcode
+   The job code, 1 for success.
+*/
+
+static void
+vdrive_job_status(vdrive *vd, int jobcode, int track, int sector)
+{
+    if (jobcode == 1)
+        vdrive_status(vd, 0, 0, 0);
+    else if (jobcode == 15)
+        vdrive_status(vd, 74, track, sector);
+    else
+        vdrive_status(vd, jobcode + 18, track, sector);
+}
+
+/*! \internal \brief Close all data channels */
+
+static void
+vdrive_close_all(vdrive *vd)
+{
+    int i;
+
+    for (i = 0; i < 15; i++)
+        vd->channel[i].buffer = -1;
+    for (i = 0; i < VDRIVE_BUFFERS; i++)
+        vd->buffer_used[i] = 0;
+}
+
+/*! \internal \brief Reset the DOS
+
+ \param vd
+   The drive.
+
+ The RAM is cleared, as by the RESET line or UJ. The transfer
+ programs in the drive are stopped.
+*/
+
+void
+vdrive_dos_reset(vdrive *vd)
+{
+    memset(vd->ram, 0, sizeof(vd->ram));
+    memset(&vd->session, 0, sizeof(vd->session));
+    vd->port = 0;
+    vd->pp_drive_output = 0;
+    vd->listening = vd->talking = -1;
+    vd->opening = 0;
+    vd->cmd_len = 0;
+    vd->dos_ready = vd->now;
+    vd->cached_track = 0;
+    vdrive_close_all(vd);
+    vdrive_status(vd, 73, 0, 0);
+}
+
+/*! \internal \brief Parse the numeric parameters of a command
+
+ \param p
+   The text after the command.
+
+ \param value
+   Will contain the parameters.
+
+ \param count
+   The number of parameters expected.
+
+ \return
+   The number of parameters found.
+*/
+
+static int
+vdrive_params(const char *p, int *value, int count)
+{
+    int n;
+
+    for (n = 0; n < count; n++)
+    {
+        while (*p == ' ' || *p == ',' || *p == ':' || *p == 0x1d)
+            p++;
+        if (!isdigit((unsigned char) *p))
+            break;
+        value[n] = (int) strtol(p, (char **) &p, 10);
+    }
+    return n;
+}
+
+/*! \internal \brief Execute a U1 or U2 command
+
+ \param write
+   0 for U1 (read a block into the buffer), 1 for U2 (write the buffer).
+*/
+
+static void
+vdrive_block_command(vdrive *vd, const char *params, int write)
+{
+    int p[4];
+    int jobcode;
+    unsigned char *buffer;
+    vdrive_time when;
+
+    if (vdrive_params(params, p, 4) != 4)
+    {
+        vdrive_status(vd, 30, 0, 0);
+        return;
+    }
+    if (p[0] < 0 || p[0] >= 15 || vd->channel[p[0]].buffer < 0)
+    {
+        vdrive_status(vd, 70, 0, 0);
+        return;
+    }
+    if (p[3] < 0 || p[3] >= vdrive_sector_count(vd, p[2]))
+    {
+        vdrive_status(vd, 66, p[2], p[3]);
+        return;
+    }
+
+    buffer = &vd->ram[0x300 + 0x100 * vd->channel[p[0]].buffer];
+
+    when = vdrive_seek(vd, vd->dos_ready > vd->now ? vd->dos_ready : vd->now, p[2]);
+    when = vdrive_sector_start(vd, when, p[2], p[3])
+         + vd->model.revolution / vdrive_sector_count(vd, p[2]);
+
+    if (write)
+        jobcode = vdrive_write_sector(vd, p[2], p[3], buffer, 1);
+    else
+        jobcode = vdrive_read_sector(vd, p[2], p[3], buffer);
+
+    // a missing sector is searched for a while
+    if (jobcode == 2 || jobcode == 3)
+        when += vd->model.revolution;
+
+    vd->dos_ready = when;
+    vd->channel[p[0]].pos = 0;
+    vdrive_job_status(vd, jobcode, p[2], p[3]);
+}
+
+/*! \internal \brief Execute a command sent to the command channel */
+
+static void
+vdrive_command(vdrive *vd, const unsigned char *cmd, unsigned int len)
+{
+    unsigned int address;
+    unsigned int i, n;
+    char text[sizeof(vd->cmd) + 1];
+    int p[2];
+
+    vd->stats.Commands++;
+
+    if (len > 0 && cmd[len - 1] == '\r')
+        len--;
+
+    memcpy(text, cmd, len);
+    text[len] = 0;
+
+    vdrive_status(vd, 0, 0, 0);
+
+    if (len >= 5 && cmd[0] == 'M' && cmd[1] == '-')
+    {
+        address = cmd[3] | (cmd[4] << 8);
+
+        switch (cmd[2])
+        {
+        case 'W':
+            n = len > 5 ? cmd[5] : 0;
+            for (i = 0; i < n && 6 + i < len; i++)
+                vdrive_poke(vd, address + i, cmd[6 + i]);
+            return;
+
+        case 'R':
+            n = len > 5 ? cmd[5] : 1;
+            if (n == 0)
+                n = 0x100;
+            for (i = 0; i < n; i++)
+                vd->reply[i] = vdrive_peek(vd, address + i);
+            vd->reply[n] = '\r';
+            vd->reply_len = n + 1;
+            vd->reply_pos = 0;
+            return;
+
+        case 'E':
+            vdrive_exec(vd, address);
+            return;
+        }
+    }
+    else if (len >= 2 && cmd[0] == 'U')
+    {
+        switch (toupper(cmd[1]))
+        {
+        case '1': case 'A':
+            vdrive_block_command(vd, text + 2, 0);
+            return;
+
+        case '2': case 'B':
+            vdrive_block_command(vd, text + 2, 1);
+            return;
+
+        case '3': case '4': case '5': case '6': case '7': case '8':
+            vdrive_exec(vd, 0x500 + 3 * (cmd[1] - '3'));
+            return;
+
+        case 'C': case 'D': case 'E': case 'F': case 'G': case 'H':
+            vdrive_exec(vd, 0x500 + 3 * (toupper(cmd[1]) - 'C'));
+            return;
+
+        case '9': case 'I':
+            vdrive_close_all(vd);
+            vdrive_status(vd, 73, 0, 0);
+            return;
+
+        case ':': case 'J':
+            vdrive_dos_reset(vd);
+            return;
+
+        case '0':
+            // the 1570/1571 mode switches are accepted and ignored
+            return;
+        }
+    }
+    else if (len >= 3 && cmd[0] == 'B' && cmd[1] == '-')
+    {
+        switch (cmd[2])
+        {
+        case 'P':
+            if (vdrive_params(text + 3, p, 2) != 2)
+                break;
+            if (p[0] < 0 || p[0] >= 15 || vd->channel[p[0]].buffer < 0)
+                vdrive_status(vd, 70, 0, 0);
+            else
+                vd->channel[p[0]].pos = p[1] & 0xff;
+            return;
+
+        case 'A':
+        case 'F':
+            // there is no BAM handling
+            return;
+        }
+    }
+    else if (len >= 1 && cmd[0] == 'I')
+    {
+        p[0] = vd->drive->dir_track;
+        vd->dos_ready = vdrive_sector_start(vd, vdrive_seek(vd, vd->now, p[0]), p[0], 0)
+                      + vd->model.revolution / vdrive_sector_count(vd, p[0]);
+        return;
+    }
+
+    vdrive_status(vd, 31, 0, 0);
+}
+
+/*! \internal \brief Open a channel
+
+ \param channel
+   The secondary address.
+
+ \param name
+   The name given with the OPEN.
+*/
+
+static void
+vdrive_open(vdrive *vd, int channel, const unsigned char *name, unsigned int len)
+{
+    int buffer;
+
+    if (channel == 15)
+    {
+        if (len > 0)
+            vdrive_command(vd, name, len);
+        return;
+    }
+
+    if (len == 0 || name[0] != '#')
+    {
+        vdrive_status(vd, 62, 0, 0);
+        return;
+    }
+
+    vdrive_dos_close(vd, channel);
+
+    if (len > 1 && isdigit(name[1]))
+    {
+        buffer = name[1] - '0';
+        if (buffer >= VDRIVE_BUFFERS || vd->buffer_used[buffer])
+            buffer = -1;
+    }
+    else
+    {
+        // take the highest free buffer
+        for (buffer = VDRIVE_BUFFERS - 1; buffer >= 0; buffer--)
+        {
+            if (!vd->buffer_used[buffer])
+                break;
+        }
+    }
+
+    if (buffer < 0)
+    {
+        vdrive_status(vd, 70, 0, 0);
+        return;
+    }
+
+    vd->buffer_used[buffer] = 1;
+    vd->channel[channel].buffer = buffer;
+    vd->channel[channel].pos = 0;
+    vdrive_status(vd, 0, 0, 0);
+}
+
+/*! \internal \brief Close a channel
+
+ Closing the command channel closes all channels.
+*/
+
+void
+vdrive_dos_close(vdrive *vd, int channel)
+{
+    if (channel == 15)
+    {
+        vdrive_close_all(vd);
+    }
+    else if (vd->channel[channel].buffer >= 0)
+    {
+        vd->buffer_used[vd->channel[channel].buffer] = 0;
+        vd->channel[channel].buffer = -1;
+    }
+}
+
+/*! \internal \brief The host sent LISTEN
+
+ \param channel
+   The secondary address.
+
+ \param opening
+   The data is the name for an OPEN.
+*/
+
+void
+vdrive_dos_listen(vdrive *vd, int channel, int opening)
+{
+    vd->listening = channel;
+    vd->opening = opening;
+    vd->cmd_len = 0;
+}
+
+/*! \internal \brief The host sends data to the listening drive
+
+ \return
+   The number of bytes taken, -1 if the drive does not listen.
+*/
+
+int
+vdrive_dos_write(vdrive *vd, const unsigned char *data, size_t count)
+{
+    vdrive_channel *ch;
+    size_t i;
+
+    if (vd->listening < 0)
+        return -1;
+
+    if (vd->opening || vd->listening == 15)
+    {
+        for (i = 0; i < count && vd->cmd_len < sizeof(vd->cmd); i++)
+            vd->cmd[vd->cmd_len++] = data[i];
+        return (int) count;
+    }
+
+    ch = &vd->channel[vd->listening];
+    if (ch->buffer >= 0)
+    {
+        for (i = 0; i < count; i++)
+        {
+            vd->ram[0x300 + 0x100 * ch->buffer + ch->pos] = data[i];
+            ch->pos = (ch->pos + 1) & 0xff;
+        }
+    }
+    return (int) count;
+}
+
+/*! \internal \brief The host sent UNLISTEN; execute what was sent */
+
+void
+vdrive_dos_unlisten(vdrive *vd)
+{
+    if (vd->opening)
+        vdrive_open(vd, vd->listening, vd->cmd, vd->cmd_len);
+    else if (vd->listening == 15 && vd->cmd_len > 0)
+        vdrive_command(vd, vd->cmd, vd->cmd_len);
+
+    vd->listening = -1;
+    vd->opening = 0;
+    vd->cmd_len = 0;
+}
+
+/*! \internal \brief The host sent TALK
+
+ \param channel
+   The secondary address.
+*/
+
+void
+vdrive_dos_talk(vdrive *vd, int channel)
+{
+    vd->talking = channel;
+}
+
+/*! \internal \brief The host reads data from the talking drive
+
+ The last byte of the data is sent with EOI.
+
+ \return
+   The number of bytes read, -1 if the drive does not talk.
+*/
+
+int
+vdrive_dos_read(vdrive *vd, unsigned char *data, size_t count)
+{
+    vdrive_channel *ch;
+    size_t i;
+
+    if (vd->talking < 0)
+        return -1;
+
+    vd->eoi = 0;
+
+    if (vd->talking == 15)
+    {
+        for (i = 0; i < count && !vd->eoi; i++)
+        {
+            data[i] = vd->reply[vd->reply_pos++];
+            if (vd->reply_pos >= vd->reply_len)
+            {
+                vd->eoi = 1;
+                vdrive_status(vd, 0, 0, 0);
+            }
+        }
+        return (int) i;
+    }
+
+    ch = &vd->channel[vd->talking];
+    if (ch->buffer < 0)
+        return 0;
+
+    for (i = 0; i < count && !vd->eoi; i++)
+    {
+        data[i] = vd->ram[0x300 + 0x100 * ch->buffer + ch->pos];
+        vd->eoi = ch->pos == 0xff;
+        ch->pos = (ch->pos + 1) & 0xff;
+    }
+    return (int) i;
+}
@@ -0,0 +1,1502 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file lib/plugin/vdrive/drivecode.c \n
+** \n
+** \brief Virtual drive plugin: programs running in the drive
+**
+** There is no 6502 emulation. Instead, the programs the tools upload
+** are recognised by comparing the drive RAM with the known ones when
+** they are started, and their effect is computed directly:
+**
+** - the checksum routine of the drive code cache (lib/drvcache.a65)
+** - the block checksums of libd64copy (checksum1541.a65)
+** - the turbo and warp programs of libd64copy and libimgcopy for the
+**   1541, 1571 and 1581, together with the serial-1, serial-2 and
+**   parallel transfer routines. The programs for the different drives
+**   use the same protocols, so they are emulated the same way. The
+**   burst transfer (serial-3) of the 1581 is not emulated.
+** - the main loop of libtrans with its serial-1, serial-2 and parallel
+**   transfer routines, installed at $0500 and $0700, or as the bootstrap
+**   loader at $0400 and $0300. Its routines for sending differ from the
+**   ones of libd64copy in the handshake.
+**
+** The transfer routines follow the line changes of the host exactly
+** as the 6502 code does, so the host can use the single IEC line
+** functions as well as the *_read_n() and *_write_n() functions.
+**
+****************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vdrive.h"
+
+static const unsigned char turboread1541[] = {
+#include "turboread1541.inc"
+};
+
+static const unsigned char turbowrite1541[] = {
+#include "turbowrite1541.inc"
+};
+
+static const unsigned char warpread1541[] = {
+#include "warpread1541.inc"
+};
+
+static const unsigned char warpwrite1541[] = {
+#include "warpwrite1541.inc"
+};
+
+static const unsigned char turboread1571[] = {
+#include "turboread1571.inc"
+};
+
+static const unsigned char turbowrite1571[] = {
+#include "turbowrite1571.inc"
+};
+
+static const unsigned char warpread1571[] = {
+#include "warpread1571.inc"
+};
+
+static const unsigned char warpwrite1571[] = {
+#include "warpwrite1571.inc"
+};
+
+static const unsigned char turboread1581[] = {
+#include "turboread1581.inc"
+};
+
+static const unsigned char turbowrite1581[] = {
+#include "turbowrite1581.inc"
+};
+
+static const unsigned char s1_drive_prog[] = {
+#include "s1.inc"
+};
+
+static const unsigned char s2_drive_prog[] = {
+#include "s2.inc"
+};
+
+static const unsigned char s1_1581_drive_prog[] = {
+#include "s1-1581.inc"
+};
+
+static const unsigned char s2_1581_drive_prog[] = {
+#include "s2-1581.inc"
+};
+
+static const unsigned char pp1541_drive_prog[] = {
+#include "pp1541.inc"
+};
+
+static const unsigned char pp1571_drive_prog[] = {
+#include "pp1571.inc"
+};
+
+static const unsigned char checksum1541[] = {
+#include "checksum1541.inc"
+};
+
+static const unsigned char drvcache_prog[] = {
+#include "drvcache.inc"
+};
+
+static const unsigned char libtrans_main_prog[] = {
+#include "libtrans/turbomain.inc"
+};
+
+static const unsigned char libtrans_boot_main_prog[] = {
+#include "libtrans/turboboot.inc"
+};
+
+static const unsigned char libtrans_s1_prog[] = {
+#include "libtrans/s1.inc"
+};
+
+static const unsigned char libtrans_s2_prog[] = {
+#include "libtrans/s2.inc"
+};
+
+static const unsigned char libtrans_pp1541_prog[] = {
+#include "libtrans/pp1541.inc"
+};
+
+static const unsigned char libtrans_pp1571_prog[] = {
+#include "libtrans/pp1571.inc"
+};
+
+static const unsigned char libtrans_s1_boot_prog[] = {
+#include "libtrans/s1boot.inc"
+};
+
+static const unsigned char libtrans_s2_boot_prog[] = {
+#include "libtrans/s2boot.inc"
+};
+
+static const unsigned char libtrans_pp1541_boot_prog[] = {
+#include "libtrans/pp1541boot.inc"
+};
+
+static const unsigned char libtrans_pp1571_boot_prog[] = {
+#include "libtrans/pp1571boot.inc"
+};
+
+/*! The main programs at $0500 */
+static const struct {
+    const unsigned char *code;
+    size_t size;
+    enum vdrive_prog prog;
+} main_programs[] = {
+    { turboread1541,  sizeof(turboread1541),  vdrive_prog_turboread },
+    { turbowrite1541, sizeof(turbowrite1541), vdrive_prog_turbowrite },
+    { warpread1541,   sizeof(warpread1541),   vdrive_prog_warpread },
+    { warpwrite1541,  sizeof(warpwrite1541),  vdrive_prog_warpwrite },
+    { turboread1571,  sizeof(turboread1571),  vdrive_prog_turboread },
+    { turbowrite1571, sizeof(turbowrite1571), vdrive_prog_turbowrite },
+    { warpread1571,   sizeof(warpread1571),   vdrive_prog_warpread },
+    { warpwrite1571,  sizeof(warpwrite1571),  vdrive_prog_warpwrite },
+    { turboread1581,  sizeof(turboread1581),  vdrive_prog_turboread },
+    { turbowrite1581, sizeof(turbowrite1581), vdrive_prog_turbowrite }
+};
+
+/*! The transfer routines at $0700 */
+static const struct {
+    const unsigned char *code;
+    size_t size;
+    enum vdrive_proto proto;
+} transfer_programs[] = {
+    { s1_drive_prog,      sizeof(s1_drive_prog),      vdrive_proto_s1 },
+    { s2_drive_prog,      sizeof(s2_drive_prog),      vdrive_proto_s2 },
+    { s1_1581_drive_prog, sizeof(s1_1581_drive_prog), vdrive_proto_s1 },
+    { s2_1581_drive_prog, sizeof(s2_1581_drive_prog), vdrive_proto_s2 },
+    { pp1541_drive_prog,  sizeof(pp1541_drive_prog),  vdrive_proto_pp },
+    { pp1571_drive_prog,  sizeof(pp1571_drive_prog),  vdrive_proto_pp }
+};
+
+/*! The main loop of libtrans, and where its transfer routines are */
+static const struct {
+    const unsigned char *code;
+    size_t size;
+    unsigned int address;
+    unsigned int transfer;
+} libtrans_main_programs[] = {
+    { libtrans_main_prog,      sizeof(libtrans_main_prog),      0x0500, 0x0700 },
+    { libtrans_boot_main_prog, sizeof(libtrans_boot_main_prog), 0x0400, 0x0300 }
+};
+
+/*! The transfer routines of libtrans */
+static const struct {
+    const unsigned char *code;
+    size_t size;
+    unsigned int address;
+    enum vdrive_proto proto;
+} libtrans_transfer_programs[] = {
+    { libtrans_s1_prog,          sizeof(libtrans_s1_prog),          0x0700, vdrive_proto_s1 },
+    { libtrans_s2_prog,          sizeof(libtrans_s2_prog),          0x0700, vdrive_proto_s2 },
+    { libtrans_pp1541_prog,      sizeof(libtrans_pp1541_prog),      0x0700, vdrive_proto_pp },
+    { libtrans_pp1571_prog,      sizeof(libtrans_pp1571_prog),      0x0700, vdrive_proto_pp },
+    { libtrans_s1_boot_prog,     sizeof(libtrans_s1_boot_prog),     0x0300, vdrive_proto_s1 },
+    { libtrans_s2_boot_prog,     sizeof(libtrans_s2_boot_prog),     0x0300, vdrive_proto_s2 },
+    { libtrans_pp1541_boot_prog, sizeof(libtrans_pp1541_boot_prog), 0x0300, vdrive_proto_pp },
+    { libtrans_pp1571_boot_prog, sizeof(libtrans_pp1571_boot_prog), 0x0300, vdrive_proto_pp }
+};
+
+/* the states of the main programs */
+enum {
+    ST_TS,          /*!< waiting for track and sector (or count) */
+    ST_DATA,        /*!< waiting for the data to write */
+    ST_MAP,         /*!< warp read: waiting for the track map */
+    ST_SECTORS,     /*!< warp read: sending the sectors of the track */
+    ST_LT_CMD,      /*!< libtrans: waiting for a command */
+    ST_LT_ADDRESS,  /*!< libtrans: waiting for the address of the page */
+    ST_LT_OFFSET,   /*!< libtrans: waiting for the first byte of the page */
+    ST_LT_DATA,     /*!< libtrans: waiting for the data to write */
+    ST_LT_EXECUTE   /*!< libtrans: waiting for the address to jump to */
+};
+
+/* the commands of the main loop of libtrans, see libtrans/turbomain.a65 */
+#define LT_CMD_WRITEMEM 0x00
+#define LT_CMD_READMEM  0x01
+#define LT_CMD_RETURN   0x02
+#define LT_CMD_EXECUTE  0x80
+
+/*! libtrans: the DOS entry the host jumps to when it removes the routines */
+#define LT_DOS_IDLE     0xebe7
+
+/* the states of the transfer routines, named after the labels in the .a65 files */
+enum {
+    LS_IDLE,        /*!< between two bytes */
+    LS_S1_READ1, LS_S1_READ2, LS_S1_READ3,
+    LS_S1_WRITE0, LS_S1_WRITE1, LS_S1_WRITE3, LS_S1_WRITE4,
+    LS_S2_INIT_CLK, LS_S2_INIT_ATN,
+    LS_S2_READ0, LS_S2_READ1,
+    LS_S2_WRITE1, LS_S2_WRITE2,
+    LS_LT_S2_WRITE1, LS_LT_S2_WRITE2, LS_LT_S2_WRITE3, LS_LT_S2_WRITE4,
+    LS_PP_INIT,
+    LS_PP_GET1, LS_PP_GET2,
+    LS_PP_SEND1, LS_PP_SEND2,
+    LS_LT_RETURN,   /*!< libtrans: the main loop waits for ATN to be released */
+    LS_LT_RETURN_CLK /*!< libtrans: the main loop waits for CLOCK to be released */
+};
+
+/*! The number of revolutions the DOS spends on retries after an error */
+#define VDRIVE_RETRIES         5
+
+/*! The number of headers the warp read program waits for a sector */
+#define VDRIVE_WARP_HEADERS    90
+
+/*! Drive cycles per byte of the checksum routine of the drive code cache */
+#define VDRIVE_DRVCACHE_CYCLES 50
+
+/*! Drive cycles per byte of the block checksum routine */
+#define VDRIVE_CHECKSUM_CYCLES 42
+
+/*! \internal \brief Check if a program is in the drive RAM */
+
+static int
+vdrive_ram_has(vdrive *vd, unsigned int address, const unsigned char *code, size_t size)
+{
+    return address + size <= vd->drive->ram_size
+        && memcmp(&vd->ram[address], code, size) == 0;
+}
+
+/*! \internal \brief The time a sector needs to pass the head */
+
+static vdrive_time
+vdrive_sector_time(vdrive *vd, int track)
+{
+    int sectors = vdrive_sector_count(vd, track);
+
+    return vd->model.revolution / (sectors > 0 ? sectors : 1);
+}
+
+/*-------------------------------------------------------------------*/
+/*--------- CHECKSUMS -----------------------------------------------*/
+
+/*! \internal \brief Run the checksum routine of the drive code cache
+
+ See lib/drvcache.a65.
+*/
+
+static void
+vdrive_checksum_drvcache(vdrive *vd)
+{
+    unsigned int adr = vd->ram[0x300] | (vd->ram[0x301] << 8);
+    unsigned int cnt = vd->ram[0x302] | (vd->ram[0x303] << 8);
+    unsigned int s1  = vd->ram[0x304] | (vd->ram[0x305] << 8);
+    unsigned int s2  = vd->ram[0x306] | (vd->ram[0x307] << 8);
+    vdrive_time when = vd->dos_ready > vd->now ? vd->dos_ready : vd->now;
+
+    do
+    {
+        s1 = (s1 + vdrive_peek(vd, adr)) & 0xffff;
+        s2 = (s2 + s1) & 0xffff;
+        adr = (adr + 1) & 0xffff;
+        cnt = (cnt - 1) & 0xffff;
+        when += VDRIVE_DRVCACHE_CYCLES * vd->model.cycle;
+    } while (cnt != 0);
+
+    vd->ram[0x302] = vd->ram[0x303] = 0;
+    vd->ram[0x304] = (unsigned char) s1;
+    vd->ram[0x305] = (unsigned char) (s1 >> 8);
+    vd->ram[0x306] = (unsigned char) s2;
+    vd->ram[0x307] = (unsigned char) (s2 >> 8);
+
+    vd->dos_ready = when;
+}
+
+/*! \internal \brief Run the block checksum routine of libd64copy
+
+ See libd64copy/checksum1541.a65. The sectors are read into buffer 1
+ at $0400 with the job queue.
+*/
+
+static void
+vdrive_checksum_blocks(vdrive *vd)
+{
+    unsigned char *res = &vd->ram[0x580];
+    unsigned char *buf = &vd->ram[0x400];
+    int track = vd->ram[0x5f0];
+    unsigned int nend = vd->ram[0x5f1];
+    unsigned int y = 0;
+    unsigned char s1, s3;
+    unsigned int s2;
+    int jobcode, i;
+    vdrive_time when;
+
+    when = vdrive_seek(vd, vd->dos_ready > vd->now ? vd->dos_ready : vd->now, track);
+
+    do
+    {
+        jobcode = vdrive_read_sector(vd, track, res[y], buf);
+
+        if (jobcode == 2 || jobcode == 3 || vdrive_sector_count(vd, track) < 0)
+            when += vd->model.revolution;
+        else
+            when = vdrive_sector_start(vd, when, track, res[y]) + vdrive_sector_time(vd, track);
+
+        s1 = s3 = 0;
+        s2 = 0;
+        for (i = 0; i < 0x100; i++)
+        {
+            s1 = (unsigned char) (s1 + buf[i]);
+            s2 = (s2 + s1) & 0xffff;
+            s3 = (unsigned char) (((s3 << 1) | (s3 >> 7)) ^ buf[i]);
+        }
+        when += 0x100 * VDRIVE_CHECKSUM_CYCLES * vd->model.cycle;
+
+        res[y++] = (unsigned char) jobcode;
+        res[y++] = s1;
+        res[y++] = (unsigned char) s2;
+        res[y++] = (unsigned char) (s2 >> 8);
+        res[y++] = s3;
+
+    } while (y < nend && y <= 0x70 - 5);
+
+    vd->dos_ready = when;
+}
+
+/*-------------------------------------------------------------------*/
+/*--------- GCR -----------------------------------------------------*/
+
+/*! The GCR code of each nibble */
+static const unsigned char gcr_code[16] = {
+    0x0a, 0x0b, 0x12, 0x13, 0x0e, 0x0f, 0x16, 0x17,
+    0x09, 0x19, 0x1a, 0x1b, 0x0d, 0x1d, 0x1e, 0x15
+};
+
+/*! \internal \brief GCR encode a data block
+
+ The result is what the warp programs transfer: the data block mark,
+ the data, the checksum and two zero bytes, 325 bytes in all.
+
+ \param jobcode
+   4 to damage the data block mark, 5 to damage the checksum, so
+   the host sees the error of the sector.
+*/
+
+void
+vdrive_gcr_encode(const unsigned char *block, unsigned char *gcr, int jobcode)
+{
+    unsigned char plain[0x104];
+    unsigned char chksum = 0;
+    unsigned long long bits;
+    int i, j;
+
+    for (i = 0; i < 0x100; i++)
+        chksum ^= block[i];
+
+    plain[0] = jobcode == 4 ? 0x00 : 0x07;
+    memcpy(plain + 1, block, 0x100);
+    plain[0x101] = jobcode == 5 ? (unsigned char) ~chksum : chksum;
+    plain[0x102] = plain[0x103] = 0;
+
+    for (i = 0; i < (int) sizeof(plain); i += 4)
+    {
+        bits = 0;
+        for (j = 0; j < 4; j++)
+        {
+            bits = (bits << 10)
+                 | (gcr_code[plain[i + j] >> 4] << 5)
+                 | gcr_code[plain[i + j] & 0x0f];
+        }
+        for (j = 4; j >= 0; j--)
+        {
+            *gcr++ = (unsigned char) (bits >> (8 * j));
+        }
+    }
+}
+
+/*! \internal \brief Decode a GCR encoded data block
+
+ \return
+   The job code: 1 if the block is fine, 4 if there is no data block
+   mark, 5 on a checksum error, 6 if the GCR code is invalid.
+*/
+
+int
+vdrive_gcr_decode(const unsigned char *gcr, unsigned char *block)
+{
+    unsigned char plain[0x104];
+    unsigned char chksum = 0;
+    unsigned long long bits;
+    int i, j, k, code, nibble;
+    int valid = 1;
+
+    for (i = 0; i < (int) sizeof(plain); i += 4)
+    {
+        bits = 0;
+        for (j = 0; j < 5; j++)
+            bits = (bits << 8) | *gcr++;
+
+        for (j = 0; j < 8; j++)
+        {
+            code = (int) (bits >> (35 - 5 * j)) & 0x1f;
+            for (nibble = 0; nibble < 16 && gcr_code[nibble] != code; nibble++)
+                ;
+            if (nibble == 16)
+            {
+                valid = 0;
+                nibble = 0;
+            }
+            k = i + j / 2;
+            plain[k] = (unsigned char) ((j & 1) ? (plain[k] | nibble) : (nibble << 4));
+        }
+    }
+
+    memcpy(block, plain + 1, 0x100);
+    for (i = 0; i < 0x100; i++)
+        chksum ^= block[i];
+
+    if (!valid)
+        return 6;
+    if (plain[0] != 0x07)
+        return 4;
+    return plain[0x101] == chksum ? 1 : 5;
+}
+
+/*-------------------------------------------------------------------*/
+/*--------- MAIN PROGRAMS -------------------------------------------*/
+
+/*! \internal \brief The number of bytes the transfer routine moves for one get_byte/send_byte */
+
+static unsigned int
+vdrive_byte_size(vdrive_session *s)
+{
+    return s->proto == vdrive_proto_pp ? 2 : 1;
+}
+
+/*! \internal \brief Send a byte with send_byte
+
+ The parallel routine sends the byte twice.
+*/
+
+static void
+vdrive_put_byte(vdrive_session *s, unsigned char byte)
+{
+    s->out[s->out_len++] = byte;
+    if (s->proto == vdrive_proto_pp)
+        s->out[s->out_len++] = byte;
+}
+
+/*! \internal \brief Send bytes with send_block */
+
+static void
+vdrive_put_block(vdrive_session *s, const unsigned char *data, unsigned int size)
+{
+    memcpy(&s->out[s->out_len], data, size);
+    s->out_len += size;
+}
+
+/*! \internal \brief Wait for track and sector again */
+
+static void
+vdrive_expect_ts(vdrive_session *s)
+{
+    s->state = ST_TS;
+    s->in_len = 0;
+    s->in_need = 2;
+}
+
+/*! \internal \brief A main program got track 0: back to the DOS */
+
+static void
+vdrive_session_end(vdrive *vd)
+{
+    vd->session.proto = vdrive_proto_none;
+    vd->port = 0;
+    vd->pp_drive_output = 0;
+    if (vd->dos_ready < vd->now)
+        vd->dos_ready = vd->now;
+}
+
+/*! \internal \brief Turbo read: read a sector and send status and data */
+
+static void
+vdrive_turbo_read(vdrive *vd)
+{
+    vdrive_session *s = &vd->session;
+    unsigned char block[0x100];
+    vdrive_time when;
+    int jobcode;
+
+    memset(block, 0, sizeof(block));
+    jobcode = vdrive_read_sector(vd, s->track, s->sector, block);
+
+    when = vdrive_seek(vd, vd->now, s->track);
+    if (jobcode == 2)
+        when += VDRIVE_RETRIES * vd->model.revolution;
+    else
+        when = vdrive_sector_start(vd, when, s->track, s->sector) + vdrive_sector_time(vd, s->track);
+    if (jobcode != 1 && jobcode != 2)
+        when += VDRIVE_RETRIES * vd->model.revolution;
+
+    vdrive_put_byte(s, (unsigned char) (jobcode == 1 ? 0 : jobcode));
+    vdrive_put_block(s, block, sizeof(block));
+    s->ready = when;
+}
+
+/*! \internal \brief Turbo and warp write: write the sector received and send the status */
+
+static void
+vdrive_turbo_write(vdrive *vd)
+{
+    vdrive_session *s = &vd->session;
+    unsigned char gcr[VDRIVE_GCR_SIZE];
+    unsigned char block[0x100];
+    vdrive_time when;
+    int jobcode = 1;
+
+    if (s->prog == vdrive_prog_warpwrite)
+    {
+        // with the parallel cable, get_byte takes the first byte of a pair
+        gcr[0] = s->in[0];
+        memcpy(&gcr[1], &s->in[vdrive_byte_size(s)], VDRIVE_GCR_SIZE - 1);
+        jobcode = vdrive_gcr_decode(gcr, block);
+    }
+    else
+    {
+        memcpy(block, s->in, sizeof(block));
+    }
+
+    when = vdrive_seek(vd, vd->now, s->track);
+    jobcode = vdrive_write_sector(vd, s->track, s->sector, block, jobcode);
+
+    if (jobcode == 2)
+        when += VDRIVE_RETRIES * vd->model.revolution;
+    else if (jobcode == 1)
+        when = vdrive_sector_start(vd, when, s->track, s->sector) + vdrive_sector_time(vd, s->track);
+
+    vdrive_put_byte(s, (unsigned char) (jobcode == 1 ? 0 : jobcode));
+    s->ready = when;
+}
+
+/*! \internal \brief Warp read: send the next sector of the track map
+
+ The sectors are sent in the order they pass the head. A sector
+ which cannot be found ends the track after some headers, with the
+ first missing sector and the error.
+*/
+
+static void
+vdrive_warp_read(vdrive *vd)
+{
+    vdrive_session *s = &vd->session;
+    unsigned char block[0x100];
+    unsigned char gcr[VDRIVE_GCR_SIZE + 1];
+    int sectors = vdrive_sector_count(vd, s->track);
+    vdrive_time when = s->ready > vd->now ? s->ready : vd->now;
+    vdrive_time start, best = 0;
+    int se, found = -1, missing = -1;
+    int jobcode;
+
+    for (se = 0; se < sectors; se++)
+    {
+        if (s->map[se] != 0)
+            continue;
+
+        jobcode = vdrive_sector_error(vd, s->track, se);
+        if (jobcode == 2 || jobcode == 3)
+        {
+            if (missing < 0)
+                missing = se;
+            continue;
+        }
+
+        start = vdrive_sector_start(vd, when, s->track, se);
+        if (found < 0 || start < best)
+        {
+            found = se;
+            best = start;
+        }
+    }
+
+    if (found < 0)
+    {
+        if (missing < 0)
+            missing = 0;
+        jobcode = vdrive_sector_error(vd, s->track, missing);
+
+        vdrive_put_byte(s, (unsigned char) missing);
+        vdrive_put_byte(s, (unsigned char) (jobcode == 3 ? 3 : 2));
+        s->ready = when + VDRIVE_WARP_HEADERS * vdrive_sector_time(vd, s->track);
+        vdrive_expect_ts(s);
+        return;
+    }
+
+    jobcode = vdrive_read_sector(vd, s->track, found, block);
+    vdrive_gcr_encode(block, gcr, jobcode);
+    gcr[VDRIVE_GCR_SIZE] = 0;
+
+    vdrive_put_byte(s, (unsigned char) found);
+    vdrive_put_byte(s, 0);
+    vdrive_put_block(s, gcr, sizeof(gcr));
+
+    s->ready = best + vdrive_sector_time(vd, s->track);
+    s->map[found] = 1;
+    s->count--;
+}
+
+/*! \internal \brief libtrans: wait for the next command */
+
+static void
+vdrive_libtrans_expect_cmd(vdrive_session *s)
+{
+    s->state = ST_LT_CMD;
+    s->in_len = 0;
+    s->in_need = vdrive_byte_size(s);
+}
+
+/*! \internal \brief Let the main loop of libtrans process what it received
+
+ See libtrans/turbomain.a65. With the parallel cable, get_byte takes
+ the first byte of a pair, and get_ts a whole pair. send_block sends
+ the page in pairs, followed by a pair as end handshake. get_block
+ takes a pair of which only the first byte is used if the page does
+ not start at an even byte.
+*/
+
+static void
+vdrive_libtrans_step(vdrive *vd)
+{
+    vdrive_session *s = &vd->session;
+    int pp = s->proto == vdrive_proto_pp;
+    unsigned int i, n;
+
+    switch (s->state)
+    {
+    case ST_LT_CMD:
+        s->command = s->in[0];
+        s->in_len = 0;
+        s->in_need = 2;
+        if (s->command & LT_CMD_EXECUTE)
+        {
+            s->state = ST_LT_EXECUTE;
+        }
+        else if (s->command == LT_CMD_RETURN)
+        {
+            // keep the handshake of the command until the host released the bus
+            s->in_need = 0;
+            s->line_state = LS_LT_RETURN;
+        }
+        else
+        {
+            s->state = ST_LT_ADDRESS;
+        }
+        break;
+
+    case ST_LT_ADDRESS:
+        s->address = s->in[0] | (s->in[1] << 8);
+        s->in_len = 0;
+        s->in_need = vdrive_byte_size(s);
+        s->state = ST_LT_OFFSET;
+        break;
+
+    case ST_LT_OFFSET:
+        s->offset = s->in[0];
+        if (s->command != LT_CMD_WRITEMEM)
+        {
+            n = 0x100 - s->offset;
+            for (i = 0; i < n; i++)
+                s->out[s->out_len++] = vdrive_peek(vd, s->address + s->offset + i);
+            if (pp)
+            {
+                // the 6502 code never stops if the page starts at an odd byte
+                if (n & 1)
+                    s->out[s->out_len++] = 0;
+
+                // the end handshake sends what is left in A
+                s->out[s->out_len++] = PORT_DATA_OUT;
+                s->out[s->out_len++] = PORT_DATA_OUT;
+            }
+            vdrive_libtrans_expect_cmd(s);
+        }
+        else
+        {
+            s->in_len = 0;
+            s->in_need = 0x100 - s->offset + (pp && (s->offset & 1));
+            s->state = ST_LT_DATA;
+        }
+        break;
+
+    case ST_LT_DATA:
+        i = 0;
+        n = s->offset;
+        if (pp && (n & 1))
+        {
+            vdrive_poke(vd, s->address + n++, s->in[0]);
+            i = 2;
+        }
+        for (; n < 0x100; n++)
+            vdrive_poke(vd, s->address + n, s->in[i++]);
+        vdrive_libtrans_expect_cmd(s);
+        break;
+
+    case ST_LT_EXECUTE:
+        n = s->in[0] | (s->in[1] << 8);
+        vdrive_session_end(vd);
+        if (n != LT_DOS_IDLE)
+            vdrive_exec(vd, n);
+        break;
+    }
+}
+
+/*! \internal \brief Let the main program process what it received
+
+ This is called when everything has been sent and the program has
+ all the data it waits for.
+*/
+
+static void
+vdrive_program_step(vdrive *vd)
+{
+    vdrive_session *s = &vd->session;
+    unsigned int unit = vdrive_byte_size(s);
+    int sectors, i;
+
+    s->out_len = s->out_pos = 0;
+
+    if (s->prog == vdrive_prog_libtrans)
+    {
+        vdrive_libtrans_step(vd);
+        return;
+    }
+
+    switch (s->state)
+    {
+    case ST_TS:
+        if (s->in[0] == 0)
+        {
+            vdrive_session_end(vd);
+            return;
+        }
+        s->track = s->in[0];
+        s->sector = s->in[1];
+        s->in_len = 0;
+
+        switch (s->prog)
+        {
+        case vdrive_prog_turboread:
+            vdrive_turbo_read(vd);
+            vdrive_expect_ts(s);
+            break;
+
+        case vdrive_prog_turbowrite:
+            s->state = ST_DATA;
+            s->in_need = 0x100;
+            break;
+
+        case vdrive_prog_warpread:
+            s->count = s->sector;
+            sectors = vdrive_sector_count(vd, s->track);
+            s->state = ST_MAP;
+            s->in_need = (sectors > 0 ? sectors : 0) * unit;
+            break;
+
+        case vdrive_prog_warpwrite:
+            s->state = ST_DATA;
+            s->in_need = VDRIVE_GCR_SIZE + unit - 1;
+            break;
+
+        case vdrive_prog_libtrans:
+            // see vdrive_libtrans_step()
+            break;
+        }
+        break;
+
+    case ST_DATA:
+        vdrive_turbo_write(vd);
+        vdrive_expect_ts(s);
+        break;
+
+    case ST_MAP:
+        memset(s->map, 1, sizeof(s->map));
+        for (i = 0; (unsigned int) i < s->in_need / unit; i++)
+            s->map[i] = s->in[i * unit];
+        s->in_len = s->in_need = 0;
+        s->ready = vdrive_seek(vd, vd->now, s->track);
+        s->state = ST_SECTORS;
+        // FALL THROUGH
+
+    case ST_SECTORS:
+        if (s->count > 0)
+            vdrive_warp_read(vd);
+        else
+            vdrive_expect_ts(s);
+        break;
+    }
+}
+
+/*! \internal \brief Start the main program at $0500 with "U4:"
+
+ \return
+   0 if the program was recognised, -1 if not.
+*/
+
+static int
+vdrive_session_start(vdrive *vd)
+{
+    vdrive_session *s = &vd->session;
+    unsigned int m, t;
+
+    for (m = 0; m < sizeof(main_programs) / sizeof(main_programs[0]); m++)
+    {
+        if (vdrive_ram_has(vd, 0x500, main_programs[m].code, main_programs[m].size))
+            break;
+    }
+    for (t = 0; t < sizeof(transfer_programs) / sizeof(transfer_programs[0]); t++)
+    {
+        if (vdrive_ram_has(vd, 0x700, transfer_programs[t].code, transfer_programs[t].size))
+            break;
+    }
+    if (m == sizeof(main_programs) / sizeof(main_programs[0])
+        || t == sizeof(transfer_programs) / sizeof(transfer_programs[0]))
+    {
+        return -1;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->proto = transfer_programs[t].proto;
+    s->prog = main_programs[m].prog;
+    s->ready = vd->now;
+    vdrive_expect_ts(s);
+
+    switch (s->proto)
+    {
+    case vdrive_proto_s1:
+        vd->port = PORT_DATA_OUT;
+        s->line_state = LS_IDLE;
+        break;
+
+    case vdrive_proto_s2:
+        vd->port = 0;
+        s->line_state = LS_S2_INIT_CLK;
+        break;
+
+    default:
+        vd->port = 0;
+        s->line_state = LS_PP_INIT;
+        break;
+    }
+    return 0;
+}
+
+/*! \internal \brief Start the main loop of libtrans with "U3:" or "M-E"
+
+ \param address
+   $0500 for the installed main loop, $0400 for the bootstrap loader.
+
+ \return
+   0 if the main loop and its transfer routine were recognised, -1 if not.
+*/
+
+static int
+vdrive_libtrans_start(vdrive *vd, unsigned int address)
+{
+    vdrive_session *s = &vd->session;
+    unsigned int m, t;
+
+    for (m = 0; m < sizeof(libtrans_main_programs) / sizeof(libtrans_main_programs[0]); m++)
+    {
+        if (libtrans_main_programs[m].address == address
+            && vdrive_ram_has(vd, address, libtrans_main_programs[m].code, libtrans_main_programs[m].size))
+        {
+            break;
+        }
+    }
+    if (m == sizeof(libtrans_main_programs) / sizeof(libtrans_main_programs[0]))
+        return -1;
+
+    for (t = 0; t < sizeof(libtrans_transfer_programs) / sizeof(libtrans_transfer_programs[0]); t++)
+    {
+        if (libtrans_transfer_programs[t].address == libtrans_main_programs[m].transfer
+            && vdrive_ram_has(vd, libtrans_transfer_programs[t].address,
+                              libtrans_transfer_programs[t].code, libtrans_transfer_programs[t].size))
+        {
+            break;
+        }
+    }
+    if (t == sizeof(libtrans_transfer_programs) / sizeof(libtrans_transfer_programs[0]))
+        return -1;
+
+    memset(s, 0, sizeof(*s));
+    s->proto = libtrans_transfer_programs[t].proto;
+    s->prog = vdrive_prog_libtrans;
+    s->ready = vd->now;
+    vdrive_libtrans_expect_cmd(s);
+    vd->pp_drive_output = 0;
+
+    if (s->proto == vdrive_proto_s2)
+    {
+        vd->port = 0;
+        s->line_state = LS_S2_INIT_CLK;
+    }
+    else
+    {
+        // the init routines of serial-1 and parallel just pull DATA
+        vd->port = PORT_DATA_OUT;
+        s->line_state = LS_IDLE;
+    }
+    return 0;
+}
+
+/*! \internal \brief Execute code in the drive
+
+ \param address
+   The address to jump to, as with M-E, or U3 to U8.
+
+ \return
+   0 if the code is known and was run, -1 if not.
+*/
+
+int
+vdrive_exec(vdrive *vd, unsigned int address)
+{
+    static int warned;
+
+    if (address == 0x0308 && vdrive_ram_has(vd, 0x308, drvcache_prog, sizeof(drvcache_prog)))
+    {
+        vdrive_checksum_drvcache(vd);
+        return 0;
+    }
+    if (address == 0x0500 && vdrive_ram_has(vd, 0x500, checksum1541, sizeof(checksum1541)))
+    {
+        vdrive_checksum_blocks(vd);
+        return 0;
+    }
+    if (address == 0x0503 && vdrive_session_start(vd) == 0)
+    {
+        return 0;
+    }
+    if ((address == 0x0500 || address == 0x0400) && vdrive_libtrans_start(vd, address) == 0)
+    {
+        return 0;
+    }
+
+    if (!warned)
+    {
+        fprintf(stderr, "vdrive: unknown drive code at $%04x, ignored.\n", address);
+        warned = 1;
+    }
+    return -1;
+}
+
+/*-------------------------------------------------------------------*/
+/*--------- TRANSFER ROUTINES ---------------------------------------*/
+
+/*! \internal \brief The time one byte needs with a fast protocol */
+
+static vdrive_time
+vdrive_byte_time(vdrive *vd, enum vdrive_proto proto)
+{
+    switch (proto)
+    {
+    case vdrive_proto_s1: return vd->model.s1_byte;
+    case vdrive_proto_s2: return vd->model.s2_byte;
+    default:              return vd->model.pp_byte;
+    }
+}
+
+/*! \internal \brief The transfer routine sent a byte (or a pair) */
+
+static void
+vdrive_sent(vdrive *vd, unsigned int count)
+{
+    vd->session.out_pos += count;
+    vd->session.line_state = LS_IDLE;
+    vd->stats.BusBytes += count;
+}
+
+/*! \internal \brief The transfer routine received a byte */
+
+static void
+vdrive_received(vdrive *vd, unsigned char byte)
+{
+    vd->session.in[vd->session.in_len++] = byte;
+    vd->session.line_state = LS_IDLE;
+    vd->stats.BusBytes++;
+}
+
+/*! \internal \brief Let the transfer routine react on the lines once
+
+ \return
+   1 if something changed, 0 if the drive waits for the host.
+*/
+
+static int
+vdrive_line_step(vdrive *vd)
+{
+    vdrive_session *s = &vd->session;
+    int lines = vdrive_lines(vd);
+    int data  = (lines & IEC_DATA) != 0;
+    int clock = (lines & IEC_CLOCK) != 0;
+    int atn   = (lines & IEC_ATN) != 0;
+    int bit;
+
+    switch (s->line_state)
+    {
+    case LS_IDLE:
+        if (s->out_pos < s->out_len)
+        {
+            if (vd->now < s->ready)
+                return 0;
+
+            s->shift = s->out[s->out_pos];
+            s->bits = 0;
+            switch (s->proto)
+            {
+            case vdrive_proto_s1:
+                if (s->prog == vdrive_prog_libtrans)
+                {
+                    s->line_state = LS_S1_WRITE0;
+                    break;
+                }
+                vd->port = (s->shift & 1) ? PORT_CLK_OUT : 0;
+                s->line_state = LS_S1_WRITE1;
+                break;
+            case vdrive_proto_s2:
+                if (s->prog == vdrive_prog_libtrans)
+                {
+                    s->line_state = LS_LT_S2_WRITE1;
+                    break;
+                }
+                vd->port = PORT_ATNA | ((s->shift & 1) << 1);
+                s->shift >>= 1;
+                s->line_state = LS_S2_WRITE1;
+                break;
+            default:
+                vd->pp_drive_output = 1;
+                if (s->prog == vdrive_prog_libtrans)
+                {
+                    s->line_state = LS_PP_SEND1;
+                    break;
+                }
+                vd->pp_drive = s->shift;
+                vd->port = PORT_DATA_OUT;
+                s->line_state = LS_PP_SEND1;
+                break;
+            }
+            return 1;
+        }
+
+        if (s->in_len < s->in_need)
+        {
+            s->shift = 0;
+            s->bits = 0;
+            switch (s->proto)
+            {
+            case vdrive_proto_s1:
+                s->line_state = LS_S1_READ1;
+                break;
+            case vdrive_proto_s2:
+                s->line_state = LS_S2_READ0;
+                break;
+            default:
+                vd->pp_drive_output = 0;
+                vd->port = PORT_DATA_OUT;
+                s->line_state = LS_PP_GET1;
+                break;
+            }
+            return 1;
+        }
+
+        vdrive_program_step(vd);
+        return 1;
+
+    /* serial-1 */
+
+    case LS_S1_READ1:
+        if (clock)
+            return 0;
+        vd->port = 0;
+        bit = (vdrive_lines(vd) & IEC_DATA) != 0;
+        s->shift = (unsigned char) ((s->shift << 1) | bit);
+        vd->port = PORT_CLK_OUT;
+        s->line_state = LS_S1_READ2;
+        return 1;
+
+    case LS_S1_READ2:
+        if (data == (s->shift & 1))
+            return 0;
+        vd->port = 0;
+        s->line_state = LS_S1_READ3;
+        return 1;
+
+    case LS_S1_READ3:
+        if (!clock)
+            return 0;
+        vd->port = PORT_DATA_OUT;
+        if (++s->bits == 8)
+            vdrive_received(vd, s->shift);
+        else
+            s->line_state = LS_S1_READ1;
+        return 1;
+
+    case LS_S1_WRITE0:
+        if (clock)
+            return 0;
+        vd->port = (s->shift & 1) ? PORT_CLK_OUT : 0;
+        s->line_state = LS_S1_WRITE1;
+        return 1;
+
+    case LS_S1_WRITE1:
+        if (!data)
+            return 0;
+        vd->port ^= PORT_CLK_OUT;
+        s->line_state = LS_S1_WRITE3;
+        return 1;
+
+    case LS_S1_WRITE3:
+        if (data)
+            return 0;
+        vd->port = PORT_DATA_OUT;
+        if (s->prog != vdrive_prog_libtrans)
+        {
+            s->line_state = LS_S1_WRITE4;
+            return 1;
+        }
+
+        // libtrans waits for CLOCK before the next bit, in write0
+        s->shift >>= 1;
+        if (++s->bits == 8)
+            vdrive_sent(vd, 1);
+        else
+            s->line_state = LS_S1_WRITE0;
+        return 1;
+
+    case LS_S1_WRITE4:
+        if (!clock)
+            return 0;
+        s->shift >>= 1;
+        if (++s->bits == 8)
+        {
+            vdrive_sent(vd, 1);
+        }
+        else
+        {
+            vd->port = (s->shift & 1) ? PORT_CLK_OUT : 0;
+            s->line_state = LS_S1_WRITE1;
+        }
+        return 1;
+
+    /* serial-2 */
+
+    case LS_S2_INIT_CLK:
+        if (clock)
+            return 0;
+        vd->port = PORT_CLK_OUT;
+        s->line_state = LS_S2_INIT_ATN;
+        return 1;
+
+    case LS_S2_INIT_ATN:
+        if (!atn)
+            return 0;
+        s->line_state = LS_IDLE;
+        return 1;
+
+    case LS_S2_READ0:
+        if (atn)
+            return 0;
+        s->shift = (unsigned char) ((s->shift >> 1) | (data << 7));
+        vd->port = PORT_ATNA;
+        s->line_state = LS_S2_READ1;
+        return 1;
+
+    case LS_S2_READ1:
+        if (!atn)
+            return 0;
+        s->shift = (unsigned char) ((s->shift >> 1) | (data << 7));
+        vd->port = PORT_CLK_OUT;
+        if (++s->bits == 4)
+            vdrive_received(vd, s->shift);
+        else
+            s->line_state = LS_S2_READ0;
+        return 1;
+
+    case LS_S2_WRITE1:
+        if (atn)
+            return 0;
+        vd->port = PORT_CLK_OUT | ((s->shift & 1) << 1);
+        s->shift >>= 1;
+        s->line_state = LS_S2_WRITE2;
+        return 1;
+
+    case LS_S2_WRITE2:
+        if (!atn)
+            return 0;
+        if (++s->bits == 4)
+        {
+            vd->port = PORT_CLK_OUT;
+            vdrive_sent(vd, 1);
+        }
+        else
+        {
+            vd->port = PORT_ATNA | ((s->shift & 1) << 1);
+            s->shift >>= 1;
+            s->line_state = LS_S2_WRITE1;
+        }
+        return 1;
+
+    /* serial-2 of libtrans, sending */
+
+    case LS_LT_S2_WRITE1:
+        if (atn)
+            return 0;
+        vd->port = (s->shift & 1) << 1;
+        s->shift >>= 1;
+        s->line_state = LS_LT_S2_WRITE2;
+        return 1;
+
+    case LS_LT_S2_WRITE2:
+        if (!atn)
+            return 0;
+        vd->port = PORT_ATNA | PORT_CLK_OUT | ((s->shift & 1) << 1);
+        s->shift >>= 1;
+        s->line_state = (++s->bits == 4) ? LS_LT_S2_WRITE3 : LS_LT_S2_WRITE1;
+        return 1;
+
+    case LS_LT_S2_WRITE3:
+        if (atn)
+            return 0;
+        vd->port = 0;
+        s->line_state = LS_LT_S2_WRITE4;
+        return 1;
+
+    case LS_LT_S2_WRITE4:
+        if (!atn)
+            return 0;
+        vd->port = PORT_CLK_OUT;
+        vdrive_sent(vd, 1);
+        return 1;
+
+    /* parallel; a pair of bytes per handshake */
+
+    case LS_PP_INIT:
+        if (!clock)
+            return 0;
+        s->line_state = LS_IDLE;
+        return 1;
+
+    case LS_PP_GET1:
+        if (clock)
+            return 0;
+        s->shift = vd->pp_host;
+        vd->port = 0;
+        s->line_state = LS_PP_GET2;
+        return 1;
+
+    case LS_PP_GET2:
+        if (!clock)
+            return 0;
+        vdrive_received(vd, s->shift);
+        vdrive_received(vd, vd->pp_host);
+        if (s->prog == vdrive_prog_libtrans)
+            vd->port = PORT_DATA_OUT;
+        return 1;
+
+    // libtrans puts each byte of the pair on the port only after CLOCK changed
+
+    case LS_PP_SEND1:
+        if (clock)
+            return 0;
+        vd->pp_drive = s->out[s->out_pos + (s->prog == vdrive_prog_libtrans ? 0 : 1)];
+        vd->port = 0;
+        s->line_state = LS_PP_SEND2;
+        return 1;
+
+    case LS_PP_SEND2:
+        if (!clock)
+            return 0;
+        if (s->prog == vdrive_prog_libtrans)
+        {
+            vd->pp_drive = s->out[s->out_pos + 1];
+            vd->port = PORT_DATA_OUT;
+        }
+        else
+        {
+            vd->pp_drive_output = 0;
+        }
+        vdrive_sent(vd, 2);
+        return 1;
+
+    /* the main loop of libtrans returns to the DOS */
+
+    case LS_LT_RETURN:
+        if (atn)
+            return 0;
+        vd->port = PORT_DATA_OUT;
+        vd->pp_drive_output = 0;
+        s->line_state = LS_LT_RETURN_CLK;
+        return 1;
+
+    case LS_LT_RETURN_CLK:
+        if (clock)
+            return 0;
+        vdrive_session_end(vd);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*! \internal \brief Let the program in the drive run as far as it can
+
+ The drive is always quicker than the host, so it runs until it has
+ to wait for the host, or for the disk.
+*/
+
+void
+vdrive_run(vdrive *vd)
+{
+    while (vd->session.proto != vdrive_proto_none && vdrive_line_step(vd))
+        ;
+}
+
+/*! \internal \brief The time the drive does something on its own next
+
+ \return
+   The time, or 0 if the drive only waits for the host.
+*/
+
+vdrive_time
+vdrive_next_event(vdrive *vd)
+{
+    vdrive_session *s = &vd->session;
+    vdrive_time when = 0;
+
+    if (s->proto != vdrive_proto_none && s->out_pos < s->out_len && s->ready > vd->now)
+        when = s->ready;
+
+    if (vd->dos_ready > vd->now && (when == 0 || vd->dos_ready < when))
+        when = vd->dos_ready;
+
+    return when;
+}
+
+/*! \internal \brief Put the transfer routine and the host between two bytes
+
+ The *_read_n() and *_write_n() functions transfer whole bytes.
+ A byte the transfer routine has just started on is taken back, and
+ the lines are set as the host and the drive leave them after a byte.
+*/
+
+static void
+vdrive_fast_sync(vdrive *vd)
+{
+    vdrive_session *s = &vd->session;
+
+    s->line_state = LS_IDLE;
+    vd->pp_drive_output = 0;
+
+    switch (s->proto)
+    {
+    case vdrive_proto_s1:
+        vd->port = PORT_DATA_OUT;
+        vd->host_lines = (vd->host_lines & ~IEC_DATA) | IEC_CLOCK;
+        break;
+
+    case vdrive_proto_s2:
+        vd->port = PORT_CLK_OUT;
+        vd->host_lines = (vd->host_lines & ~(IEC_DATA | IEC_CLOCK)) | IEC_ATN;
+        break;
+
+    default:
+        vd->port = 0;
+        vd->host_lines |= IEC_CLOCK;
+        break;
+    }
+}
+
+/*! \internal \brief Read bytes sent by the program in the drive
+
+ \param proto
+   The protocol the host uses.
+
+ \return
+   The number of bytes read. It is less than size if the drive does
+   not send with this protocol, or wants to receive.
+*/
+
+unsigned int
+vdrive_fast_read(vdrive *vd, enum vdrive_proto proto, unsigned char *data, unsigned int size)
+{
+    vdrive_session *s = &vd->session;
+    vdrive_time byte_time = vdrive_byte_time(vd, proto);
+    unsigned int i;
+
+    if (s->proto != proto)
+        return 0;
+
+    vdrive_fast_sync(vd);
+
+    for (i = 0; i < size; i++)
+    {
+        while (s->proto == proto && s->out_pos >= s->out_len && s->in_len >= s->in_need)
+            vdrive_program_step(vd);
+
+        if (s->proto != proto || s->out_pos >= s->out_len)
+            break;
+
+        if (vd->now < s->ready)
+            vd->now = s->ready;
+
+        data[i] = s->out[s->out_pos++];
+        vd->now += byte_time;
+        vd->stats.BusBytes++;
+    }
+
+    if (s->proto == proto)
+        vdrive_fast_sync(vd);
+    vdrive_run(vd);
+    return i;
+}
+
+/*! \internal \brief Send bytes to the program in the drive
+
+ \param proto
+   The protocol the host uses.
+
+ \return
+   The number of bytes written. It is less than size if the drive does
+   not receive with this protocol, or wants to send.
+*/
+
+unsigned int
+vdrive_fast_write(vdrive *vd, enum vdrive_proto proto, const unsigned char *data, unsigned int size)
+{
+    vdrive_session *s = &vd->session;
+    vdrive_time byte_time = vdrive_byte_time(vd, proto);
+    unsigned int i;
+
+    if (s->proto != proto)
+        return 0;
+
+    vdrive_fast_sync(vd);
+
+    for (i = 0; i < size; i++)
+    {
+        while (s->proto == proto && s->out_pos >= s->out_len && s->in_len >= s->in_need)
+            vdrive_program_step(vd);
+
+        if (s->proto != proto || s->in_len >= s->in_need)
+            break;
+
+        s->in[s->in_len++] = data[i];
+        vd->now += byte_time;
+        vd->stats.BusBytes++;
+    }
+
+    if (s->proto == proto)
+        vdrive_fast_sync(vd);
+    vdrive_run(vd);
+    return i;
+}
@@ -0,0 +1,1140 @@
+/*
+ *  vdrive plugin: a virtual drive backed by a disk image
+ *
+ *      This program is free software; you can redistribute it and/or
+ *      modify it under the terms of the GNU General Public License
+ *      as published by the Free Software Foundation; either version
+ *      2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file lib/plugin/vdrive/vdrive.c \n
+** \n
+** \brief Plugin emulating a drive and the adapter it is connected to
+**
+** The port names the disk image, followed by options which describe
+** the drive and the latency of the adapter and the drive, for example
+** "vdrive:test.d64,usb=125,s1=120". If there is no port, it is taken
+** from the environment variable OPENCBM_VDRIVE. The drive is a 1541
+** for .d64 images, a 1571 for .d71, a 1581 for .d81, a 8050 for .d80
+** and a 8250 for .d82. All times are given in microseconds:
+**
+** - usb:      one round trip between host and adapter (125)
+** - atn:      one LISTEN, TALK, UNLISTEN or UNTALK (1000)
+** - iec:      one byte with the standard IEC protocol (400)
+** - s1, s2:   one byte with serial-1 (120) and serial-2 (60)
+** - pp:       one byte with the parallel cable (20)
+** - rpm:      the speed of the disk (300)
+** - step:     moving the head by one track (12000)
+** - queue:    1 if queued transfers and batches need a single round
+**             trip, 0 if every one of them needs its own (1)
+** - parallel: 1 if there is a XP1541 cable (1)
+** - unit:     the device number of the drive (8)
+** - drive:    emulate this drive instead, 1571 for a .d64 image or
+**             8250 for a .d80 image
+** - latency:  multiply all times by this; 0 gives a drive and an
+**             adapter without any latency, so only the time of the
+**             host is left (1)
+**
+** Nothing really waits: the plugin keeps an emulated clock, which
+** advances by the cost of every call. This makes benchmarks of the
+** host side repeatable, and independent of the machine they run on.
+** opencbm_plugin_vdrive_get_stats() returns the clock and some counters.
+** opencbm_plugin_vdrive_sleep() advances the clock for a sleep of the
+** host, so it does not have to sleep for real.
+**
+****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! mark: We are building the DLL */
+#define OPENCBM_PLUGIN
+#include "archlib.h"
+
+#include "vdrive.h"
+
+/*! The environment variable giving the port if there is none */
+#define VDRIVE_PORT_ENV    "OPENCBM_VDRIVE"
+
+/*! ns per microsecond */
+#define VDRIVE_US          1000ULL
+
+/*! The time the drive needs to start after a RESET */
+#define VDRIVE_RESET_TIME  (1000000ULL * VDRIVE_US)
+
+/*! The duration of one cycle of the drive CPU, at 1 MHz */
+#define VDRIVE_CYCLE       VDRIVE_US
+
+/*! \internal \brief Convert microseconds into the emulated time */
+
+static vdrive_time
+vdrive_us(double value)
+{
+    return value > 0 ? (vdrive_time) (value * VDRIVE_US + 0.5) : 0;
+}
+
+/*! \internal \brief Parse the options given with the port
+
+ \param model
+   Will contain the latency model.
+
+ \param options
+   The options, separated by commas. NULL for the defaults.
+
+ \return
+   0 on success, -1 on error (already reported).
+*/
+
+int
+vdrive_model_parse(vdrive_model *model, const char *options)
+{
+    char name[16];
+    const char *p = options;
+    char *end;
+    size_t len;
+    double value;
+    double latency = 1;
+
+    model->transaction = vdrive_us(125);
+    model->atn         = vdrive_us(1000);
+    model->iec_byte    = vdrive_us(400);
+    model->s1_byte     = vdrive_us(120);
+    model->s2_byte     = vdrive_us(60);
+    model->pp_byte     = vdrive_us(20);
+    model->revolution  = vdrive_us(60.0 * 1000000 / 300);
+    model->step        = vdrive_us(12000);
+    model->reset       = VDRIVE_RESET_TIME;
+    model->cycle       = VDRIVE_CYCLE;
+    model->queue       = 1;
+    model->parallel    = 1;
+    model->unit        = 8;
+    model->drive       = 0;
+
+    while (p != NULL && *p != 0)
+    {
+        len = strcspn(p, "=,");
+        if (p[len] != '=' || len >= sizeof(name))
+        {
+            fprintf(stderr, "vdrive: invalid option '%s'.\n", p);
+            return -1;
+        }
+        memcpy(name, p, len);
+        name[len] = 0;
+
+        value = strtod(p + len + 1, &end);
+        if (end == p + len + 1 || (*end != 0 && *end != ',') || value < 0)
+        {
+            fprintf(stderr, "vdrive: invalid value for '%s'.\n", name);
+            return -1;
+        }
+        p = *end ? end + 1 : end;
+
+        if (strcmp(name, "usb") == 0)
+            model->transaction = vdrive_us(value);
+        else if (strcmp(name, "atn") == 0)
+            model->atn = vdrive_us(value);
+        else if (strcmp(name, "iec") == 0)
+            model->iec_byte = vdrive_us(value);
+        else if (strcmp(name, "s1") == 0)
+            model->s1_byte = vdrive_us(value);
+        else if (strcmp(name, "s2") == 0)
+            model->s2_byte = vdrive_us(value);
+        else if (strcmp(name, "pp") == 0)
+            model->pp_byte = vdrive_us(value);
+        else if (strcmp(name, "step") == 0)
+            model->step = vdrive_us(value);
+        else if (strcmp(name, "rpm") == 0 && value > 0)
+            model->revolution = vdrive_us(60.0 * 1000000 / value);
+        else if (strcmp(name, "queue") == 0)
+            model->queue = value != 0;
+        else if (strcmp(name, "parallel") == 0)
+            model->parallel = value != 0;
+        else if (strcmp(name, "unit") == 0 && value >= 4 && value <= 30)
+            model->unit = (unsigned char) value;
+        else if (strcmp(name, "drive") == 0)
+            model->drive = (int) value;
+        else if (strcmp(name, "latency") == 0)
+            latency = value;
+        else
+        {
+            fprintf(stderr, "vdrive: unknown option '%s'.\n", name);
+            return -1;
+        }
+    }
+
+    model->transaction = (vdrive_time) (model->transaction * latency);
+    model->atn         = (vdrive_time) (model->atn * latency);
+    model->iec_byte    = (vdrive_time) (model->iec_byte * latency);
+    model->s1_byte     = (vdrive_time) (model->s1_byte * latency);
+    model->s2_byte     = (vdrive_time) (model->s2_byte * latency);
+    model->pp_byte     = (vdrive_time) (model->pp_byte * latency);
+    model->revolution  = (vdrive_time) (model->revolution * latency);
+    model->step        = (vdrive_time) (model->step * latency);
+    model->reset       = (vdrive_time) (model->reset * latency);
+    model->cycle       = (vdrive_time) (model->cycle * latency);
+
+    return 0;
+}
+
+/*! \internal \brief The state of the IEC lines
+
+ \return
+   The lines which are active, as for opencbm_plugin_iec_poll().
+*/
+
+int
+vdrive_lines(vdrive *vd)
+{
+    int lines = vd->host_lines;
+    int atn = (lines & IEC_ATN) != 0;
+    int atna = (vd->port & PORT_ATNA) != 0;
+
+    // the ATN acknowledge circuit pulls DATA if ATN and ATNA differ
+    if ((vd->port & PORT_DATA_OUT) || atn != atna)
+        lines |= IEC_DATA;
+    if (vd->port & PORT_CLK_OUT)
+        lines |= IEC_CLOCK;
+
+    return lines;
+}
+
+/*! \internal \brief One round trip between host and adapter */
+
+static void
+vdrive_transaction(vdrive *vd)
+{
+    vd->stats.Transactions++;
+    vd->now += vd->model.transaction;
+}
+
+/*! \internal \brief Wait until the DOS has finished the last command */
+
+static void
+vdrive_dos_wait(vdrive *vd)
+{
+    if (vd->dos_ready > vd->now)
+        vd->now = vd->dos_ready;
+}
+
+/*! \internal \brief Send a LISTEN, or the OPEN of a file
+
+ Like a real drive, the drive acknowledges the bytes sent under ATN
+ even if they address another device; it just does not listen then.
+
+ \return
+   0 on success, -1 if the drive does not answer.
+*/
+
+static int
+vdrive_listen(vdrive *vd, unsigned char DeviceAddress, unsigned char SecondaryAddress, int opening)
+{
+    vdrive_dos_wait(vd);
+    vd->now += vd->model.atn;
+    vd->host_lines = IEC_CLOCK;
+
+    if (vd->session.proto != vdrive_proto_none)
+        return -1;
+
+    if (DeviceAddress != vd->model.unit)
+        vdrive_dos_listen(vd, -1, 0);
+    else
+        vdrive_dos_listen(vd, SecondaryAddress & 0x0f, opening);
+    return 0;
+}
+
+/*! \internal \brief Send a TALK
+
+ As with a LISTEN, a TALK to another device is acknowledged, too.
+
+ \return
+   0 on success, -1 if the drive does not answer.
+*/
+
+static int
+vdrive_talk(vdrive *vd, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    vdrive_dos_wait(vd);
+    vd->now += vd->model.atn;
+    vd->host_lines = IEC_DATA;
+
+    if (vd->session.proto != vdrive_proto_none)
+        return -1;
+
+    vdrive_dos_talk(vd, DeviceAddress != vd->model.unit ? -1 : SecondaryAddress & 0x0f);
+    return 0;
+}
+
+/*! \internal \brief Send an UNLISTEN; the DOS executes what it got */
+
+static int
+vdrive_unlisten(vdrive *vd)
+{
+    vd->now += vd->model.atn;
+    vd->host_lines = IEC_CLOCK;
+
+    if (vd->listening >= 0)
+        vdrive_dos_unlisten(vd);
+    return 0;
+}
+
+/*! \internal \brief Send an UNTALK */
+
+static int
+vdrive_untalk(vdrive *vd)
+{
+    vd->now += vd->model.atn;
+    vd->host_lines = IEC_CLOCK;
+
+    vdrive_dos_talk(vd, -1);
+    return 0;
+}
+
+/*! \internal \brief Write data with the standard IEC protocol
+
+ \return
+   The number of bytes written, -1 if the drive does not listen.
+*/
+
+static int
+vdrive_raw_write(vdrive *vd, const void *Buffer, size_t Count)
+{
+    int rv = vdrive_dos_write(vd, Buffer, Count);
+
+    if (rv > 0)
+    {
+        vd->now += rv * vd->model.iec_byte;
+        vd->stats.BusBytes += rv;
+    }
+    return rv;
+}
+
+/*! \internal \brief Read data with the standard IEC protocol
+
+ \return
+   The number of bytes read, -1 if the drive does not talk.
+*/
+
+static int
+vdrive_raw_read(vdrive *vd, void *Buffer, size_t Count)
+{
+    int rv;
+
+    vdrive_dos_wait(vd);
+
+    rv = vdrive_dos_read(vd, Buffer, Count);
+    if (rv > 0)
+    {
+        vd->now += rv * vd->model.iec_byte;
+        vd->stats.BusBytes += rv;
+    }
+    return rv;
+}
+
+/*! \internal \brief Convert the protocol of the plugin interface
+
+ \return
+   The protocol, or vdrive_proto_none if it is not supported.
+*/
+
+static enum vdrive_proto
+vdrive_protocol(vdrive *vd, int Protocol)
+{
+    switch (Protocol)
+    {
+    case opencbm_proto_s1:
+        return vdrive_proto_s1;
+    case opencbm_proto_s2:
+        return vdrive_proto_s2;
+    case opencbm_proto_pp_dc:
+        return vd->model.parallel ? vdrive_proto_pp : vdrive_proto_none;
+    default:
+        return vdrive_proto_none;
+    }
+}
+
+
+/*-------------------------------------------------------------------*/
+/*--------- OPENCBM ARCH FUNCTIONS ----------------------------------*/
+
+/*! \brief Get the name of the driver
+
+ \param Port
+   The disk image and the options. If NULL, they are taken from the
+   environment variable OPENCBM_VDRIVE.
+
+ \return
+   Returns a pointer to a null-terminated string containing the
+   driver name.
+*/
+
+const char * CBMAPIDECL
+opencbm_plugin_get_driver_name(const char * const Port)
+{
+    static char name[256];
+    const char *spec = Port ? Port : getenv(VDRIVE_PORT_ENV);
+
+    snprintf(name, sizeof(name), "vdrive (%s)", spec ? spec : "no image");
+
+    return name;
+}
+
+/*! \brief Opens the driver
+
+ \param HandleDevice
+   Pointer to a CBM_FILE which will contain the file handle of the driver.
+
+ \param Port
+   The disk image and the options. If NULL, they are taken from the
+   environment variable OPENCBM_VDRIVE.
+
+ \return
+   ==0: This function completed successfully
+   !=0: otherwise
+*/
+
+int CBMAPIDECL
+opencbm_plugin_driver_open(CBM_FILE *HandleDevice, const char * const Port)
+{
+    const char *spec = Port ? Port : getenv(VDRIVE_PORT_ENV);
+    char *image, *options;
+    vdrive *vd;
+
+    if (spec == NULL || *spec == 0)
+    {
+        fprintf(stderr, "vdrive: no disk image given, use vdrive:IMAGE or " VDRIVE_PORT_ENV ".\n");
+        return 1;
+    }
+
+    image = strdup(spec);
+    vd = calloc(1, sizeof(*vd));
+    if (image == NULL || vd == NULL)
+    {
+        free(image);
+        free(vd);
+        return 1;
+    }
+
+    options = strchr(image, ',');
+    if (options != NULL)
+        *options++ = 0;
+
+    if (vdrive_model_parse(&vd->model, options) != 0
+        || vdrive_image_open(vd, image) != 0)
+    {
+        vdrive_image_close(vd);
+        free(image);
+        free(vd);
+        return 1;
+    }
+    free(image);
+
+    vdrive_dos_reset(vd);
+
+    *HandleDevice = (CBM_FILE) vd;
+    return 0;
+}
+
+/*! \brief Closes the driver
+
+ The disk image is written back if it was changed.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+*/
+
+void CBMAPIDECL
+opencbm_plugin_driver_close(CBM_FILE HandleDevice)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_image_close(vd);
+    free(vd);
+}
+
+/*! \brief Write data to the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Buffer
+   Pointer to a buffer which hold the bytes to write to the bus.
+
+ \param Count
+   Number of bytes to be written.
+
+ \return
+   >= 0: The actual number of bytes written.
+   <0  indicates an error.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_raw_write(CBM_FILE HandleDevice, const void *Buffer, size_t Count)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return vdrive_raw_write(vd, Buffer, Count);
+}
+
+/*! \brief Read data from the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Buffer
+   Pointer to a buffer which will hold the bytes read.
+
+ \param Count
+   Number of bytes to be read at most.
+
+ \return
+   >= 0: The actual number of bytes read.
+   <0  indicates an error.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_raw_read(CBM_FILE HandleDevice, void *Buffer, size_t Count)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return vdrive_raw_read(vd, Buffer, Count);
+}
+
+/*! \brief Send a LISTEN on the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param SecondaryAddress
+   The secondary address for the device on the IEC serial bus.
+
+ \return
+   0 means success, else failure
+*/
+
+int CBMAPIDECL
+opencbm_plugin_listen(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return vdrive_listen(vd, DeviceAddress, SecondaryAddress, 0);
+}
+
+/*! \brief Send a TALK on the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param SecondaryAddress
+   The secondary address for the device on the IEC serial bus.
+
+ \return
+   0 means success, else failure
+*/
+
+int CBMAPIDECL
+opencbm_plugin_talk(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return vdrive_talk(vd, DeviceAddress, SecondaryAddress);
+}
+
+/*! \brief Open a file on the IEC serial bus
+
+ The file name follows with opencbm_plugin_raw_write(), and the file
+ is opened with the next UNLISTEN.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param SecondaryAddress
+   The secondary address for the device on the IEC serial bus.
+
+ \return
+   0 means success, else failure
+*/
+
+int CBMAPIDECL
+opencbm_plugin_open(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return vdrive_listen(vd, DeviceAddress, SecondaryAddress, 1);
+}
+
+/*! \brief Close a file on the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus.
+
+ \param SecondaryAddress
+   The secondary address for the device on the IEC serial bus.
+
+ \return
+   0 means success, else failure
+*/
+
+int CBMAPIDECL
+opencbm_plugin_close(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned char SecondaryAddress)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    if (vdrive_listen(vd, DeviceAddress, SecondaryAddress, 0) != 0)
+        return -1;
+
+    vd->listening = -1;
+    vdrive_dos_close(vd, SecondaryAddress & 0x0f);
+    return vdrive_unlisten(vd);
+}
+
+/*! \brief Send an UNLISTEN on the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \return
+   0 on success, else failure
+*/
+
+int CBMAPIDECL
+opencbm_plugin_unlisten(CBM_FILE HandleDevice)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return vdrive_unlisten(vd);
+}
+
+/*! \brief Send an UNTALK on the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \return
+   0 on success, else failure
+*/
+
+int CBMAPIDECL
+opencbm_plugin_untalk(CBM_FILE HandleDevice)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return vdrive_untalk(vd);
+}
+
+/*! \brief Get EOI flag after bus read
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \return
+   != 0 if the last byte read had an EOI
+*/
+
+int CBMAPIDECL
+opencbm_plugin_get_eoi(CBM_FILE HandleDevice)
+{
+    return ((vdrive *) HandleDevice)->eoi;
+}
+
+/*! \brief Reset the EOI flag
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \return
+   0 on success
+*/
+
+int CBMAPIDECL
+opencbm_plugin_clear_eoi(CBM_FILE HandleDevice)
+{
+    ((vdrive *) HandleDevice)->eoi = 0;
+    return 0;
+}
+
+/*! \brief RESET all devices
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \return
+   0 on success
+*/
+
+int CBMAPIDECL
+opencbm_plugin_reset(CBM_FILE HandleDevice)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    vd->host_lines = 0;
+    vdrive_dos_reset(vd);
+    vd->dos_ready = vd->now + vd->model.reset;
+    return 0;
+}
+
+/*! \brief Read a byte from the XP1541/XP1571 cable
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \return
+   the byte which was received on the parallel port
+*/
+
+unsigned char CBMAPIDECL
+opencbm_plugin_pp_read(CBM_FILE HandleDevice)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    vd->stats.LineOperations++;
+    vdrive_run(vd);
+
+    return vd->model.parallel && vd->pp_drive_output ? vd->pp_drive : vd->pp_host;
+}
+
+/*! \brief Write a byte to the XP1541/XP1571 cable
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Byte
+   the byte to be output on the parallel port
+*/
+
+void CBMAPIDECL
+opencbm_plugin_pp_write(CBM_FILE HandleDevice, unsigned char Byte)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    vd->stats.LineOperations++;
+    vd->pp_host = Byte;
+    vdrive_run(vd);
+}
+
+/*! \brief Read status of all bus lines
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \return
+   The state of the lines: IEC_DATA, IEC_CLOCK, IEC_ATN, and IEC_RESET
+   if they are active.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_iec_poll(CBM_FILE HandleDevice)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    vd->stats.LineOperations++;
+    vdrive_run(vd);
+
+    return vdrive_lines(vd);
+}
+
+/*! \brief Activate and deactivate lines on the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Set
+   The mask of which lines should be set.
+
+ \param Release
+   The mask of which lines should be released.
+*/
+
+void CBMAPIDECL
+opencbm_plugin_iec_setrelease(CBM_FILE HandleDevice, int Set, int Release)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    vd->stats.LineOperations++;
+
+    vd->host_lines = (vd->host_lines & ~Release) | Set;
+    if (Set & IEC_RESET)
+    {
+        vdrive_dos_reset(vd);
+        vd->dos_ready = vd->now + vd->model.reset;
+    }
+    vdrive_run(vd);
+}
+
+/*! \brief Activate a line on the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Line
+   The line to be activated.
+*/
+
+void CBMAPIDECL
+opencbm_plugin_iec_set(CBM_FILE HandleDevice, int Line)
+{
+    opencbm_plugin_iec_setrelease(HandleDevice, Line, 0);
+}
+
+/*! \brief Deactivate a line on the IEC serial bus
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Line
+   The line to be deactivated.
+*/
+
+void CBMAPIDECL
+opencbm_plugin_iec_release(CBM_FILE HandleDevice, int Line)
+{
+    opencbm_plugin_iec_setrelease(HandleDevice, 0, Line);
+}
+
+/*! \brief Wait for a line to have a specific state
+
+ The adapter waits, so this is a single round trip. If the drive
+ will never change the line, the current state is returned.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Line
+   The line to be monitored.
+
+ \param State
+   Whether the line should be set (!= 0) or released (== 0).
+
+ \return
+   The state of the IEC bus on return (like cbm_iec_poll).
+*/
+
+int CBMAPIDECL
+opencbm_plugin_iec_wait(CBM_FILE HandleDevice, int Line, int State)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+    vdrive_time when;
+    int lines;
+
+    vdrive_transaction(vd);
+    vd->stats.LineOperations++;
+
+    for (;;)
+    {
+        vdrive_run(vd);
+        lines = vdrive_lines(vd);
+
+        if (((lines & Line) != 0) == (State != 0))
+            break;
+
+        when = vdrive_next_event(vd);
+        if (when == 0)
+        {
+            fprintf(stderr, "vdrive: the host waits for a line the drive never changes.\n");
+            break;
+        }
+        vd->now = when;
+    }
+
+    return lines;
+}
+
+
+/*-------------------------------------------------------------------*/
+/*--------- FAST TRANSFER FUNCTIONS ---------------------------------*/
+
+/*! \brief read a block of data with protocol serial-1
+
+ \return
+    The number of bytes actually read.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_s1_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned int size)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return (int) vdrive_fast_read(vd, vdrive_proto_s1, data, size);
+}
+
+/*! \brief write a block of data with protocol serial-1
+
+ \return
+    The number of bytes actually written.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_s1_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsigned int size)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return (int) vdrive_fast_write(vd, vdrive_proto_s1, data, size);
+}
+
+/*! \brief read a block of data with protocol serial-2
+
+ \return
+    The number of bytes actually read.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_s2_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned int size)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return (int) vdrive_fast_read(vd, vdrive_proto_s2, data, size);
+}
+
+/*! \brief write a block of data with protocol serial-2
+
+ \return
+    The number of bytes actually written.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_s2_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsigned int size)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    return (int) vdrive_fast_write(vd, vdrive_proto_s2, data, size);
+}
+
+/*! \brief read a block of data with the parallel protocol of d64copy
+
+ \return
+    The number of bytes actually read.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_pp_dc_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned int size)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    if (!vd->model.parallel)
+        return 0;
+    return (int) vdrive_fast_read(vd, vdrive_proto_pp, data, size);
+}
+
+/*! \brief write a block of data with the parallel protocol of d64copy
+
+ \return
+    The number of bytes actually written.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_pp_dc_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsigned int size)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vdrive_transaction(vd);
+    if (!vd->model.parallel)
+        return 0;
+    return (int) vdrive_fast_write(vd, vdrive_proto_pp, data, size);
+}
+
+/*! \internal \brief Queue a transfer
+
+ \return
+    0 if the transfer was queued, -1 if the queue is full.
+*/
+
+static int
+vdrive_queue(vdrive *vd, int write, int Protocol, unsigned char *data, unsigned int size, int *count)
+{
+    vdrive_queued *q;
+
+    *count = 0;
+    if (vd->queue_len >= VDRIVE_QUEUE_SIZE)
+        return -1;
+
+    q = &vd->queue[vd->queue_len++];
+    q->write = write;
+    q->protocol = Protocol;
+    q->data = data;
+    q->size = size;
+    q->count = count;
+    return 0;
+}
+
+/*! \brief queue a read of a block of data
+
+ \return
+    0 if the read was queued, < 0 on error.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_queue_read_n(CBM_FILE HandleDevice, int Protocol, unsigned char *data, unsigned int size, int *BytesRead)
+{
+    return vdrive_queue((vdrive *) HandleDevice, 0, Protocol, data, size, BytesRead);
+}
+
+/*! \brief queue a write of a block of data
+
+ \return
+    0 if the write was queued, < 0 on error.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_queue_write_n(CBM_FILE HandleDevice, int Protocol, const unsigned char *data, unsigned int size, int *BytesWritten)
+{
+    return vdrive_queue((vdrive *) HandleDevice, 1, Protocol, (unsigned char *) data, size, BytesWritten);
+}
+
+/*! \brief execute the queued transfers
+
+ With the option queue=1, all of them need a single round trip.
+ After a transfer did not complete, the remaining ones are dropped.
+
+ \return
+    0 if all queued transfers succeeded, -1 if any of them failed.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_queue_flush(CBM_FILE HandleDevice)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+    enum vdrive_proto proto;
+    vdrive_queued *q;
+    unsigned int i;
+    int failed = 0;
+
+    for (i = 0; i < vd->queue_len; i++)
+    {
+        q = &vd->queue[i];
+
+        if (i == 0 || !vd->model.queue)
+            vdrive_transaction(vd);
+
+        proto = vdrive_protocol(vd, q->protocol);
+        if (failed || proto == vdrive_proto_none)
+        {
+            failed = 1;
+            continue;
+        }
+
+        if (q->write)
+            *q->count = (int) vdrive_fast_write(vd, proto, q->data, q->size);
+        else
+            *q->count = (int) vdrive_fast_read(vd, proto, q->data, q->size);
+
+        if ((unsigned int) *q->count != q->size)
+            failed = 1;
+    }
+
+    vd->queue_len = 0;
+    return failed ? -1 : 0;
+}
+
+/*! \brief execute a batch of IEC operations
+
+ With the option queue=1, the batch needs a single round trip.
+
+ \return
+    0
+*/
+
+int CBMAPIDECL
+opencbm_plugin_batch_submit(CBM_FILE HandleDevice, opencbm_plugin_batch_op_t *Ops, unsigned int Count)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+    opencbm_plugin_batch_op_t *op;
+    unsigned int i;
+
+    for (i = 0; i < Count; i++)
+    {
+        op = &Ops[i];
+
+        if (i == 0 || !vd->model.queue)
+            vdrive_transaction(vd);
+
+        switch (op->Type)
+        {
+        case opencbm_batch_listen:
+            op->Result = vdrive_listen(vd, op->DeviceAddress, op->SecondaryAddress, 0);
+            break;
+        case opencbm_batch_talk:
+            op->Result = vdrive_talk(vd, op->DeviceAddress, op->SecondaryAddress);
+            break;
+        case opencbm_batch_unlisten:
+            op->Result = vdrive_unlisten(vd);
+            break;
+        case opencbm_batch_untalk:
+            op->Result = vdrive_untalk(vd);
+            break;
+        case opencbm_batch_raw_write:
+            op->Result = vdrive_raw_write(vd, op->Buffer, op->Count);
+            break;
+        case opencbm_batch_raw_read:
+            op->Result = vdrive_raw_read(vd, op->Buffer, op->Count);
+            break;
+        default:
+            op->Result = -1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*! \brief get the counters of the vdrive plugin
+
+ \return
+    0
+*/
+
+int CBMAPIDECL
+opencbm_plugin_vdrive_get_stats(CBM_FILE HandleDevice, opencbm_plugin_vdrive_stats_t *Stats)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    *Stats = vd->stats;
+    Stats->VirtualTime = vd->now;
+    return 0;
+}
+
+/*! \brief let the emulated time pass, as with a sleep of the host
+
+ \return
+    0
+*/
+
+int CBMAPIDECL
+opencbm_plugin_vdrive_sleep(CBM_FILE HandleDevice, unsigned long Microseconds)
+{
+    vdrive *vd = (vdrive *) HandleDevice;
+
+    vd->now += vdrive_us(Microseconds);
+    return 0;
+}
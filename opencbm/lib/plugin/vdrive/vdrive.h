@@ -0,0 +1,264 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*! **************************************************************
+** \file lib/plugin/vdrive/vdrive.h \n
+** \n
+** \brief Virtual drive plugin: definitions shared by its files
+**
+****************************************************************/
+
+#ifndef VDRIVE_H
+#define VDRIVE_H
+
+#include "opencbm.h"
+#include "opencbm-plugin.h"
+
+/*! The emulated time, in ns */
+typedef unsigned long long vdrive_time;
+
+/*! \brief The latency model
+
+ All values are in ns. They are set from the options given with
+ the port, see vdrive_model_parse().
+*/
+typedef struct vdrive_model
+{
+    vdrive_time transaction; /*!< one round trip between host and adapter */
+    vdrive_time atn;         /*!< one LISTEN, TALK, UNLISTEN or UNTALK */
+    vdrive_time iec_byte;    /*!< one byte with the standard IEC protocol */
+    vdrive_time s1_byte;     /*!< one byte with serial-1 */
+    vdrive_time s2_byte;     /*!< one byte with serial-2 */
+    vdrive_time pp_byte;     /*!< one byte with the parallel cable */
+    vdrive_time revolution;  /*!< one revolution of the disk */
+    vdrive_time step;        /*!< moving the head by one track */
+    vdrive_time reset;       /*!< the drive starting after a RESET */
+    vdrive_time cycle;       /*!< one cycle of the drive CPU */
+    int queue;               /*!< queued transfers and batches need one round trip */
+    int parallel;            /*!< there is a XP1541 cable */
+    unsigned char unit;      /*!< the device number of the drive */
+    int drive;               /*!< the drive to emulate, as 1541; 0 to choose it by the image */
+} vdrive_model;
+
+/*! A zone of tracks with the same number of sectors */
+typedef struct vdrive_zone
+{
+    int last_track;          /*!< the last track of the zone, on the first side */
+    int sectors;             /*!< the number of sectors of each track */
+} vdrive_zone;
+
+/*! \brief A disk image format
+
+ On two sided disks, the tracks of the second side follow the ones of
+ the first side, with the same zones.
+*/
+typedef struct vdrive_format
+{
+    const char *name;        /*!< the usual extension of the image files */
+    int tracks;              /*!< the number of tracks */
+    int blocks;              /*!< the number of blocks */
+    int side_tracks;         /*!< the number of tracks of one side */
+    const vdrive_zone *zones; /*!< the zones, ending with the last track of the drive */
+    int drive;               /*!< the drive this format is made for */
+} vdrive_format;
+
+/*! A drive model, and what the tools see of it */
+typedef struct vdrive_drive
+{
+    int model;               /*!< the model number, as 1541 */
+    const char *dos;         /*!< the text of status 73 */
+    unsigned char footprint[2]; /*!< the ROM bytes at $FF40 */
+    unsigned int ram_size;   /*!< the size of the RAM, from $0000 on */
+    unsigned int pp_port;    /*!< the data register of the parallel port, 0 if there is none */
+    int dir_track;           /*!< the track the head goes to on initialisation */
+    int sides;               /*!< the number of sides */
+    int track_cache;         /*!< the drive reads whole tracks into a cache */
+    const vdrive_zone *zones; /*!< the zones of its disks */
+} vdrive_drive;
+
+/* the bits of the 1541 serial port at $1800, as seen by the drive */
+#define PORT_DATA_IN   0x01 /*!< DATA is active */
+#define PORT_DATA_OUT  0x02 /*!< the drive pulls DATA */
+#define PORT_CLK_IN    0x04 /*!< CLOCK is active */
+#define PORT_CLK_OUT   0x08 /*!< the drive pulls CLOCK */
+#define PORT_ATNA      0x10 /*!< ATN acknowledge */
+#define PORT_ATN_IN    0x80 /*!< ATN is active */
+
+/*! The protocols of the transfer routines at $0700 */
+enum vdrive_proto
+{
+    vdrive_proto_none = 0,
+    vdrive_proto_s1,
+    vdrive_proto_s2,
+    vdrive_proto_pp
+};
+
+/*! The main programs at $0500 */
+enum vdrive_prog
+{
+    vdrive_prog_turboread,
+    vdrive_prog_turbowrite,
+    vdrive_prog_warpread,
+    vdrive_prog_warpwrite,
+    vdrive_prog_libtrans     /*!< the main loop of libtrans, at $0500 or $0400 */
+};
+
+/*! The size of a GCR encoded data block, as the warp programs transfer it */
+#define VDRIVE_GCR_SIZE   325
+
+/*! Room for the bytes received by the drive before they are processed */
+#define VDRIVE_IN_SIZE    (2 * VDRIVE_GCR_SIZE)
+
+/*! Room for the bytes the drive is going to send */
+#define VDRIVE_OUT_SIZE   (2 * (2 + VDRIVE_GCR_SIZE + 1))
+
+/*! The most sectors on a track */
+#define VDRIVE_MAX_SECTORS 40
+
+/*! \brief A program running in the drive, instead of the DOS
+
+ The main program decides what to transfer, in bytes as they go over
+ the bus (that is, in pairs with the parallel cable). The transfer
+ routine moves them, either a whole byte at once for the *_read_n()
+ and *_write_n() functions, or bit by bit following the line changes
+ of the host.
+*/
+typedef struct vdrive_session
+{
+    enum vdrive_proto proto;  /*!< the transfer routine; none if the DOS is running */
+    enum vdrive_prog  prog;   /*!< the main program */
+    int state;                /*!< the state of the main program */
+    int line_state;           /*!< the state of the transfer routine */
+    int bits;                 /*!< bits (or pairs of bits) done of the current byte */
+    unsigned char shift;      /*!< the byte being transferred */
+
+    unsigned char in[VDRIVE_IN_SIZE];   /*!< the bytes received */
+    unsigned int in_len;                /*!< the number of bytes received */
+    unsigned int in_need;               /*!< the number of bytes the program waits for */
+
+    unsigned char out[VDRIVE_OUT_SIZE]; /*!< the bytes to be sent */
+    unsigned int out_len;               /*!< the number of bytes to be sent */
+    unsigned int out_pos;               /*!< the next byte to be sent */
+    vdrive_time ready;                  /*!< the bytes cannot be sent before this time */
+
+    int track;                /*!< the current track */
+    int sector;               /*!< the current sector */
+    int count;                /*!< warp read: sectors still to be sent */
+    unsigned char map[VDRIVE_MAX_SECTORS]; /*!< warp read: 0 for the sectors wanted */
+
+    int command;              /*!< libtrans: the command being executed */
+    unsigned int address;     /*!< libtrans: the page of memory to transfer */
+    unsigned int offset;      /*!< libtrans: the first byte of the page to transfer */
+} vdrive_session;
+
+/*! A channel of the DOS */
+typedef struct vdrive_channel
+{
+    int buffer;               /*!< the buffer of the channel, -1 if it is closed */
+    int pos;                  /*!< the buffer pointer */
+} vdrive_channel;
+
+/*! The number of 256 byte buffers in the drive RAM */
+#define VDRIVE_BUFFERS     5
+
+/*! The size of the largest drive RAM */
+#define VDRIVE_RAM_SIZE    0x2000
+
+/*! A transfer queued with opencbm_plugin_queue_read_n() or opencbm_plugin_queue_write_n() */
+typedef struct vdrive_queued
+{
+    int write;                /*!< the host writes */
+    int protocol;             /*!< one of enum opencbm_plugin_protocol_e */
+    unsigned char *data;      /*!< the data */
+    unsigned int size;        /*!< the number of bytes */
+    int *count;               /*!< receives the number of bytes transferred */
+} vdrive_queued;
+
+/*! The number of transfers which can be queued */
+#define VDRIVE_QUEUE_SIZE  16
+
+/*! The state of an opened virtual drive */
+typedef struct vdrive
+{
+    vdrive_model model;       /*!< the latency model */
+    vdrive_time now;          /*!< the emulated time */
+    vdrive_time dos_ready;    /*!< the DOS is busy until then */
+    opencbm_plugin_vdrive_stats_t stats; /*!< the counters */
+
+    const vdrive_drive *drive; /*!< the drive model */
+    const vdrive_format *format; /*!< the format of the disk image */
+    char *filename;           /*!< the disk image */
+    unsigned char *image;     /*!< the blocks of the disk image */
+    unsigned char *errors;    /*!< the job code of each block, NULL if all are OK */
+    int tracks;               /*!< the number of tracks of the image */
+    int blocks;               /*!< the number of blocks of the image */
+    int dirty;                /*!< the image has to be written back */
+    int write_protect;        /*!< the image cannot be written back */
+    int head;                 /*!< the cylinder the head is on */
+    int cached_track;         /*!< the track in the track cache, 0 for none */
+
+    unsigned char ram[VDRIVE_RAM_SIZE]; /*!< the drive RAM */
+
+    int host_lines;           /*!< the IEC lines the host pulls */
+    int port;                 /*!< the lines the drive pulls, as written to $1800 */
+    unsigned char pp_host;    /*!< the last value written to the parallel port by the host */
+    unsigned char pp_drive;   /*!< the value written to the parallel port by the drive */
+    int pp_drive_output;      /*!< the parallel port of the drive is an output */
+
+    int listening;            /*!< the channel the drive listens on, -1 for none */
+    int talking;              /*!< the channel the drive talks on, -1 for none */
+    int opening;              /*!< the data after LISTEN is a file name */
+    int eoi;                  /*!< the last byte read had EOI */
+    unsigned char cmd[0x80];  /*!< the command or file name received */
+    unsigned int cmd_len;     /*!< the length of cmd */
+    unsigned char reply[0x102]; /*!< what the command channel sends */
+    unsigned int reply_len;   /*!< the length of reply */
+    unsigned int reply_pos;   /*!< the next byte of reply to be sent */
+    vdrive_channel channel[15]; /*!< the data channels */
+    int buffer_used[VDRIVE_BUFFERS]; /*!< the buffers which are allocated */
+
+    vdrive_queued queue[VDRIVE_QUEUE_SIZE]; /*!< the queued transfers */
+    unsigned int queue_len;   /*!< the number of queued transfers */
+
+    vdrive_session session;   /*!< the program running in the drive */
+} vdrive;
+
+/* vdrive.c */
+extern int  vdrive_lines(vdrive *vd);
+extern int  vdrive_model_parse(vdrive_model *model, const char *options);
+
+/* dos.c */
+extern int  vdrive_image_open(vdrive *vd, const char *filename);
+extern void vdrive_image_close(vdrive *vd);
+extern int  vdrive_sector_count(vdrive *vd, int track);
+extern int  vdrive_cylinder(vdrive *vd, int track);
+extern vdrive_time vdrive_seek(vdrive *vd, vdrive_time when, int track);
+extern vdrive_time vdrive_sector_start(vdrive *vd, vdrive_time when, int track, int sector);
+extern int  vdrive_sector_error(vdrive *vd, int track, int sector);
+extern int  vdrive_read_sector(vdrive *vd, int track, int sector, unsigned char *data);
+extern int  vdrive_write_sector(vdrive *vd, int track, int sector, const unsigned char *data, int jobcode);
+extern void vdrive_dos_reset(vdrive *vd);
+extern void vdrive_dos_listen(vdrive *vd, int channel, int opening);
+extern int  vdrive_dos_write(vdrive *vd, const unsigned char *data, size_t count);
+extern void vdrive_dos_unlisten(vdrive *vd);
+extern void vdrive_dos_talk(vdrive *vd, int channel);
+extern int  vdrive_dos_read(vdrive *vd, unsigned char *data, size_t count);
+extern void vdrive_dos_close(vdrive *vd, int channel);
+extern unsigned char vdrive_peek(vdrive *vd, unsigned int address);
+extern void vdrive_poke(vdrive *vd, unsigned int address, unsigned char value);
+
+/* drivecode.c */
+extern int  vdrive_exec(vdrive *vd, unsigned int address);
+extern void vdrive_run(vdrive *vd);
+extern vdrive_time vdrive_next_event(vdrive *vd);
+extern unsigned int vdrive_fast_read(vdrive *vd, enum vdrive_proto proto, unsigned char *data, unsigned int size);
+extern unsigned int vdrive_fast_write(vdrive *vd, enum vdrive_proto proto, const unsigned char *data, unsigned int size);
+extern void vdrive_gcr_encode(const unsigned char *block, unsigned char *gcr, int jobcode);
+extern int  vdrive_gcr_decode(const unsigned char *gcr, unsigned char *block);
+
+#endif // #ifndef VDRIVE_H
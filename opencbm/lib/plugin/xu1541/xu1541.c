@@ -33,9 +33,25 @@
 static int debug_level = -10000; /*!< \internal \brief the debugging level for debugging output */
 static usb_dev_handle *xu1541_handle = NULL; /*!< \internal \brief handle to the xu1541 device */
 
-/*! \brief timeout value, used mainly after errors \todo What is the exact purpose of this? */
+/*! \brief the longest wait between two requests for the result of a command */
 #define TIMEOUT_DELAY  25000   // 25ms
 
+/*! \brief the shortest wait between two requests for the result of a command */
+#define MIN_DELAY      100
+
+/*! \brief requests for the result which are sent without any wait in between */
+#define IMMEDIATE_POLLS  2
+
+static xu1541_transport transport = NULL; /*!< \internal \brief replacement for usb_control_msg(), if any */
+static xu1541_stats stats; /*!< \internal \brief what happened since the device was opened */
+
+/*! \internal \brief an UNTALK or UNLISTEN whose result has not been collected yet, or 0 */
+static unsigned int pending_cmd = 0;
+/*! \internal \brief the time at which pending_cmd was sent */
+static unsigned long pending_start;
+/*! \internal \brief the UNTALK or UNLISTEN sent last, if nothing else happened afterwards */
+static unsigned int last_release = 0;
+
 /*! \internal \brief Output debugging information for the xu1541
 
  \param level
@@ -66,6 +82,186 @@ static void xu1541_dbg(int level, char *msg, ...)
     }
 }
 
+/*! \internal \brief send a control message to the xu1541
+
+ The parameters are the ones of usb_control_msg(), without the handle.
+ The message goes to the transport set with xu1541_set_transport(), if
+ there is one.
+*/
+static int xu1541_control_msg(int requesttype, int request, int value,
+                              int index, char *bytes, int size, int timeout)
+{
+    stats.messages++;
+
+    if(transport)
+        return transport(xu1541_handle, requesttype, request, value, index,
+                         bytes, size, timeout);
+
+    return usb.control_msg(xu1541_handle, requesttype, request, value, index,
+                           bytes, size, timeout);
+}
+
+/*! \internal \brief the histogram bucket of a completion time
+
+ \param us
+   The completion time, in microseconds
+
+ \return
+   The index of the bucket
+*/
+static int xu1541_bucket(unsigned long us)
+{
+    int bucket = 0;
+
+    while(bucket < XU1541_HISTOGRAM_BUCKETS - 1 && us >= (64ul << bucket))
+        bucket++;
+
+    return bucket;
+}
+
+/*! \internal \brief the usual completion time of a kind of command
+
+ \param cls
+   The kind of command, XU1541_POLL_*
+
+ \return
+   The lower bound of the bucket which contains the median of the
+   completion times seen so far, 0 if there are none.
+*/
+static unsigned long xu1541_expected_us(int cls)
+{
+    unsigned long *histogram = stats.histogram[cls];
+    unsigned long count = 0, sum = 0;
+    int bucket;
+
+    for(bucket = 0; bucket < XU1541_HISTOGRAM_BUCKETS; bucket++)
+        count += histogram[bucket];
+
+    for(bucket = 0; bucket < XU1541_HISTOGRAM_BUCKETS; bucket++)
+    {
+        sum += histogram[bucket];
+        if(sum * 2 >= count && count)
+            return bucket ? 64ul << (bucket - 1) : 0;
+    }
+    return 0;
+}
+
+/*! \internal \brief wait for the result of a command
+
+ While the xu1541 does the work on the IEC bus, it does not answer on
+ USB. The result is asked for at once a few times, for the commands
+ which are done quickly, then after the time these kind of commands
+ usually take, and from then on, with longer and longer waits in between.
+
+ \param cls
+   The kind of command, XU1541_POLL_*
+
+ \param expected
+   The state the xu1541 reports when the command is done
+
+ \param rv
+   Gets the state and the result byte
+
+ \param start
+   The arch_time_us() at which the command was sent
+
+ \return
+   0 on success, -1 if the xu1541 did not report the expected state
+   in time.
+*/
+static int xu1541_wait_result(int cls, unsigned char expected,
+                              unsigned char rv[2], unsigned long start)
+{
+    unsigned long expected_us = xu1541_expected_us(cls);
+    unsigned long delay = (expected_us / 8 > MIN_DELAY) ? expected_us / 8 : MIN_DELAY;
+    int polls;
+
+    for(polls = 0; ; polls++)
+    {
+        unsigned long elapsed, wait;
+
+        stats.polls++;
+
+        if(xu1541_control_msg(USB_TYPE_CLASS | USB_ENDPOINT_IN,
+                              XU1541_GET_RESULT, 0, 0,
+                              (char*)rv, 2, 1000) == 2)
+        {
+            if(rv[0] == expected)
+            {
+                elapsed = arch_time_us() - start;
+                stats.histogram[cls][xu1541_bucket(elapsed)]++;
+                xu1541_dbg(3, "result %d after %lu us, %d polls",
+                           rv[1], elapsed, polls + 1);
+                errno = 0;
+                return 0;
+            }
+            xu1541_dbg(3, "unexpected result (%d/%d)", rv[0], rv[1]);
+        }
+        else
+        {
+            xu1541_dbg(3, "usb timeout");
+        }
+
+        elapsed = arch_time_us() - start;
+        if(elapsed > USB_TIMEOUT * 1000ul)
+        {
+            fprintf(stderr, "xu1541: no result after %lu ms\n",
+                    elapsed / 1000);
+            return -1;
+        }
+
+        if(polls < IMMEDIATE_POLLS - 1)
+            continue;
+
+        wait = delay;
+        if(expected_us > elapsed && expected_us - elapsed > wait)
+            wait = expected_us - elapsed;
+        else if(delay < TIMEOUT_DELAY)
+            delay = (delay * 2 < TIMEOUT_DELAY) ? delay * 2 : TIMEOUT_DELAY;
+
+        stats.sleeps++;
+        stats.slept_us += wait;
+        arch_usleep(wait);
+    }
+}
+
+/*! \internal \brief collect the result of a deferred UNTALK or UNLISTEN
+
+ This has to be done before anything else is sent to the xu1541.
+
+ \return
+   0 on success, -1 if the xu1541 did not answer.
+*/
+static int xu1541_complete_pending(void)
+{
+    unsigned char rv[2];
+
+    if(!pending_cmd)
+        return 0;
+
+    pending_cmd = 0;
+
+    if(xu1541_wait_result(XU1541_POLL_ATN, XU1541_IO_RESULT, rv,
+                          pending_start) < 0)
+        return -1;
+
+    if(rv[1])
+        xu1541_dbg(1, "deferred UNTALK/UNLISTEN failed");
+
+    return 0;
+}
+
+/*! \internal \brief prepare the xu1541 for the next command
+
+ \return
+   0 on success, -1 if the xu1541 did not answer.
+*/
+static int xu1541_begin(void)
+{
+    last_release = 0;
+    return xu1541_complete_pending();
+}
+
 /*! \internal \brief @@@@@ \todo document
 
  \param dev
@@ -207,8 +403,11 @@ int xu1541_init(void) {
   }
 
   /* check the devices version number as firmware x.06 changed everything */
-  len = usb.control_msg(xu1541_handle, 
-	   USB_TYPE_CLASS | USB_ENDPOINT_IN, 
+  memset(&stats, 0, sizeof(stats));
+  pending_cmd = 0;
+  last_release = 0;
+
+  len = xu1541_control_msg(USB_TYPE_CLASS | USB_ENDPOINT_IN, 
 	   XU1541_INFO, 0, 0, (char*)ret, sizeof(ret), 1000);
 
   if(len < 0) {
@@ -242,8 +441,22 @@ int xu1541_init(void) {
 */
 void xu1541_close(void)
 {
+    int cls, bucket;
+
     xu1541_dbg(0, "Closing USB link");
 
+    xu1541_complete_pending();
+
+    xu1541_dbg(1, "%lu messages, %lu result polls, %lu waits of %lu us, "
+	       "%lu deferred, %lu coalesced", stats.messages, stats.polls,
+	       stats.sleeps, stats.slept_us, stats.deferred, stats.coalesced);
+
+    for(cls = 0; cls < XU1541_POLL_CLASSES; cls++)
+	for(bucket = 0; bucket < XU1541_HISTOGRAM_BUCKETS; bucket++)
+	    if(stats.histogram[cls][bucket])
+		xu1541_dbg(2, "kind %d: %lu done below %lu us", cls,
+			   stats.histogram[cls][bucket], 64ul << bucket);
+
     if(usb.release_interface(xu1541_handle, 0))
       fprintf(stderr, "USB error: %s\n", usb.strerror());
 
@@ -262,10 +475,13 @@ void xu1541_close(void)
    The (IEC) secondary address to use
 
  \return
-   Depends upon the IOCTL.
+   Depends upon the IOCTL; -1 if the xu1541 did not answer.
 
- \todo
-   Rework for cleaner structure. Currently, this is a mess!
+ \remark
+   The result of an UNTALK or UNLISTEN is not waited for, it is
+   collected when the next command is sent. An UNTALK or UNLISTEN
+   which directly follows the same command is not sent at all, as
+   nobody is on the bus anymore.
 */
 int xu1541_ioctl(unsigned int cmd, unsigned int addr, unsigned int secaddr)
 {
@@ -274,6 +490,19 @@ int xu1541_ioctl(unsigned int cmd, unsigned int addr, unsigned int secaddr)
 
   xu1541_dbg(1, "ioctl %d for device %d, sub %d", cmd, addr, secaddr);
 
+  if((cmd == XU1541_UNTALK) || (cmd == XU1541_UNLISTEN))
+  {
+      if(cmd == last_release)
+      {
+	  xu1541_dbg(2, "bus already released");
+	  stats.coalesced++;
+	  return 0;
+      }
+  }
+
+  if(xu1541_begin() < 0)
+      return -1;
+
   /* some commands are being handled asynchronously, namely the ones that */
   /* send a iec byte. These need to ask for the result with a seperate */
   /* command */
@@ -281,76 +510,47 @@ int xu1541_ioctl(unsigned int cmd, unsigned int addr, unsigned int secaddr)
      (cmd == XU1541_LISTEN) || (cmd == XU1541_UNLISTEN) ||
      (cmd == XU1541_OPEN)   || (cmd == XU1541_CLOSE)) 
   {
-      int link_ok = 0, err = 0;
-
-      /* USB_TIMEOUT msec timeout required for reset */
-      if((nBytes = usb.control_msg(xu1541_handle, 
-				   USB_TYPE_CLASS | USB_ENDPOINT_IN, 
-				   cmd, (secaddr << 8) + addr, 0, 
-				   NULL, 0, 
-				   1000)) < 0) 
+      unsigned char rv[2];
+      unsigned long start = arch_time_us();
+
+      if((nBytes = xu1541_control_msg(USB_TYPE_CLASS | USB_ENDPOINT_IN, 
+				      cmd, (secaddr << 8) + addr, 0, 
+				      NULL, 0, 
+				      1000)) < 0) 
       {
 	  fprintf(stderr, "USB error in xu1541_ioctl(async): %s\n", 
 		  usb.strerror());
-	  exit(-1);
 	  return -1;
       }
 
-      /* wait for USB to become available again by requesting the result */
-      do 
+      if((cmd == XU1541_UNTALK) || (cmd == XU1541_UNLISTEN))
       {
-	  unsigned char rv[2];
-	  
-	  /* request async result code */
-	  if(usb.control_msg(xu1541_handle, 
-			     USB_TYPE_CLASS | USB_ENDPOINT_IN, 
-			     XU1541_GET_RESULT, 0, 0, 
-			     (char*)rv, sizeof(rv), 
-			     1000) == sizeof(rv)) 
-	  {
-	      /* we got a valid result */
-	      if(rv[0] == XU1541_IO_RESULT) 
-	      {
-		  /* use that result */
-		  nBytes = sizeof(rv)-1;
-		  ret[0] = rv[1];
-		  /* a returned byte means that the USB link is fine */
-		  link_ok = 1;
-		  errno = 0;
-	      } 
-	      else 
-	      {
-		  xu1541_dbg(3, "unexpected result (%d/%d)", rv[0], rv[1]);
-
-		  /* not the expected result */
-		  arch_usleep(TIMEOUT_DELAY);
-	      }
-	  } 
-	  else 
-	  {
-	      xu1541_dbg(3, "usb timeout");
-
-	      /* count the error states (just out of couriosity) */
-	      err++;
-
-	      arch_usleep(TIMEOUT_DELAY);
-	  }
-      } 
-      while(!link_ok);
+	  /* nobody waits for the bus to be released */
+	  pending_cmd = cmd;
+	  pending_start = start;
+	  last_release = cmd;
+	  stats.deferred++;
+	  return 0;
+      }
+
+      /* wait for USB to become available again by requesting the result */
+      if(xu1541_wait_result(XU1541_POLL_ATN, XU1541_IO_RESULT, rv, start) < 0)
+	  return -1;
+
+      nBytes = sizeof(rv)-1;
+      ret[0] = rv[1];
   } 
   else 
   {
 
       /* sync transfer, read result directly */
-      if((nBytes = usb.control_msg(xu1541_handle, 
-		   USB_TYPE_CLASS | USB_ENDPOINT_IN, 
-		   cmd, (secaddr << 8) + addr, 0, 
-		   ret, sizeof(ret), 
-		   USB_TIMEOUT)) < 0) 
+      if((nBytes = xu1541_control_msg(USB_TYPE_CLASS | USB_ENDPOINT_IN, 
+				      cmd, (secaddr << 8) + addr, 0, 
+				      ret, sizeof(ret), 
+				      USB_TIMEOUT)) < 0) 
       {
 	  fprintf(stderr, "USB error in xu1541_ioctl(sync): %s\n", 
 		  usb.strerror());
-	  exit(-1);
 	  return -1;
       }
   }
@@ -374,7 +574,7 @@ int xu1541_ioctl(unsigned int cmd, unsigned int addr, unsigned int secaddr)
     The length of the data buffer to be written to the xu1541
 
  \return
-    The number of bytes written
+    The number of bytes written, -1 if the xu1541 did not answer.
 */
 int xu1541_write(const unsigned char *data, size_t len) 
 {
@@ -382,67 +582,42 @@ int xu1541_write(const unsigned char *data, size_t len)
 
     xu1541_dbg(1, "write %d bytes from address %p", len, data);
 
+    if(xu1541_begin() < 0)
+	return -1;
+
     while(len) 
     {
-        int link_ok = 0, err = 0;
-        int wr, bytes2write;
+	unsigned char rv[2];
+	unsigned long start = arch_time_us();
+	int wr, bytes2write;
 	bytes2write = (len > XU1541_IO_BUFFER_SIZE)?XU1541_IO_BUFFER_SIZE:len;
-	
+
 	/* the write itself moved the data into the buffer, the actual */
 	/* iec write is triggered _after_ this USB write is done */
-	if((wr = usb.control_msg(xu1541_handle, 
-				 USB_TYPE_CLASS | USB_ENDPOINT_OUT, 
-				 XU1541_WRITE, bytes2write, 0, 
-				 (char*)data, bytes2write, 
-				 USB_TIMEOUT)) < 0) 
+	if((wr = xu1541_control_msg(USB_TYPE_CLASS | USB_ENDPOINT_OUT, 
+				    XU1541_WRITE, bytes2write, 0, 
+				    (char*)data, bytes2write, 
+				    USB_TIMEOUT)) < 0) 
 	{
 	    fprintf(stderr, "USB error xu1541_write(): %s\n", usb.strerror());
-	    exit(-1);
 	    return -1;
 	}
-	
+
 	len -= wr;
 	data += wr;
 	bytesWritten += wr;
 
 	xu1541_dbg(2, "wrote chunk of %d bytes, total %d, left %d", 
 		   wr, bytesWritten, len);
- 
+
 	/* wait for USB to become available again by requesting the result */
-	do 
-	{
-	    unsigned char rv[2];
-
-	    /* request async result */
-	    if(usb.control_msg(xu1541_handle, 
-			       USB_TYPE_CLASS | USB_ENDPOINT_IN, 
-			       XU1541_GET_RESULT, 0, 0, 
-			       (char*)rv, sizeof(rv), 
-			       1000) == sizeof(rv)) 
-	    {
-	        /* the USB link is available again if we got a valid result */
-	        if(rv[0] == XU1541_IO_RESULT) {
-		    /* device reports failure, stop writing */
-		    if(!rv[1])
-		        len = 0;
-
-		    link_ok = 1;
-		    errno = 0;
-		} 
-		else
-		{
-		    xu1541_dbg(3, "unexpected result (%d/%d)", rv[0], rv[1]);
-		    arch_usleep(TIMEOUT_DELAY);
-		}
-	    } 
-	    else 
-	    {
-	        xu1541_dbg(3, "usb timeout");
-	        /* count the error states (just out of couriosity) */
-	        err++;
-	    }
-	} 
-	while(!link_ok);
+	if(xu1541_wait_result(XU1541_POLL_WRITE, XU1541_IO_RESULT, rv,
+			      start) < 0)
+	    return -1;
+
+	/* device reports failure, stop writing */
+	if(!rv[1])
+	    len = 0;
     }
     return bytesWritten;
 }
@@ -456,35 +631,36 @@ int xu1541_write(const unsigned char *data, size_t len)
     The number of bytes to read from the xu1541
 
  \return
-    The number of bytes read
+    The number of bytes read, -1 if the xu1541 did not answer.
 */
 int xu1541_read(unsigned char *data, size_t len) 
 {
     int bytesRead = 0;
-    
+
     xu1541_dbg(1, "read %d bytes to address %p", len, data);
-    
+
+    if(xu1541_begin() < 0)
+	return -1;
+
     while(len > 0) 
     {
 	int rd, bytes2read;
-	int link_ok = 0, err = 0;
 	unsigned char rv[2];
-	  
+	unsigned long start = arch_time_us();
+
 	/* limit transfer size */
 	bytes2read = (len > XU1541_IO_BUFFER_SIZE)?XU1541_IO_BUFFER_SIZE:len;
 
 	/* request async read, ignore errors as they happen due to */
 	/* link being disabled */
-	rd = usb.control_msg(xu1541_handle, 
-			USB_TYPE_CLASS | USB_ENDPOINT_IN, 
-			XU1541_REQUEST_READ, bytes2read, 0, 
-			NULL, 0,
-			1000);
-	
+	rd = xu1541_control_msg(USB_TYPE_CLASS | USB_ENDPOINT_IN, 
+				XU1541_REQUEST_READ, bytes2read, 0, 
+				NULL, 0,
+				1000);
+
 	if(rd < 0) {
 	    fprintf(stderr, "USB error in xu1541_request_read(): %s\n", 
 		    usb.strerror());
-	    exit(-1);
 	    return -1;
 	}
 
@@ -499,63 +675,29 @@ int xu1541_read(unsigned char *data, size_t len)
 	xu1541_dbg(2, "sent request for %d bytes, waiting for result", 
 		   bytes2read);
 
-	do 
-	{
-	    /* get the result code which also contains the current state */
-	    /* the xu1541 is in so we know when it's done reading on IEC */
-	    if((rd = usb.control_msg(xu1541_handle, 
-				     USB_TYPE_CLASS | USB_ENDPOINT_IN, 
-				     XU1541_GET_RESULT, 0, 0, 
-				     (char*)rv, sizeof(rv), 
-				     1000)) == sizeof(rv)) 
-	    {
-	        xu1541_dbg(2, "got result %d/%d", rv[0], rv[1]);
-	      
-		// if the first byte is still not XU1541_IO_READ_DONE,
-	        // then the device hasn't even entered the copy routine yet, 
-	        // so sleep to not slow it down by overloading it with USB 
-	        // requests
-	        if(rv[0] != XU1541_IO_READ_DONE) 
-		{
-		    xu1541_dbg(3, "unexpected result");
-		    arch_usleep(TIMEOUT_DELAY);
-		} 
-		else
-		{
-		    xu1541_dbg(3, "link ok");
-
-	            link_ok = 1;
-		    errno = 0;
-		}
-	    } 
-	    else 
-	    {
-		xu1541_dbg(3, "usb timeout");
-
-		/* count the error states (just out of couriosity) */
-		err++;
-	    }
-	} 
-	while(!link_ok);
-	
+	/* the result code also contains the current state the xu1541 */
+	/* is in, so we know when it's done reading on IEC */
+	if(xu1541_wait_result(XU1541_POLL_READ, XU1541_IO_READ_DONE, rv,
+			      start) < 0)
+	    return -1;
+
 	/* finally read data itself */
-	if((rd = usb.control_msg(xu1541_handle, 
-				 USB_TYPE_CLASS | USB_ENDPOINT_IN, 
-				 XU1541_READ, bytes2read, 0, 
-				 (char*)data, bytes2read, 1000)) < 0) 
+	if((rd = xu1541_control_msg(USB_TYPE_CLASS | USB_ENDPOINT_IN, 
+				    XU1541_READ, bytes2read, 0, 
+				    (char*)data, bytes2read, 1000)) < 0) 
 	{
 	    fprintf(stderr, "USB error in xu1541_read(): %s\n", 
 		    usb.strerror());
 	    return -1;
 	}
-	
+
 	len -= rd;
 	data += rd;
 	bytesRead += rd;
 
 	xu1541_dbg(2, "received chunk of %d bytes, total %d, left %d", 
 		   rd, bytesRead, len);
-	
+
 	/* force end of read */
 	if(rd < bytes2read) 
 	    len = 0;
@@ -592,14 +734,16 @@ int xu1541_special_write(int mode, const unsigned char *data, size_t size)
     xu1541_dbg(1, "special write %d %d bytes from address %p", 
 	       mode, size, data);
 
+    if(xu1541_begin() < 0)
+	return -1;
+
     while(size > 0) 
     {
 	int wr, bytes2write = (size>128)?128:size;
 
-	if((wr = usb.control_msg(xu1541_handle, 
-				 USB_TYPE_CLASS | USB_ENDPOINT_OUT, 
-				 mode, XU1541_WRITE, bytes2write, 
-				 (char*)data, bytes2write, 1000)) < 0) 
+	if((wr = xu1541_control_msg(USB_TYPE_CLASS | USB_ENDPOINT_OUT, 
+				    mode, XU1541_WRITE, bytes2write, 
+				    (char*)data, bytes2write, 1000)) < 0) 
 	{
 	    fprintf(stderr, "USB error in xu1541_special_write(): %s\n", 
 		    usb.strerror());
@@ -640,15 +784,17 @@ int xu1541_special_read(int mode, unsigned char *data, size_t size)
     xu1541_dbg(1, "special read %d %d bytes to address %p", 
 	       mode, size, data);
 
+    if(xu1541_begin() < 0)
+	return -1;
+
     while(size > 0) 
     {
 	int rd, bytes2read = (size>128)?128:size;
 	
-	if((rd = usb.control_msg(xu1541_handle, 
-				 USB_TYPE_CLASS | USB_ENDPOINT_IN, 
-				 mode, XU1541_READ, bytes2read, 
-				 (char*)data, bytes2read, 
-				 USB_TIMEOUT)) < 0) 
+	if((rd = xu1541_control_msg(USB_TYPE_CLASS | USB_ENDPOINT_IN, 
+				    mode, XU1541_READ, bytes2read, 
+				    (char*)data, bytes2read, 
+				    USB_TIMEOUT)) < 0) 
 	{
 	    fprintf(stderr, "USB error in xu1541_special_read(): %s\n", 
 		    usb.strerror());
@@ -668,3 +814,386 @@ int xu1541_special_read(int mode, unsigned char *data, size_t size)
     
     return bytesRead;
 }
+
+/*! \brief send all control messages to another transport
+
+ \param new_transport
+    The function to be called instead of usb_control_msg(), or NULL
+    for the USB device itself.
+
+ \remark
+    This allows running the access routines against a simulation of
+    the xu1541, to count and time the messages each command needs.
+*/
+void xu1541_set_transport(xu1541_transport new_transport)
+{
+    transport = new_transport;
+}
+
+/*! \brief get the statistics of the access routines
+
+ \param s
+    Gets the statistics collected since the device was opened.
+*/
+void xu1541_get_stats(xu1541_stats *s)
+{
+    *s = stats;
+}
+
+/* #define OPENCBM_STANDALONE_TEST 1 */
+
+#ifdef OPENCBM_STANDALONE_TEST
+
+/*
+ * Test of the waits for the results, of the deferred UNTALK and UNLISTEN
+ * and of the error handling, against a simulated xu1541. The control
+ * messages go to a model of the firmware through xu1541_set_transport(),
+ * which does not answer while it is busy on the IEC bus, just as the real
+ * one does. arch_time_us() is replaced with a simulated clock which
+ * advances with every message and every wait, so the waits are the same
+ * on every run.
+ *
+ * Build it in this directory after the libraries with e.g.
+ *   cc -DOPENCBM_STANDALONE_TEST -I../../../include -I../../../include/LINUX \
+ *      -I../../../libmisc -I../../../../xu1541/include -o xu1541-test \
+ *      xu1541.c -L../../../libmisc -lmisc -lusb -ldl
+ */
+
+/* the time each control message takes */
+#define SIM_MESSAGE_US  20
+
+#define SIM_MAX_MESSAGES  1024
+
+static struct {
+    unsigned long clock;
+    unsigned long slept_us;
+
+    /* how long the IEC part of a command takes, and when it is done */
+    unsigned long busy_us;
+    unsigned long ready;
+
+    /* the state and result byte reported when the command is done */
+    int busy;
+    unsigned char state, result;
+
+    /* never report a result */
+    int dead;
+
+    /* this request fails on USB, 0 for none */
+    int fail;
+
+    /* messages sent while the result of the last command was not collected */
+    unsigned int overrun;
+
+    /* the requests, and the wait before each of them */
+    int request[SIM_MAX_MESSAGES];
+    unsigned long wait[SIM_MAX_MESSAGES];
+    unsigned int messages;
+
+    unsigned char out[1024];
+    unsigned int outLen;
+
+    /* the bytes read so far */
+    unsigned int inLen;
+} sim;
+
+static int test_failures;
+
+#define TEST_CHECK(_cond) \
+    do { \
+        if (!(_cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", \
+                __FILE__, __LINE__, #_cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+unsigned long arch_time_us(void)
+{
+    return sim.clock;
+}
+
+static void sim_busy(unsigned char state, unsigned char result)
+{
+    sim.busy = 1;
+    sim.ready = sim.clock + sim.busy_us;
+    sim.state = state;
+    sim.result = result;
+}
+
+static int sim_control_msg(usb_dev_handle *dev, int requesttype,
+                           int request, int value, int index,
+                           char *bytes, int size, int timeout)
+{
+    int i;
+
+    /* the time passes with the message, and with the wait before it */
+    sim.wait[sim.messages] = stats.slept_us - sim.slept_us;
+    sim.request[sim.messages++] = request;
+    sim.clock += SIM_MESSAGE_US + stats.slept_us - sim.slept_us;
+    sim.slept_us = stats.slept_us;
+
+    if(request == sim.fail)
+        return -1;
+
+    if(request == XU1541_GET_RESULT)
+    {
+        if(sim.dead)
+            sim.clock += 1000000;
+        if(!sim.busy || sim.dead || sim.clock < sim.ready)
+            return -1;
+
+        sim.busy = 0;
+        bytes[0] = sim.state;
+        bytes[1] = sim.result;
+        return 2;
+    }
+
+    if(sim.busy)
+        sim.overrun++;
+
+    switch(request)
+    {
+    case XU1541_TALK:
+    case XU1541_LISTEN:
+    case XU1541_UNTALK:
+    case XU1541_UNLISTEN:
+    case XU1541_OPEN:
+    case XU1541_CLOSE:
+        sim_busy(XU1541_IO_RESULT, 1);
+        return 0;
+
+    case XU1541_WRITE:
+        if(sim.outLen + size > sizeof(sim.out))
+            return -1;
+        memcpy(sim.out + sim.outLen, bytes, size);
+        sim.outLen += size;
+        sim_busy(XU1541_IO_RESULT, 1);
+        return size;
+
+    case XU1541_REQUEST_READ:
+        sim_busy(XU1541_IO_READ_DONE, 0);
+        return 0;
+
+    case XU1541_READ:
+        for(i = 0; i < size; i++)
+            bytes[i] = (char)(sim.inLen++);
+        return size;
+    }
+
+    fprintf(stderr, "simulated xu1541: unknown request %d\n", request);
+    return -1;
+}
+
+static char *sim_strerror(void)
+{
+    return "simulated error";
+}
+
+/* as if the device had just been opened */
+static void sim_reset(unsigned long busy_us)
+{
+    memset(&sim, 0, sizeof(sim));
+    sim.busy_us = busy_us;
+    memset(&stats, 0, sizeof(stats));
+    pending_cmd = 0;
+    last_release = 0;
+}
+
+/* the requests sent since the last call, as a string of their numbers */
+static int sim_sent(const int *requests, unsigned int count)
+{
+    static unsigned int checked;
+    unsigned int from = checked;
+
+    if(from > sim.messages)
+        from = 0;
+    checked = sim.messages;
+
+    if(sim.messages - from != count)
+        return 0;
+    return memcmp(&sim.request[from], requests, count * sizeof(int)) == 0;
+}
+
+static void test_backoff(void)
+{
+    xu1541_stats s;
+    unsigned int i;
+
+    /* nothing seen yet: two polls at once, then doubling waits */
+    sim_reset(1000);
+    TEST_CHECK(xu1541_ioctl(XU1541_LISTEN, 8, 0x6f) == 1);
+    TEST_CHECK(sim.messages == 7 && sim.request[0] == XU1541_LISTEN);
+    TEST_CHECK(sim.wait[1] == 0 && sim.wait[2] == 0);
+    TEST_CHECK(sim.wait[3] == MIN_DELAY && sim.wait[4] == 2 * MIN_DELAY);
+    TEST_CHECK(sim.wait[5] == 4 * MIN_DELAY && sim.wait[6] == 8 * MIN_DELAY);
+    xu1541_get_stats(&s);
+    TEST_CHECK(s.messages == 7 && s.polls == 6);
+    TEST_CHECK(s.sleeps == 4 && s.slept_us == 15 * MIN_DELAY);
+    TEST_CHECK(s.histogram[XU1541_POLL_ATN][xu1541_bucket(sim.clock)] == 1);
+
+    /* a slow command: the waits do not grow above TIMEOUT_DELAY */
+    sim_reset(200000);
+    TEST_CHECK(xu1541_ioctl(XU1541_TALK, 8, 0x6f) == 1);
+    for(i = 4; i < sim.messages; i++)
+    {
+        unsigned long next = sim.wait[i - 1] * 2;
+
+        TEST_CHECK(sim.wait[i] == (next < TIMEOUT_DELAY ? next : TIMEOUT_DELAY));
+    }
+    TEST_CHECK(sim.wait[sim.messages - 1] == TIMEOUT_DELAY);
+
+    /* with a history, the first wait lasts until the usual completion
+     * time; the median of these is in the bucket from 4096us */
+    sim_reset(5000);
+    stats.histogram[XU1541_POLL_ATN][6] = 1;
+    stats.histogram[XU1541_POLL_ATN][7] = 2;
+    stats.histogram[XU1541_POLL_ATN][9] = 1;
+    TEST_CHECK(xu1541_expected_us(XU1541_POLL_ATN) == 4096);
+    TEST_CHECK(xu1541_ioctl(XU1541_OPEN, 8, 2) == 1);
+    TEST_CHECK(sim.messages == 6);
+    TEST_CHECK(sim.wait[1] == 0 && sim.wait[2] == 0);
+    TEST_CHECK(sim.wait[3] == 4096 - 3 * SIM_MESSAGE_US);
+    TEST_CHECK(sim.wait[4] == 4096 / 8 && sim.wait[5] == 4096 / 4);
+
+    /* the kinds of commands have histograms of their own */
+    TEST_CHECK(xu1541_expected_us(XU1541_POLL_WRITE) == 0);
+    sim.busy_us = 100;
+    TEST_CHECK(xu1541_write((const unsigned char *)"A", 1) == 1);
+    TEST_CHECK(stats.histogram[XU1541_POLL_WRITE][2] == 1);
+    TEST_CHECK(xu1541_expected_us(XU1541_POLL_WRITE) == 128);
+    TEST_CHECK(xu1541_expected_us(XU1541_POLL_ATN) == 4096);
+
+    fprintf(stderr, "back-off done.\n");
+}
+
+static void test_deferred(void)
+{
+    static const int listen[] = { XU1541_LISTEN, XU1541_GET_RESULT };
+    static const int unlisten[] = { XU1541_UNLISTEN };
+    static const int talk[] = { XU1541_GET_RESULT, XU1541_TALK, XU1541_GET_RESULT };
+    static const int untalk[] = { XU1541_UNTALK };
+    static const int release[] = { XU1541_GET_RESULT, XU1541_UNLISTEN };
+    static const int write[] = { XU1541_GET_RESULT, XU1541_WRITE, XU1541_GET_RESULT };
+    static const int read[] = {
+        XU1541_GET_RESULT, XU1541_REQUEST_READ, XU1541_GET_RESULT, XU1541_READ,
+        XU1541_REQUEST_READ, XU1541_GET_RESULT, XU1541_READ
+    };
+    unsigned char data[200];
+    xu1541_stats s;
+    unsigned int i;
+
+    /* the result is there with the first poll */
+    sim_reset(0);
+    sim_sent(NULL, 0);
+
+    TEST_CHECK(xu1541_ioctl(XU1541_LISTEN, 8, 0x6f) == 1);
+    TEST_CHECK(sim_sent(listen, 2));
+
+    /* nobody waits for the UNLISTEN, and the second one is not sent */
+    TEST_CHECK(xu1541_ioctl(XU1541_UNLISTEN, 0, 0) == 0);
+    TEST_CHECK(sim_sent(unlisten, 1));
+    TEST_CHECK(xu1541_ioctl(XU1541_UNLISTEN, 0, 0) == 0);
+    TEST_CHECK(sim_sent(NULL, 0));
+
+    /* its result is collected before the next command */
+    TEST_CHECK(xu1541_ioctl(XU1541_TALK, 8, 0x6f) == 1);
+    TEST_CHECK(sim_sent(talk, 3));
+
+    /* an UNLISTEN after an UNTALK is not the same */
+    TEST_CHECK(xu1541_ioctl(XU1541_UNTALK, 0, 0) == 0);
+    TEST_CHECK(sim_sent(untalk, 1));
+    TEST_CHECK(xu1541_ioctl(XU1541_UNLISTEN, 0, 0) == 0);
+    TEST_CHECK(sim_sent(release, 2));
+
+    /* anything in between, and the bus has to be released again */
+    TEST_CHECK(xu1541_write((const unsigned char *)"I0", 2) == 2);
+    TEST_CHECK(sim_sent(write, 3));
+    TEST_CHECK(sim.outLen == 2 && memcmp(sim.out, "I0", 2) == 0);
+    TEST_CHECK(xu1541_ioctl(XU1541_UNLISTEN, 0, 0) == 0);
+    TEST_CHECK(sim_sent(unlisten, 1));
+
+    TEST_CHECK(xu1541_read(data, sizeof(data)) == sizeof(data));
+    TEST_CHECK(sim_sent(read, 7));
+    for(i = 0; i < sizeof(data); i++)
+        TEST_CHECK(data[i] == (unsigned char)i);
+
+    TEST_CHECK(sim.overrun == 0);
+    xu1541_get_stats(&s);
+    TEST_CHECK(s.deferred == 4 && s.coalesced == 1);
+    TEST_CHECK(s.messages == sim.messages);
+
+    fprintf(stderr, "deferred UNTALK/UNLISTEN done.\n");
+}
+
+static void test_errors(void)
+{
+    static const unsigned char data[300];
+    unsigned char buffer[10];
+
+    /* a failed control message */
+    sim_reset(0);
+    sim.fail = XU1541_LISTEN;
+    TEST_CHECK(xu1541_ioctl(XU1541_LISTEN, 8, 0) == -1);
+    TEST_CHECK(sim.messages == 1);
+
+    sim_reset(0);
+    sim.fail = XU1541_WRITE;
+    TEST_CHECK(xu1541_write(data, sizeof(data)) == -1);
+
+    sim_reset(0);
+    sim.fail = XU1541_REQUEST_READ;
+    TEST_CHECK(xu1541_read(buffer, sizeof(buffer)) == -1);
+
+    sim_reset(0);
+    sim.fail = XU1541_READ;
+    TEST_CHECK(xu1541_read(buffer, sizeof(buffer)) == -1);
+
+    /* no result within USB_TIMEOUT */
+    sim_reset(0);
+    sim.dead = 1;
+    TEST_CHECK(xu1541_ioctl(XU1541_TALK, 8, 0) == -1);
+    TEST_CHECK(sim.clock > USB_TIMEOUT * 1000ul);
+    TEST_CHECK(sim.clock < USB_TIMEOUT * 1000ul + 2000000ul);
+
+    sim_reset(0);
+    sim.dead = 1;
+    TEST_CHECK(xu1541_write(data, sizeof(data)) == -1);
+    TEST_CHECK(sim.outLen == XU1541_IO_BUFFER_SIZE);
+
+    sim_reset(0);
+    sim.dead = 1;
+    TEST_CHECK(xu1541_read(buffer, sizeof(buffer)) == -1);
+
+    /* ... nor for a deferred UNLISTEN, which fails the next command */
+    sim_reset(0);
+    TEST_CHECK(xu1541_ioctl(XU1541_UNLISTEN, 0, 0) == 0);
+    sim.dead = 1;
+    TEST_CHECK(xu1541_ioctl(XU1541_TALK, 8, 0) == -1);
+    TEST_CHECK(sim.request[sim.messages - 1] == XU1541_GET_RESULT);
+    sim.dead = 0;
+    sim.busy = 0;
+    TEST_CHECK(xu1541_ioctl(XU1541_TALK, 8, 0) == 1);
+
+    fprintf(stderr, "errors done.\n");
+}
+
+int main(void)
+{
+    usb.strerror = sim_strerror;
+    xu1541_set_transport(sim_control_msg);
+
+    test_backoff();
+    test_deferred();
+    test_errors();
+
+    if(test_failures == 0)
+    {
+        fprintf(stderr, "success.\n");
+        return EXIT_SUCCESS;
+    }
+    fprintf(stderr, "%d checks failed.\n", test_failures);
+    return EXIT_FAILURE;
+}
+
+#endif /* #ifdef OPENCBM_STANDALONE_TEST */
@@ -31,4 +31,33 @@ extern int xu1541_read(unsigned char *data, size_t len);
 extern int xu1541_special_write(int mode, const unsigned char *data, size_t size);
 extern int xu1541_special_read(int mode, unsigned char *data, size_t size);
 
+/* the kinds of commands whose result is polled for */
+#define XU1541_POLL_ATN      0  /* TALK, LISTEN, UNTALK, UNLISTEN, OPEN, CLOSE */
+#define XU1541_POLL_WRITE    1
+#define XU1541_POLL_READ     2
+#define XU1541_POLL_CLASSES  3
+
+/* completion times; bucket 0 is below 64us, bucket n below 64us << n */
+#define XU1541_HISTOGRAM_BUCKETS 12
+
+/* what the xu1541 access routines did since the device was opened */
+typedef struct xu1541_stats {
+  unsigned long messages;    /* control messages sent */
+  unsigned long polls;       /* XU1541_GET_RESULT requests */
+  unsigned long sleeps;      /* waits between two of them */
+  unsigned long slept_us;    /* total time of these waits */
+  unsigned long deferred;    /* results collected with the next command */
+  unsigned long coalesced;   /* UNTALK/UNLISTEN which were not sent */
+  unsigned long histogram[XU1541_POLL_CLASSES][XU1541_HISTOGRAM_BUCKETS];
+} xu1541_stats;
+
+/* all control messages to the device go through this, usb_control_msg()
+   unless replaced, e.g. by a simulation of the device */
+typedef int (*xu1541_transport)(usb_dev_handle *dev, int requesttype,
+                                int request, int value, int index,
+                                char *bytes, int size, int timeout);
+
+extern void xu1541_set_transport(xu1541_transport transport);
+extern void xu1541_get_stats(xu1541_stats *stats);
+
 #endif // XU1541_H
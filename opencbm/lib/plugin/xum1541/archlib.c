@@ -109,7 +109,7 @@ opencbm_plugin_driver_open(CBM_FILE *HandleDevice, const char * const Port)
         portNumber = strtoul(Port, NULL, 10);
     }
 
-    return xum1541_init((usb_dev_handle **)HandleDevice, portNumber);
+    return xum1541_init((struct xum1541_usb_handle **)HandleDevice, portNumber);
 }
 
 /*! \brief Closes the driver
@@ -129,7 +129,7 @@ opencbm_plugin_driver_open(CBM_FILE *HandleDevice, const char * const Port)
 void CBMAPIDECL
 opencbm_plugin_driver_close(CBM_FILE HandleDevice)
 {
-    xum1541_close((usb_dev_handle *)HandleDevice);
+    xum1541_close((struct xum1541_usb_handle *)HandleDevice);
 }
 
 
@@ -211,7 +211,7 @@ opencbm_plugin_unlock(CBM_FILE HandleDevice)
 int CBMAPIDECL
 opencbm_plugin_raw_write(CBM_FILE HandleDevice, const void *Buffer, size_t Count)
 {
-    return xum1541_write((usb_dev_handle *)HandleDevice, XUM1541_CBM, Buffer, Count);
+    return xum1541_write((struct xum1541_usb_handle *)HandleDevice, XUM1541_CBM, Buffer, Count);
 }
 
 /*! \brief Read data from the IEC serial bus
@@ -240,7 +240,7 @@ opencbm_plugin_raw_write(CBM_FILE HandleDevice, const void *Buffer, size_t Count
 int CBMAPIDECL
 opencbm_plugin_raw_read(CBM_FILE HandleDevice, void *Buffer, size_t Count)
 {
-    return xum1541_read((usb_dev_handle *)HandleDevice, XUM1541_CBM, Buffer, Count);
+    return xum1541_read((struct xum1541_usb_handle *)HandleDevice, XUM1541_CBM, Buffer, Count);
 }
 
 
@@ -276,7 +276,7 @@ opencbm_plugin_listen(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsign
     proto = XUM1541_CBM | XUM_WRITE_ATN;
     dataBuf[0] = 0x20 | DeviceAddress;
     dataBuf[1] = 0x60 | SecondaryAddress;
-    return !xum1541_write((usb_dev_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
+    return !xum1541_write((struct xum1541_usb_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
 }
 
 /*! \brief Send a TALK on the IEC serial bus
@@ -310,7 +310,7 @@ opencbm_plugin_talk(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned
     proto = XUM1541_CBM | XUM_WRITE_ATN | XUM_WRITE_TALK;
     dataBuf[0] = 0x40 | DeviceAddress;
     dataBuf[1] = 0x60 | SecondaryAddress;
-    return !xum1541_write((usb_dev_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
+    return !xum1541_write((struct xum1541_usb_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
 }
 
 /*! \brief Open a file on the IEC serial bus
@@ -342,7 +342,7 @@ opencbm_plugin_open(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigned
     proto = XUM1541_CBM | XUM_WRITE_ATN;
     dataBuf[0] = 0x20 | DeviceAddress;
     dataBuf[1] = 0xf0 | SecondaryAddress;
-    return !xum1541_write((usb_dev_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
+    return !xum1541_write((struct xum1541_usb_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
 }
 
 /*! \brief Close a file on the IEC serial bus
@@ -374,7 +374,7 @@ opencbm_plugin_close(CBM_FILE HandleDevice, unsigned char DeviceAddress, unsigne
     proto = XUM1541_CBM | XUM_WRITE_ATN;
     dataBuf[0] = 0x20 | DeviceAddress;
     dataBuf[1] = 0xe0 | SecondaryAddress;
-    return !xum1541_write((usb_dev_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
+    return !xum1541_write((struct xum1541_usb_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
 }
 
 /*! \brief Send an UNLISTEN on the IEC serial bus
@@ -404,7 +404,7 @@ opencbm_plugin_unlisten(CBM_FILE HandleDevice)
 
     proto = XUM1541_CBM | XUM_WRITE_ATN;
     dataBuf[0] = 0x3f;
-    return !xum1541_write((usb_dev_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
+    return !xum1541_write((struct xum1541_usb_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
 }
 
 /*! \brief Send an UNTALK on the IEC serial bus
@@ -434,7 +434,7 @@ opencbm_plugin_untalk(CBM_FILE HandleDevice)
 
     proto = XUM1541_CBM | XUM_WRITE_ATN;
     dataBuf[0] = 0x5f;
-    return !xum1541_write((usb_dev_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
+    return !xum1541_write((struct xum1541_usb_handle *)HandleDevice, proto, dataBuf, sizeof(dataBuf));
 }
 
 
@@ -461,7 +461,7 @@ opencbm_plugin_untalk(CBM_FILE HandleDevice)
 int CBMAPIDECL
 opencbm_plugin_get_eoi(CBM_FILE HandleDevice)
 {
-    return xum1541_ioctl((usb_dev_handle *)HandleDevice, XUM1541_GET_EOI, 0, 0);
+    return xum1541_ioctl((struct xum1541_usb_handle *)HandleDevice, XUM1541_GET_EOI, 0, 0);
 }
 
 /*! \brief Reset the EOI flag
@@ -482,7 +482,7 @@ opencbm_plugin_get_eoi(CBM_FILE HandleDevice)
 int CBMAPIDECL
 opencbm_plugin_clear_eoi(CBM_FILE HandleDevice)
 {
-    return xum1541_ioctl((usb_dev_handle *)HandleDevice, XUM1541_CLEAR_EOI, 0, 0);
+    return xum1541_ioctl((struct xum1541_usb_handle *)HandleDevice, XUM1541_CLEAR_EOI, 0, 0);
 }
 
 /*! \brief RESET all devices
@@ -509,7 +509,185 @@ opencbm_plugin_clear_eoi(CBM_FILE HandleDevice)
 int CBMAPIDECL
 opencbm_plugin_reset(CBM_FILE HandleDevice)
 {
-    return xum1541_control_msg((usb_dev_handle *)HandleDevice, XUM1541_RESET);
+    return xum1541_control_msg((struct xum1541_usb_handle *)HandleDevice, XUM1541_RESET);
+}
+
+/*-------------------------------------------------------------------*/
+/*--------- BATCHES OF IEC OPERATIONS -------------------------------*/
+
+/*! \internal \brief The state of one queued operation of a batch */
+struct batch_xfer
+{
+    unsigned char atn[2]; /*!< the bytes sent under ATN for listen, talk, ... */
+    int status;           /*!< the status of a write, see xum1541_queue_write_status() */
+};
+
+/*! \internal \brief Wait for the queued operations of a batch
+
+ \param HandleXum1541
+   The xum1541 handle.
+
+ \param Ops
+   The operations of the batch.
+
+ \param Xfers
+   The transfer states, one for each of Ops.
+
+ \param First
+   The first queued operation.
+
+ \param Last
+   The operation after the last queued one.
+
+ \return
+   0 on success, -1 if the queued transfers failed.
+*/
+
+static int
+batch_flush(struct xum1541_usb_handle *HandleXum1541, opencbm_plugin_batch_op_t *Ops,
+            struct batch_xfer *Xfers, unsigned int First, unsigned int Last)
+{
+    unsigned int i;
+
+    if (xum1541_queue_flush(HandleXum1541) < 0)
+    {
+        for (i = First; i < Last; i++)
+            Ops[i].Result = -1;
+        return -1;
+    }
+
+    for (i = First; i < Last; i++)
+    {
+        switch (Ops[i].Type)
+        {
+        case opencbm_batch_raw_read:
+            // the byte count has been stored by the queue itself
+            break;
+
+        case opencbm_batch_raw_write:
+            Ops[i].Result = Xfers[i].status;
+            break;
+
+        default:
+            // same as opencbm_plugin_listen() and friends
+            Ops[i].Result = Xfers[i].status > 0 ? 0 : 1;
+            break;
+        }
+    }
+    return 0;
+}
+
+/*! \brief Execute a batch of IEC operations
+
+ The operations are put into the transfer queue of the xum1541 as a
+ whole, so the command blocks, the data and the status reads of the
+ operations are in flight together, instead of waiting for the status
+ of each single operation before sending the next one. Operations
+ which are too large for a single USB transfer are executed without
+ the queue.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param Ops
+    Pointer to the operations. The Result member of each one is set
+    when the function returns.
+
+ \param Count
+    The number of operations in Ops
+
+ \return
+    0 if the batch was executed, < 0 on a fatal error.
+
+ If cbm_driver_open() did not succeed, it is illegal to 
+ call this function.
+*/
+
+int CBMAPIDECL
+opencbm_plugin_batch_submit(CBM_FILE HandleDevice, opencbm_plugin_batch_op_t *Ops, unsigned int Count)
+{
+    struct xum1541_usb_handle *HandleXum1541 = (struct xum1541_usb_handle *)HandleDevice;
+    struct batch_xfer *xfers;
+    unsigned int i, first;
+    int ret = 0;
+
+    xfers = calloc(Count, sizeof(*xfers));
+    if (xfers == NULL)
+        return -1;
+
+    for (i = 0, first = 0; i < Count && ret == 0; i++)
+    {
+        opencbm_plugin_batch_op_t *op = &Ops[i];
+        struct batch_xfer *xfer = &xfers[i];
+        unsigned char proto = XUM1541_CBM | XUM_WRITE_ATN;
+        const unsigned char *data = xfer->atn;
+        size_t size = 1;
+
+        switch (op->Type)
+        {
+        case opencbm_batch_listen:
+            xfer->atn[0] = 0x20 | op->DeviceAddress;
+            xfer->atn[1] = 0x60 | op->SecondaryAddress;
+            size = 2;
+            break;
+
+        case opencbm_batch_talk:
+            proto |= XUM_WRITE_TALK;
+            xfer->atn[0] = 0x40 | op->DeviceAddress;
+            xfer->atn[1] = 0x60 | op->SecondaryAddress;
+            size = 2;
+            break;
+
+        case opencbm_batch_unlisten:
+            xfer->atn[0] = 0x3f;
+            break;
+
+        case opencbm_batch_untalk:
+            xfer->atn[0] = 0x5f;
+            break;
+
+        case opencbm_batch_raw_write:
+        case opencbm_batch_raw_read:
+            proto = XUM1541_CBM;
+            data = op->Buffer;
+            size = op->Count;
+            break;
+
+        default:
+            op->Result = -1;
+            continue;
+        }
+
+        if (size == 0 || size > XUM_MAX_XFER_SIZE)
+        {
+            // Cannot be queued, run it after everything before it
+            ret = batch_flush(HandleXum1541, Ops, xfers, first, i);
+            first = i + 1;
+            if (ret == 0)
+            {
+                if (op->Type == opencbm_batch_raw_read)
+                    op->Result = xum1541_read(HandleXum1541, proto, op->Buffer, size);
+                else
+                    op->Result = xum1541_write(HandleXum1541, proto, data, size);
+            }
+        }
+        else if ((op->Type == opencbm_batch_raw_read)
+            ? xum1541_queue_read(HandleXum1541, proto, op->Buffer, size, &op->Result) != 0
+            : xum1541_queue_write_status(HandleXum1541, proto, data, size, &xfer->status) != 0)
+        {
+            // Finish what was queued before, and give up
+            batch_flush(HandleXum1541, Ops, xfers, first, i);
+            op->Result = -1;
+            first = i + 1;
+            ret = -1;
+        }
+    }
+
+    if (batch_flush(HandleXum1541, Ops, xfers, first, i) != 0)
+        ret = -1;
+
+    free(xfers);
+    return ret;
 }
 
 
@@ -540,7 +718,7 @@ opencbm_plugin_reset(CBM_FILE HandleDevice)
 unsigned char CBMAPIDECL
 opencbm_plugin_pp_read(CBM_FILE HandleDevice)
 {
-    return (unsigned char) xum1541_ioctl((usb_dev_handle *)HandleDevice, XUM1541_PP_READ, 0, 0);
+    return (unsigned char) xum1541_ioctl((struct xum1541_usb_handle *)HandleDevice, XUM1541_PP_READ, 0, 0);
 }
 
 /*! \brief Write a byte to a XP1541/XP1571 cable
@@ -569,7 +747,7 @@ opencbm_plugin_pp_read(CBM_FILE HandleDevice)
 void CBMAPIDECL
 opencbm_plugin_pp_write(CBM_FILE HandleDevice, unsigned char Byte)
 {
-    xum1541_ioctl((usb_dev_handle *)HandleDevice, XUM1541_PP_WRITE, Byte, 0);
+    xum1541_ioctl((struct xum1541_usb_handle *)HandleDevice, XUM1541_PP_WRITE, Byte, 0);
 }
 
 /*! \brief Read status of all bus lines.
@@ -596,7 +774,7 @@ opencbm_plugin_pp_write(CBM_FILE HandleDevice, unsigned char Byte)
 int CBMAPIDECL
 opencbm_plugin_iec_poll(CBM_FILE HandleDevice)
 {
-    return xum1541_ioctl((usb_dev_handle *)HandleDevice, XUM1541_IEC_POLL, 0, 0);
+    return xum1541_ioctl((struct xum1541_usb_handle *)HandleDevice, XUM1541_IEC_POLL, 0, 0);
 }
 
 
@@ -621,7 +799,7 @@ opencbm_plugin_iec_poll(CBM_FILE HandleDevice)
 void CBMAPIDECL
 opencbm_plugin_iec_set(CBM_FILE HandleDevice, int Line)
 {
-    xum1541_ioctl((usb_dev_handle *)HandleDevice, XUM1541_IEC_SETRELEASE, Line, 0);
+    xum1541_ioctl((struct xum1541_usb_handle *)HandleDevice, XUM1541_IEC_SETRELEASE, Line, 0);
 }
 
 /*! \brief Deactivate a line on the IEC serial bus
@@ -645,7 +823,7 @@ opencbm_plugin_iec_set(CBM_FILE HandleDevice, int Line)
 void CBMAPIDECL
 opencbm_plugin_iec_release(CBM_FILE HandleDevice, int Line)
 {
-    xum1541_ioctl((usb_dev_handle *)HandleDevice, XUM1541_IEC_SETRELEASE, 0, Line);
+    xum1541_ioctl((struct xum1541_usb_handle *)HandleDevice, XUM1541_IEC_SETRELEASE, 0, Line);
 }
 
 /*! \brief Activate and deactive a line on the IEC serial bus
@@ -678,7 +856,7 @@ opencbm_plugin_iec_release(CBM_FILE HandleDevice, int Line)
 void CBMAPIDECL
 opencbm_plugin_iec_setrelease(CBM_FILE HandleDevice, int Set, int Release)
 {
-    xum1541_ioctl((usb_dev_handle *)HandleDevice, XUM1541_IEC_SETRELEASE, Set, Release);
+    xum1541_ioctl((struct xum1541_usb_handle *)HandleDevice, XUM1541_IEC_SETRELEASE, Set, Release);
 }
 
 /*! \brief Wait for a line to have a specific state
@@ -710,7 +888,7 @@ opencbm_plugin_iec_setrelease(CBM_FILE HandleDevice, int Set, int Release)
 int CBMAPIDECL
 opencbm_plugin_iec_wait(CBM_FILE HandleDevice, int Line, int State)
 {
-    return xum1541_ioctl((usb_dev_handle *)HandleDevice, XUM1541_IEC_WAIT, Line, State);
+    return xum1541_ioctl((struct xum1541_usb_handle *)HandleDevice, XUM1541_IEC_WAIT, Line, State);
 }
 
 /*! \brief Sends a command to the xum1541 device
@@ -730,5 +908,5 @@ opencbm_plugin_iec_wait(CBM_FILE HandleDevice, int Line, int State)
 int CBMAPIDECL
 xum1541_plugin_control_msg(CBM_FILE HandleDevice, unsigned int cmd)
 {
-    return xum1541_control_msg((usb_dev_handle *)HandleDevice, cmd);
+    return xum1541_control_msg((struct xum1541_usb_handle *)HandleDevice, cmd);
 }
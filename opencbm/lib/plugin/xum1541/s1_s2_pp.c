@@ -69,7 +69,7 @@
 int CBMAPIDECL
 opencbm_plugin_s1_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned int size)
 {
-    return xum1541_read((usb_dev_handle *)HandleDevice, XUM1541_S1, data, size);
+    return xum1541_read((struct xum1541_usb_handle *)HandleDevice, XUM1541_S1, data, size);
 }
 
 /*! \brief Write data with serial1 protocol
@@ -90,7 +90,7 @@ opencbm_plugin_s1_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned in
 int CBMAPIDECL
 opencbm_plugin_s1_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsigned int size)
 {
-    return xum1541_write((usb_dev_handle *)HandleDevice, XUM1541_S1, data, size);
+    return xum1541_write((struct xum1541_usb_handle *)HandleDevice, XUM1541_S1, data, size);
 }
 
 /*! \brief Read data with serial2 protocol
@@ -111,7 +111,7 @@ opencbm_plugin_s1_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsi
 int CBMAPIDECL
 opencbm_plugin_s2_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned int size)
 {
-    return xum1541_read((usb_dev_handle *)HandleDevice, XUM1541_S2, data, size);
+    return xum1541_read((struct xum1541_usb_handle *)HandleDevice, XUM1541_S2, data, size);
 }
 
 /*! \brief Write data with serial2 protocol
@@ -132,7 +132,7 @@ opencbm_plugin_s2_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned in
 int CBMAPIDECL
 opencbm_plugin_s2_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsigned int size)
 {
-    return xum1541_write((usb_dev_handle *)HandleDevice, XUM1541_S2, data, size);
+    return xum1541_write((struct xum1541_usb_handle *)HandleDevice, XUM1541_S2, data, size);
 }
 
 /*! \brief Read data with parallel protocol (d64copy)
@@ -153,7 +153,7 @@ opencbm_plugin_s2_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsi
 int CBMAPIDECL
 opencbm_plugin_pp_dc_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned int size)
 {
-    return xum1541_read((usb_dev_handle *)HandleDevice, XUM1541_PP, data, size);
+    return xum1541_read((struct xum1541_usb_handle *)HandleDevice, XUM1541_PP, data, size);
 }
 
 /*! \brief Write data with parallel protocol (d64copy)
@@ -174,7 +174,7 @@ opencbm_plugin_pp_dc_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned
 int CBMAPIDECL
 opencbm_plugin_pp_dc_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsigned int size)
 {
-    return xum1541_write((usb_dev_handle *)HandleDevice, XUM1541_PP, data, size);
+    return xum1541_write((struct xum1541_usb_handle *)HandleDevice, XUM1541_PP, data, size);
 }
 
 /*! \brief Read data with parallel protocol (cbmcopy)
@@ -195,7 +195,7 @@ opencbm_plugin_pp_dc_write_n(CBM_FILE HandleDevice, const unsigned char *data, u
 int CBMAPIDECL
 opencbm_plugin_pp_cc_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned int size)
 {
-    return xum1541_read((usb_dev_handle *)HandleDevice, XUM1541_P2, data, size);
+    return xum1541_read((struct xum1541_usb_handle *)HandleDevice, XUM1541_P2, data, size);
 }
 
 /*! \brief Write data with parallel protocol (cbmcopy)
@@ -216,7 +216,7 @@ opencbm_plugin_pp_cc_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned
 int CBMAPIDECL
 opencbm_plugin_pp_cc_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsigned int size)
 {
-    return xum1541_write((usb_dev_handle *)HandleDevice, XUM1541_P2, data, size);
+    return xum1541_write((struct xum1541_usb_handle *)HandleDevice, XUM1541_P2, data, size);
 }
 
 /*! \brief Read data with burst nibbler protocol (cbmcopy)
@@ -237,7 +237,7 @@ opencbm_plugin_pp_cc_write_n(CBM_FILE HandleDevice, const unsigned char *data, u
 int CBMAPIDECL
 opencbm_plugin_nib_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned int size)
 {
-    return xum1541_read((usb_dev_handle *)HandleDevice, XUM1541_NIB, data, size);
+    return xum1541_read((struct xum1541_usb_handle *)HandleDevice, XUM1541_NIB, data, size);
 }
 
 /*! \brief Write data with burst nibbler protocol (cbmcopy)
@@ -258,5 +258,209 @@ opencbm_plugin_nib_read_n(CBM_FILE HandleDevice, unsigned char *data, unsigned i
 int CBMAPIDECL
 opencbm_plugin_nib_write_n(CBM_FILE HandleDevice, const unsigned char *data, unsigned int size)
 {
-    return xum1541_write((usb_dev_handle *)HandleDevice, XUM1541_NIB, data, size);
+    return xum1541_write((struct xum1541_usb_handle *)HandleDevice, XUM1541_NIB, data, size);
+}
+
+/*! \internal \brief Map a protocol of the queued transfer functions to
+    the xum1541 protocol
+
+  \param Protocol
+    One of enum opencbm_plugin_protocol_e
+
+  \return
+    The xum1541 protocol, or 0 if it cannot be queued.
+*/
+static unsigned char
+xum1541_queue_protocol(int Protocol)
+{
+    switch (Protocol) {
+    case opencbm_proto_s1:    return XUM1541_S1;
+    case opencbm_proto_s2:    return XUM1541_S2;
+    case opencbm_proto_pp_dc: return XUM1541_PP;
+    case opencbm_proto_pp_cc: return XUM1541_P2;
+    case opencbm_proto_nib:   return XUM1541_NIB;
+    default:                  return 0;
+    }
+}
+
+/*! \brief Queue a read of data with a speeder protocol
+
+  \param HandleDevice
+    A CBM_FILE which contains the file handle of the driver.
+
+  \param Protocol
+    The protocol to use, one of enum opencbm_plugin_protocol_e
+
+  \param data
+    Pointer to the data buffer which will hold the read bytes.
+    It must stay valid until opencbm_plugin_queue_flush() returned.
+
+  \param size
+    The size of the data buffer the read bytes will be written to.
+
+  \param BytesRead
+    Will hold the number of bytes actually read after the next
+    opencbm_plugin_queue_flush().
+
+  \return
+    0 if the read was queued, < 0 on error.
+*/
+int CBMAPIDECL
+opencbm_plugin_queue_read_n(CBM_FILE HandleDevice, int Protocol, unsigned char *data, unsigned int size, int *BytesRead)
+{
+    unsigned char mode = xum1541_queue_protocol(Protocol);
+
+    if (mode == 0)
+        return -1;
+
+    return xum1541_queue_read((struct xum1541_usb_handle *)HandleDevice, mode, data, size, BytesRead);
+}
+
+/*! \brief Queue a write of data with a speeder protocol
+
+  \param HandleDevice
+    A CBM_FILE which contains the file handle of the driver.
+
+  \param Protocol
+    The protocol to use, one of enum opencbm_plugin_protocol_e
+
+  \param data
+    Pointer to the data buffer to be written.
+    It must stay valid until opencbm_plugin_queue_flush() returned.
+
+  \param size
+    The size of the data buffer to be written
+
+  \param BytesWritten
+    Will hold the number of bytes actually written after the next
+    opencbm_plugin_queue_flush().
+
+  \return
+    0 if the write was queued, < 0 on error.
+*/
+int CBMAPIDECL
+opencbm_plugin_queue_write_n(CBM_FILE HandleDevice, int Protocol, const unsigned char *data, unsigned int size, int *BytesWritten)
+{
+    unsigned char mode = xum1541_queue_protocol(Protocol);
+
+    if (mode == 0)
+        return -1;
+
+    return xum1541_queue_write((struct xum1541_usb_handle *)HandleDevice, mode, data, size, BytesWritten);
+}
+
+/*! \brief Wait for all queued reads and writes to finish
+
+  \param HandleDevice
+    A CBM_FILE which contains the file handle of the driver.
+
+  \return
+    0 if all queued transfers succeeded, -1 if any of them failed.
+*/
+int CBMAPIDECL
+opencbm_plugin_queue_flush(CBM_FILE HandleDevice)
+{
+    return xum1541_queue_flush((struct xum1541_usb_handle *)HandleDevice);
+}
+
+/*! \brief Read a number of equally sized blocks with a speeder protocol
+
+  \param HandleDevice
+    A CBM_FILE which contains the file handle of the driver.
+
+  \param Protocol
+    The protocol to use, one of enum opencbm_plugin_protocol_e
+
+  \param data
+    Pointer to the data buffer which will hold the read blocks.
+
+  \param blocks
+    The number of blocks to read.
+
+  \param blocksize
+    The size of each block.
+
+  \return
+    The number of blocks read completely. If there is a fatal error,
+    returns -1.
+*/
+int CBMAPIDECL
+opencbm_plugin_stream_read(CBM_FILE HandleDevice, int Protocol, unsigned char *data, unsigned int blocks, unsigned int blocksize)
+{
+    unsigned char mode = xum1541_queue_protocol(Protocol);
+
+    if (mode == 0 || mode == XUM1541_NIB)
+        return -1;
+
+    return xum1541_read_blocks((struct xum1541_usb_handle *)HandleDevice, mode, data, blocks, blocksize);
+}
+
+/*! \brief Write a number of equally sized blocks with a speeder protocol
+
+  \param HandleDevice
+    A CBM_FILE which contains the file handle of the driver.
+
+  \param Protocol
+    The protocol to use, one of enum opencbm_plugin_protocol_e
+
+  \param data
+    Pointer to the data buffer to be written.
+
+  \param blocks
+    The number of blocks to write.
+
+  \param blocksize
+    The size of each block.
+
+  \return
+    The number of blocks written completely. If there is a fatal error,
+    returns -1.
+*/
+int CBMAPIDECL
+opencbm_plugin_stream_write(CBM_FILE HandleDevice, int Protocol, const unsigned char *data, unsigned int blocks, unsigned int blocksize)
+{
+    unsigned char mode = xum1541_queue_protocol(Protocol);
+
+    if (mode == 0 || mode == XUM1541_NIB)
+        return -1;
+
+    return xum1541_write_blocks((struct xum1541_usb_handle *)HandleDevice, mode, data, blocks, blocksize);
+}
+
+/*! \brief Read the sectors of a track from a drive running the d64copy warp read
+
+  \param HandleDevice
+    A CBM_FILE which contains the file handle of the driver.
+
+  \param Protocol
+    The protocol to use: opencbm_proto_s1, opencbm_proto_s2 or opencbm_proto_pp_dc
+
+  \param map
+    The track map, as it is sent to the drive.
+
+  \param mapsize
+    The size of the track map.
+
+  \param sectors
+    The number of sectors the drive will send.
+
+  \param data
+    Pointer to the buffer which gets the GCR data of the sectors read.
+
+  \param results
+    Pointer to the buffer which gets a sector number and job status per sector.
+
+  \return
+    The number of sectors in results. If there is a fatal error,
+    returns -1.
+*/
+int CBMAPIDECL
+opencbm_plugin_warp_read_track(CBM_FILE HandleDevice, int Protocol, const unsigned char *map, unsigned int mapsize, unsigned int sectors, unsigned char *data, unsigned char *results)
+{
+    unsigned char mode = xum1541_queue_protocol(Protocol);
+
+    if (mode != XUM1541_S1 && mode != XUM1541_S2 && mode != XUM1541_PP)
+        return -1;
+
+    return xum1541_read_track((struct xum1541_usb_handle *)HandleDevice, mode, map, mapsize, sectors, data, results);
 }
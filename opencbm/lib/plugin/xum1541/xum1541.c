@@ -32,8 +32,10 @@
 #include "opencbm.h"
 
 #include "arch.h"
+#include "configuration.h"
 #include "dynlibusb.h"
 #include "getpluginaddress.h"
+#include "libmisc.h"
 #include "xum1541.h"
 
 // XXX Fix for Linux/Mac build, should be moved
@@ -43,8 +45,6 @@
 
 static int debug_level = -1; /*!< \internal \brief the debugging level for debugging output */
 
-unsigned char DeviceDriveMode; // Temporary disk/tape mode hack until usb device handle context is there.
-
 /*! \internal \brief Output debugging information for the xum1541
 
  \param level
@@ -142,6 +142,191 @@ xum1541_cleanup(usb_dev_handle **HandleXum1541, char *msg, ...)
     *HandleXum1541 = NULL;
 }
 
+/*! \internal \brief The name of the device cache, relative to the home directory */
+#define XUM1541_DEVICE_CACHE_FILEPATH ARCH_CBM_LINUX_WIN("/.opencbm-xum1541.cache", "/opencbm-xum1541.cache")
+
+/*! \internal \brief Get the name of the file which remembers the xum1541 devices
+
+ Opening every xum1541 to read its product name and serial number is
+ the slowest part of the enumeration. Thus, the bus and device names
+ of the xum1541 found for each port number are remembered between runs.
+
+ \return
+    The name of the file, to be freed with cbmlibmisc_strfree(); NULL if
+    there is no home directory.
+*/
+static char *
+xum1541_device_cache_filename(void)
+{
+    const char *home = getenv(ARCH_CBM_LINUX_WIN("HOME", "USERPROFILE"));
+
+    if (home == NULL || home[0] == 0)
+        return NULL;
+
+    return cbmlibmisc_strcat(home, XUM1541_DEVICE_CACHE_FILEPATH);
+}
+
+/*! \internal \brief Read the serial number of a xum1541
+
+ \param handle
+    The opened device.
+
+ \param dev
+    The device.
+
+ \param serialnum
+    Receives the serial number; 0 if the device has none.
+
+ \return
+    The length of the serial number string, negative if it could not be read.
+*/
+static int
+xum1541_get_serial(usb_dev_handle *handle, struct usb_device *dev, int *serialnum)
+{
+    char string[256];
+    int len;
+
+    len = usbGetStringAscii(handle, dev->descriptor.iSerialNumber, 0x0409,
+        string, sizeof(string) - 1);
+
+    *serialnum = 0;
+    if (len > 0 && len <= 3) {
+        string[len] = '\0';
+        *serialnum = atoi(string);
+    }
+    return len;
+}
+
+/*! \internal \brief Open the xum1541 remembered for a port number
+
+ The device is only used if it is still at the same place on the
+ bus and it still has the same serial number, which must be the port
+ number for all ports but the default one. For the default port 0,
+ it must also be the only xum1541, or have serial number 0; otherwise,
+ a newly connected device might have to be preferred.
+
+ \param HandleXum1541
+    Receives the opened device, or NULL.
+
+ \param PortNumber
+    The port number, that is, the serial number wanted.
+
+ \param Count
+    The number of devices with the xum1541 vendor and product ID.
+*/
+static void
+xum1541_device_cache_open(usb_dev_handle **HandleXum1541, int PortNumber, int Count)
+{
+    opencbm_configuration_handle cache;
+    struct usb_bus *bus;
+    struct usb_device *dev;
+    char *filename, *busname = NULL, *devname = NULL, *serial = NULL;
+    char section[16];
+    int serialnum;
+
+    *HandleXum1541 = NULL;
+
+    filename = xum1541_device_cache_filename();
+    if (filename == NULL)
+        return;
+
+    cache = opencbm_configuration_open(filename);
+    cbmlibmisc_strfree(filename);
+    if (cache == NULL)
+        return;
+
+    sprintf(section, "port%d", PortNumber);
+
+    if (opencbm_configuration_get_data(cache, section, "bus", &busname) == 0 &&
+        opencbm_configuration_get_data(cache, section, "device", &devname) == 0 &&
+        opencbm_configuration_get_data(cache, section, "serial", &serial) == 0 &&
+        (PortNumber != 0 ? atoi(serial) == PortNumber :
+                           (atoi(serial) == 0 || Count == 1))) {
+        for (bus = usb.get_busses(); bus; bus = bus->next) {
+            if (strcmp(bus->dirname, busname) != 0)
+                continue;
+            for (dev = bus->devices; dev; dev = dev->next) {
+                if (strcmp(dev->filename, devname) != 0 ||
+                    dev->descriptor.idVendor != XUM1541_VID ||
+                    dev->descriptor.idProduct != XUM1541_PID)
+                    continue;
+
+                if ((*HandleXum1541 = usb.open(dev)) == NULL)
+                    break;
+                if (xum1541_get_serial(*HandleXum1541, dev, &serialnum) < 0 ||
+                    serialnum != atoi(serial)) {
+                    xum1541_cleanup(HandleXum1541, NULL);
+                    break;
+                }
+                xum1541_dbg(0, "remembered xum1541 on bus %s, device %s, serial number %3u",
+                    busname, devname, serialnum);
+                break;
+            }
+            break;
+        }
+    }
+
+    cbmlibmisc_strfree(busname);
+    cbmlibmisc_strfree(devname);
+    cbmlibmisc_strfree(serial);
+    opencbm_configuration_close(cache);
+}
+
+/*! \internal \brief Remember the xum1541 found for a port number
+
+ The file is only written if something has changed.
+
+ \param HandleXum1541
+    The opened device.
+
+ \param PortNumber
+    The port number which was asked for.
+*/
+static void
+xum1541_device_cache_store(usb_dev_handle *HandleXum1541, int PortNumber)
+{
+    opencbm_configuration_handle cache;
+    struct usb_device *dev = usb.device(HandleXum1541);
+    char *filename;
+    char section[16], serial[12];
+    const char *entries[3], *values[3];
+    int i, serialnum;
+
+    if (xum1541_get_serial(HandleXum1541, dev, &serialnum) < 0)
+        return;
+
+    // A fallback device found for another port number is not remembered
+    if (PortNumber != 0 && serialnum != PortNumber)
+        return;
+
+    filename = xum1541_device_cache_filename();
+    if (filename == NULL)
+        return;
+
+    cache = opencbm_configuration_create(filename);
+    cbmlibmisc_strfree(filename);
+    if (cache == NULL)
+        return;
+
+    sprintf(section, "port%d", PortNumber);
+    sprintf(serial, "%d", serialnum);
+
+    entries[0] = "bus";    values[0] = dev->bus->dirname;
+    entries[1] = "device"; values[1] = dev->filename;
+    entries[2] = "serial"; values[2] = serial;
+
+    for (i = 0; i < 3; i++) {
+        char *old = NULL;
+
+        if (opencbm_configuration_get_data(cache, section, entries[i], &old) != 0 ||
+            strcmp(old, values[i]) != 0)
+            opencbm_configuration_set_data(cache, section, entries[i], values[i]);
+        cbmlibmisc_strfree(old);
+    }
+
+    opencbm_configuration_close(cache);
+}
+
 // USB bus enumeration
 static void
 xum1541_enumerate(usb_dev_handle **HandleXum1541, int PortNumber)
@@ -151,7 +336,8 @@ xum1541_enumerate(usb_dev_handle **HandleXum1541, int PortNumber)
     struct usb_bus *bus;
     struct usb_device *dev, *preferredDefaultHandle;
     char string[256];
-    int len, serialnum, leastserial;
+    int len, serialnum, leastserial, count;
+    unsigned long start;
 
     if (PortNumber < 0 || PortNumber > MAX_ALLOWED_XUM1541_SERIALNUM) {
         // Normalise the Portnumber for invalid values
@@ -159,6 +345,7 @@ xum1541_enumerate(usb_dev_handle **HandleXum1541, int PortNumber)
     }
 
     xum1541_dbg(0, "scanning usb ...");
+    start = arch_time_us();
 
     usb.init();
     usb.find_busses();
@@ -168,6 +355,23 @@ xum1541_enumerate(usb_dev_handle **HandleXum1541, int PortNumber)
     /* make lib ignore this as this has nothing to do with our device */
     errno = 0;
 
+    // Try the device which was found the last time first
+    count = 0;
+    for (bus = usb.get_busses(); bus; bus = bus->next) {
+        for (dev = bus->devices; dev; dev = dev->next) {
+            if (dev->descriptor.idVendor == XUM1541_VID &&
+                dev->descriptor.idProduct == XUM1541_PID)
+                count++;
+        }
+    }
+    if (count > 0) {
+        xum1541_device_cache_open(HandleXum1541, PortNumber, count);
+        if (*HandleXum1541 != NULL) {
+            xum1541_dbg(1, "enumeration took %lu us", arch_time_us() - start);
+            return;
+        }
+    }
+
     *HandleXum1541 = NULL;
     preferredDefaultHandle = NULL;
     leastserial = MAX_ALLOWED_XUM1541_SERIALNUM + 1;
@@ -234,17 +438,20 @@ xum1541_enumerate(usb_dev_handle **HandleXum1541, int PortNumber)
             }
 
             xum1541_dbg(0, "xum1541 serial number: %3u", serialnum);
-            return;
+            break;
         }
     }
     // if no default device was found because only specific devices were present,
     // determine the default device from the specific ones and open it
-    if(preferredDefaultHandle != NULL) {
+    if(*HandleXum1541 == NULL && preferredDefaultHandle != NULL) {
         if ((*HandleXum1541 = usb.open(preferredDefaultHandle)) == NULL) {
             fprintf(stderr, "error: Cannot reopen USB device: %s\n",
                 usb.strerror());
         }
     }
+    if (*HandleXum1541 != NULL)
+        xum1541_device_cache_store(*HandleXum1541, PortNumber);
+    xum1541_dbg(1, "enumeration took %lu us", arch_time_us() - start);
 }
 
 // Check for a firmware version compatible with this plugin
@@ -295,7 +502,8 @@ xum1541_device_path(int PortNumber)
 
     if (HandleXum1541 != NULL) {
         strcpy(dev_path, (usb.device(HandleXum1541))->filename);
-        xum1541_close(HandleXum1541);
+        // only opened for the lookup, nothing was claimed
+        xum1541_cleanup(&HandleXum1541, NULL);
     } else {
         fprintf(stderr, "error: no xum1541 device found\n");
     }
@@ -371,24 +579,33 @@ xum1541_clear_halt(usb_dev_handle *handle)
     with it.
 */
 int
-xum1541_init(usb_dev_handle **HandleXum1541, int PortNumber)
+xum1541_init(struct xum1541_usb_handle **HandleXum1541, int PortNumber)
 {
+    struct xum1541_usb_handle *uh;
     unsigned char devInfo[XUM_DEVINFO_SIZE], devStatus;
     int len;
 
-    // Place after "xum1541_usb_handle" allocation:
-    /*uh->*/DeviceDriveMode = DeviceDriveMode_Uninit;
+    *HandleXum1541 = NULL;
+
+    uh = calloc(1, sizeof(*uh));
+    if (uh == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return -1;
+    }
+    uh->DeviceDriveMode = DeviceDriveMode_Uninit;
 
-    xum1541_enumerate(HandleXum1541, PortNumber);
+    xum1541_enumerate(&uh->devh, PortNumber);
 
-    if (*HandleXum1541 == NULL) {
+    if (uh->devh == NULL) {
         fprintf(stderr, "error: no xum1541 device found\n");
+        free(uh);
         return -1;
     }
 
     // Select first and only device configuration.
-    if (usb.set_configuration(*HandleXum1541, 1) != 0) {
-        xum1541_cleanup(HandleXum1541, "USB error: %s\n", usb.strerror());
+    if (usb.set_configuration(uh->devh, 1) != 0) {
+        xum1541_cleanup(&uh->devh, "USB error: %s\n", usb.strerror());
+        free(uh);
         return -1;
     }
 
@@ -397,37 +614,47 @@ xum1541_init(usb_dev_handle **HandleXum1541, int PortNumber)
      * After this point, do cleanup using xum1541_close() instead of
      * xum1541_cleanup().
      */
-    if (usb.claim_interface(*HandleXum1541, 0) != 0) {
-        xum1541_cleanup(HandleXum1541, "USB error: %s\n", usb.strerror());
+    if (usb.claim_interface(uh->devh, 0) != 0) {
+        xum1541_cleanup(&uh->devh, "USB error: %s\n", usb.strerror());
+        free(uh);
         return -1;
     }
 
     // Check the basic device info message for firmware version
     memset(devInfo, 0, sizeof(devInfo));
-    len = usb.control_msg(*HandleXum1541, USB_TYPE_CLASS | USB_ENDPOINT_IN,
+    len = usb.control_msg(uh->devh, USB_TYPE_CLASS | USB_ENDPOINT_IN,
         XUM1541_INIT, 0, 0, (char*)devInfo, sizeof(devInfo), USB_TIMEOUT);
     if (len < 2) {
         fprintf(stderr, "USB request for XUM1541 info failed: %s\n",
             usb.strerror());
-        xum1541_close(*HandleXum1541);
+        xum1541_close(uh);
         return -1;
     }
     if (xum1541_check_version(devInfo[0]) != 0) {
-        xum1541_close(*HandleXum1541);
+        xum1541_close(uh);
         return -1;
     }
     if (len >= 4) {
         xum1541_dbg(0, "device capabilities %02x status %02x",
-            devInfo[1], devInfo[2]);
+            devInfo[XUM_DEVINFO_CAPS], devInfo[XUM_DEVINFO_STATUS]);
     }
 
+    // Older firmware leaves the fields it does not know at 0
+    uh->capabilities = devInfo[XUM_DEVINFO_CAPS];
+    uh->endpointSize = devInfo[XUM_DEVINFO_EP_SIZE];
+    uh->maxBlocks = devInfo[XUM_DEVINFO_MAX_BLOCKS];
+    if ((uh->capabilities & XUM1541_CAP_BLOCKS) == 0)
+        uh->maxBlocks = 0;
+    xum1541_dbg(1, "endpoint size %u, %u blocks per stream",
+        uh->endpointSize, uh->maxBlocks);
+
     // Check for the xum1541's current status. (Not the drive.)
     devStatus = devInfo[2];
     if ((devStatus & XUM1541_DOING_RESET) != 0) {
         fprintf(stderr, "previous command was interrupted, resetting\n");
         // Clear the stalls on both endpoints
-        if (xum1541_clear_halt(*HandleXum1541) < 0) {
-            xum1541_close(*HandleXum1541);
+        if (xum1541_clear_halt(uh->devh) < 0) {
+            xum1541_close(uh);
             return -1;
         }
     }
@@ -437,21 +664,22 @@ xum1541_init(usb_dev_handle **HandleXum1541, int PortNumber)
 	{
 		if (devInfo[2] & XUM1541_TAPE_PRESENT)
 		{
-			/*uh->*/DeviceDriveMode = DeviceDriveMode_Tape;
+			uh->DeviceDriveMode = DeviceDriveMode_Tape;
             xum1541_dbg(1, "[xum1541_init] Tape supported, tape mode entered.");
 		}
 		else
 		{
-			/*uh->*/DeviceDriveMode = DeviceDriveMode_Disk;
+			uh->DeviceDriveMode = DeviceDriveMode_Disk;
             xum1541_dbg(1, "[xum1541_init] Tape supported, disk mode entered.");
 		}
 	}
 	else
 	{
-		DeviceDriveMode = (unsigned char) DeviceDriveMode_NoTapeSupport;
+		uh->DeviceDriveMode = (unsigned char) DeviceDriveMode_NoTapeSupport;
         xum1541_dbg(1, "[xum1541_init] No tape support.");
 	}
 
+    *HandleXum1541 = uh;
     return 0;
 }
 /*! \brief close the xum1541 device
@@ -460,27 +688,34 @@ xum1541_init(usb_dev_handle **HandleXum1541, int PortNumber)
    Pointer to a XUM1541_HANDLE which will contain the file handle of the USB device.
 
  \remark
-    This function releases the interface and closes the xum1541 handle.
+    This function releases the interface, closes the USB device and frees
+    the xum1541 handle.
 */
 void
-xum1541_close(usb_dev_handle *HandleXum1541)
+xum1541_close(struct xum1541_usb_handle *HandleXum1541)
 {
     int ret;
 
     xum1541_dbg(0, "Closing USB link");
 
-    ret = usb.control_msg(HandleXum1541, USB_TYPE_CLASS | USB_ENDPOINT_OUT,
+    xum1541_queue_flush(HandleXum1541);
+    if (HandleXum1541->queue.transport && HandleXum1541->queue.transport->close)
+        HandleXum1541->queue.transport->close(HandleXum1541);
+
+    ret = usb.control_msg(HandleXum1541->devh, USB_TYPE_CLASS | USB_ENDPOINT_OUT,
         XUM1541_SHUTDOWN, 0, 0, NULL, 0, 1000);
     if (ret < 0) {
         fprintf(stderr,
             "USB request for XUM1541 close failed, continuing: %s\n",
             usb.strerror());
     }
-    if (usb.release_interface(HandleXum1541, 0) != 0)
+    if (usb.release_interface(HandleXum1541->devh, 0) != 0)
         fprintf(stderr, "USB release intf error: %s\n", usb.strerror());
 
-    if (usb.close(HandleXum1541) != 0)
+    if (usb.close(HandleXum1541->devh) != 0)
         fprintf(stderr, "USB close error: %s\n", usb.strerror());
+
+    free(HandleXum1541);
 }
 
 /*! \brief  Handle synchronous USB control messages, e.g. for RESET.
@@ -496,13 +731,16 @@ xum1541_close(usb_dev_handle *HandleXum1541)
    Returns the value the USB device sent back.
 */
 int
-xum1541_control_msg(usb_dev_handle *HandleXum1541, unsigned int cmd)
+xum1541_control_msg(struct xum1541_usb_handle *HandleXum1541, unsigned int cmd)
 {
     int nBytes;
 
     xum1541_dbg(1, "control msg %d", cmd);
 
-    nBytes = usb.control_msg(HandleXum1541, USB_TYPE_CLASS | USB_ENDPOINT_OUT,
+    // Let everything queued before this command go out first
+    xum1541_queue_flush(HandleXum1541);
+
+    nBytes = usb.control_msg(HandleXum1541->devh, USB_TYPE_CLASS | USB_ENDPOINT_OUT,
         cmd, 0, 0, NULL, 0, USB_TIMEOUT);
     if (nBytes < 0) {
         fprintf(stderr, "USB error in xum1541_control_msg: %s\n",
@@ -514,7 +752,7 @@ xum1541_control_msg(usb_dev_handle *HandleXum1541, unsigned int cmd)
 }
 
 static int
-xum1541_wait_status(usb_dev_handle *HandleXum1541)
+xum1541_wait_status(struct xum1541_usb_handle *HandleXum1541)
 {
     int nBytes, deviceBusy, ret;
     unsigned char statusBuf[XUM_STATUSBUF_SIZE];
@@ -522,7 +760,7 @@ xum1541_wait_status(usb_dev_handle *HandleXum1541)
     xum1541_dbg(2, "xum1541_wait_status checking for status");
     deviceBusy = 1;
     while (deviceBusy) {
-        nBytes = usb.bulk_read(HandleXum1541,
+        nBytes = usb.bulk_read(HandleXum1541->devh,
             XUM_BULK_IN_ENDPOINT | USB_ENDPOINT_IN,
             (char*)statusBuf, XUM_STATUSBUF_SIZE, LIBUSB_NO_TIMEOUT);
         if (nBytes == XUM_STATUSBUF_SIZE) {
@@ -562,7 +800,7 @@ xum1541_wait_status(usb_dev_handle *HandleXum1541)
 // Checks if xum1541_ioctl/xum1541_read/xum1541_write command is allowed in currently set disk/tape mode.
 #define RefuseToWorkInWrongMode \
     {                                                                                                    \
-        if (/*uh->*/DeviceDriveMode == DeviceDriveMode_Uninit)                                               \
+        if (HandleXum1541->DeviceDriveMode == DeviceDriveMode_Uninit)                                        \
         {                                                                                                \
             xum1541_dbg(1, "[RefuseToWorkInWrongMode] cmd blocked - No disk or tape mode set.");         \
             return XUM1541_Error_NoDiskTapeMode;                                                         \
@@ -570,13 +808,13 @@ xum1541_wait_status(usb_dev_handle *HandleXum1541)
                                                                                                          \
         if (isTapeCmd)                                                                                   \
         {                                                                                                \
-            if (/*uh->*/DeviceDriveMode == DeviceDriveMode_NoTapeSupport)                                \
+            if (HandleXum1541->DeviceDriveMode == DeviceDriveMode_NoTapeSupport)                         \
             {                                                                                            \
                 xum1541_dbg(1, "[RefuseToWorkInWrongMode] cmd blocked - Firmware has no tape support."); \
                 return XUM1541_Error_NoTapeSupport;                                                      \
             }                                                                                            \
                                                                                                          \
-            if (/*uh->*/DeviceDriveMode == DeviceDriveMode_Disk)                                             \
+            if (HandleXum1541->DeviceDriveMode == DeviceDriveMode_Disk)                                      \
             {                                                                                            \
                 xum1541_dbg(1, "[RefuseToWorkInWrongMode] cmd blocked - Tape cmd in disk mode.");        \
                 return XUM1541_Error_TapeCmdInDiskMode;                                                  \
@@ -584,7 +822,7 @@ xum1541_wait_status(usb_dev_handle *HandleXum1541)
         }                                                                                                \
         else /*isDiskCmd*/                                                                               \
         {                                                                                                \
-            if (/*uh->*/DeviceDriveMode == DeviceDriveMode_Tape)                                             \
+            if (HandleXum1541->DeviceDriveMode == DeviceDriveMode_Tape)                                      \
             {                                                                                            \
                 xum1541_dbg(1, "[RefuseToWorkInWrongMode] cmd blocked - Disk cmd in tape mode.");        \
                 return XUM1541_Error_DiskCmdInTapeMode;                                                  \
@@ -613,7 +851,7 @@ xum1541_wait_status(usb_dev_handle *HandleXum1541)
    info from the device such as the active IEC lines.
 */
 int
-xum1541_ioctl(usb_dev_handle *HandleXum1541, unsigned int cmd, unsigned int addr, unsigned int secaddr)
+xum1541_ioctl(struct xum1541_usb_handle *HandleXum1541, unsigned int cmd, unsigned int addr, unsigned int secaddr)
 {
     int nBytes, ret;
     unsigned char cmdBuf[XUM_CMDBUF_SIZE];
@@ -623,13 +861,17 @@ xum1541_ioctl(usb_dev_handle *HandleXum1541, unsigned int cmd, unsigned int addr
 
     RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
 
+    // Let everything queued before this command go out first
+    if (xum1541_queue_flush(HandleXum1541) < 0)
+        return -1;
+
     cmdBuf[0] = (unsigned char)cmd;
     cmdBuf[1] = (unsigned char)addr;
     cmdBuf[2] = (unsigned char)secaddr;
     cmdBuf[3] = 0;
 
     // Send the 4-byte command block
-    nBytes = usb.bulk_write(HandleXum1541,
+    nBytes = usb.bulk_write(HandleXum1541->devh,
         XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
         (char *)cmdBuf, sizeof(cmdBuf), LIBUSB_NO_TIMEOUT);
     if (nBytes < 0) {
@@ -653,7 +895,7 @@ xum1541_ioctl(usb_dev_handle *HandleXum1541, unsigned int cmd, unsigned int addr
    Returns the value the USB device sent back.
 */
 int
-xum1541_tap_break(usb_dev_handle *HandleXum1541)
+xum1541_tap_break(struct xum1541_usb_handle *HandleXum1541)
 {
     BOOL isTapeCmd = TRUE;
     RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
@@ -683,7 +925,7 @@ xum1541_tap_break(usb_dev_handle *HandleXum1541)
     fatal error, returns -1.
 */
 int
-xum1541_write(usb_dev_handle *HandleXum1541, unsigned char modeFlags, const unsigned char *data, size_t size)
+xum1541_write(struct xum1541_usb_handle *HandleXum1541, unsigned char modeFlags, const unsigned char *data, size_t size)
 {
     int wr, mode, ret;
     size_t bytesWritten, bytes2write;
@@ -696,12 +938,29 @@ xum1541_write(usb_dev_handle *HandleXum1541, unsigned char modeFlags, const unsi
 
     RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
 
+    /*
+     * Without a status to wait for, the command block and the data can
+     * go out together through the transfer queue.
+     */
+    if (!isTapeCmd && mode != XUM1541_CBM &&
+        size > 0 && size <= XUM_MAX_XFER_SIZE) {
+        if (xum1541_queue_write(HandleXum1541, modeFlags, data, size, &wr) < 0 ||
+            xum1541_queue_flush(HandleXum1541) < 0)
+            return -1;
+        xum1541_dbg(2, "write done, got %d bytes", wr);
+        return wr;
+    }
+
+    // Everything else runs synchronously after what has been queued
+    if (xum1541_queue_flush(HandleXum1541) < 0)
+        return -1;
+
     // Send the write command
     cmdBuf[0] = XUM1541_WRITE;
     cmdBuf[1] = modeFlags;
     cmdBuf[2] = size & 0xff;
     cmdBuf[3] = (size >> 8) & 0xff;
-    wr = usb.bulk_write(HandleXum1541,
+    wr = usb.bulk_write(HandleXum1541->devh,
         XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
         (char *)cmdBuf, sizeof(cmdBuf), LIBUSB_NO_TIMEOUT);
     if (wr < 0) {
@@ -715,15 +974,15 @@ xum1541_write(usb_dev_handle *HandleXum1541, unsigned char modeFlags, const unsi
         bytes2write = size - bytesWritten;
         if (bytes2write > XUM_MAX_XFER_SIZE)
             bytes2write = XUM_MAX_XFER_SIZE;
-        wr = usb.bulk_write(HandleXum1541,
+        wr = usb.bulk_write(HandleXum1541->devh,
             XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
             (char *)data, bytes2write, LIBUSB_NO_TIMEOUT);
         if (wr < 0) {
             if (isTapeCmd)
             {
-                if (usb.resetep(HandleXum1541, XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT) < 0)
+                if (usb.resetep(HandleXum1541->devh, XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT) < 0)
                     fprintf(stderr, "USB reset ep request failed for out ep (tape stall): %s\n", usb.strerror());
-                if (usb.control_msg(HandleXum1541, USB_RECIP_ENDPOINT, USB_REQ_CLEAR_FEATURE, 0, XUM_BULK_OUT_ENDPOINT, NULL, 0, USB_TIMEOUT) < 0)
+                if (usb.control_msg(HandleXum1541->devh, USB_RECIP_ENDPOINT, USB_REQ_CLEAR_FEATURE, 0, XUM_BULK_OUT_ENDPOINT, NULL, 0, USB_TIMEOUT) < 0)
                     fprintf(stderr, "USB error in xum1541_control_msg (tape stall): %s\n", usb.strerror());
                 return bytesWritten;
             }
@@ -772,7 +1031,7 @@ xum1541_write(usb_dev_handle *HandleXum1541, unsigned char modeFlags, const unsi
 */
 
 int
-xum1541_write_ext(usb_dev_handle *HandleXum1541, unsigned char modeFlags, const unsigned char *data, size_t size, int *Status, int *BytesWritten)
+xum1541_write_ext(struct xum1541_usb_handle *HandleXum1541, unsigned char modeFlags, const unsigned char *data, size_t size, int *Status, int *BytesWritten)
 {
     xum1541_dbg(1, "[xum1541_write_ext]");
     *BytesWritten = xum1541_write(HandleXum1541, modeFlags, data, size);
@@ -798,7 +1057,7 @@ xum1541_write_ext(usb_dev_handle *HandleXum1541, unsigned char modeFlags, const
 */
 
 int
-xum1541_read_ext(usb_dev_handle *HandleXum1541, unsigned char mode, unsigned char *data, size_t size, int *Status, int *BytesRead)
+xum1541_read_ext(struct xum1541_usb_handle *HandleXum1541, unsigned char mode, unsigned char *data, size_t size, int *Status, int *BytesRead)
 {
     xum1541_dbg(1, "[xum1541_read_ext]");
     *BytesRead = xum1541_read(HandleXum1541, mode, data, size);
@@ -830,7 +1089,7 @@ xum1541_read_ext(usb_dev_handle *HandleXum1541, unsigned char mode, unsigned cha
     fatal error, returns -1.
 */
 int
-xum1541_read(usb_dev_handle *HandleXum1541, unsigned char mode, unsigned char *data, size_t size)
+xum1541_read(struct xum1541_usb_handle *HandleXum1541, unsigned char mode, unsigned char *data, size_t size)
 {
     int rd;
     size_t bytesRead, bytes2read;
@@ -842,12 +1101,29 @@ xum1541_read(usb_dev_handle *HandleXum1541, unsigned char mode, unsigned char *d
 
     RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
 
+    /*
+     * Submit the command block and the data transfer together through the
+     * transfer queue, so the IN transfer is already pending when the
+     * firmware starts sending.
+     */
+    if (!isTapeCmd && size > 0 && size <= XUM_MAX_XFER_SIZE) {
+        if (xum1541_queue_read(HandleXum1541, mode, data, size, &rd) < 0 ||
+            xum1541_queue_flush(HandleXum1541) < 0)
+            return -1;
+        xum1541_dbg(2, "read done, got %d bytes", rd);
+        return rd;
+    }
+
+    // Everything else runs synchronously after what has been queued
+    if (xum1541_queue_flush(HandleXum1541) < 0)
+        return -1;
+
     // Send the read command
     cmdBuf[0] = XUM1541_READ;
     cmdBuf[1] = mode;
     cmdBuf[2] = size & 0xff;
     cmdBuf[3] = (size >> 8) & 0xff;
-    rd = usb.bulk_write(HandleXum1541,
+    rd = usb.bulk_write(HandleXum1541->devh,
         XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
         (char *)cmdBuf, sizeof(cmdBuf), LIBUSB_NO_TIMEOUT);
     if (rd < 0) {
@@ -862,7 +1138,7 @@ xum1541_read(usb_dev_handle *HandleXum1541, unsigned char mode, unsigned char *d
         bytes2read = size - bytesRead;
         if (bytes2read > XUM_MAX_XFER_SIZE)
             bytes2read = XUM_MAX_XFER_SIZE;
-        rd = usb.bulk_read(HandleXum1541,
+        rd = usb.bulk_read(HandleXum1541->devh,
             XUM_BULK_IN_ENDPOINT | USB_ENDPOINT_IN,
             (char *)data, bytes2read, LIBUSB_NO_TIMEOUT);
         if (rd < 0) {
@@ -886,3 +1162,2007 @@ xum1541_read(usb_dev_handle *HandleXum1541, unsigned char mode, unsigned char *d
     xum1541_dbg(2, "read done, got %d bytes", bytesRead);
     return bytesRead;
 }
+
+/*! \brief Read a data stream of unknown length from the xum1541 device
+
+ The data is read into buffers provided by the caller one after the
+ other, until the device ends the transfer with a short packet. This
+ is used for tape captures, which are only ended by the firmware.
+
+ \param HandleXum1541
+   A XUM1541_HANDLE which contains the file handle of the USB device.
+
+ \param mode
+    Drive protocol to use to read the data from the device.
+
+ \param GetBuffer
+    Called to get the next buffer to fill.
+
+ \param PutBuffer
+    Called with each buffer after it has been filled.
+
+ \param Context
+    Given to GetBuffer and PutBuffer.
+
+ \param Status
+   The return status.
+
+ \param BytesRead
+   The number of bytes read in total.
+
+ \return
+     1 : Finished successfully.
+    <0 : Fatal error, or GetBuffer aborted the transfer.
+*/
+int
+xum1541_read_stream_ext(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    CBM_TAP_STREAM_GET GetBuffer, CBM_TAP_STREAM_PUT PutBuffer, void *Context,
+    int *Status, int *BytesRead)
+{
+    int rd;
+    unsigned int filled, length, bytes2read;
+    unsigned char *buffer;
+    unsigned char cmdBuf[XUM_CMDBUF_SIZE];
+    BOOL done = FALSE;
+    BOOL isTapeCmd = ((mode == XUM1541_TAP) || (mode == XUM1541_TAP_CONFIG));
+
+    xum1541_dbg(1, "[xum1541_read_stream_ext] %d", mode);
+
+    *BytesRead = 0;
+
+    RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
+
+    if (xum1541_queue_flush(HandleXum1541) < 0)
+        return -1;
+
+    // The length is only known when the firmware stops sending.
+    cmdBuf[0] = XUM1541_READ;
+    cmdBuf[1] = mode;
+    cmdBuf[2] = 0;
+    cmdBuf[3] = 0;
+    rd = usb.bulk_write(HandleXum1541->devh,
+        XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
+        (char *)cmdBuf, sizeof(cmdBuf), LIBUSB_NO_TIMEOUT);
+    if (rd < 0) {
+        fprintf(stderr, "USB error in read cmd: %s\n",
+            usb.strerror());
+        return -1;
+    }
+
+    while (!done) {
+        buffer = GetBuffer(Context, &length);
+        if (buffer == NULL) {
+            xum1541_dbg(1, "[xum1541_read_stream_ext] aborted after %d bytes", *BytesRead);
+            return -1;
+        }
+
+        filled = 0;
+        while (filled < length) {
+            bytes2read = length - filled;
+            if (bytes2read > XUM_MAX_XFER_SIZE)
+                bytes2read = XUM_MAX_XFER_SIZE;
+            rd = usb.bulk_read(HandleXum1541->devh,
+                XUM_BULK_IN_ENDPOINT | USB_ENDPOINT_IN,
+                (char *)buffer + filled, bytes2read, LIBUSB_NO_TIMEOUT);
+            if (rd < 0) {
+                fprintf(stderr, "USB error in read data(%p, %d): %s\n",
+                   buffer, (int)length, usb.strerror());
+                PutBuffer(Context, buffer, filled);
+                return -1;
+            }
+
+            filled += rd;
+
+            // A short read ends the transfer.
+            if (rd < (int)bytes2read) {
+                done = TRUE;
+                break;
+            }
+        }
+
+        *BytesRead += filled;
+        PutBuffer(Context, buffer, filled);
+    }
+
+    xum1541_dbg(2, "[xum1541_read_stream_ext] BytesRead = %d", *BytesRead);
+    *Status = xum1541_wait_status(HandleXum1541);
+    xum1541_dbg(2, "[xum1541_read_stream_ext] Status = %d", *Status);
+    return 1;
+}
+
+// Check a block stream request, and whether the firmware can do it
+static int
+xum1541_blocks_ok(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    unsigned int blocks, unsigned int blockSize)
+{
+    if (blocks == 0 || blockSize == 0 || blockSize > 256 ||
+        (mode == XUM1541_PP && (blockSize & 1) != 0)) {
+        fprintf(stderr, "xum1541 block stream: invalid request\n");
+        return -1;
+    }
+    switch (mode) {
+    case XUM1541_S1:
+    case XUM1541_S2:
+    case XUM1541_PP:
+    case XUM1541_P2:
+        break;
+    default:
+        fprintf(stderr, "xum1541 block stream: invalid protocol %d\n", mode);
+        return -1;
+    }
+    return HandleXum1541->maxBlocks != 0;
+}
+
+// Send the command block of a block stream
+static int
+xum1541_blocks_cmd(struct xum1541_usb_handle *HandleXum1541, unsigned char cmd,
+    unsigned char mode, unsigned int blocks, unsigned int blockSize)
+{
+    unsigned char cmdBuf[XUM_CMDBUF_SIZE];
+
+    cmdBuf[0] = cmd;
+    cmdBuf[1] = mode;
+    cmdBuf[2] = (unsigned char)blocks;
+    cmdBuf[3] = blockSize & 0xff;  // 256 is sent as 0
+    if (usb.bulk_write(HandleXum1541->devh,
+        XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
+        (char *)cmdBuf, sizeof(cmdBuf), LIBUSB_NO_TIMEOUT) != sizeof(cmdBuf)) {
+        fprintf(stderr, "USB error in block stream cmd: %s\n",
+            usb.strerror());
+        return -1;
+    }
+    return 0;
+}
+
+/*! \brief Read a number of equally sized blocks from the xum1541 device
+
+ All blocks are read with one command, and the firmware reports once at
+ the end how many of them it transferred. If the data is a multiple of
+ the bulk endpoint size, this status is read together with the last data
+ packet.
+
+ Firmware without block streams gets a plain read of all the data.
+
+ \param HandleXum1541
+   A XUM1541_HANDLE which contains the file handle of the USB device.
+
+ \param mode
+    Speeder protocol to use: XUM1541_S1, XUM1541_S2, XUM1541_PP or XUM1541_P2.
+
+ \param data
+    Pointer to a buffer which will contain the blocks read
+
+ \param blocks
+    The number of blocks to read
+
+ \param blockSize
+    The size of each block, 1 to 256 bytes (even for XUM1541_PP)
+
+ \return
+    The number of blocks read completely. If there is a fatal error,
+    returns -1.
+*/
+int
+xum1541_read_blocks(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    unsigned char *data, unsigned int blocks, unsigned int blockSize)
+{
+    unsigned char tail[64 + XUM_STATUSBUF_SIZE], *statusBuf;
+    unsigned int n, size, head, bytesRead, bytes2read, done;
+    int rd, ret;
+    BOOL isTapeCmd = FALSE;
+
+    xum1541_dbg(1, "read %d blocks of %d bytes, protocol %d",
+        blocks, blockSize, mode);
+
+    RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
+
+    ret = xum1541_blocks_ok(HandleXum1541, mode, blocks, blockSize);
+    if (ret < 0)
+        return -1;
+    if (ret == 0) {
+        rd = xum1541_read(HandleXum1541, mode, data, blocks * blockSize);
+        return (rd < 0) ? rd : rd / (int)blockSize;
+    }
+
+    if (xum1541_queue_flush(HandleXum1541) < 0)
+        return -1;
+
+    for (done = 0; done < blocks; done += n) {
+        n = blocks - done;
+        if (n > HandleXum1541->maxBlocks)
+            n = HandleXum1541->maxBlocks;
+        size = n * blockSize;
+
+        if (xum1541_blocks_cmd(HandleXum1541, XUM1541_READ_BLOCKS, mode,
+            n, blockSize) < 0)
+            return -1;
+
+        // Keep the last packet back if the status can follow it directly.
+        head = size;
+        if (HandleXum1541->endpointSize != 0 &&
+            HandleXum1541->endpointSize <= sizeof(tail) - XUM_STATUSBUF_SIZE &&
+            size % HandleXum1541->endpointSize == 0)
+            head -= HandleXum1541->endpointSize;
+
+        for (bytesRead = 0; bytesRead < head; bytesRead += rd) {
+            bytes2read = head - bytesRead;
+            if (bytes2read > XUM_MAX_XFER_SIZE)
+                bytes2read = XUM_MAX_XFER_SIZE;
+            rd = usb.bulk_read(HandleXum1541->devh,
+                XUM_BULK_IN_ENDPOINT | USB_ENDPOINT_IN,
+                (char *)data + bytesRead, bytes2read, LIBUSB_NO_TIMEOUT);
+            if (rd != (int)bytes2read) {
+                fprintf(stderr, "USB error in block stream data: %s\n",
+                    usb.strerror());
+                return -1;
+            }
+        }
+
+        if (head != size) {
+            rd = usb.bulk_read(HandleXum1541->devh,
+                XUM_BULK_IN_ENDPOINT | USB_ENDPOINT_IN, (char *)tail,
+                HandleXum1541->endpointSize + XUM_STATUSBUF_SIZE,
+                LIBUSB_NO_TIMEOUT);
+            if (rd != (int)(HandleXum1541->endpointSize + XUM_STATUSBUF_SIZE)) {
+                fprintf(stderr, "USB error in block stream status: %s\n",
+                    usb.strerror());
+                return -1;
+            }
+            memcpy(data + head, tail, HandleXum1541->endpointSize);
+            statusBuf = tail + HandleXum1541->endpointSize;
+            if (XUM_GET_STATUS(statusBuf) == XUM1541_IO_READY)
+                ret = XUM_GET_STATUS_VAL(statusBuf);
+            else
+                ret = -1;
+        } else {
+            ret = xum1541_wait_status(HandleXum1541);
+        }
+
+        xum1541_dbg(2, "block stream read %d of %d blocks", ret, n);
+        if (ret < 0)
+            return -1;
+        if ((unsigned int)ret < n)
+            return done + ret;
+        data += size;
+    }
+    return done;
+}
+
+/*! \brief Write a number of equally sized blocks to the xum1541 device
+
+ All blocks are written with one command, and the firmware reports once
+ at the end how many of them it transferred.
+
+ Firmware without block streams gets a plain write of all the data.
+
+ \param HandleXum1541
+   A XUM1541_HANDLE which contains the file handle of the USB device.
+
+ \param mode
+    Speeder protocol to use: XUM1541_S1, XUM1541_S2, XUM1541_PP or XUM1541_P2.
+
+ \param data
+    Pointer to buffer which contains the blocks to be written
+
+ \param blocks
+    The number of blocks to write
+
+ \param blockSize
+    The size of each block, 1 to 256 bytes (even for XUM1541_PP)
+
+ \return
+    The number of blocks written completely. If there is a fatal error,
+    returns -1.
+*/
+int
+xum1541_write_blocks(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    const unsigned char *data, unsigned int blocks, unsigned int blockSize)
+{
+    unsigned int n, size, bytesWritten, bytes2write, done;
+    int wr, ret;
+    BOOL isTapeCmd = FALSE;
+
+    xum1541_dbg(1, "write %d blocks of %d bytes, protocol %d",
+        blocks, blockSize, mode);
+
+    RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
+
+    ret = xum1541_blocks_ok(HandleXum1541, mode, blocks, blockSize);
+    if (ret < 0)
+        return -1;
+    if (ret == 0) {
+        wr = xum1541_write(HandleXum1541, mode, data, blocks * blockSize);
+        return (wr < 0) ? wr : wr / (int)blockSize;
+    }
+
+    if (xum1541_queue_flush(HandleXum1541) < 0)
+        return -1;
+
+    for (done = 0; done < blocks; done += n) {
+        n = blocks - done;
+        if (n > HandleXum1541->maxBlocks)
+            n = HandleXum1541->maxBlocks;
+        size = n * blockSize;
+
+        if (xum1541_blocks_cmd(HandleXum1541, XUM1541_WRITE_BLOCKS, mode,
+            n, blockSize) < 0)
+            return -1;
+
+        for (bytesWritten = 0; bytesWritten < size; bytesWritten += wr) {
+            bytes2write = size - bytesWritten;
+            if (bytes2write > XUM_MAX_XFER_SIZE)
+                bytes2write = XUM_MAX_XFER_SIZE;
+            wr = usb.bulk_write(HandleXum1541->devh,
+                XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
+                (char *)data + bytesWritten, bytes2write, LIBUSB_NO_TIMEOUT);
+            if (wr != (int)bytes2write) {
+                fprintf(stderr, "USB error in block stream data: %s\n",
+                    usb.strerror());
+                return -1;
+            }
+        }
+
+        ret = xum1541_wait_status(HandleXum1541);
+        xum1541_dbg(2, "block stream wrote %d of %d blocks", ret, n);
+        if (ret < 0)
+            return -1;
+        if ((unsigned int)ret < n)
+            return done + ret;
+        data += size;
+    }
+    return done;
+}
+
+/*! \brief Read the sectors of a track from a drive running the warp read
+
+ The track map is written to the drive, which sends the sectors it
+ reads. The firmware passes on the GCR data of all of them in one
+ stream, and the sector numbers and job states at its end, so there is
+ no request of the host between two sectors.
+
+ Firmware without XUM1541_CAP_TRACK gets a write of the map and a read
+ for every sector instead.
+
+ \param HandleXum1541
+   A XUM1541_HANDLE which contains the file handle of the USB device.
+
+ \param mode
+    Speeder protocol to use: XUM1541_S1, XUM1541_S2 or XUM1541_PP.
+
+ \param map
+    Track number, sector count and map, as the drive expects them
+
+ \param mapSize
+    The size of map, 2 to 255 bytes (even for XUM1541_PP)
+
+ \param sectors
+    The number of sectors the drive will send, 1 to XUM_TRACK_MAX_SECTORS
+
+ \param data
+    Pointer to a buffer for sectors * XUM_TRACK_GCR_SIZE bytes. The GCR
+    data of the sectors read without error is stored here back to back.
+
+ \param results
+    Pointer to a buffer for sectors * 2 bytes, which gets the sector
+    number and the job status of every sector sent by the drive.
+
+ \return
+    The number of sectors in results; only the last one can have failed.
+    If there is a fatal error, returns -1.
+*/
+int
+xum1541_read_track(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    const unsigned char *map, unsigned int mapSize, unsigned int sectors,
+    unsigned char *data, unsigned char *results)
+{
+    unsigned char cmdBuf[XUM_CMDBUF_SIZE], header[4];
+    unsigned char buf[XUM_TRACK_MAX_SECTORS * (XUM_TRACK_GCR_SIZE + 2)];
+    unsigned int good, headerSize;
+    int rd, ret;
+    BOOL isTapeCmd = FALSE;
+
+    xum1541_dbg(1, "read track of %d sectors, protocol %d", sectors, mode);
+
+    RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
+
+    if (sectors == 0 || sectors > XUM_TRACK_MAX_SECTORS ||
+        mapSize < 2 || mapSize > 255 ||
+        (mode == XUM1541_PP && (mapSize & 1) != 0) ||
+        (mode != XUM1541_S1 && mode != XUM1541_S2 && mode != XUM1541_PP)) {
+        fprintf(stderr, "xum1541 track read: invalid request\n");
+        return -1;
+    }
+
+    if ((HandleXum1541->capabilities & XUM1541_CAP_TRACK) == 0) {
+        if (xum1541_write(HandleXum1541, mode, map, mapSize) != (int)mapSize)
+            return -1;
+        // PP sends every byte of the header as the second of a pair
+        headerSize = (mode == XUM1541_PP) ? 4 : 2;
+        for (ret = 0; ret < (int)sectors; ) {
+            if (xum1541_read(HandleXum1541, mode, header, headerSize) !=
+                (int)headerSize)
+                return -1;
+            results[2 * ret] = header[headerSize / 2 - 1];
+            results[2 * ret + 1] = header[headerSize - 1];
+            if (results[2 * ret++ + 1] != 0)
+                break;
+            if (xum1541_read(HandleXum1541, mode, data,
+                XUM_TRACK_GCR_SIZE) != XUM_TRACK_GCR_SIZE)
+                return -1;
+            data += XUM_TRACK_GCR_SIZE;
+        }
+        return ret;
+    }
+
+    if (xum1541_queue_flush(HandleXum1541) < 0)
+        return -1;
+
+    cmdBuf[0] = XUM1541_READ_TRACK;
+    cmdBuf[1] = mode;
+    cmdBuf[2] = (unsigned char)sectors;
+    cmdBuf[3] = (unsigned char)mapSize;
+    if (usb.bulk_write(HandleXum1541->devh,
+        XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
+        (char *)cmdBuf, sizeof(cmdBuf), LIBUSB_NO_TIMEOUT) != sizeof(cmdBuf) ||
+        usb.bulk_write(HandleXum1541->devh,
+        XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
+        (char *)map, mapSize, LIBUSB_NO_TIMEOUT) != (int)mapSize) {
+        fprintf(stderr, "USB error in track read cmd: %s\n", usb.strerror());
+        return -1;
+    }
+
+    // A failed sector ends the stream early, with a short packet.
+    rd = usb.bulk_read(HandleXum1541->devh,
+        XUM_BULK_IN_ENDPOINT | USB_ENDPOINT_IN, (char *)buf,
+        sectors * (XUM_TRACK_GCR_SIZE + 2), LIBUSB_NO_TIMEOUT);
+    if (rd < 0) {
+        fprintf(stderr, "USB error in track read data: %s\n", usb.strerror());
+        return -1;
+    }
+
+    ret = xum1541_wait_status(HandleXum1541);
+    xum1541_dbg(2, "track read %d of %d sectors, %d bytes", ret, sectors, rd);
+    if (ret <= 0 || ret > (int)sectors)
+        return -1;
+
+    // The last pair tells if the last sector has data
+    good = ret;
+    if (rd >= 2 && buf[rd - 1] != 0)
+        good--;
+    if ((unsigned int)rd != good * XUM_TRACK_GCR_SIZE + 2 * ret) {
+        fprintf(stderr, "xum1541 track read: bad length %d\n", rd);
+        return -1;
+    }
+    memcpy(data, buf, good * XUM_TRACK_GCR_SIZE);
+    memcpy(results, buf + good * XUM_TRACK_GCR_SIZE, 2 * ret);
+    return ret;
+}
+
+/*-------------------------------------------------------------------*/
+/*--------- QUEUED TRANSFERS ----------------------------------------*/
+
+/*
+ * Fallback transport for a libusb without asynchronous transfers.
+ * A submitted transfer is only remembered, and run synchronously when it
+ * is reaped. As the queue reaps in submission order, this gives exactly
+ * the same sequence of USB transactions as the unqueued code.
+ */
+struct xum1541_sync_urb {
+    usb_dev_handle *HandleXum1541;
+    int ep;
+    unsigned char *data;
+    int size;
+};
+
+static int
+xum1541_sync_submit(struct xum1541_usb_handle *HandleXum1541, int ep,
+    unsigned char *data, int size, void **Urb)
+{
+    struct xum1541_sync_urb *urb;
+
+    urb = malloc(sizeof(*urb));
+    if (urb == NULL)
+        return -1;
+
+    urb->HandleXum1541 = HandleXum1541->devh;
+    urb->ep = ep;
+    urb->data = data;
+    urb->size = size;
+    *Urb = urb;
+    return 0;
+}
+
+static int
+xum1541_sync_reap(void *Urb, int timeout)
+{
+    struct xum1541_sync_urb *urb = Urb;
+
+    if (urb->ep & USB_ENDPOINT_IN) {
+        return usb.bulk_read(urb->HandleXum1541, urb->ep,
+            (char *)urb->data, urb->size, timeout);
+    } else {
+        return usb.bulk_write(urb->HandleXum1541, urb->ep,
+            (char *)urb->data, urb->size, timeout);
+    }
+}
+
+static void
+xum1541_sync_discard(void *Urb)
+{
+    free(Urb);
+}
+
+static const xum1541_transport_t xum1541_sync_transport = {
+    xum1541_sync_submit,
+    xum1541_sync_reap,
+    xum1541_sync_discard,
+    NULL
+};
+
+/*
+ * Transport using the asynchronous libusb calls (libusb-win32). All
+ * submitted transfers are really on the bus at the same time, so the
+ * IN transfer for a read is already waiting when the firmware starts
+ * sending, and the next command block is already in the device's OUT
+ * endpoint bank when the firmware finishes the current one.
+ */
+struct xum1541_async_urb {
+    void *context;
+    int reaped;
+};
+
+static int
+xum1541_async_submit(struct xum1541_usb_handle *HandleXum1541, int ep,
+    unsigned char *data, int size, void **Urb)
+{
+    struct xum1541_async_urb *urb;
+
+    urb = malloc(sizeof(*urb));
+    if (urb == NULL)
+        return -1;
+
+    urb->context = NULL;
+    urb->reaped = 0;
+    if (usb.bulk_setup_async(HandleXum1541->devh, &urb->context,
+        (unsigned char)ep) < 0) {
+        free(urb);
+        return -1;
+    }
+    if (usb.submit_async(urb->context, (char *)data, size) < 0) {
+        usb.free_async(&urb->context);
+        free(urb);
+        return -1;
+    }
+
+    *Urb = urb;
+    return 0;
+}
+
+static int
+xum1541_async_reap(void *Urb, int timeout)
+{
+    struct xum1541_async_urb *urb = Urb;
+
+    urb->reaped = 1;
+    return usb.reap_async(urb->context, timeout);
+}
+
+static void
+xum1541_async_discard(void *Urb)
+{
+    struct xum1541_async_urb *urb = Urb;
+
+    if (!urb->reaped)
+        usb.cancel_async(urb->context);
+    usb.free_async(&urb->context);
+    free(urb);
+}
+
+static const xum1541_transport_t xum1541_async_transport = {
+    xum1541_async_submit,
+    xum1541_async_reap,
+    xum1541_async_discard,
+    NULL
+};
+
+/*
+ * Transport running the synchronous libusb calls in worker threads, for
+ * a libusb without asynchronous transfers (the libusb 0.1 API on Linux and
+ * Mac OS X). Each device gets one worker for its bulk OUT endpoint and one
+ * for its bulk IN endpoint, and each worker runs its transfers in
+ * submission order. So the next command block is written while the data
+ * of the current command is still being read, as with the asynchronous
+ * calls. This needs a libusb which allows calls on one handle from
+ * several threads at the same time, as libusb-compat on top of
+ * libusb-1.0 does; XUM1541_QUEUE=sync in the environment falls back to
+ * the synchronous transport.
+ *
+ * A synchronous transfer cannot be cancelled. So an IN transfer is only
+ * started after the OUT transfers submitted before it, that is, after its
+ * command block went out, and once a transfer failed, the ones not yet
+ * started fail without going to the device, until all of them are gone.
+ */
+#define XUM1541_THREAD_QUEUED   0 // waiting for the worker
+#define XUM1541_THREAD_RUNNING  1 // the worker runs the transfer
+#define XUM1541_THREAD_DONE     2 // finished, result is valid
+
+#define XUM1541_THREAD_OUT      0 // index of the worker of the OUT endpoint
+#define XUM1541_THREAD_IN       1 // index of the worker of the IN endpoint
+
+struct xum1541_thread_state;
+
+struct xum1541_thread_urb {
+    struct xum1541_thread_state *state;
+    int pipe;                       // XUM1541_THREAD_OUT or _IN
+    int ep;
+    unsigned char *data;
+    int size;
+    unsigned int after;             // OUT transfers to finish before this
+    int status;                     // XUM1541_THREAD_xxx
+    int result;                     // byte count or < 0, when done
+    int reaped;
+    ARCH_SEMAPHORE *done;           // posted when the transfer is done
+    struct xum1541_thread_urb *next;
+};
+
+// A worker and the transfers waiting for it
+struct xum1541_thread_pipe {
+    struct xum1541_thread_state *state;
+    ARCH_THREAD *thread;
+    ARCH_SEMAPHORE *work;           // wakes up the worker to look again
+    struct xum1541_thread_urb *head, *tail;
+    int stop;
+};
+
+// The per-device state of the transport
+struct xum1541_thread_state {
+    usb_dev_handle *devh;
+    ARCH_SEMAPHORE *lock;           // protects everything below and the urbs
+    struct xum1541_thread_pipe pipe[2];
+    unsigned int outSubmitted;      // OUT transfers submitted so far
+    unsigned int outDone;           // OUT transfers finished or discarded
+    unsigned int pending;           // transfers not yet discarded
+    int failed;                     // a transfer failed since pending was 0
+};
+
+static void
+xum1541_thread_worker(void *Context)
+{
+    struct xum1541_thread_pipe *pipe = Context;
+    struct xum1541_thread_state *state = pipe->state;
+    struct xum1541_thread_urb *urb;
+    int ret, failed;
+
+    for (;;) {
+        arch_semaphore_wait(state->lock);
+        for (;;) {
+            urb = pipe->head;
+            if (urb != NULL && (urb->pipe == XUM1541_THREAD_OUT ||
+                state->failed || state->outDone >= urb->after))
+                break;
+            if (urb == NULL && pipe->stop) {
+                arch_semaphore_post(state->lock);
+                return;
+            }
+            arch_semaphore_post(state->lock);
+            arch_semaphore_wait(pipe->work);
+            arch_semaphore_wait(state->lock);
+        }
+        pipe->head = urb->next;
+        if (pipe->head == NULL)
+            pipe->tail = NULL;
+        urb->status = XUM1541_THREAD_RUNNING;
+        failed = state->failed;
+        arch_semaphore_post(state->lock);
+
+        // The unqueued calls do not time out either
+        if (failed) {
+            ret = -1;
+        } else if (urb->pipe == XUM1541_THREAD_IN) {
+            ret = usb.bulk_read(state->devh, urb->ep,
+                (char *)urb->data, urb->size, LIBUSB_NO_TIMEOUT);
+        } else {
+            ret = usb.bulk_write(state->devh, urb->ep,
+                (char *)urb->data, urb->size, LIBUSB_NO_TIMEOUT);
+        }
+
+        arch_semaphore_wait(state->lock);
+        urb->result = ret;
+        urb->status = XUM1541_THREAD_DONE;
+        if (ret < 0)
+            state->failed = 1;
+        if (urb->pipe == XUM1541_THREAD_OUT || ret < 0) {
+            if (urb->pipe == XUM1541_THREAD_OUT)
+                state->outDone++;
+            arch_semaphore_post(state->pipe[XUM1541_THREAD_IN].work);
+        }
+        arch_semaphore_post(urb->done);
+        arch_semaphore_post(state->lock);
+    }
+}
+
+static void
+xum1541_thread_close(struct xum1541_usb_handle *HandleXum1541)
+{
+    struct xum1541_thread_state *state = HandleXum1541->queue.transportData;
+    struct xum1541_thread_pipe *pipe;
+    int i;
+
+    if (state == NULL)
+        return;
+
+    for (i = 0; i < 2; i++) {
+        pipe = &state->pipe[i];
+        if (pipe->thread != NULL) {
+            arch_semaphore_wait(state->lock);
+            pipe->stop = 1;
+            arch_semaphore_post(state->lock);
+            arch_semaphore_post(pipe->work);
+            arch_thread_join(pipe->thread);
+        }
+        if (pipe->work != NULL)
+            arch_semaphore_destroy(pipe->work);
+    }
+    if (state->lock != NULL)
+        arch_semaphore_destroy(state->lock);
+    free(state);
+    HandleXum1541->queue.transportData = NULL;
+}
+
+// Start the workers of a device; 0 on success
+static int
+xum1541_thread_open(struct xum1541_usb_handle *HandleXum1541)
+{
+    struct xum1541_thread_state *state;
+    struct xum1541_thread_pipe *pipe;
+    int i;
+
+    state = calloc(1, sizeof(*state));
+    if (state == NULL)
+        return -1;
+    HandleXum1541->queue.transportData = state;
+    state->devh = HandleXum1541->devh;
+
+    if (arch_semaphore_create(&state->lock, 1) != 0) {
+        state->lock = NULL;
+        xum1541_thread_close(HandleXum1541);
+        return -1;
+    }
+    for (i = 0; i < 2; i++) {
+        pipe = &state->pipe[i];
+        pipe->state = state;
+        if (arch_semaphore_create(&pipe->work, 0) != 0) {
+            pipe->work = NULL;
+            xum1541_thread_close(HandleXum1541);
+            return -1;
+        }
+        if (arch_thread_create(&pipe->thread, xum1541_thread_worker, pipe) != 0) {
+            pipe->thread = NULL;
+            xum1541_thread_close(HandleXum1541);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+xum1541_thread_submit(struct xum1541_usb_handle *HandleXum1541, int ep,
+    unsigned char *data, int size, void **Urb)
+{
+    struct xum1541_thread_state *state = HandleXum1541->queue.transportData;
+    struct xum1541_thread_pipe *pipe;
+    struct xum1541_thread_urb *urb;
+
+    urb = malloc(sizeof(*urb));
+    if (urb == NULL)
+        return -1;
+    if (arch_semaphore_create(&urb->done, 0) != 0) {
+        free(urb);
+        return -1;
+    }
+
+    urb->state = state;
+    urb->pipe = (ep & USB_ENDPOINT_IN) ? XUM1541_THREAD_IN : XUM1541_THREAD_OUT;
+    urb->ep = ep;
+    urb->data = data;
+    urb->size = size;
+    urb->status = XUM1541_THREAD_QUEUED;
+    urb->result = -1;
+    urb->reaped = 0;
+    urb->next = NULL;
+    pipe = &state->pipe[urb->pipe];
+
+    arch_semaphore_wait(state->lock);
+    if (state->pending++ == 0)
+        state->failed = 0;
+    if (urb->pipe == XUM1541_THREAD_OUT)
+        state->outSubmitted++;
+    urb->after = state->outSubmitted;
+    if (pipe->tail != NULL)
+        pipe->tail->next = urb;
+    else
+        pipe->head = urb;
+    pipe->tail = urb;
+    arch_semaphore_post(state->lock);
+    arch_semaphore_post(pipe->work);
+
+    *Urb = urb;
+    return 0;
+}
+
+static int
+xum1541_thread_reap(void *Urb, int timeout)
+{
+    struct xum1541_thread_urb *urb = Urb;
+
+    // the worker runs the transfer without a timeout, see above
+    arch_semaphore_wait(urb->done);
+    urb->reaped = 1;
+    return urb->result;
+}
+
+static void
+xum1541_thread_discard(void *Urb)
+{
+    struct xum1541_thread_urb *urb = Urb;
+    struct xum1541_thread_state *state = urb->state;
+    struct xum1541_thread_pipe *pipe = &state->pipe[urb->pipe];
+    struct xum1541_thread_urb **link, *prev = NULL;
+    int started = 1;
+
+    arch_semaphore_wait(state->lock);
+    if (!urb->reaped && urb->status == XUM1541_THREAD_QUEUED) {
+        // not started yet, just take it off the list
+        for (link = &pipe->head; *link != urb; link = &(*link)->next)
+            prev = *link;
+        *link = urb->next;
+        if (pipe->tail == urb)
+            pipe->tail = prev;
+        if (urb->pipe == XUM1541_THREAD_OUT) {
+            state->outDone++;
+            arch_semaphore_post(state->pipe[XUM1541_THREAD_IN].work);
+        }
+        started = 0;
+    }
+    arch_semaphore_post(state->lock);
+
+    // wait for the end of a transfer which was not reaped
+    if (started && !urb->reaped)
+        arch_semaphore_wait(urb->done);
+
+    arch_semaphore_wait(state->lock);
+    state->pending--;
+    arch_semaphore_post(state->lock);
+
+    arch_semaphore_destroy(urb->done);
+    free(urb);
+}
+
+static const xum1541_transport_t xum1541_thread_transport = {
+    xum1541_thread_submit,
+    xum1541_thread_reap,
+    xum1541_thread_discard,
+    xum1541_thread_close
+};
+
+// The transport for devices opened from now on, NULL for the default one
+static const xum1541_transport_t *xum1541_transport;
+
+/*! \brief Install a transport for queued transfers
+
+ \param Transport
+   The transport to use from now on, or NULL to select the default one.
+
+ \return
+   The transport that was active before.
+
+ \remark
+   A device keeps the transport of its first queued transfer until it
+   is closed, so this only affects devices which did not queue anything
+   yet.
+*/
+const xum1541_transport_t *
+xum1541_queue_set_transport(const xum1541_transport_t *Transport)
+{
+    const xum1541_transport_t *old = xum1541_transport;
+
+    xum1541_transport = Transport;
+    return old;
+}
+
+static const xum1541_transport_t *
+xum1541_queue_get_transport(struct xum1541_usb_handle *HandleXum1541)
+{
+    const xum1541_transport_t *transport = HandleXum1541->queue.transport;
+    const char *val;
+
+    if (transport != NULL)
+        return transport;
+
+    transport = xum1541_transport;
+    if (transport == NULL) {
+        val = getenv("XUM1541_QUEUE");
+        if (val != NULL && strcmp(val, "sync") == 0) {
+            xum1541_dbg(1, "queue forced to be synchronous");
+            transport = &xum1541_sync_transport;
+        } else if (usb.bulk_setup_async && usb.submit_async && usb.reap_async &&
+            usb.cancel_async && usb.free_async) {
+            xum1541_dbg(1, "using asynchronous USB transfers");
+            transport = &xum1541_async_transport;
+        } else if (xum1541_thread_open(HandleXum1541) == 0) {
+            xum1541_dbg(1, "no asynchronous USB transfers, using worker threads");
+            transport = &xum1541_thread_transport;
+        } else {
+            xum1541_dbg(1, "no worker threads, queue is synchronous");
+            transport = &xum1541_sync_transport;
+        }
+    }
+    HandleXum1541->queue.transport = transport;
+    return transport;
+}
+
+// Wait for the oldest transfer in flight and record its result
+static void
+xum1541_queue_reap_one(struct xum1541_usb_handle *HandleXum1541)
+{
+    const xum1541_transport_t *transport = xum1541_queue_get_transport(HandleXum1541);
+    struct xum1541_queue_entry *entry;
+    int nBytes;
+
+    entry = &HandleXum1541->queue.entries[HandleXum1541->queue.first];
+    HandleXum1541->queue.first = (HandleXum1541->queue.first + 1) % XUM1541_QUEUE_DEPTH;
+    HandleXum1541->queue.count--;
+
+    if (HandleXum1541->queue.error) {
+        // An earlier transfer failed, do not wait for the rest.
+        transport->discard(entry->urb);
+        return;
+    }
+
+    nBytes = transport->reap(entry->urb, LIBUSB_NO_TIMEOUT);
+    transport->discard(entry->urb);
+
+    if (nBytes < 0) {
+        fprintf(stderr, "USB error in queued transfer: %s\n",
+            usb.strerror());
+        HandleXum1541->queue.error = 1;
+    } else if (entry->kind == XUM1541_QUEUE_CMD) {
+        if (nBytes != XUM_CMDBUF_SIZE) {
+            fprintf(stderr, "USB error in queued cmd: short write\n");
+            HandleXum1541->queue.error = 1;
+        }
+    } else if (entry->kind == XUM1541_QUEUE_STATUS) {
+        if (nBytes != XUM_STATUSBUF_SIZE) {
+            fprintf(stderr, "USB error in queued status: short read\n");
+            HandleXum1541->queue.error = 1;
+        } else if (XUM_GET_STATUS(entry->statusBuf) == XUM1541_IO_READY) {
+            *entry->result = XUM_GET_STATUS_VAL(entry->statusBuf);
+        } else {
+            // The firmware never sends IO_BUSY for CBM writes
+            fprintf(stderr, "device reports error\n");
+            *entry->result = -1;
+        }
+        xum1541_dbg(2, "queued status done, %d", *entry->result);
+    } else {
+        xum1541_dbg(2, "queued transfer done, %d bytes", nBytes);
+        if (entry->result != NULL)
+            *entry->result = nBytes;
+    }
+}
+
+// Submit one transfer, making room in the queue first if necessary
+static int
+xum1541_queue_submit(struct xum1541_usb_handle *HandleXum1541, int ep,
+    unsigned char *data, int size, int kind, int *result)
+{
+    const xum1541_transport_t *transport = xum1541_queue_get_transport(HandleXum1541);
+    struct xum1541_queue_entry *entry;
+
+    if (HandleXum1541->queue.count == XUM1541_QUEUE_DEPTH)
+        xum1541_queue_reap_one(HandleXum1541);
+    if (HandleXum1541->queue.error)
+        return -1;
+
+    entry = &HandleXum1541->queue.entries[
+        (HandleXum1541->queue.first + HandleXum1541->queue.count) % XUM1541_QUEUE_DEPTH];
+    entry->kind = kind;
+    entry->result = result;
+    if (result != NULL)
+        *result = 0;
+    if (kind == XUM1541_QUEUE_CMD) {
+        // The caller's command block may be gone before the reap
+        memcpy(entry->cmdBuf, data, XUM_CMDBUF_SIZE);
+        data = entry->cmdBuf;
+    } else if (kind == XUM1541_QUEUE_STATUS) {
+        data = entry->statusBuf;
+    }
+
+    if (transport->submit(HandleXum1541, ep, data, size, &entry->urb) != 0) {
+        fprintf(stderr, "USB error submitting queued transfer: %s\n",
+            usb.strerror());
+        HandleXum1541->queue.error = 1;
+        return -1;
+    }
+    HandleXum1541->queue.count++;
+    return 0;
+}
+
+// Submit a command block and its data transfer
+static int
+xum1541_queue_cmd(struct xum1541_usb_handle *HandleXum1541, unsigned char cmd,
+    unsigned char mode, unsigned char *data, size_t size, int *result)
+{
+    unsigned char cmdBuf[XUM_CMDBUF_SIZE];
+    int ep;
+
+    cmdBuf[0] = cmd;
+    cmdBuf[1] = mode;
+    cmdBuf[2] = size & 0xff;
+    cmdBuf[3] = (size >> 8) & 0xff;
+    if (xum1541_queue_submit(HandleXum1541,
+        XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT,
+        cmdBuf, sizeof(cmdBuf), XUM1541_QUEUE_CMD, NULL) != 0)
+        return -1;
+
+    ep = (cmd == XUM1541_READ) ?
+        XUM_BULK_IN_ENDPOINT | USB_ENDPOINT_IN :
+        XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT;
+    return xum1541_queue_submit(HandleXum1541, ep, data, (int)size,
+        XUM1541_QUEUE_DATA, result);
+}
+
+/*! \brief Queue a read from the xum1541 device
+
+ \param HandleXum1541
+   A XUM1541_HANDLE which contains the file handle of the USB device.
+
+ \param mode
+    Drive protocol to use to read the data from the device (e.g,
+    XUM1541_S1). The tape protocols cannot be queued.
+
+ \param data
+    Pointer to a buffer which will contain the data read from the xum1541.
+    It must stay valid until xum1541_queue_flush() returned.
+
+ \param size
+    The number of bytes to read from the xum1541. This must not exceed
+    XUM_MAX_XFER_SIZE.
+
+ \param BytesRead
+    Will contain the number of bytes actually read after the next
+    xum1541_queue_flush().
+
+ \return
+    0 if the read was queued, < 0 on error.
+*/
+int
+xum1541_queue_read(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    unsigned char *data, size_t size, int *BytesRead)
+{
+    BOOL isTapeCmd = FALSE;
+
+    xum1541_dbg(1, "queue read %d %d bytes to address %p",
+        mode, size, data);
+
+    RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
+
+    if (mode == XUM1541_TAP || mode == XUM1541_TAP_CONFIG ||
+        size == 0 || size > XUM_MAX_XFER_SIZE) {
+        fprintf(stderr, "xum1541_queue_read: invalid request\n");
+        return -1;
+    }
+
+    return xum1541_queue_cmd(HandleXum1541, XUM1541_READ, mode,
+        data, size, BytesRead);
+}
+
+/*! \brief Queue a write to the xum1541 device
+
+ \param HandleXum1541
+   A XUM1541_HANDLE which contains the file handle of the USB device.
+
+ \param mode
+    Drive protocol to use to write the data to the device (e.g,
+    XUM1541_S1). XUM1541_CBM and the tape protocols cannot be queued,
+    as they report a status after the data.
+
+ \param data
+    Pointer to buffer which contains the data to be written to the xum1541.
+    It must stay valid until xum1541_queue_flush() returned.
+
+ \param size
+    The number of bytes to write to the xum1541. This must not exceed
+    XUM_MAX_XFER_SIZE.
+
+ \param BytesWritten
+    Will contain the number of bytes actually written after the next
+    xum1541_queue_flush().
+
+ \return
+    0 if the write was queued, < 0 on error.
+*/
+int
+xum1541_queue_write(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    const unsigned char *data, size_t size, int *BytesWritten)
+{
+    BOOL isTapeCmd = FALSE;
+
+    xum1541_dbg(1, "queue write %d %d bytes from address %p",
+        mode, size, data);
+
+    RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
+
+    if (XUM_RW_PROTO(mode) == XUM1541_CBM || mode == XUM1541_TAP ||
+        mode == XUM1541_TAP_CONFIG || size == 0 || size > XUM_MAX_XFER_SIZE) {
+        fprintf(stderr, "xum1541_queue_write: invalid request\n");
+        return -1;
+    }
+
+    return xum1541_queue_cmd(HandleXum1541, XUM1541_WRITE, mode,
+        (unsigned char *)data, size, BytesWritten);
+}
+
+/*! \brief Queue a CBM write to the xum1541 device, including its status
+
+ This is the queued counterpart of xum1541_write() with XUM1541_CBM:
+ the command block, the data and the read of the status the firmware
+ sends after the data are all submitted without waiting.
+
+ \param HandleXum1541
+   A XUM1541_HANDLE which contains the file handle of the USB device.
+
+ \param modeFlags
+    XUM1541_CBM, possibly or'ed with XUM_WRITE_ATN and XUM_WRITE_TALK.
+
+ \param data
+    Pointer to buffer which contains the data to be written to the xum1541.
+    It must stay valid until xum1541_queue_flush() returned.
+
+ \param size
+    The number of bytes to write to the xum1541. This must not exceed
+    XUM_MAX_XFER_SIZE.
+
+ \param Status
+    Will contain the extended status after the next xum1541_queue_flush(),
+    that is, the number of bytes written to the bus, or -1 if the device
+    reported an error.
+
+ \return
+    0 if the write was queued, < 0 on error.
+*/
+int
+xum1541_queue_write_status(struct xum1541_usb_handle *HandleXum1541, unsigned char modeFlags,
+    const unsigned char *data, size_t size, int *Status)
+{
+    BOOL isTapeCmd = FALSE;
+
+    xum1541_dbg(1, "queue write with status %d bytes from address %p flags %x",
+        size, data, modeFlags & 0x0f);
+
+    RefuseToWorkInWrongMode; // Check if command allowed in current disk/tape mode.
+
+    if (XUM_RW_PROTO(modeFlags) != XUM1541_CBM ||
+        size == 0 || size > XUM_MAX_XFER_SIZE || Status == NULL) {
+        fprintf(stderr, "xum1541_queue_write_status: invalid request\n");
+        return -1;
+    }
+
+    if (xum1541_queue_cmd(HandleXum1541, XUM1541_WRITE, modeFlags,
+        (unsigned char *)data, size, NULL) != 0)
+        return -1;
+
+    return xum1541_queue_submit(HandleXum1541,
+        XUM_BULK_IN_ENDPOINT | USB_ENDPOINT_IN,
+        NULL, XUM_STATUSBUF_SIZE, XUM1541_QUEUE_STATUS, Status);
+}
+
+/*! \brief Wait for all queued transfers to finish
+
+ \param HandleXum1541
+   A XUM1541_HANDLE which contains the file handle of the USB device.
+
+ \return
+    0 if all queued transfers succeeded, -1 if any of them failed.
+    In the latter case, the remaining transfers have been discarded.
+*/
+int
+xum1541_queue_flush(struct xum1541_usb_handle *HandleXum1541)
+{
+    int ret;
+
+    while (HandleXum1541->queue.count != 0)
+        xum1541_queue_reap_one(HandleXum1541);
+
+    ret = HandleXum1541->queue.error ? -1 : 0;
+    HandleXum1541->queue.error = 0;
+    return ret;
+}
+
+/* #define OPENCBM_STANDALONE_TEST 1 */
+
+#ifdef OPENCBM_STANDALONE_TEST
+
+/*
+ * Test of the block stream and track read functions against a simulated
+ * xum1541, and of the queued transfers. The libusb bulk calls are replaced
+ * with a model of the firmware, which sends its data in packets of the
+ * bulk endpoint size and ends each transfer with a short packet, just as
+ * the real one does.
+ *
+ * Build it in this directory after the libraries with e.g.
+ *   cc -DOPENCBM_STANDALONE_TEST -I../../../include -I../../../include/LINUX \
+ *      -I../../../libmisc -I../../../../xum1541 -o xum1541-test xum1541.c \
+ *      -L../../../libmisc -lmisc -L../../../arch/linux -larch -lusb \
+ *      -lpthread -ldl
+ */
+
+#define SIM_BUF_SIZE 0x20000
+
+static struct {
+    unsigned int endpointSize;
+
+    /* what the drive sends through the xum1541, and how much of it is used */
+    unsigned char drive[SIM_BUF_SIZE];
+    unsigned int drivePos;
+
+    /* the packets for the host, back to back, and their sizes */
+    unsigned char in[SIM_BUF_SIZE];
+    unsigned int inLen, inPos;
+    unsigned int packet[SIM_BUF_SIZE / 8];
+    unsigned int packets, packetPos;
+
+    /* the data the host wrote after the last command block with data */
+    unsigned char out[SIM_BUF_SIZE];
+    unsigned int outLen, outMissing;
+    unsigned char cmd[XUM_CMDBUF_SIZE];
+
+    /* a block stream write reports this many blocks at most */
+    unsigned int blocksOk;
+
+    /* if not 0, a block stream read sends only this many bytes */
+    unsigned int truncate;
+
+    /* number of commands, and the size of the last bulk read */
+    unsigned int commands;
+    int lastRead;
+} sim;
+
+static int test_failures;
+
+#define TEST_CHECK(_cond) \
+    do { \
+        if (!(_cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", \
+                __FILE__, __LINE__, #_cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+static void
+sim_reset(unsigned int endpointSize, unsigned char seed)
+{
+    unsigned int i;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.endpointSize = endpointSize;
+    sim.blocksOk = 255;
+    for (i = 0; i < sizeof(sim.drive); i++)
+        sim.drive[i] = (unsigned char)(i * 7 + seed + (i >> 8));
+}
+
+/* send data to the host as the firmware does; announced is the length
+ * the command asked for, 0 for a status */
+static void
+sim_send(const unsigned char *data, unsigned int len, unsigned int announced)
+{
+    unsigned int n, sent = len;
+
+    memcpy(sim.in + sim.inLen, data, len);
+    sim.inLen += len;
+    while (len > 0) {
+        n = (len > sim.endpointSize) ? sim.endpointSize : len;
+        sim.packet[sim.packets++] = n;
+        len -= n;
+    }
+    /* a transfer ending early after a full packet needs a ZLP */
+    if (sent < announced && sent % sim.endpointSize == 0)
+        sim.packet[sim.packets++] = 0;
+}
+
+static void
+sim_status(unsigned int value)
+{
+    unsigned char status[XUM_STATUSBUF_SIZE];
+
+    status[0] = XUM1541_IO_READY;
+    status[1] = value & 0xff;
+    status[2] = (value >> 8) & 0xff;
+    sim_send(status, sizeof(status), 0);
+}
+
+/* the warp track read of the firmware, after the map went to the drive */
+static void
+sim_read_track(unsigned char mode, unsigned int sectors)
+{
+    unsigned char buf[XUM_TRACK_MAX_SECTORS * (XUM_TRACK_GCR_SIZE + 2)];
+    unsigned char results[XUM_TRACK_MAX_SECTORS * 2];
+    unsigned int headerSize = (mode == XUM1541_PP) ? 4 : 2;
+    unsigned int n, len = 0;
+
+    for (n = 0; n < sectors; ) {
+        results[2 * n] = sim.drive[sim.drivePos + headerSize / 2 - 1];
+        results[2 * n + 1] = sim.drive[sim.drivePos + headerSize - 1];
+        sim.drivePos += headerSize;
+        if (results[2 * n++ + 1] != 0)
+            break;
+        memcpy(buf + len, sim.drive + sim.drivePos, XUM_TRACK_GCR_SIZE);
+        sim.drivePos += XUM_TRACK_GCR_SIZE;
+        len += XUM_TRACK_GCR_SIZE;
+    }
+    memcpy(buf + len, results, 2 * n);
+    len += 2 * n;
+    if (sim.truncate != 0 && sim.truncate < len)
+        len = sim.truncate;
+    sim_send(buf, len, sectors * (XUM_TRACK_GCR_SIZE + 2));
+    sim_status(n);
+}
+
+/* the host has written all data of the current command */
+static void
+sim_out_done(void)
+{
+    unsigned int blocks;
+
+    switch (sim.cmd[0]) {
+    case XUM1541_WRITE_BLOCKS:
+        blocks = sim.cmd[2];
+        sim_status(blocks < sim.blocksOk ? blocks : sim.blocksOk);
+        break;
+    case XUM1541_READ_TRACK:
+        sim_read_track(sim.cmd[1], sim.cmd[2]);
+        break;
+    }
+}
+
+static int
+sim_command(const unsigned char *cmd)
+{
+    unsigned int len;
+
+    memcpy(sim.cmd, cmd, XUM_CMDBUF_SIZE);
+    sim.commands++;
+
+    switch (cmd[0]) {
+    case XUM1541_READ:
+        len = cmd[2] | (cmd[3] << 8);
+        sim_send(sim.drive + sim.drivePos, len, len);
+        sim.drivePos += len;
+        break;
+    case XUM1541_WRITE:
+        sim.outLen = 0;
+        sim.outMissing = cmd[2] | (cmd[3] << 8);
+        break;
+    case XUM1541_READ_BLOCKS:
+        len = cmd[2] * XUM_BLOCK_SIZE(cmd[3]);
+        sim_send(sim.drive + sim.drivePos, sim.truncate ? sim.truncate : len, len);
+        sim.drivePos += len;
+        sim_status(cmd[2]);
+        break;
+    case XUM1541_WRITE_BLOCKS:
+        sim.outLen = 0;
+        sim.outMissing = cmd[2] * XUM_BLOCK_SIZE(cmd[3]);
+        break;
+    case XUM1541_READ_TRACK:
+        /* the track map follows */
+        sim.outLen = 0;
+        sim.outMissing = cmd[3];
+        break;
+    default:
+        fprintf(stderr, "simulated xum1541: unknown command %d\n", cmd[0]);
+        return -1;
+    }
+    return XUM_CMDBUF_SIZE;
+}
+
+static int
+sim_bulk_write(usb_dev_handle *dev, int ep, const char *bytes, int size, int timeout)
+{
+    if (sim.outMissing == 0) {
+        if (size != XUM_CMDBUF_SIZE)
+            return -1;
+        return sim_command((const unsigned char *)bytes);
+    }
+
+    if ((unsigned int)size > sim.outMissing)
+        return -1;
+    memcpy(sim.out + sim.outLen, bytes, size);
+    sim.outLen += size;
+    sim.outMissing -= size;
+    if (sim.outMissing == 0)
+        sim_out_done();
+    return size;
+}
+
+/* like libusb: collect packets until size is reached or a short one came */
+static int
+sim_bulk_read(usb_dev_handle *dev, int ep, char *bytes, int size, int timeout)
+{
+    int got = 0;
+    unsigned int n;
+
+    sim.lastRead = size;
+    if (sim.packetPos == sim.packets)
+        return -1; /* timeout, the device has nothing to send */
+
+    while (got < size && sim.packetPos < sim.packets) {
+        n = sim.packet[sim.packetPos];
+        if (n > (unsigned int)(size - got))
+            return -1; /* overflow */
+        memcpy(bytes + got, sim.in + sim.inPos, n);
+        sim.inPos += n;
+        sim.packetPos++;
+        got += n;
+        if (n < sim.endpointSize)
+            break;
+    }
+    return got;
+}
+
+static char *
+sim_strerror(void)
+{
+    return "simulated error";
+}
+
+static void
+test_handle(struct xum1541_usb_handle *handle, unsigned char capabilities,
+    unsigned int endpointSize, unsigned int maxBlocks)
+{
+    memset(handle, 0, sizeof(*handle));
+    handle->DeviceDriveMode = DeviceDriveMode_Disk;
+    handle->capabilities = capabilities;
+    handle->endpointSize = endpointSize;
+    handle->maxBlocks = maxBlocks;
+}
+
+static void
+test_read_blocks(unsigned int endpointSize, unsigned int maxBlocks,
+    unsigned char mode, unsigned int blocks, unsigned int blockSize,
+    unsigned int commands)
+{
+    static unsigned char data[SIM_BUF_SIZE];
+    struct xum1541_usb_handle handle;
+    unsigned int size = blocks * blockSize;
+
+    test_handle(&handle, XUM1541_CAP_BLOCKS, endpointSize, maxBlocks);
+    sim_reset(endpointSize, (unsigned char)blocks);
+    TEST_CHECK(xum1541_read_blocks(&handle, mode, data, blocks, blockSize) == (int)blocks);
+    TEST_CHECK(memcmp(data, sim.drive, size) == 0);
+    TEST_CHECK(sim.commands == commands);
+    TEST_CHECK(sim.packetPos == sim.packets);
+}
+
+static void
+test_write_blocks(unsigned int maxBlocks, unsigned char mode,
+    unsigned int blocks, unsigned int blockSize, unsigned int blocksOk)
+{
+    struct xum1541_usb_handle handle;
+    unsigned int size = blocks * blockSize;
+    int expected = (blocks < blocksOk) ? blocks : blocksOk;
+
+    test_handle(&handle, XUM1541_CAP_BLOCKS, 64, maxBlocks);
+    sim_reset(64, (unsigned char)blocks);
+    sim.blocksOk = blocksOk;
+    TEST_CHECK(xum1541_write_blocks(&handle, mode, sim.drive, blocks, blockSize) == expected);
+    if (blocks <= maxBlocks) {
+        TEST_CHECK(sim.outLen == size);
+        TEST_CHECK(memcmp(sim.out, sim.drive, size) == 0);
+    }
+    TEST_CHECK(sim.packetPos == sim.packets);
+}
+
+static void
+test_blocks(void)
+{
+    static unsigned char data[SIM_BUF_SIZE];
+    struct xum1541_usb_handle handle;
+
+    /* a whole number of packets: the status comes with the last one */
+    test_read_blocks(64, 255, XUM1541_S1, 10, 256, 1);
+    TEST_CHECK(sim.lastRead == 64 + XUM_STATUSBUF_SIZE);
+    test_read_blocks(32, 255, XUM1541_PP, 255, 256, 1);
+    TEST_CHECK(sim.lastRead == 32 + XUM_STATUSBUF_SIZE);
+
+    /* a short last packet, the status is read on its own */
+    test_read_blocks(64, 255, XUM1541_PP, 3, 254, 1);
+    TEST_CHECK(sim.lastRead == XUM_STATUSBUF_SIZE);
+    test_read_blocks(64, 255, XUM1541_S2, 7, 3, 1);
+    TEST_CHECK(sim.lastRead == XUM_STATUSBUF_SIZE);
+
+    /* more blocks than the firmware takes with one command */
+    test_read_blocks(64, 4, XUM1541_P2, 10, 256, 3);
+    test_read_blocks(64, 255, XUM1541_S1, 300, 200, 2);
+
+    /* firmware without block streams gets one plain read */
+    test_handle(&handle, 0, 0, 0);
+    sim_reset(64, 1);
+    TEST_CHECK(xum1541_read_blocks(&handle, XUM1541_S1, data, 5, 256) == 5);
+    TEST_CHECK(memcmp(data, sim.drive, 5 * 256) == 0);
+    TEST_CHECK(sim.commands == 1 && sim.cmd[0] == XUM1541_READ);
+
+    test_write_blocks(255, XUM1541_S1, 10, 256, 255);
+    test_write_blocks(255, XUM1541_PP, 9, 100, 255);
+    test_write_blocks(4, XUM1541_S2, 10, 256, 255);
+    TEST_CHECK(sim.commands == 3);
+
+    /* the firmware reports that only part of the blocks made it */
+    test_write_blocks(255, XUM1541_S1, 10, 256, 6);
+    test_write_blocks(4, XUM1541_P2, 10, 64, 3);
+    TEST_CHECK(sim.commands == 1);
+
+    /* firmware without block streams gets one plain write */
+    test_handle(&handle, 0, 0, 0);
+    sim_reset(64, 2);
+    TEST_CHECK(xum1541_write_blocks(&handle, XUM1541_S2, sim.drive, 3, 256) == 3);
+    TEST_CHECK(sim.outLen == 3 * 256 && memcmp(sim.out, sim.drive, 3 * 256) == 0);
+    TEST_CHECK(sim.commands == 1 && sim.cmd[0] == XUM1541_WRITE);
+
+    /* invalid requests do not reach the device */
+    test_handle(&handle, XUM1541_CAP_BLOCKS, 64, 255);
+    sim_reset(64, 0);
+    TEST_CHECK(xum1541_read_blocks(&handle, XUM1541_PP, data, 2, 255) == -1);
+    TEST_CHECK(xum1541_read_blocks(&handle, XUM1541_S1, data, 0, 256) == -1);
+    TEST_CHECK(xum1541_read_blocks(&handle, XUM1541_S1, data, 1, 257) == -1);
+    TEST_CHECK(xum1541_write_blocks(&handle, XUM1541_CBM, data, 1, 256) == -1);
+    TEST_CHECK(sim.commands == 0);
+
+    /* a short data transfer is an error, not a partial success */
+    test_handle(&handle, XUM1541_CAP_BLOCKS, 64, 255);
+    sim_reset(64, 0);
+    sim.truncate = 100;
+    TEST_CHECK(xum1541_read_blocks(&handle, XUM1541_S1, data, 1, 256) == -1);
+}
+
+/* put the sector headers of a track into the drive stream; the GCR
+ * data of the good sectors is copied to gcr, the headers to results */
+static unsigned int
+test_track_drive(unsigned char mode, unsigned int sectors, unsigned int failAt,
+    unsigned char *gcr, unsigned char *results)
+{
+    unsigned int n, pos = 0;
+
+    for (n = 0; n < sectors; n++) {
+        results[2 * n] = (unsigned char)((n * 11) % sectors);
+        results[2 * n + 1] = (n == failAt) ? 5 : 0;
+        if (mode == XUM1541_PP) {
+            sim.drive[pos++] = 0xee;
+            sim.drive[pos++] = results[2 * n];
+            sim.drive[pos++] = 0xee;
+            sim.drive[pos++] = results[2 * n + 1];
+        } else {
+            sim.drive[pos++] = results[2 * n];
+            sim.drive[pos++] = results[2 * n + 1];
+        }
+        if (n == failAt)
+            return n + 1;
+        memcpy(gcr + n * XUM_TRACK_GCR_SIZE, sim.drive + pos, XUM_TRACK_GCR_SIZE);
+        pos += XUM_TRACK_GCR_SIZE;
+    }
+    return sectors;
+}
+
+static void
+test_read_track(unsigned char capabilities, unsigned int endpointSize,
+    unsigned char mode, unsigned int sectors, unsigned int failAt,
+    unsigned int mapSize)
+{
+    static unsigned char gcr[XUM_TRACK_MAX_SECTORS * XUM_TRACK_GCR_SIZE];
+    static unsigned char data[XUM_TRACK_MAX_SECTORS * XUM_TRACK_GCR_SIZE];
+    unsigned char results[XUM_TRACK_MAX_SECTORS * 2];
+    unsigned char expected[XUM_TRACK_MAX_SECTORS * 2];
+    unsigned char map[255];
+    struct xum1541_usb_handle handle;
+    unsigned int i, sent, good;
+
+    for (i = 0; i < mapSize; i++)
+        map[i] = (unsigned char)(i + 18);
+
+    test_handle(&handle, capabilities, endpointSize, 255);
+    sim_reset(endpointSize, (unsigned char)sectors);
+    sent = test_track_drive(mode, sectors, failAt, gcr, expected);
+    good = (failAt < sectors) ? sent - 1 : sent;
+    memset(data, 0, sizeof(data));
+    TEST_CHECK(xum1541_read_track(&handle, mode, map, mapSize, sectors,
+        data, results) == (int)sent);
+    TEST_CHECK(memcmp(data, gcr, good * XUM_TRACK_GCR_SIZE) == 0);
+    TEST_CHECK(memcmp(results, expected, 2 * sent) == 0);
+    TEST_CHECK(sim.outLen == mapSize && memcmp(sim.out, map, mapSize) == 0);
+    TEST_CHECK(sim.packetPos == sim.packets);
+
+    /* one command, or a write of the map and plain reads per sector */
+    if (capabilities & XUM1541_CAP_TRACK)
+        TEST_CHECK(sim.commands == 1 && sim.cmd[0] == XUM1541_READ_TRACK);
+    else
+        TEST_CHECK(sim.commands == 1 + sent + good);
+}
+
+static void
+test_track(void)
+{
+    static unsigned char data[XUM_TRACK_MAX_SECTORS * XUM_TRACK_GCR_SIZE];
+    unsigned char results[XUM_TRACK_MAX_SECTORS * 2], map[256] = { 18, 21 };
+    struct xum1541_usb_handle handle;
+    unsigned int i;
+
+    for (i = 0; i < 2; i++) {
+        unsigned char caps = (i == 0) ? XUM1541_CAP_TRACK : 0;
+
+        test_read_track(caps, 64, XUM1541_S1, 21, ~0u, 23);
+        test_read_track(caps, 64, XUM1541_S2, 17, 7, 19);
+        test_read_track(caps, 32, XUM1541_S1, 21, 20, 5);
+        test_read_track(caps, 64, XUM1541_S2, 1, ~0u, 2);
+        test_read_track(caps, 64, XUM1541_PP, 19, ~0u, 42);
+        test_read_track(caps, 64, XUM1541_PP, 3, 0, 8);
+        test_read_track(caps, 32, XUM1541_PP, 21, 12, 2);
+    }
+
+    /* a stream that does not match the status is an error */
+    test_handle(&handle, XUM1541_CAP_TRACK, 64, 255);
+    sim_reset(64, 5);
+    test_track_drive(XUM1541_S1, 5, ~0u, data, results);
+    sim.truncate = 2 * XUM_TRACK_GCR_SIZE;
+    TEST_CHECK(xum1541_read_track(&handle, XUM1541_S1, map, 7, 5,
+        data, results) == -1);
+
+    /* invalid requests do not reach the device */
+    test_handle(&handle, XUM1541_CAP_TRACK, 64, 255);
+    sim_reset(64, 0);
+    TEST_CHECK(xum1541_read_track(&handle, XUM1541_S1, map, 7, 0, data, results) == -1);
+    TEST_CHECK(xum1541_read_track(&handle, XUM1541_S1, map, 7,
+        XUM_TRACK_MAX_SECTORS + 1, data, results) == -1);
+    TEST_CHECK(xum1541_read_track(&handle, XUM1541_S2, map, 1, 5, data, results) == -1);
+    TEST_CHECK(xum1541_read_track(&handle, XUM1541_S2, map, 256, 5, data, results) == -1);
+    TEST_CHECK(xum1541_read_track(&handle, XUM1541_PP, map, 7, 5, data, results) == -1);
+    TEST_CHECK(xum1541_read_track(&handle, XUM1541_P2, map, 8, 5, data, results) == -1);
+    TEST_CHECK(sim.commands == 0);
+}
+
+/*
+ * Test of the queue itself with a scripted transport: the transfers are
+ * only recorded when submitted, and get their data and byte counts when
+ * reaped, so the test sees exactly when the queue waits for what.
+ */
+#define MOCK_MAX_URBS 256
+
+static struct {
+    unsigned int submitted, reaped, discarded, inFlight, maxInFlight;
+    int ep[MOCK_MAX_URBS];
+    int size[MOCK_MAX_URBS];
+    unsigned char *data[MOCK_MAX_URBS];
+    unsigned int failAt;        // this transfer fails, 0 for none
+    unsigned int shortAt;       // this transfer is one byte short, 0 for none
+    int status;                 // sent back for status reads
+    unsigned char out[SIM_BUF_SIZE];
+    unsigned int outLen;
+} mock;
+
+static int
+mock_submit(struct xum1541_usb_handle *HandleXum1541, int ep,
+    unsigned char *data, int size, void **Urb)
+{
+    unsigned int n = mock.submitted++;
+
+    mock.ep[n] = ep;
+    mock.size[n] = size;
+    mock.data[n] = data;
+    if (++mock.inFlight > mock.maxInFlight)
+        mock.maxInFlight = mock.inFlight;
+    *Urb = &mock.ep[n];
+    return 0;
+}
+
+static int
+mock_reap(void *Urb, int timeout)
+{
+    unsigned int n = (unsigned int)((int *)Urb - mock.ep);
+    int i, size = mock.size[n];
+
+    // the queue reaps in submission order
+    TEST_CHECK(n == mock.reaped);
+    mock.reaped++;
+    if (n + 1 == mock.failAt)
+        return -1;
+    if (n + 1 == mock.shortAt)
+        size--;
+
+    if (!(mock.ep[n] & USB_ENDPOINT_IN)) {
+        // record the data, not the command blocks
+        if (size != XUM_CMDBUF_SIZE) {
+            memcpy(mock.out + mock.outLen, mock.data[n], size);
+            mock.outLen += size;
+        }
+    } else if (size == XUM_STATUSBUF_SIZE) {
+        // the status after the data of a CBM write
+        mock.data[n][0] = XUM1541_IO_READY;
+        mock.data[n][1] = mock.status & 0xff;
+        mock.data[n][2] = (mock.status >> 8) & 0xff;
+    } else {
+        for (i = 0; i < size; i++)
+            mock.data[n][i] = (unsigned char)(n + i);
+    }
+    return size;
+}
+
+static void
+mock_discard(void *Urb)
+{
+    mock.discarded++;
+    mock.inFlight--;
+}
+
+static const xum1541_transport_t mock_transport = {
+    mock_submit,
+    mock_reap,
+    mock_discard,
+    NULL
+};
+
+static void
+mock_reset(void)
+{
+    memset(&mock, 0, sizeof(mock));
+}
+
+static void
+test_queue(void)
+{
+    static unsigned char data[20][256];
+    unsigned char trse[20][2];
+    int count[20][2], status, i;
+    struct xum1541_usb_handle handle;
+    const xum1541_transport_t *old;
+
+    old = xum1541_queue_set_transport(&mock_transport);
+
+    /* block requests: nothing is waited for until the queue is full */
+    test_handle(&handle, 0, 64, 0);
+    mock_reset();
+    for (i = 0; i < 4; i++) {
+        trse[i][0] = 18;
+        trse[i][1] = (unsigned char)i;
+        TEST_CHECK(xum1541_queue_write(&handle, XUM1541_S1, trse[i], 2, &count[i][0]) == 0);
+        TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S1, data[i], 256, &count[i][1]) == 0);
+    }
+    TEST_CHECK(mock.submitted == 16 && mock.reaped == 0);
+    TEST_CHECK(handle.queue.transport == &mock_transport);
+    for (i = 4; i < 20; i++) {
+        trse[i][0] = 19;
+        trse[i][1] = (unsigned char)i;
+        TEST_CHECK(xum1541_queue_write(&handle, XUM1541_S1, trse[i], 2, &count[i][0]) == 0);
+        TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S1, data[i], 256, &count[i][1]) == 0);
+    }
+    TEST_CHECK(mock.maxInFlight == XUM1541_QUEUE_DEPTH);
+    TEST_CHECK(mock.reaped == mock.submitted - XUM1541_QUEUE_DEPTH);
+    /* the first requests are done, the last ones not yet */
+    TEST_CHECK(count[0][0] == 2 && count[0][1] == 256);
+    TEST_CHECK(count[19][0] == 0 && count[19][1] == 0);
+
+    TEST_CHECK(xum1541_queue_flush(&handle) == 0);
+    TEST_CHECK(mock.reaped == 80 && mock.inFlight == 0);
+    for (i = 0; i < 20; i++) {
+        TEST_CHECK(count[i][0] == 2 && count[i][1] == 256);
+        TEST_CHECK(data[i][0] == (unsigned char)(4 * i + 3));
+        TEST_CHECK(data[i][255] == (unsigned char)(4 * i + 3 + 255));
+        TEST_CHECK(memcmp(mock.out + 2 * i, trse[i], 2) == 0);
+    }
+    TEST_CHECK(mock.outLen == 40);
+
+    /* command blocks and endpoints */
+    TEST_CHECK(mock.size[0] == XUM_CMDBUF_SIZE && mock.ep[0] == (XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT));
+    TEST_CHECK(mock.size[1] == 2 && mock.ep[1] == (XUM_BULK_OUT_ENDPOINT | USB_ENDPOINT_OUT));
+    TEST_CHECK(mock.size[3] == 256 && mock.ep[3] == (XUM_BULK_IN_ENDPOINT | USB_ENDPOINT_IN));
+
+    /* a flush of an empty queue does nothing */
+    TEST_CHECK(xum1541_queue_flush(&handle) == 0);
+    TEST_CHECK(mock.reaped == 80);
+
+    /* a CBM write gets the status the firmware sends after the data */
+    mock_reset();
+    mock.status = 5;
+    status = 0;
+    TEST_CHECK(xum1541_queue_write_status(&handle, XUM1541_CBM | XUM_WRITE_ATN,
+        trse[0], 2, &status) == 0);
+    TEST_CHECK(mock.submitted == 3 && mock.reaped == 0);
+    TEST_CHECK(xum1541_queue_flush(&handle) == 0);
+    TEST_CHECK(status == 5);
+
+    /* a failed transfer: the rest is discarded without waiting for it */
+    mock_reset();
+    mock.failAt = 3;
+    for (i = 0; i < 3; i++) {
+        TEST_CHECK(xum1541_queue_write(&handle, XUM1541_S2, trse[i], 2, &count[i][0]) == 0);
+        TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S2, data[i], 256, &count[i][1]) == 0);
+    }
+    TEST_CHECK(xum1541_queue_flush(&handle) == -1);
+    TEST_CHECK(mock.reaped == 3 && mock.discarded == 12 && mock.inFlight == 0);
+    TEST_CHECK(count[0][0] == 2 && count[0][1] == 0 && count[2][1] == 0);
+    /* the error is reported once */
+    TEST_CHECK(xum1541_queue_flush(&handle) == 0);
+
+    /* with a full queue, the error stops the submission */
+    mock_reset();
+    mock.failAt = 1;
+    for (i = 0; i < 8; i++)
+        TEST_CHECK(xum1541_queue_read(&handle, XUM1541_PP, data[i], 256, &count[i][1]) == 0);
+    TEST_CHECK(xum1541_queue_read(&handle, XUM1541_PP, data[8], 256, &count[8][1]) == -1);
+    TEST_CHECK(mock.submitted == 16);
+    TEST_CHECK(xum1541_queue_flush(&handle) == -1);
+    TEST_CHECK(mock.discarded == 16);
+
+    /* a short transfer is reported in its count */
+    mock_reset();
+    mock.shortAt = 2;
+    TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S1, data[0], 256, &count[0][1]) == 0);
+    TEST_CHECK(xum1541_queue_flush(&handle) == 0);
+    TEST_CHECK(count[0][1] == 255);
+
+    /* invalid requests are not queued */
+    mock_reset();
+    TEST_CHECK(xum1541_queue_read(&handle, XUM1541_TAP, data[0], 256, &count[0][1]) == -1);
+    TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S1, data[0], 0, &count[0][1]) == -1);
+    TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S1, data[0], XUM_MAX_XFER_SIZE + 1, &count[0][1]) == -1);
+    TEST_CHECK(xum1541_queue_write(&handle, XUM1541_CBM, data[0], 2, &count[0][0]) == -1);
+    TEST_CHECK(xum1541_queue_write_status(&handle, XUM1541_S1, data[0], 2, &status) == -1);
+    TEST_CHECK(xum1541_queue_write_status(&handle, XUM1541_CBM, data[0], 2, NULL) == -1);
+    handle.DeviceDriveMode = DeviceDriveMode_Tape;
+    TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S1, data[0], 256, &count[0][1]) < 0);
+    TEST_CHECK(mock.submitted == 0);
+
+    xum1541_queue_set_transport(old);
+}
+
+/*
+ * Test of the worker thread transport. The bulk calls answer each read
+ * command after its command block was written, from whatever thread
+ * they are called, and record the data written.
+ */
+static struct {
+    unsigned int reads[256];    // lengths of the read commands written
+    unsigned int readsIn, readsOut;
+    int expectData;             // the next OUT transfer is data
+    unsigned char out[SIM_BUF_SIZE];
+    unsigned int outLen;
+    unsigned char next;         // the next byte sent to the host
+    int failWrites;             // all writes fail
+    unsigned int bulkReads;     // number of bulk reads
+} thr;
+
+static int
+thr_bulk_write(usb_dev_handle *dev, int ep, const char *bytes, int size, int timeout)
+{
+    arch_global_lock();
+    if (thr.failWrites) {
+        arch_global_unlock();
+        return -1;
+    }
+    if (thr.expectData) {
+        memcpy(thr.out + thr.outLen, bytes, size);
+        thr.outLen += size;
+        thr.expectData = 0;
+    } else if (bytes[0] == XUM1541_READ) {
+        thr.reads[thr.readsIn++ % 256] = (unsigned char)bytes[2] | ((unsigned char)bytes[3] << 8);
+    } else {
+        thr.expectData = 1;
+    }
+    arch_global_unlock();
+    return size;
+}
+
+static int
+thr_bulk_read(usb_dev_handle *dev, int ep, char *bytes, int size, int timeout)
+{
+    unsigned int len;
+    int i;
+
+    arch_global_lock();
+    thr.bulkReads++;
+    while (thr.readsIn == thr.readsOut) {
+        arch_global_unlock();
+        arch_usleep(100);
+        arch_global_lock();
+    }
+    len = thr.reads[thr.readsOut++ % 256];
+    for (i = 0; i < (int)len && i < size; i++)
+        bytes[i] = (char)thr.next++;
+    arch_global_unlock();
+    return i;
+}
+
+static void
+test_thread_transport(void)
+{
+    static unsigned char data[40][256];
+    unsigned char trse[40][2];
+    int count[40][2], i, j;
+    struct xum1541_usb_handle handle;
+    unsigned char expected = 0;
+
+    usb.bulk_read = thr_bulk_read;
+    usb.bulk_write = thr_bulk_write;
+    memset(&thr, 0, sizeof(thr));
+
+    test_handle(&handle, 0, 64, 0);
+    for (i = 0; i < 40; i++) {
+        trse[i][0] = (unsigned char)(1 + i / 21);
+        trse[i][1] = (unsigned char)(i % 21);
+        TEST_CHECK(xum1541_queue_write(&handle, XUM1541_S2, trse[i], 2, &count[i][0]) == 0);
+        TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S2, data[i], 256, &count[i][1]) == 0);
+    }
+    TEST_CHECK(handle.queue.transport == &xum1541_thread_transport);
+    TEST_CHECK(xum1541_queue_flush(&handle) == 0);
+
+    for (i = 0; i < 40; i++) {
+        TEST_CHECK(count[i][0] == 2 && count[i][1] == 256);
+        for (j = 0; j < 256; j++)
+            if (data[i][j] != expected++)
+                break;
+        TEST_CHECK(j == 256);
+    }
+    TEST_CHECK(thr.outLen == 80 && memcmp(thr.out, trse, 80) == 0);
+
+    TEST_CHECK(thr.bulkReads == 40);
+
+    /* transfers are discarded whether they ran already or not */
+    TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S2, data[0], 256, &count[0][1]) == 0);
+    handle.queue.error = 1;
+    TEST_CHECK(xum1541_queue_flush(&handle) == -1);
+
+    /* the read of a failed command does not wait for the device */
+    thr.failWrites = 1;
+    thr.bulkReads = 0;
+    for (i = 0; i < 3; i++)
+        TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S2, data[i], 256, &count[i][1]) == 0);
+    TEST_CHECK(xum1541_queue_flush(&handle) == -1);
+    TEST_CHECK(thr.bulkReads == 0);
+    TEST_CHECK(count[0][1] == 0);
+
+    /* the next transfers go to the device again */
+    thr.failWrites = 0;
+    TEST_CHECK(xum1541_queue_read(&handle, XUM1541_S2, data[0], 256, &count[0][1]) == 0);
+    TEST_CHECK(xum1541_queue_flush(&handle) == 0);
+    TEST_CHECK(count[0][1] == 256 && thr.bulkReads == 1);
+
+    handle.queue.transport->close(&handle);
+    TEST_CHECK(handle.queue.transportData == NULL);
+
+    usb.bulk_read = sim_bulk_read;
+    usb.bulk_write = sim_bulk_write;
+}
+
+int
+main(void)
+{
+    usb.bulk_read = sim_bulk_read;
+    usb.bulk_write = sim_bulk_write;
+    usb.strerror = sim_strerror;
+    usb.bulk_setup_async = NULL;
+
+    /* the simulated firmware takes one transfer after the other */
+    xum1541_queue_set_transport(&xum1541_sync_transport);
+    test_blocks();
+    test_track();
+    test_queue();
+
+    /* the default transport, as there are no asynchronous calls */
+    xum1541_queue_set_transport(NULL);
+    test_thread_transport();
+
+    if (test_failures == 0) {
+        fprintf(stderr, "success.\n");
+        return EXIT_SUCCESS;
+    }
+    fprintf(stderr, "%d checks failed.\n", test_failures);
+    return EXIT_FAILURE;
+}
+
+#endif /* #ifdef OPENCBM_STANDALONE_TEST */
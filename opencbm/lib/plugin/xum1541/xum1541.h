@@ -24,7 +24,83 @@
 #define __CTASSERT(x, y)    typedef char __assert ## y[(x) ? 1 : -1]
 #endif
 
-CTASSERT(sizeof(CBM_FILE) >= sizeof(usb_dev_handle *));
+/*
+ * Queued (pipelined) bulk transfers for the speeder protocols.
+ *
+ * A queued read or write submits its command block and its data transfer
+ * without waiting for completion, so several commands can be in flight
+ * at once and the firmware can start on the next one as soon as it is
+ * done with the current one. Results are only valid after
+ * xum1541_queue_flush() returned.
+ */
+
+// Maximum number of USB transfers (command and data) kept in flight
+#define XUM1541_QUEUE_DEPTH 16
+
+struct xum1541_usb_handle;
+
+/*
+ * The transport used for queued transfers. The default one uses the
+ * asynchronous libusb calls if the loaded libusb provides them (libusb-win32).
+ * If not, the transfers of each direction are run by a worker thread with
+ * the synchronous calls, so the bulk IN and OUT endpoints are busy at the
+ * same time. As a last resort (XUM1541_QUEUE=sync, or no thread could be
+ * started), they are run in submission order at reap time. A different
+ * transport, e.g. a mock to test the queueing without hardware, can be
+ * installed with xum1541_queue_set_transport().
+ */
+typedef struct xum1541_transport_s {
+    // Start a bulk transfer, storing its context in *Urb. 0 on success.
+    int (*submit)(struct xum1541_usb_handle *HandleXum1541, int ep,
+        unsigned char *data, int size, void **Urb);
+    // Wait for the transfer to finish; returns the byte count or < 0.
+    int (*reap)(void *Urb, int timeout);
+    // Abort the transfer if still pending, and free its context.
+    void (*discard)(void *Urb);
+    // Free what the transport keeps per device; may be NULL.
+    void (*close)(struct xum1541_usb_handle *HandleXum1541);
+} xum1541_transport_t;
+
+// The kinds of USB transfers in the queue
+#define XUM1541_QUEUE_DATA      0 // data, of a read or write
+#define XUM1541_QUEUE_CMD       1 // command block (stored in cmdBuf)
+#define XUM1541_QUEUE_STATUS    2 // status after a write (stored in statusBuf)
+
+// One USB transfer in flight
+struct xum1541_queue_entry {
+    void *urb;
+    int kind;           // XUM1541_QUEUE_xxx
+    int *result;        // where to store the byte count or the status
+    unsigned char cmdBuf[XUM_CMDBUF_SIZE];
+    unsigned char statusBuf[XUM_STATUSBUF_SIZE];
+};
+
+/*
+ * The state of one opened xum1541. A pointer to this is what the plugin
+ * hands out as CBM_FILE, so several devices can be used at the same time,
+ * each from its own thread.
+ */
+struct xum1541_usb_handle {
+    usb_dev_handle *devh;           // the libusb device handle
+    unsigned char DeviceDriveMode;  // DeviceDriveMode_xxx, see below
+
+    // what the firmware reported in its XUM1541_INIT response
+    unsigned char capabilities;     // XUM1541_CAP_xxx
+    unsigned int endpointSize;      // bulk endpoint size, 0 if unknown
+    unsigned int maxBlocks;         // blocks per XUM1541_READ/WRITE_BLOCKS
+
+    // queued transfers, see xum1541_queue_read()
+    struct {
+        struct xum1541_queue_entry entries[XUM1541_QUEUE_DEPTH];
+        unsigned int first;     // oldest transfer still in flight
+        unsigned int count;     // number of transfers in flight
+        int error;              // a transfer failed since the last flush
+        const xum1541_transport_t *transport; // set by the first transfer
+        void *transportData;    // per-device state of the transport
+    } queue;
+};
+
+CTASSERT(sizeof(CBM_FILE) >= sizeof(struct xum1541_usb_handle *));
 
 /*
  * Make our control transfer timeout 10% later than the device itself
@@ -47,22 +123,46 @@ CTASSERT(sizeof(CBM_FILE) >= sizeof(usb_dev_handle *));
 #define DeviceDriveMode_Tape            2 // Tape drive mode (only communication to tape drive allowed)
 
 const char *xum1541_device_path(int PortNumber);
-int xum1541_init(usb_dev_handle **HandleXum1541, int PortNumber);
-void xum1541_close(usb_dev_handle *HandleXum1541);
-int xum1541_control_msg(usb_dev_handle *HandleXum1541, unsigned int cmd);
-int xum1541_ioctl(usb_dev_handle *HandleXum1541, unsigned int cmd,
+int xum1541_init(struct xum1541_usb_handle **HandleXum1541, int PortNumber);
+void xum1541_close(struct xum1541_usb_handle *HandleXum1541);
+int xum1541_control_msg(struct xum1541_usb_handle *HandleXum1541, unsigned int cmd);
+int xum1541_ioctl(struct xum1541_usb_handle *HandleXum1541, unsigned int cmd,
     unsigned int addr, unsigned int secaddr);
 
 // Read/write data in normal CBM and speeder protocol modes
-int xum1541_write(usb_dev_handle *HandleXum1541, unsigned char mode,
+int xum1541_write(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
     const unsigned char *data, size_t size);
-int xum1541_write_ext(usb_dev_handle *HandleXum1541, unsigned char mode,
+int xum1541_write_ext(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
     const unsigned char *data, size_t size, int *Status, int *BytesWritten);
-int xum1541_read(usb_dev_handle *HandleXum1541, unsigned char mode,
+int xum1541_read(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
     unsigned char *data, size_t size);
-int xum1541_read_ext(usb_dev_handle *HandleXum1541, unsigned char mode,
+int xum1541_read_ext(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
     unsigned char *data, size_t size, int *Status, int *BytesRead);
+int xum1541_read_stream_ext(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    CBM_TAP_STREAM_GET GetBuffer, CBM_TAP_STREAM_PUT PutBuffer, void *Context,
+    int *Status, int *BytesRead);
+
+// Transfer a number of equally sized blocks as one stream
+int xum1541_read_blocks(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    unsigned char *data, unsigned int blocks, unsigned int blockSize);
+int xum1541_write_blocks(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    const unsigned char *data, unsigned int blocks, unsigned int blockSize);
+
+// Warp read of the sectors of a track, see d64copy
+int xum1541_read_track(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    const unsigned char *map, unsigned int mapSize, unsigned int sectors,
+    unsigned char *data, unsigned char *results);
+
+int xum1541_tap_break(struct xum1541_usb_handle *HandleXum1541);
 
-int xum1541_tap_break(usb_dev_handle *HandleXum1541);
+const xum1541_transport_t *xum1541_queue_set_transport(
+    const xum1541_transport_t *Transport);
+int xum1541_queue_read(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    unsigned char *data, size_t size, int *BytesRead);
+int xum1541_queue_write(struct xum1541_usb_handle *HandleXum1541, unsigned char mode,
+    const unsigned char *data, size_t size, int *BytesWritten);
+int xum1541_queue_write_status(struct xum1541_usb_handle *HandleXum1541, unsigned char modeFlags,
+    const unsigned char *data, size_t size, int *Status);
+int xum1541_queue_flush(struct xum1541_usb_handle *HandleXum1541);
 
 #endif // XUM1541_H
@@ -31,6 +31,7 @@
 #define DLL
 #include "opencbm.h"
 #include "archlib.h"
+#include "internal.h"
 
 
 /*-------------------------------------------------------------------*/
@@ -136,20 +137,30 @@ cbm_upload(CBM_FILE HandleDevice, unsigned char DeviceAddress,
     const char *bufferToProgram = Program;
 
     unsigned char command[] = { 'M', '-', 'W', ' ', ' ', ' ' };
+    CBM_BATCH *batch;
     size_t i;
-    int rv = 0;
+    int rv;
     int c;
 
     FUNC_ENTER();
 
     DBG_ASSERT(sizeof(command) == 6);
 
-    for(i = 0; i < Size; i += 32)
+    // Whatever has been cached about this memory area is overwritten now
+
+    cbm_drive_cache_written(HandleDevice, DeviceAddress, DriveMemAddress, Size);
+
+    // All M-W commands are collected into one batch, so the
+    // plugin can send them without waiting for each single one
+
+    batch = cbm_batch_create();
+    if (batch == NULL)
     {
-        if ( cbm_listen(HandleDevice, DeviceAddress, 15) ) {
-            return -1;
-        }
+        FUNC_LEAVE_INT(-1);
+    }
 
+    for(i = 0; i < Size; i += 32)
+    {
         // Calculate how many bytes are left
 
         c = Size - i;
@@ -167,19 +178,19 @@ cbm_upload(CBM_FILE HandleDevice, unsigned char DeviceAddress,
 
         StoreAddressAndCount(&command[3], DriveMemAddress, c);
 
-        // Write the M-W command to the drive...
-
-        if ( cbm_raw_write(HandleDevice, command, sizeof(command)) != sizeof command) {
-            rv = -1;
-            break;
-        }
+        // Write the M-W command to the drive, as well as the
+        // (up to 32) data bytes. The UNLISTEN is the signal for
+        // the drive to start execution of the command.
+        // The command and the data must be two separate writes,
+        // as each one ends with an EOI.
 
-
-        // ... as well as the (up to 32) data bytes
-
-        if ( cbm_raw_write(HandleDevice, bufferToProgram, c) != c ) {
-            rv = -1;
-            break;
+        if ( cbm_batch_listen(batch, DeviceAddress, 15) < 0
+            || cbm_batch_raw_write(batch, command, sizeof(command)) < 0
+            || cbm_batch_raw_write(batch, bufferToProgram, c) < 0
+            || cbm_batch_unlisten(batch) < 0 )
+        {
+            cbm_batch_free(batch);
+            FUNC_LEAVE_INT(-1);
         }
 
         // Now, advance the pointer into drive memory
@@ -188,19 +199,11 @@ cbm_upload(CBM_FILE HandleDevice, unsigned char DeviceAddress,
 
         DriveMemAddress += c;
         bufferToProgram += c;
+    }
 
-        // Advance the return value of send bytes, too.
-
-        rv += c;
-
-        // The UNLISTEN is the signal for the drive 
-        // to start execution of the command
+    rv = (cbm_batch_submit(HandleDevice, batch) == 0) ? (int) Size : -1;
 
-        if ( cbm_unlisten(HandleDevice) ) {
-            rv = -1;
-            break;
-        }
-    }
+    cbm_batch_free(batch);
 
     FUNC_LEAVE_INT(rv);
 }
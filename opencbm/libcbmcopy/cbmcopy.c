@@ -69,7 +69,7 @@ static int check_drive_type(CBM_FILE fd, unsigned char drive,
 
     if( settings->drive_type == cbm_dt_unknown )
     {
-        if(cbm_identify( fd, drive, &settings->drive_type, &type_str ))
+        if(cbm_bus_identify( fd, drive, &settings->drive_type, &type_str ))
         {
             msg_cb( sev_warning, "could not identify drive, using no turbo" );
         }
@@ -99,7 +99,7 @@ static int send_turbo(CBM_FILE fd, unsigned char drive, int write,
     {
         if(turbo_size)
         {
-            cbm_upload( fd, drive, 0x500, turbo, turbo_size );
+            cbm_upload_cached( fd, drive, 0x500, turbo, turbo_size );
             msg_cb( sev_debug, "uploading %d bytes turbo code", turbo_size );
             if(trf->upload_turbo(fd, drive, settings->drive_type, write) == 0)
             {
@@ -136,6 +136,7 @@ static int send_turbo(CBM_FILE fd, unsigned char drive, int write,
 static int cbmcopy_read(CBM_FILE fd,
                         cbmcopy_settings *settings,
                         unsigned char drive,
+                        int prepared,
                         int track, int sector,
                         const char *cbmname,
                         int cbmname_len,
@@ -160,7 +161,7 @@ static int cbmcopy_read(CBM_FILE fd,
             transfers[settings->transfer_mode].name);
     trf = transfers[settings->transfer_mode].trf;
 
-    if(check_drive_type( fd, drive, settings, msg_cb ))
+    if(!prepared && check_drive_type( fd, drive, settings, msg_cb ))
     {
         return -1;
     }
@@ -173,7 +174,7 @@ static int cbmcopy_read(CBM_FILE fd,
             break;
         case cbm_dt_cbm1570:
         case cbm_dt_cbm1571:
-            cbm_exec_command( fd, drive, "U0>M1", 0 );
+            if(!prepared) cbm_exec_command( fd, drive, "U0>M1", 0 );
             turbo = turboread1571;
             turbo_size = sizeof(turboread1571);
             break;
@@ -426,7 +427,7 @@ int cbmcopy_check_auto_transfer_mode(CBM_FILE cbm_fd, int auto_transfermode, int
     {
         enum cbm_cable_type_e cable_type;
         enum cbm_device_type_e device_type;
-        unsigned char testdrive;
+        unsigned long devices;
 
         /*
          * Test the cable
@@ -443,11 +444,18 @@ int cbmcopy_check_auto_transfer_mode(CBM_FILE cbm_fd, int auto_transfermode, int
             }
         }
 
+        /*
+         * find all drives on the bus; this way, the drive itself does
+         * not need to be identified again later on
+         */
+
+        cbm_bus_scan(cbm_fd, &devices);
+
         /*
          * lookup drivetyp, if IEEE-488 drive, use original
          */
 
-        if (cbm_identify(cbm_fd, (unsigned char)drive, &device_type, NULL) == 0)
+        if (cbm_bus_identify(cbm_fd, (unsigned char)drive, &device_type, NULL) == 0)
         {
             switch(device_type)
             {
@@ -473,19 +481,13 @@ int cbmcopy_check_auto_transfer_mode(CBM_FILE cbm_fd, int auto_transfermode, int
          * on the bus, so we can use serial2, at least.
          */
 
-        for (testdrive = 4; testdrive < 31; ++testdrive)
+        /* of course, the drive to be transfered to is present! */
+        if (devices & ~(1ul << drive))
         {
-            /* of course, the drive to be transfered to is present! */
-            if (testdrive == drive)
-                continue;
-
-            if (cbm_identify(cbm_fd, testdrive, &device_type, NULL) == 0)
-            {
-                /*
-                 * My bad, there is another drive -> only use serial1
-                 */
-                return cbmcopy_get_transfer_mode_index("serial1");
-            }
+            /*
+             * My bad, there is another drive -> only use serial1
+             */
+            return cbmcopy_get_transfer_mode_index("serial1");
         }
 
         /*
@@ -514,20 +516,20 @@ cbmcopy_settings *cbmcopy_get_default_settings(void)
 
 
 
-int cbmcopy_write_file(CBM_FILE fd,
-                       cbmcopy_settings *settings,
-                       int drivei,
-                       const char *cbmname,
-                       int cbmname_len,
-                       const unsigned char *filedata,
-                       int filedata_size,
-                       cbmcopy_message_cb msg_cb,
-                       cbmcopy_status_cb status_cb)
+static int cbmcopy_write(CBM_FILE fd,
+                         cbmcopy_settings *settings,
+                         unsigned char drive,
+                         int prepared,
+                         const char *cbmname,
+                         int cbmname_len,
+                         const unsigned char *filedata,
+                         int filedata_size,
+                         cbmcopy_message_cb msg_cb,
+                         cbmcopy_status_cb status_cb)
 {
     int rv;
     int i;
     int turbo_size;
-    unsigned char drive = (unsigned char) drivei; //! \todo Find better solution
     int error;
     unsigned char buf[48];
     const unsigned char *turbo;
@@ -538,7 +540,7 @@ int cbmcopy_write_file(CBM_FILE fd,
             transfers[settings->transfer_mode].name);
     trf = transfers[settings->transfer_mode].trf;
 
-    if(check_drive_type( fd, drive, settings, msg_cb ))
+    if(!prepared && check_drive_type( fd, drive, settings, msg_cb ))
     {
         return -1;
     }
@@ -551,7 +553,7 @@ int cbmcopy_write_file(CBM_FILE fd,
             break;
         case cbm_dt_cbm1570:
         case cbm_dt_cbm1571:
-            cbm_exec_command( fd, drive, "U0>M1", 0 );
+            if(!prepared) cbm_exec_command( fd, drive, "U0>M1", 0 );
             turbo = turbowrite1571;
             turbo_size = sizeof(turbowrite1571);
             break;
@@ -672,6 +674,24 @@ int cbmcopy_write_file(CBM_FILE fd,
 }
 
 
+/* just a wrapper */
+int cbmcopy_write_file(CBM_FILE fd,
+                       cbmcopy_settings *settings,
+                       int drive,
+                       const char *cbmname,
+                       int cbmname_len,
+                       const unsigned char *filedata,
+                       int filedata_size,
+                       cbmcopy_message_cb msg_cb,
+                       cbmcopy_status_cb status_cb)
+{
+    return cbmcopy_write(fd, settings, (unsigned char) drive, 0,
+                         cbmname, cbmname_len,
+                         filedata, filedata_size,
+                         msg_cb, status_cb);
+}
+
+
 /* just a wrapper */
 int cbmcopy_read_file_ts(CBM_FILE fd,
                          cbmcopy_settings *settings,
@@ -682,7 +702,7 @@ int cbmcopy_read_file_ts(CBM_FILE fd,
                          cbmcopy_message_cb msg_cb,
                          cbmcopy_status_cb status_cb)
 {
-    return cbmcopy_read(fd, settings, (unsigned char) drive,
+    return cbmcopy_read(fd, settings, (unsigned char) drive, 0,
                         track, sector,
                         NULL, 0,
                         filedata, filedata_size,
@@ -701,13 +721,269 @@ int cbmcopy_read_file(CBM_FILE fd,
                       cbmcopy_message_cb msg_cb,
                       cbmcopy_status_cb status_cb)
 {
-    return cbmcopy_read(fd, settings, (unsigned char) drive,
+    return cbmcopy_read(fd, settings, (unsigned char) drive, 0,
                         0, 0,
                         cbmname, cbmname_len,
                         filedata, filedata_size,
                         msg_cb, status_cb);
 }
 
+/*
+ * A session keeps what has been found out about the drive, and
+ * optionally its directory, over the transfer of many files.
+ */
+struct cbmcopy_session_s
+{
+    CBM_FILE fd;
+    cbmcopy_settings *settings;
+    unsigned char drive;
+    cbmcopy_message_cb msg_cb;
+    CBM_DIRECTORY *directory;
+};
+
+
+/*
+ * find a file in the directory read when the session was opened;
+ * only plain names of closed SEQ, PRG and USR files are looked up,
+ * everything else (patterns, drive numbers, ...) is left to the DOS
+ */
+static const CBM_DIRECTORY_ENTRY *
+session_find_file(const cbmcopy_session *session,
+                  const char *cbmname, int cbmname_len)
+{
+    const CBM_DIRECTORY_ENTRY *entry;
+    unsigned int i;
+    int len;
+
+    if(session->directory == NULL || cbmname == NULL)
+    {
+        return NULL;
+    }
+
+    if(cbmname_len == 0) cbmname_len = strlen( cbmname );
+
+    /* the file type after the name does not matter here */
+    for(len = 0; len < cbmname_len && cbmname[len] != ','; len++)
+    {
+        if(strchr("*?:", cbmname[len]))
+        {
+            return NULL;
+        }
+    }
+
+    if(len == 0 || len > 16)
+    {
+        return NULL;
+    }
+
+    for(i = 0; i < session->directory->count; i++)
+    {
+        entry = &session->directory->entries[i];
+
+        if((entry->type & 0x80) == 0
+           || (entry->type & 0x07) < 1 || (entry->type & 0x07) > 3)
+        {
+            continue;
+        }
+        if(strlen((const char *) entry->name) == (size_t) len
+           && memcmp(entry->name, cbmname, len) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * only the turbo routines can start reading at a given track and
+ * sector; the original transfer would read the buffer opened with "#"
+ */
+static int session_uses_turbo(const cbmcopy_session *session)
+{
+    if(transfers[session->settings->transfer_mode].abbrev[0] == 'o')
+    {
+        return 0;
+    }
+
+    switch(session->settings->drive_type)
+    {
+        case cbm_dt_cbm1541:
+        case cbm_dt_cbm1570:
+        case cbm_dt_cbm1571:
+        case cbm_dt_cbm1581:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+
+cbmcopy_session *cbmcopy_session_open(CBM_FILE fd,
+                                      cbmcopy_settings *settings,
+                                      int drive,
+                                      int read_directory,
+                                      cbmcopy_message_cb msg_cb)
+{
+    cbmcopy_session *session;
+
+    session = malloc(sizeof(*session));
+    if(session == NULL)
+    {
+        msg_cb( sev_fatal, "out of memory" );
+        return NULL;
+    }
+
+    session->fd = fd;
+    session->settings = settings;
+    session->drive = (unsigned char) drive;
+    session->msg_cb = msg_cb;
+    session->directory = NULL;
+
+    check_drive_type( fd, session->drive, settings, msg_cb );
+
+    switch(settings->drive_type)
+    {
+        case cbm_dt_cbm1570:
+        case cbm_dt_cbm1571:
+            /* the turbo routines need the 1571 in 1541 mode */
+            cbm_exec_command( fd, session->drive, "U0>M1", 0 );
+            break;
+        default:
+            break;
+    }
+
+    if(read_directory)
+    {
+        if(cbm_read_directory( fd, session->drive, 0, &session->directory ))
+        {
+            msg_cb( sev_warning, "could not read the directory, "
+                                 "files are searched by the drive" );
+            session->directory = NULL;
+        }
+        else
+        {
+            msg_cb( sev_debug, "read %u directory entries",
+                    session->directory->count );
+        }
+    }
+
+    return session;
+}
+
+
+int cbmcopy_session_read(cbmcopy_session *session,
+                         const char *cbmname,
+                         int cbmname_len,
+                         unsigned char **filedata,
+                         size_t *filedata_size,
+                         cbmcopy_status_cb status_cb)
+{
+    const CBM_DIRECTORY_ENTRY *entry;
+
+    entry = session_find_file( session, cbmname, cbmname_len );
+    if(entry && session_uses_turbo( session ))
+    {
+        /* the DOS does not need to search the directory again */
+        return cbmcopy_read(session->fd, session->settings,
+                            session->drive, 1,
+                            entry->track, entry->sector,
+                            NULL, 0,
+                            filedata, filedata_size,
+                            session->msg_cb, status_cb);
+    }
+
+    return cbmcopy_read(session->fd, session->settings,
+                        session->drive, 1,
+                        0, 0,
+                        cbmname, cbmname_len,
+                        filedata, filedata_size,
+                        session->msg_cb, status_cb);
+}
+
+
+int cbmcopy_session_write(cbmcopy_session *session,
+                          const char *cbmname,
+                          int cbmname_len,
+                          const unsigned char *filedata,
+                          int filedata_size,
+                          cbmcopy_status_cb status_cb)
+{
+    if(session->directory)
+    {
+        /* writing changes the directory, do not trust the copy anymore */
+        cbm_directory_free( session->directory );
+        session->directory = NULL;
+    }
+
+    return cbmcopy_write(session->fd, session->settings,
+                         session->drive, 1,
+                         cbmname, cbmname_len,
+                         filedata, filedata_size,
+                         session->msg_cb, status_cb);
+}
+
+
+void cbmcopy_session_order(const cbmcopy_session *session,
+                           const char * const *cbmnames,
+                           int count,
+                           int *order)
+{
+    const CBM_DIRECTORY_ENTRY *entry;
+    unsigned int *key;
+    unsigned int k;
+    int i;
+    int j;
+    int o;
+
+    for(i = 0; i < count; i++)
+    {
+        order[i] = i;
+    }
+
+    if(session->directory == NULL || count < 2)
+    {
+        return;
+    }
+
+    key = malloc(count * sizeof(*key));
+    if(key == NULL)
+    {
+        return;
+    }
+
+    /* files which are not found go last, as the DOS has to search for them */
+    for(i = 0; i < count; i++)
+    {
+        entry = session_find_file( session, cbmnames[i], 0 );
+        key[i] = entry ? (entry->track << 8) | entry->sector : 0x10000;
+    }
+
+    /* a stable insertion sort, the lists are short */
+    for(i = 1; i < count; i++)
+    {
+        o = order[i];
+        k = key[o];
+        for(j = i; j > 0 && key[order[j - 1]] > k; j--)
+        {
+            order[j] = order[j - 1];
+        }
+        order[j] = o;
+    }
+
+    free(key);
+}
+
+
+void cbmcopy_session_close(cbmcopy_session *session)
+{
+    if(session)
+    {
+        cbm_directory_free( session->directory );
+        free(session);
+    }
+}
+
 /*! \brief write a data block of a file with a sequence of byte transfers
 
  \param HandleDevice  
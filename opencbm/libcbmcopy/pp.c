@@ -275,7 +275,7 @@ static int upload_turbo(CBM_FILE fd, unsigned char drive,
     p = &drive_progs[dt * 2 + (write != 0)];
     
                                                                         SETSTATEDEBUG((void)0);
-    cbm_upload(fd, drive, 0x680, p->prog, p->size);
+    cbm_upload_cached(fd, drive, 0x680, p->prog, p->size);
                                                                         SETSTATEDEBUG((void)0);
     return 0;
 }
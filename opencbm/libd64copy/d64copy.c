@@ -99,10 +99,47 @@ static const int warp_write_interleave[] = { -1, 0, 6, 12, 4, -1 };
 
 
 /*
- * Variables to make sure writing a block is an atomary process
+ * The destinations which are currently written to the file system,
+ * so d64copy_cleanup() can make sure writing a block is an atomary
+ * process. There is one entry for every copy running at the same time.
  */
-static int atom_mustcleanup = 0;
-static const transfer_funcs *atom_dst;
+#define MAX_ACTIVE_COPIES 32
+
+static struct
+{
+    const transfer_funcs *volatile dst;
+    void *volatile state;
+} active_copies[MAX_ACTIVE_COPIES];
+
+static int active_copy_add(const transfer_funcs *dst, void *state)
+{
+    int i;
+
+    arch_global_lock();
+    for(i = 0; i < MAX_ACTIVE_COPIES; i++)
+    {
+        if(active_copies[i].dst == NULL)
+        {
+            active_copies[i].state = state;
+            active_copies[i].dst = dst;
+            break;
+        }
+    }
+    arch_global_unlock();
+
+    return i < MAX_ACTIVE_COPIES ? i : -1;
+}
+
+static void active_copy_remove(int slot)
+{
+    if(slot >= 0)
+    {
+        arch_global_lock();
+        active_copies[slot].dst = NULL;
+        active_copies[slot].state = NULL;
+        arch_global_unlock();
+    }
+}
 
 
 #ifdef LIBD64COPY_DEBUG
@@ -128,7 +165,7 @@ static int send_turbo(CBM_FILE fd, unsigned char drv, int write, int warp, int d
     prog = &drive_progs[drv_type * 4 + warp * 2 + write];
 
     SETSTATEDEBUG((void)0);
-    return cbm_upload(fd, drv, 0x500, prog->prog, prog->size);
+    return cbm_upload_cached(fd, drv, 0x500, prog->prog, prog->size);
 }
 
 extern transfer_funcs d64copy_fs_transfer,
@@ -137,9 +174,6 @@ extern transfer_funcs d64copy_fs_transfer,
                       d64copy_s1_transfer,
                       d64copy_s2_transfer;
 
-static d64copy_message_cb message_cb;
-static d64copy_status_cb status_cb;
-
 int d64copy_sector_count(int two_sided, int track)
 {
     if(two_sided)
@@ -159,6 +193,188 @@ int d64copy_sector_count(int two_sided, int track)
     return -1;
 }
 
+d64copy_warp_track *d64copy_warp_track_open(void)
+{
+    d64copy_warp_track *wt;
+    opencbm_plugin_warp_read_track_t *read_track;
+
+    read_track = cbm_get_plugin_function_address("opencbm_plugin_warp_read_track");
+    if(read_track == NULL)
+    {
+        return NULL;
+    }
+    wt = malloc(sizeof(*wt));
+    if(wt != NULL)
+    {
+        wt->read_track = read_track;
+        wt->count = 0;
+        wt->results = wt->next = 0;
+    }
+    return wt;
+}
+
+void d64copy_warp_track_close(d64copy_warp_track *wt)
+{
+    free(wt);
+}
+
+void d64copy_warp_track_map(d64copy_warp_track *wt, const unsigned char *map,
+                            unsigned int size, unsigned char count)
+{
+    assert(size <= sizeof(wt->map));
+    memcpy(wt->map, map, size);
+    wt->map_size = size;
+    wt->count = count;
+    wt->results = wt->next = 0;
+}
+
+int d64copy_warp_track_read(d64copy_warp_track *wt, CBM_FILE fd, int protocol,
+                            unsigned char *se, unsigned char *gcrbuf)
+{
+    unsigned char status;
+
+    if(wt->count)
+    {
+        wt->results = wt->read_track(fd, protocol, wt->map, wt->map_size,
+                                     wt->count, wt->gcr, wt->result);
+        wt->count = 0;
+        wt->next = 0;
+    }
+    if(wt->next >= wt->results)
+    {
+        /* the plugin failed, or more sectors than announced */
+        return 0xff;
+    }
+
+    *se = wt->result[2*wt->next];
+    status = wt->result[2*wt->next+1];
+    if(status == 0)
+    {
+        /* only the last sector can have failed */
+        memcpy(gcrbuf, &wt->gcr[wt->next*GCRBUFSIZE], GCRBUFSIZE);
+    }
+    wt->next++;
+    return status;
+}
+
+d64copy_block_queue *d64copy_block_queue_open(int protocol,
+                                              unsigned int status_size)
+{
+    d64copy_block_queue *bq;
+    opencbm_plugin_queue_read_n_t *read_n;
+    opencbm_plugin_queue_write_n_t *write_n;
+    opencbm_plugin_queue_flush_t *flush;
+
+    read_n = cbm_get_plugin_function_address("opencbm_plugin_queue_read_n");
+    write_n = cbm_get_plugin_function_address("opencbm_plugin_queue_write_n");
+    flush = cbm_get_plugin_function_address("opencbm_plugin_queue_flush");
+    if(read_n == NULL || write_n == NULL || flush == NULL)
+    {
+        return NULL;
+    }
+    assert(status_size >= 1 && status_size <= 2);
+    bq = malloc(sizeof(*bq));
+    if(bq != NULL)
+    {
+        bq->read_n = read_n;
+        bq->write_n = write_n;
+        bq->flush = flush;
+        bq->protocol = protocol;
+        bq->status_size = status_size;
+        bq->count = 0;
+        bq->failed = 0;
+    }
+    return bq;
+}
+
+void d64copy_block_queue_close(d64copy_block_queue *bq)
+{
+    free(bq);
+}
+
+/* queue a transfer; if the plugin's queue is full, wait for it first */
+static void block_queue_transfer(d64copy_block_queue *bq, CBM_FILE fd,
+                                 int write, unsigned char *data,
+                                 unsigned int size, int *done)
+{
+    int i;
+
+    for(i = 0; i < 2; i++)
+    {
+        if((write ? bq->write_n(fd, bq->protocol, data, size, done)
+                  : bq->read_n(fd, bq->protocol, data, size, done)) == 0)
+        {
+            return;
+        }
+        if(bq->flush(fd) != 0)
+        {
+            bq->failed = 1;
+        }
+    }
+    /* not queued at all, done stays short of size */
+    *done = 0;
+}
+
+int d64copy_block_queue_read(d64copy_block_queue *bq, CBM_FILE fd,
+                             unsigned char tr, unsigned char se,
+                             unsigned char *block, int *result)
+{
+    int n = bq->count;
+
+    if(n >= MAX_SECTORS)
+    {
+        return 1;
+    }
+    /*
+     * The firmware handshakes every byte itself, so the whole request
+     * can be queued at once without waiting for the drive in between.
+     */
+    bq->block[n].trse[0] = tr;
+    bq->block[n].trse[1] = se;
+    bq->block[n].status[0] = bq->block[n].status[1] = 0xff;
+    bq->block[n].result = result;
+    *result = 0xff;
+    bq->count++;
+
+    block_queue_transfer(bq, fd, 1, bq->block[n].trse, 2,
+                         &bq->block[n].done[0]);
+    block_queue_transfer(bq, fd, 0, bq->block[n].status, bq->status_size,
+                         &bq->block[n].done[1]);
+    block_queue_transfer(bq, fd, 0, block, BLOCKSIZE,
+                         &bq->block[n].done[2]);
+    return 0;
+}
+
+void d64copy_block_queue_flush(d64copy_block_queue *bq, CBM_FILE fd)
+{
+    int i;
+
+    if(bq->count == 0)
+    {
+        return;
+    }
+    if(bq->flush(fd) != 0)
+    {
+        bq->failed = 1;
+    }
+    for(i = 0; i < bq->count; i++)
+    {
+        /* a short transfer leaves status or block incomplete */
+        if(bq->failed || bq->block[i].done[0] != 2 ||
+           bq->block[i].done[1] != (int)bq->status_size ||
+           bq->block[i].done[2] != BLOCKSIZE)
+        {
+            *bq->block[i].result = 0xff;
+        }
+        else
+        {
+            *bq->block[i].result = bq->block[i].status[bq->status_size-1];
+        }
+    }
+    bq->count = 0;
+    bq->failed = 0;
+}
+
 d64copy_settings *d64copy_get_default_settings(void)
 {
     d64copy_settings *settings;
@@ -176,6 +392,7 @@ d64copy_settings *d64copy_get_default_settings(void)
         settings->drive_type  = cbm_dt_unknown; /* auto detect later on */
         settings->two_sided   = 0;
         settings->error_mode  = em_on_error;
+        settings->incremental = 0;
     }
     return settings;
 }
@@ -188,9 +405,301 @@ static int start_turbo(CBM_FILE fd, unsigned char drive)
 }
 
 
+/*
+ * Track pipeline
+ *
+ * The blocks are read by a reader thread and handed over to the caller's
+ * thread through a bounded ring of block buffers. The caller's thread
+ * GCR decodes and writes them, and does all the bookkeeping and the
+ * callbacks, so the transfer of the next sectors overlaps with the
+ * processing of the current ones.
+ *
+ * The reader is told what to read by "passes": one pass reads the
+ * needed sectors of one track once. Up to PIPE_PASSES passes may be
+ * outstanding, so the reader can start on the next track while the
+ * current one is still being written. Whether a track needs a retry is
+ * only known after all of its blocks have been written; the retry pass
+ * is queued behind the passes already posted.
+ *
+ * If the source can queue block requests, the reader queues those of a
+ * whole pass, and hands the blocks on in one go after the flush at the
+ * end of the pass. So the requests are in flight back to back instead of
+ * waiting for each block in turn.
+ *
+ * If no thread can be started, every pass is read as soon as it is
+ * posted, which gives the old sequential behaviour.
+ */
+
+#define PIPE_PASSES  2
+#define PIPE_BLOCKS  (PIPE_PASSES * (MAX_SECTORS + 1))
+
+enum pipe_kind { pk_block, pk_abort, pk_end };
+
+struct pipe_pass
+{
+    unsigned char tr;           /* 0: no more passes, end the reader */
+    unsigned char scnt;
+    char trackmap[MAX_SECTORS+1];
+};
+
+struct pipe_block
+{
+    enum pipe_kind kind;
+    unsigned char tr;
+    unsigned char se;
+    int read_result;
+    unsigned char data[GCRBUFSIZE];
+};
+
+struct pipeline
+{
+    const transfer_funcs *src;
+    void *src_state;
+    const d64copy_settings *settings;
+    const char *sector_map;
+
+    ARCH_THREAD *thread;
+    int max_pending;
+
+    ARCH_SEMAPHORE *pass_avail;
+    struct pipe_pass passes[PIPE_PASSES + 1];
+    int pass_in;
+    int pass_out;
+
+    ARCH_SEMAPHORE *block_free;
+    ARCH_SEMAPHORE *block_avail;
+    struct pipe_block *blocks;
+    int block_next;             /* next free block for the reader */
+    int block_in;               /* oldest block the reader did not put */
+    int block_out;
+};
+
+/* blocks are put in the order they were taken */
+static struct pipe_block *pipe_get_free(struct pipeline *pipe)
+{
+    struct pipe_block *blk;
+
+    arch_semaphore_wait(pipe->block_free);
+    blk = &pipe->blocks[pipe->block_next];
+    pipe->block_next = (pipe->block_next + 1) % PIPE_BLOCKS;
+    return blk;
+}
+
+static void pipe_put(struct pipeline *pipe, enum pipe_kind kind)
+{
+    pipe->blocks[pipe->block_in].kind = kind;
+    pipe->block_in = (pipe->block_in + 1) % PIPE_BLOCKS;
+    arch_semaphore_post(pipe->block_avail);
+}
+
+static struct pipe_block *pipe_get_block(struct pipeline *pipe)
+{
+    arch_semaphore_wait(pipe->block_avail);
+    return &pipe->blocks[pipe->block_out];
+}
+
+static void pipe_release_block(struct pipeline *pipe)
+{
+    pipe->block_out = (pipe->block_out + 1) % PIPE_BLOCKS;
+    arch_semaphore_post(pipe->block_free);
+}
+
+/* wait for the queued block reads, and hand their blocks on */
+static void pipe_flush_queued(struct pipeline *pipe, int *queued)
+{
+    if(*queued)
+    {
+        SETSTATEDEBUG((void)0);
+        pipe->src->flush_blocks(pipe->src_state);
+        while(*queued)
+        {
+            pipe_put(pipe, pk_block);
+            (*queued)--;
+        }
+    }
+}
+
+static void pipe_read_pass(struct pipeline *pipe, struct pipe_pass *pass)
+{
+    const d64copy_settings *settings = pipe->settings;
+    const transfer_funcs *src = pipe->src;
+    void *src_state = pipe->src_state;
+    struct pipe_block *blk;
+    unsigned char tr = pass->tr;
+    unsigned char scnt = pass->scnt;
+    unsigned char sectors = pipe->sector_map[tr];
+    unsigned char needed = 0;
+    unsigned char se = 0;
+    int queued = 0;
+
+    if(settings->warp && src->is_cbm_drive)
+    {
+        if(scnt)
+        {
+            SETSTATEDEBUG((void)0);
+            src->send_track_map(src_state, tr, pass->trackmap, scnt);
+        }
+        while(scnt)
+        {
+            blk = pipe_get_free(pipe);
+            SETSTATEDEBUG((void)0);
+            blk->read_result = src->read_gcr_block(src_state, &se, blk->data);
+            blk->tr = tr;
+            blk->se = se;
+            if(blk->read_result)
+            {
+                /* the track map has to be sent again */
+                pipe_put(pipe, pk_abort);
+                break;
+            }
+            pipe_put(pipe, pk_block);
+            scnt--;
+        }
+    }
+    else
+    {
+        /* a sector is read at most once per pass */
+        for(se = 0; se < sectors; se++)
+        {
+            if(NEED_SECTOR(pass->trackmap[se])) needed++;
+        }
+        if(scnt > needed) scnt = needed;
+
+        se = 0;
+        while(scnt)
+        {
+            while(!NEED_SECTOR(pass->trackmap[se]))
+            {
+                if(++se >= sectors) se = 0;
+            }
+            blk = pipe_get_free(pipe);
+            SETSTATEDEBUG(DebugBlockCount++);
+            blk->tr = tr;
+            blk->se = se;
+            if(src->queue_block != NULL &&
+               src->queue_block(src_state, tr, se, blk->data, &blk->read_result) == 0)
+            {
+                queued++;
+            }
+            else
+            {
+                pipe_flush_queued(pipe, &queued);
+                blk->read_result = src->read_block(src_state, tr, se, blk->data);
+                pipe_put(pipe, pk_block);
+            }
+
+            pass->trackmap[se] = bs_copied;
+            scnt--;
+
+            se += (unsigned char) settings->interleave;
+            if(se >= sectors) se -= sectors;
+        }
+        pipe_flush_queued(pipe, &queued);
+    }
+
+    blk = pipe_get_free(pipe);
+    blk->tr = tr;
+    pipe_put(pipe, pk_end);
+}
+
+/* read the next posted pass; returns 0 if the reader has to end */
+static int pipe_read_next(struct pipeline *pipe)
+{
+    struct pipe_pass pass;
+
+    arch_semaphore_wait(pipe->pass_avail);
+    pass = pipe->passes[pipe->pass_out];
+    pipe->pass_out = (pipe->pass_out + 1) % (PIPE_PASSES + 1);
+
+    if(pass.tr == 0)
+    {
+        return 0;
+    }
+    pipe_read_pass(pipe, &pass);
+    return 1;
+}
+
+static void pipe_reader(void *Context)
+{
+    struct pipeline *pipe = Context;
+
+    while(pipe_read_next(pipe))
+        ;
+}
+
+static void pipe_post_pass(struct pipeline *pipe, unsigned char tr,
+                           const char *trackmap, unsigned char scnt)
+{
+    struct pipe_pass *pass = &pipe->passes[pipe->pass_in];
+
+    pass->tr = tr;
+    pass->scnt = scnt;
+    if(trackmap)
+    {
+        memcpy(pass->trackmap, trackmap, sizeof(pass->trackmap));
+    }
+    pipe->pass_in = (pipe->pass_in + 1) % (PIPE_PASSES + 1);
+    arch_semaphore_post(pipe->pass_avail);
+
+    if(pipe->thread == NULL)
+    {
+        pipe_read_next(pipe);
+    }
+}
+
+static void pipe_close(struct pipeline *pipe)
+{
+    if(pipe->thread)
+    {
+        pipe_post_pass(pipe, 0, NULL, 0);
+        arch_thread_join(pipe->thread);
+        pipe->thread = NULL;
+    }
+    if(pipe->pass_avail)  arch_semaphore_destroy(pipe->pass_avail);
+    if(pipe->block_free)  arch_semaphore_destroy(pipe->block_free);
+    if(pipe->block_avail) arch_semaphore_destroy(pipe->block_avail);
+    free(pipe->blocks);
+}
+
+static int pipe_open(struct pipeline *pipe, const transfer_funcs *src,
+                     void *src_state, const d64copy_settings *settings,
+                     const char *sector_map, d64copy_message_cb message_cb)
+{
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->src = src;
+    pipe->src_state = src_state;
+    pipe->settings = settings;
+    pipe->sector_map = sector_map;
+
+    pipe->blocks = malloc(PIPE_BLOCKS * sizeof(struct pipe_block));
+
+    if(pipe->blocks == NULL ||
+       arch_semaphore_create(&pipe->pass_avail, 0) ||
+       arch_semaphore_create(&pipe->block_free, PIPE_BLOCKS) ||
+       arch_semaphore_create(&pipe->block_avail, 0))
+    {
+        pipe_close(pipe);
+        return -1;
+    }
+
+    if(arch_thread_create(&pipe->thread, pipe_reader, pipe) == 0)
+    {
+        pipe->max_pending = PIPE_PASSES;
+    }
+    else
+    {
+        message_cb(2, "no reader thread, copying sequentially");
+        pipe->thread = NULL;
+        pipe->max_pending = 1;
+    }
+    return 0;
+}
+
+
 static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
               const transfer_funcs *src, const void *src_arg,
-              const transfer_funcs *dst, const void *dst_arg, unsigned char cbm_drive)
+              const transfer_funcs *dst, const void *dst_arg, unsigned char cbm_drive,
+              d64copy_message_cb message_cb, d64copy_status_cb status_cb)
 {
     unsigned char tr = 0;
     unsigned char se = 0;
@@ -198,9 +707,20 @@ static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
     int cnt  = 0;
     unsigned char scnt = 0;
     unsigned char errors;
-    int retry_count;
-    int resend_trackmap;
     int max_tracks;
+    int ntracks;
+    int next;
+    int pending;
+    unsigned char order[D71_TRACKS];
+    struct
+    {
+        char trackmap[MAX_SECTORS+1];
+        int retry_count;
+        unsigned char errors;
+    } tracks[D71_TRACKS+1], *t;
+    struct pipeline pipe;
+    struct pipe_block *blk;
+    const unsigned char *data;
     char trackmap[MAX_SECTORS+1];
     char buf[40];
     unsigned const char *bam_ptr;
@@ -209,6 +729,10 @@ static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
     unsigned char block[BLOCKSIZE];
     unsigned char gcr[GCRBUFSIZE];
     const transfer_funcs *cbm_transf = NULL;
+    void *src_state;
+    void *dst_state;
+    d64copy_index *index = NULL;
+    int active_slot = -1;
     d64copy_status status;
     const char *sector_map;
     const char *type_str = "*unknown*";
@@ -259,7 +783,7 @@ static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
     if(settings->drive_type == cbm_dt_unknown )
     {
         message_cb( 2, "Trying to identify drive type" );
-        if( cbm_identify( fd_cbm, cbm_drive, &settings->drive_type, NULL ) )
+        if( cbm_bus_identify( fd_cbm, cbm_drive, &settings->drive_type, NULL ) )
         {
             message_cb( 0, "could not identify device" );
         }
@@ -322,6 +846,26 @@ static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
         cbm_exec_command(fd_cbm, cbm_drive, "U0>M1", 0);
     }
 
+    if(settings->incremental)
+    {
+        if(src->is_cbm_drive && !dst->is_cbm_drive)
+        {
+            /* this runs its own drive code, so it must be done before the turbo is sent */
+            index = d64copy_index_open(dst_arg, settings, message_cb);
+            if(index)
+            {
+                d64copy_index_scan(index, fd_cbm, cbm_drive, settings->start_track,
+                    settings->end_track != -1 ? settings->end_track :
+                        (settings->two_sided ? D71_TRACKS : STD_TRACKS),
+                    message_cb);
+            }
+        }
+        else
+        {
+            message_cb(1, "incremental mode only applies when reading a disk, ignored");
+        }
+    }
+
     SETSTATEDEBUG((void)0);
     cbm_transf = src->is_cbm_drive ? src : dst;
 
@@ -342,7 +886,7 @@ static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
     }
 
     SETSTATEDEBUG((void)0);
-    if(src->open_disk(fd_cbm, settings, src_arg, 0,
+    if(src->open_disk(&src_state, fd_cbm, settings, src_arg, 0,
                       start_turbo, message_cb) == 0)
     {
         if(settings->end_track == -1)
@@ -351,16 +895,23 @@ static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
                 settings->two_sided ? D71_TRACKS : STD_TRACKS;
         }
         SETSTATEDEBUG((void)0);
-        if(dst->open_disk(fd_cbm, settings, dst_arg, 1,
+        if(dst->open_disk(&dst_state, fd_cbm, settings, dst_arg, 1,
                           start_turbo, message_cb) != 0)
         {
             message_cb(0, "can't open destination");
+            src->close_disk(src_state);
+            d64copy_index_close(index);
             return -1;
         }
+        if(!dst->is_cbm_drive)
+        {
+            active_slot = active_copy_add(dst, dst_state);
+        }
     }
     else
     {
         message_cb(0, "can't open source");
+        d64copy_index_close(index);
         return -1;
     }
 
@@ -374,20 +925,20 @@ static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
             trackmap[0] = bs_must_copy;
             scnt = 1;
             SETSTATEDEBUG((void)0);
-            src->send_track_map(18, trackmap, scnt);
+            src->send_track_map(src_state, 18, trackmap, scnt);
             SETSTATEDEBUG(DebugBlockCount=0);
-            st = src->read_gcr_block(&se, gcr);
+            st = src->read_gcr_block(src_state, &se, gcr);
             SETSTATEDEBUG(DebugBlockCount=-1);
             if(st == 0) st = gcr_decode(gcr, bam);
         }
         else
         {
             SETSTATEDEBUG(DebugBlockCount=0);
-            st = src->read_block(18, 0, bam);
+            st = src->read_block(src_state, 18, 0, bam);
             if(settings->two_sided && (st == 0))
             {
                 SETSTATEDEBUG(DebugBlockCount=1);
-                st = src->read_block(53, 0, bam2);
+                st = src->read_block(src_state, 53, 0, bam2);
             }
             SETSTATEDEBUG(DebugBlockCount=-1);
         }
@@ -437,6 +988,18 @@ static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
             status.total_sectors += sector_map[tr];
             memset(status.bam[tr-1], bs_must_copy, sector_map[tr]);
         }
+
+        /* unchanged blocks are taken from the previous image */
+        for(se = 0; index && se < sector_map[tr]; se++)
+        {
+            data = d64copy_index_unchanged(index, tr, se);
+            if(status.bam[tr-1][se] == bs_must_copy && data &&
+               dst->write_block(dst_state, tr, se, data, BLOCKSIZE, 0) == 0)
+            {
+                status.bam[tr-1][se] = bs_dont_copy;
+                status.total_sectors--;
+            }
+        }
     }
 
     status.settings = settings;
@@ -446,178 +1009,190 @@ static int copy_disk(CBM_FILE fd_cbm, d64copy_settings *settings,
     message_cb(2, "copying tracks %d-%d (%d sectors)",
             settings->start_track, settings->end_track, status.total_sectors);
 
-    SETSTATEDEBUG(DebugBlockCount=0);
+    /* the tracks to copy, in the order they are copied */
+    ntracks = 0;
     for(tr = 1; tr <= max_tracks; tr++)
     {
         if(tr >= settings->start_track && tr <= settings->end_track)
         {
-            scnt = sector_map[tr];
-            memcpy(trackmap, status.bam[tr-1], scnt);
-            if(settings->bam_mode != bm_ignore)
+            order[ntracks++] = tr;
+        }
+        if(settings->two_sided)
+        {
+            if(tr <= STD_TRACKS)
             {
-                for(se = 0; se < sector_map[tr]; se++)
+                if(tr + STD_TRACKS <= D71_TRACKS)
                 {
-                    if(trackmap[se] != bs_must_copy)
-                    {
-                        scnt--;
-                    }
+                    tr += (STD_TRACKS - 1);
                 }
             }
+            else if(tr != D71_TRACKS)
+            {
+                tr -= STD_TRACKS;
+            }
+        }
+    }
+
+    if(pipe_open(&pipe, src, src_state, settings, sector_map, message_cb) != 0)
+    {
+        message_cb(0, "can't allocate the transfer buffers");
+        active_copy_remove(active_slot);
+        dst->close_disk(dst_state);
+        src->close_disk(src_state);
+        d64copy_index_close(index);
+        return -1;
+    }
 
-            retry_count = settings->retries;
-            do
+    SETSTATEDEBUG(DebugBlockCount=0);
+    next = pending = 0;
+    while(next < ntracks || pending > 0)
+    {
+        /* keep the reader busy */
+        while(next < ntracks && pending < pipe.max_pending)
+        {
+            tr = order[next++];
+            t = &tracks[tr];
+            scnt = sector_map[tr];
+            memcpy(t->trackmap, status.bam[tr-1], scnt);
+            for(se = 0; se < sector_map[tr]; se++)
             {
-                errors = resend_trackmap = 0;
-                if(scnt && settings->warp && src->is_cbm_drive)
-                {
-                    SETSTATEDEBUG((void)0);
-                    src->send_track_map(tr, trackmap, scnt);
-                }
-                else
+                if(t->trackmap[se] != bs_must_copy)
                 {
-                    se = 0;
+                    scnt--;
                 }
-                while(scnt && !resend_trackmap)
-                {
-                    if(settings->warp && src->is_cbm_drive)
-                    {
-                        SETSTATEDEBUG((void)0);
-                        status.read_result = src->read_gcr_block(&se, gcr);
-                        if(status.read_result == 0)
-                        {
-                            SETSTATEDEBUG((void)0);
-                            status.read_result = gcr_decode(gcr, block);
-                        }
-                        else
-                        {
-                            /* mark all sectors not received so far */
-                            /* ugly */
-                            errors = 0;
-                            for(scnt = 0; scnt < sector_map[tr]; scnt++)
-                            {
-                                if(NEED_SECTOR(trackmap[scnt]) && scnt != se)
-                                {
-                                    trackmap[scnt] = bs_error;
-                                    errors++;
-                                }
-                            }
-                            resend_trackmap = 1;
-                        }
-                    }
-                    else
-                    {
-                        while(!NEED_SECTOR(trackmap[se]))
-                        {
-                            if(++se >= sector_map[tr]) se = 0;
-                        }
-                        SETSTATEDEBUG(DebugBlockCount++);
-                        status.read_result = src->read_block(tr, se, block);
-                    }
-
-                    if(settings->warp && dst->is_cbm_drive)
-                    {
-                        SETSTATEDEBUG((void)0);
-                        gcr_encode(block, gcr);
-                        SETSTATEDEBUG(DebugBlockCount++);
-                        status.write_result = 
-                            dst->write_block(tr, se, gcr, GCRBUFSIZE-1,
-                                             status.read_result);
-                    }
-                    else
-                    {
-                        SETSTATEDEBUG(DebugBlockCount++);
-                        status.write_result = 
-                            dst->write_block(tr, se, block, BLOCKSIZE,
-                                             status.read_result);
-                    }
-                    SETSTATEDEBUG((void)0);
+            }
+            t->retry_count = settings->retries;
+            t->errors = 0;
+            pipe_post_pass(&pipe, tr, t->trackmap, scnt);
+            pending++;
+        }
 
-                    if(status.read_result)
-                    {
-                        /* read error */
-                        trackmap[se] = bs_error;
-                        errors++;
-                        if(retry_count == 0)
-                        {
-                            status.sectors_processed++;
-                            /* FIXME: shall we get rid of this? */
-                            message_cb( 1, "read error: %02x/%02x: %d",
-                                        tr, se, status.read_result );
-                        }
-                    }
-                    else
-                    {
-                        /* successfull read */
-                        if(status.write_result)
-                        {
-                            /* write error */
-                            trackmap[se] = bs_error;
-                            errors++;
-                            if(retry_count == 0)
-                            {
-                                status.sectors_processed++;
-                                /* FIXME: shall we get rid of this? */
-                                message_cb(1, "write error: %02x/%02x: %d",
-                                           tr, se, status.write_result);
-                            }
-                        }
-                        else
-                        {
-                            /* successfull read and write, mark sector */
-                            trackmap[se] = bs_copied;
-                            cnt++;
-                            status.sectors_processed++;
-                        }
-                    }
-                    /* remaining sectors on this track */
-                    if(!resend_trackmap)
-                    {
-                        scnt--;
-                    }
-
-                    status.track = tr;
-                    status.sector= se;
-
-                    status_cb(status);
-
-                    if(dst->is_cbm_drive || !settings->warp)
-                    {
-                        se += (unsigned char) settings->interleave;
-                        if(se >= sector_map[tr]) se -= sector_map[tr];
-                    }
-                }
-                if(errors > 0 && settings->retries >= 0)
+        blk = pipe_get_block(&pipe);
+        tr = blk->tr;
+        se = blk->se;
+        t = &tracks[tr];
+
+        if(blk->kind == pk_end)
+        {
+            pipe_release_block(&pipe);
+            pending--;
+
+            errors = t->errors;
+            if(errors > 0 && settings->retries >= 0)
+            {
+                t->retry_count--;
+            }
+            if(t->retry_count >= 0 && errors > 0)
+            {
+                t->errors = 0;
+                pipe_post_pass(&pipe, tr, t->trackmap, errors);
+                pending++;
+            }
+            else if(errors)
+            {
+                message_cb(1, "giving up...");
+            }
+            continue;
+        }
+
+        data = blk->data;
+        status.read_result = blk->read_result;
+        if(blk->kind == pk_abort)
+        {
+            /* mark all sectors not received so far */
+            t->errors = 0;
+            for(scnt = 0; scnt < sector_map[tr]; scnt++)
+            {
+                if(NEED_SECTOR(t->trackmap[scnt]) && scnt != se)
                 {
-                    retry_count--;
-                    scnt = errors;
+                    t->trackmap[scnt] = bs_error;
+                    t->errors++;
                 }
             }
-            while(retry_count >= 0 && errors > 0);
-            if(errors)
+            data = block;
+        }
+        else if(settings->warp && src->is_cbm_drive)
+        {
+            SETSTATEDEBUG((void)0);
+            status.read_result = gcr_decode(blk->data, block);
+            data = block;
+        }
+
+        if(settings->warp && dst->is_cbm_drive)
+        {
+            SETSTATEDEBUG((void)0);
+            gcr_encode(data, gcr);
+            SETSTATEDEBUG(DebugBlockCount++);
+            status.write_result = 
+                dst->write_block(dst_state, tr, se, gcr, GCRBUFSIZE-1,
+                                 status.read_result);
+        }
+        else
+        {
+            SETSTATEDEBUG(DebugBlockCount++);
+            status.write_result = 
+                dst->write_block(dst_state, tr, se, data, BLOCKSIZE,
+                                 status.read_result);
+        }
+        SETSTATEDEBUG((void)0);
+        pipe_release_block(&pipe);
+
+        if(status.read_result)
+        {
+            /* read error */
+            t->trackmap[se] = bs_error;
+            t->errors++;
+            if(t->retry_count == 0)
             {
-                message_cb(1, "giving up...");
+                status.sectors_processed++;
+                /* FIXME: shall we get rid of this? */
+                message_cb( 1, "read error: %02x/%02x: %d",
+                            tr, se, status.read_result );
             }
         }
-        if(settings->two_sided)
+        else
         {
-            if(tr <= STD_TRACKS)
+            /* successfull read */
+            if(status.write_result)
             {
-                if(tr + STD_TRACKS <= D71_TRACKS)
+                /* write error */
+                t->trackmap[se] = bs_error;
+                t->errors++;
+                if(t->retry_count == 0)
                 {
-                    tr += (STD_TRACKS - 1);
+                    status.sectors_processed++;
+                    /* FIXME: shall we get rid of this? */
+                    message_cb(1, "write error: %02x/%02x: %d",
+                               tr, se, status.write_result);
                 }
             }
-            else if(tr != D71_TRACKS)
+            else
             {
-                tr -= STD_TRACKS;
+                /* successfull read and write, mark sector */
+                t->trackmap[se] = bs_copied;
+                cnt++;
+                status.sectors_processed++;
             }
         }
+
+        status.track = tr;
+        status.sector= se;
+
+        status_cb(status);
     }
+    pipe_close(&pipe);
     SETSTATEDEBUG(DebugBlockCount=-1);
 
-    dst->close_disk();
+    active_copy_remove(active_slot);
+    dst->close_disk(dst_state);
     SETSTATEDEBUG((void)0);
-    src->close_disk();
+    src->close_disk(src_state);
+
+    if(index)
+    {
+        d64copy_index_commit(index, message_cb);
+        d64copy_index_close(index);
+    }
 
     SETSTATEDEBUG((void)0);
     return cnt;
@@ -720,7 +1295,7 @@ int d64copy_check_auto_transfer_mode(CBM_FILE cbm_fd, int auto_transfermode, int
     {
         do {
             enum cbm_cable_type_e cable_type;
-            unsigned char testdrive;
+            unsigned long devices;
 
             /*
              * Test the cable
@@ -745,24 +1320,17 @@ int d64copy_check_auto_transfer_mode(CBM_FILE cbm_fd, int auto_transfermode, int
              * on the bus, so we can use serial2, at least.
              */
 
-            for (testdrive = 4; testdrive < 31; ++testdrive)
-            {
-                enum cbm_device_type_e device_type;
-
-                /* of course, the drive to be transfered to is present! */
-                if (testdrive == drive)
-                    continue;
+            SETSTATEDEBUG((void)0);
+            cbm_bus_scan(cbm_fd, &devices);
 
+            /* of course, the drive to be transfered to is present! */
+            if (devices & ~(1ul << drive))
+            {
+                /*
+                 * My bad, there is another drive -> only use serial1
+                 */
                 SETSTATEDEBUG((void)0);
-                if (cbm_identify(cbm_fd, testdrive, &device_type, NULL) == 0)
-                {
-                    /*
-                     * My bad, there is another drive -> only use serial1
-                     */
-                    SETSTATEDEBUG((void)0);
-                    transfermode = d64copy_get_transfer_mode_index("serial1");
-                    break;
-                }
+                transfermode = d64copy_get_transfer_mode_index("serial1");
             }
 
             /*
@@ -790,24 +1358,14 @@ int d64copy_read_image(CBM_FILE cbm_fd,
 {
     const transfer_funcs *src;
     const transfer_funcs *dst;
-    int ret;
-
-    message_cb = msg_cb;
-    status_cb = stat_cb;
 
     src = transfers[settings->transfer_mode].trf;
     dst = &d64copy_fs_transfer;
 
-    atom_dst = dst;
-    atom_mustcleanup = 1;
-
     SETSTATEDEBUG((void)0);
-    ret = copy_disk(cbm_fd, settings,
-            src, (void*)(ULONG_PTR)src_drive, dst, (void*)dst_image, (unsigned char) src_drive);
-
-    atom_mustcleanup = 0;
-
-    return ret;
+    return copy_disk(cbm_fd, settings,
+            src, (void*)(ULONG_PTR)src_drive, dst, (void*)dst_image, (unsigned char) src_drive,
+            msg_cb, stat_cb);
 }
 
 int d64copy_write_image(CBM_FILE cbm_fd,
@@ -820,15 +1378,13 @@ int d64copy_write_image(CBM_FILE cbm_fd,
     const transfer_funcs *src;
     const transfer_funcs *dst;
 
-    message_cb = msg_cb;
-    status_cb = stat_cb;
-
     src = &d64copy_fs_transfer;
     dst = transfers[settings->transfer_mode].trf;
 
     SETSTATEDEBUG((void)0);
     return copy_disk(cbm_fd, settings,
-            src, (void*)src_image, dst, (void*)(ULONG_PTR)dst_drive, (unsigned char) dst_drive);
+            src, (void*)src_image, dst, (void*)(ULONG_PTR)dst_drive, (unsigned char) dst_drive,
+            msg_cb, stat_cb);
 }
 
 void d64copy_cleanup(void)
@@ -837,9 +1393,17 @@ void d64copy_cleanup(void)
      * write anything that has already been started
      */
 
-    if (atom_mustcleanup)
+    int i;
+    const transfer_funcs *dst;
+
+    /* no locking here, as this is called from the signal handler */
+    for (i = 0; i < MAX_ACTIVE_COPIES; i++)
     {
-        atom_dst->close_disk();
-        atom_mustcleanup = 0;
+        dst = active_copies[i].dst;
+        if (dst)
+        {
+            active_copies[i].dst = NULL;
+            dst->close_disk(active_copies[i].state);
+        }
     }
 }
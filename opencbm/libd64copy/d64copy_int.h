@@ -16,6 +16,8 @@
 
 #include "arch.h"
 
+#include "opencbm-plugin.h"
+
 #ifdef LIBD64COPY_DEBUG
 # define DEBUG_STATEDEBUG
 #endif
@@ -40,18 +42,90 @@
 
 typedef int(*turbo_start)(CBM_FILE,unsigned char);
 
+/*
+ * All state of an opened transfer lives in the object open_disk() returns
+ * in its first parameter, which is given to all the other functions, so
+ * several copies can run at the same time on different handles.
+ */
 typedef struct {
-    int  (*open_disk)(CBM_FILE,d64copy_settings*,const void*,int,
+    int  (*open_disk)(void**,CBM_FILE,d64copy_settings*,const void*,int,
                       turbo_start,d64copy_message_cb);
-    int  (*read_block)(unsigned char,unsigned char,unsigned char*);
-    int  (*write_block)(unsigned char,unsigned char,const unsigned char*,int,int);
-    void (*close_disk)(void);
+    int  (*read_block)(void*,unsigned char,unsigned char,unsigned char*);
+    int  (*write_block)(void*,unsigned char,unsigned char,const unsigned char*,int,int);
+    void (*close_disk)(void*);
     int  is_cbm_drive;
     int  needs_turbo;
-    int  (*send_track_map)(unsigned char,const char*,unsigned char);
-    int  (*read_gcr_block)(unsigned char*,unsigned char*);
+    int  (*send_track_map)(void*,unsigned char,const char*,unsigned char);
+    int  (*read_gcr_block)(void*,unsigned char*,unsigned char*);
+    int  (*queue_block)(void*,unsigned char,unsigned char,unsigned char*,int*);
+    void (*flush_blocks)(void*);
 } transfer_funcs;
 
+/*
+ * Warp reads through a plugin which reads a whole track on its own:
+ * send_track_map() only keeps the map, the first read_gcr_block() of the
+ * pass gets all sectors, and the others are taken from here.
+ */
+typedef struct {
+    opencbm_plugin_warp_read_track_t *read_track;
+    unsigned char map[2+2*MAX_SECTORS];
+    unsigned int map_size;
+    unsigned char count;        /* sectors of the pending pass, 0 if none */
+    int results;                /* sectors returned by the plugin */
+    int next;                   /* next one to hand out */
+    unsigned char result[2*MAX_SECTORS];
+    unsigned char gcr[MAX_SECTORS*GCRBUFSIZE];
+} d64copy_warp_track;
+
+extern d64copy_warp_track *d64copy_warp_track_open(void);
+extern void d64copy_warp_track_close(d64copy_warp_track *wt);
+extern void d64copy_warp_track_map(d64copy_warp_track *wt,
+                                   const unsigned char *map,
+                                   unsigned int size, unsigned char count);
+extern int d64copy_warp_track_read(d64copy_warp_track *wt, CBM_FILE fd,
+                                   int protocol, unsigned char *se,
+                                   unsigned char *gcrbuf);
+
+/*
+ * Block reads through a plugin with queued transfers: queue_block() only
+ * queues the request of a block, so the requests of a whole pass are in
+ * flight one after the other, and only when the plugin's queue is full,
+ * the oldest ones are waited for. flush_blocks() waits for the rest and
+ * stores the status of every block queued since the last flush.
+ */
+typedef struct {
+    opencbm_plugin_queue_read_n_t *read_n;
+    opencbm_plugin_queue_write_n_t *write_n;
+    opencbm_plugin_queue_flush_t *flush;
+    int protocol;
+    unsigned int status_size;   /* status bytes before the block */
+    int count;                  /* blocks queued since the last flush */
+    int failed;                 /* a flush of the plugin failed meanwhile */
+    struct {
+        unsigned char trse[2];
+        unsigned char status[2];
+        int done[3];            /* bytes transferred of trse, status, block */
+        int *result;
+    } block[MAX_SECTORS];
+} d64copy_block_queue;
+
+extern d64copy_block_queue *d64copy_block_queue_open(int protocol,
+                                                     unsigned int status_size);
+extern void d64copy_block_queue_close(d64copy_block_queue *bq);
+extern int d64copy_block_queue_read(d64copy_block_queue *bq, CBM_FILE fd,
+                                    unsigned char tr, unsigned char se,
+                                    unsigned char *block, int *result);
+extern void d64copy_block_queue_flush(d64copy_block_queue *bq, CBM_FILE fd);
+
+/* transfer state of the drive transfers */
+typedef struct {
+    CBM_FILE fd_cbm;
+    unsigned char drive;
+    int two_sided;
+    d64copy_warp_track *warp;   /* NULL if not reading whole tracks */
+    d64copy_block_queue *queue; /* NULL if the plugin cannot queue */
+} cbm_transfer_state;
+
 #define DECLARE_TRANSFER_FUNCS(x,c,t) \
     transfer_funcs d64copy_ ## x = {open_disk, \
                         read_block, \
@@ -60,6 +134,8 @@ typedef struct {
                         c, \
                         t, \
                         NULL, \
+                        NULL, \
+                        NULL, \
                         NULL}
 
 #define DECLARE_TRANSFER_FUNCS_EX(x,c,t) \
@@ -70,6 +146,24 @@ typedef struct {
                         c, \
                         t, \
                         send_track_map, \
-                        read_gcr_block}
+                        read_gcr_block, \
+                        queue_block, \
+                        flush_blocks}
+
+/* incremental imaging, see index.c */
+typedef struct d64copy_index_s d64copy_index;
+
+extern d64copy_index *d64copy_index_open(const char *image,
+                                         const d64copy_settings *settings,
+                                         d64copy_message_cb message_cb);
+extern int d64copy_index_scan(d64copy_index *index, CBM_FILE fd,
+                              unsigned char drive, int start_track,
+                              int end_track, d64copy_message_cb message_cb);
+extern const unsigned char *d64copy_index_unchanged(d64copy_index *index,
+                                                    unsigned char tr,
+                                                    unsigned char se);
+extern int d64copy_index_commit(d64copy_index *index,
+                                d64copy_message_cb message_cb);
+extern void d64copy_index_close(d64copy_index *index);
 
 #endif
@@ -15,74 +15,134 @@
 
 #include "arch.h"
 
-static d64copy_settings *fs_settings;
+typedef struct
+{
+    d64copy_settings *fs_settings;
+
+    FILE *the_file;
+    char *error_map;
+    int block_count;
+
+    /*
+     * The image is mapped into memory if possible, so the blocks are
+     * just copied from or to it. If not, the_file is used.
+     */
+    ARCH_FILEMAP *map;
+    unsigned char *image;
+
+    /* number of blocks in front of every track */
+    int track_offset[D71_TRACKS+2];
 
-static FILE *the_file;
-static char *error_map;
-static int block_count;
+    /*
+     * Variables to make sure writing the block is an atomary process
+     */
+    volatile int atom_execute;
+    unsigned char atom_tr;
+    unsigned char atom_se;
+    const unsigned char *atom_blk;
+    int atom_size;
+    int atom_read_status;
+} fs_state;
 
 /* always use maximum size for error map */
 #define ERROR_MAP_LENGTH D71_BLOCKS
 
-static int block_offset(int tr, int se)
+static void setup_track_offsets(fs_state *fs)
+{
+    int sectors = 0, n, i;
+
+    for(i = 1; i <= D71_TRACKS + 1; i++)
+    {
+        fs->track_offset[i] = sectors;
+        n = d64copy_sector_count(fs->fs_settings->two_sided, i);
+        if(n > 0)
+        {
+            sectors += n;
+        }
+    }
+}
+
+static long block_offset(fs_state *fs, int tr, int se)
 {
-    int sectors = 0, i;
-    for(i = 1; i < tr; i++)
+    if(tr < 1 || tr > D71_TRACKS)
     {
-        sectors += d64copy_sector_count(fs_settings->two_sided, i);
+        return -1;
     }
-    return (sectors + se) * BLOCKSIZE;
+    return (long) (fs->track_offset[tr] + se) * BLOCKSIZE;
+}
+
+/* is the given range completely inside of the mapped image? */
+static int in_image(fs_state *fs, long ofs, int size)
+{
+    return ofs >= 0 && ofs + size <= (long) fs->block_count * BLOCKSIZE;
 }
 
-static int read_block(unsigned char tr, unsigned char se, unsigned char *block)
+static int read_block(void *state, unsigned char tr, unsigned char se, unsigned char *block)
 {
-    if(fseek(the_file, block_offset(tr, se), SEEK_SET) == 0)
+    fs_state *fs = state;
+    long ofs = block_offset(fs, tr, se);
+
+    if(fs->image)
     {
-        return fread(block, BLOCKSIZE, 1, the_file) != 1;
+        if(!in_image(fs, ofs, BLOCKSIZE))
+        {
+            return 1;
+        }
+        memcpy(block, fs->image + ofs, BLOCKSIZE);
+        return 0;
+    }
+
+    if(ofs >= 0 && fseek(fs->the_file, ofs, SEEK_SET) == 0)
+    {
+        return fread(block, BLOCKSIZE, 1, fs->the_file) != 1;
     }
     return 1;
 }
 
-/*
- * Variables to make sure writing the block is an atomary process
- */
-static int atom_execute = 0;
-static unsigned char atom_tr;
-static unsigned char atom_se;
-static const unsigned char *atom_blk;
-static int atom_size;
-static int atom_read_status;
-
-static int write_block(unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
+static int write_block(void *state, unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
 {
+    fs_state *fs = state;
     long ofs;
     int ret;
 
-    atom_tr = tr;
-    atom_se = se;
-    atom_blk = blk;
-    atom_size = size;
-    atom_read_status = read_status;
+    fs->atom_tr = tr;
+    fs->atom_se = se;
+    fs->atom_blk = blk;
+    fs->atom_size = size;
+    fs->atom_read_status = read_status;
 
-    atom_execute = 1;
+    fs->atom_execute = 1;
 
-    ofs = block_offset(tr, se);
-    if(fseek(the_file, ofs, SEEK_SET) == 0)
+    ofs = block_offset(fs, tr, se);
+    if(fs->image)
     {
-        error_map[ofs / BLOCKSIZE] = (char) ((read_status == 0) ? 1 : read_status);
-        ret = fwrite(blk, size, 1, the_file) != 1;
+        if(in_image(fs, ofs, size))
+        {
+            fs->error_map[ofs / BLOCKSIZE] = (char) ((read_status == 0) ? 1 : read_status);
+            memcpy(fs->image + ofs, blk, size);
+            ret = 0;
+        }
+        else
+        {
+            ret = 1;
+        }
+    }
+    else if(ofs >= 0 && fseek(fs->the_file, ofs, SEEK_SET) == 0)
+    {
+        fs->error_map[ofs / BLOCKSIZE] = (char) ((read_status == 0) ? 1 : read_status);
+        ret = fwrite(blk, size, 1, fs->the_file) != 1;
     }
     else
     {
         ret = 1;
     }
 
-    atom_execute = 0;
+    fs->atom_execute = 0;
 
     return ret;
 }
 
-static int open_disk(CBM_FILE fd, d64copy_settings *settings,
+static int open_disk(void **state, CBM_FILE fd, d64copy_settings *settings,
                      const void *arg, int for_writing,
                      turbo_start start, d64copy_message_cb message_cb)
 {
@@ -90,10 +150,18 @@ static int open_disk(CBM_FILE fd, d64copy_settings *settings,
     int stat_ok, is_image, error_info;
     int tr = 0;
     char *name = (char*)arg;
+    fs_state *fs;
+    FILE *the_file = NULL;
+    char *error_map = NULL;
+    int block_count = 0;
 
-    the_file = NULL;
-    fs_settings = settings;
-    block_count = 0;
+    fs = calloc(1, sizeof(*fs));
+    if(!fs)
+    {
+        message_cb(0, "no memory for transfer state");
+        return 1;
+    }
+    fs->fs_settings = settings;
 
     stat_ok = arch_filesize(name, &filesize) == 0;
     is_image = error_info = 0;
@@ -174,7 +242,7 @@ static int open_disk(CBM_FILE fd, d64copy_settings *settings,
     }
     else
     {
-        the_file = fopen(name, is_image ? "r+b" : "wb");
+        the_file = fopen(name, is_image ? "r+b" : "w+b");
         if(the_file)
         {
             /* check whether we must resize or create an image file */
@@ -206,6 +274,7 @@ static int open_disk(CBM_FILE fd, d64copy_settings *settings,
                 {
                     arch_unlink(name);
                 }
+                free(fs);
                 return 1;
             }
 
@@ -218,6 +287,8 @@ static int open_disk(CBM_FILE fd, d64copy_settings *settings,
                     {
                         message_cb(0, "%s: could not read error map", name);
                         fclose(the_file);
+                        free(error_map);
+                        free(fs);
                         return 1;
                     }
                 }
@@ -225,6 +296,8 @@ static int open_disk(CBM_FILE fd, d64copy_settings *settings,
                 {
                     message_cb(0, "%s: could not seek to end of file", name);
                     fclose(the_file);
+                    free(error_map);
+                    free(fs);
                     return 1;
                 }
             }
@@ -245,6 +318,8 @@ static int open_disk(CBM_FILE fd, d64copy_settings *settings,
                     fclose(the_file);
                     if(!is_image)
                         arch_unlink(name);
+                    free(error_map);
+                    free(fs);
                     return 1;
                 }
             }
@@ -254,26 +329,57 @@ static int open_disk(CBM_FILE fd, d64copy_settings *settings,
             message_cb(0, "could not open %s", name);
         }
     }
-    return the_file == NULL;
+
+    if(the_file == NULL)
+    {
+        free(fs);
+        return 1;
+    }
+
+    fs->the_file = the_file;
+    fs->error_map = error_map;
+    fs->block_count = block_count;
+    setup_track_offsets(fs);
+
+    if(arch_file_map(&fs->map, arch_fileno(the_file),
+                     (size_t) block_count * BLOCKSIZE, for_writing,
+                     &fs->image) != 0)
+    {
+        message_cb(3, "could not map %s, using file I/O", name);
+        fs->map = NULL;
+        fs->image = NULL;
+    }
+
+    *state = fs;
+    return 0;
 }
 
-static void close_disk(void)
+static void close_disk(void *state)
 {
+    fs_state *fs = state;
     int i, has_errors = 0;
 
     /* if writing the block was interrupted, make sure it is
      * redone before closing the disk 
      */
 
-    if (the_file && atom_execute)
+    if (fs->the_file && fs->atom_execute)
     {
-        atom_execute = 0;
-        write_block(atom_tr, atom_se, atom_blk, atom_size, atom_read_status);
+        fs->atom_execute = 0;
+        write_block(fs, fs->atom_tr, fs->atom_se, fs->atom_blk, fs->atom_size, fs->atom_read_status);
     }
 
-    if (fs_settings)
+    /* the mapping has to be gone before the file size can be changed */
+    if (fs->map)
     {
-        switch(fs_settings->error_mode)
+        arch_file_unmap(fs->map);
+        fs->map = NULL;
+        fs->image = NULL;
+    }
+
+    if (fs->fs_settings)
+    {
+        switch(fs->fs_settings->error_mode)
         {
             case em_always:
                 has_errors = 1;
@@ -282,42 +388,186 @@ static void close_disk(void)
                 has_errors = 0;
                 break;
             default:
-                if(error_map)
+                if(fs->error_map)
                 {
-                    for(i = 0; !has_errors && i < block_count; i++)
+                    for(i = 0; !has_errors && i < fs->block_count; i++)
                     {
-                        has_errors = error_map[i] != 1;
+                        has_errors = fs->error_map[i] != 1;
                     }
                 }
                 break;
         }
     }
 
-    if(the_file)
+    if(fs->the_file)
     {
         if(has_errors)
         {
-            if(fseek(the_file, block_count * BLOCKSIZE, SEEK_SET) == 0)
+            if(fseek(fs->the_file, fs->block_count * BLOCKSIZE, SEEK_SET) == 0)
             {
-                fwrite(error_map, block_count, 1, the_file);
+                fwrite(fs->error_map, fs->block_count, 1, fs->the_file);
             }
         } 
         else
         {
-            arch_ftruncate(arch_fileno(the_file), block_count * BLOCKSIZE);
+            arch_ftruncate(arch_fileno(fs->the_file), fs->block_count * BLOCKSIZE);
         }
     }
 
-    if(error_map)
+    if(fs->error_map)
     {
-        free(error_map);
-        error_map = NULL;
+        free(fs->error_map);
     }
-    if(the_file)
+    if(fs->the_file)
     {
-        fclose(the_file);
-        the_file = NULL;
+        fclose(fs->the_file);
     }
+    free(fs);
 }
 
 DECLARE_TRANSFER_FUNCS(fs_transfer, 0, 0);
+
+/* #define OPENCBM_STANDALONE_TEST 1 */
+
+#ifdef OPENCBM_STANDALONE_TEST
+
+/*
+ * Test that new and existing images are mapped into memory, and that the
+ * blocks written through the mapping end up in the file.
+ *
+ * Build it in this directory after the libraries with e.g.
+ *   cc -DOPENCBM_STANDALONE_TEST -I../include -I../include/LINUX \
+ *      -I../arch/linux -o fs-test fs.c d64copy.o gcr.o index.o pp.o s1.o \
+ *      s2.o std.o -L../lib -L../arch/linux -L../libmisc -lopencbm -larch \
+ *      -lmisc -lpthread
+ */
+
+#include <stdarg.h>
+
+static int test_failures;
+static int test_unmapped;
+
+#define TEST_CHECK(_x) \
+    do { \
+        if(!(_x)) \
+        { \
+            fprintf(stderr, "%s:%u: check failed: %s\n", __FILE__, __LINE__, #_x); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+static void test_message(int severity, const char *format, ...)
+{
+    va_list args;
+
+    if(strncmp(format, "could not map", 13) == 0)
+    {
+        ++test_unmapped;
+    }
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+static void test_fill(unsigned char *block, unsigned char tr, unsigned char se)
+{
+    int i;
+
+    for(i = 0; i < BLOCKSIZE; i++)
+    {
+        block[i] = (unsigned char) (tr * 31 + se * 7 + i);
+    }
+}
+
+int main(void)
+{
+    d64copy_settings *settings;
+    void *state = NULL;
+    unsigned char block[BLOCKSIZE], expected[BLOCKSIZE];
+    char name[] = "fs-test.d64";
+    FILE *f;
+    off_t size;
+
+    settings = d64copy_get_default_settings();
+    settings->error_mode = em_never;
+    settings->end_track = STD_TRACKS;
+
+    /* a new image has to be created read/write, or it cannot be mapped */
+    arch_unlink(name);
+    test_unmapped = 0;
+    TEST_CHECK(d64copy_fs_transfer.open_disk(&state, CBM_FILE_INVALID, settings, name, 1,
+                                             NULL, test_message) == 0);
+    TEST_CHECK(test_unmapped == 0);
+    TEST_CHECK(state && ((fs_state *) state)->image != NULL);
+    if(state)
+    {
+        test_fill(block, 18, 0);
+        TEST_CHECK(d64copy_fs_transfer.write_block(state, 18, 0, block, BLOCKSIZE, 0) == 0);
+        test_fill(block, 35, 16);
+        TEST_CHECK(d64copy_fs_transfer.write_block(state, 35, 16, block, BLOCKSIZE, 0) == 0);
+        d64copy_fs_transfer.close_disk(state);
+    }
+
+    TEST_CHECK(arch_filesize(name, &size) == 0 && size == STD_BLOCKS * BLOCKSIZE);
+    f = fopen(name, "rb");
+    TEST_CHECK(f != NULL);
+    if(f)
+    {
+        test_fill(expected, 18, 0);
+        TEST_CHECK(fseek(f, 357L * BLOCKSIZE, SEEK_SET) == 0);
+        TEST_CHECK(fread(block, BLOCKSIZE, 1, f) == 1);
+        TEST_CHECK(memcmp(block, expected, BLOCKSIZE) == 0);
+        test_fill(expected, 35, 16);
+        TEST_CHECK(fseek(f, (STD_BLOCKS - 1L) * BLOCKSIZE, SEEK_SET) == 0);
+        TEST_CHECK(fread(block, BLOCKSIZE, 1, f) == 1);
+        TEST_CHECK(memcmp(block, expected, BLOCKSIZE) == 0);
+        fclose(f);
+    }
+    fprintf(stderr, "new image done.\n");
+
+    /* existing images are mapped for reading and for writing */
+    state = NULL;
+    test_unmapped = 0;
+    settings->end_track = -1;
+    TEST_CHECK(d64copy_fs_transfer.open_disk(&state, CBM_FILE_INVALID, settings, name, 0,
+                                             NULL, test_message) == 0);
+    TEST_CHECK(test_unmapped == 0);
+    if(state)
+    {
+        TEST_CHECK(((fs_state *) state)->image != NULL);
+        test_fill(expected, 18, 0);
+        TEST_CHECK(d64copy_fs_transfer.read_block(state, 18, 0, block) == 0);
+        TEST_CHECK(memcmp(block, expected, BLOCKSIZE) == 0);
+        d64copy_fs_transfer.close_disk(state);
+    }
+
+    state = NULL;
+    settings->end_track = STD_TRACKS;
+    TEST_CHECK(d64copy_fs_transfer.open_disk(&state, CBM_FILE_INVALID, settings, name, 1,
+                                             NULL, test_message) == 0);
+    TEST_CHECK(test_unmapped == 0);
+    if(state)
+    {
+        TEST_CHECK(((fs_state *) state)->image != NULL);
+        test_fill(expected, 35, 16);
+        TEST_CHECK(d64copy_fs_transfer.read_block(state, 35, 16, block) == 0);
+        TEST_CHECK(memcmp(block, expected, BLOCKSIZE) == 0);
+        d64copy_fs_transfer.close_disk(state);
+    }
+    fprintf(stderr, "existing image done.\n");
+
+    arch_unlink(name);
+    free(settings);
+
+    if(test_failures == 0)
+    {
+        fprintf(stderr, "success.\n");
+        return EXIT_SUCCESS;
+    }
+    fprintf(stderr, "%d checks failed.\n", test_failures);
+    return EXIT_FAILURE;
+}
+
+#endif /* #ifdef OPENCBM_STANDALONE_TEST */
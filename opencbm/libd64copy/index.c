@@ -0,0 +1,676 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+*/
+
+/*
+ * Incremental imaging
+ *
+ * Next to an image IMAGE, the file IMAGE.idx holds a checksum of every
+ * block of the image, and the generation of the image, that is, how
+ * many times it has been written in incremental mode. Before a disk is
+ * read into the image again, the drive computes the same checksums of
+ * its blocks; blocks whose checksum did not change are not transferred.
+ *
+ * IMAGE.gen is the generation log: every incremental run appends the
+ * previous contents of the blocks it changed, so every earlier
+ * generation can be rebuilt from the current image.
+ *
+ * All numbers in the files are stored little endian.
+ */
+
+#include "d64copy_int.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arch.h"
+#include "libmisc.h"
+
+static const unsigned char checksum_prog[] = {
+#include "checksum1541.inc"
+};
+
+/* addresses in the drive, see checksum1541.a65 */
+#define CHECKSUM_RES    0x0580
+#define CHECKSUM_TRK    0x05f0
+#define CHECKSUM_RECORD 5
+
+/* sectors to skip between two checksummed ones; the drive needs about
+ * the time of two sectors to pick up a job and to sum the block */
+#define CHECKSUM_INTERLEAVE 4
+
+static const char index_magic[8] = "D64IDX1\n";
+static const char gen_magic[4] = "GEN1";
+
+#define INDEX_HEADER_SIZE   16  /* magic, generation, block count */
+#define INDEX_ENTRY_SIZE    5   /* checksum, valid flag */
+#define GEN_HEADER_SIZE     20  /* magic, generation, time, block count, changed */
+#define GEN_ENTRY_SIZE      (2 + BLOCKSIZE)
+
+struct d64copy_index_s
+{
+    char *image_name;
+    char *index_name;
+    char *gen_name;
+    int two_sided;
+
+    /* the image as it was before this run */
+    unsigned char *old_image;
+    int old_blocks;
+    unsigned long generation;
+
+    /* block of the old image is known to be good and matches the index */
+    char *valid;
+    unsigned long *checksum;
+
+    /* block has been found unchanged on the disk */
+    char unchanged[D71_TRACKS+1][MAX_SECTORS];
+    int unchanged_count;
+};
+
+
+static void put_u32(unsigned char *p, unsigned long v)
+{
+    p[0] = (unsigned char) v;
+    p[1] = (unsigned char) (v >> 8);
+    p[2] = (unsigned char) (v >> 16);
+    p[3] = (unsigned char) (v >> 24);
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | ((unsigned long) p[2] << 16) |
+        ((unsigned long) p[3] << 24);
+}
+
+/* the checksum of checksum1541.a65, as s1 | s2 << 8 | s3 << 24 */
+static unsigned long block_checksum(const unsigned char *block)
+{
+    unsigned int s1 = 0, s2 = 0, s3 = 0;
+    int i;
+
+    for(i = 0; i < BLOCKSIZE; i++)
+    {
+        s1 = (s1 + block[i]) & 0xff;
+        s2 = (s2 + s1) & 0xffff;
+        s3 = (((s3 << 1) | (s3 >> 7)) & 0xff) ^ block[i];
+    }
+    return s1 | ((unsigned long) s2 << 8) | ((unsigned long) s3 << 24);
+}
+
+/* number of blocks in front of the given track */
+static int track_offset(int two_sided, int tr)
+{
+    int i, blocks = 0;
+
+    for(i = 1; i < tr; i++)
+    {
+        blocks += d64copy_sector_count(two_sided, i);
+    }
+    return blocks;
+}
+
+/*
+ * find out the number of blocks of an image file of the given size;
+ * 0 if it is no valid image
+ */
+static int image_blocks(long filesize, int *error_info)
+{
+    int tr, blocks = 0;
+
+    *error_info = 0;
+    if(filesize == D71_BLOCKS * BLOCKSIZE ||
+       filesize == D71_BLOCKS * (BLOCKSIZE + 1))
+    {
+        *error_info = filesize != D71_BLOCKS * BLOCKSIZE;
+        return D71_BLOCKS;
+    }
+    for(tr = 1; tr <= TOT_TRACKS; tr++)
+    {
+        blocks += d64copy_sector_count(0, tr);
+        if(tr >= STD_TRACKS)
+        {
+            if(filesize == blocks * BLOCKSIZE)
+            {
+                return blocks;
+            }
+            if(filesize == blocks * (BLOCKSIZE + 1))
+            {
+                *error_info = 1;
+                return blocks;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * read a complete image; the error information, if any, is returned
+ * in *errors, which may be NULL if it is not needed
+ */
+static unsigned char *read_image(const char *name, int *blocks, char **errors)
+{
+    off_t filesize;
+    int error_info;
+    unsigned char *image;
+    FILE *f;
+
+    if(errors) *errors = NULL;
+
+    if(arch_filesize(name, &filesize) != 0)
+    {
+        return NULL;
+    }
+    *blocks = image_blocks((long) filesize, &error_info);
+    if(*blocks == 0)
+    {
+        return NULL;
+    }
+
+    f = fopen(name, "rb");
+    if(f == NULL)
+    {
+        return NULL;
+    }
+
+    image = malloc((size_t) *blocks * BLOCKSIZE);
+    if(image && fread(image, BLOCKSIZE, *blocks, f) != (size_t) *blocks)
+    {
+        free(image);
+        image = NULL;
+    }
+    if(image && errors && error_info)
+    {
+        *errors = malloc(*blocks);
+        if(*errors && fread(*errors, *blocks, 1, f) != 1)
+        {
+            free(*errors);
+            *errors = NULL;
+        }
+    }
+    fclose(f);
+    return image;
+}
+
+/* read the sidecar index, and find out which blocks of the image it vouches for */
+static void read_index(d64copy_index *index, const char *errors)
+{
+    unsigned char header[INDEX_HEADER_SIZE];
+    unsigned char entry[INDEX_ENTRY_SIZE];
+    FILE *f;
+    int b;
+
+    f = fopen(index->index_name, "rb");
+    if(f == NULL)
+    {
+        return;
+    }
+    if(fread(header, sizeof(header), 1, f) == 1 &&
+       memcmp(header, index_magic, sizeof(index_magic)) == 0)
+    {
+        index->generation = get_u32(header + 8);
+
+        if(get_u32(header + 12) == (unsigned long) index->old_blocks)
+        {
+            for(b = 0; b < index->old_blocks; b++)
+            {
+                if(fread(entry, sizeof(entry), 1, f) != 1)
+                {
+                    memset(index->valid, 0, index->old_blocks);
+                    break;
+                }
+                index->checksum[b] = block_checksum(index->old_image + b * BLOCKSIZE);
+
+                /* a block changed behind our back is not trusted */
+                index->valid[b] = entry[4] &&
+                    get_u32(entry) == index->checksum[b] &&
+                    (errors == NULL || errors[b] == 1);
+            }
+        }
+    }
+    fclose(f);
+}
+
+d64copy_index *d64copy_index_open(const char *image, const d64copy_settings *settings,
+                                  d64copy_message_cb message_cb)
+{
+    d64copy_index *index;
+    char *errors = NULL;
+    int b, valid = 0;
+
+    index = calloc(1, sizeof(*index));
+    if(index == NULL)
+    {
+        message_cb(0, "no memory for the block index");
+        return NULL;
+    }
+    index->two_sided = settings->two_sided;
+    index->image_name = cbmlibmisc_strdup(image);
+    index->index_name = cbmlibmisc_strcat(image, ".idx");
+    index->gen_name = cbmlibmisc_strcat(image, ".gen");
+    if(!index->image_name || !index->index_name || !index->gen_name)
+    {
+        message_cb(0, "no memory for the block index");
+        d64copy_index_close(index);
+        return NULL;
+    }
+
+    index->old_image = read_image(image, &index->old_blocks, &errors);
+    if(index->old_image)
+    {
+        index->valid = calloc(index->old_blocks, 1);
+        index->checksum = calloc(index->old_blocks, sizeof(*index->checksum));
+        if(!index->valid || !index->checksum)
+        {
+            message_cb(0, "no memory for the block index");
+            free(errors);
+            d64copy_index_close(index);
+            return NULL;
+        }
+        read_index(index, errors);
+        free(errors);
+
+        for(b = 0; b < index->old_blocks; b++)
+        {
+            valid += index->valid[b];
+        }
+        message_cb(2, "%s: generation %lu, %d blocks indexed",
+                   image, index->generation, valid);
+    }
+    else
+    {
+        index->old_blocks = 0;
+        message_cb(2, "%s: no previous image, copying everything", image);
+    }
+    return index;
+}
+
+void d64copy_index_close(d64copy_index *index)
+{
+    if(index)
+    {
+        cbmlibmisc_strfree(index->image_name);
+        cbmlibmisc_strfree(index->index_name);
+        cbmlibmisc_strfree(index->gen_name);
+        free(index->old_image);
+        free(index->valid);
+        free(index->checksum);
+        free(index);
+    }
+}
+
+/* checksum the sectors of one track in the drive, and compare them */
+static int scan_track(d64copy_index *index, CBM_FILE fd, unsigned char drive,
+                      unsigned char tr, int sectors, int first_block)
+{
+    unsigned char buf[CHECKSUM_TRK - CHECKSUM_RES + 2];
+    unsigned char res[MAX_SECTORS * CHECKSUM_RECORD];
+    char used[MAX_SECTORS];
+    const unsigned char *r;
+    int i, se, b, size;
+
+    /* the order of the sectors, with an interleave */
+    memset(buf, 0, sizeof(buf));
+    memset(used, 0, sizeof(used));
+    for(i = 0, se = 0; i < sectors; i++)
+    {
+        while(used[se])
+        {
+            if(++se >= sectors) se = 0;
+        }
+        used[se] = 1;
+        buf[i * CHECKSUM_RECORD] = (unsigned char) se;
+        se = (se + CHECKSUM_INTERLEAVE) % sectors;
+    }
+    size = sectors * CHECKSUM_RECORD;
+    buf[CHECKSUM_TRK - CHECKSUM_RES] = tr;
+    buf[CHECKSUM_TRK - CHECKSUM_RES + 1] = (unsigned char) size;
+
+    if(cbm_upload(fd, drive, CHECKSUM_RES, buf, sizeof(buf)) != (int) sizeof(buf) ||
+       cbm_exec_command(fd, drive, "U3:", 3) != 0 ||
+       cbm_download(fd, drive, CHECKSUM_RES, res, size) != size)
+    {
+        return -1;
+    }
+
+    for(i = 0; i < sectors; i++)
+    {
+        r = &res[i * CHECKSUM_RECORD];
+        se = buf[i * CHECKSUM_RECORD];
+        b = first_block + se;
+
+        /* job status 1 is "OK"; anything else is copied, to get the error */
+        if(r[0] == 1 && b < index->old_blocks && index->valid[b] &&
+           get_u32(r + 1) == index->checksum[b])
+        {
+            index->unchanged[tr][se] = 1;
+            index->unchanged_count++;
+        }
+    }
+    return 0;
+}
+
+int d64copy_index_scan(d64copy_index *index, CBM_FILE fd, unsigned char drive,
+                       int start_track, int end_track, d64copy_message_cb message_cb)
+{
+    int tr, se, sectors, first_block, any;
+    int uploaded = 0;
+
+    for(tr = start_track; tr <= end_track; tr++)
+    {
+        sectors = d64copy_sector_count(index->two_sided, tr);
+        first_block = track_offset(index->two_sided, tr);
+
+        /* without a usable block in the image, there is nothing to compare */
+        for(se = 0, any = 0; se < sectors && !any; se++)
+        {
+            any = first_block + se < index->old_blocks && index->valid[first_block + se];
+        }
+        if(!any)
+        {
+            continue;
+        }
+
+        if(!uploaded)
+        {
+            if(cbm_upload(fd, drive, 0x500, checksum_prog, sizeof(checksum_prog))
+                   != (int) sizeof(checksum_prog))
+            {
+                message_cb(1, "could not upload the checksum code");
+                return -1;
+            }
+            uploaded = 1;
+        }
+
+        SETSTATEDEBUG((void)0);
+        if(scan_track(index, fd, drive, (unsigned char) tr, sectors, first_block) != 0)
+        {
+            message_cb(1, "could not checksum track %d, copying everything", tr);
+            memset(index->unchanged, 0, sizeof(index->unchanged));
+            index->unchanged_count = 0;
+            return -1;
+        }
+    }
+
+    message_cb(2, "%d blocks unchanged since generation %lu",
+               index->unchanged_count, index->generation);
+    return 0;
+}
+
+const unsigned char *d64copy_index_unchanged(d64copy_index *index,
+                                             unsigned char tr, unsigned char se)
+{
+    if(tr > D71_TRACKS || se >= MAX_SECTORS || !index->unchanged[tr][se])
+    {
+        return NULL;
+    }
+    return index->old_image + (track_offset(index->two_sided, tr) + se) * BLOCKSIZE;
+}
+
+/* append the blocks changed by this run to the generation log */
+static int write_generation(d64copy_index *index, const unsigned char *image, int blocks)
+{
+    unsigned char header[GEN_HEADER_SIZE];
+    unsigned char entry[GEN_ENTRY_SIZE];
+    unsigned long changed = 0;
+    long start;
+    FILE *f;
+    int b, ok;
+
+    for(b = 0; b < index->old_blocks; b++)
+    {
+        if(b >= blocks ||
+           memcmp(index->old_image + b * BLOCKSIZE, image + b * BLOCKSIZE, BLOCKSIZE) != 0)
+        {
+            changed++;
+        }
+    }
+
+    f = fopen(index->gen_name, "ab");
+    if(f == NULL)
+    {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    start = ftell(f);
+
+    memcpy(header, gen_magic, sizeof(gen_magic));
+    put_u32(header + 4, index->generation + 1);
+    put_u32(header + 8, (unsigned long) time(NULL));
+    put_u32(header + 12, index->old_blocks);
+    put_u32(header + 16, changed);
+    ok = fwrite(header, sizeof(header), 1, f) == 1;
+
+    for(b = 0; ok && b < index->old_blocks; b++)
+    {
+        if(b >= blocks ||
+           memcmp(index->old_image + b * BLOCKSIZE, image + b * BLOCKSIZE, BLOCKSIZE) != 0)
+        {
+            entry[0] = (unsigned char) b;
+            entry[1] = (unsigned char) (b >> 8);
+            memcpy(entry + 2, index->old_image + b * BLOCKSIZE, BLOCKSIZE);
+            ok = fwrite(entry, sizeof(entry), 1, f) == 1;
+        }
+    }
+
+    if(!ok)
+    {
+        /* do not leave a partial record behind */
+        fflush(f);
+        arch_ftruncate(arch_fileno(f), start);
+    }
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+int d64copy_index_commit(d64copy_index *index, d64copy_message_cb message_cb)
+{
+    unsigned char header[INDEX_HEADER_SIZE];
+    unsigned char entry[INDEX_ENTRY_SIZE];
+    unsigned char *image;
+    char *errors;
+    int blocks, b, ok;
+    FILE *f;
+
+    image = read_image(index->image_name, &blocks, &errors);
+    if(image == NULL)
+    {
+        message_cb(1, "%s: could not read back the image, index not updated",
+                   index->image_name);
+        return -1;
+    }
+
+    /* the first generation has nothing to undo */
+    if(index->old_image && write_generation(index, image, blocks) != 0)
+    {
+        message_cb(1, "%s: could not write the generation log", index->gen_name);
+        free(errors);
+        free(image);
+        return -1;
+    }
+
+    f = fopen(index->index_name, "wb");
+    ok = f != NULL;
+    if(ok)
+    {
+        memcpy(header, index_magic, sizeof(index_magic));
+        put_u32(header + 8, index->generation + 1);
+        put_u32(header + 12, blocks);
+        ok = fwrite(header, sizeof(header), 1, f) == 1;
+
+        for(b = 0; ok && b < blocks; b++)
+        {
+            put_u32(entry, block_checksum(image + b * BLOCKSIZE));
+            entry[4] = errors == NULL || errors[b] == 1;
+            ok = fwrite(entry, sizeof(entry), 1, f) == 1;
+        }
+        ok = (fclose(f) == 0) && ok;
+    }
+    if(!ok)
+    {
+        message_cb(1, "%s: could not write the block index", index->index_name);
+        arch_unlink(index->index_name);
+    }
+    else
+    {
+        message_cb(2, "%s: now at generation %lu",
+                   index->image_name, index->generation + 1);
+    }
+
+    free(errors);
+    free(image);
+    return ok ? 0 : -1;
+}
+
+/* the generation of an image, as recorded in its index; 0 if unknown */
+static unsigned long current_generation(const char *image)
+{
+    unsigned char header[INDEX_HEADER_SIZE];
+    unsigned long generation = 0;
+    char *name;
+    FILE *f;
+
+    name = cbmlibmisc_strcat(image, ".idx");
+    f = name ? fopen(name, "rb") : NULL;
+    if(f)
+    {
+        if(fread(header, sizeof(header), 1, f) == 1 &&
+           memcmp(header, index_magic, sizeof(index_magic)) == 0)
+        {
+            generation = get_u32(header + 8);
+        }
+        fclose(f);
+    }
+    cbmlibmisc_strfree(name);
+    return generation;
+}
+
+int d64copy_rebuild_generation(const char *image, int generation, const char *target,
+                               d64copy_message_cb message_cb)
+{
+    unsigned char header[GEN_HEADER_SIZE];
+    unsigned char entry[GEN_ENTRY_SIZE];
+    unsigned char *data, *all;
+    long *records = NULL, *r;
+    int nrecords = 0;
+    int blocks, i, rv = 0;
+    unsigned long current, changed, n, b, gen_blocks;
+    char *gen_name;
+    FILE *f;
+
+    current = current_generation(image);
+    if(generation < 0 || (unsigned long) generation > current)
+    {
+        message_cb(0, "%s: is at generation %lu", image, current);
+        return -1;
+    }
+
+    /* the image holds the current generation; older ones might be larger */
+    data = read_image(image, &blocks, NULL);
+    all = data ? realloc(data, D71_BLOCKS * BLOCKSIZE) : NULL;
+    if(all == NULL)
+    {
+        message_cb(0, "%s: could not read the image", image);
+        free(data);
+        return -1;
+    }
+    data = all;
+
+    gen_name = cbmlibmisc_strcat(image, ".gen");
+    f = gen_name ? fopen(gen_name, "rb") : NULL;
+    if(f == NULL && current != (unsigned long) generation)
+    {
+        message_cb(0, "%s: could not open the generation log", image);
+        cbmlibmisc_strfree(gen_name);
+        free(data);
+        return -1;
+    }
+
+    /* find all records first, as they are applied newest first */
+    while(f && fread(header, sizeof(header), 1, f) == 1 &&
+          memcmp(header, gen_magic, sizeof(gen_magic)) == 0)
+    {
+        r = realloc(records, (nrecords + 1) * sizeof(*records));
+        if(r == NULL)
+        {
+            break;
+        }
+        records = r;
+        records[nrecords++] = ftell(f) - GEN_HEADER_SIZE;
+        if(fseek(f, (long) get_u32(header + 16) * GEN_ENTRY_SIZE, SEEK_CUR) != 0)
+        {
+            break;
+        }
+    }
+
+    /* every record takes the image back by one generation */
+    for(i = nrecords - 1; rv == 0 && i >= 0 && current > (unsigned long) generation; i--)
+    {
+        rv = -1;
+        if(fseek(f, records[i], SEEK_SET) != 0 ||
+           fread(header, sizeof(header), 1, f) != 1 ||
+           get_u32(header + 4) != current)
+        {
+            break;
+        }
+        gen_blocks = get_u32(header + 12);
+        changed = get_u32(header + 16);
+        if(gen_blocks > D71_BLOCKS)
+        {
+            break;
+        }
+        for(n = 0; n < changed; n++)
+        {
+            if(fread(entry, sizeof(entry), 1, f) != 1)
+            {
+                break;
+            }
+            b = entry[0] | (entry[1] << 8);
+            if(b < gen_blocks)
+            {
+                memcpy(data + b * BLOCKSIZE, entry + 2, BLOCKSIZE);
+            }
+        }
+        if(n == changed)
+        {
+            blocks = (int) gen_blocks;
+            current--;
+            rv = 0;
+        }
+    }
+    if(f)
+    {
+        fclose(f);
+    }
+
+    if(rv != 0 || current != (unsigned long) generation)
+    {
+        message_cb(0, "%s: generation %d cannot be rebuilt", image, generation);
+        rv = -1;
+    }
+    else
+    {
+        f = fopen(target, "wb");
+        if(f == NULL ||
+           fwrite(data, BLOCKSIZE, blocks, f) != (size_t) blocks)
+        {
+            message_cb(0, "could not write %s", target);
+            rv = -1;
+        }
+        if(f != NULL && fclose(f) != 0)
+        {
+            rv = -1;
+        }
+    }
+
+    free(records);
+    cbmlibmisc_strfree(gen_name);
+    free(data);
+    return rv;
+}
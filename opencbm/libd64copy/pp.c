@@ -17,6 +17,10 @@
 
 #include "opencbm-plugin.h"
 
+/*
+ * The plugin functions are the same for every handle, thus, they can be
+ * shared by all transfers
+ */
 static opencbm_plugin_pp_dc_read_n_t * opencbm_plugin_pp_dc_read_n = NULL;
 
 static opencbm_plugin_pp_dc_write_n_t * opencbm_plugin_pp_dc_write_n = NULL;
@@ -26,8 +30,14 @@ enum pp_direction_e
     PP_READ, PP_WRITE
 };
 
-static CBM_FILE fd_cbm;
-static int two_sided;
+typedef struct
+{
+    CBM_FILE fd_cbm;
+    int two_sided;
+    enum pp_direction_e direction;
+    d64copy_warp_track *warp;
+    d64copy_block_queue *queue;
+} pp_transfer_state;
 
 static const unsigned char pp1541_drive_prog[] = {
 #include "pp1541.inc"
@@ -37,20 +47,20 @@ static const unsigned char pp1571_drive_prog[] = {
 #include "pp1571.inc"
 };
 
-static void pp_check_direction(enum pp_direction_e dir)
+static void pp_check_direction(pp_transfer_state *pp, enum pp_direction_e dir)
 {
-    static enum pp_direction_e direction = PP_READ;
-    if(direction != dir)
+    if(pp->direction != dir)
     {
         arch_usleep(100);
-        direction = dir;
+        pp->direction = dir;
     }
 }
 
-static int pp_write(CBM_FILE fd, char c1, char c2)
+static int pp_write(pp_transfer_state *pp, char c1, char c2)
 {
+    CBM_FILE fd = pp->fd_cbm;
                                                                         SETSTATEDEBUG((void)0);
-    pp_check_direction(PP_WRITE);
+    pp_check_direction(pp, PP_WRITE);
                                                                         SETSTATEDEBUG((void)0);
 #ifndef USE_CBM_IEC_WAIT
     while(!cbm_iec_get(fd, IEC_DATA));
@@ -78,24 +88,25 @@ static int pp_write(CBM_FILE fd, char c1, char c2)
 }
 
 /* write_n redirects USB writes to the external reader if required */
-static void write_n(const unsigned char *data, int size) 
+static void write_n(pp_transfer_state *pp, const unsigned char *data, int size) 
 {
     int i;
 
     if (opencbm_plugin_pp_dc_write_n)
     {
-        opencbm_plugin_pp_dc_write_n(fd_cbm, data, size);
+        opencbm_plugin_pp_dc_write_n(pp->fd_cbm, data, size);
         return;
     }
 
     for(i=0;i<size/2;i++,data+=2)
-	pp_write(fd_cbm, data[0], data[1]);
+	pp_write(pp, data[0], data[1]);
 }
 
-static int pp_read(CBM_FILE fd, unsigned char *c1, unsigned char *c2)
+static int pp_read(pp_transfer_state *pp, unsigned char *c1, unsigned char *c2)
 {
+    CBM_FILE fd = pp->fd_cbm;
                                                                         SETSTATEDEBUG((void)0);
-    pp_check_direction(PP_READ);
+    pp_check_direction(pp, PP_READ);
                                                                         SETSTATEDEBUG((void)0);
 #ifndef USE_CBM_IEC_WAIT
     while(!cbm_iec_get(fd, IEC_DATA));
@@ -123,59 +134,89 @@ static int pp_read(CBM_FILE fd, unsigned char *c1, unsigned char *c2)
 }
 
 /* read_n redirects USB reads to the external reader if required */
-static void read_n(unsigned char *data, int size) 
+static void read_n(pp_transfer_state *pp, unsigned char *data, int size) 
 {
     int i;
 
     if (opencbm_plugin_pp_dc_read_n)
     {
-        opencbm_plugin_pp_dc_read_n(fd_cbm, data, size);
+        opencbm_plugin_pp_dc_read_n(pp->fd_cbm, data, size);
         return;
     }
 
     for(i=0;i<size/2;i++,data+=2)
-	pp_read(fd_cbm, data, data+1);
+	pp_read(pp, data, data+1);
+}
+
+static int queue_block(void *state, unsigned char tr, unsigned char se, unsigned char *block, int *result)
+{
+    pp_transfer_state *pp = state;
+
+    if(pp->queue == NULL)
+    {
+        return 1;
+    }
+                                                                        SETSTATEDEBUG((void)0);
+    return d64copy_block_queue_read(pp->queue, pp->fd_cbm, tr, se, block, result);
+}
+
+static void flush_blocks(void *state)
+{
+    pp_transfer_state *pp = state;
+                                                                        SETSTATEDEBUG((void)0);
+    d64copy_block_queue_flush(pp->queue, pp->fd_cbm);
 }
 
-static int read_block(unsigned char tr, unsigned char se, unsigned char *block)
+static int read_block(void *state, unsigned char tr, unsigned char se, unsigned char *block)
 {
+    pp_transfer_state *pp = state;
     unsigned char status[2];
+
+    if (pp->queue)
+    {
+        int result;
+        queue_block(state, tr, se, block, &result);
+        flush_blocks(state);
+        return result;
+    }
+
                                                                         SETSTATEDEBUG((void)0);
 
     status[0] = tr; status[1] = se;
-    write_n(status, 2);
+    write_n(pp, status, 2);
 
 #ifndef USE_CBM_IEC_WAIT    
     arch_usleep(20000);
 #endif
                                                                         SETSTATEDEBUG((void)0);
-    read_n(status, 2);
+    read_n(pp, status, 2);
 
                                                                         SETSTATEDEBUG(DebugByteCount=0);
-    read_n(block, BLOCKSIZE);
+    read_n(pp, block, BLOCKSIZE);
                                                                         SETSTATEDEBUG(DebugByteCount=-1);
 
                                                                         SETSTATEDEBUG((void)0);
     return status[1];
 }
 
-static int write_block(unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
+static int write_block(void *state, unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
 {
+    pp_transfer_state *pp = state;
     int i = 0;
     unsigned char status[2];
 
                                                                         SETSTATEDEBUG((void)0);
     status[0] = tr; status[1] = se;
-    write_n(status, 2);
+    write_n(pp, status, 2);
 
                                                                         SETSTATEDEBUG((void)0);
     /* send first byte twice if length is odd */
     if(size % 2) {
-        write_n(blk, 2);
+        write_n(pp, blk, 2);
         i = 1;
     }
                                                                         SETSTATEDEBUG(DebugByteCount=0);
-    write_n(blk+i, size-i);
+    write_n(pp, blk+i, size-i);
 
                                                                         SETSTATEDEBUG(DebugByteCount=-1);
 #ifndef USE_CBM_IEC_WAIT    
@@ -185,27 +226,44 @@ static int write_block(unsigned char tr, unsigned char se, const unsigned char *
 #endif
 
                                                                         SETSTATEDEBUG((void)0);
-    read_n(status, 2);
+    read_n(pp, status, 2);
 
                                                                         SETSTATEDEBUG((void)0);
     return status[1];
 }
 
-static int open_disk(CBM_FILE fd, d64copy_settings *settings,
+static int open_disk(void **state, CBM_FILE fd, d64copy_settings *settings,
                      const void *arg, int for_writing,
                      turbo_start start, d64copy_message_cb message_cb)
 {
     unsigned char d = (unsigned char)(ULONG_PTR)arg;
     const unsigned char *drive_prog;
     int prog_size;
+    pp_transfer_state *pp;
+    CBM_FILE fd_cbm = fd;
 
-    fd_cbm    = fd;
-    two_sided = settings->two_sided;
+    pp = malloc(sizeof(*pp));
+    if(pp == NULL)
+    {
+        message_cb(0, "no memory for transfer state");
+        return 1;
+    }
+    pp->fd_cbm = fd;
+    pp->two_sided = settings->two_sided;
+    pp->direction = PP_READ;
+    pp->warp = NULL;
+    if(!for_writing && settings->warp)
+    {
+        pp->warp = d64copy_warp_track_open();
+    }
+    *state = pp;
 
     opencbm_plugin_pp_dc_read_n = cbm_get_plugin_function_address("opencbm_plugin_pp_dc_read_n");
 
     opencbm_plugin_pp_dc_write_n = cbm_get_plugin_function_address("opencbm_plugin_pp_dc_write_n");
 
+    pp->queue = d64copy_block_queue_open(opencbm_proto_pp_dc, 2);
+
     if(settings->drive_type != cbm_dt_cbm1541)
     {
         drive_prog = pp1571_drive_prog;
@@ -222,11 +280,11 @@ static int open_disk(CBM_FILE fd, d64copy_settings *settings,
     cbm_pp_read(fd_cbm);
 
                                                                         SETSTATEDEBUG((void)0);
-    cbm_upload(fd_cbm, d, 0x700, drive_prog, prog_size);
+    cbm_upload_cached(fd_cbm, d, 0x700, drive_prog, prog_size);
                                                                         SETSTATEDEBUG((void)0);
     start(fd, d);
                                                                         SETSTATEDEBUG((void)0);
-    pp_check_direction(PP_READ);
+    pp_check_direction(pp, PP_READ);
                                                                         SETSTATEDEBUG((void)0);
     cbm_iec_set(fd_cbm, IEC_CLOCK);
                                                                         SETSTATEDEBUG((void)0);
@@ -235,10 +293,12 @@ static int open_disk(CBM_FILE fd, d64copy_settings *settings,
     return 0;
 }
 
-static void close_disk(void)
+static void close_disk(void *state)
 {
+    pp_transfer_state *pp = state;
+    CBM_FILE fd_cbm = pp->fd_cbm;
                                                                         SETSTATEDEBUG((void)0);
-    pp_write(fd_cbm, 0, 0);
+    pp_write(pp, 0, 0);
     arch_usleep(100);
                                                                         SETSTATEDEBUG((void)0);
     cbm_iec_wait(fd_cbm, IEC_DATA, 0);
@@ -248,17 +308,18 @@ static void close_disk(void)
     cbm_pp_read(fd_cbm);
                                                                         SETSTATEDEBUG((void)0);
 
-    opencbm_plugin_pp_dc_read_n = NULL;
-
-    opencbm_plugin_pp_dc_write_n = NULL;
+    d64copy_warp_track_close(pp->warp);
+    d64copy_block_queue_close(pp->queue);
+    free(pp);
 }
 
-static int send_track_map(unsigned char tr, const char *trackmap, unsigned char count)
+static int send_track_map(void *state, unsigned char tr, const char *trackmap, unsigned char count)
 {
+    pp_transfer_state *pp = state;
     int i, size;
     unsigned char *data;
 
-    size = d64copy_sector_count(two_sided, tr);
+    size = d64copy_sector_count(pp->two_sided, tr);
     data = malloc(2+2*size);
 
     data[0] = tr;
@@ -268,26 +329,39 @@ static int send_track_map(unsigned char tr, const char *trackmap, unsigned char
     for(i = 0; i < size; i++)
 	data[2+2*i] = data[2+2*i+1] = !NEED_SECTOR(trackmap[i]);
     
-    write_n(data, 2*size+2);
+    if(pp->warp)
+    {
+        d64copy_warp_track_map(pp->warp, data, 2*size+2, count);
+    }
+    else
+    {
+        write_n(pp, data, 2*size+2);
+    }
     free(data);
                                                                         SETSTATEDEBUG((void)0);
     return 0;
 }
 
-static int read_gcr_block(unsigned char *se, unsigned char *gcrbuf)
+static int read_gcr_block(void *state, unsigned char *se, unsigned char *gcrbuf)
 {
+    pp_transfer_state *pp = state;
     unsigned char s[2];
+
+    if(pp->warp)
+    {
+        return d64copy_warp_track_read(pp->warp, pp->fd_cbm, opencbm_proto_pp_dc, se, gcrbuf);
+    }
                                                                         SETSTATEDEBUG((void)0);
-    read_n(s, 2);
+    read_n(pp, s, 2);
     *se = s[1];
                                                                         SETSTATEDEBUG((void)0);
-    read_n(s, 2);
+    read_n(pp, s, 2);
 
     if(s[1]) {
         return s[1];
     }
                                                                         SETSTATEDEBUG(DebugByteCount=0);
-    read_n(gcrbuf, GCRBUFSIZE);
+    read_n(pp, gcrbuf, GCRBUFSIZE);
                                                                         SETSTATEDEBUG(DebugByteCount=-1);
 
                                                                         SETSTATEDEBUG((void)0);
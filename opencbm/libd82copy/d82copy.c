@@ -71,10 +71,47 @@ static const int warp_write_interleave[] = { -1, 0,-1 };
 
 
 /*
- * Variables to make sure writing a block is an atomary process
+ * The destinations which are currently written to the file system,
+ * so d82copy_cleanup() can make sure writing a block is an atomary
+ * process. There is one entry for every copy running at the same time.
  */
-static int atom_mustcleanup = 0;
-static const transfer_funcs *atom_dst;
+#define MAX_ACTIVE_COPIES 32
+
+static struct
+{
+    const transfer_funcs *volatile dst;
+    void *volatile state;
+} active_copies[MAX_ACTIVE_COPIES];
+
+static int active_copy_add(const transfer_funcs *dst, void *state)
+{
+    int i;
+
+    arch_global_lock();
+    for(i = 0; i < MAX_ACTIVE_COPIES; i++)
+    {
+        if(active_copies[i].dst == NULL)
+        {
+            active_copies[i].state = state;
+            active_copies[i].dst = dst;
+            break;
+        }
+    }
+    arch_global_unlock();
+
+    return i < MAX_ACTIVE_COPIES ? i : -1;
+}
+
+static void active_copy_remove(int slot)
+{
+    if(slot >= 0)
+    {
+        arch_global_lock();
+        active_copies[slot].dst = NULL;
+        active_copies[slot].state = NULL;
+        arch_global_unlock();
+    }
+}
 
 
 #ifdef LIBD82COPY_DEBUG
@@ -100,15 +137,12 @@ static int send_turbo(CBM_FILE fd, unsigned char drv, int write, int warp, int d
     prog = &drive_progs[drv_type * 4 + warp * 2 + write];
 
     SETSTATEDEBUG((void)0);
-    return cbm_upload(fd, drv, 0x500, prog->prog, prog->size);
+    return cbm_upload_cached(fd, drv, 0x500, prog->prog, prog->size);
 }
 
 extern transfer_funcs d82copy_fs_transfer,
                       d82copy_std_transfer;
 
-static d82copy_message_cb message_cb;
-static d82copy_status_cb status_cb;
-
 int d82copy_sector_count(int two_sided, int track)
 {
     if(two_sided)
@@ -155,7 +189,8 @@ static int start_turbo(CBM_FILE fd, unsigned char drive)
     return cbm_exec_command(fd, drive, "U4:", 3);
 }
 
-void DumpBlock(unsigned char *buffer)
+#ifdef LIBD82COPY_DEBUG
+static void DumpBlock(unsigned char *buffer, d82copy_message_cb message_cb)
 {
 	char buf[128];
 	char buf2[6];
@@ -173,8 +208,10 @@ void DumpBlock(unsigned char *buffer)
 			message_cb(2, buf);
 	}
 }
+#endif
 
-int ReadBAM(d82copy_settings *settings, const transfer_funcs *src, unsigned char *buffer, int *bam_count)
+static int ReadBAM(d82copy_settings *settings, const transfer_funcs *src, void *src_state,
+                   unsigned char *buffer, int *bam_count, d82copy_message_cb message_cb)
 {
 	int cnt;
 	int st;
@@ -191,7 +228,7 @@ int ReadBAM(d82copy_settings *settings, const transfer_funcs *src, unsigned char
 	{
 		//message_cb(2, "reading sector: %d / %d", track, sector);
 
-		st = src->read_block(track, sector, buffer);
+		st = src->read_block(src_state, track, sector, buffer);
 		if (st) break;
 
 		//DumpBlock(buffer);
@@ -235,7 +272,8 @@ int ReadBAM(d82copy_settings *settings, const transfer_funcs *src, unsigned char
 
 static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
               const transfer_funcs *src, const void *src_arg,
-              const transfer_funcs *dst, const void *dst_arg, unsigned char cbm_drive)
+              const transfer_funcs *dst, const void *dst_arg, unsigned char cbm_drive,
+              d82copy_message_cb message_cb, d82copy_status_cb status_cb)
 {
     unsigned char tr = 0;
     unsigned char se = 0;
@@ -257,12 +295,15 @@ static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
     d82copy_status status;
     const char *sector_map;
     const char *type_str = "*unknown*";
+    void *src_state = NULL;
+    void *dst_state = NULL;
+    int active_slot = -1;
 
 
     if(settings->drive_type == cbm_dt_unknown )
     {
         message_cb( 2, "Trying to identify drive type" );
-        if( cbm_identify( fd_cbm, cbm_drive, &settings->drive_type, NULL ) )
+        if( cbm_bus_identify( fd_cbm, cbm_drive, &settings->drive_type, NULL ) )
         {
             message_cb( 0, "could not identify device" );
         }
@@ -408,7 +449,7 @@ static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
     }
 
     SETSTATEDEBUG((void)0);
-    if(src->open_disk(fd_cbm, settings, src_arg, 0,
+    if(src->open_disk(&src_state, fd_cbm, settings, src_arg, 0,
                       start_turbo, message_cb) == 0)
     {
         if(settings->end_track == -1)
@@ -417,12 +458,17 @@ static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
                 settings->two_sided ? D82_TRACKS : D80_TRACKS;
         }
         SETSTATEDEBUG((void)0);
-        if(dst->open_disk(fd_cbm, settings, dst_arg, 1,
+        if(dst->open_disk(&dst_state, fd_cbm, settings, dst_arg, 1,
                           start_turbo, message_cb) != 0)
         {
             message_cb(0, "can't open destination");
+            src->close_disk(src_state);
             return -1;
         }
+        if(!dst->is_cbm_drive)
+        {
+            active_slot = active_copy_add(dst, dst_state);
+        }
     }
     else
     {
@@ -434,7 +480,7 @@ static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
 
     if(settings->bam_mode != bm_ignore)
     {
-	st = ReadBAM(settings, src, bam, &bam_count);
+	st = ReadBAM(settings, src, src_state, bam, &bam_count, message_cb);
 	if(st)
 	{
 		message_cb(1, "failed to read BAM (%d), reading whole disk", st);
@@ -514,7 +560,7 @@ static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
                 if(scnt && settings->warp && src->is_cbm_drive)
                 {
                     SETSTATEDEBUG((void)0);
-                    src->send_track_map(tr, trackmap, scnt);
+                    src->send_track_map(src_state, tr, trackmap, scnt);
                 }
                 else
                 {
@@ -525,7 +571,7 @@ static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
                     /* if(settings->warp && src->is_cbm_drive)
                     {
                         SETSTATEDEBUG((void)0);
-                        status.read_result = src->read_gcr_block(&se, gcr);
+                        status.read_result = src->read_gcr_block(src_state, &se, gcr);
                         if(status.read_result == 0)
                         {
                             SETSTATEDEBUG((void)0);
@@ -554,7 +600,7 @@ static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
                             if(++se >= sector_map[tr]) se = 0;
                         }
                         SETSTATEDEBUG(debugLibD82BlockCount++);
-                        status.read_result = src->read_block(tr, se, block);
+                        status.read_result = src->read_block(src_state, tr, se, block);
                     }
 
                     /*if(settings->warp && dst->is_cbm_drive)
@@ -563,14 +609,14 @@ static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
                         gcr_encode(block, gcr);
                         SETSTATEDEBUG(debugLibD82BlockCount++);
                         status.write_result = 
-                            dst->write_block(tr, se, gcr, GCRBUFSIZE-1,
+                            dst->write_block(dst_state, tr, se, gcr, GCRBUFSIZE-1,
                                              status.read_result);
                     }
                     else  */
                     {
                         SETSTATEDEBUG(debugLibD82BlockCount++);
                         status.write_result = 
-                            dst->write_block(tr, se, block, BLOCKSIZE,
+                            dst->write_block(dst_state, tr, se, block, BLOCKSIZE,
                                              status.read_result);
                     }
                     SETSTATEDEBUG((void)0);
@@ -658,9 +704,10 @@ static int copy_disk(CBM_FILE fd_cbm, d82copy_settings *settings,
     }
     SETSTATEDEBUG(debugLibD82BlockCount=-1);
 
-    dst->close_disk();
+    active_copy_remove(active_slot);
+    dst->close_disk(dst_state);
     SETSTATEDEBUG((void)0);
-    src->close_disk();
+    src->close_disk(src_state);
 
     SETSTATEDEBUG((void)0);
     return cnt;
@@ -778,24 +825,14 @@ int d82copy_read_image(CBM_FILE cbm_fd,
 {
     const transfer_funcs *src;
     const transfer_funcs *dst;
-    int ret;
-
-    message_cb = msg_cb;
-    status_cb = stat_cb;
 
     src = transfers[settings->transfer_mode].trf;
     dst = &d82copy_fs_transfer;
 
-    atom_dst = dst;
-    atom_mustcleanup = 1;
-
     SETSTATEDEBUG((void)0);
-    ret = copy_disk(cbm_fd, settings,
-            src, (void*)(ULONG_PTR)src_drive, dst, (void*)dst_image, (unsigned char) src_drive);
-
-    atom_mustcleanup = 0;
-
-    return ret;
+    return copy_disk(cbm_fd, settings,
+            src, (void*)(ULONG_PTR)src_drive, dst, (void*)dst_image, (unsigned char) src_drive,
+            msg_cb, stat_cb);
 }
 
 int d82copy_write_image(CBM_FILE cbm_fd,
@@ -808,15 +845,13 @@ int d82copy_write_image(CBM_FILE cbm_fd,
     const transfer_funcs *src;
     const transfer_funcs *dst;
 
-    message_cb = msg_cb;
-    status_cb = stat_cb;
-
     src = &d82copy_fs_transfer;
     dst = transfers[settings->transfer_mode].trf;
 
     SETSTATEDEBUG((void)0);
     return copy_disk(cbm_fd, settings,
-            src, (void*)src_image, dst, (void*)(ULONG_PTR)dst_drive, (unsigned char) dst_drive);
+            src, (void*)src_image, dst, (void*)(ULONG_PTR)dst_drive, (unsigned char) dst_drive,
+            msg_cb, stat_cb);
 }
 
 void d82copy_cleanup(void)
@@ -825,9 +860,17 @@ void d82copy_cleanup(void)
      * write anything that has already been started
      */
 
-    if (atom_mustcleanup)
+    int i;
+    const transfer_funcs *dst;
+
+    /* no locking here, as this is called from the signal handler */
+    for (i = 0; i < MAX_ACTIVE_COPIES; i++)
     {
-        atom_dst->close_disk();
-        atom_mustcleanup = 0;
+        dst = active_copies[i].dst;
+        if (dst)
+        {
+            active_copies[i].dst = NULL;
+            dst->close_disk(active_copies[i].state);
+        }
     }
 }
@@ -20,77 +20,81 @@
 typedef long off_t ;
 #endif
 
-static d82copy_settings *fs_settings;
-
-static FILE *the_file;
-static char *error_map;
-static int block_count;
+typedef struct
+{
+    d82copy_settings *fs_settings;
 
+    FILE *the_file;
+    char *error_map;
+    int block_count;
 
+    /*
+     * Variables to make sure writing the block is an atomary process
+     */
+    volatile int atom_execute;
+    unsigned char atom_tr;
+    unsigned char atom_se;
+    const unsigned char *atom_blk;
+    int atom_size;
+    int atom_read_status;
+} fs_state;
 
 /* always use maximum size for error map */
 #define ERROR_MAP_LENGTH D82_BLOCKS
 
 
-static int block_offset(int tr, int se)
+static int block_offset(fs_state *fs, int tr, int se)
 {
     int sectors = 0, i;
     for(i = 1; i < tr; i++)
     {
-        sectors += d82copy_sector_count(fs_settings->two_sided, i);
+        sectors += d82copy_sector_count(fs->fs_settings->two_sided, i);
     }
     return (sectors + se) * BLOCKSIZE;
 }
 
-static int read_block(unsigned char tr, unsigned char se, unsigned char *block)
+static int read_block(void *state, unsigned char tr, unsigned char se, unsigned char *block)
 {
-    if(fseek(the_file, block_offset(tr, se), SEEK_SET) == 0)
+    fs_state *fs = state;
+
+    if(fseek(fs->the_file, block_offset(fs, tr, se), SEEK_SET) == 0)
     {
-        return fread(block, BLOCKSIZE, 1, the_file) != 1;
+        return fread(block, BLOCKSIZE, 1, fs->the_file) != 1;
     }
     return 1;
 }
 
-/*
- * Variables to make sure writing the block is an atomary process
- */
-static int atom_execute = 0;
-static unsigned char atom_tr;
-static unsigned char atom_se;
-static const unsigned char *atom_blk;
-static int atom_size;
-static int atom_read_status;
-
-static int write_block(unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
+static int write_block(void *state, unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
 {
+    fs_state *fs = state;
     long ofs;
     int ret;
 
-    atom_tr = tr;
-    atom_se = se;
-    atom_blk = blk;
-    atom_size = size;
-    atom_read_status = read_status;
+    fs->atom_tr = tr;
+    fs->atom_se = se;
+    fs->atom_blk = blk;
+    fs->atom_size = size;
+    fs->atom_read_status = read_status;
 
-    atom_execute = 1;
+    fs->atom_execute = 1;
 
-    ofs = block_offset(tr, se);
-    if(fseek(the_file, ofs, SEEK_SET) == 0)
+    ofs = block_offset(fs, tr, se);
+    if(fseek(fs->the_file, ofs, SEEK_SET) == 0)
     {
-        error_map[ofs / BLOCKSIZE] = (char) ((read_status == 0) ? 1 : read_status);
-        ret = fwrite(blk, size, 1, the_file) != 1;
+        fs->error_map[ofs / BLOCKSIZE] = (char) ((read_status == 0) ? 1 : read_status);
+        ret = fwrite(blk, size, 1, fs->the_file) != 1;
     }
     else
     {
         ret = 1;
     }
 
-    atom_execute = 0;
+    fs->atom_execute = 0;
 
     return ret;
 }
 
-static int open_disk(CBM_FILE fd, d82copy_settings *settings,
+static int open_disk(void **state, CBM_FILE fd, d82copy_settings *settings,
                      const void *arg, int for_writing,
                      turbo_start start, d82copy_message_cb message_cb)
 {
@@ -98,10 +102,18 @@ static int open_disk(CBM_FILE fd, d82copy_settings *settings,
     int stat_ok, is_image, error_info;
     int tr = 0;
     char *name = (char*)arg;
+    fs_state *fs;
+    FILE *the_file = NULL;
+    char *error_map = NULL;
+    int block_count = 0;
 
-    the_file = NULL;
-    fs_settings = settings;
-    block_count = 0;
+    fs = calloc(1, sizeof(*fs));
+    if(!fs)
+    {
+        message_cb(0, "no memory for transfer state");
+        return 1;
+    }
+    fs->fs_settings = settings;
 
     stat_ok = arch_filesize(name, &filesize) == 0;
     is_image = error_info = 0;
@@ -182,7 +194,7 @@ static int open_disk(CBM_FILE fd, d82copy_settings *settings,
     }
     else
     {
-        the_file = fopen(name, is_image ? "r+b" : "wb");
+        the_file = fopen(name, is_image ? "r+b" : "w+b");
         if(the_file)
         {
             /* check whether we must resize or create an image file */
@@ -210,6 +222,7 @@ static int open_disk(CBM_FILE fd, d82copy_settings *settings,
                 {
                     arch_unlink(name);
                 }
+                free(fs);
                 return 1;
             }
 
@@ -222,6 +235,8 @@ static int open_disk(CBM_FILE fd, d82copy_settings *settings,
                     {
                         message_cb(0, "%s: could not read error map", name);
                         fclose(the_file);
+                        free(error_map);
+                        free(fs);
                         return 1;
                     }
                 }
@@ -229,6 +244,8 @@ static int open_disk(CBM_FILE fd, d82copy_settings *settings,
                 {
                     message_cb(0, "%s: could not seek to end of file", name);
                     fclose(the_file);
+                    free(error_map);
+                    free(fs);
                     return 1;
                 }
             }
@@ -249,6 +266,8 @@ static int open_disk(CBM_FILE fd, d82copy_settings *settings,
                     fclose(the_file);
                     if(!is_image)
                         arch_unlink(name);
+                    free(error_map);
+                    free(fs);
                     return 1;
                 }
             }
@@ -258,26 +277,39 @@ static int open_disk(CBM_FILE fd, d82copy_settings *settings,
             message_cb(0, "could not open %s", name);
         }
     }
-    return the_file == NULL;
+
+    if(the_file == NULL)
+    {
+        free(fs);
+        return 1;
+    }
+
+    fs->the_file = the_file;
+    fs->error_map = error_map;
+    fs->block_count = block_count;
+
+    *state = fs;
+    return 0;
 }
 
-static void close_disk(void)
+static void close_disk(void *state)
 {
+    fs_state *fs = state;
     int i, has_errors = 0;
 
     /* if writing the block was interrupted, make sure it is
      * redone before closing the disk 
      */
 
-    if (the_file && atom_execute)
+    if (fs->the_file && fs->atom_execute)
     {
-        atom_execute = 0;
-        write_block(atom_tr, atom_se, atom_blk, atom_size, atom_read_status);
+        fs->atom_execute = 0;
+        write_block(fs, fs->atom_tr, fs->atom_se, fs->atom_blk, fs->atom_size, fs->atom_read_status);
     }
 
-    if (fs_settings)
+    if (fs->fs_settings)
     {
-        switch(fs_settings->error_mode)
+        switch(fs->fs_settings->error_mode)
         {
             case em_always:
                 has_errors = 1;
@@ -286,42 +318,41 @@ static void close_disk(void)
                 has_errors = 0;
                 break;
             default:
-                if(error_map)
+                if(fs->error_map)
                 {
-                    for(i = 0; !has_errors && i < block_count; i++)
+                    for(i = 0; !has_errors && i < fs->block_count; i++)
                     {
-                        has_errors = error_map[i] != 1;
+                        has_errors = fs->error_map[i] != 1;
                     }
                 }
                 break;
         }
     }
 
-    if(the_file)
+    if(fs->the_file)
     {
         if(has_errors)
         {
-            if(fseek(the_file, block_count * BLOCKSIZE, SEEK_SET) == 0)
+            if(fseek(fs->the_file, fs->block_count * BLOCKSIZE, SEEK_SET) == 0)
             {
-                fwrite(error_map, block_count, 1, the_file);
+                fwrite(fs->error_map, fs->block_count, 1, fs->the_file);
             }
         } 
         else
         {
-            arch_ftruncate(arch_fileno(the_file), block_count * BLOCKSIZE);
+            arch_ftruncate(arch_fileno(fs->the_file), fs->block_count * BLOCKSIZE);
         }
     }
 
-    if(error_map)
+    if(fs->error_map)
     {
-        free(error_map);
-        error_map = NULL;
+        free(fs->error_map);
     }
-    if(the_file)
+    if(fs->the_file)
     {
-        fclose(the_file);
-        the_file = NULL;
+        fclose(fs->the_file);
     }
+    free(fs);
 }
 
 DECLARE_TRANSFER_FUNCS(fs_transfer, 0, 0);
@@ -9,98 +9,54 @@
 
 #include "gcr.h"
 
+#include <string.h>
+
+/*
+ * A GCR data block consists of the data block identifier 0x07, the
+ * 256 data bytes, the checksum and two unused bytes; these 260 bytes
+ * are 325 GCR bytes. Both directions convert the whole block at once.
+ */
+#define GCR_PLAINSIZE   (BLOCKSIZE + 4)
+#define GCR_ENCODEDSIZE (GCR_PLAINSIZE / 4 * 5)
+
 int gcr_decode(unsigned const char *gcr, unsigned char *decoded)
 {
-    unsigned char chkref[4], chksum = 0;
-    int i,j;
+    unsigned char plain[GCR_PLAINSIZE], chksum = 0;
+    int i;
 
-    /* FIXME:
-     * Let's introduce buffer length specifiers and sanity checks,
-     * so the the following assumptions of length specifications
-     * of 4 and 5 become true.
-     */
-    gcr_5_to_4_decode(gcr, chkref, 5, sizeof(chkref));
-    gcr += 5;
+    gcr_decode_buffer(gcr, plain, GCR_ENCODEDSIZE, sizeof(plain));
 
-    if(chkref[0] != 0x07)
+    if(plain[0] != 0x07)
     {
         return 4;
     }
 
-        /* move over the remaining three bytes */
-    for(j = 1; j < 4; j++, decoded++)
+    for(i = 1; i <= BLOCKSIZE; i++)
     {
-        *decoded = chkref[j];
-        chksum  ^= chkref[j];
+        chksum ^= plain[i];
     }
+    memcpy(decoded, plain + 1, BLOCKSIZE);
 
-        /* main block processing loop */
-    for(i = 1; i < BLOCKSIZE/4; i++)
-    {
-        gcr_5_to_4_decode(gcr, decoded, 5, 4);
-        gcr += 5;
-
-        for(j = 0; j < 4; j++, decoded++)
-        {
-            chksum ^= *decoded;
-        }
-    }
-
-    gcr_5_to_4_decode(gcr, chkref, 5, 4);
-        /* move over the remaining last byte */
-    *decoded = chkref[0];
-    chksum  ^= chkref[0];
-
-    return (chkref[1] != chksum) ? 5 : 0;
+    return (plain[BLOCKSIZE + 1] != chksum) ? 5 : 0;
 }
 
 int gcr_encode(unsigned const char *block, unsigned char *encoded)
 {
+    unsigned char plain[GCR_PLAINSIZE], chksum = 0;
+    int i;
 
-    unsigned char chkref[4] = { 0x07, 0, 0, 0};
-    int i,j;
-
-    /* FIXME:
-     * Let's introduce buffer length specifiers and sanity checks,
-     * so the the following assumptions of length specifications
-     * of 4 and 5 become true.
-     */
-
-        /* start with encoding the data block
-         * identifier and the first three bytes
-         */
-    for(j = 1; j < 4; j++, block++)
-    {
-        chkref[j] = *block;
-    }
-       gcr_4_to_5_encode(chkref, encoded, sizeof(chkref), 5);
-       encoded += 5;
-
-        /* add the three bytes into one checksum */
-    chkref[1] ^= (chkref[2] ^ chkref[3]);
-
-        /* main block processing loop */
-    for(i = 1; i < BLOCKSIZE/4; i++)
+    plain[0] = 0x07;
+    for(i = 0; i < BLOCKSIZE; i++)
     {
-        gcr_4_to_5_encode(block, encoded, 4, 5);
-        encoded += 5;
-
-        for(j = 0; j < 4; j++, block++)
-        {
-                /* directly encode the checksum */
-            chkref[1] ^= *block;
-        }
+        chksum ^= block[i];
     }
-
-        /* move over the remaining last byte */
-    chkref[0]  = *block;
-        /* add the last byte to the checksum */
-    chkref[1] ^= *block;
+    memcpy(plain + 1, block, BLOCKSIZE);
+    plain[BLOCKSIZE + 1] = chksum;
 
     /* clear trailing unused bytes, not necessary but somehow nicer */
-    chkref[2] = chkref[3] = 0;
+    plain[BLOCKSIZE + 2] = plain[BLOCKSIZE + 3] = 0;
 
-    gcr_4_to_5_encode(chkref, encoded, 4, 5);
+    gcr_encode_buffer(plain, encoded, sizeof(plain), GCR_ENCODEDSIZE);
 
     return 0;
 }
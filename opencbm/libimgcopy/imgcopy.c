@@ -111,7 +111,8 @@ static const unsigned char warp_write_1571[] =
 //
 // debug function ...
 //
-void DumpBlock(unsigned char *buffer)
+#ifdef LIBIMGCOPY_DEBUG
+static void DumpBlock(unsigned char *buffer)
 {
 	char buf[128];
 	char buf2[6];
@@ -129,6 +130,7 @@ void DumpBlock(unsigned char *buffer)
 			printf("%s\n", buf);
 	}
 }
+#endif
 
 
 
@@ -161,10 +163,47 @@ static const int warp_write_interleave[] = { -1, 0,-1 };
 
 
 /*
- * Variables to make sure writing a block is an atomary process
+ * The destinations which are currently written to the file system,
+ * so imgcopy_cleanup() can make sure writing a block is an atomary
+ * process. There is one entry for every copy running at the same time.
  */
-static int atom_mustcleanup = 0;
-static const transfer_funcs *atom_dst;
+#define MAX_ACTIVE_COPIES 32
+
+static struct
+{
+    const transfer_funcs *volatile dst;
+    void *volatile state;
+} active_copies[MAX_ACTIVE_COPIES];
+
+static int active_copy_add(const transfer_funcs *dst, void *state)
+{
+	int i;
+
+	arch_global_lock();
+	for(i = 0; i < MAX_ACTIVE_COPIES; i++)
+	{
+		if(active_copies[i].dst == NULL)
+		{
+			active_copies[i].state = state;
+			active_copies[i].dst = dst;
+			break;
+		}
+	}
+	arch_global_unlock();
+
+	return i < MAX_ACTIVE_COPIES ? i : -1;
+}
+
+static void active_copy_remove(int slot)
+{
+	if(slot >= 0)
+	{
+		arch_global_lock();
+		active_copies[slot].dst = NULL;
+		active_copies[slot].state = NULL;
+		arch_global_unlock();
+	}
+}
 
 
 #ifdef LIBIMGCOPY_DEBUG
@@ -188,7 +227,8 @@ static const transfer_funcs *atom_dst;
 //
 // send drive code 
 //
-static int send_turbo(imgcopy_settings *settings, CBM_FILE fd, unsigned char drv, int write)
+static int send_turbo(imgcopy_settings *settings, CBM_FILE fd, unsigned char drv, int write,
+                      imgcopy_message_cb message_cb)
 {
 	//int warp, int drv_type :: settings->warp, settings->drive_type
 	const struct drive_prog *prog;
@@ -225,24 +265,22 @@ static int send_turbo(imgcopy_settings *settings, CBM_FILE fd, unsigned char drv
 
 	warp = settings->warp ? 1 : 0;
 	idx = drv_type * 4 + warp * 2 + write;
-	printf("uploading drivecode %d\n", idx);
+	message_cb(3, "uploading drivecode %d", idx);
 	prog = &drive_progs[idx];
 
-	return cbm_upload(fd, drv, 0x500, prog->prog, prog->size) != prog->size;
+	return cbm_upload_cached(fd, drv, 0x500, prog->prog, prog->size) != prog->size;
 }
 
 extern transfer_funcs imgcopy_fs_transfer,
                       imgcopy_std_transfer;
 
-static imgcopy_message_cb message_cb;
-static imgcopy_status_cb status_cb;
-
 
 
 //
 // calculate the image file type
 //
-static int imgcopy_set_image_type(imgcopy_settings *settings, const char *filename)
+static int imgcopy_set_image_type(imgcopy_settings *settings, const char *filename,
+                                  imgcopy_message_cb message_cb)
 {
 	int i;
 
@@ -547,7 +585,8 @@ static int start_turbo(CBM_FILE fd, unsigned char drive)
 //
 // read BAM of inserted disk
 //
-int ReadBAM_81(imgcopy_settings *settings, const transfer_funcs *src, unsigned char *buffer, int *bam_count)
+int ReadBAM_81(imgcopy_settings *settings, const transfer_funcs *src, void *src_state,
+               unsigned char *buffer, int *bam_count, imgcopy_message_cb message_cb)
 {
 	int cnt;
 	int st;
@@ -561,7 +600,7 @@ int ReadBAM_81(imgcopy_settings *settings, const transfer_funcs *src, unsigned c
 	while(1)
 	{
 		//message_cb(0, "reading BAM sector: %d / %d", track, sector);
-		st = src->read_block(track, sector, buffer);
+		st = src->read_block(src_state, track, sector, buffer);
 		if (st) break;
 
 		//DumpBlock(buffer);
@@ -590,7 +629,8 @@ int ReadBAM_81(imgcopy_settings *settings, const transfer_funcs *src, unsigned c
 //
 // read BAM of inserted disk
 //
-int ReadBAM_82(imgcopy_settings *settings, const transfer_funcs *src, unsigned char *buffer, int *bam_count)
+int ReadBAM_82(imgcopy_settings *settings, const transfer_funcs *src, void *src_state,
+               unsigned char *buffer, int *bam_count, imgcopy_message_cb message_cb)
 {
 	int cnt;
 	int st;
@@ -605,7 +645,7 @@ int ReadBAM_82(imgcopy_settings *settings, const transfer_funcs *src, unsigned c
 	{
 		message_cb(2, "reading sector: %d / %d", track, sector);
 
-		st = src->read_block(track, sector, buffer);
+		st = src->read_block(src_state, track, sector, buffer);
 		if (st) break;
 
 		//DumpBlock(buffer);
@@ -624,7 +664,7 @@ int ReadBAM_82(imgcopy_settings *settings, const transfer_funcs *src, unsigned c
 				{
 					message_cb(1, "only 2 BAM blocks? suppose a D80 formatted disk ...");
 					//settings->image_type = D80;
-					//imgcopy_set_image_type(settings, NULL);
+					//imgcopy_set_image_type(settings, NULL, message_cb);
 					st = 1;
 				}
 				break;
@@ -653,7 +693,8 @@ int ReadBAM_82(imgcopy_settings *settings, const transfer_funcs *src, unsigned c
 //
 // read BAM of inserted disk
 //
-int ReadBAM(imgcopy_settings *settings, const transfer_funcs *src, unsigned char *buffer, int *bam_count)
+static int ReadBAM(imgcopy_settings *settings, const transfer_funcs *src, void *src_state,
+                   unsigned char *buffer, int *bam_count, imgcopy_message_cb message_cb)
 {
 	message_cb(2, "reading BAM ...");
 				
@@ -662,10 +703,10 @@ int ReadBAM(imgcopy_settings *settings, const transfer_funcs *src, unsigned char
 	   case D80:
 	   case D82:
 		message_cb(2, "reading BAM of D82 ...");
-		return ReadBAM_82(settings, src, buffer, bam_count);
+		return ReadBAM_82(settings, src, src_state, buffer, bam_count, message_cb);
 
 	   case D81:
-		return ReadBAM_81(settings, src, buffer, bam_count);
+		return ReadBAM_81(settings, src, src_state, buffer, bam_count, message_cb);
 	}
 	return -1;
 }
@@ -675,7 +716,8 @@ int ReadBAM(imgcopy_settings *settings, const transfer_funcs *src, unsigned char
 
 static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
               const transfer_funcs *src, const void *src_arg,
-              const transfer_funcs *dst, const void *dst_arg, unsigned char cbm_drive)
+              const transfer_funcs *dst, const void *dst_arg, unsigned char cbm_drive,
+              imgcopy_message_cb message_cb, imgcopy_status_cb status_cb)
 {
 	unsigned char tr = 0;
 	unsigned char se = 0;
@@ -695,12 +737,15 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 	const transfer_funcs *cbm_transf = NULL;
 	imgcopy_status status;
 	const char *type_str = "*unknown*";
+	void *src_state = NULL;
+	void *dst_state = NULL;
+	int active_slot = -1;
 
 
 	if(settings->drive_type == cbm_dt_unknown )
 	{
 		message_cb( 2, "Trying to identify drive type" );
-		if( cbm_identify( fd_cbm, cbm_drive, &settings->drive_type, NULL ) )
+		if( cbm_bus_identify( fd_cbm, cbm_drive, &settings->drive_type, NULL ) )
 		{
 			message_cb( 0, "could not identify device" );
 		}
@@ -742,7 +787,7 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 			break;
 		}
 	}
-	if(imgcopy_set_image_type(settings, NULL))
+	if(imgcopy_set_image_type(settings, NULL, message_cb))
 	{
 		message_cb(0, "invalid imagetype for this drive type");
 		return -1;
@@ -822,7 +867,7 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 			if(settings->image_type == D82)
 			{
 				//settings->image_type = D80;
-				//imgcopy_set_image_type(settings, NULL);
+				//imgcopy_set_image_type(settings, NULL, message_cb);
 
 				message_cb(1, "maybe a 8050 disk in a 8250 drive");
 				cnt = 0;
@@ -901,7 +946,7 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 		message_cb(2, "sending turbo drive code ...");
 		SETSTATEDEBUG((void)0);
 //		send_turbo(fd_cbm, cbm_drive, dst->is_cbm_drive, settings->warp, settings->drive_type == cbm_dt_cbm1541 ? 0 : 1);
-		if((rc=send_turbo(settings, fd_cbm, cbm_drive, dst->is_cbm_drive)) != 0)
+		if((rc=send_turbo(settings, fd_cbm, cbm_drive, dst->is_cbm_drive, message_cb)) != 0)
 		{
 		    message_cb(0, "error while upload of drive code (rc=%d)", rc);
 		    return -1;
@@ -911,7 +956,7 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 
 	SETSTATEDEBUG((void)0);
 	message_cb(2, "open source disk.");
-	if(src->open_disk(fd_cbm, settings, src_arg, 0,
+	if(src->open_disk(&src_state, fd_cbm, settings, src_arg, 0,
 	                  start_turbo, message_cb) == 0)
 	{
 		if(settings->end_track == -1)
@@ -920,12 +965,17 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 		}
 		SETSTATEDEBUG((void)0);
 		message_cb(2, "open destination.");
-		if(dst->open_disk(fd_cbm, settings, dst_arg, 1,
+		if(dst->open_disk(&dst_state, fd_cbm, settings, dst_arg, 1,
 		                  start_turbo, message_cb) != 0)
 		{
 			message_cb(0, "can't open destination");
+			src->close_disk(src_state);
 			return -1;
 		}
+		if(!dst->is_cbm_drive)
+		{
+			active_slot = active_copy_add(dst, dst_state);
+		}
 	}
 	else
 	{
@@ -939,7 +989,7 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 	if(settings->bam_mode != bm_ignore)
 	{
 		//message_cb(2, "reading BAM ...");
-		st = ReadBAM(settings, src, bam, &bam_count);
+		st = ReadBAM(settings, src, src_state, bam, &bam_count, message_cb);
 		if(st)
 		{
 			message_cb(1, "failed to read BAM (%d), reading whole disk", st);
@@ -1031,7 +1081,7 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 				if(scnt > 0 && settings->warp && src->is_cbm_drive)
 				{
 				    SETSTATEDEBUG((void)0);
-				    src->send_track_map(settings, tr, trackmap, scnt);
+				    src->send_track_map(src_state, tr, trackmap, scnt);
 				}
 				else
 				{
@@ -1042,7 +1092,7 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 					/* if(settings->warp && src->is_cbm_drive)
 					{
 						SETSTATEDEBUG((void)0);
-						status.read_result = src->read_gcr_block(&se, gcr);
+						status.read_result = src->read_gcr_block(src_state, &se, gcr);
 						if(status.read_result == 0)
 						{
 						    SETSTATEDEBUG((void)0);
@@ -1076,7 +1126,7 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 						if(se_max-- <= 0)	break;
 
 						SETSTATEDEBUG(debugLibImgBlockCount++);
-						status.read_result = src->read_block(tr, se, block);
+						status.read_result = src->read_block(src_state, tr, se, block);
 					}
 
 					/*if(settings->warp && dst->is_cbm_drive)
@@ -1085,14 +1135,14 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 					    gcr_encode(block, gcr);
 					    SETSTATEDEBUG(debugLibImgBlockCount++);
 					    status.write_result = 
-					        dst->write_block(tr, se, gcr, GCRBUFSIZE-1,
+					        dst->write_block(dst_state, tr, se, gcr, GCRBUFSIZE-1,
 					                         status.read_result);
 					}
 					else  */
 					{
 					    SETSTATEDEBUG(debugLibImgBlockCount++);
 					    status.write_result = 
-					        dst->write_block(tr, se, block, BLOCKSIZE,
+					        dst->write_block(dst_state, tr, se, block, BLOCKSIZE,
 					                         status.read_result);
 					}
 					SETSTATEDEBUG((void)0);
@@ -1188,9 +1238,10 @@ static int copy_disk(CBM_FILE fd_cbm, imgcopy_settings *settings,
 	SETSTATEDEBUG(debugLibImgBlockCount=-1);
 
 
-	dst->close_disk();
+	active_copy_remove(active_slot);
+	dst->close_disk(dst_state);
 	SETSTATEDEBUG((void)0);
-	src->close_disk();
+	src->close_disk(src_state);
 
 	SETSTATEDEBUG((void)0);
 	return cnt;
@@ -1336,26 +1387,16 @@ int imgcopy_read_image(CBM_FILE cbm_fd,
 {
 	const transfer_funcs *src;
 	const transfer_funcs *dst;
-	int ret;
-
-	message_cb = msg_cb;
-	status_cb = stat_cb;
 
 	src = transfers[settings->transfer_mode].trf;
 	dst = &imgcopy_fs_transfer;
 
-	atom_dst = dst;
-	atom_mustcleanup = 1;
-
-	imgcopy_set_image_type(settings, dst_image);
+	imgcopy_set_image_type(settings, dst_image, msg_cb);
 
 	SETSTATEDEBUG((void)0);
-	ret = copy_disk(cbm_fd, settings,
-	        src, (void*)(ULONG_PTR)src_drive, dst, (void*)dst_image, (unsigned char) src_drive);
-
-	atom_mustcleanup = 0;
-
-	return ret;
+	return copy_disk(cbm_fd, settings,
+	        src, (void*)(ULONG_PTR)src_drive, dst, (void*)dst_image, (unsigned char) src_drive,
+	        msg_cb, stat_cb);
 }
 
 
@@ -1373,17 +1414,15 @@ int imgcopy_write_image(CBM_FILE cbm_fd,
 	const transfer_funcs *src;
 	const transfer_funcs *dst;
 
-	message_cb = msg_cb;
-	status_cb = stat_cb;
-
 	src = &imgcopy_fs_transfer;
 	dst = transfers[settings->transfer_mode].trf;
 
-	imgcopy_set_image_type(settings, src_image);
+	imgcopy_set_image_type(settings, src_image, msg_cb);
 
 	SETSTATEDEBUG((void)0);
 	return copy_disk(cbm_fd, settings,
-	        src, (void*)src_image, dst, (void*)(ULONG_PTR)dst_drive, (unsigned char) dst_drive);
+	        src, (void*)src_image, dst, (void*)(ULONG_PTR)dst_drive, (unsigned char) dst_drive,
+	        msg_cb, stat_cb);
 }
 
 void imgcopy_cleanup(void)
@@ -1392,9 +1431,17 @@ void imgcopy_cleanup(void)
      * write anything that has already been started
      */
 
-    if (atom_mustcleanup)
+    int i;
+    const transfer_funcs *dst;
+
+    /* no locking here, as this is called from the signal handler */
+    for (i = 0; i < MAX_ACTIVE_COPIES; i++)
     {
-        atom_dst->close_disk();
-        atom_mustcleanup = 0;
+        dst = active_copies[i].dst;
+        if (dst)
+        {
+            active_copies[i].dst = NULL;
+            dst->close_disk(active_copies[i].state);
+        }
     }
 }
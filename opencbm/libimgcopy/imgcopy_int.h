@@ -106,18 +106,30 @@
 
 typedef int(*turbo_start)(CBM_FILE,unsigned char);
 
+/*
+ * All state of an opened transfer lives in the object open_disk() returns
+ * in its first parameter, which is given to all the other functions, so
+ * several copies can run at the same time on different handles.
+ */
 typedef struct {
-    int  (*open_disk)(CBM_FILE,imgcopy_settings*,const void*,int,
+    int  (*open_disk)(void**,CBM_FILE,imgcopy_settings*,const void*,int,
                       turbo_start,imgcopy_message_cb);
-    int  (*read_block)(unsigned char,unsigned char,unsigned char*);
-    int  (*write_block)(unsigned char,unsigned char,const unsigned char*,int,int);
-    void (*close_disk)(void);
+    int  (*read_block)(void*,unsigned char,unsigned char,unsigned char*);
+    int  (*write_block)(void*,unsigned char,unsigned char,const unsigned char*,int,int);
+    void (*close_disk)(void*);
     int  is_cbm_drive;
     int  needs_turbo;
-    int  (*send_track_map)(imgcopy_settings*,unsigned char,const char*,unsigned char);
-    int  (*read_gcr_block)(unsigned char*,unsigned char*);
+    int  (*send_track_map)(void*,unsigned char,const char*,unsigned char);
+    int  (*read_gcr_block)(void*,unsigned char*,unsigned char*);
 } transfer_funcs;
 
+/* transfer state of the drive transfers */
+typedef struct {
+    CBM_FILE fd_cbm;
+    unsigned char drive;
+    imgcopy_settings *settings;
+} cbm_transfer_state;
+
 
 
 
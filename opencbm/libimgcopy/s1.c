@@ -17,6 +17,10 @@
 
 #include "opencbm-plugin.h"
 
+/*
+ * The plugin functions are the same for every handle, thus, they can be
+ * shared by all transfers
+ */
 static opencbm_plugin_s1_read_n_t * opencbm_plugin_s1_read_n = NULL;
 
 static opencbm_plugin_s1_write_n_t * opencbm_plugin_s1_write_n = NULL;
@@ -35,8 +39,6 @@ static const unsigned char s1_drive_prog_1581[] = {
 
 
 
-static CBM_FILE fd_cbm;
-static int two_sided;
 
 static int s1_write_byte_nohs(CBM_FILE fd, unsigned char c)
 {
@@ -95,7 +97,7 @@ static int s1_write_byte(CBM_FILE fd, unsigned char c)
 }
 
 /* write_n redirects USB writes to the external reader if required */
-static void write_n(const unsigned char *data, int size) 
+static void write_n(CBM_FILE fd_cbm, const unsigned char *data, int size) 
 {
     int i;
 
@@ -149,7 +151,7 @@ static int s1_read_byte(CBM_FILE fd, unsigned char *c)
 }
 
 /* read_n redirects USB reads to the external reader if required */
-static void read_n(unsigned char *data, int size) 
+static void read_n(CBM_FILE fd_cbm, unsigned char *data, int size) 
 {
     int i;
 
@@ -163,40 +165,42 @@ static void read_n(unsigned char *data, int size)
 	s1_read_byte(fd_cbm, data++);
 }
 
-static int read_block(unsigned char tr, unsigned char se, unsigned char *block)
+static int read_block(void *state, unsigned char tr, unsigned char se, unsigned char *block)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char status;
 
                                                                         SETSTATEDEBUG((void)0);
-    write_n(&tr, 1);
+    write_n(fd_cbm, &tr, 1);
                                                                         SETSTATEDEBUG((void)0);
-    write_n(&se, 1);
+    write_n(fd_cbm, &se, 1);
                                                                         SETSTATEDEBUG((void)0);
 #ifndef USE_CBM_IEC_WAIT    
     arch_usleep(20000);
 #endif    
                                                                         SETSTATEDEBUG((void)0);
-    read_n(&status, 1);
+    read_n(fd_cbm, &status, 1);
                                                                         SETSTATEDEBUG(DebugByteCount=0);
     // removed from loop: SETSTATEDEBUG(DebugByteCount++);
-    read_n(block, 256);
+    read_n(fd_cbm, block, 256);
                                                                         SETSTATEDEBUG(DebugByteCount=-1);
     cbm_iec_release(fd_cbm, IEC_DATA);
                                                                         SETSTATEDEBUG((void)0);
     return status;
 }
 
-static int write_block(unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
+static int write_block(void *state, unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char status;
                                                                         SETSTATEDEBUG((void)0);
-    write_n(&tr, 1);
+    write_n(fd_cbm, &tr, 1);
                                                                         SETSTATEDEBUG((void)0);
-    write_n(&se, 1);
+    write_n(fd_cbm, &se, 1);
                                                                         SETSTATEDEBUG(DebugByteCount=0);
 
     // removed from loop: SETSTATEDEBUG(DebugByteCount++);
-    write_n(blk, size);
+    write_n(fd_cbm, blk, size);
                                                                         SETSTATEDEBUG(DebugByteCount=-1);
 #ifndef USE_CBM_IEC_WAIT    
     if(size == BLOCKSIZE) {
@@ -205,7 +209,7 @@ static int write_block(unsigned char tr, unsigned char se, const unsigned char *
     }
 #endif    
                                                                         SETSTATEDEBUG((void)0);
-    read_n(&status, 1);
+    read_n(fd_cbm, &status, 1);
                                                                         SETSTATEDEBUG((void)0);
     cbm_iec_release(fd_cbm, IEC_DATA);
                                                                         SETSTATEDEBUG((void)0);
@@ -213,14 +217,23 @@ static int write_block(unsigned char tr, unsigned char se, const unsigned char *
     return status;
 }
 
-static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
+static int open_disk(void **state, CBM_FILE fd, imgcopy_settings *settings,
                      const void *arg, int for_writing,
                      turbo_start start, imgcopy_message_cb message_cb)
 {
     unsigned char d = (unsigned char)(ULONG_PTR)arg;
+    cbm_transfer_state *cbm;
+    CBM_FILE fd_cbm = fd;
 
-    fd_cbm = fd;
-    two_sided = settings->two_sided;
+    cbm = malloc(sizeof(*cbm));
+    if(cbm == NULL)
+    {
+        message_cb(0, "no memory for transfer state");
+        return 1;
+    }
+    cbm->fd_cbm = fd;
+    cbm->drive = d;
+    cbm->settings = settings;
 
     opencbm_plugin_s1_read_n = cbm_get_plugin_function_address("opencbm_plugin_s1_read_n");
 
@@ -232,11 +245,11 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
 	   case cbm_dt_cbm1541:
 	   case cbm_dt_cbm1570:
 	   case cbm_dt_cbm1571:
-		cbm_upload(fd_cbm, d, 0x700, s1_drive_prog_1541, sizeof(s1_drive_prog_1541));
+		cbm_upload_cached(fd_cbm, d, 0x700, s1_drive_prog_1541, sizeof(s1_drive_prog_1541));
 		break;
 
 	   case cbm_dt_cbm1581:
-		cbm_upload(fd_cbm, d, 0x700, s1_drive_prog_1581, sizeof(s1_drive_prog_1581));
+		cbm_upload_cached(fd_cbm, d, 0x700, s1_drive_prog_1581, sizeof(s1_drive_prog_1581));
 		break;
 
            case cbm_dt_cbm2040:
@@ -250,6 +263,7 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
 	   case cbm_dt_unknown:
 	   default:
 		// drive type not allowed
+		free(cbm);
 		return -1;
 	}
                                                                         SETSTATEDEBUG((void)0);
@@ -257,11 +271,13 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
                                                                         SETSTATEDEBUG((void)0);
     while(!cbm_iec_get(fd_cbm, IEC_DATA));
                                                                         SETSTATEDEBUG((void)0);
+    *state = cbm;
     return 0;
 }
 
-static void close_disk(void)
+static void close_disk(void *state)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
                                                                         SETSTATEDEBUG((void)0);
     s1_write_byte(fd_cbm, 0);
                                                                         SETSTATEDEBUG((void)0);
@@ -270,17 +286,17 @@ static void close_disk(void)
     arch_usleep(100);
                                                                         SETSTATEDEBUG(DebugBitCount=-1);
 
-    opencbm_plugin_s1_read_n = NULL;
-
-    opencbm_plugin_s1_write_n = NULL;
+    free(state);
 }
 
-static int send_track_map(imgcopy_settings *settings, unsigned char tr, const char *trackmap, unsigned char count)
+static int send_track_map(void *state, unsigned char tr, const char *trackmap, unsigned char count)
 {
+    cbm_transfer_state *cbm = state;
+    CBM_FILE fd_cbm = cbm->fd_cbm;
     int i, size;
     unsigned char *data;
                                                                         SETSTATEDEBUG((void)0);
-    size = imgcopy_sector_count(settings, tr);
+    size = imgcopy_sector_count(cbm->settings, tr);
     data = malloc(size+2);
 
     data[0] = tr;
@@ -290,21 +306,22 @@ static int send_track_map(imgcopy_settings *settings, unsigned char tr, const ch
     for(i = 0; i < size; i++)
 	data[2+i] = !NEED_SECTOR(trackmap[i]);
                                                                         SETSTATEDEBUG((void)0);
-    write_n(data, size+2);
+    write_n(fd_cbm, data, size+2);
     free(data);
                                                                         SETSTATEDEBUG((void)0);
     return 0;
 }
 
-static int read_gcr_block(unsigned char *se, unsigned char *gcrbuf)
+static int read_gcr_block(void *state, unsigned char *se, unsigned char *gcrbuf)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char s;
 
                                                                         SETSTATEDEBUG((void)0);
-    read_n(&s, 1);
+    read_n(fd_cbm, &s, 1);
                                                                         SETSTATEDEBUG((void)0);
     *se = s;
-    read_n(&s, 1);
+    read_n(fd_cbm, &s, 1);
                                                                         SETSTATEDEBUG((void)0);
 
     if(s) {
@@ -312,7 +329,7 @@ static int read_gcr_block(unsigned char *se, unsigned char *gcrbuf)
     }
 
                                                                         SETSTATEDEBUG(DebugByteCount=0);
-    read_n(gcrbuf, GCRBUFSIZE);
+    read_n(fd_cbm, gcrbuf, GCRBUFSIZE);
                                                                         SETSTATEDEBUG(DebugByteCount=-1);
     return 0;
 }
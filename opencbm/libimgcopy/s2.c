@@ -17,6 +17,10 @@
 
 #include "opencbm-plugin.h"
 
+/*
+ * The plugin functions are the same for every handle, thus, they can be
+ * shared by all transfers
+ */
 static opencbm_plugin_s2_read_n_t * opencbm_plugin_s2_read_n = NULL;
 
 static opencbm_plugin_s2_write_n_t * opencbm_plugin_s2_write_n = NULL;
@@ -34,8 +38,6 @@ static const unsigned char s2_drive_prog_1581[] = {
 
 
 
-static CBM_FILE fd_cbm;
-static int two_sided;
 
 static int s2_read_byte(CBM_FILE fd, unsigned char *c)
 {
@@ -99,7 +101,7 @@ static int s2_write_byte_nohs(CBM_FILE fd, unsigned char c)
 }
 
 /* read_n redirects USB reads to the external reader if required */
-static void read_n(unsigned char *data, int size) 
+static void read_n(CBM_FILE fd_cbm, unsigned char *data, int size) 
 {
     int i;
 
@@ -130,7 +132,7 @@ static int s2_write_byte(CBM_FILE fd, unsigned char c)
 }
 
 /* write_n redirects USB writes to the external reader if required */
-static void write_n(const unsigned char *data, int size) 
+static void write_n(CBM_FILE fd_cbm, const unsigned char *data, int size) 
 {
     int i;
 
@@ -144,35 +146,37 @@ static void write_n(const unsigned char *data, int size)
     s2_write_byte(fd_cbm, *data++);
 }
 
-static int read_block(unsigned char tr, unsigned char se, unsigned char *block)
+static int read_block(void *state, unsigned char tr, unsigned char se, unsigned char *block)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char status;
 
                                                                         SETSTATEDEBUG((void)0);
-    write_n(&tr, 1);
+    write_n(fd_cbm, &tr, 1);
                                                                         SETSTATEDEBUG((void)0);
-    write_n(&se, 1);
+    write_n(fd_cbm, &se, 1);
 #ifndef USE_CBM_IEC_WAIT
     arch_usleep(20000);
 #endif
                                                                         SETSTATEDEBUG((void)0);
-    read_n(&status, 1);
+    read_n(fd_cbm, &status, 1);
                                                                         SETSTATEDEBUG(DebugByteCount=0);
-    read_n(block, BLOCKSIZE);
+    read_n(fd_cbm, block, BLOCKSIZE);
                                                                         SETSTATEDEBUG(DebugByteCount=-1);
 
     return status;
 }
 
-static int write_block(unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
+static int write_block(void *state, unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char status;
                                                                         SETSTATEDEBUG((void)0);
-    write_n(&tr, 1);
+    write_n(fd_cbm, &tr, 1);
                                                                         SETSTATEDEBUG((void)0);
-    write_n(&se, 1);
+    write_n(fd_cbm, &se, 1);
                                                                         SETSTATEDEBUG(DebugByteCount=0);
-    write_n(blk, size);
+    write_n(fd_cbm, blk, size);
                                                                         SETSTATEDEBUG(DebugByteCount=-1);
 #ifndef USE_CBM_IEC_WAIT
     if(size == BLOCKSIZE) {
@@ -180,19 +184,28 @@ static int write_block(unsigned char tr, unsigned char se, const unsigned char *
     }
 #endif
                                                                         SETSTATEDEBUG((void)0);
-    read_n(&status, 1);
+    read_n(fd_cbm, &status, 1);
                                                                         SETSTATEDEBUG((void)0);
     return status;
 }
 
-static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
+static int open_disk(void **state, CBM_FILE fd, imgcopy_settings *settings,
                      const void *arg, int for_writing,
                      turbo_start start, imgcopy_message_cb message_cb)
 {
     unsigned char d = (unsigned char)(ULONG_PTR)arg;
+    cbm_transfer_state *cbm;
+    CBM_FILE fd_cbm = fd;
 
-    fd_cbm = fd;
-    two_sided = settings->two_sided;
+    cbm = malloc(sizeof(*cbm));
+    if(cbm == NULL)
+    {
+        message_cb(0, "no memory for transfer state");
+        return 1;
+    }
+    cbm->fd_cbm = fd;
+    cbm->drive = d;
+    cbm->settings = settings;
 
     opencbm_plugin_s2_read_n = cbm_get_plugin_function_address("opencbm_plugin_s2_read_n");
 
@@ -204,11 +217,11 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
        case cbm_dt_cbm1541:
        case cbm_dt_cbm1570:
        case cbm_dt_cbm1571:
-        cbm_upload(fd_cbm, d, 0x700, s2_drive_prog_1541, sizeof(s2_drive_prog_1541));
+        cbm_upload_cached(fd_cbm, d, 0x700, s2_drive_prog_1541, sizeof(s2_drive_prog_1541));
         break;
 
        case cbm_dt_cbm1581:
-        cbm_upload(fd_cbm, d, 0x700, s2_drive_prog_1581, sizeof(s2_drive_prog_1581));
+        cbm_upload_cached(fd_cbm, d, 0x700, s2_drive_prog_1581, sizeof(s2_drive_prog_1581));
         break;
 
        case cbm_dt_cbm2040:
@@ -222,6 +235,7 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
        case cbm_dt_unknown:
        default:
         // drive type not allowed
+        free(cbm);
         return -1;
     }
                                                                         SETSTATEDEBUG((void)0);
@@ -235,11 +249,13 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
     arch_usleep(20000);
     
                                                                         SETSTATEDEBUG((void)0);
+    *state = cbm;
     return 0;
 }
 
-static void close_disk(void)
+static void close_disk(void *state)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
                                                                         SETSTATEDEBUG((void)0);
     s2_write_byte(fd_cbm, 0);
                                                                         SETSTATEDEBUG((void)0);
@@ -253,19 +269,19 @@ static void close_disk(void)
     cbm_iec_set(fd_cbm, IEC_CLOCK);
                                                                         SETSTATEDEBUG((void)0);
 
-    opencbm_plugin_s2_read_n = NULL;
-
-    opencbm_plugin_s2_write_n = NULL;
+    free(state);
 }
 
-static int send_track_map(imgcopy_settings *settings, unsigned char tr, const char *trackmap, unsigned char count)
+static int send_track_map(void *state, unsigned char tr, const char *trackmap, unsigned char count)
 {
+    cbm_transfer_state *cbm = state;
+    CBM_FILE fd_cbm = cbm->fd_cbm;
     int i;
     int size;
     unsigned char *data;
 
                                                                         SETSTATEDEBUG((void)0);
-    size = imgcopy_sector_count(settings, tr);
+    size = imgcopy_sector_count(cbm->settings, tr);
     data = malloc(2+size);
 
     data[0] = tr;
@@ -275,27 +291,28 @@ static int send_track_map(imgcopy_settings *settings, unsigned char tr, const ch
     for(i = 0; i < size; i++)
         data[2+i] = !NEED_SECTOR(trackmap[i]);
     
-    write_n(data, size+2);
+    write_n(fd_cbm, data, size+2);
     free(data);
                                                                         SETSTATEDEBUG((void)0);
     return 0;
 }
 
-static int read_gcr_block(unsigned char *se, unsigned char *gcrbuf)
+static int read_gcr_block(void *state, unsigned char *se, unsigned char *gcrbuf)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char s;
 
                                                                         SETSTATEDEBUG((void)0);
-    read_n(&s, 1);
+    read_n(fd_cbm, &s, 1);
     *se = s;
                                                                         SETSTATEDEBUG((void)0);
-    read_n(&s, 1);
+    read_n(fd_cbm, &s, 1);
 
     if(s) {
         return s;
     }
                                                                         SETSTATEDEBUG(DebugByteCount=0);
-    read_n(gcrbuf, GCRBUFSIZE);
+    read_n(fd_cbm, gcrbuf, GCRBUFSIZE);
                                                                         SETSTATEDEBUG(DebugByteCount=-1);
     return 0;
 }
@@ -18,6 +18,10 @@
 
 #include "opencbm-plugin.h"
 
+/*
+ * The plugin functions are the same for every handle, thus, they can be
+ * shared by all transfers
+ */
 static opencbm_plugin_s3_read_n_t * opencbm_plugin_s3_read_n = NULL;
 
 static opencbm_plugin_s3_write_n_t * opencbm_plugin_s3_write_n = NULL;
@@ -32,8 +36,6 @@ static const unsigned char s3_drive_prog_1581[] = {
 #include "s3-1581.inc"
 };
 
-static CBM_FILE fd_cbm;
-static int two_sided;
 
 //#define DEBUG
 
@@ -56,7 +58,7 @@ static int s3_write_byte(CBM_FILE fd, unsigned char c)
 */
 
 /* write_n redirects USB writes to the external reader if required */
-static void write_n(const unsigned char *data, int size)
+static void write_n(CBM_FILE fd_cbm, const unsigned char *data, int size)
 {
     if (opencbm_plugin_s3_write_n)
     {
@@ -73,7 +75,7 @@ static void write_n(const unsigned char *data, int size)
 }
 
 /* read_n redirects USB reads to the external reader if required */
-static void read_n(unsigned char *data, int size)
+static void read_n(CBM_FILE fd_cbm, unsigned char *data, int size)
 {
     if (opencbm_plugin_s3_read_n)
     {
@@ -88,8 +90,9 @@ static void read_n(unsigned char *data, int size)
 #endif
 }
 
-static int read_block(unsigned char tr, unsigned char se, unsigned char *block)
+static int read_block(void *state, unsigned char tr, unsigned char se, unsigned char *block)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char status;
     unsigned char buf[2];
 
@@ -99,43 +102,53 @@ static int read_block(unsigned char tr, unsigned char se, unsigned char *block)
 
     buf[0] = tr;
     buf[1] = se;
-    write_n(buf, 2);
+    write_n(fd_cbm, buf, 2);
 
-    read_n(&status, 1);
+    read_n(fd_cbm, &status, 1);
     printf("s3_read_block() :: status=%d \n", status);
 
-    read_n(block, 256);
+    read_n(fd_cbm, block, 256);
     return status;
 }
 
-static int write_block(unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
+static int write_block(void *state, unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char status;
 
 #ifdef DEBUG
     printf("s3_write_block() :: track=%d, sector=%d \n", tr, se);
 #endif
-    write_n(&tr, 1);
-    write_n(&se, 1);
+    write_n(fd_cbm, &tr, 1);
+    write_n(fd_cbm, &se, 1);
 
-    write_n(blk, size);
-    read_n(&status, 1);
+    write_n(fd_cbm, blk, size);
+    read_n(fd_cbm, &status, 1);
 
     return status;
 }
 
-static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
+static int open_disk(void **state, CBM_FILE fd, imgcopy_settings *settings,
                      const void *arg, int for_writing,
                      turbo_start start, imgcopy_message_cb message_cb)
 {
     unsigned char d = (unsigned char)(ULONG_PTR)arg;
+    cbm_transfer_state *cbm;
+    CBM_FILE fd_cbm = fd;
 
 #ifdef DEBUG
     printf("s3_open_disk() \n");
 #endif
 
-    fd_cbm = fd;
-    two_sided = settings->two_sided;
+    cbm = malloc(sizeof(*cbm));
+    if(cbm == NULL)
+    {
+        message_cb(0, "no memory for transfer state");
+        return 1;
+    }
+    cbm->fd_cbm = fd;
+    cbm->drive = d;
+    cbm->settings = settings;
 
     opencbm_plugin_s3_read_n = cbm_get_plugin_function_address("opencbm_plugin_s3_read_n");
     opencbm_plugin_s3_write_n = cbm_get_plugin_function_address("opencbm_plugin_s3_write_n");
@@ -145,11 +158,11 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
         case cbm_dt_cbm1541:
         case cbm_dt_cbm1570:
         case cbm_dt_cbm1571:
-            cbm_upload(fd_cbm, d, 0x700, s3_drive_prog_1541, sizeof(s3_drive_prog_1541));
+            cbm_upload_cached(fd_cbm, d, 0x700, s3_drive_prog_1541, sizeof(s3_drive_prog_1541));
             break;
 
         case cbm_dt_cbm1581:
-            cbm_upload(fd_cbm, d, 0x700, s3_drive_prog_1581, sizeof(s3_drive_prog_1581));
+            cbm_upload_cached(fd_cbm, d, 0x700, s3_drive_prog_1581, sizeof(s3_drive_prog_1581));
             break;
 
         case cbm_dt_cbm2040:
@@ -163,6 +176,7 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
         case cbm_dt_unknown:
         default:
             // drive type not allowed
+            free(cbm);
             return -1;
     }
     start(fd, d);
@@ -171,11 +185,13 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
     cbm_iec_release(fd, IEC_CLOCK);
     arch_usleep(300);
 
+    *state = cbm;
     return 0;
 }
 
-static void close_disk(void)
+static void close_disk(void *state)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char buf[2];
 
 #ifdef DEBUG
@@ -184,14 +200,15 @@ static void close_disk(void)
 
     buf[0] = 0;
     buf[1] = 0;
-    write_n(buf, 2);
+    write_n(fd_cbm, buf, 2);
 
-    opencbm_plugin_s3_read_n = NULL;
-    opencbm_plugin_s3_write_n = NULL;
+    free(state);
 }
 
-static int send_track_map(imgcopy_settings *settings, unsigned char tr, const char *trackmap, unsigned char count)
+static int send_track_map(void *state, unsigned char tr, const char *trackmap, unsigned char count)
 {
+    cbm_transfer_state *cbm = state;
+    CBM_FILE fd_cbm = cbm->fd_cbm;
     int i, size;
     unsigned char *data;
 
@@ -199,7 +216,7 @@ static int send_track_map(imgcopy_settings *settings, unsigned char tr, const ch
     printf("s3_send_trackmap() \n");
 #endif
 
-    size = imgcopy_sector_count(settings, tr);
+    size = imgcopy_sector_count(cbm->settings, tr);
     data = malloc(size+2);
 
     data[0] = tr;
@@ -209,28 +226,29 @@ static int send_track_map(imgcopy_settings *settings, unsigned char tr, const ch
     for(i = 0; i < size; i++)
     data[2+i] = !NEED_SECTOR(trackmap[i]);
 
-    write_n(data, size+2);
+    write_n(fd_cbm, data, size+2);
     free(data);
     return 0;
 }
 
-static int read_gcr_block(unsigned char *se, unsigned char *gcrbuf)
+static int read_gcr_block(void *state, unsigned char *se, unsigned char *gcrbuf)
 {
+    CBM_FILE fd_cbm = ((cbm_transfer_state *)state)->fd_cbm;
     unsigned char s;
 
 #ifdef DEBUG
     printf("s3_read_gcr_block() \n");
 #endif
 
-    read_n(&s, 1);
+    read_n(fd_cbm, &s, 1);
     *se = s;
-    read_n(&s, 1);
+    read_n(fd_cbm, &s, 1);
 
     if(s) {
         return s;
     }
 
-    read_n(gcrbuf, GCRBUFSIZE);
+    read_n(fd_cbm, gcrbuf, GCRBUFSIZE);
     return 0;
 }
 
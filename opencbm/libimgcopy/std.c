@@ -14,11 +14,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-static unsigned char drive = 0;
-static CBM_FILE fd_cbm = (CBM_FILE) -1;
-
-static int read_block(unsigned char tr, unsigned char se, unsigned char *block)
+static int read_block(void *state, unsigned char tr, unsigned char se, unsigned char *block)
 {
+    cbm_transfer_state *cbm = state;
+    CBM_FILE fd_cbm = cbm->fd_cbm;
+    unsigned char drive = cbm->drive;
     char cmd[48];
     int rv = 1;
 
@@ -39,8 +39,11 @@ static int read_block(unsigned char tr, unsigned char se, unsigned char *block)
     return rv;
 }
 
-static int write_block(unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
+static int write_block(void *state, unsigned char tr, unsigned char se, const unsigned char *blk, int size, int read_status)
 {
+    cbm_transfer_state *cbm = state;
+    CBM_FILE fd_cbm = cbm->fd_cbm;
+    unsigned char drive = cbm->drive;
     char cmd[48];
     int  rv = 1;
 
@@ -63,12 +66,15 @@ static int write_block(unsigned char tr, unsigned char se, const unsigned char *
     return rv;
 }
 
-static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
+static int open_disk(void **state, CBM_FILE fd, imgcopy_settings *settings,
                      const void *arg, int for_writing,
                      turbo_start start, imgcopy_message_cb message_cb)
 {
     char buf[48];
     int rv;
+    cbm_transfer_state *cbm;
+    CBM_FILE fd_cbm = fd;
+    unsigned char drive = (unsigned char)(ULONG_PTR)arg;
 
     if(settings->end_track > settings->max_tracks)
     {
@@ -77,9 +83,15 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
         return 99;
     }
 
-    drive = (unsigned char)(ULONG_PTR)arg;
-
-    fd_cbm = fd;
+    cbm = malloc(sizeof(*cbm));
+    if(cbm == NULL)
+    {
+        message_cb(0, "no memory for transfer state");
+        return 1;
+    }
+    cbm->fd_cbm = fd;
+    cbm->drive = drive;
+    cbm->settings = settings;
 
     cbm_open(fd_cbm, drive, 2, "#", 1);
 
@@ -87,13 +99,21 @@ static int open_disk(CBM_FILE fd, imgcopy_settings *settings,
     if(rv)
     {
         message_cb(0, "drive %02d: %s", drive, buf);
+        free(cbm);
+    }
+    else
+    {
+        *state = cbm;
     }
     return rv;
 }
 
-static void close_disk(void)
+static void close_disk(void *state)
 {
-    cbm_close(fd_cbm, drive, 2);
+    cbm_transfer_state *cbm = state;
+
+    cbm_close(cbm->fd_cbm, cbm->drive, 2);
+    free(cbm);
 }
 
 DECLARE_TRANSFER_FUNCS(std_transfer, 1, 0);
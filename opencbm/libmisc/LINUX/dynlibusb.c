@@ -45,6 +45,7 @@ usb_dll_t usb = {
     .find_devices = usb_find_devices, 
     .device = usb_device,
     .get_busses = usb_get_busses
+    /* no asynchronous transfers with the libusb 0.1 API */
 };
 
 int dynlibusb_init(void) {
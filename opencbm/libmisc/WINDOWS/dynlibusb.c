@@ -71,6 +71,15 @@ int dynlibusb_init(void) {
         READ(device);
         READ(get_busses);
 
+#define READ_OPTIONAL(_x) \
+    usb._x = plugin_get_address(usb.shared_object_handle, "usb_" ## #_x);
+
+        READ_OPTIONAL(bulk_setup_async);
+        READ_OPTIONAL(submit_async);
+        READ_OPTIONAL(reap_async);
+        READ_OPTIONAL(cancel_async);
+        READ_OPTIONAL(free_async);
+
         error = 0;
     } while (0);
 
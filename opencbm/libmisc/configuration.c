@@ -26,6 +26,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
 
 /*! \brief the maximum line length we expect in a configuration file 
  * \remark: 
@@ -73,6 +76,48 @@ struct opencbm_configuration_section_s {
     char *                            Comment; /*!< an (optional) comment which is on the line where the section starts, if any */
 };
 
+/*! a convenient name for opencbm_configuration_index_node_s */
+typedef struct opencbm_configuration_index_node_s opencbm_configuration_index_node_t;
+
+/*! this struct holds a section or an entry in the hashed index
+ * of a configuration file.
+ */
+struct opencbm_configuration_index_node_s {
+    opencbm_configuration_index_node_t * Next;    /*!< pointer to the next node in the same bucket; NULL if this is the last one */
+    unsigned int                         Hash;    /*!< the hash of the section name and the entry name */
+    opencbm_configuration_section_t    * Section; /*!< the section */
+    opencbm_configuration_entry_t      * Entry;   /*!< the entry; NULL if this node stands for the section itself */
+};
+
+/*! this struct holds the hashed index of a configuration file.
+ * It allows finding a section or an entry without walking the lists.
+ * The index is built when it is needed first, and it is thrown away
+ * whenever a section or an entry is added or removed.
+ */
+typedef
+struct opencbm_configuration_index_s {
+    unsigned int                          Mask;    /*!< the number of buckets minus 1; the number of buckets is a power of 2 */
+    opencbm_configuration_index_node_t ** Buckets; /*!< the buckets, each one a linked list of nodes */
+    opencbm_configuration_index_node_t *  Nodes;   /*!< the memory of all nodes */
+} opencbm_configuration_index_t;
+
+/*! this struct tells if a configuration file has changed since it has been read.
+ * As files are written by creating a new one and renaming it, the file node
+ * changes even if the file is written twice in the same second. A file
+ * edited in place might keep its size and node, and where the file system
+ * has no sub-second times, even its times; thus, a file changed in the
+ * last second is never taken from the cache or from a snapshot.
+ */
+typedef
+struct opencbm_configuration_stamp_s {
+    unsigned long Time;     /*!< the time of the last modification of the file */
+    unsigned long TimeNs;   /*!< the nanoseconds of Time, if the system has them */
+    unsigned long Change;   /*!< the time of the last status change of the file */
+    unsigned long Size;     /*!< the size of the file */
+    unsigned long Node;     /*!< the file node (inode) of the file, if there is one */
+    unsigned int  Recent;   /*!< 1 if the file might still be changed in the same second */
+} opencbm_configuration_stamp_t;
+
 /*! this struct holds a complete configuration file
  * The handle to the configuration file is a pointer to this struct, actually.
  */
@@ -83,8 +128,38 @@ struct opencbm_configuration_s {
     const char *                      FileNameForWrite; /*!< the special file name used when the configuration file is written */
 
     unsigned int Changed;                               /*!< marker if this file has been changed after it has been read. 0 if no changed occurred, 1 otherwise. */
+
+    opencbm_configuration_index_t *   Index;            /*!< the hashed index of the sections and entries; NULL if it has not been built yet */
+    opencbm_configuration_stamp_t     Stamp;            /*!< the state of the file when it was read */
+    unsigned int                      Cached;           /*!< 1 if this handle is kept in the configuration cache, 0 otherwise */
+    unsigned int                      InUse;            /*!< for a cached handle: 1 while it is opened, 0 otherwise */
 } opencbm_configuration_t;
 
+/*! the number of configuration files which are kept parsed in memory
+ * after they have been closed. Usually, there are only two of them:
+ * The configuration file and the drive cache.
+ */
+#define CONFIGURATION_CACHE_SIZE 4
+
+/*! the configuration files which are kept parsed in memory.
+ * This array is protected by arch_global_lock().
+ */
+static opencbm_configuration_handle configuration_cache[CONFIGURATION_CACHE_SIZE];
+
+/*! the environment variable which names a directory for the snapshots,
+ * cf. configuration_snapshot_name()
+ */
+#define CONFIGURATION_SNAPSHOT_ENV "OPENCBM_CONFIG_SNAPSHOT"
+
+/*! the first bytes of a snapshot file */
+#define CONFIGURATION_SNAPSHOT_MAGIC "OCBMCFG\001"
+
+/*! the length of CONFIGURATION_SNAPSHOT_MAGIC */
+#define CONFIGURATION_SNAPSHOT_MAGIC_LENGTH 8
+
+/*! the start value of configuration_hash() */
+#define CONFIGURATION_HASH_INIT 2166136261u
+
 /*! \brief \internal allocate memory for a new configuration entry
 
  \param CurrentSection
@@ -295,6 +370,257 @@ configuration_section_free(opencbm_configuration_section_t * Section)
     return next_section;
 }
 
+/*! \brief \internal hash a string
+
+ This function calculates the FNV-1a hash of a string.
+
+ \param Hash
+   The hash of the preceding data, or CONFIGURATION_HASH_INIT if
+   there is none.
+
+ \param String
+   The string to hash.
+
+ \return
+   The hash of the preceding data and the string.
+*/
+static unsigned int
+configuration_hash(unsigned int Hash, const char * String)
+{
+    const unsigned char * p = (const unsigned char *) String;
+
+    while (*p) {
+        Hash = (Hash ^ *p++) * 16777619u;
+    }
+
+    return Hash;
+}
+
+/*! \brief \internal hash the name of a section or entry for the index
+
+ \param Section
+   The name of the section.
+
+ \param Entry
+   The name of the entry, or NULL for the section itself.
+
+ \return
+   The hash of the names.
+*/
+static unsigned int
+configuration_index_hash(const char * Section, const char * Entry)
+{
+    unsigned int hash = configuration_hash(CONFIGURATION_HASH_INIT, Section);
+
+    if (Entry) {
+        hash = configuration_hash((hash ^ '=') * 16777619u, Entry);
+    }
+
+    return hash;
+}
+
+/*! \brief \internal find a section or an entry in the index
+
+ \param Index
+   Pointer to the index.
+
+ \param Hash
+   The hash of the names, as calculated by configuration_index_hash().
+
+ \param Section
+   The name of the section.
+
+ \param Entry
+   The name of the entry, or NULL to find the section itself.
+
+ \return
+   Pointer to the node of the index. NULL if there is none.
+*/
+static opencbm_configuration_index_node_t *
+configuration_index_lookup(opencbm_configuration_index_t * Index,
+                           unsigned int Hash,
+                           const char * Section,
+                           const char * Entry)
+{
+    opencbm_configuration_index_node_t * node;
+
+    for (node = Index->Buckets[Hash & Index->Mask]; node != NULL; node = node->Next) {
+        if (node->Hash == Hash
+            && (node->Entry == NULL) == (Entry == NULL)
+            && strcmp(node->Section->Name, Section) == 0
+            && (Entry == NULL || strcmp(node->Entry->Name, Entry) == 0))
+        {
+            break;
+        }
+    }
+
+    return node;
+}
+
+/*! \brief \internal add a section or an entry to the index
+
+ If there already is a section or entry with the same name, the
+ index is not changed. This way, the first one is found, as it
+ would be when walking the lists.
+
+ \param Index
+   Pointer to the index.
+
+ \param Node
+   Pointer to the memory for the new node.
+
+ \param Section
+   Pointer to the section.
+
+ \param Entry
+   Pointer to the entry, or NULL to add the section itself.
+
+ \return
+   1 if the node has been used, 0 otherwise.
+*/
+static int
+configuration_index_insert(opencbm_configuration_index_t * Index,
+                           opencbm_configuration_index_node_t * Node,
+                           opencbm_configuration_section_t * Section,
+                           opencbm_configuration_entry_t * Entry)
+{
+    unsigned int hash = configuration_index_hash(Section->Name, Entry ? Entry->Name : NULL);
+
+    if (configuration_index_lookup(Index, hash, Section->Name, Entry ? Entry->Name : NULL)) {
+        return 0;
+    }
+
+    Node->Hash    = hash;
+    Node->Section = Section;
+    Node->Entry   = Entry;
+    Node->Next    = Index->Buckets[hash & Index->Mask];
+    Index->Buckets[hash & Index->Mask] = Node;
+
+    return 1;
+}
+
+/*! \brief \internal free the index of a configuration file
+
+ \param Handle
+   Handle to the configuration file.
+
+ \remark
+   This must be called whenever a section or an entry is added or removed.
+*/
+static void
+configuration_index_drop(opencbm_configuration_handle Handle)
+{
+    if (Handle->Index) {
+        free(Handle->Index->Buckets);
+        free(Handle->Index->Nodes);
+        free(Handle->Index);
+        Handle->Index = NULL;
+    }
+}
+
+/*! \brief \internal get the index of a configuration file
+
+ If the index has not been built yet, it is built now.
+ The unnamed first section, and the lines without an entry name,
+ are not part of the index.
+
+ \param Handle
+   Handle to the configuration file.
+
+ \return
+   Pointer to the index. NULL if we run out of memory; then, the
+   lists have to be walked.
+*/
+static opencbm_configuration_index_t *
+configuration_index_get(opencbm_configuration_handle Handle)
+{
+    opencbm_configuration_index_t * index = NULL;
+    unsigned int error = 1;
+
+    do {
+        opencbm_configuration_section_t * currentSection;
+        opencbm_configuration_entry_t   * currentEntry;
+        unsigned int count = 0;
+        unsigned int buckets = 8;
+
+        if (Handle->Index) {
+            error = 0;
+            break;
+        }
+
+        for (currentSection = Handle->Sections;
+             currentSection != NULL;
+             currentSection = currentSection->Next)
+        {
+            if (currentSection->Name == NULL) {
+                continue;
+            }
+
+            ++count;
+
+            for (currentEntry = currentSection->Entries;
+                 currentEntry != NULL;
+                 currentEntry = currentEntry->Next)
+            {
+                if (currentEntry->Name && currentEntry->Name[0]) {
+                    ++count;
+                }
+            }
+        }
+
+        while (buckets < 2 * count) {
+            buckets <<= 1;
+        }
+
+        index = malloc(sizeof(*index));
+
+        if (index == NULL) {
+            break;
+        }
+
+        index->Mask = buckets - 1;
+        index->Buckets = calloc(buckets, sizeof(*index->Buckets));
+        index->Nodes = calloc(count ? count : 1, sizeof(*index->Nodes));
+
+        Handle->Index = index;
+
+        if (index->Buckets == NULL || index->Nodes == NULL) {
+            break;
+        }
+
+        count = 0;
+
+        for (currentSection = Handle->Sections;
+             currentSection != NULL;
+             currentSection = currentSection->Next)
+        {
+            if (currentSection->Name == NULL) {
+                continue;
+            }
+
+            count += configuration_index_insert(index, &index->Nodes[count], currentSection, NULL);
+
+            for (currentEntry = currentSection->Entries;
+                 currentEntry != NULL;
+                 currentEntry = currentEntry->Next)
+            {
+                if (currentEntry->Name && currentEntry->Name[0]) {
+                    count += configuration_index_insert(index, &index->Nodes[count], currentSection, currentEntry);
+                }
+            }
+        }
+
+        error = 0;
+
+    } while (0);
+
+    if (error) {
+        configuration_index_drop(Handle);
+    }
+
+    return Handle->Index;
+}
+
 /*! \brief \internal handle the comment when reading a line of the configuration file
 
  This function is an internal helper function which is called whenever a
@@ -782,139 +1108,757 @@ opencbm_configuration_write_file(opencbm_configuration_handle Handle)
     return error;
 }
 
-/*! \brief Open the configuration file
+/*! \brief \internal Free all sections of the configuration file
 
- Opens the configuration file so it can be used later on with
- opencbm_configuration_get_data(). If the file does not exist,
- this function fails.
+ This function frees the memory of all sections and entries, and
+ of the index. The handle itself is not freed.
+*/
+static void
+configuration_sections_free(opencbm_configuration_handle Handle)
+{
+    opencbm_configuration_section_t *section;
 
- \param Filename
-   The name of the configuration file to open
+    configuration_index_drop(Handle);
 
- \return
-   Returns a handle to the configuration file which can be used
-   in subsequent calls to the other configuration file functions
-   for reading. Write operations are not allowed after using
-   this function.
+    section = Handle->Sections;
 
-   If the configuration file does not exist, this function
-   returns NULL.
-*/
-opencbm_configuration_handle
-opencbm_configuration_open(const char * Filename)
-{
-    opencbm_configuration_handle handle;
-    unsigned int error = 1;
+    while (section != NULL)
+    {
+        section = configuration_section_free(section);
+    }
 
-    FILE * configFile = NULL;
+    Handle->Sections = NULL;
+}
 
-    do {
-        handle = malloc(sizeof(*handle));
+/*! \brief Free all of the memory occupied by the configuration file
 
-        if (!handle) {
-            break;
-        }
+ This function frees all of the memory occupied by the configuration
+ file in processor memory.
+ The file is not deleted from the permanent storage (hard disk).
+*/
+static void
+opencbm_configuration_free_all(opencbm_configuration_handle Handle)
+{
+    configuration_sections_free(Handle);
 
-        memset(handle, 0, sizeof(*handle));
+    cbmlibmisc_strfree(Handle->FileName);
+    cbmlibmisc_strfree(Handle->FileNameForWrite);
 
-        handle->Sections = NULL;
+    free(Handle);
+}
 
-        handle->FileName = cbmlibmisc_strdup(Filename);
-        handle->FileNameForWrite = cbmlibmisc_strcat(handle->FileName, ".tmp");
-        handle->Changed = 0;
+/*! \brief \internal Find out the state of a configuration file
 
-        if ( (handle->FileName == NULL) || (handle->FileNameForWrite == NULL)) {
-            break;
-        }
+ \param Filename
+   The name of the configuration file.
 
-        configFile = fopen(handle->FileName, "rt");
+ \param Stamp
+   Pointer to a stamp which is filled in.
 
-        if (configFile == NULL) {
-            break;
-        }
+ \return
+   0 if the state could be determined,
+   1 otherwise. This means the file does not exist.
+*/
+static int
+configuration_stamp_get(const char * Filename, opencbm_configuration_stamp_t * Stamp)
+{
+    struct stat statbuf;
 
-        opencbm_configuration_parse_file(handle, configFile);
+    memset(Stamp, 0, sizeof(*Stamp));
 
-        fclose(configFile);
+    if (stat(Filename, &statbuf)) {
+        return 1;
+    }
 
-        error = 0;
+    Stamp->Time = (unsigned long) statbuf.st_mtime;
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__)
+    Stamp->TimeNs = (unsigned long) statbuf.st_mtimespec.tv_nsec;
+#elif defined(__linux__) || defined(__OpenBSD__)
+    Stamp->TimeNs = (unsigned long) statbuf.st_mtim.tv_nsec;
+#endif
+    Stamp->Change = (unsigned long) statbuf.st_ctime;
+    Stamp->Size = (unsigned long) statbuf.st_size;
+    Stamp->Node = (unsigned long) statbuf.st_ino;
 
-    } while (0);
+    /* a change later in this second would not change Time or Change */
+    {
+        time_t now = time(NULL);
 
-    if (error && handle) {
-        cbmlibmisc_strfree(handle->FileName);
-        cbmlibmisc_strfree(handle->FileNameForWrite);
-        free(handle);
-        handle = NULL;
+        Stamp->Recent = statbuf.st_mtime + 1 >= now || statbuf.st_ctime + 1 >= now;
     }
 
-    return handle;
+    return 0;
 }
 
+/*! \brief \internal Get the name of the snapshot of a configuration file
 
-/*! \brief Creates the configuration file for reading and writing
-
- Opens the configuration file so it can be used later on with
- opencbm_configuration_get_data(). If the file does not exist,
- a new, empty one is created.
+ A snapshot is a binary copy of the parsed configuration file. It can be
+ read without parsing the lines again. Snapshots are only used if the
+ environment variable OPENCBM_CONFIG_SNAPSHOT names a directory where they
+ can be stored.
 
  \param Filename
-   The name of the configuration file to open
+   The name of the configuration file.
 
  \return
-   Returns a handle to the configuration file which can be used
-   in subsequent calls to the other configuration file functions.
+   The name of the snapshot file, which has to be freed with
+   cbmlibmisc_strfree(). NULL if no snapshots are used.
 */
-opencbm_configuration_handle
-opencbm_configuration_create(const char * Filename)
+static char *
+configuration_snapshot_name(const char * Filename)
 {
-    opencbm_configuration_handle handle = NULL;
+    const char * directory = getenv(CONFIGURATION_SNAPSHOT_ENV);
+    char name[32];
 
-    do {
-        handle = opencbm_configuration_open(Filename);
+    if (directory == NULL || directory[0] == 0) {
+        return NULL;
+    }
 
-        if (handle == NULL) {
+    arch_snprintf(name, sizeof(name), "/opencbm-%08x.snapshot",
+        configuration_hash(CONFIGURATION_HASH_INIT, Filename));
 
-            FILE * filehandle;
-            filehandle = fopen(Filename, "wt");
+    return cbmlibmisc_strcat(directory, name);
+}
 
-            if (filehandle == NULL)
-                break;
+/*! \brief \internal Format the state of a file, as it is stored in a snapshot
 
-            fclose(filehandle);
+ \param Handle
+   Handle to the configuration file.
 
-            handle = opencbm_configuration_open(Filename);
-            if (handle == NULL)
+ \param Buffer
+   Buffer which receives the string.
+
+ \param Length
+   The length of Buffer.
+*/
+static void
+configuration_snapshot_stamp(opencbm_configuration_handle Handle, char * Buffer, size_t Length)
+{
+    arch_snprintf(Buffer, Length, "%lu %lu %lu %lu %lu",
+        Handle->Stamp.Time, Handle->Stamp.TimeNs, Handle->Stamp.Change,
+        Handle->Stamp.Size, Handle->Stamp.Node);
+}
+
+/*! \brief \internal Get the next string from a snapshot
+
+ \param Position
+   Pointer to the current position in the snapshot.
+   On return, it points after the string.
+
+ \param End
+   The end of the snapshot data.
+
+ \return
+   Pointer to the string; NULL if the snapshot is damaged.
+*/
+static const char *
+configuration_snapshot_string(const char ** Position, const char * End)
+{
+    const char * string = *Position;
+    const char * p = memchr(string, 0, End - string);
+
+    if (p == NULL) {
+        return NULL;
+    }
+
+    *Position = p + 1;
+
+    return string;
+}
+
+/*! \brief \internal Read the configuration file from a snapshot
+
+ The snapshot is only used if it has been written for the same
+ file, in the same state as the file is now.
+
+ \param Handle
+   Handle to the configuration file. Handle->Stamp must be set.
+
+ \param SnapshotName
+   The name of the snapshot file.
+
+ \return
+   0 if the snapshot has been read,
+   1 otherwise. In this case, the file has to be parsed.
+*/
+static int
+configuration_snapshot_read(opencbm_configuration_handle Handle, const char * SnapshotName)
+{
+    FILE * snapshot = NULL;
+    char * buffer = NULL;
+    int error = 1;
+
+    do {
+        opencbm_configuration_section_t * currentSection;
+        opencbm_configuration_entry_t   * previousEntry = NULL;
+        const char * p;
+        const char * end;
+        const char * string;
+        char stamp[64];
+        long length;
+
+        snapshot = fopen(SnapshotName, "rb");
+
+        if (snapshot == NULL) {
+            break;
+        }
+
+        if (fseek(snapshot, 0, SEEK_END) != 0) {
+            break;
+        }
+
+        length = ftell(snapshot);
+
+        if (length < CONFIGURATION_SNAPSHOT_MAGIC_LENGTH + 4 || fseek(snapshot, 0, SEEK_SET) != 0) {
+            break;
+        }
+
+        buffer = malloc(length);
+
+        if (buffer == NULL || fread(buffer, 1, length, snapshot) != (size_t) length) {
+            break;
+        }
+
+        /* the file ends with the hash of all of its contents */
+
+        end = buffer + length - 4;
+
+        {
+            const unsigned char * trailer = (const unsigned char *) end;
+            unsigned int hash = CONFIGURATION_HASH_INIT;
+
+            for (p = buffer; p < end; p++) {
+                hash = (hash ^ (unsigned char) *p) * 16777619u;
+            }
+
+            if (hash != (trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((unsigned int) trailer[3] << 24))) {
                 break;
+            }
+        }
+
+        if (memcmp(buffer, CONFIGURATION_SNAPSHOT_MAGIC, CONFIGURATION_SNAPSHOT_MAGIC_LENGTH) != 0) {
+            break;
+        }
+
+        p = buffer + CONFIGURATION_SNAPSHOT_MAGIC_LENGTH;
+
+        /* check that the snapshot has been made of this very file */
+
+        configuration_snapshot_stamp(Handle, stamp, sizeof(stamp));
+
+        string = configuration_snapshot_string(&p, end);
+
+        if (string == NULL || strcmp(string, Handle->FileName) != 0) {
+            break;
+        }
+
+        string = configuration_snapshot_string(&p, end);
+
+        if (string == NULL || strcmp(string, stamp) != 0) {
+            break;
+        }
+
+        Handle->Sections = section_alloc_new(Handle, NULL, NULL, "");
+        currentSection = Handle->Sections;
+
+        /* now, re-create the sections and entries
+         *
+         * 'S' name comment:        a new section
+         * 'E' name value comment:  an entry in the current section
+         */
+
+        while (currentSection != NULL && p < end) {
+            const char * name;
+            const char * value = NULL;
+            const char * comment;
+            char type = *p++;
+
+            name = configuration_snapshot_string(&p, end);
+
+            if (type == 'E') {
+                value = configuration_snapshot_string(&p, end);
+            }
+            else if (type != 'S') {
+                break;
+            }
+
+            comment = configuration_snapshot_string(&p, end);
+
+            if (name == NULL || comment == NULL || (type == 'E' && value == NULL)) {
+                break;
+            }
+
+            if (type == 'S') {
+                currentSection = section_alloc_new(Handle, currentSection, name, comment);
+                previousEntry = NULL;
+            }
+            else {
+                previousEntry = entry_alloc_new(currentSection, previousEntry, name, value, comment);
+
+                if (previousEntry == NULL) {
+                    break;
+                }
+            }
+        }
+
+        if (currentSection != NULL && p == end) {
+            error = 0;
         }
 
     } while (0);
 
+    if (snapshot) {
+        fclose(snapshot);
+    }
+
+    free(buffer);
+
+    if (error) {
+        configuration_sections_free(Handle);
+    }
+
+    return error;
+}
+
+/*! \brief \internal Write data into a snapshot
+
+ \param Snapshot
+   The snapshot file.
+
+ \param Hash
+   Pointer to the hash of the data written so far; it is updated.
+
+ \param Data
+   The data to write.
+
+ \param Length
+   The length of the data.
+
+ \return
+   0 on success, 1 otherwise.
+*/
+static int
+configuration_snapshot_put(FILE * Snapshot, unsigned int * Hash, const void * Data, size_t Length)
+{
+    const unsigned char * p = Data;
+    size_t i;
+
+    for (i = 0; i < Length; i++) {
+        *Hash = (*Hash ^ p[i]) * 16777619u;
+    }
+
+    return fwrite(Data, 1, Length, Snapshot) != Length;
+}
+
+/*! \brief \internal Write a string into a snapshot
+
+ \param Snapshot
+   The snapshot file.
+
+ \param Hash
+   Pointer to the hash of the data written so far; it is updated.
+
+ \param String
+   The string to write, including its terminating zero.
+   NULL is written as an empty string.
+
+ \return
+   0 on success, 1 otherwise.
+*/
+static int
+configuration_snapshot_put_string(FILE * Snapshot, unsigned int * Hash, const char * String)
+{
+    if (String == NULL) {
+        String = "";
+    }
+
+    return configuration_snapshot_put(Snapshot, Hash, String, strlen(String) + 1);
+}
+
+/*! \brief \internal Write a snapshot of the configuration file
+
+ Errors are ignored, as the snapshot is only an optimisation.
+ The snapshot is written into a temporary file first, so no
+ other process can see a half written snapshot.
+
+ \param Handle
+   Handle to the configuration file, as it has just been read.
+
+ \param SnapshotName
+   The name of the snapshot file.
+*/
+static void
+configuration_snapshot_write(opencbm_configuration_handle Handle, const char * SnapshotName)
+{
+    char * tempName = cbmlibmisc_strcat(SnapshotName, ".tmp");
+    FILE * snapshot = NULL;
+    int error = 1;
+
+    do {
+        opencbm_configuration_section_t * currentSection;
+        unsigned int hash = CONFIGURATION_HASH_INIT;
+        unsigned char trailer[4];
+        char stamp[64];
+
+        if (tempName == NULL) {
+            break;
+        }
+
+        snapshot = fopen(tempName, "wb");
+
+        if (snapshot == NULL) {
+            break;
+        }
+
+        configuration_snapshot_stamp(Handle, stamp, sizeof(stamp));
+
+        error = configuration_snapshot_put(snapshot, &hash, CONFIGURATION_SNAPSHOT_MAGIC, CONFIGURATION_SNAPSHOT_MAGIC_LENGTH)
+             || configuration_snapshot_put_string(snapshot, &hash, Handle->FileName)
+             || configuration_snapshot_put_string(snapshot, &hash, stamp);
+
+        for (currentSection = Handle->Sections;
+             currentSection != NULL && error == 0;
+             currentSection = currentSection->Next)
+        {
+            opencbm_configuration_entry_t * currentEntry;
+
+            /* the first section is no real section, cf. opencbm_configuration_write_file() */
+
+            if (currentSection != Handle->Sections) {
+                error = configuration_snapshot_put(snapshot, &hash, "S", 1)
+                     || configuration_snapshot_put_string(snapshot, &hash, currentSection->Name)
+                     || configuration_snapshot_put_string(snapshot, &hash, currentSection->Comment);
+            }
+
+            for (currentEntry = currentSection->Entries;
+                 currentEntry != NULL && error == 0;
+                 currentEntry = currentEntry->Next)
+            {
+                error = configuration_snapshot_put(snapshot, &hash, "E", 1)
+                     || configuration_snapshot_put_string(snapshot, &hash, currentEntry->Name)
+                     || configuration_snapshot_put_string(snapshot, &hash, currentEntry->Value)
+                     || configuration_snapshot_put_string(snapshot, &hash, currentEntry->Comment);
+            }
+        }
+
+        trailer[0] = (unsigned char) hash;
+        trailer[1] = (unsigned char) (hash >> 8);
+        trailer[2] = (unsigned char) (hash >> 16);
+        trailer[3] = (unsigned char) (hash >> 24);
+
+        if (error || fwrite(trailer, 1, sizeof(trailer), snapshot) != sizeof(trailer)) {
+            error = 1;
+        }
+
+    } while (0);
+
+    if (snapshot) {
+        if (fclose(snapshot)) {
+            error = 1;
+        }
+
+        if (error == 0) {
+            arch_unlink(SnapshotName);
+            error = rename(tempName, SnapshotName);
+        }
+
+        if (error) {
+            arch_unlink(tempName);
+        }
+    }
+
+    cbmlibmisc_strfree(tempName);
+}
+
+/*! \brief \internal Get a configuration file from the configuration cache
+
+ \param Filename
+   The name of the configuration file.
+
+ \param Stamp
+   The current state of the file.
+
+ \return
+   The handle of the cached configuration file, which is now in use.
+   NULL if the file is not in the cache, if it has changed since, or
+   if its handle is in use.
+*/
+static opencbm_configuration_handle
+configuration_cache_get(const char * Filename, const opencbm_configuration_stamp_t * Stamp)
+{
+    opencbm_configuration_handle handle = NULL;
+    unsigned int i;
+
+    arch_global_lock();
+
+    for (i = 0; i < CONFIGURATION_CACHE_SIZE; i++) {
+        opencbm_configuration_handle cached = configuration_cache[i];
+
+        if (cached != NULL
+            && ! cached->InUse
+            && strcmp(cached->FileName, Filename) == 0
+            && memcmp(&cached->Stamp, Stamp, sizeof(*Stamp)) == 0)
+        {
+            cached->InUse = 1;
+            handle = cached;
+            break;
+        }
+    }
+
+    arch_global_unlock();
+
     return handle;
 }
 
-/*! \brief Free all of the memory occupied by the configuration file
+/*! \brief \internal Put a configuration file into the configuration cache
 
- This function frees all of the memory occupied by the configuration
- file in processor memory.
- The file is not deleted from the permanent storage (hard disk).
+ If the cache is full, a configuration file which is not in use is
+ dropped. If there is none, the handle is not cached.
+
+ \param Handle
+   Handle to the configuration file, as it has just been read.
 */
 static void
-opencbm_configuration_free_all(opencbm_configuration_handle Handle)
+configuration_cache_put(opencbm_configuration_handle Handle)
 {
-    opencbm_configuration_section_t *section;
+    opencbm_configuration_handle dropped = NULL;
+    int slot = -1;
+    int i;
 
-    section = Handle->Sections;
+    arch_global_lock();
 
-    while (section != NULL)
-    {
-        section = configuration_section_free(section);
+    for (i = 0; i < CONFIGURATION_CACHE_SIZE; i++) {
+        opencbm_configuration_handle cached = configuration_cache[i];
+
+        if (cached == NULL) {
+            if (slot < 0) {
+                slot = i;
+            }
+        }
+        else if ( ! cached->InUse && strcmp(cached->FileName, Handle->FileName) == 0) {
+            /* an older state of the same file */
+            slot = i;
+            break;
+        }
+    }
+
+    for (i = 0; slot < 0 && i < CONFIGURATION_CACHE_SIZE; i++) {
+        if ( ! configuration_cache[i]->InUse) {
+            slot = i;
+        }
+    }
+
+    if (slot >= 0) {
+        dropped = configuration_cache[slot];
+        configuration_cache[slot] = Handle;
+        Handle->Cached = 1;
+        Handle->InUse = 1;
+    }
+
+    arch_global_unlock();
+
+    if (dropped) {
+        opencbm_configuration_free_all(dropped);
+    }
+}
+
+/*! \brief \internal Give back a configuration file to the configuration cache
+
+ If the configuration file has been changed, it is removed from the
+ cache, as it is not the same as the file anymore.
+
+ \param Handle
+   Handle to the configuration file.
+
+ \return
+   1 if the handle is still cached, 0 if it has to be freed.
+*/
+static int
+configuration_cache_release(opencbm_configuration_handle Handle)
+{
+    int cached = 0;
+    int i;
+
+    arch_global_lock();
+
+    if (Handle->Cached) {
+        if (Handle->Changed) {
+            for (i = 0; i < CONFIGURATION_CACHE_SIZE; i++) {
+                if (configuration_cache[i] == Handle) {
+                    configuration_cache[i] = NULL;
+                }
+            }
+
+            Handle->Cached = 0;
+        }
+        else {
+            Handle->InUse = 0;
+            cached = 1;
+        }
+    }
+
+    arch_global_unlock();
+
+    return cached;
+}
+
+/*! \brief Open the configuration file
+
+ Opens the configuration file so it can be used later on with
+ opencbm_configuration_get_data(). If the file does not exist,
+ this function fails.
+
+ \param Filename
+   The name of the configuration file to open
+
+ \return
+   Returns a handle to the configuration file which can be used
+   in subsequent calls to the other configuration file functions
+   for reading. Write operations are not allowed after using
+   this function.
+
+   If the configuration file does not exist, this function
+   returns NULL.
+
+ \remark
+   The parsed configuration file is kept in memory after it has
+   been closed. As long as the file has not been changed, the next
+   call of this function for the same file does not read it again.
+   If the environment variable OPENCBM_CONFIG_SNAPSHOT names a
+   directory, a binary snapshot of the parsed file is stored there,
+   so other processes do not have to parse the file again, either.
+*/
+opencbm_configuration_handle
+opencbm_configuration_open(const char * Filename)
+{
+    opencbm_configuration_handle handle = NULL;
+    opencbm_configuration_stamp_t stamp;
+    char * snapshotName = NULL;
+    unsigned int error = 1;
+
+    FILE * configFile = NULL;
+
+    do {
+        if (Filename == NULL || configuration_stamp_get(Filename, &stamp)) {
+            break;
+        }
+
+        if ( ! stamp.Recent) {
+            handle = configuration_cache_get(Filename, &stamp);
+        }
+
+        if (handle) {
+            error = 0;
+            break;
+        }
+
+        handle = malloc(sizeof(*handle));
+
+        if (!handle) {
+            break;
+        }
+
+        memset(handle, 0, sizeof(*handle));
+
+        handle->Sections = NULL;
+
+        handle->FileName = cbmlibmisc_strdup(Filename);
+        handle->FileNameForWrite = cbmlibmisc_strcat(handle->FileName, ".tmp");
+        handle->Changed = 0;
+        handle->Stamp = stamp;
+
+        if ( (handle->FileName == NULL) || (handle->FileNameForWrite == NULL)) {
+            break;
+        }
+
+        if ( ! stamp.Recent) {
+            snapshotName = configuration_snapshot_name(handle->FileName);
+        }
+
+        if (snapshotName == NULL || configuration_snapshot_read(handle, snapshotName) != 0) {
+
+            configFile = fopen(handle->FileName, "rt");
+
+            if (configFile == NULL) {
+                break;
+            }
+
+            error = opencbm_configuration_parse_file(handle, configFile);
+
+            fclose(configFile);
+
+            /* a configuration which could not be read completely can
+             * be used, but it is neither cached nor stored as a snapshot
+             */
+
+            if (error) {
+                error = 0;
+                break;
+            }
+
+            if (snapshotName) {
+                configuration_snapshot_write(handle, snapshotName);
+            }
+        }
+
+        configuration_cache_put(handle);
+
+        error = 0;
+
+    } while (0);
+
+    cbmlibmisc_strfree(snapshotName);
+
+    if (error && handle) {
+        cbmlibmisc_strfree(handle->FileName);
+        cbmlibmisc_strfree(handle->FileNameForWrite);
+        free(handle);
+        handle = NULL;
     }
 
-    cbmlibmisc_strfree(Handle->FileName);
-    cbmlibmisc_strfree(Handle->FileNameForWrite);
+    return handle;
+}
+
+
+/*! \brief Creates the configuration file for reading and writing
+
+ Opens the configuration file so it can be used later on with
+ opencbm_configuration_get_data(). If the file does not exist,
+ a new, empty one is created.
+
+ \param Filename
+   The name of the configuration file to open
+
+ \return
+   Returns a handle to the configuration file which can be used
+   in subsequent calls to the other configuration file functions.
+*/
+opencbm_configuration_handle
+opencbm_configuration_create(const char * Filename)
+{
+    opencbm_configuration_handle handle = NULL;
+
+    do {
+        handle = opencbm_configuration_open(Filename);
+
+        if (handle == NULL) {
+
+            FILE * filehandle;
+            filehandle = fopen(Filename, "wt");
+
+            if (filehandle == NULL)
+                break;
+
+            fclose(filehandle);
+
+            handle = opencbm_configuration_open(Filename);
+            if (handle == NULL)
+                break;
+        }
+
+    } while (0);
 
-    free(Handle);
+    return handle;
 }
 
 /*! \brief Flush the configuration file
@@ -975,7 +1919,9 @@ opencbm_configuration_close(opencbm_configuration_handle Handle)
 
         error = opencbm_configuration_flush(Handle);
 
-        opencbm_configuration_free_all(Handle);
+        if ( ! configuration_cache_release(Handle) ) {
+            opencbm_configuration_free_all(Handle);
+        }
 
     } while(0);
 
@@ -1019,6 +1965,22 @@ opencbm_configuration_find_section(opencbm_configuration_handle Handle,
             break;
         }
 
+        /* The index can only be used if the previous section is not needed */
+
+        if (PreviousSection == NULL) {
+            opencbm_configuration_index_t * index = configuration_index_get(Handle);
+
+            if (index) {
+                opencbm_configuration_index_node_t * node =
+                    configuration_index_lookup(index, configuration_index_hash(Section, NULL), Section, NULL);
+
+                if (node || ! Create) {
+                    currentSection = node ? node->Section : NULL;
+                    break;
+                }
+            }
+        }
+
         for (currentSection = Handle->Sections;
              currentSection != NULL;
              currentSection = currentSection->Next)
@@ -1041,11 +2003,16 @@ opencbm_configuration_find_section(opencbm_configuration_handle Handle,
             lastSection = currentSection;
         }
 
+        if (PreviousSection) {
+            *PreviousSection = lastSection;
+        }
+
         if (Create && currentSection == NULL) {
 
             /* there was no section with that name, generate a new one */
             
             currentSection = section_alloc_new(Handle, lastSection, Section, NULL);
+            configuration_index_drop(Handle);
         }
 
     } while(0);
@@ -1151,6 +2118,7 @@ opencbm_configuration_find_data_ex(opencbm_configuration_handle Handle,
         }
 
         currentEntry = entry_alloc_new(currentSection, lastEntry, Entry, NULL, NULL);
+        configuration_index_drop(Handle);
 
     } while(0);
 
@@ -1188,8 +2156,39 @@ opencbm_configuration_find_data(opencbm_configuration_handle Handle,
 {
     opencbm_configuration_entry_t * last_entry;
     opencbm_configuration_section_t * section;
+    opencbm_configuration_entry_t * entry = NULL;
+    unsigned int found = 0;
+
+    do {
+        opencbm_configuration_index_t * index;
+
+        /* the lines without an entry name are not in the index */
+
+        if (Section == NULL || Entry == NULL || Entry[0] == 0) {
+            break;
+        }
+
+        index = configuration_index_get(Handle);
+
+        if (index) {
+            opencbm_configuration_index_node_t * node =
+                configuration_index_lookup(index, configuration_index_hash(Section, Entry), Section, Entry);
+
+            /* if the entry is to be created, the lists have to be walked */
+
+            if (node || ! Create) {
+                entry = node ? node->Entry : NULL;
+                found = 1;
+            }
+        }
 
-    return opencbm_configuration_find_data_ex(Handle, Section, Entry, Create, &last_entry, &section);
+    } while (0);
+
+    if ( ! found ) {
+        entry = opencbm_configuration_find_data_ex(Handle, Section, Entry, Create, &last_entry, &section);
+    }
+
+    return entry;
 }
 
 /*! \brief Read data from the configuration file
@@ -1465,6 +2464,9 @@ opencbm_configuration_section_remove(opencbm_configuration_handle Handle,
             previous_section->Next = configuration_section_free(section);
         }
 
+        configuration_index_drop(Handle);
+        Handle->Changed = 1;
+
         error = 0;
 
     } while (0);
@@ -1512,7 +2514,7 @@ opencbm_configuration_entry_remove(opencbm_configuration_handle Handle,
             break;
         }
 
-        assert(section->Entries == entry);
+        assert(last_entry ? last_entry->Next == entry : section->Entries == entry);
 
         if (last_entry == NULL) {
             /*
@@ -1526,6 +2528,9 @@ opencbm_configuration_entry_remove(opencbm_configuration_handle Handle,
             last_entry->Next = configuration_entry_free(entry);
         }
 
+        configuration_index_drop(Handle);
+        Handle->Changed = 1;
+
         error = 0;
 
     } while (0);
@@ -1543,6 +2548,12 @@ opencbm_configuration_entry_remove(opencbm_configuration_handle Handle,
     #endif
 #endif
 
+#ifdef WIN32
+    #include <sys/utime.h>
+#else
+    #include <utime.h>
+#endif
+
 static void
 EnableCrtDebug(void)
 {
@@ -1627,6 +2638,229 @@ static int enum_sections_callback(opencbm_configuration_handle Handle,
     return error;
 }
 
+/*! \brief Write a configuration file for the cache and snapshot tests
+
+ \param Filename
+   The name of the file.
+
+ \param Contents
+   The lines of the file.
+
+ \return
+   0 on success, 1 otherwise.
+*/
+static int
+TestFileWrite(const char * Filename, const char * Contents)
+{
+    FILE * file = fopen(Filename, "wt");
+    int error = 1;
+
+    if (file != NULL) {
+        error = fputs(Contents, file) < 0;
+
+        if (fclose(file)) {
+            error = 1;
+        }
+    }
+
+    return error;
+}
+
+/*! \brief Wait until a file just written is old enough for the cache
+
+ cf. configuration_stamp_get(): A file changed in the last second is
+ neither taken from the cache nor from a snapshot.
+*/
+static void
+TestWaitNotRecent(void)
+{
+    arch_sleep(2);
+}
+
+/*! \brief Drop all configuration files from the cache which are not in use
+
+ This way, the next opencbm_configuration_open() has to read the snapshot
+ or the file, as another process would.
+*/
+static void
+TestCacheDrop(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < CONFIGURATION_CACHE_SIZE; i++) {
+        if (configuration_cache[i] != NULL && ! configuration_cache[i]->InUse) {
+            opencbm_configuration_free_all(configuration_cache[i]);
+            configuration_cache[i] = NULL;
+        }
+    }
+}
+
+/*! \brief Check the value of an entry of a configuration file
+
+ \param Filename
+   The name of the configuration file.
+
+ \param Value
+   The value expected for the entry "Entry" in the section "Sect".
+
+ \param Handle
+   If not NULL, the handle which was used is stored here. It is
+   closed already and must not be used anymore, but it can be compared.
+
+ \return
+   0 if the file could be opened and the entry has the value,
+   1 otherwise.
+*/
+static int
+TestValueCheck(const char * Filename, const char * Value, opencbm_configuration_handle * Handle)
+{
+    opencbm_configuration_handle handle = opencbm_configuration_open(Filename);
+    char * buffer = NULL;
+    int error = 1;
+
+    if (handle != NULL) {
+        if (opencbm_configuration_get_data(handle, "Sect", "Entry", &buffer) == 0) {
+            fprintf(stderr, "returned: %s ... ", buffer);
+            error = strcmp(buffer, Value) != 0;
+            cbmlibmisc_strfree(buffer);
+        }
+
+        if (opencbm_configuration_close(handle)) {
+            error = 1;
+        }
+    }
+
+    if (Handle) {
+        *Handle = handle;
+    }
+
+    return error;
+}
+
+/*! \brief Find a string in the snapshot of a configuration file
+
+ \param Filename
+   The name of the configuration file.
+
+ \param Text
+   The string to find.
+
+ \param Replacement
+   If not NULL, the string is overwritten with this one, which
+   must have the same length.
+
+ \return
+   0 if the string has been found, 1 otherwise.
+*/
+static int
+TestSnapshotFind(const char * Filename, const char * Text, const char * Replacement)
+{
+    char * snapshotName = configuration_snapshot_name(Filename);
+    FILE * snapshot = NULL;
+    char buffer[1024];
+    size_t length = 0;
+    size_t textLength = strlen(Text);
+    size_t i;
+    int error = 1;
+
+    do {
+        if (snapshotName == NULL) {
+            break;
+        }
+
+        snapshot = fopen(snapshotName, "r+b");
+
+        if (snapshot == NULL) {
+            break;
+        }
+
+        length = fread(buffer, 1, sizeof(buffer), snapshot);
+
+        for (i = 0; i + textLength <= length; i++) {
+            if (memcmp(&buffer[i], Text, textLength) == 0) {
+                break;
+            }
+        }
+
+        if (i + textLength > length) {
+            break;
+        }
+
+        if (Replacement != NULL) {
+            if (fseek(snapshot, (long) i, SEEK_SET) != 0
+                || fwrite(Replacement, 1, textLength, snapshot) != textLength)
+            {
+                break;
+            }
+        }
+
+        error = 0;
+
+    } while (0);
+
+    if (snapshot && fclose(snapshot)) {
+        error = 1;
+    }
+
+    cbmlibmisc_strfree(snapshotName);
+
+    return error;
+}
+
+/*! \brief Set the modification time of the snapshot of a configuration file
+
+ \param Filename
+   The name of the configuration file.
+
+ \param Time
+   The new modification time.
+
+ \return
+   0 on success, 1 otherwise.
+*/
+static int
+TestSnapshotTimeSet(const char * Filename, time_t Time)
+{
+    char * snapshotName = configuration_snapshot_name(Filename);
+    struct utimbuf times;
+    int error = 1;
+
+    times.actime = Time;
+    times.modtime = Time;
+
+    if (snapshotName != NULL) {
+        error = utime(snapshotName, &times) != 0;
+    }
+
+    cbmlibmisc_strfree(snapshotName);
+
+    return error;
+}
+
+/*! \brief Get the modification time of the snapshot of a configuration file
+
+ \param Filename
+   The name of the configuration file.
+
+ \return
+   The modification time; 0 if there is no snapshot.
+*/
+static time_t
+TestSnapshotTimeGet(const char * Filename)
+{
+    char * snapshotName = configuration_snapshot_name(Filename);
+    struct stat statbuf;
+    time_t time = 0;
+
+    if (snapshotName != NULL && stat(snapshotName, &statbuf) == 0) {
+        time = statbuf.st_mtime;
+    }
+
+    cbmlibmisc_strfree(snapshotName);
+
+    return time;
+}
+
 /*! \brief Simple test case for configuration
 
  This function implements a very simple test case for
@@ -1719,6 +2953,148 @@ opencbm_configuration_enum_sections(opencbm_configuration_handle Handle,
             break;
         }
 
+
+        /* the cache: a file which has not changed is not read again */
+
+        OpStart("TestFileWrite(\"TestCache.inf\", \"Entry=one\")");
+        if (TestFileWrite("TestCache.inf", "[Sect]\nEntry=one\n")) {
+            break;
+        }
+        TestWaitNotRecent();
+
+        {
+            opencbm_configuration_handle cachedHandle = NULL;
+
+            OpStart("TestValueCheck(\"TestCache.inf\", \"one\")");
+            if (TestValueCheck("TestCache.inf", "one", &cachedHandle)) {
+                break;
+            }
+
+            OpStart("TestValueCheck(\"TestCache.inf\", \"one\"), from the cache");
+            if (TestValueCheck("TestCache.inf", "one", &handle) || handle != cachedHandle) {
+                break;
+            }
+        }
+
+
+        /* the cache: an edited file is read again */
+
+        OpStart("opencbm_configuration_set_data(\"Sect\", \"Entry\", \"two\")");
+        handle = opencbm_configuration_open("TestCache.inf");
+        if (handle == NULL
+            || opencbm_configuration_set_data(handle, "Sect", "Entry", "two")
+            || opencbm_configuration_close(handle))
+        {
+            break;
+        }
+        TestWaitNotRecent();
+
+        OpStart("TestValueCheck(\"TestCache.inf\", \"two\"), after set_data()");
+        if (TestValueCheck("TestCache.inf", "two", NULL)) {
+            break;
+        }
+
+        OpStart("TestFileWrite(\"TestCache.inf\", \"Entry=six\"), in place");
+        {
+            FILE * file = fopen("TestCache.inf", "r+t");
+
+            if (file == NULL) {
+                break;
+            }
+
+            if (fputs("[Sect]\nEntry=six\n", file) < 0 || fclose(file)) {
+                break;
+            }
+        }
+        TestWaitNotRecent();
+
+        OpStart("TestValueCheck(\"TestCache.inf\", \"six\"), after an edit in place");
+        if (TestValueCheck("TestCache.inf", "six", NULL)) {
+            break;
+        }
+
+
+        /* the cache: a file renamed over the old one is read again */
+
+        OpStart("rename(\"TestCache.new\", \"TestCache.inf\")");
+        if (TestFileWrite("TestCache.new", "[Sect]\nEntry=ten\n")) {
+            break;
+        }
+        arch_unlink("TestCache.inf");
+        if (rename("TestCache.new", "TestCache.inf")) {
+            break;
+        }
+        TestWaitNotRecent();
+
+        OpStart("TestValueCheck(\"TestCache.inf\", \"ten\"), after a rename");
+        if (TestValueCheck("TestCache.inf", "ten", NULL)) {
+            break;
+        }
+
+
+        /* snapshots: a snapshot is written, and read instead of the file */
+
+        OpStart("putenv(\"" CONFIGURATION_SNAPSHOT_ENV "=.\")");
+        if (putenv(CONFIGURATION_SNAPSHOT_ENV "=.")) {
+            break;
+        }
+
+        TestCacheDrop();
+
+        OpStart("TestValueCheck(\"TestCache.inf\", \"ten\"), writing the snapshot");
+        if (TestValueCheck("TestCache.inf", "ten", NULL)
+            || TestSnapshotFind("TestCache.inf", "ten", NULL))
+        {
+            break;
+        }
+
+        /* the snapshot is written by renaming a new file over it;
+         * thus, its time only stays in the past if it is not written again
+         */
+
+        if (TestSnapshotTimeSet("TestCache.inf", 1000000000)) {
+            break;
+        }
+
+        TestCacheDrop();
+
+        OpStart("TestValueCheck(\"TestCache.inf\", \"ten\"), from the snapshot");
+        if (TestValueCheck("TestCache.inf", "ten", NULL)
+            || TestSnapshotTimeGet("TestCache.inf") != 1000000000)
+        {
+            break;
+        }
+
+
+        /* snapshots: a damaged snapshot is not used, but written again */
+
+        OpStart("TestSnapshotFind(\"TestCache.inf\", \"ten\", \"tan\")");
+        if (TestSnapshotFind("TestCache.inf", "ten", "tan")) {
+            break;
+        }
+
+        TestCacheDrop();
+
+        OpStart("TestValueCheck(\"TestCache.inf\", \"ten\"), with a damaged snapshot");
+        if (TestValueCheck("TestCache.inf", "ten", NULL)
+            || TestSnapshotFind("TestCache.inf", "ten", NULL))
+        {
+            break;
+        }
+
+        OpEnd();
+
+        {
+            char * snapshotName = configuration_snapshot_name("TestCache.inf");
+
+            if (snapshotName != NULL) {
+                arch_unlink(snapshotName);
+                cbmlibmisc_strfree(snapshotName);
+            }
+
+            arch_unlink("TestCache.inf");
+        }
+
         errorcode = EXIT_SUCCESS;
 
     } while(0);
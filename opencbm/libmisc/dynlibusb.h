@@ -67,6 +67,17 @@ struct usb_dll_s {
     struct usb_device * (LIBUSB_APIDECL *device)(usb_dev_handle *dev);
     struct usb_bus * (LIBUSB_APIDECL *get_busses)(void);
 
+    /*
+     * asynchronous transfers. These are optional: libusb-win32 has them,
+     * but the libusb 0.1 API on other platforms does not. Callers must
+     * check for NULL before using them.
+     */
+    int (LIBUSB_APIDECL *bulk_setup_async)(usb_dev_handle *dev, void **context, unsigned char ep);
+    int (LIBUSB_APIDECL *submit_async)(void *context, char *bytes, int size);
+    int (LIBUSB_APIDECL *reap_async)(void *context, int timeout);
+    int (LIBUSB_APIDECL *cancel_async)(void *context);
+    int (LIBUSB_APIDECL *free_async)(void **context);
+
 } usb_dll_t;
 
 extern usb_dll_t usb;
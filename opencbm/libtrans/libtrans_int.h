@@ -89,6 +89,7 @@ typedef struct {
 
 typedef struct {
     int (*upload)    (CBM_FILE fd, unsigned char drive);
+    int (*bootstrap) (CBM_FILE fd, unsigned char drive);
     int (*init)      (CBM_FILE fd, unsigned char drive);
     int (*read1byte) (CBM_FILE fd, unsigned char *c1);
     int (*read2byte) (CBM_FILE fd, unsigned char *c1, unsigned char *c2);
@@ -102,6 +103,7 @@ typedef struct {
     transfer_funcs libopencbmtransfer_ ## _name_ = \
     { \
         upload,     \
+        bootstrap,  \
         init,       \
         read1byte,  \
         read2byte,  \
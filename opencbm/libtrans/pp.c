@@ -22,6 +22,14 @@ static const unsigned char pp1571_drive_prog[] = {
 #include "pp1571.inc"
 };
 
+static const unsigned char pp1541_boot_drive_prog[] = {
+#include "pp1541boot.inc"
+};
+
+static const unsigned char pp1571_boot_drive_prog[] = {
+#include "pp1571boot.inc"
+};
+
 static int pp_write(CBM_FILE fd, unsigned char c1, unsigned char c2)
 {
                                                                         SETSTATEDEBUG((void)0);
@@ -86,14 +94,16 @@ static int pp_read(CBM_FILE fd, unsigned char *c1, unsigned char *c2)
 
 
 static int
-upload(CBM_FILE fd, unsigned char drive)
+pp_upload(CBM_FILE fd, unsigned char drive, int address,
+          const unsigned char *pp1541_prog, unsigned int pp1541_prog_length,
+          const unsigned char *pp1571_prog, unsigned int pp1571_prog_length)
 {
     enum cbm_device_type_e driveType;
     const unsigned char *pp_drive_prog = 0;
     unsigned int pp_drive_prog_length = 0;
     unsigned int bytesWritten;
 
-    if (cbm_identify(fd, drive, &driveType, NULL))
+    if (cbm_bus_identify(fd, drive, &driveType, NULL))
         return 1;
 
     switch (driveType)
@@ -104,15 +114,15 @@ upload(CBM_FILE fd, unsigned char drive)
 
     case cbm_dt_cbm1541:
         DBG_PRINT((DBG_PREFIX "recognized 1541."));
-        pp_drive_prog = pp1541_drive_prog;
-        pp_drive_prog_length = sizeof(pp1541_drive_prog);
+        pp_drive_prog = pp1541_prog;
+        pp_drive_prog_length = pp1541_prog_length;
         break;
 
     case cbm_dt_cbm1570:
     case cbm_dt_cbm1571:
         DBG_PRINT((DBG_PREFIX "recognized 1571."));
-        pp_drive_prog = pp1571_drive_prog;
-        pp_drive_prog_length = sizeof(pp1571_drive_prog);
+        pp_drive_prog = pp1571_prog;
+        pp_drive_prog_length = pp1571_prog_length;
         break;
 
     case cbm_dt_unknown:
@@ -123,7 +133,11 @@ upload(CBM_FILE fd, unsigned char drive)
         return 1;
     }
 
-    bytesWritten = cbm_upload(fd, drive, 0x700, pp_drive_prog, pp_drive_prog_length);
+    // the drive code cache cannot check code at $0300, where it runs itself
+    if (address == 0x300)
+        bytesWritten = cbm_upload(fd, drive, address, pp_drive_prog, pp_drive_prog_length);
+    else
+        bytesWritten = cbm_upload_cached(fd, drive, address, pp_drive_prog, pp_drive_prog_length);
 
     if (bytesWritten != pp_drive_prog_length)
     {
@@ -136,6 +150,22 @@ upload(CBM_FILE fd, unsigned char drive)
     return 0;
 }
 
+static int
+upload(CBM_FILE fd, unsigned char drive)
+{
+    return pp_upload(fd, drive, 0x700,
+        pp1541_drive_prog, sizeof(pp1541_drive_prog),
+        pp1571_drive_prog, sizeof(pp1571_drive_prog));
+}
+
+static int
+bootstrap(CBM_FILE fd, unsigned char drive)
+{
+    return pp_upload(fd, drive, 0x300,
+        pp1541_boot_drive_prog, sizeof(pp1541_boot_drive_prog),
+        pp1571_boot_drive_prog, sizeof(pp1571_boot_drive_prog));
+}
+
 static int
 init(CBM_FILE fd, unsigned char drive)
 {
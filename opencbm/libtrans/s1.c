@@ -18,6 +18,10 @@ static const unsigned char s1_drive_prog[] = {
 #include "s1.inc"
 };
 
+static const unsigned char s1_boot_drive_prog[] = {
+#include "s1boot.inc"
+};
+
 static int s1_write_byte_nohs(CBM_FILE fd, unsigned char c)
 {
     int b, i;
@@ -117,7 +121,7 @@ upload(CBM_FILE fd, unsigned char drive)
 {
     unsigned int bytesWritten;
 
-    bytesWritten = cbm_upload(fd, drive, 0x700, s1_drive_prog, sizeof(s1_drive_prog));
+    bytesWritten = cbm_upload_cached(fd, drive, 0x700, s1_drive_prog, sizeof(s1_drive_prog));
 
     if (bytesWritten != sizeof(s1_drive_prog))
     {
@@ -130,6 +134,25 @@ upload(CBM_FILE fd, unsigned char drive)
     return 0;
 }
 
+static int
+bootstrap(CBM_FILE fd, unsigned char drive)
+{
+    unsigned int bytesWritten;
+
+    // the drive code cache cannot check code at $0300, where it runs itself
+    bytesWritten = cbm_upload(fd, drive, 0x300, s1_boot_drive_prog, sizeof(s1_boot_drive_prog));
+
+    if (bytesWritten != sizeof(s1_boot_drive_prog))
+    {
+        DBG_ERROR((DBG_PREFIX "wanted to write %u bytes, but only %u "
+            "bytes could be written", sizeof(s1_boot_drive_prog), bytesWritten));
+
+        return 1;
+    }
+
+    return 0;
+}
+
 static int
 init(CBM_FILE fd, unsigned char drive)
 {
@@ -18,6 +18,10 @@ static const unsigned char s2_drive_prog[] = {
 #include "s2.inc"
 };
 
+static const unsigned char s2_boot_drive_prog[] = {
+#include "s2boot.inc"
+};
+
 static int s2_read_byte(CBM_FILE fd, unsigned char *c)
 {
     int i;
@@ -103,7 +107,7 @@ upload(CBM_FILE fd, unsigned char drive)
 {
     unsigned int bytesWritten;
 
-    bytesWritten = cbm_upload(fd, drive, 0x700, s2_drive_prog, sizeof(s2_drive_prog));
+    bytesWritten = cbm_upload_cached(fd, drive, 0x700, s2_drive_prog, sizeof(s2_drive_prog));
 
     if (bytesWritten != sizeof(s2_drive_prog))
     {
@@ -116,6 +120,25 @@ upload(CBM_FILE fd, unsigned char drive)
     return 0;
 }
 
+static int
+bootstrap(CBM_FILE fd, unsigned char drive)
+{
+    unsigned int bytesWritten;
+
+    // the drive code cache cannot check code at $0300, where it runs itself
+    bytesWritten = cbm_upload(fd, drive, 0x300, s2_boot_drive_prog, sizeof(s2_boot_drive_prog));
+
+    if (bytesWritten != sizeof(s2_boot_drive_prog))
+    {
+        DBG_ERROR((DBG_PREFIX "wanted to write %u bytes, but only %u "
+            "bytes could be written", sizeof(s2_boot_drive_prog), bytesWritten));
+
+        return 1;
+    }
+
+    return 0;
+}
+
 static int
 init(CBM_FILE fd, unsigned char drive)
 {
@@ -16,6 +16,25 @@ static const unsigned char turbomain_drive_prog[] = {
 #include "turbomain.inc"
 };
 
+static const unsigned char turboboot_drive_prog[] = {
+#include "turboboot.inc"
+};
+
+/*! the drive memory where the bootstrap loader puts its transfer routines */
+#define BOOTSTRAP_TRANSFER      0x0300
+
+/*! the drive memory where the bootstrap loader puts its main loop */
+#define BOOTSTRAP_MAIN          0x0400
+
+/*! the first byte after the bootstrap loader in the drive memory */
+#define BOOTSTRAP_END           0x0500
+
+/*! transfers shorter than this are not worth installing the bootstrap loader */
+#define BOOTSTRAP_MIN_LENGTH    0x0100
+
+/*! the command which makes the main loop return to the DOS */
+#define CMD_RETURN              0x02
+
 
 /*
 // functions to perform:
@@ -25,27 +44,35 @@ libopencbmtransfer_test()
 
 static transfer_funcs *current_transfer_funcs = &libopencbmtransfer_pp;
 
-int
-libopencbmtransfer_set_transfer(opencbm_transfer_t TransferType)
+static transfer_funcs *
+get_transfer_funcs(opencbm_transfer_t TransferType)
 {
     switch (TransferType)
     {
     case opencbm_transfer_serial1:
-        current_transfer_funcs = &libopencbmtransfer_s1;
-        break;
+        return &libopencbmtransfer_s1;
 
     case opencbm_transfer_serial2:
-        current_transfer_funcs = &libopencbmtransfer_s2;
-        break;
+        return &libopencbmtransfer_s2;
 
     case opencbm_transfer_parallel:
-        current_transfer_funcs = &libopencbmtransfer_pp;
-        break;
+        return &libopencbmtransfer_pp;
 
     default:
         printf("Unknown transfer type %u!\n", TransferType);
-        return 1;
+        return NULL;
     }
+}
+
+int
+libopencbmtransfer_set_transfer(opencbm_transfer_t TransferType)
+{
+    transfer_funcs *funcs = get_transfer_funcs(TransferType);
+
+    if (funcs == NULL)
+        return 1;
+
+    current_transfer_funcs = funcs;
 
     return 0;
 }
@@ -79,7 +106,7 @@ libopencbmtransfer_install(CBM_FILE HandleDevice, unsigned char DeviceAddress)
 
     FUNC_ENTER();
 
-    if (cbm_identify(HandleDevice, DeviceAddress, &cbmDeviceType, &cbmDeviceString))
+    if (cbm_bus_identify(HandleDevice, DeviceAddress, &cbmDeviceType, &cbmDeviceString))
     {
         error = 1;
         DBG_ERROR((DBG_PREFIX "cbm_identify returned with an error."));
@@ -100,7 +127,7 @@ libopencbmtransfer_install(CBM_FILE HandleDevice, unsigned char DeviceAddress)
 
         // Now, upload the main loop into the drive
 
-        bytesWritten = cbm_upload(HandleDevice, DeviceAddress, 0x500, 
+        bytesWritten = cbm_upload_cached(HandleDevice, DeviceAddress, 0x500, 
             turbomain_drive_prog, sizeof(turbomain_drive_prog));
 
         if (bytesWritten != sizeof(turbomain_drive_prog))
@@ -185,7 +212,7 @@ libopencbmtransfer_ll_read_mem(CBM_FILE HandleDevice, unsigned char DeviceAddres
 static int
 libopencbmtransfer_read_write_mem(CBM_FILE HandleDevice, unsigned char DeviceAddress,
                                   unsigned char Buffer[], unsigned int MemoryAddress, unsigned int Length,
-                                  ll_read_write_mem function)
+                                  ll_read_write_mem function, int ShowProgress)
 {
     const static char monkey[]={",oO*^!:;"};// for fast moves
 
@@ -195,9 +222,12 @@ libopencbmtransfer_read_write_mem(CBM_FILE HandleDevice, unsigned char DeviceAdd
                                                                         SETSTATEDEBUG(DebugBlockCount = 0);
     while (Length >= 0x100)
     {
-        int c = (Length >> 8) % (sizeof(monkey) - 1);
-        fprintf(stderr, (c != 0) ? "\b%c" : "\b.%c" , monkey[c]);
-        fflush(stderr);
+        if (ShowProgress)
+        {
+            int c = (Length >> 8) % (sizeof(monkey) - 1);
+            fprintf(stderr, (c != 0) ? "\b%c" : "\b.%c" , monkey[c]);
+            fflush(stderr);
+        }
 
                                                                         SETSTATEDEBUG(DebugBlockCount++);
         function(HandleDevice, DeviceAddress, Buffer, MemoryAddress, 0x00);
@@ -212,12 +242,16 @@ libopencbmtransfer_read_write_mem(CBM_FILE HandleDevice, unsigned char DeviceAdd
         unsigned int remainder = 0x100 - Length;
                                                                         SETSTATEDEBUG(DebugBlockCount++);
         //fprintf(stderr, "."); fflush(stderr);
-        fprintf(stderr, "\010.");
-        fflush(stderr);
+        if (ShowProgress)
+        {
+            fprintf(stderr, "\010.");
+            fflush(stderr);
+        }
         function(HandleDevice, DeviceAddress, Buffer, MemoryAddress - remainder, remainder);
     }
                                                                         SETSTATEDEBUG(DebugBlockCount = -1);
-    fprintf(stderr, "\010.\n");  // fflush(stderr);
+    if (ShowProgress)
+        fprintf(stderr, "\010.\n");  // fflush(stderr);
 
     FUNC_LEAVE_INT(0);
 }
@@ -227,7 +261,7 @@ libopencbmtransfer_read_mem(CBM_FILE HandleDevice, unsigned char DeviceAddress,
                             unsigned char Buffer[], unsigned int MemoryAddress, unsigned int Length)
 {
     return libopencbmtransfer_read_write_mem(HandleDevice, DeviceAddress,
-                                  Buffer, MemoryAddress, Length, libopencbmtransfer_ll_read_mem);
+                                  Buffer, MemoryAddress, Length, libopencbmtransfer_ll_read_mem, 1);
 }
 
 int
@@ -235,7 +269,7 @@ libopencbmtransfer_write_mem(CBM_FILE HandleDevice, unsigned char DeviceAddress,
                             unsigned char Buffer[], unsigned int MemoryAddress, unsigned int Length)
 {
     return libopencbmtransfer_read_write_mem(HandleDevice, DeviceAddress,
-                                  Buffer, MemoryAddress, Length, libopencbmtransfer_ll_write_mem);
+                                  Buffer, MemoryAddress, Length, libopencbmtransfer_ll_write_mem, 1);
 }
 
 int
@@ -243,3 +277,354 @@ libopencbmtransfer_remove(CBM_FILE HandleDevice, unsigned char DeviceAddress)
 {
     return libopencbmtransfer_execute_command(HandleDevice, DeviceAddress, 0xEBE7);
 }
+
+/*! \internal \brief Start the bootstrap loader in a drive
+
+ This function uploads the bootstrap loader, that is, the transfer
+ routines and the main loop, into the buffers at $0300 to $04FF of
+ the drive with plain "M-W" commands, and starts it.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param TransferType
+   The transfer protocol to use.
+
+ \param MemoryAddress
+   The start of the drive memory which is to be transferred.
+
+ \param Length
+   The number of bytes which are to be transferred.
+
+ \return
+   The transfer routines if the bootstrap loader is running in the
+   drive, NULL if the transfer has to be done with the plain DOS
+   commands. This is the case if the transfer is too short to be
+   worth the effort, if it overlaps the memory used by the bootstrap
+   loader, or if the drive is not a 1541, 1570 or 1571.
+*/
+static transfer_funcs *
+libopencbmtransfer_bootstrap(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                             opencbm_transfer_t TransferType,
+                             unsigned int MemoryAddress, unsigned int Length)
+{
+    enum cbm_device_type_e cbmDeviceType;
+    transfer_funcs *funcs;
+    char command[] = { 'M', '-', 'E', BOOTSTRAP_MAIN & 0xFF, BOOTSTRAP_MAIN >> 8 };
+
+    FUNC_ENTER();
+
+    // the zero page, the stack and the buffers used by the bootstrap
+    // loader cannot be transferred with it
+
+    if (Length < BOOTSTRAP_MIN_LENGTH || MemoryAddress < BOOTSTRAP_END)
+        FUNC_LEAVE_PTR(NULL, transfer_funcs *);
+
+    funcs = get_transfer_funcs(TransferType);
+
+    if (funcs == NULL
+        || cbm_bus_identify(HandleDevice, DeviceAddress, &cbmDeviceType, NULL) != 0)
+    {
+        FUNC_LEAVE_PTR(NULL, transfer_funcs *);
+    }
+
+    switch (cbmDeviceType)
+    {
+    case cbm_dt_cbm1541:
+    case cbm_dt_cbm1570:
+    case cbm_dt_cbm1571:
+        break;
+
+    default:
+        DBG_PRINT((DBG_PREFIX "no bootstrap loader for this drive type."));
+        FUNC_LEAVE_PTR(NULL, transfer_funcs *);
+    }
+
+    // checking the cached main loop runs the checksum routine at $0300,
+    // so the transfer routines have to be written after it
+
+    if (cbm_upload_cached(HandleDevice, DeviceAddress, BOOTSTRAP_MAIN,
+               turboboot_drive_prog, sizeof(turboboot_drive_prog)) != sizeof(turboboot_drive_prog)
+        || funcs->bootstrap(HandleDevice, DeviceAddress) != 0
+        || cbm_exec_command(HandleDevice, DeviceAddress, command, sizeof(command)) != 0)
+    {
+        DBG_ERROR((DBG_PREFIX "could not start the bootstrap loader."));
+        FUNC_LEAVE_PTR(NULL, transfer_funcs *);
+    }
+
+    funcs->init(HandleDevice, DeviceAddress);
+
+    FUNC_LEAVE_PTR(funcs, transfer_funcs *);
+}
+
+/*! \internal \brief Transfer memory with the bootstrap loader
+
+ Transfers memory from or to the drive with the bootstrap loader
+ started by libopencbmtransfer_bootstrap(). Afterwards, the bootstrap
+ loader returns to the DOS, and the bus is released.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param Funcs
+   The transfer routines returned by libopencbmtransfer_bootstrap().
+
+ \param Buffer
+   The buffer in the caller's address space.
+
+ \param MemoryAddress
+   The start of the drive memory which is to be transferred.
+
+ \param Length
+   The number of bytes which are to be transferred.
+
+ \param Function
+   libopencbmtransfer_ll_read_mem() or libopencbmtransfer_ll_write_mem().
+*/
+static void
+libopencbmtransfer_bootstrap_transfer(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                                      transfer_funcs *Funcs,
+                                      unsigned char Buffer[], unsigned int MemoryAddress,
+                                      unsigned int Length, ll_read_write_mem Function)
+{
+    transfer_funcs *old_transfer_funcs = current_transfer_funcs;
+
+    current_transfer_funcs = Funcs;
+
+    libopencbmtransfer_read_write_mem(HandleDevice, DeviceAddress,
+        Buffer, MemoryAddress, Length, Function, 0);
+
+    Funcs->write1byte(HandleDevice, CMD_RETURN);
+
+    current_transfer_funcs = old_transfer_funcs;
+
+    // the main loop keeps the handshake of CMD_RETURN until ATN and
+    // CLOCK are released, then it returns to the DOS
+
+    cbm_iec_release(HandleDevice, IEC_ATN);
+    cbm_iec_release(HandleDevice, IEC_CLOCK | IEC_DATA);
+}
+
+/*! \brief Write a program into a floppy's drive memory
+
+ This function is a replacement for cbm_upload() for long programs.
+ It installs a bootstrap loader into the drive memory at $0300 to $04FF
+ with "M-W" commands, which then receives the program with the given
+ fast transfer protocol. Thus, instead of one "M-W" command for every
+ 35 bytes, only a few bus transactions are needed.
+
+ If the program is short, or it overlaps the memory from $0000 to
+ $04FF, or the drive is not a 1541, 1570 or 1571, cbm_upload_cached()
+ is used instead.
+
+ The bootstrap loader is not resident after this function returns;
+ use libopencbmtransfer_install() for repeated transfers.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param TransferType
+   The transfer protocol to use.
+
+ \param DriveMemAddress
+   The address in the drive's memory where the program is to be
+   stored.
+
+ \param Program
+   Pointer to a byte buffer which holds the program in the
+   caller's address space.
+
+ \param Length
+   The size of the program to be stored, in bytes.
+
+ \return
+   Returns the number of bytes written into program memory.
+   If it does not equal Length, than an error occurred.
+   Specifically, -1 is returned on transfer errors.
+*/
+int
+libopencbmtransfer_upload(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                          opencbm_transfer_t TransferType, unsigned int DriveMemAddress,
+                          const unsigned char *Program, unsigned int Length)
+{
+    transfer_funcs *funcs;
+
+    FUNC_ENTER();
+
+    if (cbm_drive_code_resident(HandleDevice, DeviceAddress, DriveMemAddress, Program, Length))
+        FUNC_LEAVE_INT((int) Length);
+
+    funcs = libopencbmtransfer_bootstrap(HandleDevice, DeviceAddress, TransferType,
+        DriveMemAddress, Length);
+
+    if (funcs == NULL)
+        FUNC_LEAVE_INT(cbm_upload_cached(HandleDevice, DeviceAddress, DriveMemAddress, Program, Length));
+
+    libopencbmtransfer_bootstrap_transfer(HandleDevice, DeviceAddress, funcs,
+        (unsigned char *) Program, DriveMemAddress, Length, libopencbmtransfer_ll_write_mem);
+
+    cbm_drive_code_uploaded(HandleDevice, DeviceAddress, DriveMemAddress, Program, Length);
+
+    FUNC_LEAVE_INT((int) Length);
+}
+
+/*! \brief Read a floppy's drive memory
+
+ This function is a replacement for cbm_download() for large
+ memory regions. It uses the same bootstrap loader as
+ libopencbmtransfer_upload(), with the same restrictions.
+
+ \param HandleDevice
+   A CBM_FILE which contains the file handle of the driver.
+
+ \param DeviceAddress
+   The address of the device on the IEC serial bus. This
+   is known as primary address, too.
+
+ \param TransferType
+   The transfer protocol to use.
+
+ \param DriveMemAddress
+   The address in the drive's memory where the data is to be read
+   from.
+
+ \param Buffer
+   Pointer to a byte buffer which will hold the data in the
+   caller's address space.
+
+ \param Length
+   The number of bytes to read.
+
+ \return
+   Returns the number of bytes read from the drive memory.
+   If it does not equal Length, than an error occurred.
+   Specifically, -1 is returned on transfer errors.
+*/
+int
+libopencbmtransfer_download(CBM_FILE HandleDevice, unsigned char DeviceAddress,
+                            opencbm_transfer_t TransferType, unsigned int DriveMemAddress,
+                            unsigned char *Buffer, unsigned int Length)
+{
+    transfer_funcs *funcs;
+
+    FUNC_ENTER();
+
+    funcs = libopencbmtransfer_bootstrap(HandleDevice, DeviceAddress, TransferType,
+        DriveMemAddress, Length);
+
+    if (funcs == NULL)
+        FUNC_LEAVE_INT(cbm_download(HandleDevice, DeviceAddress, DriveMemAddress, Buffer, Length));
+
+    libopencbmtransfer_bootstrap_transfer(HandleDevice, DeviceAddress, funcs,
+        Buffer, DriveMemAddress, Length, libopencbmtransfer_ll_read_mem);
+
+    FUNC_LEAVE_INT((int) Length);
+}
+
+/* #define OPENCBM_STANDALONE_TEST 1 */
+
+#ifdef OPENCBM_STANDALONE_TEST
+
+/*
+ * Test that the bootstrap loader can be started more than once. The
+ * second time, the main loop is already in the drive code cache, and
+ * checking it runs the checksum routine of the cache at $0300.
+ *
+ * Build it in this directory after the libraries with e.g.
+ *   cc -DOPENCBM_STANDALONE_TEST -I../include -I../include/LINUX \
+ *      -o turbo-test turbo.c pp.lo s1.lo s2.lo -L../lib -L../arch/linux \
+ *      -L../libmisc -lopencbm -lmisc -larch
+ *
+ * and run it against the vdrive plugin, e.g.
+ *   ./turbo-test vdrive:test.d64,parallel=1
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int test_failures;
+
+#define TEST_CHECK(_x) \
+    do { \
+        if (!(_x)) \
+        { \
+            fprintf(stderr, "%s:%u: check failed: %s\n", __FILE__, __LINE__, #_x); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+/*! the drive memory the test transfers, the buffers #2 to #4 */
+#define TEST_MEMORY     0x0500
+
+/*! the number of bytes the test transfers */
+#define TEST_LENGTH     0x0300
+
+int
+main(int argc, char **argv)
+{
+    static const opencbm_transfer_t types[] = {
+        opencbm_transfer_serial1, opencbm_transfer_serial2, opencbm_transfer_parallel
+    };
+    static const char *names[] = { "serial1", "serial2", "parallel" };
+    unsigned char program[TEST_LENGTH], memory[TEST_LENGTH];
+    CBM_FILE fd;
+    unsigned int t, round, i;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <adapter>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (cbm_driver_open_ex(&fd, argv[1]) != 0)
+    {
+        fprintf(stderr, "cannot open the adapter %s.\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    // the transfer routines wait for the drive without a timeout
+
+    alarm(60);
+
+    for (t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+    {
+        for (round = 0; round < 2; round++)
+        {
+            for (i = 0; i < TEST_LENGTH; i++)
+                program[i] = (unsigned char) (t * 71 + round * 13 + i);
+            memset(memory, 0, sizeof(memory));
+
+            TEST_CHECK(libopencbmtransfer_upload(fd, 8, types[t], TEST_MEMORY,
+                           program, TEST_LENGTH) == TEST_LENGTH);
+            TEST_CHECK(libopencbmtransfer_download(fd, 8, types[t], TEST_MEMORY,
+                           memory, TEST_LENGTH) == TEST_LENGTH);
+            TEST_CHECK(memcmp(program, memory, TEST_LENGTH) == 0);
+        }
+        fprintf(stderr, "%s done.\n", names[t]);
+    }
+
+    cbm_driver_close(fd);
+
+    if (test_failures == 0)
+    {
+        fprintf(stderr, "success.\n");
+        return EXIT_SUCCESS;
+    }
+    fprintf(stderr, "%d checks failed.\n", test_failures);
+    return EXIT_FAILURE;
+}
+
+#endif /* #ifdef OPENCBM_STANDALONE_TEST */
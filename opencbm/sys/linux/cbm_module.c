@@ -45,11 +45,13 @@
 #endif
 
 #include <linux/delay.h>
+#include <linux/device.h>
 #include <linux/errno.h>
 #include <linux/fs.h>
 #include <linux/kernel.h>
 #include <linux/miscdevice.h>
 #include <linux/sched.h>
+#include <linux/ktime.h>
 
 #include <asm/uaccess.h>
 
@@ -232,6 +234,58 @@ static void timeout_us(int us)
 	schedule_timeout(HZ / 1000000 * us);
 }
 
+/*
+ *  wait while the bus is idle; with high resolution timers,
+ *  this does not keep the CPU busy
+ */
+static void idle_us(unsigned long us)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,36)
+	usleep_range(us, us + us / 2);
+#else
+	udelay(us);
+#endif
+}
+
+/*
+ *  timing statistics of the transfers, shown in sysfs
+ */
+enum { STATS_READ, STATS_WRITE, STATS_BLOCK, STATS_COUNT };
+
+static const char *const stats_name[STATS_COUNT] = {
+	"read", "write", "block"
+};
+
+static struct cbm_stats {
+	unsigned long transfers;	/* number of transfers */
+	unsigned long errors;		/* transfers which failed */
+	unsigned long long bytes;	/* bytes transferred */
+	unsigned long long ns;		/* time spent in the transfers */
+	unsigned long long max_ns;	/* longest transfer */
+	unsigned long last_bytes;	/* bytes of the last transfer */
+	unsigned long long last_ns;	/* time of the last transfer */
+} stats[STATS_COUNT];
+
+static void stats_account(int which, ktime_t start, long rv)
+{
+	struct cbm_stats *st = &stats[which];
+	unsigned long long ns;
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	st->transfers++;
+	if (rv < 0) {
+		st->errors++;
+		rv = 0;
+	}
+	st->bytes += rv;
+	st->ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+	st->last_bytes = rv;
+	st->last_ns = ns;
+}
+
 static int check_if_bus_free(void)
 {
 	int ret = 0;
@@ -363,31 +417,102 @@ static void wait_for_listener(void)
 	DPRINTK_INT("cbm: wait_for_listener() got an interrupt\n");
 }
 
+/*
+ *  the fast protocols, see cbm_protocol.h
+ */
+static int proto_idle(void)
+{
+	idle_us(50);
+	return signal_pending(current) ? -EINTR : 0;
+}
+
+#define PROTO_IDLE() proto_idle()
+
+#include "cbm_protocol.h"
+
+/*
+ *  transfer a block with a fast protocol, 256 bytes at a time
+ */
+static long cbm_block_transfer(int proto, int write,
+			       PARBURST_RW_VALUE *user_val)
+{
+	PARBURST_RW_VALUE kernel_val;
+	unsigned char chunk[256];
+	int done = 0;
+	int n, rv = 0;
+	ktime_t start = ktime_get();
+
+	if (copy_from_user(&kernel_val, user_val, sizeof(PARBURST_RW_VALUE)))
+		return -EFAULT;
+	if (kernel_val.length < 0)
+		return -EINVAL;
+
+	while (done < kernel_val.length) {
+		n = kernel_val.length - done;
+		if (n > sizeof(chunk))
+			n = sizeof(chunk);
+
+		if (write) {
+			if (copy_from_user(chunk, kernel_val.buffer + done, n))
+				return -EFAULT;
+			rv = proto_write_n(proto, chunk, n);
+		} else {
+			rv = proto_read_n(proto, chunk, n);
+			if (rv > 0
+			    && copy_to_user(kernel_val.buffer + done, chunk, rv))
+				return -EFAULT;
+		}
+		if (rv < 0)
+			break;
+		done += rv;
+		if (rv < n)
+			break;
+		schedule();
+	}
+
+	DPRINTK("block transfer: proto=%d, write=%d, %d of %d bytes, rv=%d\n",
+		proto, write, done, kernel_val.length, rv);
+
+	rv = done ? done : rv;
+	stats_account(STATS_BLOCK, start, rv);
+	return rv;
+}
+
 static ssize_t cbm_read(struct file *f, char *buf, size_t count, loff_t *ppos)
 {
+	unsigned char chunk[256];
+	size_t pending = 0;
 	size_t received = 0;
 	int i, b, bit;
 	int ok = 0;
+	int rv = 0;
 	unsigned long flags;
+	ktime_t start;
 
 	DPRINTK("cbm_read: %zu bytes\n", count);
 
 	if (eoi)
 		return 0;
 
+	start = ktime_get();
+
 	do {
 		i = 0;
 		while (GET(CLK_IN)) {
 			if (i >= 50) {
 				current->state = TASK_INTERRUPTIBLE;
 				schedule_timeout(HZ / 50);
-				if (signal_pending(current))
-					return -EINTR;
+				if (signal_pending(current)) {
+					rv = -EINTR;
+					break;
+				}
 			} else {
 				i++;
-				udelay(20);
+				idle_us(20);
 			}
 		}
+		if (rv)
+			break;
 		local_irq_save(flags);
 		RELEASE(DATA_OUT);
 		for (i = 0; (i < 40) && !(ok = GET(CLK_IN)); i++)
@@ -418,33 +543,49 @@ static ssize_t cbm_read(struct file *f, char *buf, size_t count, loff_t *ppos)
 		local_irq_restore(flags);
 		if (ok) {
 			received++;
-			put_user((char)b, buf++);
+			chunk[pending++] = b;
 
-			if (received % 256)
-				udelay(50);
-			else
+			/* hand the bytes to the caller in one go */
+			if (pending == sizeof(chunk)) {
+				if (copy_to_user(buf, chunk, pending)) {
+					rv = -EFAULT;
+					break;
+				}
+				buf += pending;
+				pending = 0;
 				schedule();
+			} else {
+				idle_us(50);
+			}
 		}
 
 	} while (received < count && ok && !eoi);
 
-	if (!ok) {
+	if (rv == 0 && !ok) {
 		printk("cbm_read: I/O error\n");
-		return -EIO;
+		rv = -EIO;
 	}
 
+	if (rv == 0 && pending && copy_to_user(buf, chunk, pending))
+		rv = -EFAULT;
+
 	DPRINTK("received=%zu, count=%zu, ok=%d, eoi=%d\n",
 		received, count, ok, eoi);
 
-	return received;
+	if (rv == 0)
+		rv = received;
+	stats_account(STATS_READ, start, rv);
+	return rv;
 }
 
 static int cbm_raw_write(const char *buf, size_t cnt, int atn, int talk)
 {
+	unsigned char chunk[256];
 	unsigned char c;
 	int i;
 	int rv = 0;
 	size_t sent = 0;
+	size_t n;
 	unsigned long flags;
 
 	eoi = cbm_irq_count = 0;
@@ -467,11 +608,22 @@ static int cbm_raw_write(const char *buf, size_t cnt, int atn, int talk)
 	schedule_timeout(HZ / 50);	/* 20ms */
 
 	while (cnt > sent && rv == 0) {
-		if (atn == 0)
-			get_user(c, buf++);
-		else
-			c = *buf++;
-		udelay(50);
+		if (atn == 0) {
+			/* fetch the data from the caller in one go */
+			if (sent % sizeof(chunk) == 0) {
+				n = cnt - sent;
+				if (n > sizeof(chunk))
+					n = sizeof(chunk);
+				if (copy_from_user(chunk, buf + sent, n)) {
+					rv = -EFAULT;
+					break;
+				}
+			}
+			c = chunk[sent % sizeof(chunk)];
+		} else {
+			c = buf[sent];
+		}
+		idle_us(50);
 		if (GET(DATA_IN)) {
 			cbm_irq_count = ((sent == (cnt - 1))
 					 && (atn == 0)) ? 2 : 1;
@@ -482,7 +634,7 @@ static int cbm_raw_write(const char *buf, size_t cnt, int atn, int talk)
 			} else {
 				if (send_byte(c)) {
 					sent++;
-					udelay(100);
+					idle_us(100);
 				} else {
 					printk("cbm_write: I/O error\n");
 					rv = -EIO;
@@ -520,7 +672,12 @@ static int cbm_raw_write(const char *buf, size_t cnt, int atn, int talk)
 static ssize_t cbm_write(struct file *f, const char *buf, size_t cnt,
 			 loff_t *ppos)
 {
-	return cbm_raw_write(buf, cnt, 0, 0);
+	ktime_t start = ktime_get();
+	int rv;
+
+	rv = cbm_raw_write(buf, cnt, 0, 0);
+	stats_account(STATS_WRITE, start, rv);
+	return rv;
 }
 
 static long cbm_unlocked_ioctl(struct file *f,
@@ -757,6 +914,36 @@ static long cbm_unlocked_ioctl(struct file *f,
 		/* and do it: */
 		return cbm_parallel_burst_write_track(kernel_val.buffer,
 						      kernel_val.length);
+
+/* block transfers with the fast protocols */
+
+	case CBMCTRL_S1_READ_N:
+		return cbm_block_transfer(PROTO_S1, 0, (PARBURST_RW_VALUE *) arg);
+
+	case CBMCTRL_S1_WRITE_N:
+		return cbm_block_transfer(PROTO_S1, 1, (PARBURST_RW_VALUE *) arg);
+
+	case CBMCTRL_S2_READ_N:
+		return cbm_block_transfer(PROTO_S2, 0, (PARBURST_RW_VALUE *) arg);
+
+	case CBMCTRL_S2_WRITE_N:
+		return cbm_block_transfer(PROTO_S2, 1, (PARBURST_RW_VALUE *) arg);
+
+	case CBMCTRL_PP_DC_READ_N:
+		return cbm_block_transfer(PROTO_PP_DC, 0,
+					  (PARBURST_RW_VALUE *) arg);
+
+	case CBMCTRL_PP_DC_WRITE_N:
+		return cbm_block_transfer(PROTO_PP_DC, 1,
+					  (PARBURST_RW_VALUE *) arg);
+
+	case CBMCTRL_PP_CC_READ_N:
+		return cbm_block_transfer(PROTO_PP_CC, 0,
+					  (PARBURST_RW_VALUE *) arg);
+
+	case CBMCTRL_PP_CC_WRITE_N:
+		return cbm_block_transfer(PROTO_PP_CC, 1,
+					  (PARBURST_RW_VALUE *) arg);
 	}
 	return -EINVAL;
 }
@@ -836,6 +1023,43 @@ static struct miscdevice cbm_dev = {
 	.fops		= &cbm_fops,
 };
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,26)
+# define SYSFS_STATS
+#endif
+
+#ifdef SYSFS_STATS
+/*
+ *  /sys/class/misc/cbm/stats: one line per kind of transfer;
+ *  writing anything clears the counters
+ */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr,
+			  char *page)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < STATS_COUNT; i++) {
+		len += scnprintf(page + len, PAGE_SIZE - len,
+				 "%s transfers=%lu errors=%lu bytes=%llu ns=%llu"
+				 " max_ns=%llu last_bytes=%lu last_ns=%llu\n",
+				 stats_name[i], stats[i].transfers,
+				 stats[i].errors, stats[i].bytes, stats[i].ns,
+				 stats[i].max_ns, stats[i].last_bytes,
+				 stats[i].last_ns);
+	}
+	return len;
+}
+
+static ssize_t stats_store(struct device *dev, struct device_attribute *attr,
+			   const char *page, size_t count)
+{
+	memset(stats, 0, sizeof(stats));
+	return count;
+}
+
+static DEVICE_ATTR(stats, 0644, stats_show, stats_store);
+#endif /* SYSFS_STATS */
+
 void cbm_cleanup(void)
 {
 #ifdef DIRECT_PORT_ACCESS
@@ -845,6 +1069,9 @@ void cbm_cleanup(void)
 	DPRINTK("releasing parallel port\n");
 	parport_release(cbm_device);
 	parport_unregister_device(cbm_device);
+#endif
+#ifdef SYSFS_STATS
+	device_remove_file(cbm_dev.this_device, &dev_attr_stats);
 #endif
 	misc_deregister(&cbm_dev);
 }
@@ -894,6 +1121,11 @@ int cbm_init(void)
 #endif
 	misc_register(&cbm_dev);
 
+#ifdef SYSFS_STATS
+	if (device_create_file(cbm_dev.this_device, &dev_attr_stats))
+		printk("cbm_init: could not create the statistics in sysfs\n");
+#endif
+
 #ifdef DIRECT_PORT_ACCESS
 	in_port = port + 1;
 	out_port = port + 2;
@@ -0,0 +1,338 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * The handshake protocols of the drive side turbo routines (serial1,
+ * serial2 and the two parallel flavours of d64copy and cbmcopy), for
+ * whole blocks of bytes.
+ *
+ * They are the same as the byte routines in libd64copy and libcbmcopy,
+ * but running in the driver, they need no system call per line change.
+ *
+ * This file only uses the line primitives of its includer, thus, it
+ * can be built against a simulated parallel port as well:
+ *
+ *   GET(line)            1 if the input line (DATA_IN, CLK_IN) is active
+ *   SET(lines)           activate the output lines (DATA_OUT, CLK_OUT, ATN_OUT)
+ *   RELEASE(lines)       release the output lines
+ *   SET_RELEASE(s,r)     both at once
+ *   XP_READ()            read the data register of the port
+ *   XP_WRITE(c)          write the data register of the port
+ *   set_data_forward()   switch the data register to output, and
+ *   set_data_reverse()   to input, both updating data_reverse
+ *   udelay(us)           busy wait
+ *   PROTO_IDLE()         called when the drive takes long to answer;
+ *                        returns a negative error code to abort
+ *
+ * All functions return the number of bytes transferred, or a negative
+ * error code if nothing was transferred.
+ *
+ * cbm_protocol_test.c runs them in user space against a simulated drive.
+ */
+
+#ifndef CBM_PROTOCOL_H
+#define CBM_PROTOCOL_H
+
+#define PROTO_S1     0
+#define PROTO_S2     1
+#define PROTO_PP_DC  2
+#define PROTO_PP_CC  3
+
+/* the time for the IEC lines to change */
+#define PROTO_SETTLE()  udelay(2)
+
+/* polls before PROTO_IDLE() is called while waiting for the drive */
+#define PROTO_SPIN      200
+
+static int proto_wait(unsigned char line, int state)
+{
+	int i = 0;
+	int rv;
+
+	while (GET(line) != state) {
+		if (i < PROTO_SPIN) {
+			i++;
+			udelay(1);
+		} else {
+			rv = PROTO_IDLE();
+			if (rv < 0)
+				return rv;
+		}
+	}
+	return 0;
+}
+
+/*
+ * the parallel port direction; d64copy gives the drive time to take
+ * the last byte and to turn its own port, before the cable is turned
+ */
+static void proto_pp_forward(int settle)
+{
+	if (data_reverse) {
+		if (settle)
+			udelay(100);
+		set_data_forward();
+	}
+}
+
+static void proto_pp_reverse(int settle)
+{
+	if (!data_reverse) {
+		if (settle)
+			udelay(100);
+		XP_WRITE(0xff);
+		set_data_reverse();
+	}
+}
+
+/*
+ *  serial1: one bit at a time on DATA, handshaked with CLK
+ */
+static int proto_s1_write_byte(unsigned char c)
+{
+	int i, b, rv;
+
+	for (i = 7; i >= 0; i--) {
+		b = (c >> i) & 1;
+		if (b)
+			SET(DATA_OUT);
+		else
+			RELEASE(DATA_OUT);
+		PROTO_SETTLE();
+		RELEASE(CLK_OUT);
+		PROTO_SETTLE();
+		if ((rv = proto_wait(CLK_IN, 1)) < 0)
+			return rv;
+		if (b)
+			RELEASE(DATA_OUT);
+		else
+			SET(DATA_OUT);
+		if ((rv = proto_wait(CLK_IN, 0)) < 0)
+			return rv;
+		SET_RELEASE(CLK_OUT, DATA_OUT);
+		PROTO_SETTLE();
+		if ((rv = proto_wait(DATA_IN, 1)) < 0)
+			return rv;
+	}
+	return 0;
+}
+
+static int proto_s1_read_byte(void)
+{
+	int i, b, rv;
+	unsigned char c = 0;
+
+	for (i = 7; i >= 0; i--) {
+		if ((rv = proto_wait(DATA_IN, 0)) < 0)
+			return rv;
+		RELEASE(CLK_OUT);
+		PROTO_SETTLE();
+		b = GET(CLK_IN);
+		c = (c >> 1) | (b ? 0x80 : 0);
+		SET(DATA_OUT);
+		if ((rv = proto_wait(CLK_IN, !b)) < 0)
+			return rv;
+		RELEASE(DATA_OUT);
+		PROTO_SETTLE();
+		if ((rv = proto_wait(DATA_IN, 1)) < 0)
+			return rv;
+		SET(CLK_OUT);
+	}
+	return c;
+}
+
+/*
+ *  serial2: two bits at a time on DATA, handshaked with ATN and CLK
+ */
+static int proto_s2_write_byte(unsigned char c)
+{
+	int i, rv;
+
+	for (i = 4; i > 0; i--) {
+		if (c & 1)
+			SET(DATA_OUT);
+		else
+			RELEASE(DATA_OUT);
+		c >>= 1;
+		PROTO_SETTLE();
+		RELEASE(ATN_OUT);
+		if ((rv = proto_wait(CLK_IN, 0)) < 0)
+			return rv;
+		if (c & 1)
+			SET(DATA_OUT);
+		else
+			RELEASE(DATA_OUT);
+		c >>= 1;
+		PROTO_SETTLE();
+		SET(ATN_OUT);
+		if ((rv = proto_wait(CLK_IN, 1)) < 0)
+			return rv;
+	}
+	RELEASE(DATA_OUT);
+	return 0;
+}
+
+static int proto_s2_read_byte(void)
+{
+	int i, rv;
+	unsigned char c = 0;
+
+	for (i = 4; i > 0; i--) {
+		if ((rv = proto_wait(CLK_IN, 0)) < 0)
+			return rv;
+		PROTO_SETTLE();
+		c = (c >> 1) | (GET(DATA_IN) ? 0x80 : 0);
+		RELEASE(ATN_OUT);
+		if ((rv = proto_wait(CLK_IN, 1)) < 0)
+			return rv;
+		PROTO_SETTLE();
+		c = (c >> 1) | (GET(DATA_IN) ? 0x80 : 0);
+		SET(ATN_OUT);
+	}
+	return c;
+}
+
+/*
+ *  parallel, d64copy flavour: two bytes per handshake on DATA
+ */
+static int proto_pp_dc_write_2(const unsigned char *c)
+{
+	int rv;
+
+	proto_pp_forward(1);
+	if ((rv = proto_wait(DATA_IN, 1)) < 0)
+		return rv;
+	XP_WRITE(c[0]);
+	udelay(1);
+	RELEASE(CLK_OUT);
+	if ((rv = proto_wait(DATA_IN, 0)) < 0)
+		return rv;
+	XP_WRITE(c[1]);
+	udelay(1);
+	SET(CLK_OUT);
+	return 0;
+}
+
+static int proto_pp_dc_read_2(unsigned char *c)
+{
+	int rv;
+
+	proto_pp_reverse(1);
+	if ((rv = proto_wait(DATA_IN, 1)) < 0)
+		return rv;
+	c[0] = XP_READ();
+	RELEASE(CLK_OUT);
+	if ((rv = proto_wait(DATA_IN, 0)) < 0)
+		return rv;
+	c[1] = XP_READ();
+	SET(CLK_OUT);
+	return 0;
+}
+
+/*
+ *  parallel, cbmcopy flavour: one byte per handshake on CLK and DATA
+ */
+static int proto_pp_cc_write_byte(unsigned char c)
+{
+	int rv;
+
+	proto_pp_forward(0);
+	XP_WRITE(c);
+	udelay(1);
+	RELEASE(CLK_OUT);
+	if ((rv = proto_wait(DATA_IN, 0)) < 0)
+		return rv;
+	SET(CLK_OUT);
+	if ((rv = proto_wait(DATA_IN, 1)) < 0)
+		return rv;
+	return 0;
+}
+
+static int proto_pp_cc_read_byte(void)
+{
+	int rv;
+	unsigned char c;
+
+	proto_pp_reverse(0);
+	RELEASE(CLK_OUT);
+	if ((rv = proto_wait(DATA_IN, 0)) < 0)
+		return rv;
+	c = XP_READ();
+	SET(CLK_OUT);
+	if ((rv = proto_wait(DATA_IN, 1)) < 0)
+		return rv;
+	return c;
+}
+
+static int proto_read_n(int proto, unsigned char *data, int size)
+{
+	int done = 0;
+	int rv = 0;
+
+	while (done < size && rv >= 0) {
+		switch (proto) {
+		case PROTO_S1:
+			rv = proto_s1_read_byte();
+			break;
+		case PROTO_S2:
+			rv = proto_s2_read_byte();
+			break;
+		case PROTO_PP_CC:
+			rv = proto_pp_cc_read_byte();
+			break;
+		case PROTO_PP_DC:
+			/* whole pairs only */
+			if (size - done < 2)
+				return done;
+			rv = proto_pp_dc_read_2(data + done);
+			if (rv >= 0)
+				done += 2;
+			continue;
+		default:
+			return -EINVAL;
+		}
+		if (rv >= 0)
+			data[done++] = rv;
+	}
+	return done ? done : rv;
+}
+
+static int proto_write_n(int proto, const unsigned char *data, int size)
+{
+	int done = 0;
+	int rv = 0;
+
+	while (done < size && rv >= 0) {
+		switch (proto) {
+		case PROTO_S1:
+			rv = proto_s1_write_byte(data[done]);
+			break;
+		case PROTO_S2:
+			rv = proto_s2_write_byte(data[done]);
+			break;
+		case PROTO_PP_CC:
+			rv = proto_pp_cc_write_byte(data[done]);
+			break;
+		case PROTO_PP_DC:
+			/* whole pairs only */
+			if (size - done < 2)
+				return done;
+			rv = proto_pp_dc_write_2(data + done);
+			if (rv >= 0)
+				done += 2;
+			continue;
+		default:
+			return -EINVAL;
+		}
+		if (rv >= 0)
+			done++;
+	}
+	return done ? done : rv;
+}
+
+#endif /* CBM_PROTOCOL_H */
@@ -0,0 +1,633 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * User space test of the block protocols in cbm_protocol.h.
+ *
+ * The line primitives cbm_protocol.h needs are implemented on a
+ * simulated XP1541 cable. The host side runs the protocol functions,
+ * and a thread plays the drive. The drive follows the transfer
+ * routines line for line:
+ *
+ *   serial1            libd64copy/s1.a65
+ *   serial2            libd64copy/s2.a65
+ *   parallel, d64copy  libd64copy/pp1571.a65
+ *   parallel, cbmcopy  libcbmcopy/ppr-1541.a65 and ppw-1541.a65
+ *
+ * This includes the ATN acknowledge of the drive, which pulls DATA
+ * while ATN and ATNA differ. Each round writes a random block to the
+ * drive and reads another one back; some rounds let the drive stop
+ * in the middle, to check the partial counts and the abort through
+ * PROTO_IDLE().
+ *
+ * Build with e.g.
+ *   cc -o cbm_protocol_test sys/linux/cbm_protocol_test.c -lpthread
+ * and run it with an optional seed and an optional number of rounds.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* the host side lines, named as in cbm_module.c */
+#define DATA_OUT	0x01
+#define CLK_OUT		0x02
+#define ATN_OUT		0x04
+#define DATA_IN		0x10
+#define CLK_IN		0x20
+#define ATN_IN		0x40
+
+/* the serial port of the drive at $1800 */
+#define VIA_DATA_IN	0x01
+#define VIA_DATA_OUT	0x02
+#define VIA_CLK_IN	0x04
+#define VIA_CLK_OUT	0x08
+#define VIA_ATNA_OUT	0x10
+#define VIA_ATN_IN	0x80
+
+/* the longest block of a round */
+#define TEST_MAX	256
+
+/* how long the host waits for a drive which stopped, in ms */
+#define TEST_STOP_MS	50
+
+/* how long the host waits at all, in ms */
+#define TEST_TIMEOUT_MS	5000
+
+static struct {
+	pthread_mutex_t lock;
+	unsigned char host_lines;	/* DATA_OUT, CLK_OUT and ATN_OUT */
+	unsigned char drive_port;	/* the last value written to $1800 */
+	unsigned char host_data;	/* the data register of the parallel port */
+	unsigned char drive_data;	/* the data register of the VIA of the drive */
+	int host_forward;		/* the host drives the parallel cable */
+	int drive_output;		/* the drive drives the parallel cable */
+	int conflicts;			/* reads while both sides drove the cable */
+	int stop;			/* the drive is to give up waiting */
+	int reading;			/* the host waits for the drive to send */
+	int drive_waiting;		/* the drive waits for the host */
+	struct timespec deadline;	/* the host gives up after this */
+} sim = { PTHREAD_MUTEX_INITIALIZER };
+
+/* the state of the includer, see cbm_module.c */
+static int data_reverse;
+
+/*
+ *  the lines as both sides see them
+ */
+static unsigned char sim_bus(void)
+{
+	int atn = (sim.host_lines & ATN_OUT) != 0;
+	int atna = (sim.drive_port & VIA_ATNA_OUT) != 0;
+	unsigned char bus = atn ? ATN_IN : 0;
+
+	if ((sim.host_lines & DATA_OUT) || (sim.drive_port & VIA_DATA_OUT) || atn != atna)
+		bus |= DATA_IN;
+	if ((sim.host_lines & CLK_OUT) || (sim.drive_port & VIA_CLK_OUT))
+		bus |= CLK_IN;
+	return bus;
+}
+
+static unsigned char sim_parallel(void)
+{
+	if (sim.host_forward && sim.drive_output)
+		sim.conflicts++;
+	if (sim.drive_output)
+		return sim.drive_data;
+	return sim.host_forward ? sim.host_data : 0xff;
+}
+
+/*
+ *  the primitives of the host side
+ */
+static int sim_get(unsigned char line)
+{
+	int rv;
+
+	pthread_mutex_lock(&sim.lock);
+	rv = (sim_bus() & line) != 0;
+	pthread_mutex_unlock(&sim.lock);
+	return rv;
+}
+
+static void sim_set_release(unsigned char set, unsigned char release)
+{
+	pthread_mutex_lock(&sim.lock);
+	sim.host_lines = (sim.host_lines | set) & ~release;
+	pthread_mutex_unlock(&sim.lock);
+}
+
+static unsigned char sim_xp_read(void)
+{
+	unsigned char c;
+
+	pthread_mutex_lock(&sim.lock);
+	c = sim_parallel();
+	pthread_mutex_unlock(&sim.lock);
+	return c;
+}
+
+static void sim_xp_write(unsigned char c)
+{
+	pthread_mutex_lock(&sim.lock);
+	sim.host_data = c;
+	pthread_mutex_unlock(&sim.lock);
+}
+
+static void sim_direction(int forward)
+{
+	pthread_mutex_lock(&sim.lock);
+	sim.host_forward = forward;
+	data_reverse = !forward;
+	pthread_mutex_unlock(&sim.lock);
+}
+
+static int sim_idle(void);
+
+/*
+ * The protocols only wait long for the drive to follow; this is
+ * done when the drive waits for the host again.
+ */
+static void udelay(int us)
+{
+	int waiting = 0;
+
+	while (us >= 100 && !waiting && sim_idle() == 0) {
+		pthread_mutex_lock(&sim.lock);
+		waiting = sim.drive_waiting;
+		pthread_mutex_unlock(&sim.lock);
+	}
+	sched_yield();
+}
+
+static int sim_idle(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > sim.deadline.tv_sec
+	    || (now.tv_sec == sim.deadline.tv_sec && now.tv_nsec > sim.deadline.tv_nsec))
+		return -ETIMEDOUT;
+	sched_yield();
+	return 0;
+}
+
+#define GET(line)		sim_get(line)
+#define SET(lines)		sim_set_release(lines, 0)
+#define RELEASE(lines)		sim_set_release(0, lines)
+#define SET_RELEASE(s,r)	sim_set_release(s, r)
+#define XP_READ()		sim_xp_read()
+#define XP_WRITE(c)		sim_xp_write(c)
+#define set_data_forward()	sim_direction(1)
+#define set_data_reverse()	sim_direction(0)
+#define PROTO_IDLE()		sim_idle()
+
+#include "cbm_protocol.h"
+
+/*
+ *  the drive
+ */
+static int drive_in(unsigned char *port, int waiting)
+{
+	unsigned char bus;
+	int stop;
+
+	pthread_mutex_lock(&sim.lock);
+	bus = sim_bus();
+	stop = sim.stop;
+	sim.drive_waiting = waiting;
+	pthread_mutex_unlock(&sim.lock);
+
+	*port = ((bus & DATA_IN) ? VIA_DATA_IN : 0)
+	      | ((bus & CLK_IN) ? VIA_CLK_IN : 0)
+	      | ((bus & ATN_IN) ? VIA_ATN_IN : 0);
+	return stop ? -1 : 0;
+}
+
+static void drive_out(unsigned char port)
+{
+	pthread_mutex_lock(&sim.lock);
+	sim.drive_port = port;
+	pthread_mutex_unlock(&sim.lock);
+}
+
+/* wait until the line is active (1) or released (0) */
+static int drive_wait(unsigned char line, int state)
+{
+	unsigned char port;
+
+	for (;;) {
+		if (drive_in(&port, 1))
+			return -1;
+		if (((port & line) != 0) == state)
+			break;
+		sched_yield();
+	}
+	drive_in(&port, 0);
+	return 0;
+}
+
+static int drive_line(unsigned char line)
+{
+	unsigned char port;
+
+	drive_in(&port, 0);
+	return (port & line) != 0;
+}
+
+static unsigned char drive_pp_read(void)
+{
+	unsigned char c;
+
+	pthread_mutex_lock(&sim.lock);
+	c = sim_parallel();
+	pthread_mutex_unlock(&sim.lock);
+	return c;
+}
+
+static void drive_pp_write(unsigned char c)
+{
+	pthread_mutex_lock(&sim.lock);
+	sim.drive_data = c;
+	pthread_mutex_unlock(&sim.lock);
+}
+
+/*
+ * Wait until the host reads. After the last byte, the drive routines
+ * return at once, but the programs using them work on the disk before
+ * they send anything; the host would miss the end of the handshake.
+ */
+static int drive_turn(void)
+{
+	int reading, stop;
+
+	for (;;) {
+		pthread_mutex_lock(&sim.lock);
+		reading = sim.reading;
+		stop = sim.stop;
+		sim.drive_waiting = !reading;
+		pthread_mutex_unlock(&sim.lock);
+		if (stop)
+			return -1;
+		if (reading)
+			return 0;
+		sched_yield();
+	}
+}
+
+static void drive_pp_output(int output)
+{
+	pthread_mutex_lock(&sim.lock);
+	sim.drive_output = output;
+	pthread_mutex_unlock(&sim.lock);
+}
+
+#define WAIT(line, state) \
+	do { if (drive_wait(line, state)) return -1; } while (0)
+
+/* s1.a65: gbyte and sbyte */
+static int drive_s1_get(unsigned char *c)
+{
+	int i, b;
+
+	for (i = 0; i < 8; i++) {
+		WAIT(VIA_CLK_IN, 0);
+		drive_out(0);
+		b = drive_line(VIA_DATA_IN);
+		*c = (*c << 1) | b;
+		drive_out(VIA_CLK_OUT);
+		WAIT(VIA_DATA_IN, !b);
+		drive_out(0);
+		WAIT(VIA_CLK_IN, 1);
+		drive_out(VIA_DATA_OUT);
+	}
+	return 0;
+}
+
+static int drive_s1_send(unsigned char c)
+{
+	unsigned char port;
+	int i;
+
+	for (i = 0; i < 8; i++, c >>= 1) {
+		port = (c & 1) ? VIA_CLK_OUT : 0;
+		drive_out(port);
+		WAIT(VIA_DATA_IN, 1);
+		drive_out(port ^ VIA_CLK_OUT);
+		WAIT(VIA_DATA_IN, 0);
+		drive_out(VIA_DATA_OUT);
+		WAIT(VIA_CLK_IN, 1);
+	}
+	return 0;
+}
+
+/* s2.a65: gbyte and sbyte */
+static int drive_s2_get(unsigned char *c)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		WAIT(VIA_ATN_IN, 0);
+		*c = (*c >> 1) | (drive_line(VIA_DATA_IN) ? 0x80 : 0);
+		drive_out(VIA_ATNA_OUT);
+		WAIT(VIA_ATN_IN, 1);
+		*c = (*c >> 1) | (drive_line(VIA_DATA_IN) ? 0x80 : 0);
+		drive_out(VIA_CLK_OUT);
+	}
+	return 0;
+}
+
+static int drive_s2_send(unsigned char c)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		drive_out(VIA_ATNA_OUT | ((c & 1) ? VIA_DATA_OUT : 0));
+		c >>= 1;
+		WAIT(VIA_ATN_IN, 0);
+		drive_out(VIA_CLK_OUT | ((c & 1) ? VIA_DATA_OUT : 0));
+		c >>= 1;
+		WAIT(VIA_ATN_IN, 1);
+	}
+	drive_out(VIA_CLK_OUT);
+	return 0;
+}
+
+/* pp1571.a65: gts and sblk, two bytes at a time */
+static int drive_pp_dc_get_2(unsigned char *c)
+{
+	drive_out(VIA_DATA_OUT);
+	WAIT(VIA_CLK_IN, 0);
+	c[0] = drive_pp_read();
+	drive_out(0);
+	WAIT(VIA_CLK_IN, 1);
+	c[1] = drive_pp_read();
+	return 0;
+}
+
+static int drive_pp_dc_send_2(const unsigned char *c)
+{
+	drive_pp_write(c[0]);
+	drive_out(VIA_DATA_OUT);
+	WAIT(VIA_CLK_IN, 0);
+	drive_pp_write(c[1]);
+	drive_out(0);
+	WAIT(VIA_CLK_IN, 1);
+	return 0;
+}
+
+/* ppw-1541.a65: gbyte */
+static int drive_pp_cc_get(unsigned char *c)
+{
+	WAIT(VIA_CLK_IN, 0);
+	*c = drive_pp_read();
+	drive_out(0);
+	WAIT(VIA_CLK_IN, 1);
+	drive_out(VIA_DATA_OUT);
+	return 0;
+}
+
+/* ppr-1541.a65: sbyte */
+static int drive_pp_cc_send(unsigned char c)
+{
+	drive_pp_write(c);
+	WAIT(VIA_CLK_IN, 0);
+	drive_out(0);
+	WAIT(VIA_CLK_IN, 1);
+	drive_out(VIA_DATA_OUT);
+	return 0;
+}
+
+/*
+ *  a round: the drive receives a block, and sends another one
+ */
+static struct {
+	int proto;
+	int size;			/* the bytes the protocol transfers */
+	int sent;			/* the drive stops sending after this */
+	unsigned char to_drive[TEST_MAX];
+	unsigned char received[TEST_MAX];
+	unsigned char from_drive[TEST_MAX];
+} job;
+
+static void *drive_thread(void *arg)
+{
+	int i, rv = 0;
+
+	if (job.proto == PROTO_PP_CC)
+		drive_pp_output(0);
+
+	for (i = 0; i < job.size && rv == 0; i++) {
+		switch (job.proto) {
+		case PROTO_S1:
+			rv = drive_s1_get(&job.received[i]);
+			break;
+		case PROTO_S2:
+			rv = drive_s2_get(&job.received[i]);
+			break;
+		case PROTO_PP_DC:
+			rv = drive_pp_dc_get_2(&job.received[i++]);
+			break;
+		case PROTO_PP_CC:
+			rv = drive_pp_cc_get(&job.received[i]);
+			break;
+		}
+	}
+
+	if (rv == 0)
+		rv = drive_turn();
+
+	if (job.proto == PROTO_PP_DC || job.proto == PROTO_PP_CC)
+		drive_pp_output(1);
+
+	for (i = 0; i < job.sent && rv == 0; i++) {
+		switch (job.proto) {
+		case PROTO_S1:
+			rv = drive_s1_send(job.from_drive[i]);
+			break;
+		case PROTO_S2:
+			rv = drive_s2_send(job.from_drive[i]);
+			break;
+		case PROTO_PP_DC:
+			rv = drive_pp_dc_send_2(&job.from_drive[i++]);
+			break;
+		case PROTO_PP_CC:
+			rv = drive_pp_cc_send(job.from_drive[i]);
+			break;
+		}
+	}
+
+	if (job.proto == PROTO_PP_DC)
+		drive_pp_output(0);
+
+	pthread_mutex_lock(&sim.lock);
+	sim.drive_waiting = 1;
+	pthread_mutex_unlock(&sim.lock);
+	return NULL;
+}
+
+static unsigned long test_seed;
+
+static unsigned int test_random(void)
+{
+	test_seed = test_seed * 1103515245ul + 12345ul;
+	return (unsigned int) (test_seed >> 16) & 0x7fff;
+}
+
+static void test_deadline(int ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, &sim.deadline);
+	sim.deadline.tv_sec += ms / 1000;
+	sim.deadline.tv_nsec += (ms % 1000) * 1000000l;
+	if (sim.deadline.tv_nsec >= 1000000000l) {
+		sim.deadline.tv_sec++;
+		sim.deadline.tv_nsec -= 1000000000l;
+	}
+}
+
+static int test_round(const char *name, int proto, unsigned int round)
+{
+	unsigned char from_host[TEST_MAX];
+	pthread_t drive;
+	int size, expected, rv;
+	int failed = 0;
+	int i;
+
+	/* a whole block every other round, else a random length */
+	size = (round & 1) ? TEST_MAX : (int) (test_random() % TEST_MAX) + 1;
+
+	/* the parallel routines of d64copy only transfer whole pairs */
+	job.proto = proto;
+	job.size = (proto == PROTO_PP_DC) ? size & ~1 : size;
+	job.sent = job.size;
+	if (round % 8 == 6)
+		job.sent = (int) (test_random() % (job.size + 1)) & ((proto == PROTO_PP_DC) ? ~1 : ~0);
+
+	for (i = 0; i < size; i++) {
+		job.to_drive[i] = (unsigned char) test_random();
+		job.from_drive[i] = (unsigned char) test_random();
+	}
+	memset(job.received, 0x55, sizeof(job.received));
+	memset(from_host, 0x55, sizeof(from_host));
+
+	/* the lines as the drive routines leave them after their init */
+	switch (proto) {
+	case PROTO_S1:
+		sim.host_lines = CLK_OUT;
+		sim.drive_port = VIA_DATA_OUT;
+		break;
+	case PROTO_S2:
+		sim.host_lines = ATN_OUT;
+		sim.drive_port = VIA_CLK_OUT;
+		break;
+	case PROTO_PP_DC:
+		sim.host_lines = CLK_OUT;
+		sim.drive_port = 0;
+		break;
+	case PROTO_PP_CC:
+		sim.host_lines = CLK_OUT;
+		sim.drive_port = VIA_DATA_OUT;
+		break;
+	}
+	sim.drive_output = 0;
+	sim.conflicts = 0;
+	sim.stop = 0;
+	sim.reading = 0;
+	sim.drive_waiting = 0;
+
+	if (pthread_create(&drive, NULL, drive_thread, NULL) != 0) {
+		fprintf(stderr, "%s: cannot start the drive\n", name);
+		return 1;
+	}
+
+	test_deadline(TEST_TIMEOUT_MS);
+	rv = proto_write_n(proto, job.to_drive, size);
+	if (rv != job.size) {
+		fprintf(stderr, "%s: round %u: wrote %d of %d bytes\n",
+			name, round, rv, size);
+		failed = 1;
+	}
+
+	if (!failed) {
+		test_deadline(job.sent < job.size ? TEST_STOP_MS : TEST_TIMEOUT_MS);
+		pthread_mutex_lock(&sim.lock);
+		sim.reading = 1;
+		pthread_mutex_unlock(&sim.lock);
+		rv = proto_read_n(proto, from_host, size);
+
+		/* if the drive stops, the bytes so far, or the error */
+		expected = job.sent;
+		if (job.sent < job.size && job.sent == 0)
+			expected = -ETIMEDOUT;
+
+		if (rv != expected) {
+			fprintf(stderr, "%s: round %u: read %d of %d bytes, expected %d\n",
+				name, round, rv, size, expected);
+			failed = 1;
+		}
+	}
+
+	pthread_mutex_lock(&sim.lock);
+	sim.stop = 1;
+	pthread_mutex_unlock(&sim.lock);
+	pthread_join(drive, NULL);
+
+	if (!failed && memcmp(job.received, job.to_drive, job.size) != 0) {
+		fprintf(stderr, "%s: round %u: the drive got other bytes\n", name, round);
+		failed = 1;
+	}
+	if (!failed && memcmp(from_host, job.from_drive, job.sent) != 0) {
+		fprintf(stderr, "%s: round %u: the host got other bytes\n", name, round);
+		failed = 1;
+	}
+	if (!failed && sim.conflicts != 0) {
+		fprintf(stderr, "%s: round %u: both sides drove the parallel cable\n",
+			name, round);
+		failed = 1;
+	}
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct {
+		const char *name;
+		int proto;
+	} protos[] = {
+		{ "serial1", PROTO_S1 },
+		{ "serial2", PROTO_S2 },
+		{ "parallel (d64copy)", PROTO_PP_DC },
+		{ "parallel (cbmcopy)", PROTO_PP_CC }
+	};
+	unsigned long seed = 1541;
+	unsigned int rounds = 100;
+	unsigned int p, round, failed = 0;
+
+	if (argc > 1)
+		seed = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		rounds = (unsigned int) strtoul(argv[2], NULL, 0);
+
+	sim_direction(1);
+
+	for (p = 0; p < sizeof(protos) / sizeof(protos[0]); p++) {
+		test_seed = seed;
+		for (round = 0; round < rounds; round++)
+			failed += test_round(protos[p].name, protos[p].proto, round);
+
+		fprintf(stderr, "%s: %u rounds with seed %lu done.\n",
+			protos[p].name, rounds, seed);
+	}
+
+	fprintf(stderr, failed ? "FAILED: %u rounds.\n" : "success.\n", failed);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
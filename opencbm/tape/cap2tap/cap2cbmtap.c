@@ -5,7 +5,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <Windows.h>
+#include "tapeport.h"
 
 #include "cap.h"
 #include "tap-cbm.h"
@@ -18,86 +18,8 @@
 #define FREQ_C16_PAL    886724
 #define FREQ_C16_NTSC   894886
 
-#define NeedEvenSplitNumber  0
-#define NeedOddSplitNumber   1
-#define NeedSplit            2
-#define NoSplit              3
-
-
-__int32 HandlePause(HANDLE hTAP, unsigned __int64 ui64Len, unsigned __int8 uiNeededSplit, unsigned __int8 TAPv, unsigned __int32 *puiCounter)
-{
-	unsigned __int32 numsplits, i;
-	__int32          FuncRes;
-
-	if (TAPv == TAPv2)
-	{
-		if (ui64Len > 0x00ffffff)
-		{
-			numsplits = (unsigned __int32) (ui64Len/0x00ffffff);
-			if ((ui64Len % 0x00ffffff) != 0) numsplits++;
-
-			if (((unsigned __int8)(numsplits % 2)) != uiNeededSplit) // NeedEvenSplitNumber=0 / NeedOddSplitNumber=1
-			{
-				// Split last 2 parts into 3, make sure last halfwave is not too short.
-				// Write (n-2) long ones, last two /3: 0.33 < length < 0.67.
-				//             even     odd      even
-				// |        |        |        |       *|
-				// |        |        |        |*       |
-				// |        |        |       *|        |
-				// |        |        |*       |        |
-				// |        |       *|        |        |
-				// |        |*       |        |        |
-
-				// First two 2/3-fractions, last 1/3 remaining.
-				for (i=1; i<=2; i++)
-				{
-					// Write 32bit unsigned integer to image file: LSB first, MSB last.
-					Check_TAP_CBM_Error_TextRetM1(TAP_CBM_WriteSignal_4Bytes(hTAP, 0x55555500, puiCounter));
-					ui64Len -= 0x00555555;
-				}
-			}
-			else if ((ui64Len % 0x00ffffff) < 0x007fffff)
-			{
-				// Make sure last halfwave is not too short: Pull 0x007fffff.
-				// Does not change numsplits.
-				// Write 32bit unsigned integer to image file: LSB first, MSB last.
-				Check_TAP_CBM_Error_TextRetM1(TAP_CBM_WriteSignal_4Bytes(hTAP, 0x7fffff00, puiCounter));
-				ui64Len -= 0x007fffff;
-			}
-		}
-	}
-
-	if ((TAPv == TAPv1) || (TAPv == TAPv2))
-	{
-		while (ui64Len > 0x00ffffff)
-		{
-			// Write 32bit unsigned integer to image file: LSB first, MSB last.
-			Check_TAP_CBM_Error_TextRetM1(TAP_CBM_WriteSignal_4Bytes(hTAP, 0xffffff00, puiCounter));
-			ui64Len -= 0x00ffffff;
-		}
-		if (ui64Len > 0)
-		{
-			// Write 32bit unsigned integer to image file: LSB first, MSB last.
-			Check_TAP_CBM_Error_TextRetM1(TAP_CBM_WriteSignal_4Bytes(hTAP, (unsigned __int32) ((ui64Len << 8) & 0xffffff00), puiCounter));
-		}
-	}
-
-	if (TAPv == TAPv0)
-	{
-		while (ui64Len > 2040)
-		{
-			Check_TAP_CBM_Error_TextRetM1(TAP_CBM_WriteSignal_1Byte(hTAP, 0, puiCounter));
-			ui64Len -= 2040;
-		}
-		if (ui64Len > 0)
-		{
-			Check_TAP_CBM_Error_TextRetM1(TAP_CBM_WriteSignal_1Byte(hTAP, 0, puiCounter));
-			ui64Len = 0;
-		}
-	}
-
-	return 0;
-}
+// Number of signals converted per block.
+#define SIGNAL_BLOCK_SIZE 4096
 
 
 __int32 Initialize_TAP_header_and_return_frequencies(HANDLE hCAP, HANDLE hTAP, unsigned __int32 *puiTimer_Precision_MHz, unsigned __int32 *puiFreq)
@@ -214,12 +136,15 @@ __int32 Initialize_TAP_header_and_return_frequencies(HANDLE hCAP, HANDLE hTAP, u
 // Convert CAP to CBM TAP format.
 __int32 CAP2CBMTAP(HANDLE hCAP, HANDLE hTAP)
 {
-	unsigned __int64 ui64Delta, ui64Delta2, ui64Len;
+	unsigned __int64 ui64Delta, ui64HalfWave = 0;
+	unsigned __int64 *pui64CAPSignals, *pui64TAPSignals;
 	unsigned __int32 Timer_Precision_MHz, uiFreq;
 	unsigned __int8  TAPv; // TAP file format version.
-	unsigned __int8  ch;   // Single TAP data byte.
-	__int32          TAP_Counter = 0; // CAP & TAP file byte counters.
+	unsigned __int8  HaveHalfWave = 0; // First halfwave of a TAPv0/v1 signal is in ui64HalfWave.
+	unsigned __int32 TAP_Counter = 0; // CAP & TAP file byte counters.
 	__int32          FuncRes, ReadFuncRes; // Function call results.
+	int              iNumSignals, iNumTAPSignals, i;
+	__int32          RetVal = 0;
 
 	if (Initialize_TAP_header_and_return_frequencies(hCAP, hTAP, &Timer_Precision_MHz, &uiFreq) != 0)
 		return -1;
@@ -247,52 +172,57 @@ __int32 CAP2CBMTAP(HANDLE hCAP, HANDLE hTAP)
 		return -1;
 	}
 
-	// Convert while CAP file signal available.
-	while ((ReadFuncRes = CAP_ReadSignal(hCAP, &ui64Delta, NULL)) == CAP_Status_OK)
+	pui64CAPSignals = (unsigned __int64 *) malloc(2 * SIGNAL_BLOCK_SIZE * sizeof(unsigned __int64));
+	if (pui64CAPSignals == NULL)
 	{
-		if ((TAPv == TAPv0) || (TAPv == TAPv1))
-		{
-			// Get and add timestamp of falling edge.
-			FuncRes = CAP_ReadSignal(hCAP, &ui64Delta2, NULL);
-			if (FuncRes == CAP_Status_Error_Reading_data)
-			{
-				CAP_OutputError(FuncRes);
-				return -1;
-			}
-			else if (FuncRes == CAP_Status_OK_End_of_file)
-				break;
-
-			ui64Delta += ui64Delta2;
-		}
+		printf("Error: Not enough memory for signal buffers.\n");
+		return -1;
+	}
+	pui64TAPSignals = &pui64CAPSignals[SIGNAL_BLOCK_SIZE];
 
-		ui64Len = (ui64Delta*uiFreq/Timer_Precision_MHz+500000)/1000000;
+	// Convert while CAP file signals available.
+	while ((ReadFuncRes = CAP_ReadSignals(hCAP, pui64CAPSignals, SIGNAL_BLOCK_SIZE, &iNumSignals, NULL)) == CAP_Status_OK)
+	{
+		iNumTAPSignals = 0;
 
-		if (ui64Len > 2040) // 8*0xff=2040
+		for (i = 0; i < iNumSignals; i++)
 		{
-			// We have a pause.
+			ui64Delta = pui64CAPSignals[i];
+
 			if ((TAPv == TAPv0) || (TAPv == TAPv1))
 			{
-				if (HandlePause(hTAP, ui64Len, NeedEvenSplitNumber, TAPv, &TAP_Counter) == -1)
-					return -1;
-			}
-			else
-			{
-				if (HandlePause(hTAP, ui64Len, NeedOddSplitNumber, TAPv, &TAP_Counter) == -1)
-					return -1;
+				// A TAPv0/v1 signal is a whole wave: add the falling edge
+				// halfwave, which may be in the next block.
+				if (!HaveHalfWave)
+				{
+					ui64HalfWave = ui64Delta;
+					HaveHalfWave = 1;
+					continue;
+				}
+
+				ui64Delta += ui64HalfWave;
+				HaveHalfWave = 0;
 			}
+
+			pui64TAPSignals[iNumTAPSignals++] = (ui64Delta*uiFreq/Timer_Precision_MHz+500000)/1000000;
 		}
-		else
+
+		FuncRes = TAP_CBM_WriteSignals(hTAP, pui64TAPSignals, iNumTAPSignals, &TAP_Counter);
+		if (FuncRes != TAP_CBM_Status_OK)
 		{
-			// We have a data byte.
-			ch = (unsigned __int8) ((ui64Len+4)/8);
-			Check_TAP_CBM_Error_TextRetM1(TAP_CBM_WriteSignal_1Byte(hTAP, ch, &TAP_Counter));
+			TAP_CBM_OutputError(FuncRes);
+			RetVal = -1;
+			goto exit;
 		}
-	} // Convert while CAP file signal available.
+	} // Convert while CAP file signals available.
 
-	if (ReadFuncRes == CAP_Status_Error_Reading_data)
+	// A halfwave left over at the end of a TAPv0/v1 conversion is dropped.
+
+	if (ReadFuncRes != CAP_Status_OK_End_of_file)
 	{
 		CAP_OutputError(ReadFuncRes);
-		return -1;
+		RetVal = -1;
+		goto exit;
 	}
 
 	// Set signal byte count in header (sum of all signal bytes).
@@ -300,7 +230,8 @@ __int32 CAP2CBMTAP(HANDLE hCAP, HANDLE hTAP)
 	if (FuncRes != TAP_CBM_Status_OK)
 	{
 		TAP_CBM_OutputError(FuncRes);
-		return -1;
+		RetVal = -1;
+		goto exit;
 	}
 
 	// Seek to start of file & write image header.
@@ -308,8 +239,12 @@ __int32 CAP2CBMTAP(HANDLE hCAP, HANDLE hTAP)
 	if (FuncRes != TAP_CBM_Status_OK)
 	{
 		TAP_CBM_OutputError(FuncRes);
-		return -1;
+		RetVal = -1;
+		goto exit;
 	}
 
-	return 0;
+exit:
+	free(pui64CAPSignals);
+
+	return RetVal;
 }
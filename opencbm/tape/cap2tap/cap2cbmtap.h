@@ -6,7 +6,7 @@
 #ifndef __CAP2CBMTAP_H_
 #define __CAP2CBMTAP_H_
 
-#include <Windows.h>
+#include "tapeport.h"
 
 // Convert CAP to CBM TAP format.
 __int32 CAP2CBMTAP(HANDLE hCAP, HANDLE hTAP);
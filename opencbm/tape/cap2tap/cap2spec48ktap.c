@@ -6,7 +6,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <Windows.h>
+#include "tapeport.h"
 
 #include "cap.h"
 
@@ -96,7 +96,7 @@ __int32 CAP2SPEC48KTAP(HANDLE hCAP, FILE *TapFile)
 	{
 		ui64Len = (ui64Delta+(Timer_Precision_MHz/2))/Timer_Precision_MHz;
 
-		if (DBGFLAG == 1) printf("%I64u ", ui64Len);
+		if (DBGFLAG == 1) printf("%" TAP_PRIu64 " ", ui64Len);
 		
 		LastPulse = Pulse;
 
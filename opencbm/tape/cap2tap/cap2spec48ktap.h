@@ -6,7 +6,7 @@
 #ifndef __CAP2SPEC48KTAP_H_
 #define __CAP2SPEC48KTAP_H_
 
-#include <Windows.h>
+#include "tapeport.h"
 
 // Convert CAP to Spectrum48K TAP format. *EXPERIMENTAL*
 __int32 CAP2SPEC48KTAP(HANDLE hCAP, FILE *TapFile);
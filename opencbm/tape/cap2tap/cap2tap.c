@@ -35,7 +35,7 @@ __int32 Evaluate_Commandline_Params(__int32 argc, __int8 *argv[])
 int ARCH_MAINDECL main(int argc, char *argv[])
 {
 	HANDLE          hCAP, hTAP;
-	FILE            *fd; // Experimental Spectrum48K support.
+	FILE            *fd = NULL; // Experimental Spectrum48K support.
 	unsigned __int8 CAP_Machine;
 	__int32         FuncRes, RetVal = -1;
 
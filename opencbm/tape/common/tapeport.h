@@ -0,0 +1,39 @@
+/*
+ *  CBM 1530/1531 tape routines.
+ *  Portability definitions, so the tape tools build on Windows and Linux.
+*/
+
+#ifndef __TAPEPORT_H_
+#define __TAPEPORT_H_
+
+#ifdef WIN32
+
+#include <Windows.h>
+
+// printf() formats for the 64 bit types
+#define TAP_PRIu64 "I64u"
+#define TAP_PRIX64 "I64X"
+
+#else
+
+#include <limits.h>
+
+// Sized integer types as used by the tape sources (MSVC builtins).
+#define __int8  char
+#define __int16 short
+#define __int32 int
+#define __int64 long long
+
+#define TAP_PRIu64 "llu"
+#define TAP_PRIX64 "llX"
+
+// Opaque image file handle as returned by CAP_/TAP_CBM_ functions.
+typedef void *HANDLE;
+
+#ifndef _MAX_PATH
+#define _MAX_PATH PATH_MAX
+#endif
+
+#endif
+
+#endif
@@ -6,8 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <Windows.h>
-#include <malloc.h>
+#include "tapeport.h"
 
 #include "cap.h"
 
@@ -16,6 +15,13 @@
 #define SEEK_START_OF_FILE 1
 #define SEEK_START_OF_DATA 2
 
+// Signal data is read and written in blocks of this size.
+#define CAP_Buffer_Size 0x10000
+
+#define BUFFER_IDLE  0
+#define BUFFER_READ  1
+#define BUFFER_WRITE 2
+
 #define DETAILED_INFO(rv) {fprintf(stderr, "Error : %d\nModule: %s\nBuilt : %s %s\nLine  : %d\n", rv, __FILE__, __DATE__, __TIME__, __LINE__);}
 
 #define ASSERT(x, rv) {if (!x) {DETAILED_INFO(rv); return rv;}}
@@ -26,10 +32,70 @@ typedef struct _INFOBLOCK {
 	char          header[Default_CAP_Header_Size+1]; // + 0-termination
 	unsigned char Machine, Video, StartEdge, SignalFormat;
 	unsigned int  Precision, SignalWidth, StartOfs;
+	unsigned char Buffer[CAP_Buffer_Size]; // Block buffer for signal data.
+	unsigned int  BufferPos;               // Next byte to read or write in Buffer.
+	unsigned int  BufferLen;               // Valid bytes in Buffer when reading.
+	int           BufferMode;              // BUFFER_IDLE, BUFFER_READ or BUFFER_WRITE.
 	unsigned int  MemTag2;
 } INFOBLOCK, *PINFOBLOCK;
 
 
+// Internal function.
+// Write pending signal data to the image file, or give back data read ahead.
+static int CAP_FlushBuffer(PINFOBLOCK pInfoBlock)
+{
+	int ret = CAP_Status_OK;
+
+	if ((pInfoBlock->BufferMode == BUFFER_WRITE) && (pInfoBlock->BufferPos > 0))
+	{
+		if (fwrite(pInfoBlock->Buffer, pInfoBlock->BufferPos, 1, pInfoBlock->fd) != 1)
+			ret = CAP_Status_Error_Writing_data;
+	}
+	else if ((pInfoBlock->BufferMode == BUFFER_READ) && (pInfoBlock->BufferPos < pInfoBlock->BufferLen))
+	{
+		// Move file pointer back to the first byte not yet returned.
+		if (fseek(pInfoBlock->fd, -(long)(pInfoBlock->BufferLen - pInfoBlock->BufferPos), SEEK_CUR) != 0)
+			ret = CAP_Status_Error_Seek_failed;
+	}
+
+	pInfoBlock->BufferMode = BUFFER_IDLE;
+	pInfoBlock->BufferPos = 0;
+	pInfoBlock->BufferLen = 0;
+
+	return ret;
+}
+
+
+// Internal function.
+// Refill read buffer, keeping the bytes not yet returned.
+static int CAP_FillBuffer(PINFOBLOCK pInfoBlock)
+{
+	unsigned int uiRemaining;
+	size_t       numread;
+	int          ret;
+
+	if (pInfoBlock->BufferMode != BUFFER_READ)
+	{
+		if ((ret = CAP_FlushBuffer(pInfoBlock)) != CAP_Status_OK)
+			return ret;
+		pInfoBlock->BufferMode = BUFFER_READ;
+	}
+
+	uiRemaining = pInfoBlock->BufferLen - pInfoBlock->BufferPos;
+	memmove(pInfoBlock->Buffer, &(pInfoBlock->Buffer[pInfoBlock->BufferPos]), uiRemaining);
+	pInfoBlock->BufferPos = 0;
+	pInfoBlock->BufferLen = uiRemaining;
+
+	numread = fread(&(pInfoBlock->Buffer[uiRemaining]), 1, CAP_Buffer_Size - uiRemaining, pInfoBlock->fd);
+	if ((numread == 0) && ferror(pInfoBlock->fd))
+		return CAP_Status_Error_Reading_data;
+
+	pInfoBlock->BufferLen += (unsigned int) numread;
+
+	return CAP_Status_OK;
+}
+
+
 // Exported function.
 // Create (overwrite) an image file for writing.
 int CAP_CreateFile(HANDLE *hHandle, char *pcFilename)
@@ -107,8 +173,18 @@ int CAP_CloseFile(HANDLE *hHandle)
 	ASSERT(pInfoBlock != 0, CAP_Status_Error_Invalid_Handle);
 
 	if (pInfoBlock->fd != NULL)
+	{
+		if (CAP_FlushBuffer(pInfoBlock) != CAP_Status_OK)
+		{
+			fclose(pInfoBlock->fd);
+			free(pInfoBlock);
+			*hHandle = NULL;
+			return CAP_Status_Error_Writing_data;
+		}
+
 		if (fclose(pInfoBlock->fd) != 0)
 			return CAP_Status_Error_Closing_file;
+	}
 
 	free(pInfoBlock);
 
@@ -140,6 +216,9 @@ int CAP_GetFileSize(HANDLE hHandle, int *piFileSize)
 	ASSERT(pInfoBlock != 0, CAP_Status_Error_Invalid_Handle);
 	ASSERT(piFileSize != 0, CAP_Status_Error_Invalid_pointer);
 
+	if (CAP_FlushBuffer(pInfoBlock) != CAP_Status_OK)
+		return CAP_Status_Error_Seek_failed;
+
 	if (fseek(pInfoBlock->fd, 0, SEEK_END) != 0)
 		return CAP_Status_Error_Seek_failed;
 
@@ -159,6 +238,9 @@ int CAP_SeekFile(HANDLE hHandle, char cDestination)
 	ASSERT(pInfoBlock != 0, CAP_Status_Error_Invalid_Handle);
 	ASSERT(pInfoBlock->fd != 0, CAP_Status_Error_File_not_open);
 
+	if (CAP_FlushBuffer(pInfoBlock) != CAP_Status_OK)
+		return CAP_Status_Error_Seek_failed;
+
 	if (cDestination == SEEK_START_OF_FILE)
 	{
 		if (fseek(pInfoBlock->fd, 0, SEEK_SET) != 0)
@@ -391,6 +473,9 @@ int CAP_WriteHeaderAddon(HANDLE hHandle, unsigned char *pucString, unsigned int
 	ASSERT(pInfoBlock != 0, CAP_Status_Error_Invalid_Handle);
 	ASSERT(pInfoBlock->fd != 0, CAP_Status_Error_File_not_open);
 
+	if (CAP_FlushBuffer(pInfoBlock) != CAP_Status_OK)
+		return CAP_Status_Error_Writing_header;
+
 	if (fwrite(pucString, uiStringLen, 1, pInfoBlock->fd) != 1)
 		return CAP_Status_Error_Writing_header;
 
@@ -399,81 +484,116 @@ int CAP_WriteHeaderAddon(HANDLE hHandle, unsigned char *pucString, unsigned int
 
 
 // Exported function.
-// Read a signal from image, increment byte counter.
-int CAP_ReadSignal(HANDLE hHandle, unsigned __int64 *pui64Signal, int *piCounter)
+// Read up to iMaxSignals signals from image, increment byte counter.
+int CAP_ReadSignals(HANDLE hHandle, unsigned __int64 *pui64Signals, int iMaxSignals, int *piNumSignals, int *piCounter)
 {
-	unsigned char    buf5[5]; // Compatible with 40bit signal width.
+	unsigned char    *pucData;
 	unsigned __int64 ui64Signal;
+	int              i, ret;
 
 	PINFOBLOCK pInfoBlock = (struct _INFOBLOCK*)hHandle;
 
 	ASSERT(pInfoBlock != 0, CAP_Status_Error_Invalid_Handle);
 	ASSERT(pInfoBlock->fd != 0, CAP_Status_Error_File_not_open);
-	ASSERT(pui64Signal != 0, CAP_Status_Error_Invalid_pointer);
+	ASSERT(pui64Signals != 0, CAP_Status_Error_Invalid_pointer);
+	ASSERT(piNumSignals != 0, CAP_Status_Error_Invalid_pointer);
 
-	if (fread(buf5, 5, 1, pInfoBlock->fd) != 1)
+	*piNumSignals = 0;
+
+	for (i = 0; i < iMaxSignals; i++)
 	{
-		if (feof(pInfoBlock->fd) == 0)
-			return CAP_Status_Error_Reading_data;
-		else
-			return CAP_Status_OK_End_of_file;
+		// Compatible with 40bit signal width.
+		if ((pInfoBlock->BufferMode != BUFFER_READ) || (pInfoBlock->BufferLen - pInfoBlock->BufferPos < 5))
+		{
+			if ((ret = CAP_FillBuffer(pInfoBlock)) != CAP_Status_OK)
+				return ret;
+
+			if (pInfoBlock->BufferLen - pInfoBlock->BufferPos < 5)
+				break; // End of file.
+		}
+
+		pucData = &(pInfoBlock->Buffer[pInfoBlock->BufferPos]);
+		pInfoBlock->BufferPos += 5;
+
+		ui64Signal = pucData[0];
+		ui64Signal = (ui64Signal << 8) + pucData[1];
+		ui64Signal = (ui64Signal << 8) + pucData[2];
+		ui64Signal = (ui64Signal << 8) + pucData[3];
+		ui64Signal = (ui64Signal << 8) + pucData[4];
+
+		pui64Signals[i] = ui64Signal;
 	}
 
-	ui64Signal = buf5[0];
-	ui64Signal = (ui64Signal << 8) + buf5[1];
-	ui64Signal = (ui64Signal << 8) + buf5[2];
-	ui64Signal = (ui64Signal << 8) + buf5[3];
-	ui64Signal = (ui64Signal << 8) + buf5[4];
-
-	*pui64Signal = ui64Signal;
+	*piNumSignals = i;
 
 	if (piCounter != NULL)
-		(*piCounter)+=5;
+		(*piCounter) += 5*i;
+
+	if ((i == 0) && (iMaxSignals > 0))
+		return CAP_Status_OK_End_of_file;
 
 	return CAP_Status_OK;
 }
 
 
-// Internal function.
-// Write a single byte to image, increment counter.
-int CAP_WriteSingleByte(HANDLE hHandle, unsigned char ucByte, int *piCounter)
+// Exported function.
+// Read a signal from image, increment byte counter.
+int CAP_ReadSignal(HANDLE hHandle, unsigned __int64 *pui64Signal, int *piCounter)
+{
+	int iNumSignals;
+
+	return CAP_ReadSignals(hHandle, pui64Signal, 1, &iNumSignals, piCounter);
+}
+
+
+// Exported function.
+// Write iNumSignals signals to image, increment counter for each written byte.
+int CAP_WriteSignals(HANDLE hHandle, unsigned __int64 *pui64Signals, int iNumSignals, int *piCounter)
 {
+	unsigned char    *pucData;
+	unsigned __int64 ui64Signal;
+	int              i;
+
 	PINFOBLOCK pInfoBlock = (struct _INFOBLOCK*)hHandle;
 
 	ASSERT(pInfoBlock != 0, CAP_Status_Error_Invalid_Handle);
+	ASSERT(pui64Signals != 0, CAP_Status_Error_Invalid_pointer);
 
 	if (pInfoBlock->fd == NULL)
 		return CAP_Status_Error_File_not_open;
 
-	if (fwrite(&ucByte, 1, 1, pInfoBlock->fd) != 1)
-		return CAP_Status_Error_Writing_data;
-
-	if (piCounter != NULL)
-		(*piCounter)++;
+	for (i = 0; i < iNumSignals; i++)
+	{
+		if ((pInfoBlock->BufferMode != BUFFER_WRITE) || (CAP_Buffer_Size - pInfoBlock->BufferPos < 5))
+		{
+			if (CAP_FlushBuffer(pInfoBlock) != CAP_Status_OK)
+				return CAP_Status_Error_Writing_data;
+			pInfoBlock->BufferMode = BUFFER_WRITE;
+		}
+
+		pucData = &(pInfoBlock->Buffer[pInfoBlock->BufferPos]);
+		pInfoBlock->BufferPos += 5;
+
+		ui64Signal = pui64Signals[i];
+		pucData[0] = (unsigned char) ((ui64Signal >> 32) & 0xff);
+		pucData[1] = (unsigned char) ((ui64Signal >> 24) & 0xff);
+		pucData[2] = (unsigned char) ((ui64Signal >> 16) & 0xff);
+		pucData[3] = (unsigned char) ((ui64Signal >>  8) & 0xff);
+		pucData[4] = (unsigned char) ((ui64Signal      ) & 0xff);
+
+		if (piCounter != NULL)
+			(*piCounter)+=5;
+	}
 
 	return CAP_Status_OK;
 }
 
+
 // Exported function.
 // Write a signal to image, increment counter for each written byte.
 int CAP_WriteSignal(HANDLE hHandle, unsigned __int64 ui64Signal, int *piCounter)
 {
-	if (CAP_WriteSingleByte( hHandle, (unsigned char) ((ui64Signal >> 32) & 0xff), piCounter ) != CAP_Status_OK)
-		return CAP_Status_Error_Writing_data;
-
-	if (CAP_WriteSingleByte( hHandle, (unsigned char) ((ui64Signal >> 24) & 0xff), piCounter ) != CAP_Status_OK)
-		return CAP_Status_Error_Writing_data;
-
-	if (CAP_WriteSingleByte( hHandle, (unsigned char) ((ui64Signal >> 16) & 0xff), piCounter ) != CAP_Status_OK)
-		return CAP_Status_Error_Writing_data;
-
-	if (CAP_WriteSingleByte( hHandle, (unsigned char) ((ui64Signal >> 8) & 0xff), piCounter ) != CAP_Status_OK)
-		return CAP_Status_Error_Writing_data;
-
-	if (CAP_WriteSingleByte( hHandle, (unsigned char) ((ui64Signal) & 0xff), piCounter ) != CAP_Status_OK)
-		return CAP_Status_Error_Writing_data;
-
-	return CAP_Status_OK;
+	return CAP_WriteSignals(hHandle, &ui64Signal, 1, piCounter);
 }
 
 
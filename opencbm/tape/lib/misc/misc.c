@@ -3,7 +3,7 @@
  *  Copyright 2012 Arnd Menge, arnd(at)jonnz(dot)de
 */
 
-#include <Windows.h>
+#include "tapeport.h"
 #include <stdio.h>
 
 #include "tape.h"
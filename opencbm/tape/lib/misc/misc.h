@@ -6,7 +6,7 @@
 #ifndef __TAP_MISC_H_
 #define __TAP_MISC_H_
 
-#include <Windows.h>
+#include "tapeport.h"
 
 // Macro to handle errors of called exported functions.
 #define	Check_CAP_Error_TextRetM1(FuncRes) \
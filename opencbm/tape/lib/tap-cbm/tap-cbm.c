@@ -6,8 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <Windows.h>
-#include <malloc.h>
+#include "tapeport.h"
 
 #include "tap-cbm.h"
 
@@ -16,6 +15,13 @@
 #define SEEK_START_OF_FILE 1
 #define SEEK_START_OF_DATA 2
 
+// Signal data is read and written in blocks of this size.
+#define TAP_CBM_Buffer_Size 0x10000
+
+#define BUFFER_IDLE  0
+#define BUFFER_READ  1
+#define BUFFER_WRITE 2
+
 #define DETAILED_INFO(rv) {fprintf(stderr, "Error : %d\nModule: %s\nBuilt : %s %s\nLine  : %d\n", rv, __FILE__, __DATE__, __TIME__, __LINE__);}
 
 #define ASSERT(x, rv) {if (!x) {DETAILED_INFO(rv); return rv;}}
@@ -26,10 +32,98 @@ typedef struct _INFOBLOCK {
 	char          header[Header_Size_TAP_CBM+1]; // + 0-termination
 	unsigned char Machine, Video, TAPversion;
 	unsigned int  ByteCount;
+	unsigned char Buffer[TAP_CBM_Buffer_Size]; // Block buffer for signal data.
+	unsigned int  BufferPos;                   // Next byte to read or write in Buffer.
+	unsigned int  BufferLen;                   // Valid bytes in Buffer when reading.
+	int           BufferMode;                  // BUFFER_IDLE, BUFFER_READ or BUFFER_WRITE.
 	unsigned int  MemTag2;
 } INFOBLOCK, *PINFOBLOCK;
 
 
+// Internal function.
+// Write pending signal data to the image file, or give back data read ahead.
+static int TAP_CBM_FlushBuffer(PINFOBLOCK pInfoBlock)
+{
+	int ret = TAP_CBM_Status_OK;
+
+	if ((pInfoBlock->BufferMode == BUFFER_WRITE) && (pInfoBlock->BufferPos > 0))
+	{
+		if (fwrite(pInfoBlock->Buffer, pInfoBlock->BufferPos, 1, pInfoBlock->fd) != 1)
+			ret = TAP_CBM_Status_Error_Writing_data;
+	}
+	else if ((pInfoBlock->BufferMode == BUFFER_READ) && (pInfoBlock->BufferPos < pInfoBlock->BufferLen))
+	{
+		// Move file pointer back to the first byte not yet returned.
+		if (fseek(pInfoBlock->fd, -(long)(pInfoBlock->BufferLen - pInfoBlock->BufferPos), SEEK_CUR) != 0)
+			ret = TAP_CBM_Status_Error_Seek_failed;
+	}
+
+	pInfoBlock->BufferMode = BUFFER_IDLE;
+	pInfoBlock->BufferPos = 0;
+	pInfoBlock->BufferLen = 0;
+
+	return ret;
+}
+
+
+// Internal function.
+// Make sure at least uiNeeded bytes are in the read buffer, unless the end of file is reached.
+static int TAP_CBM_FillBuffer(PINFOBLOCK pInfoBlock, unsigned int uiNeeded)
+{
+	unsigned int uiRemaining;
+	size_t       numread;
+	int          ret;
+
+	if (pInfoBlock->BufferMode != BUFFER_READ)
+	{
+		if ((ret = TAP_CBM_FlushBuffer(pInfoBlock)) != TAP_CBM_Status_OK)
+			return ret;
+		pInfoBlock->BufferMode = BUFFER_READ;
+	}
+
+	uiRemaining = pInfoBlock->BufferLen - pInfoBlock->BufferPos;
+	if (uiRemaining >= uiNeeded)
+		return TAP_CBM_Status_OK;
+
+	memmove(pInfoBlock->Buffer, &(pInfoBlock->Buffer[pInfoBlock->BufferPos]), uiRemaining);
+	pInfoBlock->BufferPos = 0;
+	pInfoBlock->BufferLen = uiRemaining;
+
+	numread = fread(&(pInfoBlock->Buffer[uiRemaining]), 1, TAP_CBM_Buffer_Size - uiRemaining, pInfoBlock->fd);
+	if ((numread == 0) && ferror(pInfoBlock->fd))
+		return TAP_CBM_Status_Error_Reading_data;
+
+	pInfoBlock->BufferLen += (unsigned int) numread;
+
+	return TAP_CBM_Status_OK;
+}
+
+
+// Internal function.
+// Append bytes to the write buffer.
+static int TAP_CBM_WriteBytes(PINFOBLOCK pInfoBlock, unsigned char *pucData, unsigned int uiLen)
+{
+	if (pInfoBlock->BufferMode != BUFFER_WRITE)
+	{
+		if (TAP_CBM_FlushBuffer(pInfoBlock) != TAP_CBM_Status_OK)
+			return TAP_CBM_Status_Error_Writing_data;
+		pInfoBlock->BufferMode = BUFFER_WRITE;
+	}
+
+	if (TAP_CBM_Buffer_Size - pInfoBlock->BufferPos < uiLen)
+	{
+		if (TAP_CBM_FlushBuffer(pInfoBlock) != TAP_CBM_Status_OK)
+			return TAP_CBM_Status_Error_Writing_data;
+		pInfoBlock->BufferMode = BUFFER_WRITE;
+	}
+
+	memcpy(&(pInfoBlock->Buffer[pInfoBlock->BufferPos]), pucData, uiLen);
+	pInfoBlock->BufferPos += uiLen;
+
+	return TAP_CBM_Status_OK;
+}
+
+
 // Exported function.
 // Create (overwrite) an image file for writing.
 int TAP_CBM_CreateFile(HANDLE *hHandle, char *pcFilename)
@@ -105,8 +199,18 @@ int TAP_CBM_CloseFile(HANDLE *hHandle)
 	ASSERT(pInfoBlock != 0, TAP_CBM_Status_Error_Invalid_Handle);
 
 	if (pInfoBlock->fd != NULL)
+	{
+		if (TAP_CBM_FlushBuffer(pInfoBlock) != TAP_CBM_Status_OK)
+		{
+			fclose(pInfoBlock->fd);
+			free(pInfoBlock);
+			*hHandle = NULL;
+			return TAP_CBM_Status_Error_Writing_data;
+		}
+
 		if (fclose(pInfoBlock->fd) != 0)
 			return TAP_CBM_Status_Error_Closing_file;
+	}
 
 	free(pInfoBlock);
 
@@ -139,6 +243,9 @@ int TAP_CBM_GetFileSize(HANDLE hHandle, int *piFileSize)
 	ASSERT(piFileSize != 0, TAP_CBM_Status_Error_Invalid_pointer);
 	ASSERT(pInfoBlock->fd != 0, TAP_CBM_Status_Error_File_not_open);
 
+	if (TAP_CBM_FlushBuffer(pInfoBlock) != TAP_CBM_Status_OK)
+		return TAP_CBM_Status_Error_Seek_failed;
+
 	if (fseek(pInfoBlock->fd, 0, SEEK_END) != 0)
 		return TAP_CBM_Status_Error_Seek_failed;
 
@@ -158,6 +265,9 @@ int TAP_CBM_SeekFile(HANDLE hHandle, char cDestination)
 	ASSERT(pInfoBlock != 0, TAP_CBM_Status_Error_Invalid_Handle);
 	ASSERT(pInfoBlock->fd != 0, TAP_CBM_Status_Error_File_not_open);
 
+	if (TAP_CBM_FlushBuffer(pInfoBlock) != TAP_CBM_Status_OK)
+		return TAP_CBM_Status_Error_Seek_failed;
+
 	if (cDestination == SEEK_START_OF_FILE)
 	{
 		if (fseek(pInfoBlock->fd, 0, SEEK_SET) != 0)
@@ -315,100 +425,261 @@ int TAP_CBM_WriteHeader(HANDLE hHandle)
 
 
 // Exported function.
-// Read a signal from image, increment counter for each read byte.
-int TAP_CBM_ReadSignal(HANDLE hHandle, unsigned int *puiSignal, unsigned int *puiCounter)
+// Read up to iMaxSignals signals (in cycles) from image, increment counter for each read byte.
+int TAP_CBM_ReadSignals(HANDLE hHandle, unsigned int *puiSignals, int iMaxSignals, int *piNumSignals, unsigned int *puiCounter)
 {
-	unsigned char buf3[3];
-	unsigned char ch;
-	unsigned int  uiSignal;
+	unsigned char *pucData;
+	unsigned int  uiSignal, uiLen;
+	int           i, ret;
 
 	PINFOBLOCK pInfoBlock = (struct _INFOBLOCK*)hHandle;
 
 	ASSERT(pInfoBlock != 0, TAP_CBM_Status_Error_Invalid_Handle);
 	ASSERT(pInfoBlock->fd != 0, TAP_CBM_Status_Error_File_not_open);
-	ASSERT(puiSignal != 0, TAP_CBM_Status_Error_Invalid_pointer);
+	ASSERT(puiSignals != 0, TAP_CBM_Status_Error_Invalid_pointer);
+	ASSERT(piNumSignals != 0, TAP_CBM_Status_Error_Invalid_pointer);
 	ASSERT(puiCounter != 0, TAP_CBM_Status_Error_Invalid_pointer);
 
-	if (fread(&ch, 1, 1, pInfoBlock->fd) != 1)
-	{
-		if (feof(pInfoBlock->fd) == 0)
-			return TAP_CBM_Status_Error_Reading_data;
-		else
-			return TAP_CBM_Status_OK_End_of_file;
-	}
+	*piNumSignals = 0;
 
-	if (ch == 0) // Pause detected.
+	for (i = 0; i < iMaxSignals; i++)
 	{
-		if (pInfoBlock->TAPversion == TAPv0)
-			*puiSignal = 2040; // 8*0xff=2040
-		else
+		if ((ret = TAP_CBM_FillBuffer(pInfoBlock, 4)) != TAP_CBM_Status_OK)
+			return ret;
+
+		if (pInfoBlock->BufferPos == pInfoBlock->BufferLen)
+			break; // End of file.
+
+		pucData = &(pInfoBlock->Buffer[pInfoBlock->BufferPos]);
+
+		if (pucData[0] == 0) // Pause detected.
 		{
-			if (fread(buf3, 3, 1, pInfoBlock->fd) != 1)
+			if (pInfoBlock->TAPversion == TAPv0)
 			{
-				if (feof(pInfoBlock->fd) == 0)
-					return TAP_CBM_Status_Error_Reading_data;
-				else
-					return TAP_CBM_Status_OK_End_of_file;
+				uiSignal = 2040; // 8*0xff=2040
+				uiLen = 1;
 			}
+			else
+			{
+				if (pInfoBlock->BufferLen - pInfoBlock->BufferPos < 4)
+					break; // End of file within pause.
+
+				uiSignal = pucData[3];
+				uiSignal = (uiSignal << 8) | pucData[2];
+				uiSignal = (uiSignal << 8) | pucData[1];
+				uiLen = 4;
+			}
+		}
+		else // Data detected.
+		{
+			uiSignal = ((unsigned int)pucData[0])*8;
+			uiLen = 1;
+		}
+
+		pInfoBlock->BufferPos += uiLen;
+		(*puiCounter) += uiLen;
+		puiSignals[i] = uiSignal;
+	}
+
+	*piNumSignals = i;
+
+	if ((i == 0) && (iMaxSignals > 0))
+		return TAP_CBM_Status_OK_End_of_file;
+
+	return TAP_CBM_Status_OK;
+}
+
+
+// Exported function.
+// Read a signal from image, increment counter for each read byte.
+int TAP_CBM_ReadSignal(HANDLE hHandle, unsigned int *puiSignal, unsigned int *puiCounter)
+{
+	int iNumSignals;
+
+	return TAP_CBM_ReadSignals(hHandle, puiSignal, 1, &iNumSignals, puiCounter);
+}
+
+
+// Internal function.
+// Write 32bit unsigned integer to write buffer: LSB first, MSB last.
+static int TAP_CBM_Write4Bytes(PINFOBLOCK pInfoBlock, unsigned int uiSignal, unsigned int *puiCounter)
+{
+	unsigned char ucData[4];
+	int           ret;
+
+	ucData[0] = (unsigned char) ((uiSignal      ) & 0xff);
+	ucData[1] = (unsigned char) ((uiSignal >>  8) & 0xff);
+	ucData[2] = (unsigned char) ((uiSignal >> 16) & 0xff);
+	ucData[3] = (unsigned char) ((uiSignal >> 24) & 0xff);
+
+	if ((ret = TAP_CBM_WriteBytes(pInfoBlock, ucData, 4)) != TAP_CBM_Status_OK)
+		return ret;
 
-			(*puiCounter)+=3;
+	(*puiCounter) += 4;
+
+	return TAP_CBM_Status_OK;
+}
+
+
+// Internal function.
+// Write a pause of ui64Len cycles, split into as many pause entries as the TAP version needs.
+static int TAP_CBM_WritePause(PINFOBLOCK pInfoBlock, unsigned __int64 ui64Len, unsigned int *puiCounter)
+{
+	unsigned char ucZero = 0;
+	unsigned int  numsplits, i;
+	int           ret;
+
+	if (pInfoBlock->TAPversion == TAPv2)
+	{
+		// Every TAPv2 pause entry is one halfwave, so a split pause must
+		// consist of an odd number of entries to keep the signal level.
+		if (ui64Len > 0x00ffffff)
+		{
+			numsplits = (unsigned int) (ui64Len/0x00ffffff);
+			if ((ui64Len % 0x00ffffff) != 0) numsplits++;
 
-			uiSignal = buf3[2];
-			uiSignal = (uiSignal << 8) | buf3[1];
-			uiSignal = (uiSignal << 8) | buf3[0];
-			*puiSignal = uiSignal;
+			if ((numsplits % 2) != 1)
+			{
+				// Split last 2 parts into 3, make sure last halfwave is not too short.
+				// Write (n-2) long ones, last two /3: 0.33 < length < 0.67.
+				//             even     odd      even
+				// |        |        |        |       *|
+				// |        |        |        |*       |
+				// |        |        |       *|        |
+				// |        |        |*       |        |
+				// |        |       *|        |        |
+				// |        |*       |        |        |
+
+				// First two 2/3-fractions, last 1/3 remaining.
+				for (i=1; i<=2; i++)
+				{
+					if ((ret = TAP_CBM_Write4Bytes(pInfoBlock, 0x55555500, puiCounter)) != TAP_CBM_Status_OK)
+						return ret;
+					ui64Len -= 0x00555555;
+				}
+			}
+			else if ((ui64Len % 0x00ffffff) < 0x007fffff)
+			{
+				// Make sure last halfwave is not too short: Pull 0x007fffff.
+				// Does not change numsplits.
+				if ((ret = TAP_CBM_Write4Bytes(pInfoBlock, 0x7fffff00, puiCounter)) != TAP_CBM_Status_OK)
+					return ret;
+				ui64Len -= 0x007fffff;
+			}
 		}
 	}
-	else // Data detected.
-		*puiSignal = ((unsigned int)ch)*8;
 
-	(*puiCounter)++;
+	if ((pInfoBlock->TAPversion == TAPv1) || (pInfoBlock->TAPversion == TAPv2))
+	{
+		while (ui64Len > 0x00ffffff)
+		{
+			if ((ret = TAP_CBM_Write4Bytes(pInfoBlock, 0xffffff00, puiCounter)) != TAP_CBM_Status_OK)
+				return ret;
+			ui64Len -= 0x00ffffff;
+		}
+		if (ui64Len > 0)
+		{
+			if ((ret = TAP_CBM_Write4Bytes(pInfoBlock, (unsigned int) ((ui64Len << 8) & 0xffffff00), puiCounter)) != TAP_CBM_Status_OK)
+				return ret;
+		}
+	}
+	else
+	{
+		// TAPv0: a zero byte stands for a pause of up to 2040 cycles.
+		while (ui64Len > 0)
+		{
+			if ((ret = TAP_CBM_WriteBytes(pInfoBlock, &ucZero, 1)) != TAP_CBM_Status_OK)
+				return ret;
+			(*puiCounter)++;
+			ui64Len = (ui64Len > 2040) ? ui64Len - 2040 : 0;
+		}
+	}
 
 	return TAP_CBM_Status_OK;
 }
 
 
 // Exported function.
-// Write a single unsigned char to image file.
-int TAP_CBM_WriteSignal_1Byte(HANDLE hHandle, unsigned char ucByte, unsigned int *puiCounter)
+// Write iNumSignals signals (in cycles) to image, increment counter for each written byte.
+// Signals up to 2040 cycles are written as data byte (rounded to 8 cycles), longer ones as pause.
+int TAP_CBM_WriteSignals(HANDLE hHandle, unsigned __int64 *pui64Signals, int iNumSignals, unsigned int *puiCounter)
 {
+	unsigned __int64 ui64Signal;
+	unsigned char    ucData;
+	int              i, ret;
+
 	PINFOBLOCK pInfoBlock = (struct _INFOBLOCK*)hHandle;
 
 	ASSERT(pInfoBlock != 0, TAP_CBM_Status_Error_Invalid_Handle);
 	ASSERT(pInfoBlock->fd != 0, TAP_CBM_Status_Error_File_not_open);
+	ASSERT(pui64Signals != 0, TAP_CBM_Status_Error_Invalid_pointer);
 	ASSERT(puiCounter != 0, TAP_CBM_Status_Error_Invalid_pointer);
 
-	if (fwrite(&ucByte, 1, 1, pInfoBlock->fd) != 1)
-		return TAP_CBM_Status_Error_Writing_data;
+	for (i = 0; i < iNumSignals; i++)
+	{
+		ui64Signal = pui64Signals[i];
 
-	(*puiCounter)++;
+		if (ui64Signal > 2040) // 8*0xff=2040
+		{
+			if ((ret = TAP_CBM_WritePause(pInfoBlock, ui64Signal, puiCounter)) != TAP_CBM_Status_OK)
+				return ret;
+		}
+		else
+		{
+			ucData = (unsigned char) ((ui64Signal+4)/8);
+			if ((ret = TAP_CBM_WriteBytes(pInfoBlock, &ucData, 1)) != TAP_CBM_Status_OK)
+				return ret;
+			(*puiCounter)++;
+		}
+	}
 
 	return TAP_CBM_Status_OK;
 }
 
 
 // Exported function.
-// Write 32bit unsigned integer to image file: LSB first, MSB last.
-int TAP_CBM_WriteSignal_4Bytes(HANDLE hHandle, unsigned int uiSignal, unsigned int *puiCounter)
+// Write a signal (in cycles) to image, increment counter for each written byte.
+int TAP_CBM_WriteSignal(HANDLE hHandle, unsigned __int64 ui64Signal, unsigned int *puiCounter)
+{
+	return TAP_CBM_WriteSignals(hHandle, &ui64Signal, 1, puiCounter);
+}
+
+
+// Exported function.
+// Write a single unsigned char to image file.
+int TAP_CBM_WriteSignal_1Byte(HANDLE hHandle, unsigned char ucByte, unsigned int *puiCounter)
 {
 	int ret;
 
-	if ((ret = TAP_CBM_WriteSignal_1Byte(hHandle, (uiSignal      ) & 0xff, puiCounter)) != TAP_CBM_Status_OK)
-		return ret;
+	PINFOBLOCK pInfoBlock = (struct _INFOBLOCK*)hHandle;
 
-	if ((ret = TAP_CBM_WriteSignal_1Byte(hHandle, (uiSignal >>  8) & 0xff, puiCounter)) != TAP_CBM_Status_OK)
-		return ret;
+	ASSERT(pInfoBlock != 0, TAP_CBM_Status_Error_Invalid_Handle);
+	ASSERT(pInfoBlock->fd != 0, TAP_CBM_Status_Error_File_not_open);
+	ASSERT(puiCounter != 0, TAP_CBM_Status_Error_Invalid_pointer);
 
-	if ((ret = TAP_CBM_WriteSignal_1Byte(hHandle, (uiSignal >> 16) & 0xff, puiCounter)) != TAP_CBM_Status_OK)
+	if ((ret = TAP_CBM_WriteBytes(pInfoBlock, &ucByte, 1)) != TAP_CBM_Status_OK)
 		return ret;
 
-	if ((ret = TAP_CBM_WriteSignal_1Byte(hHandle, (uiSignal >> 24) & 0xff, puiCounter)) != TAP_CBM_Status_OK)
-		return ret;
+	(*puiCounter)++;
 
 	return TAP_CBM_Status_OK;
 }
 
 
+// Exported function.
+// Write 32bit unsigned integer to image file: LSB first, MSB last.
+int TAP_CBM_WriteSignal_4Bytes(HANDLE hHandle, unsigned int uiSignal, unsigned int *puiCounter)
+{
+	PINFOBLOCK pInfoBlock = (struct _INFOBLOCK*)hHandle;
+
+	ASSERT(pInfoBlock != 0, TAP_CBM_Status_Error_Invalid_Handle);
+	ASSERT(pInfoBlock->fd != 0, TAP_CBM_Status_Error_File_not_open);
+	ASSERT(puiCounter != 0, TAP_CBM_Status_Error_Invalid_pointer);
+
+	return TAP_CBM_Write4Bytes(pInfoBlock, uiSignal, puiCounter);
+}
+
+
 // Exported function.
 // Verify header contents (Signature, Machine, Video, TAPversion).
 int TAP_CBM_isValidHeader(HANDLE hHandle)
@@ -6,7 +6,7 @@
 #ifndef __TAP_CBM_H_
 #define __TAP_CBM_H_
 
-#include <Windows.h>
+#include "tapeport.h"
 
 // Status results from exported functions
 #define TAP_CBM_Status_OK                     0
@@ -66,6 +66,17 @@ int TAP_CBM_WriteHeader(HANDLE hHandle);
 // Read a signal from image, increment counter for each read byte.
 int TAP_CBM_ReadSignal(HANDLE hHandle, unsigned int *puiSignal, unsigned int *puiCounter);
 
+// Read up to iMaxSignals signals (in cycles) from image, increment counter for each read byte.
+// Returns TAP_CBM_Status_OK_End_of_file if no signal is left.
+int TAP_CBM_ReadSignals(HANDLE hHandle, unsigned int *puiSignals, int iMaxSignals, int *piNumSignals, unsigned int *puiCounter);
+
+// Write a signal (in cycles) to image, increment counter for each written byte.
+int TAP_CBM_WriteSignal(HANDLE hHandle, unsigned __int64 ui64Signal, unsigned int *puiCounter);
+
+// Write iNumSignals signals (in cycles) to image, increment counter for each written byte.
+// Signals up to 2040 cycles are written as data byte (rounded to 8 cycles), longer ones as pause.
+int TAP_CBM_WriteSignals(HANDLE hHandle, unsigned __int64 *pui64Signals, int iNumSignals, unsigned int *puiCounter);
+
 // Write a single unsigned char to image file.
 int TAP_CBM_WriteSignal_1Byte(HANDLE hHandle, unsigned char ucByte, unsigned int *puiCounter);
 
@@ -5,7 +5,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <Windows.h>
+#include "tapeport.h"
 
 #include <arch.h>
 #include "cap.h"
@@ -19,8 +19,8 @@
 #define FREQ_C16_PAL    886724
 #define FREQ_C16_NTSC   894886
 
-#define NeedSplit            2
-#define NoSplit              3
+// Number of TAP signals converted per block.
+#define SIGNAL_BLOCK_SIZE 4096
 
 // Global variables
 unsigned __int8   CAP_Machine, CAP_Video, CAP_StartEdge, CAP_SignalFormat;
@@ -29,29 +29,6 @@ unsigned __int8   TAP_Machine, TAP_Video, TAPv;
 unsigned __int32  TAP_ByteCount;
 
 
-__int32 HandleDeltaAndWriteToCAP(HANDLE hCAP, unsigned __int64 ui64Delta, unsigned __int8 uiSplit)
-{
-	unsigned __int64 ui64SplitLen;
-	__int32          FuncRes;
-
-	if (uiSplit == NeedSplit)
-	{
-		// Write two halfwaves.
-		ui64SplitLen = ui64Delta/2;
-		Check_CAP_Error_TextRetM1(CAP_WriteSignal(hCAP, ui64SplitLen, NULL));
-		ui64SplitLen = ui64Delta-ui64SplitLen;
-		Check_CAP_Error_TextRetM1(CAP_WriteSignal(hCAP, ui64SplitLen, NULL));
-	}
-	else
-	{
-		// Write one halfwave.
-		Check_CAP_Error_TextRetM1(CAP_WriteSignal(hCAP, ui64Delta, NULL));
-	}
-
-	return 0;
-}
-
-
 __int32 Initialize_CAP_header_and_return_frequency(HANDLE hCAP, HANDLE hTAP, unsigned __int32 *puiFreq)
 {
 	__int32 FuncRes;
@@ -109,7 +86,7 @@ __int32 Initialize_CAP_header_and_return_frequency(HANDLE hCAP, HANDLE hTAP, uns
 		return -1;
 	}
 
-	FuncRes = CAP_WriteHeaderAddon(hCAP, "   Created by       TAP2CAP     ----------------", 0x30);
+	FuncRes = CAP_WriteHeaderAddon(hCAP, (unsigned char *) "   Created by       TAP2CAP     ----------------", 0x30);
 	if (FuncRes != CAP_Status_OK)
 	{
 		CAP_OutputError(FuncRes);
@@ -146,10 +123,12 @@ __int32 Initialize_CAP_header_and_return_frequency(HANDLE hCAP, HANDLE hTAP, uns
 __int32 CBMTAP2CAP(HANDLE hCAP, HANDLE hTAP)
 {
 	unsigned __int64 ui64Delta;
-	unsigned __int32 uiDelta, uiFreq;
+	unsigned __int64 *pui64CAPSignals;
+	unsigned __int32 *puiTAPSignals, uiFreq;
 	unsigned __int32 TAP_Counter = 0; // CAP & TAP file byte counters.
-	unsigned __int8  ch;
 	__int32          FuncRes;
+	int              iNumSignals, iNumCAPSignals, i;
+	__int32          RetVal = 0;
 
 	// Seek to & read image header, extract & verify header contents.
 	FuncRes = TAP_CBM_ReadHeader(hTAP);
@@ -174,34 +153,60 @@ __int32 CBMTAP2CAP(HANDLE hCAP, HANDLE hTAP)
 
 	// Start with 100us delay (can be replaced with specified start delay in tapwrite).
 	ui64Delta = CAP_Precision*100;
-	if (HandleDeltaAndWriteToCAP(hCAP, ui64Delta, NoSplit) == -1)
-		return -1;
+	Check_CAP_Error_TextRetM1(CAP_WriteSignal(hCAP, ui64Delta, NULL));
+
+	// A TAPv0/v1 signal becomes two halfwaves.
+	pui64CAPSignals = (unsigned __int64 *) malloc(2 * SIGNAL_BLOCK_SIZE * sizeof(unsigned __int64));
+	puiTAPSignals = (unsigned __int32 *) malloc(SIGNAL_BLOCK_SIZE * sizeof(unsigned __int32));
+	if ((pui64CAPSignals == NULL) || (puiTAPSignals == NULL))
+	{
+		printf("Error: Not enough memory for signal buffers.\n");
+		RetVal = -1;
+		goto exit;
+	}
 
 	// Conversion loop.
-	while ((FuncRes = TAP_CBM_ReadSignal(hTAP, &uiDelta, &TAP_Counter)) == TAP_CBM_Status_OK)
+	while ((FuncRes = TAP_CBM_ReadSignals(hTAP, puiTAPSignals, SIGNAL_BLOCK_SIZE, &iNumSignals, &TAP_Counter)) == TAP_CBM_Status_OK)
 	{
-		ui64Delta = uiDelta;
-		ui64Delta = (ui64Delta*1000000*CAP_Precision+uiFreq/2)/uiFreq;
+		iNumCAPSignals = 0;
 
-		if ((TAPv == TAPv0) || (TAPv == TAPv1))
+		for (i = 0; i < iNumSignals; i++)
 		{
-			// Generate two halfwaves.
-			if (HandleDeltaAndWriteToCAP(hCAP, ui64Delta, NeedSplit) == -1)
-				return -1;
+			ui64Delta = puiTAPSignals[i];
+			ui64Delta = (ui64Delta*1000000*CAP_Precision+uiFreq/2)/uiFreq;
+
+			if ((TAPv == TAPv0) || (TAPv == TAPv1))
+			{
+				// Generate two halfwaves.
+				pui64CAPSignals[iNumCAPSignals++] = ui64Delta/2;
+				pui64CAPSignals[iNumCAPSignals++] = ui64Delta-ui64Delta/2;
+			}
+			else
+			{
+				// Generate one halfwave.
+				pui64CAPSignals[iNumCAPSignals++] = ui64Delta;
+			}
 		}
-		else
+
+		FuncRes = CAP_WriteSignals(hCAP, pui64CAPSignals, iNumCAPSignals, NULL);
+		if (FuncRes != CAP_Status_OK)
 		{
-			// Generate one halfwave.
-			if (HandleDeltaAndWriteToCAP(hCAP, ui64Delta, NoSplit) == -1)
-				return -1;
+			CAP_OutputError(FuncRes);
+			RetVal = -1;
+			goto exit;
 		}
 	}
 
-	if (FuncRes == TAP_CBM_Status_Error_Reading_data)
+	if (FuncRes != TAP_CBM_Status_OK_End_of_file)
 	{
 		TAP_CBM_OutputError(FuncRes);
-		return -1;
+		RetVal = -1;
+		goto exit;
 	}
 
-	return 0;
+exit:
+	free(puiTAPSignals);
+	free(pui64CAPSignals);
+
+	return RetVal;
 }
@@ -6,7 +6,7 @@
 #ifndef __CBMTAP2CAP_H_
 #define __CBMTAP2CAP_H_
 
-#include <Windows.h>
+#include "tapeport.h"
 
 // Convert CBM TAP to CAP format.
 __int32 CBMTAP2CAP(HANDLE hCAP, HANDLE hTAP);
@@ -6,7 +6,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <malloc.h>
 
 #include <opencbm.h>
 #include <arch.h>
@@ -18,15 +17,15 @@
 unsigned __int8  CAP_Machine, CAP_Video, CAP_StartEdge, CAP_SignalFormat;
 unsigned __int32 CAP_Precision, CAP_SignalWidth, CAP_StartOfs;
 CBM_FILE         fd;
+__int8           *Adapter = NULL; // Adapter given with -@, default adapter if NULL.
 
 // Break handling variables
-CRITICAL_SECTION CritSec_fd, CritSec_BreakHandler;
-BOOL             fd_Initialized = FALSE, AbortTapeOps = FALSE;
+volatile BOOL    fd_Initialized = FALSE, AbortTapeOps = FALSE;
 
 
 void usage(void)
 {
-	printf("Usage: tapread <type> [buffer size] [sampling rate] <filename.cap>\n");
+	printf("Usage: tapread [-@adapter] <type> [buffer size] [sampling rate] <filename.cap>\n");
 	printf("\n");
 	printf("Please specify the tape type:\n\n");
 	printf("  -c64pal : C64 PAL     \n");
@@ -38,9 +37,10 @@ void usage(void)
 	printf("  -spec48k: Spectrum48K \n");
 	printf("  -x      : custom/unknown\n");
 	printf("\n");
-	printf("You can specify the buffer size for the capture data (optional):\n\n");
+	printf("The capture data is written to the file while the tape is playing.\n");
+	printf("Alternatively, you can capture into a buffer of fixed size first (optional):\n\n");
 	printf("  -b10 :  10 Megabyte\n");
-	printf("  -b25 :  25 Megabyte (default)\n");
+	printf("  -b25 :  25 Megabyte\n");
 	printf("  -b50 :  50 Megabyte\n");
 	printf("  -b100: 100 Megabyte\n");
 	printf("\n");
@@ -48,6 +48,9 @@ void usage(void)
 	printf("  -s1 :  1 MHz (default)\n");
 	printf("  -s16: 16 MHz (maximum precision)\n");
 	printf("\n");
+	printf("You can select the adapter (optional):\n\n");
+	printf("  -@plugin:bus : e.g. -@tapreplay:recorded.cap replays a CAP file\n");
+	printf("\n");
 	printf("Examples:\n");
 	printf("  tapread -c64pal myfile.cap\n");
 	printf("  tapread -c64pal -b50 -s16 myfile.cap");
@@ -58,13 +61,13 @@ __int32 EvaluateCommandlineParams(__int32 argc, __int8 *argv[], __int32 *piTapeB
 {
 	unsigned __int8 bTapeType = 0, bBufferSize = 0, bSamplingRate = 0; // Commandline flag counters.
 
-	if ((argc < 3) || (5 < argc))
+	if ((argc < 3) || (6 < argc))
 	{
 		printf("Error: invalid number of commandline parameters.\n\n");
 		return -1;
 	}
 
-	*piTapeBufferSize = 1024*1024*25; // Default buffer size: 25MB.
+	*piTapeBufferSize = 0; // Default: stream capture data to file.
 
 	// Evaluate flags.
 	while (--argc && (*(++argv)[0] == '-'))
@@ -149,6 +152,11 @@ __int32 EvaluateCommandlineParams(__int32 argc, __int8 *argv[], __int32 *piTapeB
 			printf("* Buffer size: 100 MB\n");
 			bBufferSize++;
 		}
+		else if ((*argv)[1] == '@')
+		{
+			Adapter = ((*argv)[2] != 0) ? &((*argv)[2]) : NULL;
+			printf("* Adapter: %s\n", (Adapter != NULL) ? Adapter : "default");
+		}
 		else if (strcmp(*argv,"-s1") == 0)
 		{
 			CAP_Precision = 1;
@@ -181,7 +189,7 @@ __int32 EvaluateCommandlineParams(__int32 argc, __int8 *argv[], __int32 *piTapeB
 
 	if (bBufferSize == 0)
 	{
-		printf("* Buffer size: 25 MB\n"); // use default value
+		printf("* Capture mode: streaming\n"); // use default value
 	}
 	else if (bBufferSize > 1)
 	{
@@ -212,7 +220,7 @@ __int32 EvaluateCommandlineParams(__int32 argc, __int8 *argv[], __int32 *piTapeB
 
 
 // Allocate memory for tape image.
-__int32 AllocateImageBuffer(void **ppucTapeBuffer, __int32 iTapeBufferSize)
+__int32 AllocateImageBuffer(unsigned __int8 **ppucTapeBuffer, __int32 iTapeBufferSize)
 {
 	if (iTapeBufferSize < 0)
 	{
@@ -250,41 +258,59 @@ void OutputTapeLength(unsigned __int32 uiTotalTapeTimeSeconds, unsigned __int32
 }
 
 
+// State of the conversion, kept across chunks of capture data.
+typedef struct
+{
+	HANDLE           hCAP;
+	unsigned __int8  Signal[5];         // Bytes of the signal being assembled.
+	__int32          iSignalLen;        // Number of bytes in Signal.
+	unsigned __int64 ui64TotalTapeTime; // Sum of all signal lengths (16 MHz).
+	unsigned __int32 uiNumSignals;
+	__int32          iCaptureLen;       // Number of capture data bytes.
+} CaptureConversion;
+
+
+void InitCaptureConversion(CaptureConversion *pConv, HANDLE hCAP)
+{
+	memset(pConv, 0, sizeof(*pConv));
+	pConv->hCAP = hCAP;
+}
+
+
 // Convert timestamps to 5 bytes, downscale precision to 1us if requested and write to CAP file.
-__int32 ConvertAndWriteCaptureData(HANDLE hCAP, unsigned __int8 *pucTapeBuffer, __int32 iCaptureLen, unsigned __int32 *puiTotalTapeTimeSeconds, unsigned __int32 *puiNumSignals)
+// A signal may be split across two chunks, its first bytes are kept in the conversion state.
+__int32 ConvertAndWriteCaptureData(CaptureConversion *pConv, unsigned __int8 *pucTapeBuffer, __int32 iCaptureLen)
 {
-	unsigned __int64 ui64Delta, ui64TotalTapeTime = 0;
-	__int32          FuncRes, i = 0;
+	unsigned __int64 ui64Delta;
+	__int32          FuncRes, i;
 
-	*puiTotalTapeTimeSeconds = 0;
-	*puiNumSignals = 0;
+	pConv->iCaptureLen += iCaptureLen;
 
-	while (i < iCaptureLen)
+	for (i = 0; i < iCaptureLen; i++)
 	{
-		ui64Delta = pucTapeBuffer[i];
-		ui64Delta = (ui64Delta << 8) + pucTapeBuffer[i+1];
+		pConv->Signal[pConv->iSignalLen++] = pucTapeBuffer[i];
 
-		if (ui64Delta < 0x8000)
-		{
-			// Short signal (<2ms)
-			i += 2;
-		}
-		else
+		// Short signal (<2ms) takes 2 bytes, long signal (>=2ms) takes 5 bytes.
+		if ((pConv->iSignalLen < 2) || ((pConv->Signal[0] & 0x80) && (pConv->iSignalLen < 5)))
+			continue;
+
+		ui64Delta = pConv->Signal[0] & 0x7f;
+		ui64Delta = (ui64Delta << 8) + pConv->Signal[1];
+
+		if (pConv->iSignalLen == 5)
 		{
-			// Long signal (>=2ms)
-			ui64Delta &= 0x7fff;
-			ui64Delta = (ui64Delta << 8) + pucTapeBuffer[i+2];
-			ui64Delta = (ui64Delta << 8) + pucTapeBuffer[i+3];
-			ui64Delta = (ui64Delta << 8) + pucTapeBuffer[i+4];
-			i += 5;
+			ui64Delta = (ui64Delta << 8) + pConv->Signal[2];
+			ui64Delta = (ui64Delta << 8) + pConv->Signal[3];
+			ui64Delta = (ui64Delta << 8) + pConv->Signal[4];
 		}
+		pConv->iSignalLen = 0;
 
-		ui64TotalTapeTime += ui64Delta;
-		(*puiNumSignals)++;
+		pConv->ui64TotalTapeTime += ui64Delta;
+		pConv->uiNumSignals++;
 
 		if (CAP_Precision == 1) ui64Delta = (ui64Delta + 8) >> 4; // downscale by 16
 
-		FuncRes = CAP_WriteSignal(hCAP, ui64Delta, NULL);
+		FuncRes = CAP_WriteSignal(pConv->hCAP, ui64Delta, NULL);
 		if (FuncRes != CAP_Status_OK)
 		{
 			CAP_OutputError(FuncRes);
@@ -292,22 +318,31 @@ __int32 ConvertAndWriteCaptureData(HANDLE hCAP, unsigned __int8 *pucTapeBuffer,
 		}
 	}
 
-	// Calculate tape length in seconds.
-	*puiTotalTapeTimeSeconds = (unsigned __int32) (((ui64TotalTapeTime + 8000000) >> 10)/15625); //16000000;
-
 	return 0;
 }
 
 
-// Write tape image to specified image file.
-__int32 WriteTapeBufferToCaptureFile(HANDLE hCAP, unsigned __int8 *pucTapeBuffer, __int32 iCaptureLen)
+// Print statistics of a finished conversion.
+void FinishCaptureConversion(CaptureConversion *pConv)
 {
-	unsigned __int32 uiTotalTapeTimeSeconds, uiNumSignals;
-	__int32          FuncRes;
+	unsigned __int32 uiTotalTapeTimeSeconds;
 
-	if (iCaptureLen == 0)
+	if (pConv->iCaptureLen == 0)
 		printf("Empty capture file.\n");
 
+	// Calculate tape length in seconds.
+	uiTotalTapeTimeSeconds = (unsigned __int32) (((pConv->ui64TotalTapeTime + 8000000) >> 10)/15625); //16000000;
+
+	// Print tape length to console.
+	OutputTapeLength(uiTotalTapeTimeSeconds, pConv->uiNumSignals, pConv->iCaptureLen);
+}
+
+
+// Write CAP header to specified image file.
+__int32 WriteCaptureHeader(HANDLE hCAP)
+{
+	__int32 FuncRes;
+
 	FuncRes = CAP_SetHeader(hCAP, CAP_Precision, CAP_Machine, CAP_Video, CAP_StartEdge, CAP_SignalFormat, CAP_SignalWidth, CAP_StartOfs);
 	if (FuncRes != CAP_Status_OK)
 	{
@@ -322,25 +357,187 @@ __int32 WriteTapeBufferToCaptureFile(HANDLE hCAP, unsigned __int8 *pucTapeBuffer
 		return -1;
 	}
 
-	FuncRes = CAP_WriteHeaderAddon(hCAP, "   Created by       ZoomTape    ----------------", 0x30);
+	FuncRes = CAP_WriteHeaderAddon(hCAP, (unsigned char *) "   Created by       ZoomTape    ----------------", 0x30);
 	if (FuncRes != CAP_Status_OK)
 	{
 		CAP_OutputError(FuncRes);
 		return -1;
 	}
 
+	return 0;
+}
+
+
+// Write tape image to specified image file.
+__int32 WriteTapeBufferToCaptureFile(HANDLE hCAP, unsigned __int8 *pucTapeBuffer, __int32 iCaptureLen)
+{
+	CaptureConversion Conv;
+
+	if (WriteCaptureHeader(hCAP) == -1)
+		return -1;
+
+	InitCaptureConversion(&Conv, hCAP);
+
 	// Convert timestamps to 5 bytes, downscale precision to 1us if requested and write to CAP file.
-	if (ConvertAndWriteCaptureData(hCAP, pucTapeBuffer, iCaptureLen, &uiTotalTapeTimeSeconds, &uiNumSignals) == -1)
+	if (ConvertAndWriteCaptureData(&Conv, pucTapeBuffer, iCaptureLen) == -1)
 		return -1;
 
-	// Print tape length to console.
-	OutputTapeLength(uiTotalTapeTimeSeconds, uiNumSignals, iCaptureLen);
+	FinishCaptureConversion(&Conv);
 
 	return 0;
 }
 
 
-__int32 CaptureTape(CBM_FILE fd, unsigned __int8 *pucTapeBuffer, __int32 iTapeBufferSize, __int32 *piCaptureLen)
+// Streaming capture: the USB transfers are done into a fixed ring of
+// buffers, which a consumer thread converts and appends to the CAP file
+// while the tape is still playing.
+
+#define STREAM_BUFFER_SIZE  32768 // One full USB transfer.
+#define STREAM_BUFFER_COUNT 64    // 2 MB in total.
+
+typedef struct
+{
+	unsigned __int8   *pucBuffer[STREAM_BUFFER_COUNT];
+	unsigned __int32   uiLength[STREAM_BUFFER_COUNT];
+	unsigned __int32   uiPut;       // Next buffer handed to the USB side.
+	unsigned __int32   uiGet;       // Next buffer converted by the consumer.
+	BOOL               bEnd[STREAM_BUFFER_COUNT]; // Marks the end of the capture.
+	ARCH_SEMAPHORE    *semFree;     // Counts buffers free for the USB side.
+	ARCH_SEMAPHORE    *semFilled;   // Counts buffers waiting for the consumer.
+	CaptureConversion  Conv;
+	volatile BOOL      bFailed;     // Conversion or file error, stop capturing.
+} CaptureStream;
+
+
+// Consumer thread: convert and write filled buffers until the end marker.
+void CaptureStreamConsumer(void *Context)
+{
+	CaptureStream *pStream = Context;
+	unsigned __int32 uiIndex;
+
+	for (;;)
+	{
+		arch_semaphore_wait(pStream->semFilled);
+		uiIndex = pStream->uiGet++ % STREAM_BUFFER_COUNT;
+
+		if (pStream->bEnd[uiIndex])
+			break;
+
+		// After an error, keep on draining so the USB side never blocks.
+		if (!pStream->bFailed &&
+		    (ConvertAndWriteCaptureData(&pStream->Conv, pStream->pucBuffer[uiIndex], pStream->uiLength[uiIndex]) == -1))
+			pStream->bFailed = TRUE;
+
+		arch_semaphore_post(pStream->semFree);
+	}
+}
+
+
+unsigned char *CaptureStreamGetBuffer(void *Context, unsigned int *Length)
+{
+	CaptureStream *pStream = Context;
+	unsigned __int32 uiIndex;
+
+	if (pStream->bFailed || AbortTapeOps)
+		return NULL;
+
+	arch_semaphore_wait(pStream->semFree);
+	uiIndex = pStream->uiPut % STREAM_BUFFER_COUNT;
+
+	*Length = STREAM_BUFFER_SIZE;
+	return pStream->pucBuffer[uiIndex];
+}
+
+
+void CaptureStreamPutBuffer(void *Context, unsigned char *Buffer, unsigned int Length)
+{
+	CaptureStream *pStream = Context;
+	unsigned __int32 uiIndex = pStream->uiPut++ % STREAM_BUFFER_COUNT;
+
+	pStream->uiLength[uiIndex] = Length;
+	pStream->bEnd[uiIndex] = FALSE;
+	arch_semaphore_post(pStream->semFilled);
+}
+
+
+// Free the ring buffers of a stream.
+void FreeCaptureStream(CaptureStream *pStream)
+{
+	__int32 i;
+
+	for (i = 0; i < STREAM_BUFFER_COUNT; i++)
+		if (pStream->pucBuffer[i] != NULL) free(pStream->pucBuffer[i]);
+
+	if (pStream->semFree != NULL) arch_semaphore_destroy(pStream->semFree);
+	if (pStream->semFilled != NULL) arch_semaphore_destroy(pStream->semFilled);
+}
+
+
+// Allocate the ring buffers of a stream.
+__int32 AllocateCaptureStream(CaptureStream *pStream, HANDLE hCAP)
+{
+	__int32 i;
+
+	memset(pStream, 0, sizeof(*pStream));
+	InitCaptureConversion(&pStream->Conv, hCAP);
+
+	for (i = 0; i < STREAM_BUFFER_COUNT; i++)
+	{
+		pStream->pucBuffer[i] = malloc(STREAM_BUFFER_SIZE);
+		if (pStream->pucBuffer[i] == NULL)
+		{
+			printf("Error: Could not allocate memory for capture data.\n");
+			FreeCaptureStream(pStream);
+			return -1;
+		}
+	}
+
+	if ((arch_semaphore_create(&pStream->semFree, STREAM_BUFFER_COUNT) != 0) ||
+	    (arch_semaphore_create(&pStream->semFilled, 0) != 0))
+	{
+		printf("Error: Could not create semaphores for capture.\n");
+		FreeCaptureStream(pStream);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// Capture the tape, writing the data to the CAP file while capturing.
+__int32 CaptureTapeStream(CBM_FILE fd, CaptureStream *pStream, __int32 *pStatus, __int32 *pBytesRead)
+{
+	ARCH_THREAD     *Consumer;
+	unsigned __int32 uiIndex;
+	__int32          FuncRes;
+
+	if (arch_thread_create(&Consumer, CaptureStreamConsumer, pStream) != 0)
+	{
+		printf("\nError [capture]: Could not start conversion thread.\n");
+		return -1;
+	}
+
+	FuncRes = cbm_tap_start_capture_stream(fd, CaptureStreamGetBuffer, CaptureStreamPutBuffer, pStream, pStatus, pBytesRead);
+
+	// The firmware keeps on sending if the capture was stopped by us.
+	if ((FuncRes < 0) && pStream->bFailed)
+		cbm_tap_break(fd);
+
+	// Tell the consumer to finish, and wait for it.
+	arch_semaphore_wait(pStream->semFree);
+	uiIndex = pStream->uiPut++ % STREAM_BUFFER_COUNT;
+	pStream->bEnd[uiIndex] = TRUE;
+	arch_semaphore_post(pStream->semFilled);
+	arch_thread_join(Consumer);
+
+	if (pStream->bFailed)
+		return -1;
+
+	return FuncRes;
+}
+
+
+__int32 CaptureTape(CBM_FILE fd, CaptureStream *pStream, unsigned __int8 *pucTapeBuffer, __int32 iTapeBufferSize, __int32 *piCaptureLen)
 {
 	unsigned __int8 ReadConfig, ReadConfig2;
 	__int32         Status, BytesRead, BytesWritten, FuncRes;
@@ -586,16 +783,21 @@ __int32 CaptureTape(CBM_FILE fd, unsigned __int8 *pucTapeBuffer, __int32 iTapeBu
 	//   - XUM1541_Error_NoTapeSupport
 	//   - XUM1541_Error_NoDiskTapeMode
 	//   - XUM1541_Error_TapeCmdInDiskMode
-	FuncRes = cbm_tap_start_capture(fd, pucTapeBuffer, iTapeBufferSize, &Status, &BytesRead);
+	if (pStream != NULL)
+		FuncRes = CaptureTapeStream(fd, pStream, &Status, &BytesRead);
+	else
+		FuncRes = cbm_tap_start_capture(fd, pucTapeBuffer, iTapeBufferSize, &Status, &BytesRead);
 	if (FuncRes < 0)
 	{
+		if (pStream != NULL && pStream->bFailed)
+			return -1; // Already reported.
 		printf("\nReturned error [capture]: ");
 		if (OutputFuncError(FuncRes) < 0)
 			printf("%d\n", FuncRes);
 		return -1;
 	}
 	*piCaptureLen = BytesRead;
-	if (*piCaptureLen >= iTapeBufferSize)
+	if ((pStream == NULL) && (*piCaptureLen >= iTapeBufferSize))
 	{
 		printf("\nError [capture]: Buffer full, use larger buffer size!\n");
 		return -1;
@@ -618,30 +820,19 @@ __int32 CaptureTape(CBM_FILE fd, unsigned __int8 *pucTapeBuffer, __int32 iTapeBu
 }
 
 
-// Break handler.
-// Initialized by SetConsoleCtrlHandler() after critical sections initialized.
-BOOL BreakHandler(DWORD fdwCtrlType)
+// Break handler, installed by arch_set_ctrlbreak_handler().
+// Runs as signal handler (Linux) or on a separate thread (Windows), so it
+// does not take any locks: the flags are only set once during an abort.
+void ARCH_SIGNALDECL BreakHandler(int dummy)
 {
-	if (fdwCtrlType == CTRL_C_EVENT)
-	{
-		printf("\nAborting...\n");
-		AbortTapeOps = TRUE; // Flag tape ops abort.
-
-		if (!TryEnterCriticalSection(&CritSec_BreakHandler))
-			return TRUE; // Already aborting.
-
-		EnterCriticalSection(&CritSec_fd); // Acquire handle flag access.
+	if (AbortTapeOps)
+		return; // Already aborting.
 
-		if (fd_Initialized)
-		{
-			cbm_tap_break(fd); // Handle valid.
-			LeaveCriticalSection(&CritSec_fd); // Release handle flag access.
-			return TRUE;
-		}
+	printf("\nAborting...\n");
+	AbortTapeOps = TRUE; // Flag tape ops abort.
 
-		LeaveCriticalSection(&CritSec_fd); // Release handle flag access.
-	}
-	return FALSE;
+	if (fd_Initialized)
+		cbm_tap_break(fd); // Handle valid.
 }
 
 
@@ -652,6 +843,7 @@ BOOL BreakHandler(DWORD fdwCtrlType)
 int ARCH_MAINDECL main(int argc, char *argv[])
 {
 	HANDLE          hCAP;
+	CaptureStream   Stream, *pStream = NULL;
 	unsigned __int8 *pucTapeBuffer = NULL;
 	__int8          filename[_MAX_PATH];
 	__int32         iCaptureLen, iTapeBufferSize = 0;
@@ -660,11 +852,7 @@ int ARCH_MAINDECL main(int argc, char *argv[])
 	printf("\ntapread v1.00 - Commodore 1530/1531 tape image creator\n");
 	printf("Copyright 2012 Arnd Menge\n\n");
 
-	InitializeCriticalSection(&CritSec_fd);
-	InitializeCriticalSection(&CritSec_BreakHandler);
-
-	if (!SetConsoleCtrlHandler((PHANDLER_ROUTINE) BreakHandler, TRUE))
-		printf("Ctrl-C break handler not installed.\n\n");
+	arch_set_ctrlbreak_handler(BreakHandler);
 
 	// Set defaults.
 	CAP_Precision    = 1;                         // Default: 1us signal precision.
@@ -680,7 +868,13 @@ int ARCH_MAINDECL main(int argc, char *argv[])
 	}
 
 	// Allocate memory for tape image.
-	if (AllocateImageBuffer(&pucTapeBuffer, iTapeBufferSize) == -1)
+	if (iTapeBufferSize == 0)
+	{
+		if (AllocateCaptureStream(&Stream, NULL) == -1)
+			goto exit;
+		pStream = &Stream;
+	}
+	else if (AllocateImageBuffer(&pucTapeBuffer, iTapeBufferSize) == -1)
 		goto exit;
 
 	// Check if specified image file is already existing.
@@ -701,25 +895,30 @@ int ARCH_MAINDECL main(int argc, char *argv[])
 		goto exit;
 	}
 
-	EnterCriticalSection(&CritSec_fd); // Acquire handle flag access.
+	// When streaming, the data follows the header while capturing.
+	if (pStream != NULL)
+	{
+		pStream->Conv.hCAP = hCAP;
+		if (WriteCaptureHeader(hCAP) == -1)
+		{
+			CAP_CloseFile(&hCAP);
+			goto exit;
+		}
+	}
 
-	if (cbm_driver_open_ex(&fd, NULL) != 0)
+	if (cbm_driver_open_ex(&fd, Adapter) != 0)
 	{
 		printf("Driver error.\n");
 		CAP_CloseFile(&hCAP);
-		LeaveCriticalSection(&CritSec_fd);
 		goto exit;
 	}
 
 	fd_Initialized = TRUE;
-	LeaveCriticalSection(&CritSec_fd); // Release handle flag access.
 
-	RetVal = CaptureTape(fd, pucTapeBuffer, iTapeBufferSize, &iCaptureLen);
+	RetVal = CaptureTape(fd, pStream, pucTapeBuffer, iTapeBufferSize, &iCaptureLen);
 
-	EnterCriticalSection(&CritSec_fd); // Acquire handle flag access.
+	fd_Initialized = FALSE; // Invalidate handle for the break handler first.
 	cbm_driver_close(fd);
-	fd_Initialized = FALSE;
-	LeaveCriticalSection(&CritSec_fd); // Release handle flag access.
 
 	if (RetVal != 0)
 	{
@@ -728,7 +927,10 @@ int ARCH_MAINDECL main(int argc, char *argv[])
 	}
 
 	// Write tape image to specified image file.
-	RetVal = WriteTapeBufferToCaptureFile(hCAP, pucTapeBuffer, iCaptureLen);
+	if (pStream != NULL)
+		FinishCaptureConversion(&pStream->Conv);
+	else
+		RetVal = WriteTapeBufferToCaptureFile(hCAP, pucTapeBuffer, iCaptureLen);
 
 	FuncRes = CAP_CloseFile(&hCAP);
 	if (FuncRes != CAP_Status_OK)
@@ -740,9 +942,8 @@ int ARCH_MAINDECL main(int argc, char *argv[])
 	printf("Capture file successfully created.\n");
 
 	exit:
-	DeleteCriticalSection(&CritSec_fd);
-	DeleteCriticalSection(&CritSec_BreakHandler);
    	if (pucTapeBuffer != NULL) free(pucTapeBuffer);
+   	if (pStream != NULL) FreeCaptureStream(pStream);
    	printf("\n");
    	return RetVal;
 }
@@ -17,10 +17,10 @@
 unsigned __int8  CAP_Machine, CAP_Video, CAP_StartEdge, CAP_SignalFormat;
 unsigned __int32 CAP_Precision, CAP_SignalWidth, CAP_StartOfs;
 CBM_FILE         fd;
+__int8           *Adapter = NULL; // Adapter given with -@, default adapter if NULL.
 
 // Break handling variables
-CRITICAL_SECTION CritSec_fd, CritSec_BreakHandler;
-BOOL             fd_Initialized = FALSE, AbortTapeOps = FALSE;
+volatile BOOL    fd_Initialized = FALSE, AbortTapeOps = FALSE;
 
 // Start/stop delay
 BOOL             StartDelayActivated = FALSE,
@@ -31,11 +31,12 @@ unsigned __int32 StartDelay = 0, // Write start delay (replaces first timestamp)
 
 void usage(void)
 {
-	printf("Usage: tapwrite [-aX] [-bY] [-bz] <filename.cap>\n");
+	printf("Usage: tapwrite [-@adapter] [-aX] [-bY] [-bz] <filename.cap>\n");
 	printf("\n");
 	printf("  -aX: wait X seconds before writing first signal (optional)\n");
 	printf("  -bY: keep on record Y seconds after last signal (optional)\n");
 	printf("  -bz: keep on record max time after last signal (optional)\n");
+	printf("  -@plugin:bus: use this adapter instead of the default one (optional)\n");
 	printf("\n");
 	printf("Examples:\n");
 	printf("  tapwrite myfile.cap\n");
@@ -49,7 +50,7 @@ __int32 EvaluateCommandlineParams(__int32 argc, __int8 *argv[], __int8 filename[
 {
 	unsigned __int8 bStartDelay = 0, bStopDelay = 0, bMaxStopDelay = 0;
 
-	if ((argc < 2) || (4 < argc))
+	if ((argc < 2) || (5 < argc))
 	{
 		printf("Error: invalid number of commandline parameters.\n\n");
 		return -1;
@@ -76,6 +77,10 @@ __int32 EvaluateCommandlineParams(__int32 argc, __int8 *argv[], __int8 filename[
 			if (StopDelay > 0) StopDelayActivated = TRUE;
 			bStopDelay++;
 		}
+		else if ((*argv)[1] == '@')
+		{
+			Adapter = ((*argv)[2] != 0) ? &((*argv)[2]) : NULL;
+		}
 		else
 		{
 			printf("\nError: invalid commandline parameter.\n\n");
@@ -90,7 +95,7 @@ __int32 EvaluateCommandlineParams(__int32 argc, __int8 *argv[], __int8 filename[
 	else if (bStartDelay == 1)
 	{
 		if (StartDelay == 0)
-			printf("* Start delay: minimum / 100us\n", StartDelay);
+			printf("* Start delay: minimum / 100us\n");
 		else if (StartDelay == 1)
 			printf("* Start delay: %u second\n", StartDelay);
 		else
@@ -141,7 +146,7 @@ __int32 EvaluateCommandlineParams(__int32 argc, __int8 *argv[], __int8 filename[
 }
 
 
-__int32 AllocateImageBuffer(HANDLE hCAP, void **ppucTapeBuffer, __int32 *piTapeBufferSize)
+__int32 AllocateImageBuffer(HANDLE hCAP, unsigned __int8 **ppucTapeBuffer, __int32 *piTapeBufferSize)
 {
 	__int32 FuncRes;
 
@@ -191,7 +196,7 @@ void OutputTapeLength(unsigned __int32 uiTotalTapeTimeSeconds)
 // Read tape image into memory.
 __int32 ReadCaptureFile(HANDLE hCAP, unsigned __int8 *pucTapeBuffer, __int32 *piCaptureLen)
 {
-	unsigned __int64 ui64Delta = 0, ShortWarning, ShortError, MinLength, ui64TotalTapeTime = 0;
+	unsigned __int64 ui64Delta = 0, ShortWarning, ShortError, ui64TotalTapeTime = 0;
 	unsigned __int32 uiTotalTapeTimeSeconds;
 	__int32          FuncRes;
 	BOOL             FirstSignal = TRUE;
@@ -248,7 +253,7 @@ __int32 ReadCaptureFile(HANDLE hCAP, unsigned __int8 *pucTapeBuffer, __int32 *pi
 		else
 			if (CAP_Precision == 1) ui64Delta <<= 4; // Convert from 1MHz to 16MHz.
 
-		if (ui64Delta < ShortWarning) printf("Warning - Short signal length detected: 0x%.10X\n", ui64Delta);
+		if (ui64Delta < ShortWarning) printf("Warning - Short signal length detected: 0x%.10" TAP_PRIX64 "\n", ui64Delta);
 		if (ui64Delta < ShortError)
 		{
 			printf("Warning - Replaced by minimum signal length.\n");
@@ -605,30 +610,19 @@ __int32 WriteTape(CBM_FILE fd, unsigned __int8 *pucTapeBuffer, unsigned __int32
 }
 
 
-// Break handler.
-// Initialized by SetConsoleCtrlHandler() after critical sections initialized.
-BOOL BreakHandler(DWORD fdwCtrlType)
+// Break handler, installed by arch_set_ctrlbreak_handler().
+// Runs as signal handler (Linux) or on a separate thread (Windows), so it
+// does not take any locks: the flags are only set once during an abort.
+void ARCH_SIGNALDECL BreakHandler(int dummy)
 {
-	if (fdwCtrlType == CTRL_C_EVENT)
-	{
-		printf("\nAborting...\n");
-		AbortTapeOps = TRUE; // Flag tape ops abort.
-
-		if (!TryEnterCriticalSection(&CritSec_BreakHandler))
-			return TRUE; // Already aborting.
+	if (AbortTapeOps)
+		return; // Already aborting.
 
-		EnterCriticalSection(&CritSec_fd); // Acquire handle flag access.
+	printf("\nAborting...\n");
+	AbortTapeOps = TRUE; // Flag tape ops abort.
 
-		if (fd_Initialized)
-		{
-			cbm_tap_break(fd); // Handle valid.
-			LeaveCriticalSection(&CritSec_fd); // Release handle flag access.
-			return TRUE;
-		}
-
-		LeaveCriticalSection(&CritSec_fd); // Release handle flag access.
-	}
-	return FALSE;
+	if (fd_Initialized)
+		cbm_tap_break(fd); // Handle valid.
 }
 
 
@@ -647,11 +641,7 @@ int ARCH_MAINDECL main(int argc, char *argv[])
 	printf("\ntapwrite v1.00 - Commodore 1530/1531 tape mastering software\n");
 	printf("Copyright 2012 Arnd Menge\n\n");
 
-	InitializeCriticalSection(&CritSec_fd);
-	InitializeCriticalSection(&CritSec_BreakHandler);
-
-	if (!SetConsoleCtrlHandler((PHANDLER_ROUTINE) BreakHandler, TRUE))
-		printf("Ctrl-C break handler not installed.\n\n");
+	arch_set_ctrlbreak_handler(BreakHandler);
 
 	if (EvaluateCommandlineParams(argc, argv, filename) == -1)
 	{
@@ -682,28 +672,20 @@ int ARCH_MAINDECL main(int argc, char *argv[])
 	if (RetVal == -1)
 		goto exit;
 
-	EnterCriticalSection(&CritSec_fd); // Acquire handle flag access.
-
-	if (cbm_driver_open_ex(&fd, NULL) != 0)
+	if (cbm_driver_open_ex(&fd, Adapter) != 0)
 	{
 		printf("Driver error.\n");
-		LeaveCriticalSection(&CritSec_fd);
 		goto exit;
 	}
 
 	fd_Initialized = TRUE;
-	LeaveCriticalSection(&CritSec_fd); // Release handle flag access.
 
 	RetVal = WriteTape(fd, pucTapeBuffer, iCaptureLen);
 
-	EnterCriticalSection(&CritSec_fd); // Acquire handle flag access.
+	fd_Initialized = FALSE; // Invalidate handle for the break handler first.
 	cbm_driver_close(fd);
-	fd_Initialized = FALSE;
-	LeaveCriticalSection(&CritSec_fd); // Release handle flag access.
 
     exit:
-	DeleteCriticalSection(&CritSec_fd);
-	DeleteCriticalSection(&CritSec_BreakHandler);
    	if (pucTapeBuffer != NULL) free(pucTapeBuffer);
    	printf("\n");
    	return RetVal;
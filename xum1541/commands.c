@@ -274,6 +274,221 @@ ioWrite2Loop(Write2Fn_t writeFn, uint16_t len)
     return 0;
 }
 
+/*
+ * Block streams. All blocks go through one endpoint transfer, so there
+ * is no command or status in between, and the host learns from the
+ * single status at the end how many blocks made it.
+ */
+static bool
+blocksRequestOk(uint8_t proto, uint8_t blocks, uint16_t blockSize)
+{
+    if (blocks == 0)
+        return false;
+
+    switch (proto) {
+    case XUM1541_S1:
+    case XUM1541_S2:
+    case XUM1541_P2:
+        return true;
+    case XUM1541_PP:
+        // Two bytes per handshake, so only whole pairs
+        return (blockSize & 1) == 0;
+    default:
+        return false;
+    }
+}
+
+static uint8_t
+ioReadBlocksLoop(uint8_t proto, uint8_t blocks, uint16_t blockSize)
+{
+    ReadFn_t readFn = NULL;
+    Read2Fn_t read2Fn = NULL;
+    uint8_t data[2], done;
+    uint16_t i;
+
+    // The caller checked the request with blocksRequestOk().
+    switch (proto) {
+    case XUM1541_S1:
+        readFn = s1_read_byte;
+        break;
+    case XUM1541_S2:
+        readFn = s2_read_byte;
+        break;
+    case XUM1541_P2:
+        readFn = p2_read_byte;
+        break;
+    case XUM1541_PP:
+        read2Fn = pp_read_2_bytes;
+        break;
+    default:
+        return 0;
+    }
+
+    usbInitIo(blocks * blockSize, ENDPOINT_DIR_IN);
+    for (done = 0; done < blocks; done++) {
+        for (i = 0; i < blockSize; i++) {
+            if (read2Fn != NULL) {
+                read2Fn(data);
+                i++;
+                if (usbSendByte(data[0]) != 0 || usbSendByte(data[1]) != 0)
+                    goto out;
+            } else if (usbSendByte(readFn()) != 0)
+                goto out;
+        }
+    }
+out:
+    usbIoDone();
+    return done;
+}
+
+static uint8_t
+ioWriteBlocksLoop(uint8_t proto, uint8_t blocks, uint16_t blockSize)
+{
+    WriteFn_t writeFn = NULL;
+    Write2Fn_t write2Fn = NULL;
+    uint8_t data[2], done;
+    uint16_t i;
+
+    // The caller checked the request with blocksRequestOk().
+    switch (proto) {
+    case XUM1541_S1:
+        writeFn = s1_write_byte;
+        break;
+    case XUM1541_S2:
+        writeFn = s2_write_byte;
+        break;
+    case XUM1541_P2:
+        writeFn = p2_write_byte;
+        break;
+    case XUM1541_PP:
+        write2Fn = pp_write_2_bytes;
+        break;
+    default:
+        return 0;
+    }
+
+    usbInitIo(blocks * blockSize, ENDPOINT_DIR_OUT);
+    for (done = 0; done < blocks; done++) {
+        for (i = 0; i < blockSize; i++) {
+            if (usbRecvByte(&data[0]) != 0)
+                goto out;
+            if (write2Fn != NULL) {
+                if (usbRecvByte(&data[1]) != 0)
+                    goto out;
+                write2Fn(data);
+                i++;
+            } else
+                writeFn(data[0]);
+        }
+    }
+out:
+    usbIoDone();
+    return done;
+}
+
+/*
+ * Warp track read. The sector results are kept back until all GCR data
+ * went out, so the data of several sectors shares each endpoint buffer.
+ */
+static uint8_t trackResults[XUM_TRACK_MAX_SECTORS * 2];
+
+static bool
+trackRequestOk(uint8_t proto, uint8_t sectors, uint8_t mapLen)
+{
+    if (sectors == 0 || sectors > XUM_TRACK_MAX_SECTORS || mapLen < 2)
+        return false;
+
+    switch (proto) {
+    case XUM1541_S1:
+    case XUM1541_S2:
+        return true;
+    case XUM1541_PP:
+        // Every byte of the warp protocol is sent as a pair
+        return (mapLen & 1) == 0;
+    default:
+        return false;
+    }
+}
+
+static uint8_t
+ioReadTrackLoop(uint8_t proto, uint8_t sectors, uint8_t mapLen)
+{
+    ReadFn_t readFn = NULL;
+    WriteFn_t writeFn = NULL;
+    uint8_t data[2], results, i;
+    uint16_t j;
+
+    // The caller checked the request with trackRequestOk().
+    switch (proto) {
+    case XUM1541_S1:
+        readFn = s1_read_byte;
+        writeFn = s1_write_byte;
+        break;
+    case XUM1541_S2:
+        readFn = s2_read_byte;
+        writeFn = s2_write_byte;
+        break;
+    case XUM1541_PP:
+        break;
+    default:
+        return 0;
+    }
+
+    // Track number, sector count and map, as prepared by the host
+    usbInitIo(mapLen, ENDPOINT_DIR_OUT);
+    for (i = 0; i < mapLen; i++) {
+        if (usbRecvByte(&data[0]) != 0)
+            break;
+        if (writeFn == NULL) {
+            if (usbRecvByte(&data[1]) != 0)
+                break;
+            pp_write_2_bytes(data);
+            i++;
+        } else
+            writeFn(data[0]);
+    }
+    usbIoDone();
+    if (i != mapLen)
+        return 0;
+
+    usbInitIo(sectors * (XUM_TRACK_GCR_SIZE + 2), ENDPOINT_DIR_IN);
+    for (results = 0; results < sectors; results++) {
+        // Sector number and job status; PP sends them in the second byte
+        if (readFn == NULL) {
+            pp_read_2_bytes(data);
+            trackResults[2 * results] = data[1];
+            pp_read_2_bytes(data);
+            trackResults[2 * results + 1] = data[1];
+        } else {
+            trackResults[2 * results] = readFn();
+            trackResults[2 * results + 1] = readFn();
+        }
+        if (trackResults[2 * results + 1] != 0) {
+            // The drive waits for a new track map now
+            results++;
+            break;
+        }
+
+        for (j = 0; j < XUM_TRACK_GCR_SIZE; j++) {
+            if (readFn == NULL) {
+                pp_read_2_bytes(data);
+                j++;
+                if (usbSendByte(data[0]) != 0 || usbSendByte(data[1]) != 0)
+                    goto out;
+            } else if (usbSendByte(readFn()) != 0)
+                goto out;
+        }
+    }
+
+    for (i = 0; i < 2 * results; i++) {
+        if (usbSendByte(trackResults[i]) != 0)
+            break;
+    }
+out:
+    usbIoDone();
+    return results;
+}
+
 static uint8_t
 ioReadNibLoop(uint16_t len, bool earlyExit)
 {
@@ -605,9 +820,11 @@ usbHandleControl(uint8_t cmd, uint8_t *replyBuf)
         if (cmds == NULL)
             return -1;
 
-        replyBuf[0] = XUM1541_VERSION;
-        replyBuf[1] = XUM1541_CAPABILITIES;
-        replyBuf[2] = currState;
+        replyBuf[XUM_DEVINFO_VERSION] = XUM1541_VERSION;
+        replyBuf[XUM_DEVINFO_CAPS] = XUM1541_CAPABILITIES;
+        replyBuf[XUM_DEVINFO_STATUS] = currState;
+        replyBuf[XUM_DEVINFO_EP_SIZE] = XUM_ENDPOINT_BULK_SIZE;
+        replyBuf[XUM_DEVINFO_MAX_BLOCKS] = 255; // one byte in the command
 
         /*
          * Our previous transaction was interrupted in the middle, say by
@@ -616,7 +833,7 @@ usbHandleControl(uint8_t cmd, uint8_t *replyBuf)
          * their new transaction.
          */
         if (cmdSeqInProgress) {
-            replyBuf[2] |= XUM1541_DOING_RESET;
+            replyBuf[XUM_DEVINFO_STATUS] |= XUM1541_DOING_RESET;
             cmdSeqInProgress = XUM1541_DOING_RESET;
             cmds->cbm_reset(false);
             SetAbortState();
@@ -629,7 +846,7 @@ usbHandleControl(uint8_t cmd, uint8_t *replyBuf)
          * that has been detected.
          */
         if (!device_running)
-            replyBuf[2] |= XUM1541_NO_DEVICE;
+            replyBuf[XUM_DEVINFO_STATUS] |= XUM1541_NO_DEVICE;
         return 8;
     case XUM1541_SHUTDOWN:
         cmdSeqInProgress = 0;
@@ -794,6 +1011,44 @@ usbHandleBulk(uint8_t *request, uint8_t *status)
         }
         break;
 
+    case XUM1541_READ_BLOCKS:
+    case XUM1541_WRITE_BLOCKS:
+        // Only the speeder protocols, and not in IEEE mode.
+        if ((currState & XUM1541_IEEE488_PRESENT)) {
+            ret = -1;
+            break;
+        }
+        proto = XUM_RW_PROTO(request[1]);
+        len = XUM_BLOCK_SIZE(request[3]);
+        DEBUGF(DBG_INFO, "blk:%d %d %d\n", proto, request[2], len);
+        if (!blocksRequestOk(proto, request[2], len)) {
+            DEBUGF(DBG_ERROR, "badblk %d\n", proto);
+            ret = -1;
+            break;
+        }
+        if (cmd == XUM1541_READ_BLOCKS)
+            len = ioReadBlocksLoop(proto, request[2], len);
+        else
+            len = ioWriteBlocksLoop(proto, request[2], len);
+        XUM_SET_STATUS_VAL(status, len);
+        break;
+
+    case XUM1541_READ_TRACK:
+        if ((currState & XUM1541_IEEE488_PRESENT)) {
+            ret = -1;
+            break;
+        }
+        proto = XUM_RW_PROTO(request[1]);
+        DEBUGF(DBG_INFO, "trk:%d %d %d\n", proto, request[2], request[3]);
+        if (!trackRequestOk(proto, request[2], request[3])) {
+            DEBUGF(DBG_ERROR, "badtrk %d\n", proto);
+            ret = -1;
+            break;
+        }
+        XUM_SET_STATUS_VAL(status,
+            ioReadTrackLoop(proto, request[2], request[3]));
+        break;
+
     /* Low-level port access */
     case XUM1541_GET_EOI:
         XUM_SET_STATUS_VAL(status, eoi ? 1 : 0);
@@ -0,0 +1,499 @@
+/*
+ * Host test of the xum1541 bulk command loops
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * commands.c is built here with the host compiler, against a mocked
+ * bulk endpoint pair and a mocked drive, and its commands are run
+ * through usbHandleBulk() as the firmware main loop would. Build and run
+ * it with "make test".
+ *
+ * The mocked endpoints behave like the AVR ones: the IN bank is sent to
+ * the host when it is full or cleared, and the OUT bank only holds one
+ * packet of host data until it is cleared. The host side of both is
+ * logged, so the tests can check the data as well as the packets.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Keep the AVR and LUFA headers out, and define what commands.c uses. */
+#define _XUM1541_H
+#include "../xum1541_types.h"
+
+#define DEBUGF(level, format, args...)
+
+#define XUM_DATA_DIR_NONE       0x0f
+#define XUM_ENDPOINT_BULK_SIZE  64
+
+#define STATUS_INIT             0
+#define STATUS_CONNECTING       1
+#define STATUS_READY            2
+#define STATUS_ACTIVE           3
+#define STATUS_ERROR            4
+
+#define ENDPOINT_DIR_IN         0x80
+#define ENDPOINT_DIR_OUT        0x00
+
+#define DELAY_MS(x)
+#define wdt_disable()
+#define cli()
+
+struct ProtocolFunctions {
+    void (*cbm_reset)(bool forever);
+    uint16_t (*cbm_raw_write)(uint16_t len, uint8_t flags);
+    uint16_t (*cbm_raw_read)(uint16_t len);
+    bool (*cbm_wait)(uint8_t line, uint8_t state);
+    uint8_t (*cbm_poll)(void);
+    void (*cbm_setrelease)(uint8_t set, uint8_t release);
+};
+
+volatile uint8_t eoi;
+volatile bool doDeviceReset;
+volatile bool device_running = true;
+
+int8_t usbHandleBulk(uint8_t *request, uint8_t *status);
+void usbInitIo(uint16_t len, uint8_t dir);
+void usbIoDone(void);
+int8_t usbSendByte(uint8_t data);
+int8_t usbRecvByte(uint8_t *data);
+
+/*
+ * Mocked endpoints
+ */
+#define HOST_BUF_SIZE   0x10000
+#define HOST_MAX_PKTS   (HOST_BUF_SIZE / XUM_ENDPOINT_BULK_SIZE + 1)
+
+static uint8_t epSelected;
+static uint8_t epIn[XUM_ENDPOINT_BULK_SIZE];
+static uint16_t epInCount;
+
+// Everything sent to the host, and the size of each packet
+static uint8_t hostIn[HOST_BUF_SIZE];
+static uint32_t hostInLen;
+static uint16_t hostInPkts[HOST_MAX_PKTS];
+static uint32_t hostInPktCount;
+
+// The data the host sends, the OUT bank is a window of one packet on it
+static uint8_t hostOut[HOST_BUF_SIZE];
+static uint32_t hostOutLen, epOutPos, epOutEnd;
+
+// Host aborts (device reset) once this many bytes were sent to it
+static long abortAfter = -1;
+
+// Guard against a loop waiting for an endpoint that never gets ready
+static unsigned long spins;
+
+static void
+hostReset(void)
+{
+    epInCount = hostInLen = hostInPktCount = 0;
+    hostOutLen = epOutPos = epOutEnd = 0;
+    abortAfter = -1;
+    doDeviceReset = false;
+}
+
+// Queue data from the host; the first packet goes into the OUT bank
+static void
+hostSend(const uint8_t *data, uint32_t len)
+{
+    memcpy(hostOut + hostOutLen, data, len);
+    hostOutLen += len;
+    if (epOutPos == epOutEnd) {
+        epOutEnd = epOutPos + XUM_ENDPOINT_BULK_SIZE;
+        if (epOutEnd > hostOutLen)
+            epOutEnd = hostOutLen;
+    }
+}
+
+static void
+Endpoint_SelectEndpoint(uint8_t ep)
+{
+    epSelected = ep;
+}
+
+static bool
+Endpoint_IsReadWriteAllowed(void)
+{
+    if (++spins > 1000000) {
+        fprintf(stderr, "endpoint %d never gets ready\n", epSelected);
+        exit(EXIT_FAILURE);
+    }
+    if (epSelected == XUM_BULK_IN_ENDPOINT)
+        return epInCount < XUM_ENDPOINT_BULK_SIZE;
+    if (epOutPos < epOutEnd)
+        return true;
+    // The firmware waits for data the host never sends, so it gives up
+    if (spins > 1000)
+        doDeviceReset = true;
+    return false;
+}
+
+static uint16_t
+Endpoint_BytesInEndpoint(void)
+{
+    if (epSelected == XUM_BULK_IN_ENDPOINT)
+        return epInCount;
+    return epOutEnd - epOutPos;
+}
+
+static void
+Endpoint_ClearIN(void)
+{
+    memcpy(hostIn + hostInLen, epIn, epInCount);
+    hostInLen += epInCount;
+    hostInPkts[hostInPktCount++] = epInCount;
+    epInCount = 0;
+    spins = 0;
+}
+
+static void
+Endpoint_ClearOUT(void)
+{
+    // Drop the rest of the bank and take the next packet of the host
+    epOutPos = epOutEnd;
+    epOutEnd = epOutPos + XUM_ENDPOINT_BULK_SIZE;
+    if (epOutEnd > hostOutLen)
+        epOutEnd = hostOutLen;
+    spins = 0;
+}
+
+static void
+Endpoint_Write_Byte(uint8_t data)
+{
+    epIn[epInCount++] = data;
+    if (abortAfter >= 0 && hostInLen + epInCount >= abortAfter)
+        doDeviceReset = true;
+}
+
+static uint8_t
+Endpoint_Read_Byte(void)
+{
+    return hostOut[epOutPos++];
+}
+
+static uint8_t
+AbortOnReset(void)
+{
+    return doDeviceReset;
+}
+
+static void
+Endpoint_Discard_Stream(uint16_t len, uint8_t (*callback)(void))
+{
+    while (len-- > 0 && !callback()) {
+        if (!Endpoint_IsReadWriteAllowed())
+            Endpoint_ClearOUT();
+        if (!callback())
+            epOutPos++;
+    }
+}
+
+static void Endpoint_ClearSETUP(void) { }
+static bool Endpoint_IsINReady(void) { return true; }
+static void USB_ShutDown(void) { }
+static void cpu_bootloader_start(void) { }
+static void board_set_status(uint8_t status) { (void)status; }
+static void board_init_iec(void) { }
+static void SetAbortState(void) { }
+
+/*
+ * Mocked drive: the protocol read functions return drvData, the write
+ * functions append to drvSink. PP moves two bytes per handshake.
+ */
+static uint8_t drvData[HOST_BUF_SIZE], drvSink[HOST_BUF_SIZE];
+static uint32_t drvPos, drvSinkLen;
+
+// Fill drvData with a pattern that differs for every block size
+static void
+drvReset(uint8_t seed)
+{
+    uint32_t i;
+
+    for (i = 0; i < sizeof(drvData); i++)
+        drvData[i] = (uint8_t)(i * 7 + seed + (i >> 8));
+    drvPos = drvSinkLen = 0;
+}
+
+uint8_t s1_read_byte(void) { return drvData[drvPos++]; }
+uint8_t s2_read_byte(void) { return drvData[drvPos++]; }
+uint8_t p2_read_byte(void) { return drvData[drvPos++]; }
+void s1_write_byte(uint8_t c) { drvSink[drvSinkLen++] = c; }
+void s2_write_byte(uint8_t c) { drvSink[drvSinkLen++] = c; }
+void p2_write_byte(uint8_t c) { drvSink[drvSinkLen++] = c; }
+
+void
+pp_read_2_bytes(uint8_t *c)
+{
+    c[0] = drvData[drvPos++];
+    c[1] = drvData[drvPos++];
+}
+
+void
+pp_write_2_bytes(uint8_t *c)
+{
+    drvSink[drvSinkLen++] = c[0];
+    drvSink[drvSinkLen++] = c[1];
+}
+
+// The rest of the firmware is not used by the tested commands
+uint8_t nib_parburst_read(void) { return 0; }
+int8_t nib_read_handshaked(uint8_t *c, uint8_t t) { (void)t; *c = 0; return 0; }
+void nib_parburst_write(uint8_t data) { (void)data; }
+int8_t nib_write_handshaked(uint8_t data, uint8_t t) { (void)data; (void)t; return 0; }
+#define IO_DATA 0x01
+static void iec_release(uint8_t line) { (void)line; }
+uint8_t iec_pp_read(void) { return 0; }
+void iec_pp_write(uint8_t data) { (void)data; }
+struct ProtocolFunctions *iec_init(void) { return NULL; }
+
+#include "../commands.c"
+
+/*
+ * Tests
+ */
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", \
+                __FILE__, __LINE__, __func__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// Run one bulk command as main() does, return its status value or -1
+static int
+runBulk(uint8_t cmd, uint8_t proto, uint8_t arg1, uint8_t arg2)
+{
+    uint8_t request[XUM_CMDBUF_SIZE], status[XUM_STATUSBUF_SIZE];
+    int8_t ret;
+
+    request[0] = cmd;
+    request[1] = proto;
+    request[2] = arg1;
+    request[3] = arg2;
+    memset(status, 0, sizeof(status));
+    ret = usbHandleBulk(request, status);
+    if (ret < 0)
+        return -1;
+    return XUM_GET_STATUS_VAL(status);
+}
+
+// Every packet but the last one of a transfer is a full one
+static bool
+hostPacketsOk(void)
+{
+    uint32_t i;
+
+    for (i = 0; i + 1 < hostInPktCount; i++) {
+        if (hostInPkts[i] != XUM_ENDPOINT_BULK_SIZE)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Block streams
+ */
+static void
+testReadBlocks(uint8_t proto, uint8_t blocks, uint16_t blockSize)
+{
+    uint32_t size = (uint32_t)blocks * blockSize;
+
+    hostReset();
+    drvReset(blocks);
+    CHECK(runBulk(XUM1541_READ_BLOCKS, proto, blocks,
+        blockSize & 0xff) == blocks);
+    CHECK(hostInLen == size);
+    CHECK(drvPos == size);
+    CHECK(memcmp(hostIn, drvData, size) == 0);
+    CHECK(hostPacketsOk());
+    // A full last packet lets the status follow without a short packet
+    if (size % XUM_ENDPOINT_BULK_SIZE == 0)
+        CHECK(hostInPkts[hostInPktCount - 1] == XUM_ENDPOINT_BULK_SIZE);
+}
+
+static void
+testWriteBlocks(uint8_t proto, uint8_t blocks, uint16_t blockSize)
+{
+    uint32_t size = (uint32_t)blocks * blockSize;
+
+    hostReset();
+    drvReset(blocks);
+    hostSend(drvData, size);
+    CHECK(runBulk(XUM1541_WRITE_BLOCKS, proto, blocks,
+        blockSize & 0xff) == blocks);
+    CHECK(drvSinkLen == size);
+    CHECK(memcmp(drvSink, drvData, size) == 0);
+    CHECK(epOutPos == hostOutLen);
+}
+
+static void
+testBlocks(void)
+{
+    testReadBlocks(XUM1541_S1, 255, 256);
+    testReadBlocks(XUM1541_S2, 1, 256);
+    testReadBlocks(XUM1541_S2, 17, 3);
+    testReadBlocks(XUM1541_P2, 4, 200);
+    testReadBlocks(XUM1541_PP, 3, 254);
+    testReadBlocks(XUM1541_PP, 32, 256);
+
+    testWriteBlocks(XUM1541_S1, 2, 256);
+    testWriteBlocks(XUM1541_S2, 9, 100);
+    testWriteBlocks(XUM1541_P2, 1, 1);
+    testWriteBlocks(XUM1541_PP, 4, 250);
+    testWriteBlocks(XUM1541_PP, 255, 256);
+
+    // The host aborts in the third block: two made it
+    hostReset();
+    drvReset(0);
+    abortAfter = 600;
+    CHECK(runBulk(XUM1541_READ_BLOCKS, XUM1541_S2, 4, 0) == 2);
+    CHECK(hostInLen <= 600 + XUM_ENDPOINT_BULK_SIZE);
+
+    // The host sends less than announced: one block made it
+    hostReset();
+    drvReset(0);
+    hostSend(drvData, 300);
+    CHECK(runBulk(XUM1541_WRITE_BLOCKS, XUM1541_S1, 2, 0) == 1);
+    CHECK(drvSinkLen == 300);
+
+    // Invalid requests are refused before anything is transferred
+    hostReset();
+    drvReset(0);
+    CHECK(runBulk(XUM1541_READ_BLOCKS, XUM1541_S1, 0, 0) == -1);
+    CHECK(runBulk(XUM1541_READ_BLOCKS, XUM1541_PP, 1, 255) == -1);
+    CHECK(runBulk(XUM1541_WRITE_BLOCKS, XUM1541_PP, 2, 3) == -1);
+    CHECK(runBulk(XUM1541_READ_BLOCKS, XUM1541_NIB, 1, 0) == -1);
+    CHECK(runBulk(XUM1541_WRITE_BLOCKS, XUM1541_CBM, 1, 0) == -1);
+    CHECK(hostInLen == 0 && drvPos == 0 && drvSinkLen == 0);
+}
+
+/*
+ * Warp track read. The drive answers every sector with its number and
+ * job status, then the GCR data if the status is 0. With PP, the header
+ * bytes come as the second byte of a pair.
+ */
+static uint16_t
+drvTrack(uint8_t proto, uint8_t sectors, int failAt, uint8_t *gcr,
+    uint8_t *results)
+{
+    uint32_t pos = 0;
+    uint16_t gcrLen = 0;
+    uint8_t i, j;
+
+    drvReset(sectors);
+    for (i = 0; i < sectors; i++) {
+        results[2 * i] = (i * 11) % sectors;
+        results[2 * i + 1] = (i == failAt) ? 5 : 0;
+        if (proto == XUM1541_PP) {
+            drvData[pos++] = 0xee;
+            drvData[pos++] = results[2 * i];
+            drvData[pos++] = 0xee;
+            drvData[pos++] = results[2 * i + 1];
+        } else {
+            drvData[pos++] = results[2 * i];
+            drvData[pos++] = results[2 * i + 1];
+        }
+        if (i == failAt)
+            break;
+        for (j = 0; j < XUM_TRACK_GCR_SIZE / 2; j++) {
+            gcr[gcrLen++] = drvData[pos++];
+            gcr[gcrLen++] = drvData[pos++];
+        }
+    }
+    return gcrLen;
+}
+
+static void
+testReadTrack(uint8_t proto, uint8_t sectors, int failAt, uint8_t mapLen)
+{
+    static uint8_t gcr[XUM_TRACK_MAX_SECTORS * XUM_TRACK_GCR_SIZE];
+    uint8_t results[XUM_TRACK_MAX_SECTORS * 2], map[256];
+    uint16_t gcrLen, i;
+    uint8_t sent;
+
+    for (i = 0; i < mapLen; i++)
+        map[i] = i + 1;
+    sent = (failAt >= 0 && failAt < sectors) ? failAt + 1 : sectors;
+
+    hostReset();
+    gcrLen = drvTrack(proto, sectors, failAt, gcr, results);
+    hostSend(map, mapLen);
+    CHECK(runBulk(XUM1541_READ_TRACK, proto, sectors, mapLen) == sent);
+
+    // The map went to the drive, the host gets GCR data and trailer
+    CHECK(drvSinkLen == mapLen);
+    CHECK(memcmp(drvSink, map, mapLen) == 0);
+    CHECK(hostInLen == gcrLen + 2 * sent);
+    CHECK(memcmp(hostIn, gcr, gcrLen) == 0);
+    CHECK(memcmp(hostIn + gcrLen, results, 2 * sent) == 0);
+    CHECK(hostPacketsOk());
+    // A stream ending early must still end with a short packet
+    if (sent < sectors && hostInLen % XUM_ENDPOINT_BULK_SIZE == 0)
+        CHECK(hostInPkts[hostInPktCount - 1] == 0);
+}
+
+static void
+testTrack(void)
+{
+    uint8_t gcr[XUM_TRACK_GCR_SIZE * 5], results[10], map[5] = { 1, 2, 3 };
+
+    testReadTrack(XUM1541_S1, 21, -1, 5);
+    testReadTrack(XUM1541_S2, 17, 7, 23);
+    testReadTrack(XUM1541_S1, 21, 20, 5);
+    testReadTrack(XUM1541_S1, 1, -1, 2);
+    testReadTrack(XUM1541_PP, 19, -1, 10);
+    testReadTrack(XUM1541_PP, 3, 0, 44);
+    testReadTrack(XUM1541_PP, 21, 12, 2);
+
+    // The host aborts during the GCR data of the fourth sector
+    hostReset();
+    drvTrack(XUM1541_S1, 5, -1, gcr, results);
+    hostSend(map, 5);
+    abortAfter = 1000;
+    CHECK(runBulk(XUM1541_READ_TRACK, XUM1541_S1, 5, 5) == 3);
+    CHECK(hostInLen <= 1000 + XUM_ENDPOINT_BULK_SIZE);
+
+    // Without the whole map, the drive is not asked for anything
+    hostReset();
+    drvTrack(XUM1541_S2, 5, -1, gcr, results);
+    hostSend(map, 3);
+    CHECK(runBulk(XUM1541_READ_TRACK, XUM1541_S2, 5, 5) == 0);
+    CHECK(drvPos == 0 && hostInLen == 0);
+
+    // Invalid requests are refused before anything is transferred
+    hostReset();
+    drvReset(0);
+    CHECK(runBulk(XUM1541_READ_TRACK, XUM1541_S1, 0, 5) == -1);
+    CHECK(runBulk(XUM1541_READ_TRACK, XUM1541_S1,
+        XUM_TRACK_MAX_SECTORS + 1, 5) == -1);
+    CHECK(runBulk(XUM1541_READ_TRACK, XUM1541_S1, 5, 1) == -1);
+    CHECK(runBulk(XUM1541_READ_TRACK, XUM1541_PP, 5, 5) == -1);
+    CHECK(runBulk(XUM1541_READ_TRACK, XUM1541_P2, 5, 6) == -1);
+    CHECK(hostInLen == 0 && drvPos == 0 && drvSinkLen == 0);
+}
+
+int
+main(void)
+{
+    testBlocks();
+    testTrack();
+
+    if (failures == 0) {
+        printf("all tests passed\n");
+        return EXIT_SUCCESS;
+    }
+    printf("%d checks failed\n", failures);
+    return EXIT_FAILURE;
+}
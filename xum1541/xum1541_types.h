@@ -45,10 +45,15 @@
 #define XUM1541_CAP_TAP             0
 #endif
 
+#define XUM1541_CAP_BLOCKS          0x20 // XUM1541_READ/WRITE_BLOCKS
+#define XUM1541_CAP_TRACK           0x40 // XUM1541_READ_TRACK
+
 #define XUM1541_CAPABILITIES        (XUM1541_CAP_CBM |      \
                                      XUM1541_CAP_NIB |      \
                                      XUM1541_CAP_TAP |      \
-                                     XUM1541_CAP_IEEE488)
+                                     XUM1541_CAP_IEEE488 |  \
+                                     XUM1541_CAP_BLOCKS |   \
+                                     XUM1541_CAP_TRACK)
 
 // Actual auto-detected status
 #define XUM1541_DOING_RESET         0x01 // no clean shutdown, will reset now
@@ -61,6 +66,16 @@
 #define XUM_STATUSBUF_SIZE          3 // Waiting status value (in)
 #define XUM_DEVINFO_SIZE            8 // Response to XUM1541_INIT msg (in)
 
+/*
+ * Layout of the XUM1541_INIT response. Older firmware sends zeros after
+ * the status byte, so the host has to use defaults for those fields.
+ */
+#define XUM_DEVINFO_VERSION         0 // XUM1541_VERSION
+#define XUM_DEVINFO_CAPS            1 // XUM1541_CAP_xxx
+#define XUM_DEVINFO_STATUS          2 // XUM1541_DOING_RESET etc.
+#define XUM_DEVINFO_EP_SIZE         3 // bulk endpoint size in bytes
+#define XUM_DEVINFO_MAX_BLOCKS      4 // blocks per XUM1541_READ/WRITE_BLOCKS
+
 /*
  * Control msg command timeout. Since the longest command we run in this
  * mode is XUM1541_RESET (or INIT if it has to run RESET), we chose a
@@ -74,6 +89,29 @@
 #define XUM1541_READ                8
 #define XUM1541_WRITE               (XUM1541_READ + 1)
 
+/*
+ * Block streams: transfer a number of equally sized blocks with one
+ * command, followed by a single status whose value is the number of
+ * blocks transferred completely. The command block holds the protocol
+ * (S1, S2, PP or P2), the block count and the block size (0 = 256).
+ */
+#define XUM1541_READ_BLOCKS         (XUM1541_READ + 2)
+#define XUM1541_WRITE_BLOCKS        (XUM1541_READ + 3)
+#define XUM_BLOCK_SIZE(x)           ((x) == 0 ? 256 : (x))
+
+/*
+ * Warp track read for d64copy: the command block holds the protocol
+ * (S1, S2 or PP), the number of sectors and the size of the track map.
+ * The map is written to the drive, which answers every sector with its
+ * number, a job status and, if that is 0, the GCR data. The host gets
+ * the GCR blocks back to back, then a trailer with a sector number and
+ * status pair per sector. The status value is the number of pairs; the
+ * drive stops after the first failed sector.
+ */
+#define XUM1541_READ_TRACK          (XUM1541_READ + 4)
+#define XUM_TRACK_MAX_SECTORS       21
+#define XUM_TRACK_GCR_SIZE          326
+
 /*
  * Maximum size for USB transfers (read/write commands, all protocols).
  * This should be ok for the raw USB protocol. I haven't tested this much